@@ -626,6 +626,29 @@ environment variable or by passing "-k" flag to this script.
         Set the retry times for service control Report request.
         Must be >= 0 and the default is 5 if not set.
         ''')
+    parser.add_argument(
+        '--service_control_enable_http2',
+        action='store_true',
+        help='''
+        Use HTTP/2 to call service control, so the Check, Quota and Report
+        calls of a worker are multiplexed on a few long-lived connections.
+        ''')
+    parser.add_argument(
+        '--service_control_max_concurrent_streams',
+        default=None,
+        help='''
+        The maximum number of concurrent calls on one HTTP/2 connection to
+        service control. A new connection is opened when it is reached.
+        Requires --service_control_enable_http2.
+        ''')
+    parser.add_argument(
+        '--service_control_keepalive_interval_ms',
+        default=None,
+        help='''
+        The interval in millisecond at which HTTP/2 PING frames are sent on
+        idle connections to service control, so they are kept open and
+        detected when broken. Requires --service_control_enable_http2.
+        ''')
     parser.add_argument(
         '--backend_retry_ons',
         default=None,
@@ -1164,6 +1187,21 @@ def gen_proxy_config(args):
             args.service_control_report_retries
         ])
 
+    if args.service_control_enable_http2:
+        proxy_conf.append("--service_control_enable_http2")
+
+    if args.service_control_max_concurrent_streams:
+        proxy_conf.extend([
+            "--service_control_max_concurrent_streams",
+            args.service_control_max_concurrent_streams
+        ])
+
+    if args.service_control_keepalive_interval_ms:
+        proxy_conf.extend([
+            "--service_control_keepalive_interval_ms",
+            args.service_control_keepalive_interval_ms
+        ])
+
     if args.service_control_check_timeout_ms:
         proxy_conf.extend([
             "--service_control_check_timeout_ms",
@@ -37,10 +37,13 @@ namespace {
 // Variable = "{" FieldPath [ "=" Segments ] "}" ;
 // FieldPath = IDENT { "." IDENT } ;
 // Verb     = ":" LITERAL ;
+//
+// The parser reads the input in a single pass. Literals and identifiers are
+// scanned for their delimiter and copied into their segment at once.
 class Parser {
  public:
   Parser(const std::string& input)
-      : input_(input), tb_(0), te_(0), in_variable_(false) {}
+      : input_(input), pos_(0), in_variable_(false) {}
 
   bool Parse() {
     if (!ParseTemplate() || !ConsumedAllInput()) {
@@ -116,13 +119,13 @@ class Parser {
         Consume('*');
         if (Consume('*')) {
           // **
-          segments_.push_back("**");
+          segments_.emplace_back(HttpTemplate::kWildCardPathKey);
           if (in_variable_) {
             return MarkVariableHasWildCardPath();
           }
           return true;
         } else {
-          segments_.push_back("*");
+          segments_.emplace_back(HttpTemplate::kWildCardPathPartKey);
           return true;
         }
       }
@@ -151,7 +154,7 @@ class Parser {
       }
     } else {
       // {field_path} is equivalent to {field_path=*}
-      segments_.push_back("*");
+      segments_.emplace_back(HttpTemplate::kWildCardPathPartKey);
     }
     if (!EndVariable()) {
       return false;
@@ -167,7 +170,7 @@ class Parser {
     if (!ParseLiteral(&ls)) {
       return false;
     }
-    segments_.push_back(ls);
+    segments_.push_back(std::move(ls));
     return true;
   }
 
@@ -193,85 +196,48 @@ class Parser {
 
   bool ParseIdentifier() {
     std::string idf;
-
-    // Initialize to false to handle empty literal.
-    bool result = false;
-
-    while (NextChar()) {
-      char c;
-      switch (c = current_char()) {
-        case '.':
-        case '}':
-        case '=':
-          return result && AddFieldIdentifier(std::move(idf));
-        default:
-          Consume(c);
-          idf.push_back(c);
-          break;
-      }
-      result = true;
+    if (!ScanUntil(".}=", &idf)) {
+      // Empty identifier.
+      return false;
     }
-    return result && AddFieldIdentifier(std::move(idf));
+    return AddFieldIdentifier(std::move(idf));
   }
 
   bool ParseLiteral(std::string* lit) {
-    if (!EnsureCurrent()) {
-      return false;
-    }
-
-    // Initialize to false in case we encounter an empty literal.
-    bool result = false;
-
-    for (;;) {
-      char c;
-      switch (c = current_char()) {
-        case '/':
-        case ':':
-        case '}':
-          return result;
-        default:
-          Consume(c);
-          lit->push_back(c);
-          break;
-      }
-
-      result = true;
-
-      if (!NextChar()) {
-        break;
-      }
-    }
-    return result;
+    // Fails on an empty literal.
+    return ScanUntil("/:}", lit);
   }
 
-  bool Consume(char c) {
-    if (tb_ >= te_ && !NextChar()) {
-      return false;
+  // Moves to the first of the delimiters, or the end of the input, and
+  // appends the characters passed to `token`. Returns false if there were
+  // none.
+  bool ScanUntil(const char* delimiters, std::string* token) {
+    size_t end = input_.find_first_of(delimiters, pos_);
+    if (end == std::string::npos) {
+      end = input_.size();
     }
-    if (current_char() != c) {
+    if (end == pos_) {
       return false;
     }
-    tb_++;
+    token->append(input_, pos_, end - pos_);
+    pos_ = end;
     return true;
   }
 
-  bool ConsumedAllInput() { return tb_ >= input_.size(); }
-
-  bool EnsureCurrent() { return tb_ < te_ || NextChar(); }
-
-  bool NextChar() {
-    if (te_ < input_.size()) {
-      te_++;
-      return true;
-    } else {
+  bool Consume(char c) {
+    if (!EnsureCurrent() || current_char() != c) {
       return false;
     }
+    pos_++;
+    return true;
   }
 
-  // Returns the character looked at.
-  char current_char() const {
-    return tb_ < te_ && te_ <= input_.size() ? input_[te_ - 1] : -1;
-  }
+  bool ConsumedAllInput() { return pos_ >= input_.size(); }
+
+  bool EnsureCurrent() { return pos_ < input_.size(); }
+
+  // Returns the character looked at. Only valid if EnsureCurrent().
+  char current_char() const { return input_[pos_]; }
 
   HttpTemplate::Variable& CurrentVariable() { return variables_.back(); }
 
@@ -345,9 +311,8 @@ class Parser {
 
   const std::string& input_;
 
-  // Token delimiter indexes
-  size_t tb_;
-  size_t te_;
+  // The position of the next character to read.
+  size_t pos_;
 
   // are we in nested Segments of a variable?
   bool in_variable_;
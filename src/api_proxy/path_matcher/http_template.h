@@ -23,6 +23,8 @@ namespace path_matcher {
 
 class HttpTemplate {
  public:
+  // Returns nullptr if the template is invalid. Has no shared state, so
+  // templates can be parsed on several threads.
   static std::unique_ptr<HttpTemplate> Parse(const std::string& ht);
   const std::vector<std::string>& segments() const { return segments_; }
   const std::string& verb() const { return verb_; }
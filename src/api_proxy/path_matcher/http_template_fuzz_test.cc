@@ -1,6 +1,8 @@
+#include "absl/strings/str_cat.h"
 #include "src/api_proxy/path_matcher/http_template.h"
 #include "test/fuzz/fuzz_runner.h"
 #include "test/fuzz/utility.h"
+#include "tests/fuzz/fuzz_time_limit.h"
 #include "tests/fuzz/structured_inputs/http_template.pb.validate.h"
 
 namespace espv2 {
@@ -10,6 +12,8 @@ namespace fuzz {
 DEFINE_PROTO_FUZZER(
     const espv2::tests::fuzz::protos::HttpTemplateInput& input) {
   for (const auto& path : input.paths()) {
+    espv2::tests::fuzz::FuzzTimeLimit time_limit(
+        absl::StrCat("HttpTemplate::Parse(", path, ")"));
     HttpTemplate::Parse(path);
   }
 }
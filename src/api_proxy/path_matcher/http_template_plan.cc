@@ -0,0 +1,103 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/path_matcher/http_template_plan.h"
+
+#include "src/api_proxy/utils/memory_bytes.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace path_matcher {
+
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::VectorBytes;
+
+std::unique_ptr<HttpTemplatePlan> HttpTemplatePlan::Create(
+    const std::string& path_template) {
+  std::unique_ptr<HttpTemplate> ht = HttpTemplate::Parse(path_template);
+  if (ht == nullptr) {
+    return nullptr;
+  }
+  return std::unique_ptr<HttpTemplatePlan>(new HttpTemplatePlan(*ht));
+}
+
+HttpTemplatePlan::HttpTemplatePlan(HttpTemplate& ht)
+    : segments_(ht.segments()), variables_(std::move(ht.Variables())) {
+  if (!ht.verb().empty()) {
+    segments_.push_back(ht.verb());
+    custom_verbs_.insert(ht.verb());
+  }
+  wildcard_path_ = segments_.size();
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    if (segments_[i] == HttpTemplate::kWildCardPathKey) {
+      wildcard_path_ = i;
+      break;
+    }
+  }
+}
+
+size_t HttpTemplatePlan::Bytes() const {
+  size_t bytes =
+      sizeof(*this) + VectorBytes(segments_) + VectorBytes(variables_);
+  for (const std::string& segment : segments_) {
+    bytes += HeapBytes(segment);
+  }
+  // A tree node per verb, with its links and color.
+  for (const std::string& verb : custom_verbs_) {
+    bytes += 4 * sizeof(void*) + sizeof(verb) + HeapBytes(verb);
+  }
+  for (const HttpTemplate::Variable& var : variables_) {
+    bytes += VectorBytes(var.field_path);
+    for (const std::string& field : var.field_path) {
+      bytes += HeapBytes(field);
+    }
+  }
+  return bytes;
+}
+
+bool HttpTemplatePlan::MatchParts(
+    const PathMatcherNode::RequestPathParts& parts) const {
+  if (wildcard_path_ == segments_.size()) {
+    return parts.size() == segments_.size() &&
+           MatchSegments(0, segments_.size(), parts, 0);
+  }
+
+  // A "**" at the end also matches no parts, one followed by literals
+  // matches at least one.
+  const size_t suffix_size = segments_.size() - wildcard_path_ - 1;
+  const size_t min_wildcard_parts = suffix_size == 0 ? 0 : 1;
+  if (parts.size() < wildcard_path_ + min_wildcard_parts + suffix_size) {
+    return false;
+  }
+  return MatchSegments(0, wildcard_path_, parts, 0) &&
+         MatchSegments(wildcard_path_ + 1, segments_.size(), parts,
+                       parts.size() - suffix_size);
+}
+
+bool HttpTemplatePlan::MatchSegments(
+    size_t begin, size_t end, const PathMatcherNode::RequestPathParts& parts,
+    size_t first_part) const {
+  for (size_t i = begin; i < end; ++i) {
+    const std::string& segment = segments_[i];
+    if (segment != HttpTemplate::kWildCardPathPartKey &&
+        segment != parts[first_part + i - begin]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace path_matcher
+}  // namespace api_proxy
+}  // namespace espv2
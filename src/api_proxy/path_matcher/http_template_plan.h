@@ -0,0 +1,85 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "src/api_proxy/path_matcher/http_template.h"
+#include "src/api_proxy/path_matcher/path_matcher.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace path_matcher {
+
+// Matches request paths against a single http template, for callers with one
+// template per config. The request parts are compared with the template
+// segments by position: the segments a "**" is followed by are literals, so
+// they are matched against the last parts. No trie is built.
+//
+// A plan matches exactly like a PathMatcher that only has the template
+// registered.
+class HttpTemplatePlan {
+ public:
+  // Returns nullptr if the template is invalid.
+  static std::unique_ptr<HttpTemplatePlan> Create(
+      const std::string& path_template);
+
+  // Returns true if the path matches. Then calls
+  // visit_binding(field_path, value) for each variable of the template, in
+  // its order; the value views `path`.
+  template <typename BindingVisitor>
+  bool Match(absl::string_view path, BindingVisitor visit_binding) const;
+
+  // The memory held by the plan, roughly.
+  size_t Bytes() const;
+
+ private:
+  explicit HttpTemplatePlan(HttpTemplate& ht);
+
+  bool MatchParts(const PathMatcherNode::RequestPathParts& parts) const;
+  // Matches the segments [begin, end) with the parts from `first_part` on.
+  bool MatchSegments(size_t begin, size_t end,
+                     const PathMatcherNode::RequestPathParts& parts,
+                     size_t first_part) const;
+
+  // The segments, and the verb as the last one, like in the trie.
+  std::vector<std::string> segments_;
+  // The index of the "**" segment, or segments_.size() if there is none.
+  size_t wildcard_path_;
+  CustomVerbs custom_verbs_;
+  std::vector<HttpTemplate::Variable> variables_;
+};
+
+template <typename BindingVisitor>
+bool HttpTemplatePlan::Match(absl::string_view path,
+                             BindingVisitor visit_binding) const {
+  const PathMatcherNode::RequestPathParts parts =
+      ExtractRequestParts(path, custom_verbs_);
+  if (!MatchParts(parts)) {
+    return false;
+  }
+  for (const HttpTemplate::Variable& var : variables_) {
+    visit_binding(var.field_path, VariableBindingValue(var, parts));
+  }
+  return true;
+}
+
+}  // namespace path_matcher
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,119 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/path_matcher/http_template_plan.h"
+
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace path_matcher {
+namespace {
+
+using VariableBindings = std::vector<VariableBinding>;
+
+// Returns whether the plan matches, and its bindings.
+bool PlanMatch(const HttpTemplatePlan& plan, const std::string& path,
+               VariableBindings* bindings) {
+  bindings->clear();
+  return plan.Match(path, [bindings](const std::vector<std::string>& field_path,
+                                     absl::string_view value) {
+    bindings->push_back(VariableBinding{field_path, std::string(value)});
+  });
+}
+
+TEST(HttpTemplatePlanTest, MatchesAndBindsVariables) {
+  auto plan = HttpTemplatePlan::Create("/shelves/{shelf}/books/{book.id=**}");
+  ASSERT_NE(plan, nullptr);
+  VariableBindings bindings;
+
+  EXPECT_TRUE(PlanMatch(*plan, "/shelves/1/books/2/3?a=b", &bindings));
+  EXPECT_EQ(VariableBindings({
+                VariableBinding{{"shelf"}, "1"},
+                VariableBinding{{"book", "id"}, "2/3"},
+            }),
+            bindings);
+
+  EXPECT_FALSE(PlanMatch(*plan, "/shelves/1/novels/2", &bindings));
+  EXPECT_FALSE(PlanMatch(*plan, "/shelves", &bindings));
+}
+
+TEST(HttpTemplatePlanTest, InvalidTemplate) {
+  EXPECT_EQ(HttpTemplatePlan::Create("/shelves/{shelf"), nullptr);
+  EXPECT_EQ(HttpTemplatePlan::Create("/a/**/{b}"), nullptr);
+}
+
+TEST(HttpTemplatePlanTest, MatchesLikePathMatcher) {
+  const std::vector<std::string> templates = {
+      "/",
+      "/a",
+      "/a/*",
+      "/a/{x}/b",
+      "/a/**",
+      "/**",
+      "/a/{x=**}/b/c",
+      "/{x=**}/a",
+      "/a/{x=b/*}/{y=**}",
+      "/a/{x}:verb",
+      "/a/{x=**}:verb",
+      "/a:verb",
+  };
+  const std::vector<std::string> paths = {
+      "",
+      "/",
+      "/a",
+      "/a/",
+      "/a/b",
+      "/a//b",
+      "/a/x/b",
+      "/a/x/b/c",
+      "/a/b/c",
+      "/b/a",
+      "/b/c/a",
+      "/a/b/x/y",
+      "/a:verb",
+      "/a/x:verb",
+      "/a/x/y:verb",
+      "/a/x/verb",
+      "/a/x:other",
+      "a/b",
+      "/a?x=y",
+      "/a/b/c?q",
+  };
+
+  for (const std::string& path_template : templates) {
+    auto plan = HttpTemplatePlan::Create(path_template);
+    ASSERT_NE(plan, nullptr) << path_template;
+
+    PathMatcherBuilder<const std::string*> builder;
+    ASSERT_TRUE(builder.Register("GET", path_template, "", &path_template));
+    auto matcher = builder.Build();
+
+    for (const std::string& path : paths) {
+      VariableBindings expected;
+      const bool matched = matcher->Lookup("GET", path, &expected) != nullptr;
+      VariableBindings bindings;
+      EXPECT_EQ(PlanMatch(*plan, path, &bindings), matched)
+          << path_template << " " << path;
+      if (matched) {
+        EXPECT_EQ(bindings, expected) << path_template << " " << path;
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace path_matcher
+}  // namespace api_proxy
+}  // namespace espv2
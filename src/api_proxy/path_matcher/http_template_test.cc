@@ -527,6 +527,18 @@ TEST(HttpTemplate, ParseNonVerbTest) {
   ASSERT_EQ(nullptr, HttpTemplate::Parse("/a/{b=*}/**:"));
 }
 
+TEST(HttpTemplate, ParseDelimitedTokens) {
+  // Literals only end at '/', ':' or '}', identifiers at '.', '=' or '}'.
+  auto ht = HttpTemplate::Parse("/a*b=c/{d_e.f-g}/h{i:j");
+  ASSERT_NE(nullptr, ht);
+  ASSERT_EQ(Segments({"a*b=c", "*", "h{i"}), ht->segments());
+  ASSERT_EQ("j", ht->verb());
+  ASSERT_EQ(Variables({
+                Variable{1, 2, FieldPath{"d_e", "f-g"}, false},
+            }),
+            ht->Variables());
+}
+
 }  // namespace path_matcher
 }  // namespace api_proxy
 }  // namespace espv2
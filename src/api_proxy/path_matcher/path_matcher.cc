@@ -14,72 +14,156 @@
 
 #include "src/api_proxy/path_matcher/path_matcher.h"
 
-#include "absl/strings/str_split.h"
+#include "absl/strings/str_cat.h"
 
 namespace espv2 {
 namespace api_proxy {
 namespace path_matcher {
 
 void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
-                             const std::vector<std::string>& parts,
+                             const PathMatcherNode::RequestPathParts& parts,
                              std::vector<VariableBinding>* bindings) {
+  std::vector<VariableBindingView> views;
+  ExtractBindingViewsFromPath(vars, parts, &views);
+  bindings->reserve(bindings->size() + views.size());
+  for (const VariableBindingView& view : views) {
+    bindings->push_back(
+        VariableBinding{*view.field_path, std::string(view.value)});
+  }
+}
+
+void ExtractBindingViewsFromPath(
+    const std::vector<HttpTemplate::Variable>& vars,
+    const PathMatcherNode::RequestPathParts& parts,
+    std::vector<VariableBindingView>* bindings) {
+  bindings->reserve(bindings->size() + vars.size());
   for (const auto& var : vars) {
-    // Determine the subpath bound to the variable based on the
-    // [start_segment, end_segment) segment range of the variable.
-    //
-    // In case of matching "**" - end_segment is negative and is relative to
-    // the end such that end_segment = -1 will match all subsequent segments.
-    VariableBinding binding;
-    binding.field_path = var.field_path;
-    // Calculate the absolute index of the ending segment in case it's negative.
-    size_t end_segment = (var.end_segment >= 0)
-                             ? var.end_segment
-                             : parts.size() + var.end_segment + 1;
-    // Joins parts with "/"  to form a path string.
-    for (size_t i = var.start_segment; i < end_segment; ++i) {
-      binding.value += parts[i];
-      if (i < end_segment - 1) {
-        binding.value += "/";
-      }
-    }
-    bindings->emplace_back(binding);
+    bindings->push_back(
+        VariableBindingView{&var.field_path, VariableBindingValue(var, parts)});
   }
 }
 
-std::vector<std::string> ExtractRequestParts(
-    std::string path, const std::set<std::string>& custom_verbs) {
-  // Remove query parameters.
-  path = path.substr(0, path.find_first_of('?'));
+absl::string_view VariableBindingValue(
+    const HttpTemplate::Variable& var,
+    const PathMatcherNode::RequestPathParts& parts) {
+  // Determine the subpath bound to the variable based on the
+  // [start_segment, end_segment) segment range of the variable.
+  //
+  // In case of matching "**" - end_segment is negative and is relative to
+  // the end such that end_segment = -1 will match all subsequent segments.
+  // Calculate the absolute index of the ending segment in case it's negative.
+  size_t end_segment = (var.end_segment >= 0)
+                           ? var.end_segment
+                           : parts.size() + var.end_segment + 1;
+  // The parts joined with "/" are the path between the first and the last
+  // part. A custom verb part is never bound to a variable.
+  if (static_cast<size_t>(var.start_segment) >= end_segment) {
+    return absl::string_view();
+  }
+  const char* begin = parts[var.start_segment].data();
+  const absl::string_view last = parts[end_segment - 1];
+  return absl::string_view(begin, last.data() + last.size() - begin);
+}
 
-  // Replace last ':' with '/' to handle custom verb.
-  // But not for /foo:bar/const.
-  std::size_t last_colon_pos = path.find_last_of(':');
-  std::size_t last_slash_pos = path.find_last_of('/');
-  if (last_colon_pos != std::string::npos && last_colon_pos > last_slash_pos) {
-    std::string verb = path.substr(last_colon_pos + 1);
-    // only verb in the configured custom verbs, treat it as verb
-    // replace ":" with / as a separate segment.
-    if (custom_verbs.find(verb) != custom_verbs.end()) {
-      path[last_colon_pos] = '/';
+PathMatcherNode::RequestPathParts ExtractRequestParts(
+    absl::string_view path, const CustomVerbs& custom_verbs) {
+  PathMatcherNode::RequestPathParts result;
+  if (path.empty() || path[0] == '?') {
+    return result;
+  }
+
+  // A single sweep splits the path into slash separated parts, up to the
+  // query string, and finds the last ':' of the last part. The first char is
+  // skipped like a leading '/'.
+  bool has_slash = path[0] == '/';
+  std::size_t part_start = 1;
+  std::size_t last_colon_pos = absl::string_view::npos;
+  std::size_t pos = 1;
+  for (; pos < path.size(); ++pos) {
+    const char c = path[pos];
+    if (c == '/') {
+      result.push_back(path.substr(part_start, pos - part_start));
+      part_start = pos + 1;
+      last_colon_pos = absl::string_view::npos;
+      has_slash = true;
+    } else if (c == ':') {
+      last_colon_pos = pos;
+    } else if (c == '?') {
+      break;
     }
   }
 
-  std::vector<std::string> result;
-  if (!path.empty()) {
-    result = absl::StrSplit(path.substr(1), '/');
+  // Split the last ':' as a separate part to handle custom verb.
+  // But not for /foo:bar/const.
+  absl::string_view verb;
+  bool has_verb = false;
+  if (has_slash && last_colon_pos != absl::string_view::npos) {
+    verb = path.substr(last_colon_pos + 1, pos - last_colon_pos - 1);
+    // only verb in the configured custom verbs, treat it as verb
+    // as a separate segment.
+    has_verb = custom_verbs.find(verb) != custom_verbs.end();
+  }
+  if (has_verb) {
+    result.push_back(path.substr(part_start, last_colon_pos - part_start));
+    result.push_back(verb);
+  } else {
+    result.push_back(path.substr(part_start, pos - part_start));
   }
+
   // Removes all trailing empty parts caused by extra "/".
-  while (!result.empty() && (*(--result.end())).empty()) {
+  while (!result.empty() && result.back().empty()) {
     result.pop_back();
   }
   return result;
 }
 
+bool LiteralTemplatePath(const HttpTemplate& ht, std::string* path) {
+  path->clear();
+  for (const std::string& segment : ht.segments()) {
+    if (segment == HttpTemplate::kSingleParameterKey ||
+        segment == HttpTemplate::kWildCardPathPartKey ||
+        segment == HttpTemplate::kWildCardPathKey) {
+      return false;
+    }
+    absl::StrAppend(path, "/", segment);
+  }
+  if (!ht.verb().empty()) {
+    absl::StrAppend(path, ":", ht.verb());
+  }
+  return true;
+}
+
+bool LiteralRequestPath(absl::string_view path,
+                        absl::string_view* literal_path) {
+  path = path.substr(0, path.find_first_of('?'));
+  if (!path.empty() && path[0] != '/') {
+    return false;
+  }
+
+  // Trailing slashes are dropped like the trailing empty parts.
+  absl::string_view trimmed = path;
+  while (!trimmed.empty() && trimmed.back() == '/') {
+    trimmed.remove_suffix(1);
+  }
+  // But they also keep the last ':' from splitting off a custom verb.
+  if (trimmed.size() != path.size()) {
+    std::size_t last_colon_pos = trimmed.find_last_of(':');
+    std::size_t last_slash_pos = trimmed.find_last_of('/');
+    if (last_colon_pos != absl::string_view::npos &&
+        last_colon_pos > last_slash_pos) {
+      return false;
+    }
+  }
+  *literal_path = trimmed;
+  return true;
+}
+
 PathMatcherLookupResult LookupInPathMatcherNode(
-    const PathMatcherNode& root, const std::vector<std::string>& parts,
-    const HttpMethod& http_method) {
+    const PathMatcherNode& root, const PathMatcherNode::RequestPathParts& parts,
+    absl::string_view http_method) {
   PathMatcherLookupResult result;
-  root.LookupPath(parts.begin(), parts.end(), http_method, &result);
+  root.LookupPath(parts.begin(), parts.end(), InternedHttpMethod(http_method),
+                  &result);
   return result;
 }
 
@@ -15,14 +15,18 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "src/api_proxy/path_matcher/http_template.h"
 #include "src/api_proxy/path_matcher/path_matcher_node.h"
+#include "src/api_proxy/path_matcher/path_matcher_trie.h"
 
 namespace espv2 {
 namespace api_proxy {
@@ -45,9 +49,19 @@ inline bool operator==(const VariableBinding& b1, const VariableBinding& b2) {
   return b1.field_path == b2.field_path && b1.value == b2.value;
 }
 
+// A VariableBinding that views its field path in the PathMatcher and its value
+// in the request path, for callers that do not keep the bindings.
+struct VariableBindingView {
+  const std::vector<std::string>* field_path;
+  absl::string_view value;
+};
+
 template <class Method>
 class PathMatcherBuilder;  // required for PathMatcher constructor
 
+// Looked up by a view of the request verb.
+using CustomVerbs = std::set<std::string, std::less<>>;
+
 // The immutable, thread safe PathMatcher stores a mapping from a combination of
 // a service (host) name and a HTTP path to your method (MethodInfo*). It is
 // constructed with a PathMatcherBuilder and supports one operation: Lookup.
@@ -65,25 +79,35 @@ class PathMatcherBuilder;  // required for PathMatcher constructor
 //                                           url_path);
 //      if (method == nullptr)  failed to find it.
 //
+//
+// Lookups view the method and the path parts without copying them, and do not
+// allocate unless the path has more parts than fit inline or variable
+// bindings are asked for. Paths of templates without variables or wildcards
+// are also kept in a hash table that is probed with the whole request path
+// before the path is split into parts.
 template <class Method>
 class PathMatcher {
  public:
   ~PathMatcher(){};
 
-  Method Lookup(const std::string& http_method, const std::string& path,
+  Method Lookup(absl::string_view http_method, absl::string_view path,
                 std::vector<VariableBinding>* variable_bindings) const;
 
-  Method Lookup(const std::string& http_method, const std::string& path) const;
+  // The bindings view `path`, which must outlive them.
+  Method Lookup(absl::string_view http_method, absl::string_view path,
+                std::vector<VariableBindingView>* variable_bindings) const;
+
+  Method Lookup(absl::string_view http_method, absl::string_view path) const;
 
  private:
-  // Creates a Path Matcher with a Builder by moving the builder's root node.
+  // Creates a Path Matcher with a Builder by freezing the builder's root node.
   explicit PathMatcher(PathMatcherBuilder<Method>&& builder);
 
-  // A root node shared by all services, i.e. paths of all services will be
-  // registered to this node.
-  std::unique_ptr<PathMatcherNode> root_ptr_;
+  // The frozen trie of the root node shared by all services, i.e. paths of
+  // all services are registered to it.
+  std::unique_ptr<PathMatcherTrie> trie_;
   // Holds the set of custom verbs found in configured templates.
-  std::set<std::string> custom_verbs_;
+  CustomVerbs custom_verbs_;
   // Data we store per each registered method
   struct MethodData {
     Method method;
@@ -93,6 +117,27 @@ class PathMatcher {
   // The info associated with each method. The path matcher nodes
   // will hold pointers to MethodData objects in this vector.
   std::vector<std::unique_ptr<MethodData>> methods_;
+  // The methods registered for the path of a literal template.
+  struct LiteralMethods {
+    std::vector<std::pair<std::string, const MethodData*>> methods;
+    // Registered for the wildcard http method.
+    const MethodData* wildcard = nullptr;
+  };
+  // Maps the paths of literal templates, as LiteralTemplatePath() spells
+  // them, to the methods registered for them.
+  using LiteralPaths = absl::flat_hash_map<std::string, LiteralMethods>;
+  LiteralPaths literal_paths_;
+
+  // Returns the method data of a literal template matching the request, or
+  // nullptr if the trie has to be looked up. Matches the trie's precedence,
+  // since a literal match is the first one the trie would find.
+  const MethodData* LookupLiteral(absl::string_view http_method,
+                                  absl::string_view path) const;
+
+  // Returns the method data matching the request, or nullptr. Leaves `parts`
+  // empty if a literal template matched.
+  const MethodData* Match(absl::string_view http_method, absl::string_view path,
+                          PathMatcherNode::RequestPathParts* parts) const;
 
  private:
   friend class PathMatcherBuilder<Method>;
@@ -119,6 +164,12 @@ class PathMatcherBuilder {
   bool Register(std::string http_method, std::string path,
                 std::string body_field_path, Method method);
 
+  // Same as above, with a template already parsed by HttpTemplate::Parse().
+  // Builders of large APIs can parse their templates in parallel and register
+  // them here in order, since only the registration must be serial.
+  bool Register(std::string http_method, std::unique_ptr<HttpTemplate> ht,
+                std::string body_field_path, Method method);
+
   // Returns a unique_ptr to a thread safe PathMatcher that contains all
   // registered path-WrapperGraph pairs. Note the PathMatchBuilder instance
   // will be moved so cannot use after invoking Build().
@@ -132,21 +183,36 @@ class PathMatcherBuilder {
   // TODO: Perhaps this should not be at this level because there will
   // be multiple templates in different services on a server. Consider moving
   // this to PathMatcherNode.
-  std::set<std::string> custom_verbs_;
+  CustomVerbs custom_verbs_;
   using MethodData = typename PathMatcher<Method>::MethodData;
   std::vector<std::unique_ptr<MethodData>> methods_;
+  typename PathMatcher<Method>::LiteralPaths literal_paths_;
 
   friend class PathMatcher<Method>;
 };
 
 void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
-                             const std::vector<std::string>& parts,
+                             const PathMatcherNode::RequestPathParts& parts,
                              std::vector<VariableBinding>* bindings);
 
+// Same as above, but the values are slices of the request path the parts
+// view: the parts bound to a variable are contiguous in it, separated by
+// single slashes.
+void ExtractBindingViewsFromPath(
+    const std::vector<HttpTemplate::Variable>& vars,
+    const PathMatcherNode::RequestPathParts& parts,
+    std::vector<VariableBindingView>* bindings);
+
+// The value of a single variable binding, viewing the request path the parts
+// view.
+absl::string_view VariableBindingValue(
+    const HttpTemplate::Variable& var,
+    const PathMatcherNode::RequestPathParts& parts);
+
 // Converts a request path into a format that can be used to perform a request
 // lookup in the PathMatcher trie. This utility method sanitizes the request
-// path and then splits the path into slash separated parts. Returns an empty
-// vector if the sanitized path is "/".
+// path and then splits the path into slash separated parts, viewing `path`.
+// Returns no parts if the sanitized path is "/".
 //
 // custom_verbs is a set of configured custom verbs that are used to match
 // against any custom verbs in request path. If the request_path contains a
@@ -154,44 +220,75 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
 //
 // - Strips off query string: "/a?foo=bar" --> "/a"
 // - Collapses extra slashes: "///" --> "/"
-std::vector<std::string> ExtractRequestParts(
-    std::string path, const std::set<std::string>& custom_verbs);
+PathMatcherNode::RequestPathParts ExtractRequestParts(
+    absl::string_view path, const CustomVerbs& custom_verbs);
+
+// Spells the path of a template without variables the way
+// LiteralRequestPath() spells the request paths it matches, e.g.
+// "/v1/shelves:list" or "" for "/". Returns false if the template has
+// wildcards or single parameter segments.
+bool LiteralTemplatePath(const HttpTemplate& ht, std::string* path);
+
+// Strips the query string and trailing slashes off the request path, for a
+// literal template lookup. Returns false if the trie would split the path
+// differently than a literal template path, e.g. for "/a:verb/" or a path
+// not starting with "/"; the trie has to be looked up then.
+bool LiteralRequestPath(absl::string_view path,
+                        absl::string_view* literal_path);
 
 // Looks up on a PathMatcherNode.
 PathMatcherLookupResult LookupInPathMatcherNode(
-    const PathMatcherNode& root, const std::vector<std::string>& parts,
-    const HttpMethod& http_method);
+    const PathMatcherNode& root, const PathMatcherNode::RequestPathParts& parts,
+    absl::string_view http_method);
 
 PathMatcherNode::PathInfo TransformHttpTemplate(const HttpTemplate& ht);
 
 template <class Method>
 PathMatcher<Method>::PathMatcher(PathMatcherBuilder<Method>&& builder)
-    : root_ptr_(std::move(builder.root_ptr_)),
+    : trie_(builder.root_ptr_ == nullptr
+                ? nullptr
+                : new PathMatcherTrie(*builder.root_ptr_)),
       custom_verbs_(std::move(builder.custom_verbs_)),
-      methods_(std::move(builder.methods_)) {}
+      methods_(std::move(builder.methods_)),
+      literal_paths_(std::move(builder.literal_paths_)) {
+  // Only the frozen trie is looked up.
+  builder.root_ptr_.reset();
+}
 
 template <class Method>
-Method PathMatcher<Method>::Lookup(
-    const std::string& http_method, const std::string& path,
-    std::vector<VariableBinding>* variable_bindings) const {
-  const std::vector<std::string> parts =
-      ExtractRequestParts(path, custom_verbs_);
+const typename PathMatcher<Method>::MethodData* PathMatcher<Method>::Match(
+    absl::string_view http_method, absl::string_view path,
+    PathMatcherNode::RequestPathParts* parts) const {
+  const MethodData* literal = LookupLiteral(http_method, path);
+  if (literal != nullptr) {
+    return literal;
+  }
+
+  *parts = ExtractRequestParts(path, custom_verbs_);
 
   // If service_name has not been registered to ESPv2 and
   // strict_service_matching_ is set to false, tries to lookup the method in all
   // registered services.
-  if (root_ptr_ == nullptr) {
+  if (trie_ == nullptr) {
     return nullptr;
   }
 
   PathMatcherLookupResult lookup_result =
-      LookupInPathMatcherNode(*root_ptr_, parts, http_method);
+      trie_->Lookup(*parts, InternedHttpMethod(http_method));
   // Return nullptr if nothing is found.
   // Not need to check duplication. Only first item is stored for duplicated
-  if (lookup_result.data == nullptr) {
+  return reinterpret_cast<const MethodData*>(lookup_result.data);
+}
+
+template <class Method>
+Method PathMatcher<Method>::Lookup(
+    absl::string_view http_method, absl::string_view path,
+    std::vector<VariableBinding>* variable_bindings) const {
+  PathMatcherNode::RequestPathParts parts;
+  const MethodData* method_data = Match(http_method, path, &parts);
+  if (method_data == nullptr) {
     return nullptr;
   }
-  MethodData* method_data = reinterpret_cast<MethodData*>(lookup_result.data);
   if (variable_bindings != nullptr) {
     variable_bindings->clear();
     ExtractBindingsFromPath(method_data->variables, parts, variable_bindings);
@@ -199,28 +296,50 @@ Method PathMatcher<Method>::Lookup(
   return method_data->method;
 }
 
-// TODO: refactor common code with method above
 template <class Method>
-Method PathMatcher<Method>::Lookup(const std::string& http_method,
-                                   const std::string& path) const {
-  const std::vector<std::string> parts =
-      ExtractRequestParts(path, custom_verbs_);
-
-  // If service_name has not been registered to ESP and strict_service_matching_
-  // is set to false, tries to lookup the method in all registered services.
-  if (root_ptr_ == nullptr) {
+Method PathMatcher<Method>::Lookup(
+    absl::string_view http_method, absl::string_view path,
+    std::vector<VariableBindingView>* variable_bindings) const {
+  PathMatcherNode::RequestPathParts parts;
+  const MethodData* method_data = Match(http_method, path, &parts);
+  if (method_data == nullptr) {
     return nullptr;
   }
+  if (variable_bindings != nullptr) {
+    variable_bindings->clear();
+    ExtractBindingViewsFromPath(method_data->variables, parts,
+                                variable_bindings);
+  }
+  return method_data->method;
+}
 
-  PathMatcherLookupResult lookup_result =
-      LookupInPathMatcherNode(*root_ptr_, parts, http_method);
-  // Return nullptr if nothing is found.
-  // Not need to check duplication. Only first item is stored for duplicated
-  if (lookup_result.data == nullptr) {
+template <class Method>
+Method PathMatcher<Method>::Lookup(absl::string_view http_method,
+                                   absl::string_view path) const {
+  PathMatcherNode::RequestPathParts parts;
+  const MethodData* method_data = Match(http_method, path, &parts);
+  return method_data == nullptr ? nullptr : method_data->method;
+}
+
+template <class Method>
+const typename PathMatcher<Method>::MethodData*
+PathMatcher<Method>::LookupLiteral(absl::string_view http_method,
+                                   absl::string_view path) const {
+  absl::string_view literal_path;
+  if (literal_paths_.empty() || !LiteralRequestPath(path, &literal_path)) {
     return nullptr;
   }
-  MethodData* method_data = reinterpret_cast<MethodData*>(lookup_result.data);
-  return method_data->method;
+  const auto it = literal_paths_.find(literal_path);
+  if (it == literal_paths_.end()) {
+    return nullptr;
+  }
+  // Like the trie, prefers the http method over the wildcard one.
+  for (const auto& registered : it->second.methods) {
+    if (registered.first == http_method) {
+      return registered.second;
+    }
+  }
+  return it->second.wildcard;
 }
 
 // Initializes the builder with a root Path Segment
@@ -240,11 +359,22 @@ bool PathMatcherBuilder<Method>::Register(std::string http_method,
                                           std::string http_template,
                                           std::string body_field_path,
                                           Method method) {
-  std::unique_ptr<HttpTemplate> ht(HttpTemplate::Parse(http_template));
+  return Register(std::move(http_method), HttpTemplate::Parse(http_template),
+                  std::move(body_field_path), method);
+}
+
+template <class Method>
+bool PathMatcherBuilder<Method>::Register(std::string http_method,
+                                          std::unique_ptr<HttpTemplate> ht,
+                                          std::string body_field_path,
+                                          Method method) {
   if (nullptr == ht) {
     return false;
   }
   PathMatcherNode::PathInfo path_info = TransformHttpTemplate(*ht);
+  std::string literal_path;
+  const bool literal =
+      ht->Variables().empty() && LiteralTemplatePath(*ht, &literal_path);
 
   // Create & initialize a MethodData struct. Then insert its pointer
   // into the path matcher trie.
@@ -256,6 +386,15 @@ bool PathMatcherBuilder<Method>::Register(std::string http_method,
   if (!root_ptr_->InsertPath(path_info, http_method, method_data.get(), true)) {
     return false;
   }
+  if (literal) {
+    auto& literal_methods = literal_paths_[literal_path];
+    if (InternedHttpMethod(http_method).id == HttpMethodId::kWildCard) {
+      literal_methods.wildcard = method_data.get();
+    } else {
+      literal_methods.methods.emplace_back(std::move(http_method),
+                                           method_data.get());
+    }
+  }
   // Add the method_data to the methods_ vector for cleanup
   methods_.emplace_back(std::move(method_data));
   if (!ht->verb().empty()) {
@@ -0,0 +1,355 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares splitting request paths in a single sweep, as ExtractRequestParts
+// does, with the previous split that scanned the path once per delimiter.
+//
+// Also compares matching "**" templates by their literal suffixes, as
+// PathMatcher does, with the search of PathMatcherNode that tries the suffixes
+// at every part of the path.
+//
+// Also measures parsing the templates of the http_template fuzz corpus, and
+// building and looking up matchers of the bookstore templates and of large
+// Google API-style configs.
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "benchmark/benchmark.h"
+#include "src/api_proxy/path_matcher/path_matcher.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace path_matcher {
+namespace {
+
+// The previous ExtractRequestParts.
+PathMatcherNode::RequestPathParts ExtractRequestPartsByScans(
+    absl::string_view path, const CustomVerbs& custom_verbs) {
+  path = path.substr(0, path.find_first_of('?'));
+
+  absl::string_view verb;
+  bool has_verb = false;
+  std::size_t last_colon_pos = path.find_last_of(':');
+  std::size_t last_slash_pos = path.find_last_of('/');
+  if (last_colon_pos != absl::string_view::npos &&
+      last_colon_pos > last_slash_pos) {
+    verb = path.substr(last_colon_pos + 1);
+    if (custom_verbs.find(verb) != custom_verbs.end()) {
+      has_verb = true;
+      path = path.substr(0, last_colon_pos);
+    }
+  }
+
+  PathMatcherNode::RequestPathParts result;
+  if (!path.empty()) {
+    for (absl::string_view part : absl::StrSplit(path.substr(1), '/')) {
+      result.push_back(part);
+    }
+    if (has_verb) {
+      result.push_back(verb);
+    }
+  }
+  while (!result.empty() && result.back().empty()) {
+    result.pop_back();
+  }
+  return result;
+}
+
+const CustomVerbs& customVerbs() {
+  static const CustomVerbs* verbs = new CustomVerbs({"list", "create"});
+  return *verbs;
+}
+
+// A typical path, and a long one with most of its bytes in the query string.
+std::string requestPath(int query_bytes) {
+  return "/v1/projects/my-project/shelves/123/books:list?pageSize=10&token=" +
+         std::string(query_bytes, 'x');
+}
+
+void BM_ExtractRequestPartsByScans(benchmark::State& state) {
+  const std::string path = requestPath(state.range(0));
+  for (auto _ : state) {
+    auto parts = ExtractRequestPartsByScans(path, customVerbs());
+    benchmark::DoNotOptimize(parts);
+  }
+}
+BENCHMARK(BM_ExtractRequestPartsByScans)->Arg(0)->Arg(8 * 1024);
+
+void BM_ExtractRequestParts(benchmark::State& state) {
+  const std::string path = requestPath(state.range(0));
+  for (auto _ : state) {
+    auto parts = ExtractRequestParts(path, customVerbs());
+    benchmark::DoNotOptimize(parts);
+  }
+}
+BENCHMARK(BM_ExtractRequestParts)->Arg(0)->Arg(8 * 1024);
+
+// "/a/**/b/c", "/a/**/b/b/c", ... and "/a/**". The "b" suffixes are almost
+// matched at every part of a long path of "b" parts.
+std::vector<std::string> wildcardTemplates() {
+  std::vector<std::string> templates = {"/a/**"};
+  std::string suffix = "/c";
+  for (int i = 0; i < 8; ++i) {
+    suffix = "/b" + suffix;
+    templates.push_back("/a/**" + suffix);
+  }
+  return templates;
+}
+
+std::string wildcardPath(int num_parts) {
+  std::string path = "/a";
+  for (int i = 0; i < num_parts; ++i) {
+    path += "/b";
+  }
+  return path + "/d";
+}
+
+void BM_WildcardBacktrackingLookup(benchmark::State& state) {
+  PathMatcherNode root;
+  std::vector<std::string> templates = wildcardTemplates();
+  for (const std::string& path_template : templates) {
+    std::unique_ptr<HttpTemplate> ht = HttpTemplate::Parse(path_template);
+    root.InsertPath(TransformHttpTemplate(*ht), "GET", &templates, true);
+  }
+  const std::string path = wildcardPath(state.range(0));
+  for (auto _ : state) {
+    auto result = LookupInPathMatcherNode(
+        root, ExtractRequestParts(path, customVerbs()), "GET");
+    benchmark::DoNotOptimize(result);
+  }
+}
+BENCHMARK(BM_WildcardBacktrackingLookup)->Arg(16)->Arg(256);
+
+void BM_WildcardLookup(benchmark::State& state) {
+  PathMatcherBuilder<const std::vector<std::string>*> builder;
+  const std::vector<std::string> templates = wildcardTemplates();
+  for (const std::string& path_template : templates) {
+    builder.Register("GET", path_template, "", &templates);
+  }
+  auto matcher = builder.Build();
+  const std::string path = wildcardPath(state.range(0));
+  for (auto _ : state) {
+    auto method = matcher->Lookup("GET", path);
+    benchmark::DoNotOptimize(method);
+  }
+}
+BENCHMARK(BM_WildcardLookup)->Arg(16)->Arg(256);
+
+// The valid templates of tests/fuzz/corpus/http_template.
+const std::vector<std::string>& corpusTemplates() {
+  static const std::vector<std::string>* templates =
+      new std::vector<std::string>({
+          "/*:verb",
+          "/**:verb",
+          "/{a}:verb",
+          "/a/b/*:verb",
+          "/a/b/**:verb",
+          "/a/b/{a}:verb",
+          "/{x}",
+          "/{x.y.z}",
+          "/{x=*}",
+          "/{x=a/*}",
+          "/{x.y.z=*/a/b}/c",
+          "/{x=**}",
+          "/{x.y.z=**}",
+          "/{x.y.z=a/**/b}",
+          "/{x.y.z=a/**/b}/c/d",
+          "/a/{x}/b/{y}/c/{z}/d",
+          "/shelves/{shelf}/books/{book}",
+          "/shelves/**",
+          "/**",
+          "/a:foo",
+          "/a/b/c:foo",
+          "/*/**",
+          "/*/a/**",
+          "/a/{a.b.c}",
+          "/a/{a.b.c=*}",
+          "/a/{b=*}",
+          "/a/{b=**}",
+          "/a/{b=c/*}",
+          "/a/{b=c/*/d}",
+          "/a/{b=c/**}",
+          "/a/{b=c/**}/d/e",
+          "/a/{b=c/**/d}/e",
+          "/a/{b=c/**/d}/e:verb",
+          "/a/*:verb",
+          "/a/**:verb",
+          "/a/{b=*}/**:verb",
+          "/{x}:verb",
+          "/{x.y.z}:verb",
+          "/{x.y.z=*/*}:verb",
+          "/{x=**}:myverb",
+          "/{x.y.z=**}:myverb",
+          "/{x.y.z=a/**/b}:custom",
+          "/{x.y.z=a/**/b}/c/d:custom",
+      });
+  return *templates;
+}
+
+void BM_ParseTemplates(benchmark::State& state) {
+  for (auto _ : state) {
+    for (const std::string& path_template : corpusTemplates()) {
+      auto ht = HttpTemplate::Parse(path_template);
+      benchmark::DoNotOptimize(ht);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpusTemplates().size());
+}
+BENCHMARK(BM_ParseTemplates);
+
+struct Registration {
+  std::string http_method;
+  std::string path_template;
+};
+
+// The templates of the bookstore example.
+std::vector<Registration> bookstoreRegistrations() {
+  return {
+      {"GET", "/shelves"},
+      {"POST", "/shelves"},
+      {"GET", "/shelves/{shelf}"},
+      {"DELETE", "/shelves/{shelf}"},
+      {"GET", "/shelves/{shelf}/books"},
+      {"POST", "/shelves/{shelf}/books"},
+      {"GET", "/shelves/{shelf}/books/{book}"},
+      {"DELETE", "/shelves/{shelf}/books/{book}"},
+  };
+}
+
+std::vector<std::string> bookstorePaths() {
+  return {"/shelves", "/shelves/1", "/shelves/1/books",
+          "/shelves/1/books/2?key=api-key"};
+}
+
+// A Google API-style config of `num_templates` templates: the list, create,
+// get and custom method of one collection after another, under projects and
+// locations, as resource names.
+std::vector<Registration> googleApiRegistrations(int num_templates) {
+  std::vector<Registration> registrations;
+  for (int i = 0; static_cast<int>(registrations.size()) < num_templates;
+       ++i) {
+    const std::string collection =
+        absl::StrCat("/v1/projects/{project}/locations/{location}/things", i);
+    registrations.push_back({"GET", collection});
+    registrations.push_back({"POST", collection});
+    registrations.push_back({"GET", absl::StrCat(collection, "/{thing}")});
+    registrations.push_back(
+        {"POST", absl::StrCat("/v1/{name=projects/*/locations/*/things", i,
+                              "/*}:cancel")});
+  }
+  registrations.resize(num_templates);
+  return registrations;
+}
+
+// Paths of the first 64 collections of the config, at most.
+std::vector<std::string> googleApiPaths(int num_templates) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < std::min(64, num_templates / 4); ++i) {
+    paths.push_back(
+        absl::StrCat("/v1/projects/my-project/locations/us-central1/things",
+                     i * (num_templates / 4) / 64, "/thing-id"));
+  }
+  return paths;
+}
+
+PathMatcherPtr<const Registration*> build(
+    const std::vector<Registration>& registrations) {
+  PathMatcherBuilder<const Registration*> builder;
+  for (const Registration& registration : registrations) {
+    builder.Register(registration.http_method, registration.path_template, "",
+                     &registration);
+  }
+  return builder.Build();
+}
+
+void BM_BuildGoogleApi(benchmark::State& state) {
+  const std::vector<Registration> registrations =
+      googleApiRegistrations(state.range(0));
+  for (auto _ : state) {
+    auto matcher = build(registrations);
+    benchmark::DoNotOptimize(matcher);
+  }
+  state.SetItemsProcessed(state.iterations() * registrations.size());
+}
+BENCHMARK(BM_BuildGoogleApi)->Arg(1000)->Arg(10000);
+
+enum class Bindings { None, Copies, Views };
+
+void lookup(benchmark::State& state,
+            const std::vector<Registration>& registrations,
+            const std::vector<std::string>& paths, Bindings bindings) {
+  const auto matcher = build(registrations);
+  for (const std::string& path : paths) {
+    if (matcher->Lookup("GET", path) == nullptr) {
+      state.SkipWithError("A path is not matched");
+      return;
+    }
+  }
+  std::vector<VariableBinding> copies;
+  std::vector<VariableBindingView> views;
+  size_t i = 0;
+  for (auto _ : state) {
+    const std::string& path = paths[i++ % paths.size()];
+    const Registration* registration = nullptr;
+    switch (bindings) {
+      case Bindings::None:
+        registration = matcher->Lookup("GET", path);
+        break;
+      case Bindings::Copies:
+        copies.clear();
+        registration = matcher->Lookup("GET", path, &copies);
+        break;
+      case Bindings::Views:
+        views.clear();
+        registration = matcher->Lookup("GET", path, &views);
+        break;
+    }
+    benchmark::DoNotOptimize(registration);
+  }
+}
+
+void BM_LookupBookstore(benchmark::State& state) {
+  lookup(state, bookstoreRegistrations(), bookstorePaths(),
+         static_cast<Bindings>(state.range(0)));
+}
+BENCHMARK(BM_LookupBookstore)
+    ->Arg(static_cast<int>(Bindings::None))
+    ->Arg(static_cast<int>(Bindings::Copies))
+    ->Arg(static_cast<int>(Bindings::Views));
+
+void BM_LookupGoogleApi(benchmark::State& state) {
+  lookup(state, googleApiRegistrations(state.range(0)),
+         googleApiPaths(state.range(0)), static_cast<Bindings>(state.range(1)));
+}
+void lookupGoogleApiArgs(benchmark::internal::Benchmark* benchmark) {
+  for (int num_templates : {1000, 10000}) {
+    for (Bindings bindings :
+         {Bindings::None, Bindings::Copies, Bindings::Views}) {
+      benchmark->Args({num_templates, static_cast<int>(bindings)});
+    }
+  }
+}
+BENCHMARK(BM_LookupGoogleApi)->Apply(lookupGoogleApiArgs);
+
+}  // namespace
+}  // namespace path_matcher
+}  // namespace api_proxy
+}  // namespace espv2
+
+BENCHMARK_MAIN();
@@ -24,34 +24,6 @@ constexpr char HttpMethod_WILD_CARD[] = "*";
 
 namespace {
 
-// Tries to insert the given key-value pair into the collection. Returns nullptr
-// if the insert succeeds. Otherwise, returns a pointer to the existing value.
-//
-// This complements UpdateReturnCopy in that it allows to update only after
-// verifying the old value and still insert quickly without having to look up
-// twice. Unlike UpdateReturnCopy this also does not come with the issue of an
-// undefined previous* in case new data was inserted.
-template <class Collection>
-typename Collection::value_type::second_type* InsertOrReturnExisting(
-    Collection* const collection, const typename Collection::value_type& vt) {
-  std::pair<typename Collection::iterator, bool> ret = collection->insert(vt);
-  if (ret.second) {
-    return nullptr;  // Inserted, no existing previous value.
-  } else {
-    return &ret.first->second;  // Return address of already existing value.
-  }
-}
-
-// Same as above, except for explicit key and data.
-template <class Collection>
-typename Collection::value_type::second_type* InsertOrReturnExisting(
-    Collection* const collection,
-    const typename Collection::value_type::first_type& key,
-    const typename Collection::value_type::second_type& data) {
-  return InsertOrReturnExisting(collection,
-                                typename Collection::value_type(key, data));
-}
-
 // Returns a reference to the pointer associated with key. If not found,
 // a pointee is constructed and added to the map. In that case, the new
 // pointee is value-initialized (aka "default-constructed").
@@ -69,24 +41,29 @@ typename Collection::value_type::second_type& LookupOrInsertNew(
   }
   return ret.first->second;
 }
+}  // namespace
 
-// A convinent function to lookup a STL colllection with two keys.
-// Lookup key1 first, if not found, lookup key2, or return nullptr.
-template <class Collection>
-const typename Collection::value_type::second_type* Find2KeysOrNull(
-    const Collection& collection,
-    const typename Collection::value_type::first_type& key1,
-    const typename Collection::value_type::first_type& key2) {
-  auto it = collection.find(key1);
-  if (it == collection.end()) {
-    it = collection.find(key2);
-    if (it == collection.end()) {
-      return nullptr;
+InternedHttpMethod::InternedHttpMethod(absl::string_view method)
+    : id(HttpMethodId::kCustom), name(method) {
+  static constexpr std::pair<absl::string_view, HttpMethodId> kMethods[] = {
+      {"GET", HttpMethodId::kGet},
+      {"POST", HttpMethodId::kPost},
+      {"PUT", HttpMethodId::kPut},
+      {"DELETE", HttpMethodId::kDelete},
+      {"PATCH", HttpMethodId::kPatch},
+      {"HEAD", HttpMethodId::kHead},
+      {"OPTIONS", HttpMethodId::kOptions},
+      {"CONNECT", HttpMethodId::kConnect},
+      {"TRACE", HttpMethodId::kTrace},
+      {HttpMethod_WILD_CARD, HttpMethodId::kWildCard},
+  };
+  for (const auto& known : kMethods) {
+    if (method == known.first) {
+      id = known.second;
+      return;
     }
   }
-  return &it->second;
 }
-}  // namespace
 
 PathMatcherNode::PathInfo::Builder&
 PathMatcherNode::PathInfo::Builder::AppendLiteralNode(std::string name) {
@@ -112,7 +89,8 @@ PathMatcherNode::~PathMatcherNode() {}
 
 std::unique_ptr<PathMatcherNode> PathMatcherNode::Clone() const {
   std::unique_ptr<PathMatcherNode> clone(new PathMatcherNode());
-  clone->result_map_ = result_map_;
+  clone->results_ = results_;
+  clone->custom_results_ = custom_results_;
   // deep-copy literal children
   for (const auto& entry : children_) {
     clone->children_.emplace(entry.first, entry.second->Clone());
@@ -137,7 +115,7 @@ std::unique_ptr<PathMatcherNode> PathMatcherNode::Clone() const {
 // result and returns true.
 void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
                                  const RequestPathParts::const_iterator end,
-                                 HttpMethod http_method,
+                                 const InternedHttpMethod& http_method,
                                  PathMatcherLookupResult* result) const {
   // base case
   if (current == end) {
@@ -145,7 +123,8 @@ void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
       // If we didn't find a wrapper graph at this node, check if we have one
       // in a wildcard (**) child. If we do, use it. This will ensure we match
       // the root with wildcard templates.
-      auto pair = children_.find(HttpTemplate::kWildCardPathKey);
+      auto pair =
+          children_.find(absl::string_view(HttpTemplate::kWildCardPathKey));
       if (pair != children_.end()) {
         const auto& child = pair->second;
         child->GetResultForHttpMethod(http_method, result);
@@ -166,9 +145,10 @@ void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
     return;
   }
 
-  for (const std::string& child_key :
-       {HttpTemplate::kSingleParameterKey, HttpTemplate::kWildCardPathPartKey,
-        HttpTemplate::kWildCardPathKey}) {
+  for (absl::string_view child_key :
+       {absl::string_view(HttpTemplate::kSingleParameterKey),
+        absl::string_view(HttpTemplate::kWildCardPathPartKey),
+        absl::string_view(HttpTemplate::kWildCardPathKey)}) {
     if (LookupPathFromChild(child_key, current, end, http_method, result)) {
       return;
     }
@@ -179,8 +159,9 @@ bool PathMatcherNode::InsertPath(const PathInfo& node_path_info,
                                  std::string http_method, void* method_data,
                                  bool mark_duplicates) {
   return InsertTemplate(node_path_info.path_info().begin(),
-                        node_path_info.path_info().end(), http_method,
-                        method_data, mark_duplicates);
+                        node_path_info.path_info().end(),
+                        InternedHttpMethod(http_method), method_data,
+                        mark_duplicates);
 }
 
 // This method locates a matching child for the |current| path part, inserting a
@@ -193,18 +174,37 @@ bool PathMatcherNode::InsertPath(const PathInfo& node_path_info,
 // updates the node's WrapperGraph for the specified HTTP method.
 bool PathMatcherNode::InsertTemplate(
     const std::vector<std::string>::const_iterator current,
-    const std::vector<std::string>::const_iterator end, HttpMethod http_method,
-    void* method_data, bool mark_duplicates) {
+    const std::vector<std::string>::const_iterator end,
+    const InternedHttpMethod& http_method, void* method_data,
+    bool mark_duplicates) {
   if (current == end) {
-    PathMatcherLookupResult* const existing = InsertOrReturnExisting(
-        &result_map_, http_method, PathMatcherLookupResult(method_data, false));
-    if (existing != nullptr) {
-      if (mark_duplicates) {
-        existing->is_multiple = true;
+    PathMatcherLookupResult* existing = nullptr;
+    if (http_method.id == HttpMethodId::kCustom) {
+      for (auto& custom : custom_results_) {
+        if (custom.first == http_method.name) {
+          existing = &custom.second;
+        }
+      }
+      if (existing == nullptr) {
+        custom_results_.emplace_back(
+            std::string(http_method.name),
+            PathMatcherLookupResult(method_data, false));
+        return true;
       }
-      return false;
+    } else {
+      ResultSlot& slot = results_[static_cast<size_t>(http_method.id)];
+      if (!slot.registered) {
+        slot.registered = true;
+        slot.result = PathMatcherLookupResult(method_data, false);
+        return true;
+      }
+      existing = &slot.result;
     }
-    return true;
+
+    if (mark_duplicates) {
+      existing->is_multiple = true;
+    }
+    return false;
   }
   std::unique_ptr<PathMatcherNode>& child =
       LookupOrInsertNew(&children_, *current);
@@ -216,8 +216,9 @@ bool PathMatcherNode::InsertTemplate(
 }
 
 bool PathMatcherNode::LookupPathFromChild(
-    const std::string child_key, const RequestPathParts::const_iterator current,
-    const RequestPathParts::const_iterator end, HttpMethod http_method,
+    absl::string_view child_key, const RequestPathParts::const_iterator current,
+    const RequestPathParts::const_iterator end,
+    const InternedHttpMethod& http_method,
     PathMatcherLookupResult* result) const {
   auto pair = children_.find(child_key);
   if (pair != children_.end()) {
@@ -229,10 +230,30 @@ bool PathMatcherNode::LookupPathFromChild(
   return false;
 }
 
+const PathMatcherLookupResult* PathMatcherNode::FindResult(
+    const InternedHttpMethod& key) const {
+  if (key.id == HttpMethodId::kCustom) {
+    for (const auto& custom : custom_results_) {
+      if (custom.first == key.name) {
+        return &custom.second;
+      }
+    }
+    return nullptr;
+  }
+  const ResultSlot& slot = results_[static_cast<size_t>(key.id)];
+  return slot.registered ? &slot.result : nullptr;
+}
+
 bool PathMatcherNode::GetResultForHttpMethod(
-    HttpMethod key, PathMatcherLookupResult* result) const {
-  const PathMatcherLookupResult* found_p =
-      Find2KeysOrNull(result_map_, key, HttpMethod_WILD_CARD);
+    const InternedHttpMethod& key, PathMatcherLookupResult* result) const {
+  const PathMatcherLookupResult* found_p = FindResult(key);
+  if (found_p == nullptr) {
+    const ResultSlot& wildcard =
+        results_[static_cast<size_t>(HttpMethodId::kWildCard)];
+    if (wildcard.registered) {
+      found_p = &wildcard.result;
+    }
+  }
   if (found_p != nullptr) {
     *result = *found_p;
     return true;
@@ -14,18 +14,52 @@
 
 #pragma once
 
-#include <map>
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/string_view.h"
+
 namespace espv2 {
 namespace api_proxy {
 namespace path_matcher {
 
 using HttpMethod = std::string;
 
+// The methods with a fixed result slot in each node, and the wildcard "*"
+// matching any method. Other methods are custom and kept by name.
+enum class HttpMethodId : uint8_t {
+  kGet,
+  kPost,
+  kPut,
+  kDelete,
+  kPatch,
+  kHead,
+  kOptions,
+  kConnect,
+  kTrace,
+  kWildCard,
+  kCustom,
+};
+
+constexpr size_t kNumHttpMethodSlots =
+    static_cast<size_t>(HttpMethodId::kCustom);
+
+// A method interned once per registration or lookup, so the nodes dispatch on
+// its id instead of comparing names.
+struct InternedHttpMethod {
+  explicit InternedHttpMethod(absl::string_view method);
+
+  HttpMethodId id;
+  // Only compared for custom methods.
+  absl::string_view name;
+};
+
 struct PathMatcherLookupResult {
   PathMatcherLookupResult() : data(nullptr), is_multiple(false) {}
 
@@ -108,10 +142,11 @@ class PathMatcherNode {
     std::vector<std::string> path_;
   };  // class PathInfo
 
-  using RequestPathParts = std::vector<std::string>;
+  // The parts of a request path, viewing the path. Typical paths fit inline.
+  using RequestPathParts = absl::InlinedVector<absl::string_view, 16>;
 
   // Creates a Root node with an empty WrapperGraph map.
-  PathMatcherNode() : result_map_(), children_(), wildcard_(false) {}
+  PathMatcherNode() : results_(), children_(), wildcard_(false) {}
 
   ~PathMatcherNode();
 
@@ -125,7 +160,7 @@ class PathMatcherNode {
   // VariableBindingInfoMap to the result pointers.
   void LookupPath(const RequestPathParts::const_iterator current,
                   const RequestPathParts::const_iterator end,
-                  HttpMethod http_method,
+                  const InternedHttpMethod& http_method,
                   PathMatcherLookupResult* result) const;
 
   // This method inserts a path of nodes into this subtrie. The WrapperGraph,
@@ -140,6 +175,9 @@ class PathMatcherNode {
   void set_wildcard(bool wildcard) { wildcard_ = wildcard; }
 
  private:
+  // Freezes the trie into its lookup layout.
+  friend class PathMatcherTrie;
+
   // This method inserts a path of nodes into this subtrie (described by the
   // vector<Info>, starting from the |current| position in the iterator of path
   // parts, and if necessary, creating intermediate nodes along the way. The
@@ -151,16 +189,16 @@ class PathMatcherNode {
   // template will yield a special error reporting WrapperGraph.
   bool InsertTemplate(const std::vector<std::string>::const_iterator current,
                       const std::vector<std::string>::const_iterator end,
-                      HttpMethod http_method, void* method_data,
+                      const InternedHttpMethod& http_method, void* method_data,
                       bool mark_duplicates);
 
   // Helper method for LookupPath. If the given child key exists, search
   // continues on the child node pointed by the child key with the next part
   // in the path. Returns true if found a match for the path eventually.
-  bool LookupPathFromChild(const std::string child_key,
+  bool LookupPathFromChild(absl::string_view child_key,
                            const RequestPathParts::const_iterator current,
                            const RequestPathParts::const_iterator end,
-                           HttpMethod http_method,
+                           const InternedHttpMethod& http_method,
                            PathMatcherLookupResult* result) const;
 
   // If a WrapperGraph is found for the provided key, then this method returns
@@ -169,10 +207,22 @@ class PathMatcherNode {
   //
   // NB: If result == nullptr, method will return bool value without modifying
   // result.
-  bool GetResultForHttpMethod(HttpMethod key,
+  bool GetResultForHttpMethod(const InternedHttpMethod& key,
                               PathMatcherLookupResult* result) const;
 
-  std::map<HttpMethod, PathMatcherLookupResult> result_map_;
+  // Returns the result registered for the method, or nullptr.
+  const PathMatcherLookupResult* FindResult(
+      const InternedHttpMethod& key) const;
+
+  struct ResultSlot {
+    bool registered = false;
+    PathMatcherLookupResult result;
+  };
+
+  // The results of the methods with a slot, indexed by id.
+  std::array<ResultSlot, kNumHttpMethodSlots> results_;
+  // The results of the custom methods, rarely more than a few.
+  std::vector<std::pair<std::string, PathMatcherLookupResult>> custom_results_;
 
   // Lookup must be FAST
   //
@@ -180,8 +230,9 @@ class PathMatcherNode {
   // size of |children_| to range from ~5 to ~100 entries.
   //
   // To ensure fast lookups when n grows large, it is prudent to consider an
-  // alternative to binary search on a sorted vector.
-  std::unordered_map<std::string, std::unique_ptr<PathMatcherNode>> children_;
+  // alternative to binary search on a sorted vector. Looked up by a view of
+  // the request path part.
+  absl::flat_hash_map<std::string, std::unique_ptr<PathMatcherNode>> children_;
 
   // True if this node represents a wildcard path '**'.
   bool wildcard_;
@@ -17,6 +17,7 @@
 #include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -90,6 +91,11 @@ class PathMatcherTest : public ::testing::Test {
     return matcher_->Lookup(method, path, bindings);
   }
 
+  MethodInfo* Lookup(std::string method, const std::string& path,
+                     std::vector<VariableBindingView>* bindings) {
+    return matcher_->Lookup(method, path, bindings);
+  }
+
   MethodInfo* Lookup(std::string method, std::string path) {
     return matcher_->Lookup(method, path);
   }
@@ -145,6 +151,33 @@ TEST_F(PathMatcherTest, WildCardMatches) {
   EXPECT_EQ(Lookup("GET", "/c/f/d/e"), cfde);
 }
 
+TEST_F(PathMatcherTest, WildCardLiteralSuffixMatches) {
+  // The wildcard matches the shortest prefix of the remaining path that leaves
+  // a registered suffix for the http method.
+  MethodInfo* a__ = AddGetPath("/a/**");
+  MethodInfo* a__bc = AddGetPath("/a/{x=**}/b/c");
+  MethodInfo* a__c = AddPath("POST", "/a/**/c");
+  Build();
+
+  EXPECT_NE(nullptr, a__);
+  EXPECT_NE(nullptr, a__bc);
+  EXPECT_NE(nullptr, a__c);
+
+  VariableBindings bindings;
+  EXPECT_EQ(Lookup("GET", "/a/b/c/b/c", &bindings), a__bc);
+  EXPECT_EQ(VariableBindings({
+                VariableBinding{FieldPath{"x"}, "b/c"},
+            }),
+            bindings);
+  EXPECT_EQ(Lookup("GET", "/a/x/y/b/c"), a__bc);
+  EXPECT_EQ(Lookup("GET", "/a/b/c"), a__);
+  EXPECT_EQ(Lookup("GET", "/a/b/c/x"), a__);
+  EXPECT_EQ(Lookup("GET", "/a/x/c"), a__);
+  EXPECT_EQ(Lookup("POST", "/a/x/b/c"), a__c);
+  EXPECT_EQ(Lookup("POST", "/a/c/c"), a__c);
+  EXPECT_EQ(Lookup("POST", "/a/x/b"), nullptr);
+}
+
 TEST_F(PathMatcherTest, WildCardMethodMatches) {
   MethodInfo* a__ = AddPath("*", "/a/**");
   MethodInfo* b_ = AddPath("*", "/b/*");
@@ -246,6 +279,22 @@ TEST_F(PathMatcherTest, VariableVariableBindings) {
             bindings);
 }
 
+TEST_F(PathMatcherTest, VariableBindingViewsSliceThePath) {
+  MethodInfo* a_b_c = AddGetPath("/{x=a/*}/b/{y=**}:verb");
+  Build();
+
+  const std::string path = "/a/hello/b/big//world:verb?c=d";
+  std::vector<VariableBindingView> views;
+  EXPECT_EQ(Lookup("GET", path, &views), a_b_c);
+  ASSERT_EQ(views.size(), 2);
+  EXPECT_EQ(*views[0].field_path, FieldPath{"x"});
+  EXPECT_EQ(views[0].value, "a/hello");
+  EXPECT_EQ(views[0].value.data(), path.data() + 1);
+  EXPECT_EQ(*views[1].field_path, FieldPath{"y"});
+  EXPECT_EQ(views[1].value, "big//world");
+  EXPECT_EQ(views[1].value.data(), path.data() + 11);
+}
+
 TEST_F(PathMatcherTest, PercentEscapesUnescapedForSingleSegment) {
   MethodInfo* a_c = AddGetPath("/a/{x}/c");
   Build();
@@ -644,6 +693,100 @@ TEST_F(PathMatcherTest, DifferentHttpMethod) {
   EXPECT_EQ(Lookup("POST", "/a/b"), nullptr);
 }
 
+TEST_F(PathMatcherTest, CustomHttpMethod) {
+  auto purge = AddPath("PURGE", "/a/b");
+  auto get = AddGetPath("/a/b");
+  auto any = AddPath("*", "/a/b");
+  EXPECT_EQ(nullptr, AddPath("PURGE", "/a/b"));
+  Build();
+  EXPECT_EQ(Lookup("PURGE", "/a/b"), purge);
+  EXPECT_EQ(Lookup("GET", "/a/b"), get);
+  // Methods are case sensitive, unknown ones fall back to the wildcard.
+  EXPECT_EQ(Lookup("get", "/a/b"), any);
+  EXPECT_EQ(Lookup("POST", "/a/b"), any);
+}
+
+TEST_F(PathMatcherTest, LiteralPathsMatchLikeTheTrie) {
+  auto health = AddGetPath("/v1/health");
+  auto list = AddGetPath("/v1/shelves:list");
+  auto list_part = AddGetPath("/v1/shelves/list:other");
+  auto shelf = AddGetPath("/v1/{name}");
+  auto any = AddPath("*", "/v1/health");
+  auto root = AddGetPath("/");
+  Build();
+
+  VariableBindings bindings = {VariableBinding{{"stale"}, "value"}};
+  EXPECT_EQ(Lookup("GET", "/v1/health?a=b", &bindings), health);
+  EXPECT_TRUE(bindings.empty());
+  EXPECT_EQ(Lookup("GET", "/v1/health//"), health);
+  EXPECT_EQ(Lookup("POST", "/v1/health"), any);
+  EXPECT_EQ(Lookup("GET", "/v1//health"), nullptr);
+  EXPECT_EQ(Lookup("GET", "/"), root);
+  EXPECT_EQ(Lookup("GET", "///"), root);
+  EXPECT_EQ(Lookup("GET", ""), root);
+
+  EXPECT_EQ(Lookup("GET", "/v1/shelves:list"), list);
+  // The verb also matches as a segment.
+  EXPECT_EQ(Lookup("GET", "/v1/shelves/list"), list);
+  // A trailing slash keeps "list" from being a verb.
+  EXPECT_EQ(Lookup("GET", "/v1/shelves:list/", &bindings), shelf);
+  EXPECT_EQ(bindings.size(), 1);
+  EXPECT_EQ(Lookup("GET", "/v1/shelves/list:other"), list_part);
+}
+
+TEST(PathMatcherBuilderTest, RegistersTemplatesParsedInParallel) {
+  constexpr int kNumTemplates = 64;
+  constexpr int kNumThreads = 4;
+  std::vector<std::unique_ptr<HttpTemplate>> templates(kNumTemplates);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&templates, t]() {
+      for (int i = t; i < kNumTemplates; i += kNumThreads) {
+        templates[i] = HttpTemplate::Parse("/v1/shelves" + std::to_string(i) +
+                                           "/{shelf}/books:list");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<int> ids(kNumTemplates);
+  PathMatcherBuilder<const int*> builder;
+  for (int i = 0; i < kNumTemplates; ++i) {
+    ids[i] = i;
+    ASSERT_TRUE(builder.Register("GET", std::move(templates[i]), "", &ids[i]));
+  }
+  EXPECT_FALSE(builder.Register("GET", HttpTemplate::Parse("/{"), "", &ids[0]));
+  PathMatcherPtr<const int*> matcher = builder.Build();
+
+  for (int i = 0; i < kNumTemplates; ++i) {
+    EXPECT_EQ(matcher->Lookup("GET", "/v1/shelves" + std::to_string(i) +
+                                         "/1/books:list"),
+              &ids[i]);
+  }
+}
+
+TEST(ExtractRequestPartsTest, PartsViewThePath) {
+  const CustomVerbs custom_verbs = {"verb"};
+  const std::string path = "/a//b:verb?c=d";
+  const PathMatcherNode::RequestPathParts parts =
+      ExtractRequestParts(path, custom_verbs);
+
+  ASSERT_EQ(parts.size(), 4);
+  EXPECT_EQ(parts[0], "a");
+  EXPECT_EQ(parts[1], "");
+  EXPECT_EQ(parts[2], "b");
+  EXPECT_EQ(parts[3], "verb");
+  EXPECT_EQ(parts[0].data(), path.data() + 1);
+  EXPECT_EQ(parts[3].data(), path.data() + 6);
+
+  // Not a configured verb, and trailing slashes dropped.
+  EXPECT_EQ(ExtractRequestParts("/a:other//", custom_verbs),
+            PathMatcherNode::RequestPathParts({"a:other"}));
+  EXPECT_TRUE(ExtractRequestParts("/", custom_verbs).empty());
+}
+
 }  // namespace
 
 }  // namespace path_matcher
@@ -0,0 +1,278 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/path_matcher/path_matcher_trie.h"
+
+#include <algorithm>
+#include <bitset>
+#include <functional>
+
+#include "absl/hash/hash.h"
+#include "src/api_proxy/path_matcher/http_template.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace path_matcher {
+
+namespace {
+
+size_t hashKey(absl::string_view key) {
+  return absl::Hash<absl::string_view>{}(key);
+}
+
+uint16_t methodBit(HttpMethodId id) {
+  return static_cast<uint16_t>(1u << static_cast<size_t>(id));
+}
+
+}  // namespace
+
+PathMatcherTrie::PathMatcherTrie(const PathMatcherNode& root) {
+  // The nodes are numbered in the order they are visited, breadth first.
+  std::vector<const PathMatcherNode*> sources = {&root};
+  nodes_.emplace_back();
+  for (size_t i = 0; i < sources.size(); ++i) {
+    const PathMatcherNode& source = *sources[i];
+    Node node;
+    node.wildcard = source.wildcard_;
+
+    node.first_result = results_.size();
+    for (size_t id = 0; id < kNumHttpMethodSlots; ++id) {
+      if (source.results_[id].registered) {
+        node.result_mask |= methodBit(static_cast<HttpMethodId>(id));
+        results_.push_back(source.results_[id].result);
+      }
+    }
+
+    node.first_custom_result = custom_results_.size();
+    node.num_custom_results = source.custom_results_.size();
+    for (const auto& custom : source.custom_results_) {
+      custom_results_.push_back({addToPool(custom.first), custom.second});
+    }
+
+    node.first_child = children_.size();
+    node.num_children = source.children_.size();
+    for (const auto& entry : source.children_) {
+      const uint32_t child = sources.size();
+      sources.push_back(entry.second.get());
+      nodes_.emplace_back();
+      children_.push_back(
+          {hashKey(entry.first), addToPool(entry.first), child});
+
+      if (entry.first == HttpTemplate::kSingleParameterKey) {
+        node.single_parameter_child = child;
+      } else if (entry.first == HttpTemplate::kWildCardPathPartKey) {
+        node.wildcard_path_part_child = child;
+      } else if (entry.first == HttpTemplate::kWildCardPathKey) {
+        node.wildcard_path_child = child;
+      }
+    }
+    std::sort(children_.begin() + node.first_child, children_.end(),
+              [](const Child& a, const Child& b) { return a.hash < b.hash; });
+
+    nodes_[i] = node;
+  }
+
+  for (uint32_t i = 0; i < nodes_.size(); ++i) {
+    if (nodes_[i].wildcard) {
+      addLiteralSuffixes(i);
+    }
+  }
+}
+
+void PathMatcherTrie::addLiteralSuffixes(uint32_t node_index) {
+  std::vector<uint32_t> lengths;
+  // The nodes below the wildcard node, with the length of their path.
+  std::vector<std::pair<uint32_t, uint32_t>> pending = {{node_index, 0}};
+  while (!pending.empty()) {
+    const auto [index, length] = pending.back();
+    pending.pop_back();
+    const Node& node = nodes_[index];
+    if (index != node_index) {
+      if (node.single_parameter_child != kNoNode ||
+          node.wildcard_path_part_child != kNoNode ||
+          node.wildcard_path_child != kNoNode || node.wildcard) {
+        return;
+      }
+      if (node.result_mask != 0 || node.num_custom_results != 0) {
+        lengths.push_back(length);
+      }
+    } else if (node.single_parameter_child != kNoNode ||
+               node.wildcard_path_part_child != kNoNode ||
+               node.wildcard_path_child != kNoNode) {
+      return;
+    }
+    for (uint32_t i = 0; i < node.num_children; ++i) {
+      pending.emplace_back(children_[node.first_child + i].node, length + 1);
+    }
+  }
+
+  std::sort(lengths.begin(), lengths.end(), std::greater<uint32_t>());
+  lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+  Node& node = nodes_[node_index];
+  node.literal_suffixes = true;
+  node.first_suffix_length = suffix_lengths_.size();
+  node.num_suffix_lengths = lengths.size();
+  suffix_lengths_.insert(suffix_lengths_.end(), lengths.begin(),
+                         lengths.end());
+}
+
+PathMatcherTrie::PoolString PathMatcherTrie::addToPool(
+    absl::string_view value) {
+  PoolString pooled{static_cast<uint32_t>(pool_.size()),
+                    static_cast<uint32_t>(value.size())};
+  pool_.append(value.data(), value.size());
+  return pooled;
+}
+
+PathMatcherLookupResult PathMatcherTrie::Lookup(
+    const PathMatcherNode::RequestPathParts& parts,
+    const InternedHttpMethod& http_method) const {
+  PathMatcherLookupResult result;
+  lookupPath(0, parts.begin(), parts.end(), http_method, &result);
+  return result;
+}
+
+void PathMatcherTrie::lookupPath(
+    uint32_t node_index,
+    PathMatcherNode::RequestPathParts::const_iterator current,
+    PathMatcherNode::RequestPathParts::const_iterator end,
+    const InternedHttpMethod& http_method,
+    PathMatcherLookupResult* result) const {
+  const Node& node = nodes_[node_index];
+  // base case
+  if (current == end) {
+    if (!getResultForHttpMethod(node, http_method, result) &&
+        node.wildcard_path_child != kNoNode) {
+      // Match the root with wildcard templates.
+      getResultForHttpMethod(nodes_[node.wildcard_path_child], http_method,
+                             result);
+    }
+    return;
+  }
+  if (lookupPathFromChild(findChild(node, *current), current, end, http_method,
+                          result)) {
+    return;
+  }
+  if (node.literal_suffixes) {
+    lookupLiteralSuffix(node, node_index, current, end, http_method, result);
+    return;
+  }
+  if (node.wildcard) {
+    lookupPath(node_index, current + 1, end, http_method, result);
+    return;
+  }
+
+  for (uint32_t child :
+       {node.single_parameter_child, node.wildcard_path_part_child,
+        node.wildcard_path_child}) {
+    if (lookupPathFromChild(child, current, end, http_method, result)) {
+      return;
+    }
+  }
+}
+
+void PathMatcherTrie::lookupLiteralSuffix(
+    const Node& node, uint32_t node_index,
+    PathMatcherNode::RequestPathParts::const_iterator current,
+    PathMatcherNode::RequestPathParts::const_iterator end,
+    const InternedHttpMethod& http_method,
+    PathMatcherLookupResult* result) const {
+  const size_t remaining = end - current;
+  for (uint32_t i = 0; i < node.num_suffix_lengths; ++i) {
+    const uint32_t length = suffix_lengths_[node.first_suffix_length + i];
+    // The whole remaining parts were matched with the literal child.
+    if (length >= remaining) {
+      continue;
+    }
+    uint32_t suffix_node = node_index;
+    for (auto part = end - length; part != end && suffix_node != kNoNode;
+         ++part) {
+      suffix_node = findChild(nodes_[suffix_node], *part);
+    }
+    if (suffix_node != kNoNode) {
+      lookupPath(suffix_node, end, end, http_method, result);
+      if (result->data != nullptr) {
+        return;
+      }
+    }
+  }
+  // The wildcard matches all the remaining parts.
+  lookupPath(node_index, end, end, http_method, result);
+}
+
+bool PathMatcherTrie::lookupPathFromChild(
+    uint32_t child, PathMatcherNode::RequestPathParts::const_iterator current,
+    PathMatcherNode::RequestPathParts::const_iterator end,
+    const InternedHttpMethod& http_method,
+    PathMatcherLookupResult* result) const {
+  if (child == kNoNode) {
+    return false;
+  }
+  lookupPath(child, current + 1, end, http_method, result);
+  return result != nullptr && result->data != nullptr;
+}
+
+uint32_t PathMatcherTrie::findChild(const Node& node,
+                                    absl::string_view key) const {
+  const auto begin = children_.begin() + node.first_child;
+  const auto end = begin + node.num_children;
+  const size_t hash = hashKey(key);
+  for (auto it = std::lower_bound(
+           begin, end, hash,
+           [](const Child& child, size_t hash) { return child.hash < hash; });
+       it != end && it->hash == hash; ++it) {
+    if (fromPool(it->key) == key) {
+      return it->node;
+    }
+  }
+  return kNoNode;
+}
+
+bool PathMatcherTrie::getResultForHttpMethod(
+    const Node& node, const InternedHttpMethod& http_method,
+    PathMatcherLookupResult* result) const {
+  const PathMatcherLookupResult* found = nullptr;
+  if (http_method.id == HttpMethodId::kCustom) {
+    for (uint32_t i = 0; i < node.num_custom_results; ++i) {
+      const CustomResult& custom =
+          custom_results_[node.first_custom_result + i];
+      if (fromPool(custom.method) == http_method.name) {
+        found = &custom.result;
+        break;
+      }
+    }
+  }
+
+  for (HttpMethodId id : {http_method.id, HttpMethodId::kWildCard}) {
+    if (found != nullptr || id == HttpMethodId::kCustom) {
+      continue;
+    }
+    const uint16_t bit = methodBit(id);
+    if (node.result_mask & bit) {
+      // The results are ordered by method id.
+      found = &results_[node.first_result +
+                        std::bitset<16>(node.result_mask & (bit - 1)).count()];
+    }
+  }
+
+  if (found != nullptr) {
+    *result = *found;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace path_matcher
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,140 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "src/api_proxy/path_matcher/path_matcher_node.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace path_matcher {
+
+// An immutable copy of a PathMatcherNode trie laid out for lookups.
+//
+// The nodes are stored contiguously in breadth-first order and refer to each
+// other by index. The children of a node are a contiguous range sorted by the
+// hash of their key, searched by the hash of the request part; the parameter
+// and wildcard children are also indexed directly. The results of a node are
+// a contiguous range too, one per method in its bitmask of registered method
+// ids. All keys and custom method names share a single string pool.
+//
+// Only literal segments may follow a "**" segment, so a "**" node also keeps
+// the lengths of the literal suffixes registered below it. A lookup only
+// tries to match the suffixes at the positions those lengths leave, instead
+// of at every remaining part, so it stays linear in the path length.
+//
+// Lookups match exactly like PathMatcherNode::LookupPath.
+class PathMatcherTrie {
+ public:
+  explicit PathMatcherTrie(const PathMatcherNode& root);
+
+  PathMatcherLookupResult Lookup(
+      const PathMatcherNode::RequestPathParts& parts,
+      const InternedHttpMethod& http_method) const;
+
+ private:
+  static constexpr uint32_t kNoNode = UINT32_MAX;
+
+  // A range of the string pool.
+  struct PoolString {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  struct Child {
+    size_t hash;
+    PoolString key;
+    uint32_t node;
+  };
+
+  struct CustomResult {
+    PoolString method;
+    PathMatcherLookupResult result;
+  };
+
+  struct Node {
+    uint32_t first_child = 0;
+    uint32_t num_children = 0;
+    uint32_t single_parameter_child = kNoNode;
+    uint32_t wildcard_path_part_child = kNoNode;
+    uint32_t wildcard_path_child = kNoNode;
+    uint32_t first_result = 0;
+    uint32_t first_custom_result = 0;
+    uint16_t num_custom_results = 0;
+    // Bit i is set if the method with id i has a result.
+    uint16_t result_mask = 0;
+    bool wildcard = false;
+    // Set for a wildcard node with only literal nodes below it. The lengths
+    // of their paths that have results, longest first.
+    bool literal_suffixes = false;
+    uint32_t first_suffix_length = 0;
+    uint32_t num_suffix_lengths = 0;
+  };
+
+  static_assert(kNumHttpMethodSlots <= 16, "result_mask is too small");
+
+  PoolString addToPool(absl::string_view value);
+  absl::string_view fromPool(PoolString value) const {
+    return absl::string_view(pool_.data() + value.offset, value.size);
+  }
+
+  void lookupPath(uint32_t node,
+                  PathMatcherNode::RequestPathParts::const_iterator current,
+                  PathMatcherNode::RequestPathParts::const_iterator end,
+                  const InternedHttpMethod& http_method,
+                  PathMatcherLookupResult* result) const;
+
+  // Matches the parts with the literal suffixes of a wildcard node. The
+  // shortest prefix of the parts is left to the wildcard, like the search of
+  // PathMatcherNode::LookupPath does.
+  void lookupLiteralSuffix(
+      const Node& node, uint32_t node_index,
+      PathMatcherNode::RequestPathParts::const_iterator current,
+      PathMatcherNode::RequestPathParts::const_iterator end,
+      const InternedHttpMethod& http_method,
+      PathMatcherLookupResult* result) const;
+
+  // Sets the suffix lengths of the wildcard node, if only literal nodes are
+  // below it.
+  void addLiteralSuffixes(uint32_t node_index);
+
+  bool lookupPathFromChild(
+      uint32_t child, PathMatcherNode::RequestPathParts::const_iterator current,
+      PathMatcherNode::RequestPathParts::const_iterator end,
+      const InternedHttpMethod& http_method,
+      PathMatcherLookupResult* result) const;
+
+  // Returns the child of the node with the key, or kNoNode.
+  uint32_t findChild(const Node& node, absl::string_view key) const;
+
+  bool getResultForHttpMethod(const Node& node,
+                              const InternedHttpMethod& http_method,
+                              PathMatcherLookupResult* result) const;
+
+  std::vector<Node> nodes_;
+  std::vector<Child> children_;
+  std::vector<PathMatcherLookupResult> results_;
+  std::vector<CustomResult> custom_results_;
+  std::vector<uint32_t> suffix_lengths_;
+  std::string pool_;
+};
+
+}  // namespace path_matcher
+}  // namespace api_proxy
+}  // namespace espv2
@@ -20,31 +20,67 @@ namespace espv2 {
 namespace api_proxy {
 namespace path_matcher {
 
+namespace {
+
+const std::vector<std::string>& FieldPath(const VariableBinding& binding) {
+  return binding.field_path;
+}
+
+const std::vector<std::string>& FieldPath(const VariableBindingView& binding) {
+  return *binding.field_path;
+}
+
+template <typename Binding>
+void AppendQueryParameters(const std::vector<Binding>& variable_bindings,
+                           std::string* query_params) {
+  for (size_t i = 0; i < variable_bindings.size(); i++) {
+    const Binding& variable_binding = variable_bindings[i];
+    AppendVariableBindingToQueryParameters(
+        FieldPath(variable_binding), variable_binding.value, query_params);
+    if (i < variable_bindings.size() - 1) {
+      query_params->append("&");
+    }
+  }
+}
+
+}  // namespace
+
 const std::string VariableBindingsToQueryParameters(
     const std::vector<VariableBinding>& variable_bindings) {
   std::string query_params;
-  for (size_t i = 0; i < variable_bindings.size(); i++) {
-    const VariableBinding& variable_binding = variable_bindings[i];
-    for (size_t j = 0; j < variable_binding.field_path.size(); j++) {
-      // This segment should be camel case instead of snake case.
-      // We can add validation here but it will be unnecessary after we have
-      // syntax parser in the control plane to ensure the correctness of url
-      // template.
-      const std::string& segment = variable_binding.field_path[j];
-      query_params.append(segment);
-
-      if (j < variable_binding.field_path.size() - 1) {
-        query_params.append(".");
-      }
-    }
+  AppendQueryParameters(variable_bindings, &query_params);
+  return query_params;
+}
 
-    query_params.append("=");
-    query_params.append(variable_binding.value);
-    if (i < variable_bindings.size() - 1) {
-      query_params.append("&");
+void AppendVariableBindingsToQueryParameters(
+    const std::vector<VariableBinding>& variable_bindings, std::string* query) {
+  AppendQueryParameters(variable_bindings, query);
+}
+
+void AppendVariableBindingsToQueryParameters(
+    const std::vector<VariableBindingView>& variable_bindings,
+    std::string* query) {
+  AppendQueryParameters(variable_bindings, query);
+}
+
+void AppendVariableBindingToQueryParameters(
+    const std::vector<std::string>& field_path, absl::string_view value,
+    std::string* query) {
+  for (size_t j = 0; j < field_path.size(); j++) {
+    // This segment should be camel case instead of snake case.
+    // We can add validation here but it will be unnecessary after we have
+    // syntax parser in the control plane to ensure the correctness of url
+    // template.
+    const std::string& segment = field_path[j];
+    query->append(segment);
+
+    if (j < field_path.size() - 1) {
+      query->append(".");
     }
   }
-  return query_params;
+
+  query->append("=");
+  query->append(value.data(), value.size());
 }
 
 }  // namespace path_matcher
@@ -34,6 +34,20 @@ namespace path_matcher {
 const std::string VariableBindingsToQueryParameters(
     const std::vector<VariableBinding>& variable_bindings);
 
+// Same as above, but appends the query parameters to `query`, so the caller can
+// build them into a buffer it reserved.
+void AppendVariableBindingsToQueryParameters(
+    const std::vector<VariableBinding>& variable_bindings, std::string* query);
+void AppendVariableBindingsToQueryParameters(
+    const std::vector<VariableBindingView>& variable_bindings,
+    std::string* query);
+
+// Appends the query parameter of a single variable binding, e.g. "foo.bar=42",
+// without a separator.
+void AppendVariableBindingToQueryParameters(
+    const std::vector<std::string>& field_path, absl::string_view value,
+    std::string* query);
+
 }  // namespace path_matcher
 }  // namespace api_proxy
 }  // namespace espv2
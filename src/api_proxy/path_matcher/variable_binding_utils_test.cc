@@ -43,6 +43,21 @@ TEST(VariableBindingsToQueryParameters, Test) {
                 }),
             "id=42&foo.bar.baz=value&x.y=abc");
 }
+
+TEST(AppendVariableBindingsToQueryParameters, AppendsViews) {
+  const std::vector<std::string> id = {"id"};
+  const std::vector<std::string> foo_bar = {"foo", "bar"};
+  const std::string path = "/shelves/42/books/7";
+  std::string query = "a=b&";
+  AppendVariableBindingsToQueryParameters(
+      /*variable_bindings=*/
+      std::vector<VariableBindingView>{
+          {&id, absl::string_view(path).substr(9, 2)},
+          {&foo_bar, absl::string_view(path).substr(12)},
+      },
+      &query);
+  EXPECT_EQ(query, "a=b&id=42&foo.bar=books/7");
+}
 }  // namespace path_matcher
 }  // namespace api_proxy
 }  // namespace espv2
@@ -0,0 +1,54 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/service_control/distribution_buckets.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+
+using ::google::api::servicecontrol::v1::Distribution;
+
+DistributionBuckets::DistributionBuckets(int num_finite_buckets,
+                                         double growth_factor, double scale)
+    : num_finite_buckets_(num_finite_buckets),
+      growth_factor_(growth_factor),
+      scale_(scale) {
+  bounds_.reserve(num_finite_buckets + 1);
+  double bound = scale;
+  for (int i = 0; i <= num_finite_buckets; ++i) {
+    bounds_.push_back(bound);
+    bound *= growth_factor;
+  }
+}
+
+void DistributionBuckets::setSample(double value,
+                                    Distribution* distribution) const {
+  distribution->set_count(1);
+  distribution->set_mean(value);
+  distribution->set_minimum(value);
+  distribution->set_maximum(value);
+  auto* bucket_counts = distribution->mutable_bucket_counts();
+  bucket_counts->Resize(num_finite_buckets_ + 2, 0);
+  bucket_counts->Set(index(value), 1);
+
+  auto* buckets = distribution->mutable_exponential_buckets();
+  buckets->set_num_finite_buckets(num_finite_buckets_);
+  buckets->set_growth_factor(growth_factor_);
+  buckets->set_scale(scale_);
+}
+
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,62 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vector>
+
+#include "google/api/servicecontrol/v1/distribution.pb.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+
+// The exponential buckets of a distribution metric, as set up by
+// DistributionHelper::InitExponential. The bounds of the buckets are computed
+// once, so a sample is bucketed by comparing it with them instead of with a
+// logarithm.
+class DistributionBuckets {
+ public:
+  // The options must be valid: at least one finite bucket, a growth factor
+  // above 1 and a positive scale.
+  DistributionBuckets(int num_finite_buckets, double growth_factor,
+                      double scale);
+
+  // Returns the index of the bucket of the value in the bucket counts: 0 for
+  // the underflow bucket, then the finite buckets, then the overflow bucket.
+  int index(double value) const {
+    int index = 0;
+    for (double bound : bounds_) {
+      // Counted without a branch, so the loop can be vectorized.
+      index += value >= bound;
+    }
+    return index;
+  }
+
+  // Sets the distribution to one with the value as its only sample.
+  void setSample(double value,
+                 ::google::api::servicecontrol::v1::Distribution* distribution)
+      const;
+
+ private:
+  // The lower bounds of the finite buckets and of the overflow bucket.
+  std::vector<double> bounds_;
+  const int num_finite_buckets_;
+  const double growth_factor_;
+  const double scale_;
+};
+
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,79 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/service_control/distribution_buckets.h"
+
+#include "google/protobuf/util/message_differencer.h"
+#include "gtest/gtest.h"
+#include "utils/distribution_helper.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+namespace {
+
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::protobuf::util::MessageDifferencer;
+using ::google::service_control_client::DistributionHelper;
+
+TEST(DistributionBucketsTest, Index) {
+  DistributionBuckets buckets(3, 10.0, 1);
+
+  EXPECT_EQ(buckets.index(-1), 0);
+  EXPECT_EQ(buckets.index(0.5), 0);
+  // A bucket includes its lower bound.
+  EXPECT_EQ(buckets.index(1), 1);
+  EXPECT_EQ(buckets.index(9.9), 1);
+  EXPECT_EQ(buckets.index(10), 2);
+  EXPECT_EQ(buckets.index(100), 3);
+  EXPECT_EQ(buckets.index(999), 3);
+  EXPECT_EQ(buckets.index(1000), 4);
+  EXPECT_EQ(buckets.index(1e9), 4);
+}
+
+TEST(DistributionBucketsTest, SameAsDistributionHelper) {
+  const struct {
+    int num_finite_buckets;
+    double growth_factor;
+    double scale;
+  } options[] = {{29, 2.0, 1e-6}, {8, 10.0, 1}};
+  // Off the bucket bounds, where the logarithm is exact enough.
+  const double values[] = {-1,    0,     1e-7,  3e-6,   0.022, 0.101,
+                           0.123, 7.5,   300.5, 5.5e3,  42,    1048576,
+                           1e12,  123.4, 9e7,   2.5e-3, 1e-5,  600};
+
+  for (const auto& option : options) {
+    DistributionBuckets buckets(option.num_finite_buckets,
+                                option.growth_factor, option.scale);
+    for (double value : values) {
+      Distribution expected;
+      ASSERT_TRUE(DistributionHelper::InitExponential(
+                      option.num_finite_buckets, option.growth_factor,
+                      option.scale, &expected)
+                      .ok());
+      ASSERT_TRUE(DistributionHelper::AddSample(value, &expected).ok());
+
+      Distribution distribution;
+      buckets.setSample(value, &distribution);
+      EXPECT_TRUE(MessageDifferencer::Equals(distribution, expected))
+          << value << ": " << distribution.DebugString() << " vs "
+          << expected.DebugString();
+    }
+  }
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
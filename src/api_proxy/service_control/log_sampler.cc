@@ -0,0 +1,97 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/service_control/log_sampler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+namespace {
+
+constexpr uint64_t kSampleBuckets = 10000;
+
+bool IsSuccess(const ReportRequestInfo& info) {
+  return info.http_response_code >= 200 && info.http_response_code < 300;
+}
+
+}  // namespace
+
+LogSampler::LogSampler(double success_percentage,
+                       uint32_t max_success_logs_per_consumer_per_second)
+    : success_threshold_(static_cast<uint64_t>(
+          std::min(std::max(success_percentage, 0.0), 100.0) *
+          (kSampleBuckets / 100))),
+      max_success_logs_per_consumer_per_second_(
+          max_success_logs_per_consumer_per_second) {}
+
+bool LogSampler::ShouldLog(const ReportRequestInfo& info) {
+  if (!IsSuccess(info)) {
+    return true;
+  }
+  if (success_threshold_ < kSampleBuckets &&
+      absl::Hash<absl::string_view>{}(info.operation_id) % kSampleBuckets >=
+          success_threshold_) {
+    return false;
+  }
+  return max_success_logs_per_consumer_per_second_ == 0 ||
+         TakeConsumerLog(info);
+}
+
+bool LogSampler::TakeConsumerLog(const ReportRequestInfo& info) {
+  const int64_t second =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          info.current_time.time_since_epoch())
+          .count();
+
+  Shard& shard = shards_[absl::Hash<absl::string_view>{}(info.api_key) &
+                         (kNumShards - 1)];
+
+  absl::MutexLock lock(&shard.mutex);
+  Window* window;
+  const auto it = shard.index.find(info.api_key);
+  if (it != shard.index.end()) {
+    shard.consumers.splice(shard.consumers.begin(), shard.consumers,
+                           it->second);
+    window = &it->second->window;
+    if (window->epoch_second != second) {
+      *window = Window{second, 0};
+    }
+  } else {
+    if (shard.index.size() >= kMaxConsumersPerShard) {
+      shard.index.erase(shard.consumers.back().api_key);
+      shard.consumers.pop_back();
+    }
+    shard.consumers.push_front(
+        Consumer{std::string(info.api_key), Window{second, 0}});
+    shard.index.emplace(shard.consumers.front().api_key,
+                        shard.consumers.begin());
+    window = &shard.consumers.front().window;
+  }
+
+  if (window->count >= max_success_logs_per_consumer_per_second_) {
+    return false;
+  }
+  ++window->count;
+  return true;
+}
+
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,91 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "src/api_proxy/service_control/request_info.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+
+// Picks the requests whose report carries their log entries.
+//
+// Requests without a 2xx response code are always logged. Of the others, a
+// fixed percentage is logged, picked by the hash of their operation id. If a
+// per consumer limit is set, at most that many of them are logged per second
+// for each API key. Thread safe.
+//
+// The consumers are spread over lock-striped shards by API key, so the
+// workers rarely contend. Each shard tracks a bounded number of consumers,
+// and evicts the least recently logged one for a new consumer once full. An
+// evicted consumer starts a new window when it comes back.
+class LogSampler {
+ public:
+  LogSampler(double success_percentage,
+             uint32_t max_success_logs_per_consumer_per_second);
+
+  LogSampler(const LogSampler&) = delete;
+  LogSampler& operator=(const LogSampler&) = delete;
+
+  // Returns whether the log entries of the request are sent.
+  bool ShouldLog(const ReportRequestInfo& info);
+
+ private:
+  // The logged requests of a consumer within one second.
+  struct Window {
+    int64_t epoch_second;
+    uint32_t count;
+  };
+
+  struct Consumer {
+    std::string api_key;
+    Window window;
+  };
+  using Consumers = std::list<Consumer>;
+
+  struct Shard {
+    absl::Mutex mutex;
+    // The most recently logged consumer first.
+    Consumers consumers ABSL_GUARDED_BY(mutex);
+    // Views the API keys of the consumers.
+    absl::flat_hash_map<absl::string_view, Consumers::iterator> index
+        ABSL_GUARDED_BY(mutex);
+  };
+
+  // Must be a power of 2.
+  static constexpr size_t kNumShards = 16;
+  static constexpr size_t kMaxConsumersPerShard = 10000 / kNumShards;
+
+  // Consumes a log of the consumer of the request from its window.
+  bool TakeConsumerLog(const ReportRequestInfo& info);
+
+  // Out of 10000, so rates down to 0.01% can be set.
+  const uint64_t success_threshold_;
+  const uint32_t max_success_logs_per_consumer_per_second_;
+
+  std::array<Shard, kNumShards> shards_;
+};
+
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
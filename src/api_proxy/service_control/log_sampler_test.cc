@@ -0,0 +1,113 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/service_control/log_sampler.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+namespace {
+
+// The operation id must outlive the info.
+ReportRequestInfo MakeInfo(const std::string& operation_id, int response_code) {
+  ReportRequestInfo info;
+  info.operation_id = operation_id;
+  info.http_response_code = response_code;
+  info.api_key = "api_key_x";
+  info.current_time =
+      std::chrono::system_clock::time_point(std::chrono::seconds(1000));
+  return info;
+}
+
+TEST(LogSamplerTest, ErrorsAlwaysLogged) {
+  LogSampler sampler(0, 1);
+  for (int i = 0; i < 10; ++i) {
+    const std::string id = std::to_string(i);
+    EXPECT_TRUE(sampler.ShouldLog(MakeInfo(id, 500)));
+    EXPECT_TRUE(sampler.ShouldLog(MakeInfo(id, 404)));
+  }
+}
+
+TEST(LogSamplerTest, SuccessPercentage) {
+  LogSampler none(0, 0);
+  LogSampler all(100, 0);
+  LogSampler some(30, 0);
+  int sampled = 0;
+  for (int i = 0; i < 10000; ++i) {
+    const std::string id = std::to_string(i);
+    const ReportRequestInfo info = MakeInfo(id, 200);
+    EXPECT_FALSE(none.ShouldLog(info));
+    EXPECT_TRUE(all.ShouldLog(info));
+    sampled += some.ShouldLog(info);
+
+    // The same request is always sampled the same way.
+    EXPECT_EQ(some.ShouldLog(info), some.ShouldLog(info));
+  }
+  EXPECT_NEAR(sampled, 3000, 300);
+}
+
+TEST(LogSamplerTest, PerConsumerLimit) {
+  LogSampler sampler(100, 2);
+  const std::string id = "id";
+  ReportRequestInfo info = MakeInfo(id, 200);
+  EXPECT_TRUE(sampler.ShouldLog(info));
+  EXPECT_TRUE(sampler.ShouldLog(info));
+  EXPECT_FALSE(sampler.ShouldLog(info));
+
+  // Other consumers have their own limit.
+  ReportRequestInfo other = info;
+  other.api_key = "api_key_y";
+  EXPECT_TRUE(sampler.ShouldLog(other));
+
+  // Errors are not limited.
+  info.http_response_code = 500;
+  EXPECT_TRUE(sampler.ShouldLog(info));
+
+  // The limit is reset the next second.
+  info.http_response_code = 200;
+  info.current_time += std::chrono::seconds(1);
+  EXPECT_TRUE(sampler.ShouldLog(info));
+}
+
+TEST(LogSamplerTest, NewConsumerLoggedOnceFull) {
+  LogSampler sampler(100, 1);
+  const std::string id = "id";
+  ReportRequestInfo info = MakeInfo(id, 200);
+
+  // More consumers than are tracked, all within the same second.
+  std::vector<std::string> api_keys;
+  for (int i = 0; i < 20000; ++i) {
+    api_keys.push_back("api_key_" + std::to_string(i));
+  }
+  for (const std::string& api_key : api_keys) {
+    info.api_key = api_key;
+    EXPECT_TRUE(sampler.ShouldLog(info));
+  }
+
+  // A new consumer is still logged, and limited.
+  info.api_key = "api_key_new";
+  EXPECT_TRUE(sampler.ShouldLog(info));
+  EXPECT_FALSE(sampler.ShouldLog(info));
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
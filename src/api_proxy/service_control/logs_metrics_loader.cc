@@ -14,8 +14,6 @@
 
 #include "src/api_proxy/service_control/logs_metrics_loader.h"
 
-#include <algorithm>
-
 #include "src/api_proxy/service_control/request_builder.h"
 
 namespace espv2 {
@@ -24,7 +22,6 @@ namespace service_control {
 
 using ::google::api::LabelDescriptor;
 using ::google::api::LogDescriptor;
-using ::google::api::Logging;
 using ::google::api::Logging_LoggingDestination;
 using ::google::api::MetricDescriptor;
 using ::google::api::MonitoredResourceDescriptor;
@@ -45,16 +42,29 @@ Status LogsMetricsLoader::Load(const Service& service,
   return lml.LoadLogsMetrics(service, logs, metrics, labels);
 }
 
-Status LogsMetricsLoader::AddLabels(
-    const RepeatedPtrField<LabelDescriptor>& descriptors,
-    std::map<std::string, const LabelDescriptor&>* labels) {
-  for (int i = 0, size = descriptors.size(); i < size; i++) {
-    const LabelDescriptor& ld = descriptors.Get(i);
+LogsMetricsLoader::Descriptors::Descriptors(const Service& service) {
+  // The first descriptor of a name wins.
+  logs.reserve(service.logs_size());
+  for (const LogDescriptor& ld : service.logs()) {
+    logs.emplace(ld.name(), &ld);
+  }
+  monitored_resources.reserve(service.monitored_resources_size());
+  for (const MonitoredResourceDescriptor& mr : service.monitored_resources()) {
+    monitored_resources.emplace(mr.type(), &mr);
+  }
+  metrics.reserve(service.metrics_size());
+  for (const MetricDescriptor& md : service.metrics()) {
+    metrics.emplace(md.name(), &md);
+  }
+}
 
+Status LogsMetricsLoader::AddLabels(
+    const RepeatedPtrField<LabelDescriptor>& descriptors, LabelMap* labels) {
+  for (const LabelDescriptor& ld : descriptors) {
     // Check for pre-existing incompatible duplicates
     auto existing = labels->find(ld.key());
     if (existing != labels->end()) {
-      if (existing->second.value_type() != ld.value_type()) {
+      if (existing->second->value_type() != ld.value_type()) {
         return Status(StatusCode::kInvalidArgument,
                       "Conflicting label in the configuration: " + ld.key());
       }
@@ -62,66 +72,51 @@ Status LogsMetricsLoader::AddLabels(
   }
 
   // Only insert the labels into the output set once we validated them.
-  for (int i = 0, size = descriptors.size(); i < size; i++) {
-    const LabelDescriptor& ld = descriptors.Get(i);
+  for (const LabelDescriptor& ld : descriptors) {
     if (label_supported_(ld)) {
-      labels->insert(std::map<std::string, const LabelDescriptor&>::value_type(
-          ld.key(), ld));
+      labels->emplace(ld.key(), &ld);
     }
   }
 
   return OkStatus();
 }
 
-Status LogsMetricsLoader::AddLogLabels(
-    const ::google::protobuf::RepeatedPtrField<LogDescriptor>& descriptors,
-    const std::string& log_name,
-    std::map<std::string, const LabelDescriptor&>* labels) {
-  for (int i = 0, size = descriptors.size(); i < size; i++) {
-    const LogDescriptor& ld = descriptors.Get(i);
-    if (ld.name() == log_name) {
-      // Found the log.
-      return AddLabels(ld.labels(), labels);
-    }
+Status LogsMetricsLoader::AddLogLabels(const Descriptors& descriptors,
+                                       const std::string& log_name,
+                                       LabelMap* labels) {
+  const auto it = descriptors.logs.find(log_name);
+  if (it == descriptors.logs.end()) {
+    return Status(StatusCode::kInvalidArgument, "Log not found: " + log_name);
   }
-  return Status(StatusCode::kInvalidArgument, "Log not found: " + log_name);
+  return AddLabels(it->second->labels(), labels);
 }
 
 Status LogsMetricsLoader::AddMonitoredResourceLabels(
-    const RepeatedPtrField<MonitoredResourceDescriptor>& descriptors,
-    const std::string& monitored_resource_name,
-    std::map<std::string, const LabelDescriptor&>* labels) {
-  for (int i = 0, size = descriptors.size(); i < size; i++) {
-    const MonitoredResourceDescriptor& mr = descriptors.Get(i);
-    if (mr.type() == monitored_resource_name) {
-      // Found the monitored resource.
-      return AddLabels(mr.labels(), labels);
-    }
+    const Descriptors& descriptors, const std::string& monitored_resource_name,
+    LabelMap* labels) {
+  const auto it = descriptors.monitored_resources.find(monitored_resource_name);
+  if (it == descriptors.monitored_resources.end()) {
+    return Status(StatusCode::kInvalidArgument,
+                  "Monitored resource not found: " + monitored_resource_name);
   }
-  return Status(StatusCode::kInvalidArgument,
-                "Monitored resource not found: " + monitored_resource_name);
+  return AddLabels(it->second->labels(), labels);
 }
 
 Status LogsMetricsLoader::AddLoggingDestinations(
     const RepeatedPtrField<Logging_LoggingDestination>& destinations,
-    const RepeatedPtrField<MonitoredResourceDescriptor>& monitored_resources,
-    const RepeatedPtrField<LogDescriptor>& log_descriptors,
-    std::set<std::string>* logs,
-    std::map<std::string, const LabelDescriptor&>* labels) {
+    const Descriptors& descriptors, std::set<std::string>* logs,
+    LabelMap* labels) {
   Status s = OkStatus();
-  for (int d = 0, dsize = destinations.size(); d < dsize; d++) {
-    const Logging_LoggingDestination& ld = destinations.Get(d);
-
-    s = AddMonitoredResourceLabels(monitored_resources, ld.monitored_resource(),
+  for (const Logging_LoggingDestination& ld : destinations) {
+    s = AddMonitoredResourceLabels(descriptors, ld.monitored_resource(),
                                    labels);
     if (!s.ok()) {
       continue;  // Skip bad monitored resource.
     }
 
     // Store names of logs ESPv2 should log into.
-    for (int l = 0, lsize = ld.logs_size(); l < lsize; l++) {
-      const std::string& log_name = ld.logs(l);
-      s = AddLogLabels(log_descriptors, log_name, labels);
+    for (const std::string& log_name : ld.logs()) {
+      s = AddLogLabels(descriptors, log_name, labels);
       if (!s.ok()) {
         continue;  // Skip bad log.
       }
@@ -131,51 +126,32 @@ Status LogsMetricsLoader::AddLoggingDestinations(
   return OkStatus();
 }
 
-const MetricDescriptor* FindMetricDescriptor(
-    const RepeatedPtrField<MetricDescriptor>& metric_descriptors,
-    const std::string& metric_name) {
-  auto it = std::find_if(metric_descriptors.begin(), metric_descriptors.end(),
-                         [&metric_name](const MetricDescriptor& md) {
-                           return md.name() == metric_name;
-                         });
-  return it != metric_descriptors.end() ? &*it : nullptr;
-}
-
 Status LogsMetricsLoader::AddMonitoringDestinations(
     const RepeatedPtrField<Monitoring_MonitoringDestination>& destinations,
-    const RepeatedPtrField<MonitoredResourceDescriptor>& monitored_resources,
-    const RepeatedPtrField<MetricDescriptor>& metric_descriptors,
-    std::map<std::string, const MetricDescriptor&>* metrics,
-    std::map<std::string, const LabelDescriptor&>* labels) {
+    const Descriptors& descriptors, MetricMap* metrics, LabelMap* labels) {
   Status s = OkStatus();
 
-  for (int d = 0, dsize = destinations.size(); d < dsize; d++) {
-    const Monitoring_MonitoringDestination& md = destinations.Get(d);
-    s = AddMonitoredResourceLabels(monitored_resources, md.monitored_resource(),
+  for (const Monitoring_MonitoringDestination& md : destinations) {
+    s = AddMonitoredResourceLabels(descriptors, md.monitored_resource(),
                                    labels);
     if (!s.ok()) {
       continue;  // Skip bad monitored resource.
     }
 
-    for (int m = 0, msize = md.metrics_size(); m < msize; m++) {
-      const std::string& metric_name = md.metrics(m);
-      const MetricDescriptor* metric_descriptor =
-          FindMetricDescriptor(metric_descriptors, metric_name);
-      if (metric_descriptor == nullptr ||
-          !metric_supported_(*metric_descriptor)) {
+    for (const std::string& metric_name : md.metrics()) {
+      const auto it = descriptors.metrics.find(metric_name);
+      if (it == descriptors.metrics.end() || !metric_supported_(*it->second)) {
         continue;  // Skip unrecognized or unsupported metric.
       }
 
       // Add metric specific labels.
-      s = AddLabels(metric_descriptor->labels(), labels);
+      s = AddLabels(it->second->labels(), labels);
       if (!s.ok()) {
         continue;  // Skip bad metric.
       }
 
       // Insert the metric to make sure we report it.
-      metrics->insert(
-          std::map<std::string, const MetricDescriptor&>::value_type(
-              metric_name, *metric_descriptor));
+      metrics->emplace(metric_name, it->second);
     }
   }
 
@@ -186,38 +162,31 @@ Status LogsMetricsLoader::LoadLogsMetrics(const Service& service,
                                           std::set<std::string>* logs,
                                           std::set<std::string>* metrics,
                                           std::set<std::string>* labels) {
-  std::map<std::string, const LabelDescriptor&> labels_map;
-  std::map<std::string, const MetricDescriptor&> metrics_map;
+  const Descriptors descriptors(service);
+  LabelMap labels_map;
+  MetricMap metrics_map;
 
   Status s = OkStatus();
 
   // ESPv2 logs into all producer destination logs.
-  const Logging& logging = service.logging();
-  s = AddLoggingDestinations(logging.producer_destinations(),
-                             service.monitored_resources(), service.logs(),
-                             logs, &labels_map);
+  s = AddLoggingDestinations(service.logging().producer_destinations(),
+                             descriptors, logs, &labels_map);
   if (!s.ok()) return s;
 
   // ESPv2 reports producer and consumer metrics.
   const Monitoring& monitoring = service.monitoring();
-  s = AddMonitoringDestinations(monitoring.producer_destinations(),
-                                service.monitored_resources(),
-                                service.metrics(), &metrics_map, &labels_map);
+  s = AddMonitoringDestinations(monitoring.producer_destinations(), descriptors,
+                                &metrics_map, &labels_map);
   if (!s.ok()) return s;
-  s = AddMonitoringDestinations(monitoring.consumer_destinations(),
-                                service.monitored_resources(),
-                                service.metrics(), &metrics_map, &labels_map);
+  s = AddMonitoringDestinations(monitoring.consumer_destinations(), descriptors,
+                                &metrics_map, &labels_map);
   if (!s.ok()) return s;
 
-  std::set<std::string> metrics_set;
-  for (auto it = metrics_map.begin(), end = metrics_map.end(); it != end;
-       it++) {
-    metrics->insert(it->first);
+  for (const auto& metric : metrics_map) {
+    metrics->insert(metric.first);
   }
-
-  std::set<std::string> labels_set;
-  for (auto it = labels_map.begin(), end = labels_map.end(); it != end; it++) {
-    labels->insert(it->first);
+  for (const auto& label : labels_map) {
+    labels->insert(label.first);
   }
 
   return OkStatus();
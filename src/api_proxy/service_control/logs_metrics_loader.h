@@ -15,7 +15,11 @@
 #pragma once
 
 #include <functional>
+#include <set>
+#include <string>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "google/api/service.pb.h"
 #include "google/protobuf/stubs/status.h"
 #include "gtest/gtest_prod.h"
@@ -30,7 +34,27 @@ class LogsMetricsLoader final {
       const ::google::api::Service& service, std::set<std::string>* logs,
       std::set<std::string>* metrics, std::set<std::string>* labels);
 
+  using LabelMap =
+      absl::flat_hash_map<std::string, const ::google::api::LabelDescriptor*>;
+  using MetricMap =
+      absl::flat_hash_map<std::string, const ::google::api::MetricDescriptor*>;
+
  private:
+  // The descriptors of a service config, indexed by name so each destination
+  // finds them without scanning the config.
+  struct Descriptors {
+    explicit Descriptors(const ::google::api::Service& service);
+
+    absl::flat_hash_map<absl::string_view, const ::google::api::LogDescriptor*>
+        logs;
+    absl::flat_hash_map<absl::string_view,
+                        const ::google::api::MonitoredResourceDescriptor*>
+        monitored_resources;
+    absl::flat_hash_map<absl::string_view,
+                        const ::google::api::MetricDescriptor*>
+        metrics;
+  };
+
   LogsMetricsLoader(std::function<bool(const ::google::api::LabelDescriptor&)>
                         label_supported,
                     std::function<bool(const ::google::api::MetricDescriptor&)>
@@ -41,39 +65,26 @@ class LogsMetricsLoader final {
   ::google::protobuf::util::Status AddLabels(
       const ::google::protobuf::RepeatedPtrField<
           ::google::api::LabelDescriptor>& descriptors,
-      std::map<std::string, const ::google::api::LabelDescriptor&>* labels);
+      LabelMap* labels);
 
-  ::google::protobuf::util::Status AddLogLabels(
-      const ::google::protobuf::RepeatedPtrField<::google::api::LogDescriptor>&
-          descriptors,
-      const std::string& log_name,
-      std::map<std::string, const ::google::api::LabelDescriptor&>* labels);
+  ::google::protobuf::util::Status AddLogLabels(const Descriptors& descriptors,
+                                                const std::string& log_name,
+                                                LabelMap* labels);
 
   ::google::protobuf::util::Status AddMonitoredResourceLabels(
-      const ::google::protobuf::RepeatedPtrField<
-          ::google::api::MonitoredResourceDescriptor>& descriptors,
-      const std::string& monitored_resource_name,
-      std::map<std::string, const ::google::api::LabelDescriptor&>* labels);
+      const Descriptors& descriptors,
+      const std::string& monitored_resource_name, LabelMap* labels);
 
   ::google::protobuf::util::Status AddLoggingDestinations(
       const ::google::protobuf::RepeatedPtrField<
           ::google::api::Logging_LoggingDestination>& destinations,
-      const ::google::protobuf::RepeatedPtrField<
-          ::google::api::MonitoredResourceDescriptor>& monitored_resources,
-      const ::google::protobuf::RepeatedPtrField<::google::api::LogDescriptor>&
-          log_descriptors,
-      std::set<std::string>* logs,
-      std::map<std::string, const ::google::api::LabelDescriptor&>* labels);
+      const Descriptors& descriptors, std::set<std::string>* logs,
+      LabelMap* labels);
 
   ::google::protobuf::util::Status AddMonitoringDestinations(
       const ::google::protobuf::RepeatedPtrField<
           ::google::api::Monitoring_MonitoringDestination>& destinations,
-      const ::google::protobuf::RepeatedPtrField<
-          ::google::api::MonitoredResourceDescriptor>& monitored_resources,
-      const ::google::protobuf::RepeatedPtrField<
-          ::google::api::MetricDescriptor>& metric_descriptors,
-      std::map<std::string, const ::google::api::MetricDescriptor&>* metrics,
-      std::map<std::string, const ::google::api::LabelDescriptor&>* labels);
+      const Descriptors& descriptors, MetricMap* metrics, LabelMap* labels);
 
   ::google::protobuf::util::Status LoadLogsMetrics(
       const ::google::api::Service& service, std::set<std::string>* logs,
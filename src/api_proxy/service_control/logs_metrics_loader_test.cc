@@ -64,8 +64,8 @@ bool IsMetricSupported(const MetricDescriptor& md) {
                      sizeof(unsupported_prefix) - 1);
 }
 
-using LabelMap = std::map<std::string, const LabelDescriptor&>;
-using MetricMap = std::map<std::string, const MetricDescriptor&>;
+using LabelMap = LogsMetricsLoader::LabelMap;
+using MetricMap = LogsMetricsLoader::MetricMap;
 
 }  // namespace
 
@@ -217,24 +217,25 @@ TEST(LogsMetricsLoader, AddLogLabels) {
       "}";
 
   Service service = Parse<Service>(service_config);
+  const LogsMetricsLoader::Descriptors descriptors(service);
   LogsMetricsLoader lml(IsLabelSupported, IsMetricSupported);
 
   // Test that only supported labels from the named log are added.
   {
     LabelMap labels;
-    ASSERT_TRUE(lml.AddLogLabels(service.logs(), "endpoints", &labels).ok());
+    ASSERT_TRUE(lml.AddLogLabels(descriptors, "endpoints", &labels).ok());
     ASSERT_THAT(labels, UnorderedElementsAre(Pair("supported/endpoints", _)));
   }
   {
     LabelMap labels;
-    ASSERT_TRUE(lml.AddLogLabels(service.logs(), "startpoints", &labels).ok());
+    ASSERT_TRUE(lml.AddLogLabels(descriptors, "startpoints", &labels).ok());
     ASSERT_THAT(labels, UnorderedElementsAre(Pair("supported/startpoints", _)));
   }
 
   // Referencing log not present in the config --> error.
   {
     LabelMap labels;
-    ASSERT_FALSE(lml.AddLogLabels(service.logs(), "notfound", &labels).ok());
+    ASSERT_FALSE(lml.AddLogLabels(descriptors, "notfound", &labels).ok());
     ASSERT_TRUE(labels.empty());
   }
 }
@@ -262,6 +263,7 @@ TEST(LogsMetricsLoader, AddMonitoredResourceLabels) {
       "}";
 
   Service service = Parse<Service>(service_config);
+  const LogsMetricsLoader::Descriptors descriptors(service);
   LogsMetricsLoader lml(IsLabelSupported, IsMetricSupported);
 
   // Test that only supported labels from the specific monitored resource are
@@ -269,7 +271,7 @@ TEST(LogsMetricsLoader, AddMonitoredResourceLabels) {
   {
     LabelMap labels;
     ASSERT_TRUE(lml.AddMonitoredResourceLabels(
-                       service.monitored_resources(),
+                       descriptors,
                        "endpoints.googleapis.com/endpoints", &labels)
                     .ok());
     ASSERT_THAT(labels, UnorderedElementsAre(Pair("supported/endpoints", _)));
@@ -277,7 +279,7 @@ TEST(LogsMetricsLoader, AddMonitoredResourceLabels) {
   {
     LabelMap labels;
     ASSERT_TRUE(lml.AddMonitoredResourceLabels(
-                       service.monitored_resources(),
+                       descriptors,
                        "startpoints.googleapis.com/startpoints", &labels)
                     .ok());
     ASSERT_THAT(labels, UnorderedElementsAre(Pair("supported/startpoints", _)));
@@ -287,7 +289,7 @@ TEST(LogsMetricsLoader, AddMonitoredResourceLabels) {
   {
     LabelMap labels;
     ASSERT_FALSE(lml.AddMonitoredResourceLabels(
-                        service.monitored_resources(),
+                        descriptors,
                         "endpoints.googleapis.com/notfound", &labels)
                      .ok());
     ASSERT_TRUE(labels.empty());
@@ -349,8 +351,8 @@ TEST(LogsMetricsLoader, AddLoggingDestinations) {
   LabelMap labels;
 
   Status s = lml.AddLoggingDestinations(
-      service.logging().producer_destinations(), service.monitored_resources(),
-      service.logs(), &logs, &labels);
+      service.logging().producer_destinations(),
+      LogsMetricsLoader::Descriptors(service), &logs, &labels);
   ASSERT_TRUE(s.ok());
 
   // Only one log was referenced, and valid.
@@ -433,7 +435,7 @@ TEST(LogsMetricsLoader, AddMonitoringDestinations) {
   LabelMap labels;
   Status s = lml.AddMonitoringDestinations(
       service.monitoring().consumer_destinations(),
-      service.monitored_resources(), service.metrics(), &metrics, &labels);
+      LogsMetricsLoader::Descriptors(service), &metrics, &labels);
   ASSERT_TRUE(s.ok());
 
   // Only the supported metrics from valid monitored resources have been added.
@@ -0,0 +1,157 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/service_control/report_preaggregator.h"
+
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "src/api_proxy/utils/memory_bytes.h"
+#include "utils/distribution_helper.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+namespace {
+
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::SlotBytes;
+using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::MetricValueSet;
+using ::google::api::servicecontrol::v1::Operation;
+using ::google::api::servicecontrol::v1::ReportRequest;
+using ::google::service_control_client::DistributionHelper;
+
+// Separates the fields of the consumers, not in any of them.
+constexpr absl::string_view kConsumerSeparator("\0", 1);
+
+// Adds the value of a metric of the same kind and buckets.
+void MergeMetricValue(const MetricValue& from, MetricValue* to) {
+  if (from.has_distribution_value()) {
+    (void)DistributionHelper::Merge(from.distribution_value(),
+                                    to->mutable_distribution_value());
+  } else {
+    to->set_int64_value(to->int64_value() + from.int64_value());
+  }
+}
+
+// Adds the metric values of the operation, and moves the end time.
+void MergeOperation(const Operation& from, Operation* to) {
+  *to->mutable_end_time() = from.end_time();
+  for (const MetricValueSet& from_set : from.metric_value_sets()) {
+    MetricValueSet* to_set = nullptr;
+    // There are a handful of metrics per operation.
+    for (MetricValueSet& set : *to->mutable_metric_value_sets()) {
+      if (set.metric_name() == from_set.metric_name()) {
+        to_set = &set;
+        break;
+      }
+    }
+    if (to_set == nullptr) {
+      // Not in the reports so far, e.g. a size that wasn't known.
+      *to->add_metric_value_sets() = from_set;
+    } else if (from_set.metric_values_size() > 0 &&
+               to_set->metric_values_size() > 0) {
+      MergeMetricValue(from_set.metric_values(0),
+                       to_set->mutable_metric_values(0));
+    }
+  }
+}
+
+}  // namespace
+
+bool ReportPreaggregator::Add(const RequestBuilder& builder,
+                              const ReportRequestInfo& info) {
+  if (!builder.ReportSignature(info, &signature_)) {
+    return false;
+  }
+
+  auto it = reports_.find(signature_);
+  if (it == reports_.end()) {
+    if (reports_.size() >= max_signatures_ || !AddConsumer(info)) {
+      return false;
+    }
+    ReportRequest report;
+    if (!builder.FillReportRequest(info, &report).ok()) {
+      return false;
+    }
+    entry_bytes_ += report.SpaceUsedLong() - sizeof(report);
+    auto inserted = reports_.emplace(signature_, std::move(report)).first;
+    entry_bytes_ += HeapBytes(inserted->first);
+    return true;
+  }
+
+  ReportRequest& report = it->second;
+  if (!builder.FillReportMetrics(info, &metrics_).ok() ||
+      metrics_.operations_size() != report.operations_size()) {
+    return false;
+  }
+  for (int i = 0; i < report.operations_size(); ++i) {
+    MergeOperation(metrics_.operations(i), report.mutable_operations(i));
+  }
+  return true;
+}
+
+bool ReportPreaggregator::AddConsumer(const ReportRequestInfo& info) {
+  if (max_consumers_ == 0) {
+    return true;
+  }
+  // The consumer the report is attributed to, as in its consumer id and its
+  // by_consumer operation. The reports of the API keys not verified share
+  // their signatures, so they are not limited.
+  const CheckResponseInfo& check = info.check_response_info;
+  const bool verified = check.api_key_state == api_key::ApiKeyState::VERIFIED;
+  if (!verified && check.consumer_project_number.empty()) {
+    return true;
+  }
+  std::string consumer = absl::StrCat(verified ? info.api_key : "",
+                                      kConsumerSeparator,
+                                      check.consumer_project_number);
+  if (consumers_.contains(consumer)) {
+    return true;
+  }
+  if (consumers_.size() >= max_consumers_) {
+    return false;
+  }
+  entry_bytes_ += HeapBytes(*consumers_.insert(std::move(consumer)).first);
+  return true;
+}
+
+bool ReportPreaggregator::Flush(ReportRequest* request) {
+  if (reports_.empty()) {
+    return false;
+  }
+  // All the reports are of the same service.
+  const ReportRequest& first = reports_.begin()->second;
+  request->set_service_name(first.service_name());
+  request->set_service_config_id(first.service_config_id());
+  for (auto& entry : reports_) {
+    for (Operation& op : *entry.second.mutable_operations()) {
+      request->add_operations()->Swap(&op);
+    }
+  }
+  reports_.clear();
+  consumers_.clear();
+  entry_bytes_ = 0;
+  return true;
+}
+
+size_t ReportPreaggregator::bytes() const {
+  return SlotBytes(reports_) + SlotBytes(consumers_) + entry_bytes_ +
+         HeapBytes(signature_) + metrics_.SpaceUsedLong() - sizeof(metrics_);
+}
+
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,86 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "src/api_proxy/service_control/request_builder.h"
+#include "src/api_proxy/service_control/request_info.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+
+// Pre-aggregates the reports of one worker by their signature, see
+// RequestBuilder::ReportSignature, before they are passed on to the report
+// aggregation of the client. Only the first report of a signature is built
+// in full. The later ones only fill their metric values, added to its
+// operations, so their labels are neither built nor hashed.
+//
+// The signatures of a verified consumer, by API key or consumer project,
+// can be limited to a number of consumers between two flushes, so clients
+// rotating through many keys can't fill the signatures with one report each.
+// The reports of the consumers over the limit are sent as they come, so they
+// are still reported in full. They then enter the report aggregation of the
+// client, which this does not limit. Not thread safe.
+class ReportPreaggregator {
+ public:
+  // Keeps up to `max_signatures` signatures, of up to `max_consumers`
+  // consumers, no limit if 0.
+  explicit ReportPreaggregator(size_t max_signatures, size_t max_consumers = 0)
+      : max_signatures_(max_signatures), max_consumers_(max_consumers) {}
+
+  // Returns false if the report is not pre-aggregated, then it is to be sent
+  // as before: the reports of the builder have log entries, the report is a
+  // part of a stream, or there is no room for its signature or its consumer.
+  bool Add(const RequestBuilder& builder, const ReportRequestInfo& info);
+
+  // Moves the pre-aggregated operations into the request, and starts over.
+  // Returns false if there are none.
+  bool Flush(::google::api::servicecontrol::v1::ReportRequest* request);
+
+  size_t size() const { return reports_.size(); }
+  size_t consumers() const { return consumers_.size(); }
+
+  // The memory held by the signatures, roughly. The reports are counted as
+  // first built, not as their metrics grow.
+  size_t bytes() const;
+
+ private:
+  // Returns false if the consumer of the report is over the limit.
+  bool AddConsumer(const ReportRequestInfo& info);
+
+  const size_t max_signatures_;
+  const size_t max_consumers_;
+  absl::flat_hash_map<std::string,
+                      ::google::api::servicecontrol::v1::ReportRequest>
+      reports_;
+  // The verified consumers of the signatures, only if they are limited.
+  absl::flat_hash_set<std::string> consumers_;
+  // The bytes of the reports and consumers, without the slots of the maps.
+  size_t entry_bytes_ = 0;
+
+  // Reused by each report, to keep their allocations.
+  std::string signature_;
+  ::google::api::servicecontrol::v1::ReportRequest metrics_;
+};
+
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
@@ -0,0 +1,229 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/service_control/report_preaggregator.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+namespace {
+
+namespace gasv1 = ::google::api::servicecontrol::v1;
+
+constexpr char kRequestCount[] =
+    "serviceruntime.googleapis.com/api/producer/request_count";
+constexpr char kTotalLatencies[] =
+    "serviceruntime.googleapis.com/api/producer/total_latencies";
+constexpr char kByConsumerRequestCount[] =
+    "serviceruntime.googleapis.com/api/producer/by_consumer/request_count";
+
+ReportRequestInfo MakeReportInfo(unsigned int http_response_code,
+                                 double request_time_ms, int64_t seconds) {
+  ReportRequestInfo info;
+  info.operation_id = "operation-id";
+  info.operation_name = "operation-name";
+  info.current_time =
+      std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+  info.http_response_code = http_response_code;
+  info.latency.request_time_ms = request_time_ms;
+  info.frontend_protocol = protocol::HTTP;
+  info.api_method = "api-method";
+  return info;
+}
+
+const gasv1::MetricValue* FindMetricValue(const gasv1::Operation& op,
+                                          absl::string_view name) {
+  for (const gasv1::MetricValueSet& set : op.metric_value_sets()) {
+    if (set.metric_name() == name && set.metric_values_size() == 1) {
+      return &set.metric_values(0);
+    }
+  }
+  return nullptr;
+}
+
+class ReportPreaggregatorTest : public ::testing::Test {
+ protected:
+  RequestBuilder builder_{{}, "test-service", "test-config-id"};
+};
+
+TEST_F(ReportPreaggregatorTest, SameSignatureMerged) {
+  ReportPreaggregator preaggregator(10);
+  const ReportRequestInfo first = MakeReportInfo(200, 10, 100);
+  ASSERT_TRUE(preaggregator.Add(builder_, first));
+  ASSERT_TRUE(preaggregator.Add(builder_, MakeReportInfo(200, 20, 101)));
+  ASSERT_TRUE(preaggregator.Add(builder_, MakeReportInfo(200, 30, 102)));
+  EXPECT_EQ(preaggregator.size(), 1);
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(preaggregator.Flush(&request));
+  EXPECT_EQ(preaggregator.size(), 0);
+  EXPECT_EQ(request.service_name(), "test-service");
+  EXPECT_EQ(request.service_config_id(), "test-config-id");
+  ASSERT_EQ(request.operations_size(), 1);
+  const gasv1::Operation& op = request.operations(0);
+
+  // The operation of the first report, with the metrics of all of them.
+  gasv1::ReportRequest expected;
+  ASSERT_TRUE(builder_.FillReportRequest(first, &expected).ok());
+  const auto& labels = op.labels();
+  const auto& expected_labels = expected.operations(0).labels();
+  EXPECT_EQ(std::map<std::string, std::string>(labels.begin(), labels.end()),
+            std::map<std::string, std::string>(expected_labels.begin(),
+                                               expected_labels.end()));
+  EXPECT_EQ(op.operation_id(), "operation-id");
+  EXPECT_EQ(op.start_time().seconds(), 100);
+  EXPECT_EQ(op.end_time().seconds(), 102);
+
+  const gasv1::MetricValue* request_count = FindMetricValue(op, kRequestCount);
+  ASSERT_NE(request_count, nullptr);
+  EXPECT_EQ(request_count->int64_value(), 3);
+  const gasv1::MetricValue* latencies = FindMetricValue(op, kTotalLatencies);
+  ASSERT_NE(latencies, nullptr);
+  EXPECT_EQ(latencies->distribution_value().count(), 3);
+  EXPECT_NEAR(latencies->distribution_value().mean(), 0.02, 1e-12);
+  EXPECT_DOUBLE_EQ(latencies->distribution_value().minimum(), 0.01);
+  EXPECT_DOUBLE_EQ(latencies->distribution_value().maximum(), 0.03);
+
+  // Nothing left to flush.
+  gasv1::ReportRequest empty;
+  EXPECT_FALSE(preaggregator.Flush(&empty));
+}
+
+TEST_F(ReportPreaggregatorTest, DifferentSignaturesKept) {
+  ReportPreaggregator preaggregator(10);
+  ASSERT_TRUE(preaggregator.Add(builder_, MakeReportInfo(200, 10, 100)));
+  const size_t one_signature_bytes = preaggregator.bytes();
+  ASSERT_TRUE(preaggregator.Add(builder_, MakeReportInfo(503, 10, 100)));
+  EXPECT_GT(preaggregator.bytes(), one_signature_bytes);
+  ReportRequestInfo other_method = MakeReportInfo(200, 10, 100);
+  other_method.api_method = "other-method";
+  ASSERT_TRUE(preaggregator.Add(builder_, other_method));
+  EXPECT_EQ(preaggregator.size(), 3);
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(preaggregator.Flush(&request));
+  EXPECT_EQ(request.operations_size(), 3);
+  // Only the slots of the signatures are kept.
+  EXPECT_LT(preaggregator.bytes(), one_signature_bytes);
+}
+
+TEST_F(ReportPreaggregatorTest, ByConsumerOperationMerged) {
+  ReportPreaggregator preaggregator(10);
+  for (int i = 0; i < 2; ++i) {
+    ReportRequestInfo info = MakeReportInfo(200, 10, 100);
+    info.check_response_info.consumer_project_number = "123456";
+    ASSERT_TRUE(preaggregator.Add(builder_, info));
+  }
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(preaggregator.Flush(&request));
+  ASSERT_EQ(request.operations_size(), 2);
+  const gasv1::MetricValue* request_count =
+      FindMetricValue(request.operations(1), kByConsumerRequestCount);
+  ASSERT_NE(request_count, nullptr);
+  EXPECT_EQ(request_count->int64_value(), 2);
+}
+
+TEST_F(ReportPreaggregatorTest, UnverifiedKeysMerged) {
+  ReportPreaggregator preaggregator(10, 1);
+  const std::string keys[] = {"key-1", "key-2", "key-3"};
+  for (const std::string& key : keys) {
+    ReportRequestInfo info = MakeReportInfo(200, 10, 100);
+    info.api_key = key;
+    info.check_response_info.api_key_state = api_key::ApiKeyState::INVALID;
+    ASSERT_TRUE(preaggregator.Add(builder_, info));
+  }
+  // The keys are not in the report, nor counted as consumers.
+  EXPECT_EQ(preaggregator.size(), 1);
+  EXPECT_EQ(preaggregator.consumers(), 0);
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(preaggregator.Flush(&request));
+  ASSERT_EQ(request.operations_size(), 1);
+  EXPECT_TRUE(request.operations(0).consumer_id().empty());
+}
+
+TEST_F(ReportPreaggregatorTest, ConsumersLimited) {
+  ReportPreaggregator preaggregator(10, 2);
+  auto make_info = [](absl::string_view key, unsigned int code) {
+    ReportRequestInfo info = MakeReportInfo(code, 10, 100);
+    info.api_key = key;
+    info.check_response_info.api_key_state = api_key::ApiKeyState::VERIFIED;
+    return info;
+  };
+  ASSERT_TRUE(preaggregator.Add(builder_, make_info("key-1", 200)));
+  ASSERT_TRUE(preaggregator.Add(builder_, make_info("key-2", 200)));
+  // A new consumer over the limit, the ones kept may add signatures.
+  EXPECT_FALSE(preaggregator.Add(builder_, make_info("key-3", 200)));
+  ASSERT_TRUE(preaggregator.Add(builder_, make_info("key-1", 503)));
+  ASSERT_TRUE(preaggregator.Add(builder_, make_info("key-2", 200)));
+  EXPECT_EQ(preaggregator.size(), 3);
+  EXPECT_EQ(preaggregator.consumers(), 2);
+
+  // The consumers start over with the flush.
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(preaggregator.Flush(&request));
+  EXPECT_EQ(preaggregator.consumers(), 0);
+  EXPECT_TRUE(preaggregator.Add(builder_, make_info("key-3", 200)));
+}
+
+TEST_F(ReportPreaggregatorTest, NotPreaggregated) {
+  ReportPreaggregator preaggregator(1);
+
+  // The reports carry log entries.
+  RequestBuilder logs_builder({"endpoints_log"}, "test-service",
+                              "test-config-id");
+  EXPECT_FALSE(preaggregator.Add(logs_builder, MakeReportInfo(200, 10, 100)));
+
+  // A part of a stream.
+  ReportRequestInfo intermediate = MakeReportInfo(200, 10, 100);
+  intermediate.is_final_report = false;
+  EXPECT_FALSE(preaggregator.Add(builder_, intermediate));
+
+  // No room for another signature.
+  ASSERT_TRUE(preaggregator.Add(builder_, MakeReportInfo(200, 10, 100)));
+  EXPECT_FALSE(preaggregator.Add(builder_, MakeReportInfo(404, 10, 100)));
+  EXPECT_TRUE(preaggregator.Add(builder_, MakeReportInfo(200, 10, 100)));
+  EXPECT_EQ(preaggregator.size(), 1);
+}
+
+TEST_F(ReportPreaggregatorTest, MetricsOnlyWithLogs) {
+  ReportPreaggregator preaggregator(10);
+  RequestBuilder logs_builder({"endpoints_log"}, "test-service",
+                              "test-config-id");
+
+  // The reports shedding their logs are merged as metrics only.
+  ReportRequestInfo info = MakeReportInfo(200, 10, 100);
+  info.skip_log_entries = true;
+  EXPECT_FALSE(preaggregator.Add(logs_builder, info));
+  info.metrics_only = true;
+  ASSERT_TRUE(preaggregator.Add(logs_builder, info));
+  ASSERT_TRUE(preaggregator.Add(logs_builder, info));
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(preaggregator.Flush(&request));
+  ASSERT_EQ(request.operations_size(), 1);
+  EXPECT_EQ(request.operations(0).log_entries_size(), 0);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
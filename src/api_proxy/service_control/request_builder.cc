@@ -15,8 +15,10 @@
 
 #include <time.h>
 
+#include <array>
 #include <chrono>
 #include <functional>
+#include <utility>
 
 #include "absl/strings/str_cat.h"
 #include "google/api/metric.pb.h"
@@ -25,16 +27,15 @@
 #include "source/common/common/assert.h"
 #include "source/common/common/base64.h"
 #include "source/common/grpc/status.h"
+#include "src/api_proxy/service_control/distribution_buckets.h"
 #include "src/api_proxy/service_control/request_info.h"
 #include "src/api_proxy/utils/version.h"
-#include "utils/distribution_helper.h"
 
 using ::google::api::servicecontrol::v1::CheckError;
 using ::google::api::servicecontrol::v1::CheckRequest;
 using ::google::api::servicecontrol::v1::CheckResponse;
 using ::google::api::servicecontrol::v1::
     CheckResponse_ConsumerInfo_ConsumerType;
-using ::google::api::servicecontrol::v1::Distribution;
 using ::google::api::servicecontrol::v1::LogEntry;
 using ::google::api::servicecontrol::v1::MetricValue;
 using ::google::api::servicecontrol::v1::MetricValueSet;
@@ -46,7 +47,6 @@ using ::google::protobuf::Timestamp;
 using ::google::protobuf::util::OkStatus;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::StatusCode;
-using ::google::service_control_client::DistributionHelper;
 
 namespace espv2 {
 namespace api_proxy {
@@ -62,6 +62,8 @@ struct SupportedMetric {
   ::google::api::MetricDescriptor_ValueType value_type;
 
   enum Mark { PRODUCER = 0, CONSUMER = 1, PRODUCER_BY_CONSUMER = 2 };
+  // Which reports of a stream the metric is sent in: START only in the first,
+  // INTERMEDIATE in all of them, FINAL only in the final one.
   enum Tag { START = 0, INTERMEDIATE = 1, FINAL = 2 };
   Tag tag;
   Mark mark;
@@ -76,7 +78,8 @@ struct SupportedLabel {
   enum Kind { USER = 0, SYSTEM = 1 };
   Kind kind;
 
-  Status (*set)(const SupportedLabel& l, const ReportRequestInfo& info,
+  // Sets the label to `key`, the interned name of the label.
+  Status (*set)(const std::string& key, const ReportRequestInfo& info,
                 Map<std::string, std::string>* labels);
 
   bool by_consumer_only;
@@ -98,28 +101,22 @@ void AddInt64Metric(const char* metric_name, int64_t value,
   metric_value->set_int64_value(value);
 }
 
-// The parameters to initialize DistributionHelper
-struct DistributionHelperOptions {
-  int buckets;
-  double growth;
-  double scale;
-};
-
-const DistributionHelperOptions time_distribution = {29, 2.0, 1e-6};
-const DistributionHelperOptions size_distribution = {8, 10.0, 1};
+// The buckets of the time and size distributions, built once.
+const DistributionBuckets& time_distribution() {
+  static const auto* buckets = new DistributionBuckets(29, 2.0, 1e-6);
+  return *buckets;
+}
+const DistributionBuckets& size_distribution() {
+  static const auto* buckets = new DistributionBuckets(8, 10.0, 1);
+  return *buckets;
+}
 const double kMsToSecs = 1e-3;
 
-Status AddDistributionMetric(const DistributionHelperOptions& options,
+Status AddDistributionMetric(const DistributionBuckets& buckets,
                              const char* metric_name, double value,
                              Operation* operation) {
   MetricValue* metric_value = AddMetricValue(metric_name, operation);
-  Distribution distribution;
-  Status status = DistributionHelper::InitExponential(
-      options.buckets, options.growth, options.scale, &distribution);
-  if (!status.ok()) return status;
-  status = DistributionHelper::AddSample(value, &distribution);
-  if (!status.ok()) return status;
-  *metric_value->mutable_distribution_value() = distribution;
+  buckets.setSample(value, metric_value->mutable_distribution_value());
   return OkStatus();
 }
 
@@ -136,7 +133,7 @@ Status set_distribution_metric_to_request_size(const SupportedMetric& m,
                                                const ReportRequestInfo& info,
                                                Operation* operation) {
   if (info.request_size >= 0) {
-    return AddDistributionMetric(size_distribution, m.name, info.request_size,
+    return AddDistributionMetric(size_distribution(), m.name, info.request_size,
                                  operation);
   }
   return OkStatus();
@@ -146,8 +143,8 @@ Status set_distribution_metric_to_response_size(const SupportedMetric& m,
                                                 const ReportRequestInfo& info,
                                                 Operation* operation) {
   if (info.response_size >= 0) {
-    return AddDistributionMetric(size_distribution, m.name, info.response_size,
-                                 operation);
+    return AddDistributionMetric(size_distribution(), m.name,
+                                 info.response_size, operation);
   }
   return OkStatus();
 }
@@ -158,7 +155,7 @@ Status set_distribution_metric_to_request_time(const SupportedMetric& m,
                                                Operation* operation) {
   if (info.latency.request_time_ms >= 0) {
     double request_time_secs = info.latency.request_time_ms * kMsToSecs;
-    return AddDistributionMetric(time_distribution, m.name, request_time_secs,
+    return AddDistributionMetric(time_distribution(), m.name, request_time_secs,
                                  operation);
   }
   return OkStatus();
@@ -169,7 +166,7 @@ Status set_distribution_metric_to_backend_time(const SupportedMetric& m,
                                                Operation* operation) {
   if (info.latency.backend_time_ms >= 0) {
     double backend_time_secs = info.latency.backend_time_ms * kMsToSecs;
-    return AddDistributionMetric(time_distribution, m.name, backend_time_secs,
+    return AddDistributionMetric(time_distribution(), m.name, backend_time_secs,
                                  operation);
   }
   return OkStatus();
@@ -180,8 +177,8 @@ Status set_distribution_metric_to_overhead_time(const SupportedMetric& m,
                                                 Operation* operation) {
   if (info.latency.overhead_time_ms >= 0) {
     double overhead_time_secs = info.latency.overhead_time_ms * kMsToSecs;
-    return AddDistributionMetric(time_distribution, m.name, overhead_time_secs,
-                                 operation);
+    return AddDistributionMetric(time_distribution(), m.name,
+                                 overhead_time_secs, operation);
   }
   return OkStatus();
 }
@@ -211,7 +208,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/producer/by_consumer/request_count",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64,
-        SupportedMetric::FINAL,
+        SupportedMetric::START,
         SupportedMetric::PRODUCER_BY_CONSUMER,
         set_int64_metric_to_constant_1,
     },
@@ -219,7 +216,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/consumer/request_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
-        SupportedMetric::FINAL,
+        SupportedMetric::INTERMEDIATE,
         SupportedMetric::CONSUMER,
         set_distribution_metric_to_request_size,
     },
@@ -227,7 +224,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/producer/request_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
-        SupportedMetric::FINAL,
+        SupportedMetric::INTERMEDIATE,
         SupportedMetric::PRODUCER,
         set_distribution_metric_to_request_size,
     },
@@ -235,7 +232,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/producer/by_consumer/request_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
-        SupportedMetric::FINAL,
+        SupportedMetric::INTERMEDIATE,
         SupportedMetric::PRODUCER_BY_CONSUMER,
         set_distribution_metric_to_request_size,
     },
@@ -243,7 +240,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/consumer/response_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
-        SupportedMetric::FINAL,
+        SupportedMetric::INTERMEDIATE,
         SupportedMetric::CONSUMER,
         set_distribution_metric_to_response_size,
     },
@@ -251,7 +248,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/producer/response_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
-        SupportedMetric::FINAL,
+        SupportedMetric::INTERMEDIATE,
         SupportedMetric::PRODUCER,
         set_distribution_metric_to_response_size,
     },
@@ -259,7 +256,7 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/producer/by_consumer/response_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
-        SupportedMetric::FINAL,
+        SupportedMetric::INTERMEDIATE,
         SupportedMetric::PRODUCER_BY_CONSUMER,
         set_distribution_metric_to_response_size,
     },
@@ -371,8 +368,14 @@ unsigned int get_status_code(const ReportRequestInfo& info) {
   return info.http_response_code;
 }
 
+// Whether the outcome of the request is known, so the labels of its codes
+// are set. The intermediate reports of an open stream have no code yet.
+bool HasStatusCode(const ReportRequestInfo& info) {
+  return info.is_final_report;
+}
+
 // /credential_id
-Status set_credential_id(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_credential_id(const std::string& key, const ReportRequestInfo& info,
                          Map<std::string, std::string>* labels) {
   // The rule to set /credential_id is:
   // 1) If api_key is available and valid, set it as apiKey:API-KEY
@@ -382,9 +385,7 @@ Status set_credential_id(const SupportedLabel& l, const ReportRequestInfo& info,
       api_key::ApiKeyState::VERIFIED) {
     ASSERT(!info.api_key.empty(),
            "API Key must be set, otherwise consumer would not be verified.");
-    std::string credential_id("apikey:");
-    credential_id += info.api_key;
-    (*labels)[l.name] = credential_id;
+    (*labels)[key] = absl::StrCat("apikey:", info.api_key);
   } else if (!info.auth_issuer.empty()) {
     std::string base64_issuer = Envoy::Base64Url::encode(
         info.auth_issuer.data(), info.auth_issuer.size());
@@ -395,7 +396,7 @@ Status set_credential_id(const SupportedLabel& l, const ReportRequestInfo& info,
           info.auth_audience.data(), info.auth_audience.size());
       absl::StrAppend(&credential_id, "&audience=", base64_audience);
     }
-    (*labels)[l.name] = credential_id;
+    (*labels)[key] = credential_id;
   }
   return OkStatus();
 }
@@ -403,130 +404,179 @@ Status set_credential_id(const SupportedLabel& l, const ReportRequestInfo& info,
 constexpr const char* error_types[10] = {"0xx", "1xx", "2xx", "3xx", "4xx",
                                          "5xx", "6xx", "7xx", "8xx", "9xx"};
 
+// A status code of up to 3 digits, rendered as a label value.
+struct CodeLabel {
+  char value[4];
+};
+
+// Renders the codes from `first` on.
+template <size_t N>
+constexpr std::array<CodeLabel, N> MakeCodeLabels(int first) {
+  std::array<CodeLabel, N> labels{};
+  for (size_t i = 0; i < N; ++i) {
+    int code = first + static_cast<int>(i);
+    char digits[3] = {};
+    size_t size = 0;
+    do {
+      digits[size++] = static_cast<char>('0' + code % 10);
+      code /= 10;
+    } while (code > 0);
+    for (size_t j = 0; j < size; ++j) {
+      labels[i].value[j] = digits[size - 1 - j];
+    }
+  }
+  return labels;
+}
+
+// The HTTP status codes from 100 to 599, and the canonical codes.
+constexpr int kFirstHttpCode = 100;
+constexpr auto kHttpCodeLabels = MakeCodeLabels<500>(kFirstHttpCode);
+constexpr auto kCanonicalCodeLabels = MakeCodeLabels<17>(0);
+
+// Sets the label to the code, from the table if the code is in it.
+template <size_t N>
+void SetCodeLabel(const std::array<CodeLabel, N>& table, int first, int code,
+                  std::string* label) {
+  if (code >= first && code - first < static_cast<int>(N)) {
+    *label = table[code - first].value;
+  } else {
+    *label = absl::StrCat(code);
+  }
+}
+
 // /error_type
-Status set_error_type(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_error_type(const std::string& key, const ReportRequestInfo& info,
                       Map<std::string, std::string>* labels) {
+  if (!HasStatusCode(info)) {
+    return OkStatus();
+  }
   int status_code = get_status_code(info);
   if (status_code >= 400) {
     int code = (status_code / 100) % 10;
     if (error_types[code]) {
-      (*labels)[l.name] = error_types[code];
+      (*labels)[key] = error_types[code];
     }
   }
   return OkStatus();
 }
 
 // /protocol
-Status set_protocol(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_protocol(const std::string& key, const ReportRequestInfo& info,
                     Map<std::string, std::string>* labels) {
-  (*labels)[l.name] = protocol::ToString(info.frontend_protocol);
+  (*labels)[key] = protocol::ToString(info.frontend_protocol);
   return OkStatus();
 }
 
 // /servicecontrol.googleapis.com/backend_protocol
-Status set_backend_protocol(const SupportedLabel& l,
+Status set_backend_protocol(const std::string& key,
                             const ReportRequestInfo& info,
                             Map<std::string, std::string>* labels) {
   // backend_protocol is either GRPC or UNKNOWN.
   if (info.backend_protocol == protocol::GRPC &&
       info.frontend_protocol != info.backend_protocol) {
-    (*labels)[l.name] = protocol::ToString(info.backend_protocol);
+    (*labels)[key] = protocol::ToString(info.backend_protocol);
   }
   return OkStatus();
 }
 
 // /servicecontrol.googleapis.com/consumer_project
-Status set_consumer_project(const SupportedLabel& l,
+Status set_consumer_project(const std::string& key,
                             const ReportRequestInfo& info,
                             Map<std::string, std::string>* labels) {
-  (*labels)[l.name] = info.check_response_info.consumer_project_number;
+  (*labels)[key] = info.check_response_info.consumer_project_number;
   return OkStatus();
 }
 
 // /referer
-Status set_referer(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_referer(const std::string& key, const ReportRequestInfo& info,
                    Map<std::string, std::string>* labels) {
   if (!info.referer.empty()) {
-    (*labels)[l.name] = info.referer;
+    (*labels)[key] = std::string(info.referer);
   }
   return OkStatus();
 }
 
 // /response_code
-Status set_response_code(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_response_code(const std::string& key, const ReportRequestInfo& info,
                          Map<std::string, std::string>* labels) {
-  char response_code_buf[20];
-  snprintf(response_code_buf, sizeof(response_code_buf), "%d",
-           get_status_code(info));
-  (*labels)[l.name] = response_code_buf;
+  if (!HasStatusCode(info)) {
+    return OkStatus();
+  }
+  SetCodeLabel(kHttpCodeLabels, kFirstHttpCode, get_status_code(info),
+               &(*labels)[key]);
   return OkStatus();
 }
 
 // /response_code_class
-Status set_response_code_class(const SupportedLabel& l,
+Status set_response_code_class(const std::string& key,
                                const ReportRequestInfo& info,
                                Map<std::string, std::string>* labels) {
-  (*labels)[l.name] = error_types[(get_status_code(info) / 100) % 10];
+  if (!HasStatusCode(info)) {
+    return OkStatus();
+  }
+  (*labels)[key] = error_types[(get_status_code(info) / 100) % 10];
   return OkStatus();
 }
 
 // /status_code
-Status set_status_code(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_status_code(const std::string& key, const ReportRequestInfo& info,
                        Map<std::string, std::string>* labels) {
-  char status_code_buf[20];
-  snprintf(status_code_buf, sizeof(status_code_buf), "%d", info.status.code());
-  (*labels)[l.name] = status_code_buf;
+  if (!HasStatusCode(info)) {
+    return OkStatus();
+  }
+  SetCodeLabel(kCanonicalCodeLabels, 0, static_cast<int>(info.status.code()),
+               &(*labels)[key]);
   return OkStatus();
 }
 
 // cloud.googleapis.com/location
-Status set_location(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_location(const std::string& key, const ReportRequestInfo& info,
                     Map<std::string, std::string>* labels) {
   if (!info.location.empty()) {
-    (*labels)[l.name] = info.location;
+    (*labels)[key] = std::string(info.location);
   } else {
     // This label SHOULD not be empty, otherwise the server will fail the call.
-    (*labels)[l.name] = kDefaultLocation;
+    (*labels)[key] = kDefaultLocation;
   }
   return OkStatus();
 }
 
 // serviceruntime.googleapis.com/api_method
-Status set_api_method(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_api_method(const std::string& key, const ReportRequestInfo& info,
                       Map<std::string, std::string>* labels) {
   if (!info.api_method.empty()) {
-    (*labels)[l.name] = info.api_method;
+    (*labels)[key] = info.api_method;
   }
   return OkStatus();
 }
 
 // serviceruntime.googleapis.com/api_version
-Status set_api_version(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_api_version(const std::string& key, const ReportRequestInfo& info,
                        Map<std::string, std::string>* labels) {
   if (!info.api_version.empty()) {
-    (*labels)[l.name] = info.api_version;
+    (*labels)[key] = info.api_version;
   }
   return OkStatus();
 }
 
 // servicecontrol.googleapis.com/platform
-Status set_platform(const SupportedLabel& l, const ReportRequestInfo& info,
+Status set_platform(const std::string& key, const ReportRequestInfo& info,
                     Map<std::string, std::string>* labels) {
-  (*labels)[l.name] = info.compute_platform;
+  (*labels)[key] = std::string(info.compute_platform);
   return OkStatus();
 }
 
 // servicecontrol.googleapis.com/service_agent
-Status set_service_agent(const SupportedLabel& l, const ReportRequestInfo&,
+Status set_service_agent(const std::string& key, const ReportRequestInfo&,
                          Map<std::string, std::string>* labels) {
-  (*labels)[l.name] = get_service_agent();
+  (*labels)[key] = get_service_agent();
   return OkStatus();
 }
 
 // serviceruntime.googleapis.com/user_agent
-Status set_user_agent(const SupportedLabel& l, const ReportRequestInfo&,
+Status set_user_agent(const std::string& key, const ReportRequestInfo&,
                       Map<std::string, std::string>* labels) {
-  (*labels)[l.name] = kUserAgent;
+  (*labels)[key] = kUserAgent;
   return OkStatus();
 }
 
@@ -806,10 +856,10 @@ Status VerifyRequiredReportFields(const OperationInfo&) { return OkStatus(); }
 void SetOperationCommonFields(const OperationInfo& info,
                               const Timestamp& current_time, Operation* op) {
   if (!info.operation_id.empty()) {
-    op->set_operation_id(info.operation_id);
+    op->set_operation_id(std::string(info.operation_id));
   }
   if (!info.operation_name.empty()) {
-    op->set_operation_name(info.operation_name);
+    op->set_operation_name(std::string(info.operation_name));
   }
   *op->mutable_start_time() = current_time;
   *op->mutable_end_time() = current_time;
@@ -820,10 +870,10 @@ std::string TraceResourceName(absl::string_view trace_id,
   return absl::StrCat("projects/", project_id, "/traces/", trace_id);
 }
 
-void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
-                  const std::string& config_id, const Timestamp& current_time,
-                  LogEntry* log_entry) {
-  log_entry->set_name(name);
+// Fills the log entry from the prototype of its log.
+void FillLogEntry(const ReportRequestInfo& info, const LogEntry& prototype,
+                  const Timestamp& current_time, LogEntry* log_entry) {
+  *log_entry = prototype;
   *log_entry->mutable_timestamp() = current_time;
   auto severity = (get_status_code(info) >= 400) ? google::logging::type::ERROR
                                                  : google::logging::type::INFO;
@@ -854,7 +904,7 @@ void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
     http_request->set_remote_ip(info.client_ip);
   }
   if (!info.referer.empty()) {
-    http_request->set_referer(info.referer);
+    http_request->set_referer(std::string(info.referer));
   }
   if (info.latency.request_time_ms >= 0) {
     const google::protobuf::Duration duration =
@@ -868,9 +918,6 @@ void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
   (*fields)[kLogFieldNameTimestamp].set_number_value(
       static_cast<double>(current_time.seconds()) +
       static_cast<double>(current_time.nanos()) / 1000000000.0);
-  (*fields)[kLogFieldNameConfigId].set_string_value(config_id);
-  (*fields)[kLogFieldNameServiceAgent].set_string_value(
-      kServiceAgentPrefix + utils::Version::instance().get());
 
   (*fields)[kLogFieldNameApiKeyState].set_string_value(
       api_key::ToString(info.check_response_info.api_key_state));
@@ -884,10 +931,10 @@ void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
 
   if (!info.producer_project_id.empty()) {
     (*fields)[kLogFieldNameProducerProjectId].set_string_value(
-        info.producer_project_id);
+        std::string(info.producer_project_id));
   }
   if (!info.api_key.empty()) {
-    (*fields)[kLogFieldNameApiKey].set_string_value(info.api_key);
+    (*fields)[kLogFieldNameApiKey].set_string_value(std::string(info.api_key));
   }
   if (!info.api_name.empty()) {
     (*fields)[kLogFieldNameApiName].set_string_value(info.api_name);
@@ -899,7 +946,8 @@ void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
     (*fields)[kLogFieldNameApiMethod].set_string_value(info.api_method);
   }
   if (!info.location.empty()) {
-    (*fields)[kLogFieldNameLocation].set_string_value(info.location);
+    (*fields)[kLogFieldNameLocation].set_string_value(
+        std::string(info.location));
   }
   if (!info.log_message.empty()) {
     (*fields)[kLogFieldNameLogMessage].set_string_value(info.log_message);
@@ -929,54 +977,104 @@ void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
   }
 }
 
-template <class Element>
-std::vector<const Element*> FilterPointers(
-    const Element* first, const Element* last,
-    std::function<bool(const Element*)> pred) {
-  std::vector<const Element*> filtered;
-  while (first < last) {
-    if (pred(first)) {
-      filtered.push_back(first);
-    }
-    first++;
+// Returns whether the metric is sent in this report of the request.
+bool IsMetricInReport(const SupportedMetric& m, const ReportRequestInfo& info) {
+  switch (m.tag) {
+    case SupportedMetric::START:
+      return info.is_first_report;
+    case SupportedMetric::FINAL:
+      return info.is_final_report;
+    default:
+      return true;
   }
-  return filtered;
 }
 
+// Sets the metrics of the report on the operation.
+Status SetMetrics(const std::vector<const SupportedMetric*>& metrics,
+                  const ReportRequestInfo& info, Operation* op) {
+  for (const SupportedMetric* m : metrics) {
+    if (!IsMetricInReport(*m, info)) continue;
+    Status status = (m->set)(*m, info, op);
+    if (!status.ok()) return status;
+  }
+  return OkStatus();
+}
+
+// Separates the fields of a report signature.
+constexpr absl::string_view kSignatureSeparator("\0", 1);
+
 }  // namespace
 
 RequestBuilder::RequestBuilder(const std::set<std::string>& logs,
                                const std::string& service_name,
                                const std::string& service_config_id)
-    : logs_(logs.begin(), logs.end()),
-      metrics_(FilterPointers<SupportedMetric>(
-          supported_metrics, supported_metrics + supported_metrics_count,
-          [](const struct SupportedMetric* m) { return m->set != nullptr; })),
-      labels_(FilterPointers<SupportedLabel>(
-          supported_labels, supported_labels + supported_labels_count,
-          [](const struct SupportedLabel* l) { return l->set != nullptr; })),
-      service_name_(service_name),
-      service_config_id_(service_config_id) {}
+    : RequestBuilder(
+          logs, [](const SupportedMetric&) { return true; },
+          [](const SupportedLabel&) { return true; }, service_name,
+          service_config_id) {}
 
 RequestBuilder::RequestBuilder(const std::set<std::string>& logs,
                                const std::set<std::string>& metrics,
                                const std::set<std::string>& labels,
                                const std::string& service_name,
                                const std::string& service_config_id)
-    : logs_(logs.begin(), logs.end()),
-      metrics_(FilterPointers<SupportedMetric>(
-          supported_metrics, supported_metrics + supported_metrics_count,
-          [&metrics](const struct SupportedMetric* m) {
-            return m->set && metrics.find(m->name) != metrics.end();
-          })),
-      labels_(FilterPointers<SupportedLabel>(
-          supported_labels, supported_labels + supported_labels_count,
-          [&labels](const struct SupportedLabel* l) {
-            return l->set && (l->kind == SupportedLabel::SYSTEM ||
-                              labels.find(l->name) != labels.end());
-          })),
-      service_name_(service_name),
-      service_config_id_(service_config_id) {}
+    : RequestBuilder(
+          logs,
+          [&metrics](const SupportedMetric& m) {
+            return metrics.find(m.name) != metrics.end();
+          },
+          [&labels](const SupportedLabel& l) {
+            return l.kind == SupportedLabel::SYSTEM ||
+                   labels.find(l.name) != labels.end();
+          },
+          service_name, service_config_id) {}
+
+RequestBuilder::RequestBuilder(
+    const std::set<std::string>& logs,
+    const std::function<bool(const SupportedMetric&)>& use_metric,
+    const std::function<bool(const SupportedLabel&)>& use_label,
+    const std::string& service_name, const std::string& service_config_id)
+    : service_name_(service_name),
+      service_config_id_(service_config_id),
+      service_agent_(get_service_agent()) {
+  for (const std::string& name : logs) {
+    LogEntry& log_entry = log_entries_.emplace_back();
+    log_entry.set_name(name);
+    auto* fields = log_entry.mutable_struct_payload()->mutable_fields();
+    (*fields)[kLogFieldNameConfigId].set_string_value(service_config_id_);
+    (*fields)[kLogFieldNameServiceAgent].set_string_value(service_agent_);
+  }
+
+  for (int i = 0; i < supported_labels_count; i++) {
+    const SupportedLabel& l = supported_labels[i];
+    if (l.set == nullptr || !use_label(l)) {
+      continue;
+    }
+    LabelSetter setter{&l, l.name, absl::nullopt};
+    if (l.set == set_service_agent) {
+      setter.constant_value = service_agent_;
+    } else if (l.set == set_user_agent) {
+      setter.constant_value = kUserAgent;
+    }
+    (l.by_consumer_only ? by_consumer_labels_ : labels_)
+        .push_back(std::move(setter));
+  }
+
+  for (int i = 0; i < supported_metrics_count; i++) {
+    const SupportedMetric& m = supported_metrics[i];
+    if (m.set == nullptr || !use_metric(m)) {
+      continue;
+    }
+    if (m.mark == SupportedMetric::PRODUCER_BY_CONSUMER) {
+      by_consumer_metrics_.push_back(&m);
+      continue;
+    }
+    metrics_.push_back(&m);
+    if (m.mark != SupportedMetric::CONSUMER) {
+      producer_metrics_.push_back(&m);
+    }
+  }
+}
 
 Status RequestBuilder::FillAllocateQuotaRequest(
     const QuotaRequestInfo& info,
@@ -991,7 +1089,7 @@ Status RequestBuilder::FillAllocateQuotaRequest(
 
   // allocate_operation.operation_id
   if (!info.operation_id.empty()) {
-    operation->set_operation_id(info.operation_id);
+    operation->set_operation_id(std::string(info.operation_id));
   }
   // allocate_operation.method_name
   if (!info.method_name.empty()) {
@@ -1019,10 +1117,10 @@ Status RequestBuilder::FillAllocateQuotaRequest(
   }
 
   if (!info.referer.empty()) {
-    (*labels)[kServiceControlReferer] = info.referer;
+    (*labels)[kServiceControlReferer] = std::string(info.referer);
   }
   (*labels)[kServiceControlUserAgent] = kUserAgent;
-  (*labels)[kServiceControlServiceAgent] = get_service_agent();
+  (*labels)[kServiceControlServiceAgent] = service_agent_;
 
   for (auto metric : info.metric_cost_vector) {
     MetricValueSet* value_set = operation->add_quota_metrics();
@@ -1048,33 +1146,50 @@ Status RequestBuilder::FillCheckRequest(const CheckRequestInfo& info,
   Operation* op = request->mutable_operation();
   SetOperationCommonFields(info, current_time, op);
   if (!info.api_key.empty()) {
-    // For check request, we send the API key as is.
-    op->set_consumer_id(std::string(kConsumerIdApiKey) +
-                        std::string(info.api_key));
+    op->set_consumer_id(CheckConsumerId(info));
   }
 
+  CheckLabels check_labels;
+  GetCheckLabels(info, &check_labels);
   auto* labels = op->mutable_labels();
+  for (const auto& label : check_labels) {
+    (*labels)[std::string(label.first)] = std::string(label.second);
+  }
+
+  return OkStatus();
+}
+
+std::string RequestBuilder::CheckConsumerId(const CheckRequestInfo& info) {
+  if (info.api_key.empty()) {
+    return std::string();
+  }
+  // For check request, we send the API key as is.
+  return absl::StrCat(kConsumerIdApiKey, info.api_key);
+}
+
+void RequestBuilder::GetCheckLabels(const CheckRequestInfo& info,
+                                    CheckLabels* labels) const {
+  labels->clear();
   if (!info.client_ip.empty()) {
-    (*labels)[kServiceControlCallerIp] = info.client_ip;
+    labels->emplace_back(kServiceControlCallerIp, info.client_ip);
   }
   if (!info.referer.empty()) {
-    (*labels)[kServiceControlReferer] = info.referer;
+    labels->emplace_back(kServiceControlReferer, info.referer);
   }
-  (*labels)[kServiceControlUserAgent] = kUserAgent;
-  (*labels)[kServiceControlServiceAgent] = get_service_agent();
+  labels->emplace_back(kServiceControlUserAgent, kUserAgent);
+  labels->emplace_back(kServiceControlServiceAgent, service_agent_);
 
   if (!info.android_package_name.empty()) {
-    (*labels)[kServiceControlAndroidPackageName] = info.android_package_name;
+    labels->emplace_back(kServiceControlAndroidPackageName,
+                         info.android_package_name);
   }
   if (!info.android_cert_fingerprint.empty()) {
-    (*labels)[kServiceControlAndroidCertFingerprint] =
-        info.android_cert_fingerprint;
+    labels->emplace_back(kServiceControlAndroidCertFingerprint,
+                         info.android_cert_fingerprint);
   }
   if (!info.ios_bundle_id.empty()) {
-    (*labels)[kServiceControlIosBundleId] = info.ios_bundle_id;
+    labels->emplace_back(kServiceControlIosBundleId, info.ios_bundle_id);
   }
-
-  return OkStatus();
 }
 
 Status RequestBuilder::FillReportRequest(const ReportRequestInfo& info,
@@ -1101,13 +1216,8 @@ Status RequestBuilder::FillReportRequest(const ReportRequestInfo& info,
   if (!info.operation_id.empty() && !info.operation_name.empty()) {
     Map<std::string, std::string>* labels = op->mutable_labels();
     // Set all labels with by_consumer_only is false
-    for (auto it = labels_.begin(), end = labels_.end(); it != end; it++) {
-      const SupportedLabel* l = *it;
-      if (l->set && !l->by_consumer_only) {
-        status = (l->set)(*l, info, labels);
-        if (!status.ok()) return status;
-      }
-    }
+    status = SetLabels(labels_, info, labels);
+    if (!status.ok()) return status;
 
     // Report will reject consumer metric if it's based on a invalid/unknown api
     // key, or if the service is not activated in the consumer project.
@@ -1115,21 +1225,21 @@ Status RequestBuilder::FillReportRequest(const ReportRequestInfo& info,
                                 api_key::ApiKeyState::VERIFIED;
 
     // Populate all metrics.
-    for (auto it = metrics_.begin(), end = metrics_.end(); it != end; it++) {
-      const SupportedMetric* m = *it;
-      if (send_consumer_metric || m->mark != SupportedMetric::CONSUMER) {
-        if (m->set && m->mark != SupportedMetric::PRODUCER_BY_CONSUMER) {
-          status = (m->set)(*m, info, op);
-          if (!status.ok()) return status;
-        }
-      }
+    for (const SupportedMetric* m :
+         send_consumer_metric ? metrics_ : producer_metrics_) {
+      if (!IsMetricInReport(*m, info)) continue;
+      status = (m->set)(*m, info, op);
+      if (!status.ok()) return status;
     }
   }
 
-  // Fill log entries.
-  for (auto it = logs_.begin(), end = logs_.end(); it != end; it++) {
-    FillLogEntry(info, *it, service_config_id_, current_time,
-                 op->add_log_entries());
+  // Fill log entries, once per request.
+  if (info.is_final_report && !info.skip_log_entries &&
+      !log_entries_.empty() &&
+      (log_sampler_ == nullptr || log_sampler_->ShouldLog(info))) {
+    for (const LogEntry& prototype : log_entries_) {
+      FillLogEntry(info, prototype, current_time, op->add_log_entries());
+    }
   }
 
   if (!info.check_response_info.consumer_project_number.empty()) {
@@ -1139,6 +1249,60 @@ Status RequestBuilder::FillReportRequest(const ReportRequestInfo& info,
   return OkStatus();
 }
 
+bool RequestBuilder::ReportSignature(const ReportRequestInfo& info,
+                                     std::string* signature) const {
+  if ((has_logs() && !(info.metrics_only && info.skip_log_entries)) ||
+      !info.is_first_report || !info.is_final_report ||
+      info.operation_id.empty() || info.operation_name.empty()) {
+    return false;
+  }
+  // All the fields the consumer id, the labels and the set of metrics are
+  // built from, whether the labels using them are enabled or not. The API
+  // key is only reported once verified, so the reports of the keys that are
+  // not share their signatures.
+  const CheckResponseInfo& check = info.check_response_info;
+  const absl::string_view sep = kSignatureSeparator;
+  const absl::string_view verified_key =
+      check.api_key_state == api_key::ApiKeyState::VERIFIED ? info.api_key
+                                                            : "";
+  signature->clear();
+  absl::StrAppend(signature, info.operation_name, sep,
+                  static_cast<int>(check.api_key_state), sep, verified_key,
+                  sep, check.consumer_project_number, sep, info.auth_issuer,
+                  sep, info.auth_audience, sep, get_status_code(info), sep,
+                  static_cast<int>(info.status.code()), sep,
+                  static_cast<int>(info.frontend_protocol), sep,
+                  static_cast<int>(info.backend_protocol), sep);
+  absl::StrAppend(signature, info.referer, sep, info.location, sep,
+                  info.api_method, sep, info.api_version, sep,
+                  info.compute_platform);
+  return true;
+}
+
+Status RequestBuilder::FillReportMetrics(const ReportRequestInfo& info,
+                                         ReportRequest* request) const {
+  request->Clear();
+  const Timestamp current_time = CreateTimestamp(info.current_time);
+  Operation* op = request->add_operations();
+  *op->mutable_end_time() = current_time;
+  if (info.operation_id.empty() || info.operation_name.empty()) {
+    return OkStatus();
+  }
+
+  bool send_consumer_metric = info.check_response_info.api_key_state ==
+                              api_key::ApiKeyState::VERIFIED;
+  Status status = SetMetrics(
+      send_consumer_metric ? metrics_ : producer_metrics_, info, op);
+  if (!status.ok()) return status;
+
+  if (!info.check_response_info.consumer_project_number.empty()) {
+    op = request->add_operations();
+    *op->mutable_end_time() = current_time;
+    return SetMetrics(by_consumer_metrics_, info, op);
+  }
+  return OkStatus();
+}
+
 Status RequestBuilder::AppendByConsumerOperations(
     const ReportRequestInfo& info,
     ::google::api::servicecontrol::v1::ReportRequest* request,
@@ -1159,27 +1323,36 @@ Status RequestBuilder::AppendByConsumerOperations(
   if (!info.operation_id.empty() && !info.operation_name.empty()) {
     Map<std::string, std::string>* labels = op->mutable_labels();
     // Set all labels.
-    for (auto it = labels_.begin(), end = labels_.end(); it != end; it++) {
-      const SupportedLabel* l = *it;
-      if (l->set) {
-        Status status = (l->set)(*l, info, labels);
-        if (!status.ok()) return status;
-      }
-    }
+    Status status = SetLabels(labels_, info, labels);
+    if (!status.ok()) return status;
+    status = SetLabels(by_consumer_labels_, info, labels);
+    if (!status.ok()) return status;
 
     // Populate all metrics.
-    for (auto it = metrics_.begin(), end = metrics_.end(); it != end; it++) {
-      const SupportedMetric* m = *it;
-      if (m->set && m->mark == SupportedMetric::PRODUCER_BY_CONSUMER) {
-        Status status = (m->set)(*m, info, op);
-        if (!status.ok()) return status;
-      }
+    for (const SupportedMetric* m : by_consumer_metrics_) {
+      if (!IsMetricInReport(*m, info)) continue;
+      status = (m->set)(*m, info, op);
+      if (!status.ok()) return status;
     }
   }
 
   return OkStatus();
 }
 
+Status RequestBuilder::SetLabels(const std::vector<LabelSetter>& setters,
+                                 const ReportRequestInfo& info,
+                                 Map<std::string, std::string>* labels) const {
+  for (const LabelSetter& setter : setters) {
+    if (setter.constant_value.has_value()) {
+      (*labels)[setter.key] = *setter.constant_value;
+      continue;
+    }
+    Status status = (setter.label->set)(setter.key, info, labels);
+    if (!status.ok()) return status;
+  }
+  return OkStatus();
+}
+
 bool RequestBuilder::IsMetricSupported(
     const ::google::api::MetricDescriptor& metric) {
   for (int i = 0; i < supported_metrics_count; i++) {
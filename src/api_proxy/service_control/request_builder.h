@@ -15,19 +15,32 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "google/api/label.pb.h"
 #include "google/api/metric.pb.h"
 #include "google/api/servicecontrol/v1/quota_controller.pb.h"
 #include "google/api/servicecontrol/v1/service_controller.pb.h"
 #include "google/protobuf/stubs/status.h"
 #include "google/protobuf/timestamp.pb.h"
+#include "src/api_proxy/service_control/log_sampler.h"
 #include "src/api_proxy/service_control/request_info.h"
 
 namespace espv2 {
 namespace api_proxy {
 namespace service_control {
 
+struct SupportedMetric;
+struct SupportedLabel;
+
 class RequestBuilder final {
  public:
   // Initializes RequestBuilder with all supported metrics and labels.
@@ -54,6 +67,19 @@ class RequestBuilder final {
       const CheckRequestInfo& info,
       ::google::api::servicecontrol::v1::CheckRequest* request) const;
 
+  // The labels of a check request, as key and value.
+  using CheckLabels =
+      absl::InlinedVector<std::pair<absl::string_view, absl::string_view>, 8>;
+
+  // Returns the consumer id FillCheckRequest sets for the info, empty if it
+  // sets none.
+  static std::string CheckConsumerId(const CheckRequestInfo& info);
+
+  // Sets the labels FillCheckRequest sets for the info, in no particular
+  // order. The strings view the info and the builder. Lets the callers key
+  // the check request without building it.
+  void GetCheckLabels(const CheckRequestInfo& info, CheckLabels* labels) const;
+
   ::google::protobuf::util::Status FillAllocateQuotaRequest(
       const QuotaRequestInfo& info,
       ::google::api::servicecontrol::v1::AllocateQuotaRequest* request) const;
@@ -65,6 +91,21 @@ class RequestBuilder final {
       const ReportRequestInfo& info,
       ::google::api::servicecontrol::v1::ReportRequest* request) const;
 
+  // Sets the signature of the report: the same for the reports whose
+  // operations only differ by their ids, times and metric values. Returns
+  // false if the report can't be aggregated by it: the reports have log
+  // entries and the info is not metrics_only, or the report is one part of
+  // a stream.
+  bool ReportSignature(const ReportRequestInfo& info,
+                       std::string* signature) const;
+
+  // Fills only the end times and the metric values of the operations of the
+  // report, in the order FillReportRequest adds them. The request is cleared
+  // first and its operations are reused.
+  ::google::protobuf::util::Status FillReportMetrics(
+      const ReportRequestInfo& info,
+      ::google::api::servicecontrol::v1::ReportRequest* request) const;
+
   // Append a new consumer project Operations to the ReportRequest, if customer
   // project id from the CheckResponse is not empty
   ::google::protobuf::util::Status AppendByConsumerOperations(
@@ -76,13 +117,58 @@ class RequestBuilder final {
   static bool IsLabelSupported(const ::google::api::LabelDescriptor& label);
   const std::string& service_name() const { return service_name_; }
   const std::string& service_config_id() const { return service_config_id_; }
+  // Whether the reports carry log entries. If not, the logged fields of
+  // ReportRequestInfo are ignored and need not be filled.
+  bool has_logs() const { return !log_entries_.empty(); }
+
+  // Samples the log entries of the reports. Without a sampler, every request
+  // is logged.
+  void set_log_sampler(std::unique_ptr<LogSampler> log_sampler) {
+    log_sampler_ = std::move(log_sampler);
+  }
 
  private:
-  const std::vector<std::string> logs_;
-  const std::vector<const struct SupportedMetric*> metrics_;
-  const std::vector<const struct SupportedLabel*> labels_;
+  // A label to set on each report, with its name interned as the map key.
+  struct LabelSetter {
+    const SupportedLabel* label;
+    std::string key;
+    // Set for the labels whose value does not depend on the request.
+    absl::optional<std::string> constant_value;
+  };
+
+  RequestBuilder(const std::set<std::string>& logs,
+                 const std::function<bool(const SupportedMetric&)>& use_metric,
+                 const std::function<bool(const SupportedLabel&)>& use_label,
+                 const std::string& service_name,
+                 const std::string& service_config_id);
+
+  // Sets the labels on a report operation.
+  ::google::protobuf::util::Status SetLabels(
+      const std::vector<LabelSetter>& setters, const ReportRequestInfo& info,
+      ::google::protobuf::Map<std::string, std::string>* labels) const;
+
+  // One log entry per log, with the fields that are the same for all the
+  // reports already set.
+  std::vector<::google::api::servicecontrol::v1::LogEntry> log_entries_;
+  std::unique_ptr<LogSampler> log_sampler_;
+
+  // The setters of the enabled labels and metrics, split by the operations
+  // they are set on, so a report runs them without further filtering.
+  // Labels set on all operations.
+  std::vector<LabelSetter> labels_;
+  // Labels only set on the by-consumer operation.
+  std::vector<LabelSetter> by_consumer_labels_;
+  // Metrics of the main operation, in their report order.
+  std::vector<const SupportedMetric*> metrics_;
+  // Same as metrics_, without the consumer metrics.
+  std::vector<const SupportedMetric*> producer_metrics_;
+  // Metrics of the by-consumer operation.
+  std::vector<const SupportedMetric*> by_consumer_metrics_;
+
   const std::string service_name_;
   const std::string service_config_id_;
+  // The service agent label value, built once.
+  const std::string service_agent_;
 };
 
 }  // namespace service_control
@@ -0,0 +1,337 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares building report requests on the heap with building them on a
+// reused arena, as the service control filter does.
+//
+// Also measures filling the check, quota and report requests on the arena,
+// with no, some or all of the supported metrics and labels and with logged
+// headers and JWT payloads of varying sizes, and serializing them. The arena
+// bytes used by a request stand for its allocations.
+//
+// Also compares setting a distribution sample with the client library helper
+// with setting it with precomputed bucket bounds.
+//
+// Also compares filling a new ReportRequestInfo for each report with
+// clearing and filling a reused one, as the service control handler does.
+
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "google/protobuf/arena.h"
+#include "src/api_proxy/service_control/distribution_buckets.h"
+#include "src/api_proxy/service_control/request_builder.h"
+#include "utils/distribution_helper.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace service_control {
+namespace {
+
+namespace gasv1 = ::google::api::servicecontrol::v1;
+using ::google::service_control_client::DistributionHelper;
+
+// Same as the initial block of the filter's request arena.
+constexpr size_t kInitialBlockBytes = 16 * 1024;
+
+ReportRequestInfo makeReportRequestInfo() {
+  ReportRequestInfo info;
+  info.operation_id = "operation_id";
+  info.operation_name = "operation_name";
+  info.api_key = "api_key_x";
+  info.producer_project_id = "project_id";
+  info.current_time = std::chrono::system_clock::now();
+  info.referer = "referer";
+  info.http_response_code = 200;
+  info.location = "us-central";
+  info.api_name = "api-name";
+  info.api_version = "api-version";
+  info.api_method = "api-method";
+  info.request_size = 100;
+  info.response_size = 1024 * 1024;
+  info.log_message = "test-method is called";
+  info.latency.request_time_ms = 123;
+  info.latency.backend_time_ms = 101;
+  info.latency.overhead_time_ms = 22;
+  info.response_code_detail = "response-code-detail";
+  info.frontend_protocol = protocol::HTTP;
+  info.backend_protocol = protocol::GRPC;
+  info.compute_platform = "GKE";
+  info.auth_issuer = "auth-issuer";
+  info.auth_audience = "auth-audience";
+  info.check_response_info.api_key_state = api_key::ApiKeyState::VERIFIED;
+  info.check_response_info.consumer_project_number = "12345";
+  return info;
+}
+
+void BM_FillReportRequestOnHeap(benchmark::State& state) {
+  RequestBuilder builder({"endpoints_log"}, "test_service", "2016-09-19r0");
+  const ReportRequestInfo info = makeReportRequestInfo();
+  for (auto _ : state) {
+    gasv1::ReportRequest request;
+    (void)builder.FillReportRequest(info, &request);
+    benchmark::DoNotOptimize(request);
+  }
+}
+BENCHMARK(BM_FillReportRequestOnHeap);
+
+void BM_FillReportRequestOnArena(benchmark::State& state) {
+  RequestBuilder builder({"endpoints_log"}, "test_service", "2016-09-19r0");
+  const ReportRequestInfo info = makeReportRequestInfo();
+
+  auto initial_block = std::make_unique<char[]>(kInitialBlockBytes);
+  google::protobuf::ArenaOptions options;
+  options.initial_block = initial_block.get();
+  options.initial_block_size = kInitialBlockBytes;
+  google::protobuf::Arena arena(options);
+
+  for (auto _ : state) {
+    auto* request =
+        google::protobuf::Arena::CreateMessage<gasv1::ReportRequest>(&arena);
+    (void)builder.FillReportRequest(info, request);
+    benchmark::DoNotOptimize(request);
+    arena.Reset();
+  }
+}
+BENCHMARK(BM_FillReportRequestOnArena);
+
+google::protobuf::ArenaOptions arenaOptions(char* initial_block) {
+  google::protobuf::ArenaOptions options;
+  options.initial_block = initial_block;
+  options.initial_block_size = kInitialBlockBytes;
+  return options;
+}
+
+// The metrics and labels a builder is configured with.
+enum class Instruments { None, Some, All };
+
+std::unique_ptr<RequestBuilder> makeBuilder(Instruments instruments) {
+  switch (instruments) {
+    case Instruments::None:
+      return std::make_unique<RequestBuilder>(
+          std::set<std::string>{"endpoints_log"}, std::set<std::string>{},
+          std::set<std::string>{}, "test_service", "2016-09-19r0");
+    case Instruments::Some:
+      return std::make_unique<RequestBuilder>(
+          std::set<std::string>{"endpoints_log"},
+          std::set<std::string>{
+              "serviceruntime.googleapis.com/api/producer/request_count",
+              "serviceruntime.googleapis.com/api/producer/total_latencies",
+          },
+          std::set<std::string>{
+              "/response_code",
+              "/protocol",
+              "cloud.googleapis.com/location",
+              "serviceruntime.googleapis.com/api_method",
+          },
+          "test_service", "2016-09-19r0");
+    case Instruments::All:
+      break;
+  }
+  return std::make_unique<RequestBuilder>(
+      std::set<std::string>{"endpoints_log"}, "test_service", "2016-09-19r0");
+}
+
+// Fills requests on a reused arena, as the service control filter does, and
+// reports the arena bytes a request uses.
+template <class Request, class FillFunc>
+void fillOnArena(benchmark::State& state, FillFunc fill) {
+  auto initial_block = std::make_unique<char[]>(kInitialBlockBytes);
+  google::protobuf::Arena arena(arenaOptions(initial_block.get()));
+  for (auto _ : state) {
+    auto* request = google::protobuf::Arena::CreateMessage<Request>(&arena);
+    fill(request);
+    benchmark::DoNotOptimize(request);
+    arena.Reset();
+  }
+
+  fill(google::protobuf::Arena::CreateMessage<Request>(&arena));
+  state.counters["arena_bytes_per_op"] = arena.SpaceUsed();
+}
+
+void instrumentsArgs(benchmark::internal::Benchmark* benchmark) {
+  for (Instruments instruments :
+       {Instruments::None, Instruments::Some, Instruments::All}) {
+    benchmark->Arg(static_cast<int>(instruments));
+  }
+}
+
+void BM_FillCheckRequest(benchmark::State& state) {
+  RequestBuilder builder({"endpoints_log"}, "test_service", "2016-09-19r0");
+  CheckRequestInfo info;
+  info.operation_id = "operation_id";
+  info.operation_name = "operation_name";
+  info.api_key = "api_key_x";
+  info.producer_project_id = "project_id";
+  info.referer = "referer";
+  info.client_ip = "1.2.3.4";
+  info.android_package_name = "com.google.cloud";
+  info.current_time = std::chrono::system_clock::now();
+
+  fillOnArena<gasv1::CheckRequest>(state, [&](gasv1::CheckRequest* request) {
+    (void)builder.FillCheckRequest(info, request);
+  });
+}
+BENCHMARK(BM_FillCheckRequest);
+
+void BM_FillAllocateQuotaRequest(benchmark::State& state) {
+  RequestBuilder builder({"endpoints_log"}, "test_service", "2016-09-19r0");
+  const std::vector<std::pair<std::string, int>> metric_costs = {
+      {"metric_first", 1}, {"metric_second", 2}};
+  QuotaRequestInfo info(metric_costs);
+  info.operation_id = "operation_id";
+  info.method_name = "operation_name";
+  info.api_key = "api_key_x";
+  info.producer_project_id = "project_id";
+  info.referer = "referer";
+  info.client_ip = "1.2.3.4";
+
+  fillOnArena<gasv1::AllocateQuotaRequest>(
+      state, [&](gasv1::AllocateQuotaRequest* request) {
+        (void)builder.FillAllocateQuotaRequest(info, request);
+      });
+}
+BENCHMARK(BM_FillAllocateQuotaRequest);
+
+// Args: the Instruments, and the bytes of the logged headers and of the JWT
+// payloads.
+void BM_FillReportRequest(benchmark::State& state) {
+  const auto builder = makeBuilder(static_cast<Instruments>(state.range(0)));
+  ReportRequestInfo info = makeReportRequestInfo();
+  info.request_headers = std::string(state.range(1), 'h');
+  info.response_headers = std::string(state.range(1), 'h');
+  info.jwt_payloads = std::string(state.range(1), 'j');
+
+  fillOnArena<gasv1::ReportRequest>(state, [&](gasv1::ReportRequest* request) {
+    (void)builder->FillReportRequest(info, request);
+  });
+}
+
+void reportArgs(benchmark::internal::Benchmark* benchmark) {
+  for (Instruments instruments :
+       {Instruments::None, Instruments::Some, Instruments::All}) {
+    for (int logged_bytes : {0, 4 * 1024}) {
+      benchmark->Args({static_cast<int>(instruments), logged_bytes});
+    }
+  }
+}
+BENCHMARK(BM_FillReportRequest)->Apply(reportArgs);
+
+void BM_SerializeReportRequest(benchmark::State& state) {
+  const auto builder = makeBuilder(static_cast<Instruments>(state.range(0)));
+  ReportRequestInfo info = makeReportRequestInfo();
+  gasv1::ReportRequest request;
+  (void)builder->FillReportRequest(info, &request);
+
+  std::string serialized;
+  for (auto _ : state) {
+    request.SerializeToString(&serialized);
+    benchmark::DoNotOptimize(serialized);
+  }
+  state.SetBytesProcessed(state.iterations() * serialized.size());
+}
+BENCHMARK(BM_SerializeReportRequest)->Apply(instrumentsArgs);
+
+// Sets the strings of the info as the service control handler does for a
+// report, with logged headers and JWT payloads of the given bytes.
+void fillReportRequestInfoStrings(const std::string& logged,
+                                  ReportRequestInfo& info) {
+  info.client_ip.assign("2001:db8:85a3::8a2e:370:7334");
+  info.url.assign("/v1/projects/my-project/shelves/1/books?view=full");
+  info.method.assign("GET");
+  info.api_name.assign("endpoints.examples.bookstore.Bookstore");
+  info.api_version.assign("1.0.0");
+  info.api_method.assign("endpoints.examples.bookstore.Bookstore.ListBooks");
+  info.log_message.assign(info.api_method);
+  info.log_message.append(" is called");
+  info.auth_issuer.assign("https://accounts.google.com");
+  info.auth_audience.assign("bookstore.endpoints.my-project.cloud.goog");
+  info.check_response_info.consumer_number.assign("123456789012");
+  info.request_headers.assign(logged);
+  info.response_headers.assign(logged);
+  info.jwt_payloads.assign(logged);
+  info.response_code_detail.assign("via_upstream");
+  info.trace_id.assign("4bf92f3577b34da6a3ce929d0e0e4736");
+}
+
+// Arg: the bytes of the logged headers and of the JWT payloads.
+void BM_FillNewReportRequestInfo(benchmark::State& state) {
+  const std::string logged(state.range(0), 'h');
+  for (auto _ : state) {
+    ReportRequestInfo info;
+    fillReportRequestInfoStrings(logged, info);
+    benchmark::DoNotOptimize(info);
+  }
+}
+BENCHMARK(BM_FillNewReportRequestInfo)->Arg(0)->Arg(4 * 1024);
+
+void BM_FillReusedReportRequestInfo(benchmark::State& state) {
+  const std::string logged(state.range(0), 'h');
+  ReportRequestInfo info;
+  for (auto _ : state) {
+    info.Clear();
+    fillReportRequestInfoStrings(logged, info);
+    benchmark::DoNotOptimize(info);
+  }
+}
+BENCHMARK(BM_FillReusedReportRequestInfo)->Arg(0)->Arg(4 * 1024);
+
+// Latencies in seconds spread over the buckets of the time distributions.
+std::vector<double> makeLatencies() {
+  std::vector<double> latencies;
+  for (double latency = 1e-7; latency < 1e3; latency *= 1.7) {
+    latencies.push_back(latency);
+  }
+  return latencies;
+}
+
+// Sets a time distribution sample as the client library helper does.
+void BM_DistributionHelperSample(benchmark::State& state) {
+  const std::vector<double> latencies = makeLatencies();
+  size_t i = 0;
+  for (auto _ : state) {
+    gasv1::Distribution distribution;
+    (void)DistributionHelper::InitExponential(29, 2.0, 1e-6, &distribution);
+    (void)DistributionHelper::AddSample(latencies[i], &distribution);
+    benchmark::DoNotOptimize(distribution);
+    i = (i + 1) % latencies.size();
+  }
+}
+BENCHMARK(BM_DistributionHelperSample);
+
+// Sets the same sample with the precomputed bucket bounds.
+void BM_DistributionBucketsSample(benchmark::State& state) {
+  const std::vector<double> latencies = makeLatencies();
+  const DistributionBuckets buckets(29, 2.0, 1e-6);
+  size_t i = 0;
+  for (auto _ : state) {
+    gasv1::Distribution distribution;
+    buckets.setSample(latencies[i], &distribution);
+    benchmark::DoNotOptimize(distribution);
+    i = (i + 1) % latencies.size();
+  }
+}
+BENCHMARK(BM_DistributionBucketsSample);
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_proxy
+}  // namespace espv2
+
+BENCHMARK_MAIN();
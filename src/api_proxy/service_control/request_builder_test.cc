@@ -18,7 +18,10 @@
 
 #include <chrono>
 #include <fstream>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_replace.h"
@@ -158,6 +161,13 @@ TEST(RequestBuilder, TestRequestBuilderbufStruct) {
   ASSERT_FALSE(fields->empty());
 }
 
+TEST(RequestBuilder, HasLogsTest) {
+  EXPECT_TRUE(
+      RequestBuilder({"local_test_log"}, "test_service", "2016-09-19r0")
+          .has_logs());
+  EXPECT_FALSE(RequestBuilder({}, "test_service", "2016-09-19r0").has_logs());
+}
+
 TEST_F(RequestBuilderTest, FillGoodCheckRequestTest) {
   CheckRequestInfo info;
   FillOperationInfo(&info);
@@ -272,6 +282,28 @@ TEST_F(RequestBuilderTest, FillGoodReportRequestTest) {
   ASSERT_EQ(expected_text, text);
 }
 
+TEST_F(RequestBuilderTest, FillSampledOutReportRequestTest) {
+  RequestBuilder builder({"local_test_log"}, "test_service", "2016-09-19r0");
+  builder.set_log_sampler(std::make_unique<LogSampler>(0, 0));
+
+  ReportRequestInfo info;
+  FillOperationInfo(&info);
+  FillReportRequestInfo(&info);
+  info.http_response_code = 200;
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(builder.FillReportRequest(info, &request).ok());
+  ASSERT_EQ(request.operations_size(), 1);
+  EXPECT_EQ(request.operations(0).log_entries_size(), 0);
+  EXPECT_GT(request.operations(0).metric_value_sets_size(), 0);
+
+  // Errors are always logged.
+  info.http_response_code = 503;
+  request.Clear();
+  ASSERT_TRUE(builder.FillReportRequest(info, &request).ok());
+  EXPECT_EQ(request.operations(0).log_entries_size(), 1);
+}
+
 TEST_F(RequestBuilderTest, FillGoodReportRequestByConsumerTest) {
   ReportRequestInfo info;
   FillOperationInfo(&info);
@@ -288,6 +320,75 @@ TEST_F(RequestBuilderTest, FillGoodReportRequestByConsumerTest) {
   ASSERT_EQ(expected_text, text);
 }
 
+TEST_F(RequestBuilderTest, FillIntermediateReportRequestTest) {
+  ReportRequestInfo info;
+  FillOperationInfo(&info);
+  FillReportRequestInfo(&info);
+  info.backend_protocol = protocol::GRPC;
+  info.check_response_info.consumer_project_number = "12345";
+
+  auto metric_names = [](const gasv1::Operation& op) {
+    std::set<std::string> names;
+    for (const auto& metric_value_set : op.metric_value_sets()) {
+      names.insert(metric_value_set.metric_name());
+    }
+    return names;
+  };
+  const std::string kRequestCount =
+      "serviceruntime.googleapis.com/api/producer/request_count";
+  const std::string kRequestSizes =
+      "serviceruntime.googleapis.com/api/producer/request_sizes";
+  const std::string kTotalLatencies =
+      "serviceruntime.googleapis.com/api/producer/total_latencies";
+  const std::string kByConsumerRequestCount =
+      "serviceruntime.googleapis.com/api/producer/by_consumer/request_count";
+
+  // The first report of a stream counts the request.
+  info.is_final_report = false;
+  gasv1::ReportRequest first;
+  ASSERT_TRUE(scp_.FillReportRequest(info, &first).ok());
+  ASSERT_EQ(first.operations_size(), 2);
+  std::set<std::string> names = metric_names(first.operations(0));
+  EXPECT_EQ(names.count(kRequestCount), 1);
+  EXPECT_EQ(names.count(kRequestSizes), 1);
+  EXPECT_EQ(names.count(kTotalLatencies), 0);
+  EXPECT_EQ(first.operations(0).log_entries_size(), 0);
+  EXPECT_EQ(metric_names(first.operations(1)).count(kByConsumerRequestCount),
+            1);
+  // The response codes are not known yet.
+  for (const char* label :
+       {"/response_code", "/response_code_class", "/status_code"}) {
+    EXPECT_EQ(first.operations(0).labels().count(label), 0) << label;
+  }
+
+  // Later intermediate reports only send the sizes.
+  info.is_first_report = false;
+  gasv1::ReportRequest intermediate;
+  ASSERT_TRUE(scp_.FillReportRequest(info, &intermediate).ok());
+  names = metric_names(intermediate.operations(0));
+  EXPECT_EQ(names.count(kRequestCount), 0);
+  EXPECT_EQ(names.count(kRequestSizes), 1);
+  EXPECT_EQ(names.count(kTotalLatencies), 0);
+  EXPECT_EQ(intermediate.operations(0).log_entries_size(), 0);
+  EXPECT_EQ(
+      metric_names(intermediate.operations(1)).count(kByConsumerRequestCount),
+      0);
+
+  // The final report sends the latencies and the logs.
+  info.is_final_report = true;
+  gasv1::ReportRequest final_report;
+  ASSERT_TRUE(scp_.FillReportRequest(info, &final_report).ok());
+  names = metric_names(final_report.operations(0));
+  EXPECT_EQ(names.count(kRequestCount), 0);
+  EXPECT_EQ(names.count(kRequestSizes), 1);
+  EXPECT_EQ(names.count(kTotalLatencies), 1);
+  EXPECT_EQ(final_report.operations(0).log_entries_size(), 1);
+  for (const char* label :
+       {"/response_code", "/response_code_class", "/status_code"}) {
+    EXPECT_EQ(final_report.operations(0).labels().count(label), 1) << label;
+  }
+}
+
 TEST_F(RequestBuilderTest, FillReportRequestFailedTest) {
   ReportRequestInfo info;
   FillOperationInfo(&info);
@@ -311,6 +412,34 @@ TEST_F(RequestBuilderTest, FillReportRequestFailedTest) {
   ASSERT_EQ(expected_text, text);
 }
 
+TEST_F(RequestBuilderTest, ReportCodeLabelsTest) {
+  ReportRequestInfo info;
+  FillOperationInfo(&info);
+  FillReportRequestInfo(&info);
+
+  // Both the codes looked up and the ones out of the tables.
+  const std::vector<std::pair<unsigned int, StatusCode>> codes = {
+      {0, StatusCode::kOk},
+      {99, StatusCode::kCancelled},
+      {100, StatusCode::kUnknown},
+      {204, StatusCode::kUnauthenticated},
+      {599, StatusCode::kUnavailable},
+      {600, static_cast<StatusCode>(17)},
+      {1000, static_cast<StatusCode>(100)},
+  };
+  for (const auto& code : codes) {
+    info.http_response_code = code.first;
+    info.status = Status(code.second, "");
+
+    gasv1::ReportRequest request;
+    ASSERT_TRUE(scp_.FillReportRequest(info, &request).ok());
+    const auto& labels = request.operations(0).labels();
+    EXPECT_EQ(labels.at("/response_code"), std::to_string(code.first));
+    EXPECT_EQ(labels.at("/status_code"),
+              std::to_string(static_cast<int>(code.second)));
+  }
+}
+
 TEST_F(RequestBuilderTest, FillReportRequestFailedByGrpcBackendTest) {
   ReportRequestInfo info;
   FillOperationInfo(&info);
@@ -385,6 +514,30 @@ TEST_F(RequestBuilderTest, FillReportRequestEmptyOptionalTest) {
   ASSERT_EQ(expected_text, text);
 }
 
+TEST_F(RequestBuilderTest, FillReportRequestClearedInfoTest) {
+  // A cleared info fills the same request as a new one.
+  ReportRequestInfo info;
+  FillOperationInfo(&info);
+  FillReportRequestInfo(&info);
+  info.client_ip = "1.2.3.4";
+  info.grpc_response_code = StatusCode::kUnavailable;
+  info.request_headers = "x-request=1;";
+  info.jwt_payloads = "sub=user;";
+  info.is_final_report = false;
+  info.check_response_info.consumer_project_number = "12345";
+  info.Clear();
+  FillOperationInfo(&info);
+  info.check_response_info.api_key_state = api_key::ApiKeyState::VERIFIED;
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(scp_.FillReportRequest(info, &request).ok());
+
+  std::string text = ReportRequestToString(&request);
+  std::string expected_text =
+      ReadTestBaseline("report_request_empty_optional.golden");
+  ASSERT_EQ(expected_text, text);
+}
+
 TEST_F(RequestBuilderTest, ReportApiKeyVerifiedTest) {
   ReportRequestInfo info;
   FillOperationInfo(&info);
@@ -18,6 +18,7 @@
 #include <memory>
 #include <string>
 
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "google/api/quota.pb.h"
 #include "google/protobuf/stubs/status.h"
@@ -95,25 +96,29 @@ struct LatencyInfo {
 // in minimum info and call Fill functions to fill the protobuf.
 
 // Basic information about the API call (operation).
+//
+// The string views point into the request headers, the filter config or the
+// handler of the request. They are only valid until the Fill function using
+// them returns.
 struct OperationInfo {
   // Identity of the operation. It must be unique within the scope of the
   // service. If the service calls Check() and Report() on the same operation,
   // the two calls should carry the same operation id.
-  std::string operation_id;
+  absl::string_view operation_id;
 
   // Fully qualified name of the operation.
-  std::string operation_name;
+  absl::string_view operation_name;
 
   // The producer project id.
-  std::string producer_project_id;
+  absl::string_view producer_project_id;
 
   // The API key.
-  std::string api_key;
+  absl::string_view api_key;
 
   // Uses Referer header, if the Referer header isn't present, use the
   // Origin header. If both of them not present, it's empty.
   // FIXME: Currently we don't check the Origin header.
-  std::string referer;
+  absl::string_view referer;
 
   // The current time used for operation.start_time for both Check
   // and Report.
@@ -128,9 +133,13 @@ struct OperationInfo {
 // Information to fill Check request protobuf.
 struct CheckRequestInfo : public OperationInfo {
   // used for api key restriction check
-  std::string android_package_name;
-  std::string android_cert_fingerprint;
-  std::string ios_bundle_id;
+  absl::string_view android_package_name;
+  absl::string_view android_cert_fingerprint;
+  absl::string_view ios_bundle_id;
+
+  // The time the downstream request times out, if it has a deadline. The
+  // Check call does not outlast it.
+  absl::optional<std::chrono::steady_clock::time_point> deadline;
 };
 
 enum ScResponseErrorType {
@@ -213,19 +222,36 @@ struct ReportRequestInfo : public OperationInfo {
   // Original request URL.
   std::string url;
 
-  // location of the service, such as us-central.
-  std::string location;
+  // location of the service, such as us-central. Views the filter config.
+  absl::string_view location;
   // API name and version.
   std::string api_name;
   std::string api_version;
   std::string api_method;
 
   // The request size in bytes. -1 if not available.
+  // For a stream reported in several reports, the bytes since the previous
+  // report.
   int64_t request_size;
 
   // The response size in bytes. -1 if not available.
+  // For a stream reported in several reports, the bytes since the previous
+  // report.
   int64_t response_size;
 
+  // A long-lived stream is reported by intermediate reports while it is open,
+  // and a final report when it ends. Request counts are only sent in the
+  // first report, and latencies and logs in the final one. A request reported
+  // once is both.
+  bool is_first_report;
+  bool is_final_report;
+
+  // If set, the report has no log entry, as the proxy sheds its telemetry
+  // under overload. With metrics_only, it may also be pre-aggregated though
+  // the service has logs.
+  bool skip_log_entries;
+  bool metrics_only;
+
   // per request latency.
   LatencyInfo latency;
 
@@ -243,26 +269,26 @@ struct ReportRequestInfo : public OperationInfo {
   // HTTP method. all-caps string such as "GET", "POST" etc.
   std::string method;
 
-  // A recognized compute platform (GAE, GCE, GKE).
-  std::string compute_platform;
+  // A recognized compute platform (GAE, GCE, GKE). Views the filter config.
+  absl::string_view compute_platform;
 
   // If consumer data should be sent.
   CheckResponseInfo check_response_info;
 
-  // The request headers logged
+  // The request headers logged. Only filled if the service has logs.
   std::string request_headers;
 
-  // The request headers logged
+  // The response headers logged. Only filled if the service has logs.
   std::string response_headers;
 
-  // The jwt payloads logged
+  // The jwt payloads logged. Only filled if the service has logs.
   std::string jwt_payloads;
 
   // The response code detail.
   std::string response_code_detail;
 
-  // The GCP project ID the proxy is deployed on.
-  std::string project_id;
+  // The GCP project ID the proxy is deployed on. Views the filter config.
+  absl::string_view project_id;
 
   // Trace id (in hex) the request is tied to.
   std::string trace_id;
@@ -271,9 +297,63 @@ struct ReportRequestInfo : public OperationInfo {
       : http_response_code(0),
         request_size(-1),
         response_size(-1),
+        is_first_report(true),
+        is_final_report(true),
+        skip_log_entries(false),
+        metrics_only(false),
         frontend_protocol(protocol::UNKNOWN),
         backend_protocol(protocol::UNKNOWN),
         compute_platform("UNKNOWN(ESPv2)") {}
+
+  // Restores the defaults of a new ReportRequestInfo. The strings are cleared
+  // instead of freed, so an info reused for the reports of many requests
+  // stops allocating them once they have grown.
+  void Clear() {
+    operation_id = {};
+    operation_name = {};
+    producer_project_id = {};
+    api_key = {};
+    referer = {};
+    current_time = {};
+    client_ip.clear();
+
+    http_response_code = 0;
+    grpc_response_code.reset();
+    status = ::google::protobuf::util::Status();
+    url.clear();
+    location = {};
+    api_name.clear();
+    api_version.clear();
+    api_method.clear();
+    request_size = -1;
+    response_size = -1;
+    is_first_report = true;
+    is_final_report = true;
+    skip_log_entries = false;
+    metrics_only = false;
+    latency = LatencyInfo();
+    log_message.clear();
+    auth_issuer.clear();
+    auth_audience.clear();
+    frontend_protocol = protocol::UNKNOWN;
+    backend_protocol = protocol::UNKNOWN;
+    method.clear();
+    compute_platform = "UNKNOWN(ESPv2)";
+    check_response_info.consumer_project_number.clear();
+    check_response_info.consumer_type.clear();
+    check_response_info.consumer_number.clear();
+    check_response_info.error.name.clear();
+    check_response_info.error.is_network_error = false;
+    check_response_info.error.type =
+        ScResponseErrorType::ERROR_TYPE_UNSPECIFIED;
+    check_response_info.api_key_state = api_key::ApiKeyState::NOT_CHECKED;
+    request_headers.clear();
+    response_headers.clear();
+    jwt_payloads.clear();
+    response_code_detail.clear();
+    project_id = {};
+    trace_id.clear();
+  }
 };
 
 }  // namespace service_control
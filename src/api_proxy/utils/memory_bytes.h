@@ -0,0 +1,53 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace espv2 {
+namespace api_proxy {
+namespace utils {
+
+// Rough estimates of the memory held by the containers, for the memory
+// gauges. They count the allocations of the containers themselves, not of
+// the allocator around them.
+
+// The heap bytes of the string, 0 if it is stored inline.
+inline size_t HeapBytes(const std::string& s) {
+  const char* object = reinterpret_cast<const char*>(&s);
+  const bool inline_storage =
+      s.data() >= object && s.data() < object + sizeof(s);
+  return inline_storage ? 0 : s.capacity() + 1;
+}
+
+// The heap bytes of the slots of an absl flat hash map or set, with their
+// control bytes. The heap bytes of the values are not included.
+template <class FlatHashContainer>
+size_t SlotBytes(const FlatHashContainer& container) {
+  return container.capacity() *
+         (sizeof(typename FlatHashContainer::value_type) + 1);
+}
+
+// The heap bytes of the elements of a vector. The heap bytes of the
+// elements themselves are not included.
+template <class Vector>
+size_t VectorBytes(const Vector& vector) {
+  return vector.capacity() * sizeof(typename Vector::value_type);
+}
+
+}  // namespace utils
+}  // namespace api_proxy
+}  // namespace espv2
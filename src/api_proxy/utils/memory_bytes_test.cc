@@ -0,0 +1,50 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/api_proxy/utils/memory_bytes.h"
+
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace api_proxy {
+namespace utils {
+namespace {
+
+TEST(MemoryBytesTest, HeapBytes) {
+  // Short strings are stored inline.
+  EXPECT_EQ(HeapBytes(std::string()), 0);
+  EXPECT_EQ(HeapBytes(std::string("a")), 0);
+
+  const std::string long_string(100, 'a');
+  EXPECT_EQ(HeapBytes(long_string), long_string.capacity() + 1);
+}
+
+TEST(MemoryBytesTest, ContainerBytes) {
+  absl::flat_hash_set<int> set;
+  EXPECT_EQ(SlotBytes(set), 0);
+  set.insert(1);
+  EXPECT_EQ(SlotBytes(set), set.capacity() * (sizeof(int) + 1));
+
+  std::vector<int> vector;
+  vector.reserve(10);
+  EXPECT_EQ(VectorBytes(vector), vector.capacity() * sizeof(int));
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace api_proxy
+}  // namespace espv2
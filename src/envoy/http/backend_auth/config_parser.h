@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <list>
 #include <unordered_map>
 
@@ -19,6 +22,7 @@
 #include "absl/strings/str_cat.h"
 #include "api/envoy/v10/http/backend_auth/config.pb.h"
 #include "envoy/thread_local/thread_local.h"
+#include "src/envoy/token/token_registry.h"
 #include "src/envoy/token/token_subscriber_factory.h"
 
 namespace espv2 {
@@ -33,12 +37,31 @@ constexpr const char kFilterName[] =
 // Use shared_ptr to do atomic token update.
 using TokenSharedPtr = std::shared_ptr<std::string>;
 
+// Returns the id of the audience. The ids are dense and never reused, so a
+// per-route config and the filter config agree on the id of an audience
+// while they are built and updated apart. Only called when the configs are
+// built.
+uint32_t internAudience(absl::string_view audience);
+
 class FilterConfigParser {
  public:
   virtual ~FilterConfigParser() = default;
 
-  virtual const TokenSharedPtr getJwtToken(
-      absl::string_view audience) const PURE;
+  // Returns the `Authorization` header value with the token of the audience
+  // of the id from internAudience(), "Bearer <token>", formatted once per
+  // token. Returns nullptr if the audience is not configured or has no token
+  // on the calling worker yet.
+  virtual const TokenSharedPtr getAuthorizationHeader(
+      uint32_t audience_id) const PURE;
+
+  // Calls `ready` on the calling worker once getAuthorizationHeader() has a
+  // value for the audience, after it returned nullptr. Returns nullptr if the
+  // token is not fetched on demand, then there is nothing to wait for.
+  virtual token::TokenWaitPtr waitForJwtToken(
+      uint32_t audience_id, std::function<void()> ready) const PURE;
+
+  // How long a request waits for an on demand token.
+  virtual std::chrono::milliseconds tokenWaitTimeout() const PURE;
 };
 
 using FilterConfigParserPtr = std::unique_ptr<FilterConfigParser>;
@@ -48,12 +71,18 @@ class PerRouteFilterConfig : public Envoy::Router::RouteSpecificFilterConfig {
   PerRouteFilterConfig(
       const ::espv2::api::envoy::v10::http::backend_auth::PerRouteFilterConfig&
           per_route)
-      : jwt_audience_(per_route.jwt_audience()) {}
+      : jwt_audience_(per_route.jwt_audience()),
+        audience_id_(internAudience(jwt_audience_)) {}
 
   absl::string_view jwt_audience() const { return jwt_audience_; }
 
+  // The id of the audience, to find its token without hashing the audience
+  // per request.
+  uint32_t audience_id() const { return audience_id_; }
+
  private:
   std::string jwt_audience_;
+  uint32_t audience_id_;
 };
 
 using PerRouteFilterConfigSharedPtr = std::shared_ptr<PerRouteFilterConfig>;
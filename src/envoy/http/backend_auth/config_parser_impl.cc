@@ -15,9 +15,11 @@
 #include "src/envoy/http/backend_auth/config_parser_impl.h"
 
 #include <memory>
+#include <utility>
 
 #include "google/protobuf/util/time_util.h"
 #include "source/common/common/assert.h"
+#include "src/envoy/utils/string_interner.h"
 
 namespace espv2 {
 namespace envoy {
@@ -29,57 +31,81 @@ using ::espv2::api::envoy::v10::http::common::AccessToken;
 using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
 using ::google::protobuf::util::TimeUtil;
 using token::GetTokenFunc;
+using token::TokenConstSharedPtr;
+using token::TokenRegistry;
 using token::TokenSubscriber;
 using token::TokenType;
 using token::UpdateTokenCallback;
 
-AudienceContext::AudienceContext(
-    const std::string& jwt_audience,
-    Envoy::Server::Configuration::FactoryContext& context,
-    const FilterConfig& filter_config,
-    const token::TokenSubscriberFactory& token_subscriber_factory,
-    GetTokenFunc access_token_fn)
-    : tls_(context.threadLocal()) {
-  tls_.set(
-      [](Envoy::Event::Dispatcher&) { return std::make_shared<TokenCache>(); });
-
-  UpdateTokenCallback callback = [this](absl::string_view token) {
-    TokenSharedPtr new_token = std::make_shared<std::string>(token);
-    tls_.runOnAllThreads([new_token](Envoy::OptRef<TokenCache> obj) {
-      obj->token_ = new_token;
-    });
+namespace {
+
+// Refreshed id tokens are published to the workers together, well before the
+// old ones expire.
+constexpr std::chrono::milliseconds kTokenBatchWindow(1000);
+
+constexpr std::chrono::milliseconds kDefaultTokenWaitTimeout(5000);
+
+constexpr char kBearer[] = "Bearer ";
+
+}  // namespace
+
+uint32_t internAudience(absl::string_view audience) {
+  static auto* interner = new utils::StringInterner();
+  return interner->intern(audience);
+}
+
+AudienceContext::AudienceContext(const std::string& jwt_audience,
+                                 const FilterConfig& filter_config,
+                                 GetTokenFunc access_token_fn,
+                                 TokenRegistry& registry)
+    : jwt_audience_(jwt_audience),
+      filter_config_(filter_config),
+      access_token_fn_(std::move(access_token_fn)),
+      registry_(registry),
+      token_id_(registry.add()) {}
+
+void AudienceContext::subscribe(
+    const token::TokenSubscriberFactory& token_subscriber_factory) {
+  if (token_sub_ptr_ != nullptr) {
+    return;
+  }
+  // The registry keeps the header value, so requests do not format it.
+  UpdateTokenCallback callback = [&registry = registry_, id = token_id_](
+                                     const TokenConstSharedPtr& token) {
+    registry.update(id, absl::StrCat(kBearer, *token));
   };
 
-  switch (filter_config.id_token_info_case()) {
+  switch (filter_config_.id_token_info_case()) {
     case FilterConfig::IdTokenInfoCase::kIamToken: {
-      const std::string& uri = filter_config.iam_token().iam_uri().uri();
+      const std::string& uri = filter_config_.iam_token().iam_uri().uri();
       const std::string& cluster =
-          filter_config.iam_token().iam_uri().cluster();
+          filter_config_.iam_token().iam_uri().cluster();
       const std::chrono::seconds fetch_timeout(TimeUtil::DurationToSeconds(
-          filter_config.iam_token().iam_uri().timeout()));
+          filter_config_.iam_token().iam_uri().timeout()));
       const DependencyErrorBehavior error_behavior =
-          filter_config.dep_error_behavior();
+          filter_config_.dep_error_behavior();
       const std::string real_uri =
-          absl::StrCat(uri, "?audience=", jwt_audience);
+          absl::StrCat(uri, "?audience=", jwt_audience_);
       const ::google::protobuf::RepeatedPtrField<std::string>& delegates =
-          filter_config.iam_token().delegates();
-      iam_token_sub_ptr_ = token_subscriber_factory.createIamTokenSubscriber(
+          filter_config_.iam_token().delegates();
+      token_sub_ptr_ = token_subscriber_factory.createIamTokenSubscriber(
           TokenType::IdentityToken, cluster, real_uri, fetch_timeout,
           error_behavior, callback, delegates,
-          ::google::protobuf::RepeatedPtrField<std::string>(), access_token_fn);
+          ::google::protobuf::RepeatedPtrField<std::string>(),
+          filter_config_.iam_token().access_token(), access_token_fn_);
     }
       return;
     case FilterConfig::IdTokenInfoCase::kImdsToken: {
-      const std::string& uri = filter_config.imds_token().uri();
-      const std::string& cluster = filter_config.imds_token().cluster();
+      const std::string& uri = filter_config_.imds_token().uri();
+      const std::string& cluster = filter_config_.imds_token().cluster();
       const std::chrono::seconds fetch_timeout(
-          TimeUtil::DurationToSeconds(filter_config.imds_token().timeout()));
+          TimeUtil::DurationToSeconds(filter_config_.imds_token().timeout()));
       const DependencyErrorBehavior error_behavior =
-          filter_config.dep_error_behavior();
+          filter_config_.dep_error_behavior();
       const std::string real_uri =
-          absl::StrCat(uri, "?format=standard&audience=", jwt_audience);
+          absl::StrCat(uri, "?format=standard&audience=", jwt_audience_);
 
-      imds_token_sub_ptr_ = token_subscriber_factory.createImdsTokenSubscriber(
+      token_sub_ptr_ = token_subscriber_factory.createImdsTokenSubscriber(
           TokenType::IdentityToken, cluster, real_uri, fetch_timeout,
           error_behavior, callback);
     }
@@ -89,10 +115,31 @@ AudienceContext::AudienceContext(
   }
 }
 
+void AudienceContext::unsubscribe() {
+  // The subscriber may still have updates for its entry, so it goes first.
+  token_sub_ptr_.reset();
+  registry_.clear(token_id_);
+  requested_.store(false);
+}
+
 FilterConfigParserImpl::FilterConfigParserImpl(
     const FilterConfig& config,
     Envoy::Server::Configuration::FactoryContext& context,
-    const token::TokenSubscriberFactory& token_subscriber_factory) {
+    const token::TokenSubscriberFactory& token_subscriber_factory,
+    const token::TokenSubscriberFactory& on_demand_token_subscriber_factory,
+    Envoy::Stats::Gauge* token_bytes)
+    : on_demand_token_subscriber_factory_(on_demand_token_subscriber_factory),
+      main_dispatcher_(context.dispatcher()),
+      time_source_(context.timeSource()),
+      lazy_(config.has_lazy_audience_config()),
+      idle_ttl_(config.lazy_audience_config().idle_ttl_ms()),
+      token_wait_timeout_(config.lazy_audience_config().max_wait_ms() == 0
+                              ? kDefaultTokenWaitTimeout
+                              : std::chrono::milliseconds(
+                                    config.lazy_audience_config()
+                                        .max_wait_ms())),
+      token_registry_(context.threadLocal(), context.dispatcher(),
+                      kTokenBatchWindow, token_bytes) {
   // If using IAM, then we need an access token to call IAM.
   if (config.id_token_info_case() == FilterConfig::IdTokenInfoCase::kIamToken) {
     switch (config.iam_token().access_token().token_type_case()) {
@@ -108,8 +155,9 @@ FilterConfigParserImpl::FilterConfigParserImpl(
         access_token_sub_ptr_ =
             token_subscriber_factory.createImdsTokenSubscriber(
                 TokenType::AccessToken, cluster, uri, fetch_timeout,
-                error_behavior, [this](absl::string_view access_token) {
-                  access_token_ = std::string(access_token);
+                error_behavior,
+                [this](const TokenConstSharedPtr& access_token) {
+                  access_token_ = access_token;
                 });
         break;
       }
@@ -119,11 +167,84 @@ FilterConfigParserImpl::FilterConfigParserImpl(
   }
 
   for (const auto& jwt_audience : config.jwt_audience_list()) {
-    audience_map_[jwt_audience] = AudienceContextPtr(new AudienceContext(
-        jwt_audience, context, config, token_subscriber_factory,
-        [this]() { return access_token_; }));
+    auto audience = std::make_unique<AudienceContext>(
+        jwt_audience, config,
+        [this]() {
+          return access_token_ == nullptr ? std::string() : *access_token_;
+        },
+        token_registry_);
+    if (!lazy_) {
+      audience->subscribe(token_subscriber_factory);
+    }
+    const uint32_t id = internAudience(jwt_audience);
+    if (id >= audiences_by_id_.size()) {
+      audiences_by_id_.resize(id + 1, nullptr);
+    }
+    audiences_by_id_[id] = audience.get();
+    audience_map_[jwt_audience] = std::move(audience);
   }
+
+  if (lazy_ && idle_ttl_.count() > 0) {
+    sweep_timer_ = main_dispatcher_.createTimer([this]() {
+      sweepIdleAudiences();
+      sweep_timer_->enableTimer(idle_ttl_);
+    });
+    sweep_timer_->enableTimer(idle_ttl_);
+  }
+}
+
+const TokenSharedPtr FilterConfigParserImpl::getAuthorizationHeader(
+    uint32_t audience_id) const {
+  AudienceContext* context = findAudience(audience_id);
+  if (context == nullptr) {
+    return nullptr;
+  }
+  if (!lazy_) {
+    return context->token();
+  }
+
+  context->setLastUsed(nowMs());
+  TokenSharedPtr token = context->token();
+  if (token == nullptr && context->requestSubscription()) {
+    ENVOY_LOG(debug, "subscribing to the token of audience: {}",
+              context->jwt_audience());
+    main_dispatcher_.post(
+        [this, context, alive = std::weak_ptr<bool>(alive_)]() {
+          if (alive.lock() != nullptr) {
+            context->subscribe(on_demand_token_subscriber_factory_);
+          }
+        });
+  }
+  return token;
 }
+
+token::TokenWaitPtr FilterConfigParserImpl::waitForJwtToken(
+    uint32_t audience_id, std::function<void()> ready) const {
+  const AudienceContext* context = findAudience(audience_id);
+  if (!lazy_ || context == nullptr) {
+    return nullptr;
+  }
+  return token_registry_.waitForToken(context->token_id(), std::move(ready));
+}
+
+int64_t FilterConfigParserImpl::nowMs() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time_source_.monotonicTime().time_since_epoch())
+      .count();
+}
+
+void FilterConfigParserImpl::sweepIdleAudiences() {
+  const int64_t idle_since_ms = nowMs() - idle_ttl_.count();
+  for (auto& audience : audience_map_) {
+    AudienceContext& context = *audience.second;
+    if (context.subscribed() && context.lastUsed() < idle_since_ms) {
+      ENVOY_LOG(debug, "unsubscribing from the idle token of audience: {}",
+                audience.first);
+      context.unsubscribe();
+    }
+  }
+}
+
 }  // namespace backend_auth
 }  // namespace http_filters
 }  // namespace envoy
@@ -12,15 +12,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <list>
 #include <unordered_map>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
 #include "api/envoy/v10/http/backend_auth/config.pb.h"
-#include "envoy/thread_local/thread_local.h"
+#include "envoy/common/time.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
 #include "source/common/common/empty_string.h"
 #include "src/envoy/http/backend_auth/config_parser.h"
+#include "src/envoy/token/token_registry.h"
 #include "src/envoy/token/token_subscriber_factory_impl.h"
 
 namespace espv2 {
@@ -28,34 +35,51 @@ namespace envoy {
 namespace http_filters {
 namespace backend_auth {
 
-class TokenCache : public Envoy::ThreadLocal::ThreadLocalObject {
- public:
-  TokenSharedPtr token_;
-};
-
 class AudienceContext {
  public:
+  // `filter_config` must outlive the context.
   AudienceContext(
       const std::string& jwt_audience,
-      Envoy::Server::Configuration::FactoryContext& context,
-      const ::espv2::api::envoy::v10::http::backend_auth::FilterConfig& config,
-      const token::TokenSubscriberFactory& token_subscriber_factory,
-      token::GetTokenFunc access_token_fn);
-  TokenSharedPtr token() const {
-    if (tls_->token_) {
-      return tls_->token_;
-    }
-    return nullptr;
-  }
+      const ::espv2::api::envoy::v10::http::backend_auth::FilterConfig&
+          filter_config,
+      token::GetTokenFunc access_token_fn, token::TokenRegistry& registry);
+
+  const std::string& jwt_audience() const { return jwt_audience_; }
+  TokenSharedPtr token() const { return registry_.get(token_id_); }
+  size_t token_id() const { return token_id_; }
+
+  // Creates the token subscriber, unless there is one. Main thread only.
+  void subscribe(const token::TokenSubscriberFactory& token_subscriber_factory);
+  // Destroys the token subscriber and removes its token. Main thread only.
+  void unsubscribe();
+  bool subscribed() const { return token_sub_ptr_ != nullptr; }
+
+  // Returns true for the first request of a subscription since the last
+  // unsubscribe(). Thread safe.
+  bool requestSubscription() { return !requested_.exchange(true); }
+
+  // The last time the token was asked for, for the idle sweep. Thread safe.
+  void setLastUsed(int64_t now_ms) { last_used_ms_.store(now_ms); }
+  int64_t lastUsed() const { return last_used_ms_.load(); }
 
  private:
-  Envoy::ThreadLocal::TypedSlot<TokenCache> tls_;
-  token::TokenSubscriberPtr iam_token_sub_ptr_;
-  token::TokenSubscriberPtr imds_token_sub_ptr_;
+  const std::string jwt_audience_;
+  const ::espv2::api::envoy::v10::http::backend_auth::FilterConfig&
+      filter_config_;
+  const token::GetTokenFunc access_token_fn_;
+  token::TokenRegistry& registry_;
+  const size_t token_id_;
+  token::TokenSubscriberPtr token_sub_ptr_;
+  std::atomic<bool> requested_{false};
+  std::atomic<int64_t> last_used_ms_{0};
 };
 
 using AudienceContextPtr = std::unique_ptr<AudienceContext>;
 
+// With a `lazy_audience_config`, the token of an audience is only fetched
+// once a request asks for it, and its subscriber is destroyed again after
+// `idle_ttl_ms` with no request. The subscribers are then created by the
+// `on_demand_token_subscriber_factory`.
 class FilterConfigParserImpl
     : public FilterConfigParser,
       public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
@@ -63,22 +87,53 @@ class FilterConfigParserImpl
   FilterConfigParserImpl(
       const ::espv2::api::envoy::v10::http::backend_auth::FilterConfig& config,
       Envoy::Server::Configuration::FactoryContext& context,
-      const token::TokenSubscriberFactory& token_subscriber_factory);
-
-  const TokenSharedPtr getJwtToken(absl::string_view audience) const override {
-    auto audience_it = audience_map_.find(audience);
-    if (audience_it == audience_map_.end()) {
-      return nullptr;
-    }
-    return audience_it->second->token();
+      const token::TokenSubscriberFactory& token_subscriber_factory,
+      const token::TokenSubscriberFactory& on_demand_token_subscriber_factory,
+      Envoy::Stats::Gauge* token_bytes = nullptr);
+
+  const TokenSharedPtr getAuthorizationHeader(
+      uint32_t audience_id) const override;
+
+  token::TokenWaitPtr waitForJwtToken(
+      uint32_t audience_id, std::function<void()> ready) const override;
+
+  std::chrono::milliseconds tokenWaitTimeout() const override {
+    return token_wait_timeout_;
   }
 
  private:
+  // Returns the audience of the id from internAudience(), or nullptr if it
+  // is not configured.
+  AudienceContext* findAudience(uint32_t audience_id) const {
+    return audience_id < audiences_by_id_.size()
+               ? audiences_by_id_[audience_id]
+               : nullptr;
+  }
+
+  int64_t nowMs() const;
+  // Unsubscribes the audiences idle for longer than the TTL.
+  void sweepIdleAudiences();
+
+  const token::TokenSubscriberFactory& on_demand_token_subscriber_factory_;
+  Envoy::Event::Dispatcher& main_dispatcher_;
+  Envoy::TimeSource& time_source_;
+  const bool lazy_;
+  const std::chrono::milliseconds idle_ttl_;
+  const std::chrono::milliseconds token_wait_timeout_;
+
   //  access_token_ is required for authentication during fetching id_token from
-  //  IAM server.
-  std::string access_token_;
+  //  IAM server. Null until the first one.
+  token::TokenConstSharedPtr access_token_;
   token::TokenSubscriberPtr access_token_sub_ptr_;
+  // The id tokens of all the audiences, published to the workers together.
+  // Must outlive the audiences.
+  token::TokenRegistry token_registry_;
   absl::flat_hash_map<std::string, AudienceContextPtr> audience_map_;
+  // Indexed by the audience id, nullptr for the ids of other audiences.
+  std::vector<AudienceContext*> audiences_by_id_;
+  Envoy::Event::TimerPtr sweep_timer_;
+  // Expires with the parser, for the subscriptions posted by the workers.
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
 };
 
 }  // namespace backend_auth
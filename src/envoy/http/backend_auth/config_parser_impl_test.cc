@@ -18,7 +18,9 @@
 #include "gtest/gtest.h"
 #include "source/common/common/empty_string.h"
 #include "src/envoy/token/mocks.h"
+#include "test/mocks/event/mocks.h"
 #include "test/mocks/server/mocks.h"
+#include "test/test_common/simulated_time_system.h"
 
 using ::testing::_;
 using ::testing::Invoke;
@@ -28,6 +30,7 @@ namespace envoy {
 namespace http_filters {
 namespace backend_auth {
 
+using ::espv2::api::envoy::v10::http::common::AccessToken;
 using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
 
 class ConfigParserImplTest : public ::testing::Test {
@@ -36,8 +39,20 @@ class ConfigParserImplTest : public ::testing::Test {
     google::protobuf::TextFormat::ParseFromString(std::string(filter_config),
                                                   &proto_config_);
     config_parser_ = std::make_unique<FilterConfigParserImpl>(
-        proto_config_, mock_factory_context_, mock_token_subscriber_factory_);
+        proto_config_, mock_factory_context_, mock_token_subscriber_factory_,
+        mock_token_subscriber_factory_);
   }
+
+  // The parser is called with the ids the per-route configs hold.
+  TokenSharedPtr getAuthorizationHeader(absl::string_view audience) {
+    return config_parser_->getAuthorizationHeader(internAudience(audience));
+  }
+  token::TokenWaitPtr waitForJwtToken(absl::string_view audience,
+                                      std::function<void()> ready) {
+    return config_parser_->waitForJwtToken(internAudience(audience),
+                                           std::move(ready));
+  }
+
   ::espv2::api::envoy::v10::http::backend_auth::FilterConfig proto_config_;
   testing::NiceMock<Envoy::Server::Configuration::MockFactoryContext>
       mock_factory_context_;
@@ -58,8 +73,10 @@ imds_token {
   }
 }
 )";
-  const std::string token_foo("token-foo");
-  const std::string token_bar("token-bar");
+  const token::TokenConstSharedPtr token_foo =
+      std::make_shared<const std::string>("token-foo");
+  const token::TokenConstSharedPtr token_bar =
+      std::make_shared<const std::string>("token-bar");
 
   EXPECT_CALL(mock_token_subscriber_factory_,
               createImdsTokenSubscriber(
@@ -90,10 +107,44 @@ imds_token {
 
   setUp(filter_config);
 
-  EXPECT_EQ(*config_parser_->getJwtToken("audience-foo"), "token-foo");
-  EXPECT_EQ(*config_parser_->getJwtToken("audience-bar"), "token-bar");
+  EXPECT_EQ(*getAuthorizationHeader("audience-foo"), "Bearer token-foo");
+  EXPECT_EQ(*getAuthorizationHeader("audience-bar"), "Bearer token-bar");
+
+  EXPECT_EQ(getAuthorizationHeader("audience-non-existent"), nullptr);
+}
+
+TEST_F(ConfigParserImplTest, PerRouteAudienceIds) {
+  // The per-route configs may be built before the filter config, and name
+  // audiences it does not have.
+  ::espv2::api::envoy::v10::http::backend_auth::PerRouteFilterConfig proto;
+  proto.set_jwt_audience("audience-per-route");
+  const PerRouteFilterConfig per_route(proto);
+  proto.set_jwt_audience("audience-unknown");
+  const PerRouteFilterConfig unknown(proto);
+  EXPECT_NE(per_route.audience_id(), unknown.audience_id());
+
+  EXPECT_CALL(mock_token_subscriber_factory_,
+              createImdsTokenSubscriber(_, _, _, _, _, _))
+      .WillOnce(Invoke([](const token::TokenType&, const std::string&,
+                          const std::string&, std::chrono::seconds,
+                          DependencyErrorBehavior,
+                          token::UpdateTokenCallback callback)
+                           -> token::TokenSubscriberPtr {
+        callback(std::make_shared<const std::string>("token-per-route"));
+        return nullptr;
+      }));
+  setUp(R"(
+jwt_audience_list: ["audience-per-route"]
+imds_token {
+  uri: "this-is-uri"
+  cluster: "this-is-cluster"
+}
+)");
 
-  EXPECT_EQ(config_parser_->getJwtToken("audience-non-existent"), nullptr);
+  EXPECT_EQ(*config_parser_->getAuthorizationHeader(per_route.audience_id()),
+            "Bearer token-per-route");
+  EXPECT_EQ(config_parser_->getAuthorizationHeader(unknown.audience_id()),
+            nullptr);
 }
 
 TEST_F(ConfigParserImplTest, GetIdTokenByIam) {
@@ -118,9 +169,12 @@ iam_token {
   }
 }
 )";
-  const std::string access_token("access_token");
-  const std::string id_token_foo("id-token-foo");
-  const std::string id_token_bar("id-token-bar");
+  const token::TokenConstSharedPtr access_token =
+      std::make_shared<const std::string>("access_token");
+  const token::TokenConstSharedPtr id_token_foo =
+      std::make_shared<const std::string>("id-token-foo");
+  const token::TokenConstSharedPtr id_token_bar =
+      std::make_shared<const std::string>("id-token-bar");
 
   EXPECT_CALL(mock_token_subscriber_factory_,
               createImdsTokenSubscriber(
@@ -139,7 +193,8 @@ iam_token {
   EXPECT_CALL(mock_token_subscriber_factory_,
               createIamTokenSubscriber(_, "this-is-iam-cluster",
                                        "this-is-iam-uri?audience=audience-foo",
-                                       std::chrono::seconds(4), _, _, _, _, _))
+                                       std::chrono::seconds(4), _, _, _, _, _,
+                                       _))
       .WillOnce(
           Invoke([&id_token_foo](
                      token::TokenType, const std::string&, const std::string&,
@@ -147,7 +202,7 @@ iam_token {
                      token::UpdateTokenCallback callback,
                      const ::google::protobuf::RepeatedPtrField<std::string>&,
                      const ::google::protobuf::RepeatedPtrField<std::string>&,
-                     token::GetTokenFunc access_token_fn)
+                     const AccessToken&, token::GetTokenFunc access_token_fn)
                      -> token::TokenSubscriberPtr {
             EXPECT_EQ(access_token_fn(), "access_token");
             callback(id_token_foo);
@@ -156,7 +211,8 @@ iam_token {
   EXPECT_CALL(mock_token_subscriber_factory_,
               createIamTokenSubscriber(_, "this-is-iam-cluster",
                                        "this-is-iam-uri?audience=audience-bar",
-                                       std::chrono::seconds(4), _, _, _, _, _))
+                                       std::chrono::seconds(4), _, _, _, _, _,
+                                       _))
       .WillOnce(
           Invoke([&id_token_bar](
                      token::TokenType, const std::string&, const std::string&,
@@ -164,7 +220,7 @@ iam_token {
                      token::UpdateTokenCallback callback,
                      const ::google::protobuf::RepeatedPtrField<std::string>&,
                      const ::google::protobuf::RepeatedPtrField<std::string>&,
-                     token::GetTokenFunc access_token_fn)
+                     const AccessToken&, token::GetTokenFunc access_token_fn)
                      -> token::TokenSubscriberPtr {
             EXPECT_EQ(access_token_fn(), "access_token");
             callback(id_token_bar);
@@ -173,8 +229,93 @@ iam_token {
 
   setUp(filter_config);
 
-  EXPECT_EQ(*config_parser_->getJwtToken("audience-foo"), "id-token-foo");
-  EXPECT_EQ(*config_parser_->getJwtToken("audience-bar"), "id-token-bar");
+  EXPECT_EQ(*getAuthorizationHeader("audience-foo"), "Bearer id-token-foo");
+  EXPECT_EQ(*getAuthorizationHeader("audience-bar"), "Bearer id-token-bar");
+}
+
+// Records its destruction.
+class TestSubscription : public token::TokenSubscription {
+ public:
+  explicit TestSubscription(bool& destroyed) : destroyed_(destroyed) {}
+  ~TestSubscription() override { destroyed_ = true; }
+
+ private:
+  bool& destroyed_;
+};
+
+TEST_F(ConfigParserImplTest, LazyTokenFetchedOnDemandAndReleasedWhenIdle) {
+  const char filter_config[] = R"(
+jwt_audience_list: ["audience-foo","audience-bar"]
+imds_token {
+  uri: "this-is-uri"
+  cluster: "this-is-cluster"
+  timeout: {
+    seconds: 20
+  }
+}
+lazy_audience_config {
+  max_wait_ms: 3000
+  idle_ttl_ms: 60000
+}
+)";
+  Envoy::Event::SimulatedTimeSystem time_system;
+  ON_CALL(mock_factory_context_, timeSource())
+      .WillByDefault(testing::ReturnRef(time_system));
+  // Created after the publish timer of the token registry.
+  auto* sweep_timer = new testing::NiceMock<Envoy::Event::MockTimer>(
+      &mock_factory_context_.dispatcher_);
+  auto* publish_timer = new testing::NiceMock<Envoy::Event::MockTimer>(
+      &mock_factory_context_.dispatcher_);
+
+  std::vector<token::UpdateTokenCallback> callbacks;
+  bool destroyed = false;
+  EXPECT_CALL(mock_token_subscriber_factory_,
+              createImdsTokenSubscriber(
+                  token::TokenType::IdentityToken, "this-is-cluster",
+                  "this-is-uri?format=standard&audience=audience-foo",
+                  std::chrono::seconds(20), _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&](const token::TokenType&, const std::string&,
+                                 const std::string&, std::chrono::seconds,
+                                 DependencyErrorBehavior,
+                                 token::UpdateTokenCallback callback)
+                                 -> token::TokenSubscriberPtr {
+        callbacks.push_back(callback);
+        return std::make_unique<TestSubscription>(destroyed);
+      }));
+
+  // Nothing is fetched at startup.
+  setUp(filter_config);
+  EXPECT_EQ(config_parser_->tokenWaitTimeout(),
+            std::chrono::milliseconds(3000));
+
+  // The first request subscribes, and waits for the token.
+  EXPECT_EQ(getAuthorizationHeader("audience-foo"), nullptr);
+  ASSERT_EQ(callbacks.size(), 1);
+  EXPECT_EQ(getAuthorizationHeader("audience-foo"), nullptr);
+  ASSERT_EQ(callbacks.size(), 1);
+  int ready = 0;
+  token::TokenWaitPtr wait =
+      waitForJwtToken("audience-foo", [&ready] { ++ready; });
+  ASSERT_NE(wait, nullptr);
+  EXPECT_EQ(waitForJwtToken("audience-non-existent", [] {}), nullptr);
+
+  callbacks[0](std::make_shared<const std::string>("token-foo"));
+  EXPECT_EQ(ready, 1);
+  EXPECT_EQ(*getAuthorizationHeader("audience-foo"), "Bearer token-foo");
+
+  // Idle past the TTL, the subscription is released.
+  time_system.advanceTimeWait(std::chrono::milliseconds(30000));
+  sweep_timer->invokeCallback();
+  EXPECT_FALSE(destroyed);
+  time_system.advanceTimeWait(std::chrono::milliseconds(60001));
+  sweep_timer->invokeCallback();
+  EXPECT_TRUE(destroyed);
+  publish_timer->invokeCallback();
+
+  // The next request subscribes again.
+  EXPECT_EQ(getAuthorizationHeader("audience-foo"), nullptr);
+  EXPECT_EQ(callbacks.size(), 2);
 }
 
 }  // namespace backend_auth
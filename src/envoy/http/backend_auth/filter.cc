@@ -39,18 +39,18 @@ using Envoy::Http::RegisterCustomInlineHeader;
 using Envoy::Http::RequestHeaderMap;
 
 namespace {
-constexpr char kBearer[] = "Bearer ";
-
 RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
     authorization_handle(CustomHeaders::get().Authorization);
 
 // The Http header to copy the original Authorization before it is overwritten.
-const Envoy::Http::LowerCaseString kXForwardedAuthorization{
-    "x-forwarded-authorization"};
+RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
+    x_forwarded_authorization_handle(
+        Envoy::Http::LowerCaseString("x-forwarded-authorization"));
 
 }  // namespace
 
 FilterHeadersStatus Filter::decodeHeaders(RequestHeaderMap& headers, bool) {
+  const auto timed = callback_timer_.decode();
   // Make sure route is calculated
   auto route = decoder_callbacks_->route();
 
@@ -65,39 +65,112 @@ FilterHeadersStatus Filter::decodeHeaders(RequestHeaderMap& headers, bool) {
           kFilterName);
   if (per_route == nullptr) {
     ENVOY_LOG(debug, "no per-route config");
-    config_->stats().allowed_by_auth_not_required_.inc();
+    config_->local_counters().inc(
+        config_->stats().allowed_by_auth_not_required_);
     return FilterHeadersStatus::Continue;
   }
 
   const auto& audience = per_route->jwt_audience();
   ENVOY_LOG(debug, "Found jwt_audience: {}", audience);
-  const TokenSharedPtr jwt_token = config_->cfg_parser().getJwtToken(audience);
-  if (!jwt_token) {
-    config_->stats().denied_by_no_token_.inc();
-    rejectRequest(
-        Envoy::Http::Code::InternalServerError,
-        absl::StrCat("Token not found for audience: ", audience),
-        utils::generateRcDetails(utils::kRcDetailFilterBackendAuth,
-                                 utils::kRcDetailErrorTypeMissingBackendToken));
+  const uint32_t audience_id = per_route->audience_id();
+  const TokenSharedPtr authorization =
+      config_->cfg_parser().getAuthorizationHeader(audience_id);
+  if (!authorization) {
+    // An on demand token may be on its way.
+    token_wait_ = config_->cfg_parser().waitForJwtToken(
+        audience_id, [this]() { onTokenReady(); });
+    if (token_wait_ != nullptr) {
+      ENVOY_LOG(debug, "waiting for the token of audience: {}", audience);
+      config_->stats().token_waited_.inc();
+      headers_ = &headers;
+      audience_ = std::string(audience);
+      audience_id_ = audience_id;
+      token_wait_timer_ = decoder_callbacks_->dispatcher().createTimer(
+          [this]() { onTokenWaitTimeout(); });
+      token_wait_timer_->enableTimer(config_->cfg_parser().tokenWaitTimeout());
+      return FilterHeadersStatus::StopIteration;
+    }
+
+    rejectNoToken(audience);
     return FilterHeadersStatus::StopIteration;
   }
 
+  addToken(headers, *authorization);
+  return FilterHeadersStatus::Continue;
+}
+
+FilterDataStatus Filter::decodeData(Envoy::Buffer::Instance&, bool) {
+  // The body waits with the headers for the token, buffered up to the
+  // buffer limit.
+  if (token_wait_ != nullptr) {
+    return FilterDataStatus::StopIterationAndWatermark;
+  }
+  return FilterDataStatus::Continue;
+}
+
+FilterTrailersStatus Filter::decodeTrailers(Envoy::Http::RequestTrailerMap&) {
+  if (token_wait_ != nullptr) {
+    return FilterTrailersStatus::StopIteration;
+  }
+  return FilterTrailersStatus::Continue;
+}
+
+void Filter::onDestroy() {
+  token_wait_.reset();
+  if (token_wait_timer_) {
+    token_wait_timer_->disableTimer();
+    token_wait_timer_.reset();
+  }
+}
+
+void Filter::addToken(RequestHeaderMap& headers,
+                      const std::string& authorization) {
   // Copy the existing `Authorization` header to `x-forwarded-authorization`
   // header.
   const Envoy::Http::HeaderEntry* existAuthToken =
       headers.getInline(authorization_handle.handle());
   if (existAuthToken != nullptr) {
-    // b/176165002: Clear out pre-existing header to prevent backends from
+    // b/176165002: Replace any pre-existing header to prevent backends from
     // unintentionally using the wrong value.
-    headers.remove(kXForwardedAuthorization);
+    headers.setInline(x_forwarded_authorization_handle.handle(),
+                      existAuthToken->value().getStringView());
+  }
+
+  // Formatted when the token was fetched.
+  headers.setInline(authorization_handle.handle(), authorization);
+  config_->local_counters().inc(config_->stats().token_added_);
+}
 
-    headers.addCopy(kXForwardedAuthorization,
-                    existAuthToken->value().getStringView());
+void Filter::onTokenReady() {
+  {
+    // The filters after this one run in continueDecoding(), they are not
+    // timed here.
+    const auto timed = callback_timer_.decode();
+    token_wait_.reset();
+    token_wait_timer_->disableTimer();
+
+    const TokenSharedPtr authorization =
+        config_->cfg_parser().getAuthorizationHeader(audience_id_);
+    if (!authorization) {
+      rejectNoToken(audience_);
+      return;
+    }
+    addToken(*headers_, *authorization);
   }
+  decoder_callbacks_->continueDecoding();
+}
 
-  headers.setInline(authorization_handle.handle(), kBearer + *jwt_token);
-  config_->stats().token_added_.inc();
-  return FilterHeadersStatus::Continue;
+void Filter::onTokenWaitTimeout() {
+  token_wait_.reset();
+  rejectNoToken(audience_);
+}
+
+void Filter::rejectNoToken(absl::string_view audience) {
+  config_->stats().denied_by_no_token_.inc();
+  rejectRequest(
+      Envoy::Http::Code::InternalServerError,
+      absl::StrCat("Token not found for audience: ", audience),
+      utils::kRcDetailsBackendAuthMissingBackendToken);
 }
 
 void Filter::rejectRequest(Envoy::Http::Code code, absl::string_view error_msg,
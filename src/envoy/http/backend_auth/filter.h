@@ -16,6 +16,7 @@
 
 #include <string>
 
+#include "envoy/event/timer.h"
 #include "envoy/http/filter.h"
 #include "envoy/http/header_map.h"
 #include "source/common/common/logger.h"
@@ -30,17 +31,40 @@ namespace backend_auth {
 class Filter : public Envoy::Http::PassThroughDecoderFilter,
                public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
  public:
-  Filter(FilterConfigSharedPtr config) : config_(config) {}
+  Filter(FilterConfigSharedPtr config)
+      : config_(config), callback_timer_(config_->callback_time_sampler()) {}
 
   // Envoy::Http::StreamDecoderFilter
   Envoy::Http::FilterHeadersStatus decodeHeaders(Envoy::Http::RequestHeaderMap&,
                                                  bool) override;
+  Envoy::Http::FilterDataStatus decodeData(Envoy::Buffer::Instance&,
+                                           bool) override;
+  Envoy::Http::FilterTrailersStatus decodeTrailers(
+      Envoy::Http::RequestTrailerMap&) override;
+
+  // Envoy::Http::StreamFilterBase
+  void onDestroy() override;
 
  private:
+  void addToken(Envoy::Http::RequestHeaderMap& headers,
+                const std::string& authorization);
+  void rejectNoToken(absl::string_view audience);
   void rejectRequest(Envoy::Http::Code code, absl::string_view error_msg,
                      absl::string_view details);
 
+  // The request waiting for an on demand token.
+  void onTokenReady();
+  void onTokenWaitTimeout();
+
   const FilterConfigSharedPtr config_;
+  utils::CallbackTimer callback_timer_;
+
+  // Set while the request waits for the token of `audience_`.
+  Envoy::Http::RequestHeaderMap* headers_{};
+  std::string audience_;
+  uint32_t audience_id_{};
+  token::TokenWaitPtr token_wait_;
+  Envoy::Event::TimerPtr token_wait_timer_;
 };
 
 }  // namespace backend_auth
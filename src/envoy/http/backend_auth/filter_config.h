@@ -17,6 +17,8 @@
 #include "api/envoy/v10/http/backend_auth/config.pb.h"
 #include "source/common/common/logger.h"
 #include "src/envoy/http/backend_auth/config_parser.h"
+#include "src/envoy/utils/callback_time.h"
+#include "src/envoy/utils/local_counters.h"
 
 namespace espv2 {
 namespace envoy {
@@ -26,17 +28,20 @@ namespace backend_auth {
 /**
  * All stats for the backend auth filter. @see stats_macros.h
  */
-#define ALL_BACKEND_AUTH_FILTER_STATS(COUNTER) \
-  COUNTER(denied_by_no_route)                  \
-  COUNTER(denied_by_no_token)                  \
-  COUNTER(allowed_by_auth_not_required)        \
-  COUNTER(token_added)
+#define ALL_BACKEND_AUTH_FILTER_STATS(COUNTER, GAUGE) \
+  COUNTER(denied_by_no_route)                         \
+  COUNTER(denied_by_no_token)                         \
+  COUNTER(allowed_by_auth_not_required)               \
+  COUNTER(token_added)                                \
+  COUNTER(token_waited)                               \
+  GAUGE(token_bytes, Accumulate)
 
 /**
  * Wrapper struct for backend auth filter stats. @see stats_macros.h
  */
 struct FilterStats {
-  ALL_BACKEND_AUTH_FILTER_STATS(GENERATE_COUNTER_STRUCT)
+  ALL_BACKEND_AUTH_FILTER_STATS(GENERATE_COUNTER_STRUCT,
+                                GENERATE_GAUGE_STRUCT)
 };
 
 class FilterConfig {
@@ -45,7 +50,13 @@ class FilterConfig {
 
   virtual FilterStats& stats() PURE;
 
+  // Counts the stats most requests increment.
+  virtual utils::LocalCounters& local_counters() PURE;
+
   virtual const FilterConfigParser& cfg_parser() const PURE;
+
+  // nullptr if the filter callbacks are not timed.
+  virtual const utils::CallbackTimeSampler* callback_time_sampler() const PURE;
 };
 
 using FilterConfigSharedPtr = std::shared_ptr<FilterConfig>;
@@ -38,9 +38,21 @@ class FilterConfigImpl
       Envoy::Server::Configuration::FactoryContext& context)
       : proto_config_(proto_config),
         stats_(generateStats(stats_prefix, context.scope())),
-        token_subscriber_factory_(context),
+        local_counters_(proto_config.local_counters(),
+                        {&stats_.allowed_by_auth_not_required_,
+                         &stats_.token_added_},
+                        context.threadLocal()),
+        token_subscriber_factory_(context,
+                                  proto_config_.token_refresh_config()),
+        on_demand_token_subscriber_factory_(
+            context, proto_config_.token_refresh_config(),
+            /*on_demand=*/true),
         config_parser_(std::make_unique<FilterConfigParserImpl>(
-            proto_config_, context, token_subscriber_factory_)) {}
+            proto_config_, context, token_subscriber_factory_,
+            on_demand_token_subscriber_factory_, &stats_.token_bytes_)),
+        callback_time_sampler_(utils::CallbackTimeSampler::create(
+            proto_config.callback_time(), stats_prefix + "backend_auth.",
+            context)) {}
 
   const ::espv2::api::envoy::v10::http::backend_auth::FilterConfig& config()
       const {
@@ -48,22 +60,30 @@ class FilterConfigImpl
   }
 
   FilterStats& stats() override { return stats_; }
+  utils::LocalCounters& local_counters() override { return local_counters_; }
   const FilterConfigParser& cfg_parser() const override {
     return *config_parser_;
   }
+  const utils::CallbackTimeSampler* callback_time_sampler() const override {
+    return callback_time_sampler_.get();
+  }
 
  private:
   FilterStats generateStats(const std::string& prefix,
                             Envoy::Stats::Scope& scope) {
     const std::string final_prefix = prefix + "backend_auth.";
-    return {ALL_BACKEND_AUTH_FILTER_STATS(
-        POOL_COUNTER_PREFIX(scope, final_prefix))};
+    return {
+        ALL_BACKEND_AUTH_FILTER_STATS(POOL_COUNTER_PREFIX(scope, final_prefix),
+                                      POOL_GAUGE_PREFIX(scope, final_prefix))};
   }
 
   ::espv2::api::envoy::v10::http::backend_auth::FilterConfig proto_config_;
   FilterStats stats_;
+  utils::LocalCounters local_counters_;
   const token::TokenSubscriberFactoryImpl token_subscriber_factory_;
+  const token::TokenSubscriberFactoryImpl on_demand_token_subscriber_factory_;
   FilterConfigParserPtr config_parser_;
+  const utils::CallbackTimeSamplerPtr callback_time_sampler_;
 };
 
 }  // namespace backend_auth
@@ -17,16 +17,19 @@
 #include "gmock/gmock.h"
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
+#include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/empty_string.h"
 #include "src/envoy/http/backend_auth/config_parser.h"
 #include "src/envoy/http/backend_auth/mocks.h"
 #include "src/envoy/utils/filter_state_utils.h"
+#include "test/mocks/event/mocks.h"
 #include "test/mocks/http/mocks.h"
 #include "test/mocks/router/mocks.h"
 #include "test/mocks/server/mocks.h"
 #include "test/test_common/utility.h"
 
 using ::testing::_;
+using ::testing::Invoke;
 using ::testing::NiceMock;
 using ::testing::Return;
 using ::testing::ReturnRef;
@@ -77,7 +80,8 @@ class BackendAuthFilterTest : public ::testing::Test {
 
   testing::NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope_;
   FilterStats stats_{ALL_BACKEND_AUTH_FILTER_STATS(
-      POOL_COUNTER_PREFIX(scope_, "backend_auth."))};
+      POOL_COUNTER_PREFIX(scope_, "backend_auth."),
+      POOL_GAUGE_PREFIX(scope_, "backend_auth."))};
 
   std::shared_ptr<MockFilterConfigParser> mock_filter_config_parser_;
   std::shared_ptr<MockFilterConfig> mock_filter_config_;
@@ -123,7 +127,8 @@ TEST_F(BackendAuthFilterTest, EmptyTokenRejected) {
                                                 {":path", "/books/1"}};
   setPerRouteJwtAudience("this-is-audience");
 
-  EXPECT_CALL(*mock_filter_config_parser_, getJwtToken("this-is-audience"))
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
       .WillOnce(Return(nullptr));
   EXPECT_CALL(mock_decoder_callbacks_,
               sendLocalReply(Envoy::Http::Code::InternalServerError,
@@ -148,9 +153,11 @@ TEST_F(BackendAuthFilterTest, SucceedAppendToken) {
                                                 {":path", "/books/1"}};
   setPerRouteJwtAudience("this-is-audience");
 
-  EXPECT_CALL(*mock_filter_config_parser_, getJwtToken("this-is-audience"))
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
       .Times(1)
-      .WillRepeatedly(Return(std::make_shared<std::string>("this-is-token")));
+      .WillRepeatedly(
+          Return(std::make_shared<std::string>("Bearer this-is-token")));
 
   Envoy::Http::FilterHeadersStatus status =
       filter_->decodeHeaders(headers, false);
@@ -177,9 +184,11 @@ TEST_F(BackendAuthFilterTest, SucceedTokenCopied) {
 
   setPerRouteJwtAudience("this-is-audience");
 
-  EXPECT_CALL(*mock_filter_config_parser_, getJwtToken("this-is-audience"))
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
       .Times(1)
-      .WillRepeatedly(Return(std::make_shared<std::string>("new-id-token")));
+      .WillRepeatedly(
+          Return(std::make_shared<std::string>("Bearer new-id-token")));
 
   Envoy::Http::FilterHeadersStatus status =
       filter_->decodeHeaders(headers, false);
@@ -211,9 +220,11 @@ TEST_F(BackendAuthFilterTest, SucceedTokenOverridden) {
 
   setPerRouteJwtAudience("this-is-audience");
 
-  EXPECT_CALL(*mock_filter_config_parser_, getJwtToken("this-is-audience"))
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
       .Times(1)
-      .WillRepeatedly(Return(std::make_shared<std::string>("new-id-token")));
+      .WillRepeatedly(
+          Return(std::make_shared<std::string>("Bearer new-id-token")));
 
   Envoy::Http::FilterHeadersStatus status =
       filter_->decodeHeaders(headers, false);
@@ -236,6 +247,147 @@ TEST_F(BackendAuthFilterTest, SucceedTokenOverridden) {
   EXPECT_EQ(counter->value(), 1);
 }
 
+TEST_F(BackendAuthFilterTest, WaitedTokenAdded) {
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                                {":path", "/books/1"}};
+  setPerRouteJwtAudience("this-is-audience");
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(
+      &mock_decoder_callbacks_.dispatcher_);
+
+  std::function<void()> ready;
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
+      .WillOnce(Return(nullptr))
+      .WillOnce(Return(std::make_shared<std::string>("Bearer this-is-token")));
+  EXPECT_CALL(*mock_filter_config_parser_,
+              waitForJwtToken(internAudience("this-is-audience"), _))
+      .WillOnce(Invoke([&ready](uint32_t, std::function<void()> cb) {
+        ready = std::move(cb);
+        return std::make_unique<token::TokenWait>();
+      }));
+  EXPECT_CALL(*mock_filter_config_parser_, tokenWaitTimeout)
+      .WillOnce(Return(std::chrono::milliseconds(3000)));
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(3000), _));
+
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::StopIteration);
+
+  EXPECT_CALL(mock_decoder_callbacks_, continueDecoding());
+  ready();
+  EXPECT_EQ(headers.get(Envoy::Http::CustomHeaders::get().Authorization)[0]
+                ->value()
+                .getStringView(),
+            "Bearer this-is-token");
+
+  // Stats.
+  EXPECT_EQ(
+      Envoy::TestUtility::findCounter(scope_, "backend_auth.token_waited")
+          ->value(),
+      1);
+  EXPECT_EQ(Envoy::TestUtility::findCounter(scope_, "backend_auth.token_added")
+                ->value(),
+            1);
+}
+
+TEST_F(BackendAuthFilterTest, WaitedTokenHoldsBody) {
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "POST"},
+                                                {":path", "/books"}};
+  setPerRouteJwtAudience("this-is-audience");
+  new NiceMock<Envoy::Event::MockTimer>(&mock_decoder_callbacks_.dispatcher_);
+
+  std::function<void()> ready;
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
+      .WillOnce(Return(nullptr))
+      .WillOnce(Return(std::make_shared<std::string>("Bearer this-is-token")));
+  EXPECT_CALL(*mock_filter_config_parser_,
+              waitForJwtToken(internAudience("this-is-audience"), _))
+      .WillOnce(Invoke([&ready](uint32_t, std::function<void()> cb) {
+        ready = std::move(cb);
+        return std::make_unique<token::TokenWait>();
+      }));
+
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::StopIteration);
+
+  // The body does not go upstream before the token is added.
+  Envoy::Buffer::OwnedImpl body("book");
+  EXPECT_EQ(filter_->decodeData(body, true),
+            Envoy::Http::FilterDataStatus::StopIterationAndWatermark);
+
+  EXPECT_CALL(mock_decoder_callbacks_, continueDecoding());
+  ready();
+  EXPECT_EQ(headers.get(Envoy::Http::CustomHeaders::get().Authorization)[0]
+                ->value()
+                .getStringView(),
+            "Bearer this-is-token");
+  EXPECT_EQ(filter_->decodeData(body, true),
+            Envoy::Http::FilterDataStatus::Continue);
+}
+
+TEST_F(BackendAuthFilterTest, WaitedTokenHoldsTrailers) {
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "POST"},
+                                                {":path", "/books"}};
+  setPerRouteJwtAudience("this-is-audience");
+  new NiceMock<Envoy::Event::MockTimer>(&mock_decoder_callbacks_.dispatcher_);
+
+  std::function<void()> ready;
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
+      .WillOnce(Return(nullptr))
+      .WillOnce(Return(std::make_shared<std::string>("Bearer this-is-token")));
+  EXPECT_CALL(*mock_filter_config_parser_,
+              waitForJwtToken(internAudience("this-is-audience"), _))
+      .WillOnce(Invoke([&ready](uint32_t, std::function<void()> cb) {
+        ready = std::move(cb);
+        return std::make_unique<token::TokenWait>();
+      }));
+
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::StopIteration);
+  Envoy::Buffer::OwnedImpl body("book");
+  EXPECT_EQ(filter_->decodeData(body, false),
+            Envoy::Http::FilterDataStatus::StopIterationAndWatermark);
+  Envoy::Http::TestRequestTrailerMapImpl trailers{{"grpc-status", "0"}};
+  EXPECT_EQ(filter_->decodeTrailers(trailers),
+            Envoy::Http::FilterTrailersStatus::StopIteration);
+
+  EXPECT_CALL(mock_decoder_callbacks_, continueDecoding());
+  ready();
+  EXPECT_EQ(filter_->decodeTrailers(trailers),
+            Envoy::Http::FilterTrailersStatus::Continue);
+}
+
+TEST_F(BackendAuthFilterTest, WaitedTokenTimeoutRejected) {
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                                {":path", "/books/1"}};
+  setPerRouteJwtAudience("this-is-audience");
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(
+      &mock_decoder_callbacks_.dispatcher_);
+
+  EXPECT_CALL(*mock_filter_config_parser_,
+              getAuthorizationHeader(internAudience("this-is-audience")))
+      .WillOnce(Return(nullptr));
+  EXPECT_CALL(*mock_filter_config_parser_,
+              waitForJwtToken(internAudience("this-is-audience"), _))
+      .WillOnce(Invoke([](uint32_t, std::function<void()>) {
+        return std::make_unique<token::TokenWait>();
+      }));
+
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::StopIteration);
+
+  EXPECT_CALL(mock_decoder_callbacks_,
+              sendLocalReply(Envoy::Http::Code::InternalServerError,
+                             "Token not found for audience: this-is-audience",
+                             _, _, "backend_auth_missing_backend_token"));
+  timer->invokeCallback();
+  EXPECT_EQ(
+      Envoy::TestUtility::findCounter(scope_, "backend_auth.denied_by_no_token")
+          ->value(),
+      1);
+}
+
 }  // namespace backend_auth
 }  // namespace http_filters
 }  // namespace envoy
@@ -22,8 +22,11 @@ namespace http_filters {
 namespace backend_auth {
 class MockFilterConfigParser : public FilterConfigParser {
  public:
-  MOCK_METHOD(const TokenSharedPtr, getJwtToken, (absl::string_view audience),
-              (const));
+  MOCK_METHOD(const TokenSharedPtr, getAuthorizationHeader,
+              (uint32_t audience_id), (const));
+  MOCK_METHOD(token::TokenWaitPtr, waitForJwtToken,
+              (uint32_t audience_id, std::function<void()> ready), (const));
+  MOCK_METHOD(std::chrono::milliseconds, tokenWaitTimeout, (), (const));
 };
 
 class MockFilterConfig : public FilterConfig {
@@ -31,6 +34,13 @@ class MockFilterConfig : public FilterConfig {
   MOCK_METHOD(const FilterConfigParser&, cfg_parser, (), (const));
 
   MOCK_METHOD(FilterStats&, stats, (), ());
+
+  // The stats are incremented themselves.
+  utils::LocalCounters& local_counters() override { return local_counters_; }
+  utils::LocalCounters local_counters_;
+
+  MOCK_METHOD(const utils::CallbackTimeSampler*, callback_time_sampler, (),
+              (const));
 };
 }  // namespace backend_auth
 }  // namespace http_filters
@@ -25,15 +25,33 @@ namespace http_filters {
 namespace grpc_metadata_scrubber {
 
 Envoy::Http::FilterHeadersStatus Filter::encodeHeaders(
-    Envoy::Http::ResponseHeaderMap& headers, bool) {
+    Envoy::Http::ResponseHeaderMap& headers, bool end_stream) {
+  const auto timed = callback_timer_.encode();
   ENVOY_LOG(debug, "Filter::encodeHeaders is called.");
-  config_->stats().all_.inc();
+  config_->local_counters().inc(config_->stats().all_);
+
+  // A headers only response, like a gRPC trailers-only one, has no trailers
+  // to retain.
+  if (end_stream) {
+    return Envoy::Http::FilterHeadersStatus::Continue;
+  }
+
+  // The routes that never return gRPC responses are known at config time.
+  const Envoy::Router::RouteConstSharedPtr route = encoder_callbacks_->route();
+  if (route != nullptr && route->routeEntry() != nullptr) {
+    const auto* per_route =
+        route->routeEntry()->perFilterConfigTyped<PerRouteFilterConfig>(
+            kFilterName);
+    if (per_route != nullptr && per_route->http_only()) {
+      return Envoy::Http::FilterHeadersStatus::Continue;
+    }
+  }
 
   if (Envoy::Grpc::Common::hasGrpcContentType(headers) &&
       headers.ContentLength() != nullptr) {
     ENVOY_LOG(debug, "Content-length header is removed");
     headers.removeContentLength();
-    config_->stats().removed_.inc();
+    config_->local_counters().inc(config_->stats().removed_);
   }
 
   return Envoy::Http::FilterHeadersStatus::Continue;
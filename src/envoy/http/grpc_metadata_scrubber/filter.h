@@ -27,13 +27,15 @@ namespace grpc_metadata_scrubber {
 class Filter : public Envoy::Http::PassThroughEncoderFilter,
                public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
  public:
-  Filter(FilterConfigSharedPtr config) : config_(config) {}
+  Filter(FilterConfigSharedPtr config)
+      : config_(config), callback_timer_(config_->callback_time_sampler()) {}
 
   Envoy::Http::FilterHeadersStatus encodeHeaders(
-      Envoy::Http::ResponseHeaderMap& headers, bool) override;
+      Envoy::Http::ResponseHeaderMap& headers, bool end_stream) override;
 
  private:
   const FilterConfigSharedPtr config_;
+  utils::CallbackTimer callback_timer_;
 };
 
 }  // namespace grpc_metadata_scrubber
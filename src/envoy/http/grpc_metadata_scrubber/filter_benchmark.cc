@@ -0,0 +1,79 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures Filter::encodeHeaders of a response, from the creation of its
+// filter: a gRPC response whose Content-Length is removed, and the same
+// response on a route known to be http only. The Envoy callbacks and route
+// are test mocks, their calls are in the times.
+//
+// The allocations per response are reported as allocs_per_op, only in the
+// builds that count them (see AllocationCounter).
+
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "src/envoy/http/grpc_metadata_scrubber/filter.h"
+#include "src/envoy/utils/allocation_counter.h"
+#include "test/mocks/http/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace grpc_metadata_scrubber {
+namespace {
+
+using ::espv2::envoy::utils::AllocationCounter;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+// Arg: whether the route is http only.
+void BM_EncodeHeaders(benchmark::State& state) {
+  ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::PerRouteFilterConfig
+      per_route_proto;
+  per_route_proto.set_http_only(state.range(0));
+  const PerRouteFilterConfig per_route(per_route_proto);
+
+  NiceMock<Envoy::Server::Configuration::MockFactoryContext> context;
+  const auto config = std::make_shared<FilterConfig>(
+      ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::FilterConfig(),
+      "", context);
+  NiceMock<Envoy::Http::MockStreamEncoderFilterCallbacks> callbacks;
+  ON_CALL(callbacks.route_->route_entry_, perFilterConfig(kFilterName))
+      .WillByDefault(Return(&per_route));
+
+  Envoy::Http::TestResponseHeaderMapImpl headers{
+      {":status", "200"}, {"content-type", "application/grpc"}};
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    headers.setContentLength(100);
+    Filter filter(config);
+    filter.setEncoderFilterCallbacks(callbacks);
+    benchmark::DoNotOptimize(filter.encodeHeaders(headers, false));
+  }
+  if (AllocationCounter::enabled()) {
+    state.counters["allocs_per_op"] = benchmark::Counter(
+        allocations.allocations(), benchmark::Counter::kAvgIterations);
+  }
+}
+BENCHMARK(BM_EncodeHeaders)->Arg(false)->Arg(true);
+
+}  // namespace
+}  // namespace grpc_metadata_scrubber
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
+
+BENCHMARK_MAIN();
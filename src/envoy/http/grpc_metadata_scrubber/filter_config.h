@@ -14,13 +14,21 @@
 
 #pragma once
 
+#include "api/envoy/v10/http/grpc_metadata_scrubber/config.pb.h"
+#include "envoy/router/router.h"
 #include "envoy/server/filter_config.h"
+#include "src/envoy/utils/callback_time.h"
+#include "src/envoy/utils/local_counters.h"
 
 namespace espv2 {
 namespace envoy {
 namespace http_filters {
 namespace grpc_metadata_scrubber {
 
+// The filter name.
+constexpr const char kFilterName[] =
+    "com.google.espv2.filters.http.grpc_metadata_scrubber";
+
 /**
  * All stats for the grpc metadata scrubber filter. @see stats_macros.h
  */
@@ -41,12 +49,27 @@ struct FilterStats {
 // The Envoy filter config for ESPv2 grpc metadata scrubber filter.
 class FilterConfig {
  public:
-  FilterConfig(const std::string& stats_prefix,
-               Envoy::Server::Configuration::FactoryContext& context)
-      : stats_(generateStats(stats_prefix, context.scope())) {}
+  FilterConfig(
+      const ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::
+          FilterConfig& proto_config,
+      const std::string& stats_prefix,
+      Envoy::Server::Configuration::FactoryContext& context)
+      : stats_(generateStats(stats_prefix, context.scope())),
+        local_counters_(proto_config.local_counters(),
+                        {&stats_.all_, &stats_.removed_},
+                        context.threadLocal()),
+        callback_time_sampler_(utils::CallbackTimeSampler::create(
+            proto_config.callback_time(),
+            stats_prefix + "grpc_metadata_scrubber.", context)) {}
 
   FilterStats& stats() { return stats_; }
 
+  utils::LocalCounters& local_counters() { return local_counters_; }
+
+  const utils::CallbackTimeSampler* callback_time_sampler() const {
+    return callback_time_sampler_.get();
+  }
+
  private:
   FilterStats generateStats(const std::string& prefix,
                             Envoy::Stats::Scope& scope) {
@@ -56,10 +79,25 @@ class FilterConfig {
   }
 
   FilterStats stats_;
+  utils::LocalCounters local_counters_;
+  const utils::CallbackTimeSamplerPtr callback_time_sampler_;
 };
 
 using FilterConfigSharedPtr = std::shared_ptr<FilterConfig>;
 
+class PerRouteFilterConfig : public Envoy::Router::RouteSpecificFilterConfig {
+ public:
+  PerRouteFilterConfig(
+      const ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::
+          PerRouteFilterConfig& per_route)
+      : http_only_(per_route.http_only()) {}
+
+  bool http_only() const { return http_only_; }
+
+ private:
+  const bool http_only_;
+};
+
 }  // namespace grpc_metadata_scrubber
 }  // namespace http_filters
 }  // namespace envoy
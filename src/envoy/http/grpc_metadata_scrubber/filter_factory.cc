@@ -23,25 +23,25 @@ namespace envoy {
 namespace http_filters {
 namespace grpc_metadata_scrubber {
 
-constexpr char kGrpcScrubberFilterName[] =
-    "com.google.espv2.filters.http.grpc_metadata_scrubber";
-
 /**
  * Config registration for ESPv2 grpc scrubber filter.
  */
 class FilterFactory
     : public Envoy::Extensions::HttpFilters::Common::FactoryBase<
-          ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::FilterConfig> {
+          ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::FilterConfig,
+          ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::
+              PerRouteFilterConfig> {
  public:
-  FilterFactory() : FactoryBase(kGrpcScrubberFilterName) {}
+  FilterFactory() : FactoryBase(kFilterName) {}
 
  private:
   Envoy::Http::FilterFactoryCb createFilterFactoryFromProtoTyped(
       const ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::
-          FilterConfig&,
+          FilterConfig& proto_config,
       const std::string& stats_prefix,
       Envoy::Server::Configuration::FactoryContext& context) override {
-    auto filter_config = std::make_shared<FilterConfig>(stats_prefix, context);
+    auto filter_config =
+        std::make_shared<FilterConfig>(proto_config, stats_prefix, context);
     return [filter_config](
                Envoy::Http::FilterChainFactoryCallbacks& callbacks) -> void {
       auto filter = std::make_shared<Filter>(filter_config);
@@ -49,6 +49,15 @@ class FilterFactory
           Envoy::Http::StreamEncoderFilterSharedPtr(filter));
     };
   }
+
+  Envoy::Router::RouteSpecificFilterConfigConstSharedPtr
+  createRouteSpecificFilterConfigTyped(
+      const ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::
+          PerRouteFilterConfig& per_route,
+      Envoy::Server::Configuration::ServerFactoryContext&,
+      Envoy::ProtobufMessage::ValidationVisitor&) override {
+    return std::make_shared<PerRouteFilterConfig>(per_route);
+  }
 };
 /**
  * Static registration for the filter. @see RegisterFactory.
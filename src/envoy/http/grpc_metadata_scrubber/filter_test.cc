@@ -18,6 +18,7 @@
 #include "gtest/gtest.h"
 #include "source/common/common/empty_string.h"
 #include "test/mocks/http/mocks.h"
+#include "test/mocks/router/mocks.h"
 #include "test/mocks/server/mocks.h"
 #include "test/test_common/utility.h"
 
@@ -29,20 +30,30 @@ namespace {
 
 using Envoy::Http::MockStreamEncoderFilterCallbacks;
 using Envoy::Server::Configuration::MockFactoryContext;
+using ::testing::Return;
 
 class GrpcMetadataScrubberFilterTest : public ::testing::Test {
  protected:
   void SetUp() override {
-    config_ = std::make_shared<FilterConfig>(Envoy::EMPTY_STRING,
-                                             mock_factory_context_);
+    config_ = std::make_shared<FilterConfig>(
+        ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::FilterConfig(),
+        Envoy::EMPTY_STRING, mock_factory_context_);
     filter_ = std::make_unique<Filter>(config_);
     filter_->setEncoderFilterCallbacks(mock_cb_);
   }
 
+  void setPerRoute(const PerRouteFilterConfig& per_route) {
+    EXPECT_CALL(mock_cb_, route()).WillRepeatedly(Return(mock_route_));
+    EXPECT_CALL(mock_route_->route_entry_, perFilterConfig(kFilterName))
+        .WillRepeatedly(Return(&per_route));
+  }
+
   std::unique_ptr<Filter> filter_;
   FilterConfigSharedPtr config_;
   testing::NiceMock<MockFactoryContext> mock_factory_context_;
   testing::NiceMock<MockStreamEncoderFilterCallbacks> mock_cb_;
+  std::shared_ptr<testing::NiceMock<Envoy::Router::MockRoute>> mock_route_ =
+      std::make_shared<testing::NiceMock<Envoy::Router::MockRoute>>();
 };
 
 TEST_F(GrpcMetadataScrubberFilterTest, ContentLengthRemoved) {
@@ -97,6 +108,54 @@ TEST_F(GrpcMetadataScrubberFilterTest, NotContentLength) {
             0L);
 }
 
+TEST_F(GrpcMetadataScrubberFilterTest, HeadersOnlyResponseUntouched) {
+  Envoy::Http::TestResponseHeaderMapImpl headers{
+      {"content-type", "application/grpc"},
+      {"content-length", "0"},
+      {"grpc-status", "5"}};
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->encodeHeaders(headers, true));
+
+  EXPECT_EQ(Envoy::TestUtility::findCounter(mock_factory_context_.scope_,
+                                            "grpc_metadata_scrubber.removed")
+                ->value(),
+            0L);
+  EXPECT_TRUE(headers.ContentLength() != nullptr);
+}
+
+TEST_F(GrpcMetadataScrubberFilterTest, HttpOnlyRouteSkipped) {
+  ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::PerRouteFilterConfig
+      per_route_cfg;
+  per_route_cfg.set_http_only(true);
+  const PerRouteFilterConfig per_route(per_route_cfg);
+  setPerRoute(per_route);
+
+  Envoy::Http::TestResponseHeaderMapImpl headers{
+      {"content-type", "application/grpc"}, {"content-length", "100"}};
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->encodeHeaders(headers, false));
+
+  EXPECT_EQ(Envoy::TestUtility::findCounter(mock_factory_context_.scope_,
+                                            "grpc_metadata_scrubber.removed")
+                ->value(),
+            0L);
+  EXPECT_TRUE(headers.ContentLength() != nullptr);
+}
+
+TEST_F(GrpcMetadataScrubberFilterTest, GrpcRouteChecked) {
+  const PerRouteFilterConfig per_route(
+      ::espv2::api::envoy::v10::http::grpc_metadata_scrubber::
+          PerRouteFilterConfig{});
+  setPerRoute(per_route);
+
+  Envoy::Http::TestResponseHeaderMapImpl headers{
+      {"content-type", "application/grpc"}, {"content-length", "100"}};
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->encodeHeaders(headers, false));
+
+  EXPECT_TRUE(headers.ContentLength() == nullptr);
+}
+
 }  // namespace
 
 }  // namespace grpc_metadata_scrubber
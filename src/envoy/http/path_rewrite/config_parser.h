@@ -13,24 +13,34 @@
 // limitations under the License.
 #pragma once
 
+#include "absl/strings/string_view.h"
 #include "envoy/common/pure.h"
+#include "src/envoy/utils/request_path.h"
 
 namespace espv2 {
 namespace envoy {
 namespace http_filters {
 namespace path_rewrite {
 
+// The request path, scanned once per request by the filter.
+using RequestPath = utils::RequestPath;
+
 class ConfigParser {
  public:
   virtual ~ConfigParser() = default;
 
   // If return false, fails to generate new path due to:
   // origin_path doesn't match with the url_template in the const_path.
-  virtual bool rewrite(absl::string_view origin_path,
+  virtual bool rewrite(const RequestPath& origin_path,
                        std::string& new_path) const PURE;
 
   // Get the url template
   virtual absl::string_view url_template() const PURE;
+
+  // The prefix prepended to the request path, or empty if the route does not
+  // translate the path by a prefix. The caller may then prepend it itself
+  // instead of calling rewrite().
+  virtual absl::string_view path_prefix() const PURE;
 };
 
 using ConfigParserPtr = std::unique_ptr<ConfigParser>;
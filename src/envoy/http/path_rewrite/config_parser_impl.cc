@@ -22,30 +22,22 @@ namespace espv2 {
 namespace envoy {
 namespace http_filters {
 namespace path_rewrite {
-namespace {
-
-// Use fixed HTTP method for path_matcher
-constexpr const char kHttpMethod[] = "GET";
-
-}  // namespace
 
 ConfigParserImpl::ConfigParserImpl(
     const ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig&
-        config)
-    : config_(config) {
+        config,
+    UrlTemplateMatcherCacheSharedPtr matcher_cache)
+    : config_(config), matcher_cache_(std::move(matcher_cache)) {
   if (config_.has_constant_path()) {
     const auto& path_cfg = config_.constant_path();
     if (!path_cfg.url_template().empty()) {
-      ENVOY_LOG(debug, "Building path_matcher for url_template: {}",
+      ENVOY_LOG(debug, "Getting path_matcher for url_template: {}",
                 path_cfg.url_template());
-
-      ::espv2::api_proxy::path_matcher::PathMatcherBuilder<
-          const ::espv2::api::envoy::v10::http::path_rewrite::
-              PerRouteFilterConfig*>
-          pmb;
-      pmb.Register(kHttpMethod, path_cfg.url_template(), Envoy::EMPTY_STRING,
-                   &config_);
-      path_matcher_ = pmb.Build();
+      path_matcher_ = matcher_cache_->get(path_cfg.url_template());
+      if (path_matcher_ == nullptr) {
+        // Matches no request path.
+        ENVOY_LOG(error, "Invalid url_template: {}", path_cfg.url_template());
+      }
     }
 
     // If the last char of the path is "/", remove it, unless it is just root
@@ -66,13 +58,13 @@ ConfigParserImpl::ConfigParserImpl(
   }
 }
 
-bool ConfigParserImpl::rewrite(absl::string_view origin_path,
+bool ConfigParserImpl::rewrite(const RequestPath& origin_path,
                                std::string& new_path) const {
   if (config_.has_constant_path()) {
-    return constPath(std::string(origin_path), new_path);
+    return constPath(origin_path, new_path);
   }
 
-  new_path = absl::StrCat(config_.path_prefix(), origin_path);
+  new_path = absl::StrCat(config_.path_prefix(), origin_path.path);
   ENVOY_LOG(debug, "Use path prefix: new path: {}", new_path);
   return true;
 }
@@ -84,59 +76,65 @@ absl::string_view ConfigParserImpl::url_template() const {
   return Envoy::EMPTY_STRING;
 }
 
-bool ConfigParserImpl::getVariableBindings(const std::string& origin_path,
-                                           std::string& query) const {
-  query = Envoy::EMPTY_STRING;
-  if (!path_matcher_) {
+absl::string_view ConfigParserImpl::path_prefix() const {
+  if (config_.has_constant_path()) {
+    return Envoy::EMPTY_STRING;
+  }
+  return config_.path_prefix();
+}
+
+bool ConfigParserImpl::appendVariableBindings(const RequestPath& origin_path,
+                                              char separator,
+                                              std::string& new_path) const {
+  if (config_.constant_path().url_template().empty()) {
     return true;
   }
 
-  std::vector<espv2::api_proxy::path_matcher::VariableBinding>
-      variable_bindings;
-  if (path_matcher_->Lookup(kHttpMethod, origin_path, &variable_bindings) ==
-      nullptr) {
+  const size_t query_pos = new_path.size() + 1;
+  // The values view the origin path, so they are appended without copies.
+  auto append_binding = [&separator, &new_path](
+                            const std::vector<std::string>& field_path,
+                            absl::string_view value) {
+    new_path.push_back(separator);
+    separator = '&';
+    espv2::api_proxy::path_matcher::AppendVariableBindingToQueryParameters(
+        field_path, value, &new_path);
+  };
+  // The query string is already split off, the plan need not scan it again.
+  const bool matched =
+      path_matcher_ != nullptr &&
+      path_matcher_->Match(origin_path.pathWithoutQuery(), append_binding);
+  if (!matched) {
     // mismatched case
     ENVOY_LOG(warn, "Request path: {} doesn't match url_template: {}",
-              origin_path, config_.constant_path().url_template());
+              origin_path.path, config_.constant_path().url_template());
     return false;
   }
 
-  if (!variable_bindings.empty()) {
-    query = espv2::api_proxy::path_matcher::VariableBindingsToQueryParameters(
-        variable_bindings);
-    ENVOY_LOG(debug, "Extracted query parameters: {}", query);
+  if (new_path.size() > query_pos) {
+    ENVOY_LOG(debug, "Extracted query parameters: {}",
+              absl::string_view(new_path).substr(query_pos));
   }
   return true;
 }
 
-bool ConfigParserImpl::constPath(const std::string& origin_path,
+bool ConfigParserImpl::constPath(const RequestPath& origin_path,
                                  std::string& new_path) const {
-  std::string extracted_query_params;
-  if (!getVariableBindings(origin_path, extracted_query_params)) {
-    return false;
-  }
-
   const auto& path_cfg = config_.constant_path();
-  new_path = path_cfg.path();
-
-  std::size_t originalQueryParamPos = origin_path.find('?');
-  if (originalQueryParamPos == std::string::npos) {
-    // No query param in original request.
-    if (!extracted_query_params.empty()) {
-      // Add extracted variable bindings.
-      absl::StrAppend(&new_path, "?", extracted_query_params);
-    }
-    ENVOY_LOG(debug, "Use constant path, new path: {}", new_path);
-    return true;
-  }
-
-  // Has query parameters in original request.
-  const std::string originalQueryParam =
-      origin_path.substr(originalQueryParamPos);
-  absl::StrAppend(&new_path, originalQueryParam);
-  if (!extracted_query_params.empty()) {
-    // Append extracted variable bindings.
-    absl::StrAppend(&new_path, "&", extracted_query_params);
+  // Also fits the extracted variable bindings, roughly: their values come
+  // from the path and their names from the url_template.
+  new_path.clear();
+  new_path.reserve(path_cfg.path().size() + origin_path.path.size() +
+                   path_cfg.url_template().size() + 1);
+  new_path.append(path_cfg.path());
+
+  // Has query parameters in original request, append the extracted variable
+  // bindings after them.
+  const absl::string_view originalQueryParam = origin_path.query();
+  new_path.append(originalQueryParam.data(), originalQueryParam.size());
+  const char separator = originalQueryParam.empty() ? '?' : '&';
+  if (!appendVariableBindings(origin_path, separator, new_path)) {
+    return false;
   }
   ENVOY_LOG(debug, "Use constant path, new path: {}", new_path);
   return true;
@@ -16,8 +16,8 @@
 #include "api/envoy/v10/http/path_rewrite/config.pb.h"
 #include "api/envoy/v10/http/path_rewrite/config.pb.validate.h"
 #include "source/common/common/logger.h"
-#include "src/api_proxy/path_matcher/path_matcher.h"
 #include "src/envoy/http/path_rewrite/config_parser.h"
+#include "src/envoy/http/path_rewrite/url_template_matcher_cache.h"
 
 namespace espv2 {
 namespace envoy {
@@ -30,26 +30,33 @@ class ConfigParserImpl
  public:
   ConfigParserImpl(
       const ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig&
-          config);
+          config,
+      UrlTemplateMatcherCacheSharedPtr matcher_cache);
 
-  bool rewrite(absl::string_view origin_path,
+  bool rewrite(const RequestPath& origin_path,
                std::string& new_path) const override;
 
   absl::string_view url_template() const override;
 
+  absl::string_view path_prefix() const override;
+
  private:
   // rewrite const path.
-  bool constPath(const std::string& origin_path, std::string& new_path) const;
-  // extract query parameters from variable bindings
-  bool getVariableBindings(const std::string& origin_path,
-                           std::string& query) const;
+  bool constPath(const RequestPath& origin_path, std::string& new_path) const;
+  // Appends the query parameters of the variable bindings after `separator`,
+  // if there are any. Returns false if the url_template does not match.
+  bool appendVariableBindings(const RequestPath& origin_path, char separator,
+                              std::string& new_path) const;
 
   // the per-route config
   ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig config_;
-  // path matcher for extracting variable binding.
-  ::espv2::api_proxy::path_matcher::PathMatcherPtr<
-      const ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig*>
-      path_matcher_;
+
+  // Held so the routes built later still find the shared matchers.
+  UrlTemplateMatcherCacheSharedPtr matcher_cache_;
+  // The plan matching the url_template and extracting its variable bindings,
+  // shared by the routes with the same url_template. nullptr if the
+  // url_template is empty or invalid.
+  UrlTemplateMatcherSharedPtr path_matcher_;
 };
 
 }  // namespace path_rewrite
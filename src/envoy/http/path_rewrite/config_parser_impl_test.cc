@@ -29,7 +29,7 @@ class ConfigParserImplTest : public ::testing::Test {
   void setUp(const std::string& config_str) {
     ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(config_str,
                                                               &proto_config_));
-    obj_ = std::make_unique<ConfigParserImpl>(proto_config_);
+    obj_ = std::make_unique<ConfigParserImpl>(proto_config_, matcher_cache_);
   }
 
   void validateConfig(const std::string& config_str) {
@@ -38,12 +38,35 @@ class ConfigParserImplTest : public ::testing::Test {
     Envoy::TestUtility::validate(proto_config_);
   }
 
+  bool rewrite(absl::string_view path, std::string& new_path) {
+    return obj_->rewrite(RequestPath::scan(path), new_path);
+  }
+
+  UrlTemplateMatcherCacheSharedPtr matcher_cache_ =
+      std::make_shared<UrlTemplateMatcherCache>();
   ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig
       proto_config_;
   std::unique_ptr<ConfigParserImpl> obj_;
   std::string new_path_;
 };
 
+TEST(RequestPathTest, Scan) {
+  RequestPath request_path = RequestPath::scan("/bar");
+  EXPECT_EQ(request_path.pathWithoutQuery(), "/bar");
+  EXPECT_EQ(request_path.query(), "");
+  EXPECT_FALSE(request_path.has_fragment);
+
+  request_path = RequestPath::scan("/bar?xyz=123#frag");
+  EXPECT_EQ(request_path.pathWithoutQuery(), "/bar");
+  EXPECT_EQ(request_path.query(), "?xyz=123#frag");
+  EXPECT_TRUE(request_path.has_fragment);
+
+  request_path = RequestPath::scan("/bar#frag?xyz=123");
+  EXPECT_EQ(request_path.pathWithoutQuery(), "/bar#frag?xyz=123");
+  EXPECT_EQ(request_path.query(), "");
+  EXPECT_TRUE(request_path.has_fragment);
+}
+
 TEST_F(ConfigParserImplTest, ValidatePathPrefixEmptyConfig) {
   EXPECT_THROW_WITH_REGEX(validateConfig(R"(
   )"),
@@ -110,10 +133,10 @@ TEST_F(ConfigParserImplTest, PathPrefixBasic) {
   path_prefix: "/foo"
 )");
 
-  EXPECT_TRUE(obj_->rewrite("/bar", new_path_));
+  EXPECT_TRUE(rewrite("/bar", new_path_));
   EXPECT_EQ(new_path_, "/foo/bar");
 
-  EXPECT_TRUE(obj_->rewrite("/bar?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/foo/bar?xyz=123");
 }
 
@@ -121,11 +144,12 @@ TEST_F(ConfigParserImplTest, PathPrefixRemoveLastSlash) {
   setUp(R"(
   path_prefix: "/foo/"
 )");
+  EXPECT_EQ(obj_->path_prefix(), "/foo");
 
-  EXPECT_TRUE(obj_->rewrite("/bar", new_path_));
+  EXPECT_TRUE(rewrite("/bar", new_path_));
   EXPECT_EQ(new_path_, "/foo/bar");
 
-  EXPECT_TRUE(obj_->rewrite("/bar?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/foo/bar?xyz=123");
 }
 
@@ -135,10 +159,10 @@ TEST_F(ConfigParserImplTest, PathPrefixBasicRoot) {
   path_prefix: "/"
 )");
 
-  EXPECT_TRUE(obj_->rewrite("/bar", new_path_));
+  EXPECT_TRUE(rewrite("/bar", new_path_));
   EXPECT_EQ(new_path_, "/bar");
 
-  EXPECT_TRUE(obj_->rewrite("/bar?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/bar?xyz=123");
 }
 
@@ -148,13 +172,14 @@ TEST_F(ConfigParserImplTest, ConstantPathNoUrlTemplate) {
      path: "/foo"
   }
 )");
+  EXPECT_EQ(obj_->path_prefix(), "");
 
   // /bar => /foo
-  EXPECT_TRUE(obj_->rewrite("/bar", new_path_));
+  EXPECT_TRUE(rewrite("/bar", new_path_));
   EXPECT_EQ(new_path_, "/foo");
 
   // /bar?xyz=123 => /foo?xyz=123
-  EXPECT_TRUE(obj_->rewrite("/bar?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/foo?xyz=123");
 }
 
@@ -167,17 +192,43 @@ TEST_F(ConfigParserImplTest, ConstantPathUrlTemplate) {
 )");
 
   // A  mistmatched case
-  EXPECT_FALSE(obj_->rewrite("/foo/bar", new_path_));
+  EXPECT_FALSE(rewrite("/foo/bar", new_path_));
 
   // /bar/567 => /foo?abc=567
-  EXPECT_TRUE(obj_->rewrite("/bar/567", new_path_));
+  EXPECT_TRUE(rewrite("/bar/567", new_path_));
   EXPECT_EQ(new_path_, "/foo?abc=567");
 
   // /bar/567?xyz=123 => /foo?xyz=123&abc=567
-  EXPECT_TRUE(obj_->rewrite("/bar/567?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar/567?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/foo?xyz=123&abc=567");
 }
 
+TEST_F(ConfigParserImplTest, ConstantPathUrlTemplateWildcardAndVerb) {
+  setUp(R"(
+  constant_path: {
+     path: "/foo"
+     url_template: "/bar/{abc=**}/baz:get"
+  }
+)");
+
+  EXPECT_FALSE(rewrite("/bar/567", new_path_));
+
+  // /bar/5/6/baz:get?xyz=123 => /foo?xyz=123&abc=5/6
+  EXPECT_TRUE(rewrite("/bar/5/6/baz:get?xyz=123", new_path_));
+  EXPECT_EQ(new_path_, "/foo?xyz=123&abc=5/6");
+}
+
+TEST_F(ConfigParserImplTest, ConstantPathInvalidUrlTemplate) {
+  setUp(R"(
+  constant_path: {
+     path: "/foo"
+     url_template: "/bar/{abc"
+  }
+)");
+
+  EXPECT_FALSE(rewrite("/bar/567", new_path_));
+}
+
 TEST_F(ConfigParserImplTest, ConstantPathNoUrlTemplateRemovedLastSlash) {
   setUp(R"(
   constant_path: {
@@ -186,11 +237,11 @@ TEST_F(ConfigParserImplTest, ConstantPathNoUrlTemplateRemovedLastSlash) {
 )");
 
   // /bar => /foo
-  EXPECT_TRUE(obj_->rewrite("/bar", new_path_));
+  EXPECT_TRUE(rewrite("/bar", new_path_));
   EXPECT_EQ(new_path_, "/foo");
 
   // /bar?xyz=123 => /foo?xyz=123
-  EXPECT_TRUE(obj_->rewrite("/bar?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/foo?xyz=123");
 }
 
@@ -202,11 +253,11 @@ TEST_F(ConfigParserImplTest, ConstantPathNoUrlTemplateRoot) {
 )");
 
   // /bar => /
-  EXPECT_TRUE(obj_->rewrite("/bar", new_path_));
+  EXPECT_TRUE(rewrite("/bar", new_path_));
   EXPECT_EQ(new_path_, "/");
 
   // /bar?xyz=123 => /foo?xyz=123
-  EXPECT_TRUE(obj_->rewrite("/bar?xyz=123", new_path_));
+  EXPECT_TRUE(rewrite("/bar?xyz=123", new_path_));
   EXPECT_EQ(new_path_, "/?xyz=123");
 }
 
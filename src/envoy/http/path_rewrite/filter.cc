@@ -14,11 +14,14 @@
 
 #include "src/envoy/http/path_rewrite/filter.h"
 
+#include <cstring>
 #include <string>
 
+#include "absl/container/fixed_array.h"
 #include "envoy/http/header_map.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/utility.h"
+#include "src/envoy/utils/filter_state_utils.h"
 #include "src/envoy/utils/http_header_utils.h"
 #include "src/envoy/utils/rc_detail_utils.h"
 
@@ -39,41 +42,43 @@ namespace {
 // This is need for path_matcher lookup.
 constexpr uint32_t PathMaxSize = 8192;
 
+// Prefixed paths up to this size are built on the stack.
+constexpr size_t kInlinePrefixedPathSize = 1024;
+
 }  // namespace
 
 FilterHeadersStatus Filter::decodeHeaders(RequestHeaderMap& headers, bool) {
+  const auto timed = callback_timer_.decode();
   if (headers.Path() == nullptr) {
     // NOTE: this shouldn't happen in practice because ServiceControl filter
     // would have already rejected the request.
     config_->stats().denied_by_no_path_.inc();
     rejectRequest(Envoy::Http::Code::BadRequest, "No path in request headers",
-                  utils::generateRcDetails(utils::kRcDetailFilterPathRewrite,
-                                           utils::kRcDetailErrorTypeBadRequest,
-                                           utils::kRcDetailErrorMissingPath));
+                  utils::kRcDetailsPathRewriteMissingPath);
     return FilterHeadersStatus::StopIteration;
   } else if (headers.Path()->value().size() > PathMaxSize) {
     config_->stats().denied_by_oversize_path_.inc();
     rejectRequest(Envoy::Http::Code::BadRequest,
                   absl::StrCat("Path is too long, max allowed size is ",
                                PathMaxSize, "."),
-                  utils::generateRcDetails(utils::kRcDetailFilterPathRewrite,
-                                           utils::kRcDetailErrorTypeBadRequest,
-                                           utils::kRcDetailErrorOversizePath));
+                  utils::kRcDetailsPathRewriteOversizePath);
     return Envoy::Http::FilterHeadersStatus::StopIteration;
   }
 
-  absl::string_view original_path = headers.Path()->value().getStringView();
+  // The single scan of the path, shared with the rewrite and with the
+  // service control filter, that runs first.
+  const RequestPath& original_path =
+      utils::EspRequestContext::getOrCreate(
+          *decoder_callbacks_->streamInfo().filterState(), headers)
+          .path();
   // Reject requests with fragment identifiers. They should never be sent to
   // servers, and it breaks how we handle path translation (query params
   // appended incorrectly).
-  if (absl::StrContains(original_path, "#")) {
+  if (original_path.has_fragment) {
     config_->stats().denied_by_invalid_path_.inc();
-    rejectRequest(
-        Envoy::Http::Code::BadRequest,
-        "Path cannot contain fragment identifier (#)",
-        utils::generateRcDetails(utils::kRcDetailFilterPathRewrite,
-                                 utils::kRcDetailErrorTypeBadRequest,
-                                 utils::kRcDetailErrorFragmentIdentifier));
+    rejectRequest(Envoy::Http::Code::BadRequest,
+                  "Path cannot contain fragment identifier (#)",
+                  utils::kRcDetailsPathRewriteFragmentIdentifier);
     return FilterHeadersStatus::StopIteration;
   }
 
@@ -92,7 +97,18 @@ FilterHeadersStatus Filter::decodeHeaders(RequestHeaderMap& headers, bool) {
   if (per_route == nullptr) {
     ENVOY_LOG(debug,
               "no per-route config, request is passed through unmodified");
-    config_->stats().path_not_changed_.inc();
+    config_->local_counters().inc(config_->stats().path_not_changed_);
+    return FilterHeadersStatus::Continue;
+  }
+
+  const absl::string_view path_prefix =
+      per_route->config_parser().path_prefix();
+  if (!path_prefix.empty()) {
+    prependPathPrefix(headers, path_prefix);
+    utils::EspRequestContext::invalidate(
+        *decoder_callbacks_->streamInfo().filterState());
+    ENVOY_LOG(debug, "Use path prefix: new path: {}", headers.getPathValue());
+    config_->local_counters().inc(config_->stats().path_changed_);
     return FilterHeadersStatus::Continue;
   }
 
@@ -117,14 +133,34 @@ FilterHeadersStatus Filter::decodeHeaders(RequestHeaderMap& headers, bool) {
     return FilterHeadersStatus::StopIteration;
   }
 
-  config_->stats().path_changed_.inc();
-  if (!headers.EnvoyOriginalPath()) {
+  config_->local_counters().inc(config_->stats().path_changed_);
+  if (!config_->skip_original_path_header() && !headers.EnvoyOriginalPath()) {
     headers.setEnvoyOriginalPath(headers.getPathValue());
   }
   headers.setPath(new_path);
+  utils::EspRequestContext::invalidate(
+      *decoder_callbacks_->streamInfo().filterState());
   return FilterHeadersStatus::Continue;
 }
 
+void Filter::prependPathPrefix(RequestHeaderMap& headers,
+                               absl::string_view path_prefix) {
+  if (!config_->skip_original_path_header() && !headers.EnvoyOriginalPath()) {
+    headers.setEnvoyOriginalPath(headers.getPathValue());
+    // The path is rebuilt in its own header value from the copy.
+    headers.setPath(path_prefix);
+    headers.appendPath(headers.getEnvoyOriginalPathValue(), "");
+    return;
+  }
+
+  const absl::string_view path = headers.getPathValue();
+  absl::FixedArray<char, kInlinePrefixedPathSize> new_path(path_prefix.size() +
+                                                           path.size());
+  std::memcpy(new_path.data(), path_prefix.data(), path_prefix.size());
+  std::memcpy(new_path.data() + path_prefix.size(), path.data(), path.size());
+  headers.setPath(absl::string_view(new_path.data(), new_path.size()));
+}
+
 void Filter::rejectRequest(Envoy::Http::Code code, absl::string_view error_msg,
                            absl::string_view details) {
   ENVOY_LOG(debug, "{}", error_msg);
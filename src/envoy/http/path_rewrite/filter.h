@@ -28,7 +28,8 @@ namespace path_rewrite {
 class Filter : public Envoy::Http::PassThroughDecoderFilter,
                public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
  public:
-  Filter(FilterConfigSharedPtr config) : config_(config) {}
+  Filter(FilterConfigSharedPtr config)
+      : config_(config), callback_timer_(config_->callback_time_sampler()) {}
 
   // Envoy::Http::StreamDecoderFilter
   Envoy::Http::FilterHeadersStatus decodeHeaders(Envoy::Http::RequestHeaderMap&,
@@ -38,7 +39,13 @@ class Filter : public Envoy::Http::PassThroughDecoderFilter,
   void rejectRequest(Envoy::Http::Code code, absl::string_view error_msg,
                      absl::string_view details);
 
+  // Rewrites the path of a path_prefix route without building the new path in
+  // a string.
+  void prependPathPrefix(Envoy::Http::RequestHeaderMap& headers,
+                         absl::string_view path_prefix);
+
   const FilterConfigSharedPtr config_;
+  utils::CallbackTimer callback_timer_;
 };
 
 }  // namespace path_rewrite
@@ -0,0 +1,112 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures Filter::decodeHeaders of a request, from the creation of its
+// filter, for a route that prepends a path prefix and for one that translates
+// to a constant path with the variable bindings of its url template. The
+// Envoy callbacks and route are test mocks, their calls are in the times.
+//
+// Each request has a filter state of its own, as a stream does. The
+// allocations per request are reported as allocs_per_op, only in the builds
+// that count them (see AllocationCounter).
+
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "google/protobuf/text_format.h"
+#include "source/common/stream_info/filter_state_impl.h"
+#include "src/envoy/http/path_rewrite/config_parser_impl.h"
+#include "src/envoy/http/path_rewrite/filter.h"
+#include "src/envoy/utils/allocation_counter.h"
+#include "test/mocks/http/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace path_rewrite {
+namespace {
+
+using ::espv2::envoy::utils::AllocationCounter;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+constexpr char kPath[] = "/shelves/1/books/2?view=full";
+
+// Runs the requests of kPath through the filter with the per-route config.
+void decodeHeaders(benchmark::State& state,
+                   const std::string& per_route_text) {
+  ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig
+      per_route_proto;
+  if (!google::protobuf::TextFormat::ParseFromString(per_route_text,
+                                                     &per_route_proto)) {
+    state.SkipWithError("invalid per-route config");
+    return;
+  }
+  const PerRouteFilterConfig per_route(std::make_unique<ConfigParserImpl>(
+      per_route_proto, std::make_shared<UrlTemplateMatcherCache>()));
+
+  NiceMock<Envoy::Server::Configuration::MockFactoryContext> context;
+  const auto config = std::make_shared<FilterConfig>(
+      ::espv2::api::envoy::v10::http::path_rewrite::FilterConfig(), "",
+      context);
+  NiceMock<Envoy::Http::MockStreamDecoderFilterCallbacks> callbacks;
+  ON_CALL(callbacks.route_->route_entry_, perFilterConfig(kFilterName))
+      .WillByDefault(Return(&per_route));
+
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                                {":path", kPath}};
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    callbacks.stream_info_.filter_state_ =
+        std::make_shared<Envoy::StreamInfo::FilterStateImpl>(
+            Envoy::StreamInfo::FilterState::LifeSpan::FilterChain);
+    Filter filter(config);
+    filter.setDecoderFilterCallbacks(callbacks);
+    benchmark::DoNotOptimize(filter.decodeHeaders(headers, true));
+
+    // Back to the request path for the next request.
+    headers.setPath(kPath);
+    headers.removeEnvoyOriginalPath();
+  }
+  if (AllocationCounter::enabled()) {
+    state.counters["allocs_per_op"] = benchmark::Counter(
+        allocations.allocations(), benchmark::Counter::kAvgIterations);
+  }
+}
+
+void BM_DecodeHeadersPathPrefix(benchmark::State& state) {
+  decodeHeaders(state, R"(path_prefix: "/v1/bookstore")");
+}
+BENCHMARK(BM_DecodeHeadersPathPrefix);
+
+void BM_DecodeHeadersConstantPathBindings(benchmark::State& state) {
+  decodeHeaders(state, R"(
+    constant_path: {
+      path: "/v1/bookstore/GetBook"
+      url_template: "/shelves/{shelf}/books/{book}"
+    }
+  )");
+}
+BENCHMARK(BM_DecodeHeadersConstantPathBindings);
+
+}  // namespace
+}  // namespace path_rewrite
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
+
+BENCHMARK_MAIN();
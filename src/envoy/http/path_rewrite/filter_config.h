@@ -14,8 +14,12 @@
 
 #pragma once
 
+#include "api/envoy/v10/http/path_rewrite/config.pb.h"
+#include "envoy/server/filter_config.h"
 #include "envoy/stats/scope.h"
 #include "src/envoy/http/path_rewrite/config_parser.h"
+#include "src/envoy/utils/callback_time.h"
+#include "src/envoy/utils/local_counters.h"
 
 namespace espv2 {
 namespace envoy {
@@ -47,11 +51,30 @@ struct FilterStats {
 
 class FilterConfig {
  public:
-  FilterConfig(const std::string& stats_prefix, Envoy::Stats::Scope& scope)
-      : stats_(generateStats(stats_prefix, scope)) {}
+  FilterConfig(
+      const ::espv2::api::envoy::v10::http::path_rewrite::FilterConfig&
+          proto_config,
+      const std::string& stats_prefix,
+      Envoy::Server::Configuration::FactoryContext& context)
+      : skip_original_path_header_(proto_config.skip_original_path_header()),
+        stats_(generateStats(stats_prefix, context.scope())),
+        local_counters_(proto_config.local_counters(),
+                        {&stats_.path_changed_, &stats_.path_not_changed_},
+                        context.threadLocal()),
+        callback_time_sampler_(utils::CallbackTimeSampler::create(
+            proto_config.callback_time(), stats_prefix + "path_rewrite.",
+            context)) {}
 
   FilterStats& stats() { return stats_; }
 
+  utils::LocalCounters& local_counters() { return local_counters_; }
+
+  const utils::CallbackTimeSampler* callback_time_sampler() const {
+    return callback_time_sampler_.get();
+  }
+
+  bool skip_original_path_header() const { return skip_original_path_header_; }
+
  private:
   FilterStats generateStats(const std::string& prefix,
                             Envoy::Stats::Scope& scope) {
@@ -60,8 +83,11 @@ class FilterConfig {
         POOL_COUNTER_PREFIX(scope, final_prefix))};
   }
 
+  const bool skip_original_path_header_;
   // The stats
   FilterStats stats_;
+  utils::LocalCounters local_counters_;
+  const utils::CallbackTimeSamplerPtr callback_time_sampler_;
 };
 
 using FilterConfigSharedPtr = std::shared_ptr<FilterConfig>;
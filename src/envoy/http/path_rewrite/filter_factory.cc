@@ -15,6 +15,7 @@
 #include "api/envoy/v10/http/path_rewrite/config.pb.h"
 #include "api/envoy/v10/http/path_rewrite/config.pb.validate.h"
 #include "envoy/registry/registry.h"
+#include "envoy/singleton/manager.h"
 #include "source/extensions/filters/http/common/factory_base.h"
 #include "src/envoy/http/path_rewrite/config_parser_impl.h"
 #include "src/envoy/http/path_rewrite/filter.h"
@@ -24,6 +25,8 @@ namespace envoy {
 namespace http_filters {
 namespace path_rewrite {
 
+SINGLETON_MANAGER_REGISTRATION(url_template_matcher_cache);
+
 /**
  * Config registration for ESPv2 path rewrite filter.
  */
@@ -36,11 +39,12 @@ class FilterFactory
 
  private:
   Envoy::Http::FilterFactoryCb createFilterFactoryFromProtoTyped(
-      const ::espv2::api::envoy::v10::http::path_rewrite::FilterConfig&,
+      const ::espv2::api::envoy::v10::http::path_rewrite::FilterConfig&
+          proto_config,
       const std::string& stats_prefix,
       Envoy::Server::Configuration::FactoryContext& context) override {
     auto filter_config =
-        std::make_shared<FilterConfig>(stats_prefix, context.scope());
+        std::make_shared<FilterConfig>(proto_config, stats_prefix, context);
     return [filter_config](
                Envoy::Http::FilterChainFactoryCallbacks& callbacks) -> void {
       auto filter = std::make_shared<Filter>(filter_config);
@@ -53,9 +57,17 @@ class FilterFactory
   createRouteSpecificFilterConfigTyped(
       const ::espv2::api::envoy::v10::http::path_rewrite::PerRouteFilterConfig&
           per_route,
-      Envoy::Server::Configuration::ServerFactoryContext&,
+      Envoy::Server::Configuration::ServerFactoryContext& context,
       Envoy::ProtobufMessage::ValidationVisitor&) override {
-    auto parser = std::make_unique<ConfigParserImpl>(per_route);
+    auto matcher_cache =
+        context.singletonManager().getTyped<UrlTemplateMatcherCache>(
+            SINGLETON_MANAGER_REGISTERED_NAME(url_template_matcher_cache),
+            [&context] {
+              return std::make_shared<UrlTemplateMatcherCache>(
+                  context.scope());
+            });
+    auto parser =
+        std::make_unique<ConfigParserImpl>(per_route, std::move(matcher_cache));
     return std::make_shared<PerRouteFilterConfig>(std::move(parser));
   }
 };
@@ -22,6 +22,7 @@
 #include "test/test_common/utility.h"
 
 using ::testing::_;
+using ::testing::Field;
 using ::testing::NiceMock;
 using ::testing::Return;
 using ::testing::ReturnRef;
@@ -34,19 +35,24 @@ namespace path_rewrite {
 class FilterTest : public ::testing::Test {
  protected:
   void SetUp() override {
-    filter_config_ = std::make_shared<FilterConfig>("", scope_);
+    setUpFilter(::espv2::api::envoy::v10::http::path_rewrite::FilterConfig());
     mock_route_ = std::make_shared<NiceMock<Envoy::Router::MockRoute>>();
 
-    filter_ = std::make_unique<Filter>(filter_config_);
-    filter_->setDecoderFilterCallbacks(mock_decoder_callbacks_);
-
     auto mock_parser = std::make_unique<NiceMock<MockConfigParser>>();
     raw_mock_parser_ = mock_parser.get();
     per_route_config_ =
         std::make_shared<PerRouteFilterConfig>(std::move(mock_parser));
   }
 
-  NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope_;
+  void setUpFilter(
+      const ::espv2::api::envoy::v10::http::path_rewrite::FilterConfig&
+          proto_config) {
+    filter_config_ = std::make_shared<FilterConfig>(proto_config, "", context_);
+    filter_ = std::make_unique<Filter>(filter_config_);
+    filter_->setDecoderFilterCallbacks(mock_decoder_callbacks_);
+  }
+
+  NiceMock<Envoy::Server::Configuration::MockFactoryContext> context_;
 
   std::shared_ptr<NiceMock<MockConfigParser>> mock_config_parser_;
   std::shared_ptr<FilterConfig> filter_config_;
@@ -76,7 +82,8 @@ TEST_F(FilterTest, NoPathHeaderBlocked) {
 
   // Stats.
   const Envoy::Stats::CounterSharedPtr counter =
-      Envoy::TestUtility::findCounter(scope_, "path_rewrite.denied_by_no_path");
+      Envoy::TestUtility::findCounter(context_.scope_,
+                                      "path_rewrite.denied_by_no_path");
   EXPECT_NE(counter, nullptr);
   EXPECT_EQ(counter->value(), 1);
 }
@@ -100,7 +107,7 @@ TEST_F(FilterTest, DecodeHeadersOverflowWildcard) {
 
   // Stats.
   const Envoy::Stats::CounterSharedPtr counter =
-      Envoy::TestUtility::findCounter(scope_,
+      Envoy::TestUtility::findCounter(context_.scope_,
                                       "path_rewrite.denied_by_oversize_path");
   EXPECT_NE(counter, nullptr);
   EXPECT_EQ(counter->value(), 1);
@@ -126,7 +133,7 @@ TEST_F(FilterTest, FragmentPathHeaderBlocked) {
 
   // Stats.
   const Envoy::Stats::CounterSharedPtr counter =
-      Envoy::TestUtility::findCounter(scope_,
+      Envoy::TestUtility::findCounter(context_.scope_,
                                       "path_rewrite.denied_by_invalid_path");
   EXPECT_NE(counter, nullptr);
   EXPECT_EQ(counter->value(), 1);
@@ -161,7 +168,8 @@ TEST_F(FilterTest, NotPerRouteConfigNotChanged) {
 
   // Stats.
   const Envoy::Stats::CounterSharedPtr counter =
-      Envoy::TestUtility::findCounter(scope_, "path_rewrite.path_not_changed");
+      Envoy::TestUtility::findCounter(context_.scope_,
+                                      "path_rewrite.path_not_changed");
   EXPECT_NE(counter, nullptr);
   EXPECT_EQ(counter->value(), 1);
 }
@@ -175,9 +183,10 @@ TEST_F(FilterTest, RejectedByMismatchUrlTemplate) {
       .WillRepeatedly(Return(per_route_config_.get()));
 
   // Mismatch
-  EXPECT_CALL(*raw_mock_parser_, rewrite("/books/1", _))
+  EXPECT_CALL(*raw_mock_parser_,
+              rewrite(Field(&RequestPath::path, "/books/1"), _))
       .WillOnce(Invoke(
-          [](absl::string_view, std::string&) -> bool { return false; }));
+          [](const RequestPath&, std::string&) -> bool { return false; }));
   EXPECT_CALL(*raw_mock_parser_, url_template()).WillOnce(Return("/bar/{xyz}"));
 
   // The request is rejected
@@ -200,7 +209,7 @@ TEST_F(FilterTest, RejectedByMismatchUrlTemplate) {
   // Stats.
   const Envoy::Stats::CounterSharedPtr counter =
       Envoy::TestUtility::findCounter(
-          scope_, "path_rewrite.denied_by_url_template_mismatch");
+          context_.scope_, "path_rewrite.denied_by_url_template_mismatch");
   EXPECT_NE(counter, nullptr);
   EXPECT_EQ(counter->value(), 1);
 }
@@ -214,8 +223,9 @@ TEST_F(FilterTest, PathUpdated) {
       .WillRepeatedly(Return(per_route_config_.get()));
 
   // path rewrite ok
-  EXPECT_CALL(*raw_mock_parser_, rewrite("/books/1", _))
-      .WillOnce(Invoke([](absl::string_view, std::string& new_path) -> bool {
+  EXPECT_CALL(*raw_mock_parser_,
+              rewrite(Field(&RequestPath::path, "/books/1"), _))
+      .WillOnce(Invoke([](const RequestPath&, std::string& new_path) -> bool {
         new_path = "/tree/2";
         return true;
       }));
@@ -231,11 +241,75 @@ TEST_F(FilterTest, PathUpdated) {
 
   // Stats.
   const Envoy::Stats::CounterSharedPtr counter =
-      Envoy::TestUtility::findCounter(scope_, "path_rewrite.path_changed");
+      Envoy::TestUtility::findCounter(context_.scope_,
+                                      "path_rewrite.path_changed");
   EXPECT_NE(counter, nullptr);
   EXPECT_EQ(counter->value(), 1);
 }
 
+TEST_F(FilterTest, PathPrefixPrepended) {
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                                {":path", "/books/1?a=b"}};
+  EXPECT_CALL(mock_decoder_callbacks_, route())
+      .WillRepeatedly(Return(mock_route_));
+  EXPECT_CALL(mock_route_->route_entry_, perFilterConfig(kFilterName))
+      .WillRepeatedly(Return(per_route_config_.get()));
+  EXPECT_CALL(*raw_mock_parser_, path_prefix()).WillRepeatedly(Return("/v1"));
+  EXPECT_CALL(*raw_mock_parser_, rewrite(_, _)).Times(0);
+
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::Continue);
+  EXPECT_EQ(headers.getPathValue(), "/v1/books/1?a=b");
+  EXPECT_EQ(headers.getEnvoyOriginalPathValue(), "/books/1?a=b");
+
+  // An original path set before is kept.
+  headers.setPath("/shelves/2");
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::Continue);
+  EXPECT_EQ(headers.getPathValue(), "/v1/shelves/2");
+  EXPECT_EQ(headers.getEnvoyOriginalPathValue(), "/books/1?a=b");
+
+  const Envoy::Stats::CounterSharedPtr counter =
+      Envoy::TestUtility::findCounter(context_.scope_,
+                                      "path_rewrite.path_changed");
+  EXPECT_NE(counter, nullptr);
+  EXPECT_EQ(counter->value(), 2);
+}
+
+TEST_F(FilterTest, SkipOriginalPathHeader) {
+  ::espv2::api::envoy::v10::http::path_rewrite::FilterConfig proto_config;
+  proto_config.set_skip_original_path_header(true);
+  setUpFilter(proto_config);
+
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                                {":path", "/books/1"}};
+  EXPECT_CALL(mock_decoder_callbacks_, route())
+      .WillRepeatedly(Return(mock_route_));
+  EXPECT_CALL(mock_route_->route_entry_, perFilterConfig(kFilterName))
+      .WillRepeatedly(Return(per_route_config_.get()));
+  EXPECT_CALL(*raw_mock_parser_, path_prefix())
+      .WillOnce(Return("/v1"))
+      .WillOnce(Return(""));
+  EXPECT_CALL(*raw_mock_parser_,
+              rewrite(Field(&RequestPath::path, "/v1/books/1"), _))
+      .WillOnce(Invoke([](const RequestPath&, std::string& new_path) -> bool {
+        new_path = "/tree/2";
+        return true;
+      }));
+
+  // A path_prefix route.
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::Continue);
+  EXPECT_EQ(headers.getPathValue(), "/v1/books/1");
+  EXPECT_EQ(headers.EnvoyOriginalPath(), nullptr);
+
+  // A constant_path route.
+  EXPECT_EQ(filter_->decodeHeaders(headers, false),
+            Envoy::Http::FilterHeadersStatus::Continue);
+  EXPECT_EQ(headers.getPathValue(), "/tree/2");
+  EXPECT_EQ(headers.EnvoyOriginalPath(), nullptr);
+}
+
 }  // namespace path_rewrite
 }  // namespace http_filters
 }  // namespace envoy
@@ -23,8 +23,10 @@ namespace path_rewrite {
 class MockConfigParser : public ConfigParser {
  public:
   MOCK_METHOD(bool, rewrite,
-              (absl::string_view origin_path, std::string& new_path), (const));
+              (const RequestPath& origin_path, std::string& new_path),
+              (const));
   MOCK_METHOD(absl::string_view, url_template, (), (const));
+  MOCK_METHOD(absl::string_view, path_prefix, (), (const));
 };
 
 }  // namespace path_rewrite
@@ -0,0 +1,65 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/path_rewrite/url_template_matcher_cache.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace path_rewrite {
+
+UrlTemplateMatcherCache::UrlTemplateMatcherCache(Envoy::Stats::Scope& scope)
+    : bytes_(&scope.gaugeFromString(
+          "url_template_matcher_cache.bytes",
+          Envoy::Stats::Gauge::ImportMode::Accumulate)) {}
+
+UrlTemplateMatcherSharedPtr UrlTemplateMatcherCache::get(
+    const std::string& url_template) {
+  if (UrlTemplateMatcherSharedPtr matcher = matchers_[url_template].lock()) {
+    return matcher;
+  }
+
+  // Drop the matchers of the templates no longer configured.
+  for (auto it = matchers_.begin(); it != matchers_.end();) {
+    if (it->second.expired()) {
+      matchers_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  std::unique_ptr<UrlTemplateMatcher> plan =
+      UrlTemplateMatcher::Create(url_template);
+  if (plan == nullptr) {
+    return nullptr;
+  }
+  const uint64_t bytes = plan->Bytes();
+  if (bytes_) {
+    bytes_->add(bytes);
+  }
+  UrlTemplateMatcherSharedPtr matcher(
+      plan.release(), [gauge = bytes_, bytes](const UrlTemplateMatcher* m) {
+        if (gauge) {
+          gauge->sub(bytes);
+        }
+        delete m;
+      });
+  matchers_[url_template] = matcher;
+  return matcher;
+}
+
+}  // namespace path_rewrite
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
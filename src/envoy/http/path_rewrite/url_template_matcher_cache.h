@@ -0,0 +1,67 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "envoy/singleton/instance.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats.h"
+#include "src/api_proxy/path_matcher/http_template_plan.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace path_rewrite {
+
+// Matches a single url_template and extracts its variable bindings.
+using UrlTemplateMatcher = ::espv2::api_proxy::path_matcher::HttpTemplatePlan;
+using UrlTemplateMatcherSharedPtr = std::shared_ptr<const UrlTemplateMatcher>;
+
+// The url_template matchers of the per-route configs, shared by the routes of
+// a server. Routes with the same url_template share one immutable matcher,
+// also across config pushes, since a push builds the new routes while the old
+// ones are still alive.
+// Must only be used on the main thread.
+//
+// The memory held by the matchers is counted in the
+// `url_template_matcher_cache.bytes` gauge, if created with a scope.
+class UrlTemplateMatcherCache : public Envoy::Singleton::Instance {
+ public:
+  UrlTemplateMatcherCache() = default;
+  explicit UrlTemplateMatcherCache(Envoy::Stats::Scope& scope);
+
+  // Returns the matcher of the url_template, building it if no route holds
+  // it. The matcher is freed once its last holder is gone. Returns nullptr if
+  // the url_template is invalid.
+  UrlTemplateMatcherSharedPtr get(const std::string& url_template);
+
+ private:
+  absl::flat_hash_map<std::string, std::weak_ptr<const UrlTemplateMatcher>>
+      matchers_;
+  // Kept by the matchers, which may be freed after the cache. Null if there
+  // is no scope.
+  Envoy::Stats::GaugeSharedPtr bytes_;
+};
+
+using UrlTemplateMatcherCacheSharedPtr =
+    std::shared_ptr<UrlTemplateMatcherCache>;
+
+}  // namespace path_rewrite
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,82 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/path_rewrite/url_template_matcher_cache.h"
+
+#include "gtest/gtest.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace path_rewrite {
+namespace {
+
+// Returns whether the matcher matches the path.
+bool matches(const UrlTemplateMatcher& matcher, absl::string_view path) {
+  return matcher.Match(path, [](const std::vector<std::string>&,
+                                absl::string_view) {});
+}
+
+TEST(UrlTemplateMatcherCacheTest, SharedWhileHeld) {
+  UrlTemplateMatcherCache cache;
+
+  auto matcher = cache.get("/bar/{abc}");
+  ASSERT_NE(matcher, nullptr);
+  EXPECT_TRUE(matches(*matcher, "/bar/567"));
+
+  // A template already built is not built again.
+  EXPECT_EQ(cache.get("/bar/{abc}"), matcher);
+  EXPECT_NE(cache.get("/foo/{abc}"), matcher);
+
+  // The matcher is built again once no one holds it.
+  matcher.reset();
+  matcher = cache.get("/bar/{abc}");
+  ASSERT_NE(matcher, nullptr);
+  EXPECT_TRUE(matches(*matcher, "/bar/567"));
+}
+
+TEST(UrlTemplateMatcherCacheTest, BytesCounted) {
+  testing::NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope;
+  auto cache = std::make_shared<UrlTemplateMatcherCache>(scope);
+  Envoy::Stats::GaugeSharedPtr bytes = Envoy::TestUtility::findGauge(
+      scope, "url_template_matcher_cache.bytes");
+  ASSERT_NE(bytes, nullptr);
+  EXPECT_EQ(bytes->value(), 0);
+
+  auto matcher = cache->get("/bar/{abc}");
+  const uint64_t matcher_bytes = bytes->value();
+  EXPECT_GT(matcher_bytes, 0);
+  EXPECT_EQ(cache->get("/bar/{abc}"), matcher);
+  EXPECT_EQ(bytes->value(), matcher_bytes);
+
+  // Until the last holder is gone, even after the cache.
+  cache.reset();
+  EXPECT_EQ(bytes->value(), matcher_bytes);
+  matcher.reset();
+  EXPECT_EQ(bytes->value(), 0);
+}
+
+TEST(UrlTemplateMatcherCacheTest, InvalidTemplate) {
+  UrlTemplateMatcherCache cache;
+
+  EXPECT_EQ(cache.get("/bar/{abc"), nullptr);
+}
+
+}  // namespace
+}  // namespace path_rewrite
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
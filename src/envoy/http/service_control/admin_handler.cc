@@ -0,0 +1,179 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/admin_handler.h"
+
+#include <utility>
+#include <vector>
+
+#include "envoy/singleton/manager.h"
+#include "source/common/http/headers.h"
+#include "source/common/protobuf/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+SINGLETON_MANAGER_REGISTRATION(service_control_admin_handler);
+
+using ::Envoy::ValueUtil;
+using ::Envoy::ProtobufWkt::Struct;
+using ::Envoy::ProtobufWkt::Value;
+
+namespace {
+
+Value workerValue(const ClientCacheStatus& status) {
+  Struct worker;
+  auto& fields = *worker.mutable_fields();
+  fields["check_calls"] = ValueUtil::numberValue(status.check_calls);
+  fields["check_cache_hits"] = ValueUtil::numberValue(status.check_cache_hits);
+  if (status.check_calls > 0) {
+    fields["check_cache_hit_rate"] = ValueUtil::numberValue(
+        static_cast<double>(status.check_cache_hits) / status.check_calls);
+  }
+  fields["quota_calls"] = ValueUtil::numberValue(status.quota_calls);
+  fields["report_calls"] = ValueUtil::numberValue(status.report_calls);
+  fields["check_calls_in_flight"] =
+      ValueUtil::numberValue(status.check_calls_in_flight);
+  fields["quota_calls_in_flight"] =
+      ValueUtil::numberValue(status.quota_calls_in_flight);
+  fields["report_calls_in_flight"] =
+      ValueUtil::numberValue(status.report_calls_in_flight);
+  fields["coalesced_checks"] = ValueUtil::numberValue(status.coalesced_checks);
+  fields["revalidating_checks"] =
+      ValueUtil::numberValue(status.revalidating_checks);
+  if (!status.check_circuit_breaker.empty()) {
+    fields["check_circuit_breaker"] =
+        ValueUtil::stringValue(std::string(status.check_circuit_breaker));
+  }
+  if (!status.quota_circuit_breaker.empty()) {
+    fields["quota_circuit_breaker"] =
+        ValueUtil::stringValue(std::string(status.quota_circuit_breaker));
+  }
+  return ValueUtil::structValue(worker);
+}
+
+Value callValue(const ServiceControlCallStatus& status) {
+  Struct call;
+  auto& fields = *call.mutable_fields();
+  fields["service_name"] = ValueUtil::stringValue(status.service_name);
+  fields["service_config_id"] =
+      ValueUtil::stringValue(status.service_config_id);
+  std::vector<Value> workers;
+  for (const ClientCacheStatus& worker : status.workers) {
+    workers.push_back(workerValue(worker));
+  }
+  fields["workers"] = ValueUtil::listValue(workers);
+  return ValueUtil::structValue(call);
+}
+
+Value tokenSubscriberValue(const token::TokenSubscriberStatus& status) {
+  Struct subscriber;
+  auto& fields = *subscriber.mutable_fields();
+  fields["name"] = ValueUtil::stringValue(status.name);
+  fields["has_token"] = ValueUtil::boolValue(status.has_token);
+  if (status.expires_in.has_value()) {
+    fields["expires_in_ms"] =
+        ValueUtil::numberValue(status.expires_in->count());
+  }
+  if (status.refresh_in.has_value()) {
+    fields["refresh_in_ms"] =
+        ValueUtil::numberValue(status.refresh_in->count());
+  }
+  fields["fetching"] = ValueUtil::boolValue(status.fetching);
+  if (!status.last_error.empty()) {
+    fields["last_error"] = ValueUtil::stringValue(status.last_error);
+  }
+  return ValueUtil::structValue(subscriber);
+}
+
+}  // namespace
+
+std::shared_ptr<AdminHandler> AdminHandler::get(
+    Envoy::Server::Configuration::FactoryContext& context) {
+  ServiceControlCallRegistrySharedPtr registry =
+      ServiceControlCallRegistry::get(context.singletonManager());
+  token::TokenSubscriberCacheSharedPtr token_cache =
+      token::TokenSubscriberCache::get(
+          context.singletonManager(),
+          context.getServerFactoryContext().scope());
+  return context.singletonManager().getTyped<AdminHandler>(
+      SINGLETON_MANAGER_REGISTERED_NAME(service_control_admin_handler),
+      [&context, &registry, &token_cache] {
+        return std::make_shared<AdminHandler>(
+            context.admin(), std::move(registry), std::move(token_cache));
+      });
+}
+
+AdminHandler::AdminHandler(Envoy::Server::Admin& admin,
+                           ServiceControlCallRegistrySharedPtr registry,
+                           token::TokenSubscriberCacheSharedPtr token_cache)
+    : admin_(admin),
+      registry_(std::move(registry)),
+      token_cache_(std::move(token_cache)) {
+  added_ = admin_.addHandler(
+      kAdminHandlerPrefix,
+      "print the ESPv2 service control caches and token subscribers",
+      [this](absl::string_view path_and_query,
+             Envoy::Http::ResponseHeaderMap& response_headers,
+             Envoy::Buffer::Instance& response,
+             Envoy::Server::AdminStream& admin_stream) {
+        return handle(path_and_query, response_headers, response,
+                      admin_stream);
+      },
+      /*removable=*/true, /*mutates_server_state=*/false);
+  if (!added_) {
+    ENVOY_LOG(warn, "admin path {} is taken, not serving it",
+              kAdminHandlerPrefix);
+  }
+}
+
+AdminHandler::~AdminHandler() {
+  if (added_) {
+    admin_.removeHandler(kAdminHandlerPrefix);
+  }
+}
+
+std::string AdminHandler::dump() const {
+  Struct dump;
+  auto& fields = *dump.mutable_fields();
+  std::vector<Value> calls;
+  for (const ServiceControlCallStatus& call : registry_->statuses()) {
+    calls.push_back(callValue(call));
+  }
+  fields["service_control_calls"] = ValueUtil::listValue(calls);
+  std::vector<Value> subscribers;
+  for (const token::TokenSubscriberStatus& subscriber :
+       token_cache_->statuses()) {
+    subscribers.push_back(tokenSubscriberValue(subscriber));
+  }
+  fields["token_subscribers"] = ValueUtil::listValue(subscribers);
+  return Envoy::MessageUtil::getJsonStringFromMessageOrDie(
+      dump, /*pretty_print=*/true);
+}
+
+Envoy::Http::Code AdminHandler::handle(
+    absl::string_view, Envoy::Http::ResponseHeaderMap& response_headers,
+    Envoy::Buffer::Instance& response, Envoy::Server::AdminStream&) {
+  response_headers.setReferenceContentType(
+      Envoy::Http::Headers::get().ContentTypeValues.Json);
+  response.add(dump());
+  return Envoy::Http::Code::OK;
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,80 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "envoy/buffer/buffer.h"
+#include "envoy/http/codes.h"
+#include "envoy/http/header_map.h"
+#include "envoy/server/admin.h"
+#include "envoy/server/filter_config.h"
+#include "envoy/singleton/instance.h"
+#include "source/common/common/logger.h"
+#include "src/envoy/http/service_control/service_control_call_impl.h"
+#include "src/envoy/token/token_subscriber_cache.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// The admin path the state of the service control calls is served at.
+constexpr char kAdminHandlerPrefix[] = "/espv2/service_control";
+
+// Serves, as JSON on the admin interface, the client caches of the workers of
+// each service control call and the token subscribers of the server.
+//
+// Admin requests are served on the main thread and cannot wait for the
+// workers: the workers publish the state of their caches every second, see
+// ClientCacheStatusSlot, and a dump reads the last copies. So a dump never
+// blocks, or sends work to, the workers. Main thread only.
+class AdminHandler : public Envoy::Singleton::Instance,
+                     public Envoy::Logger::Loggable<Envoy::Logger::Id::admin> {
+ public:
+  // Returns the handler of the server, added to its admin interface while it
+  // is held.
+  static std::shared_ptr<AdminHandler> get(
+      Envoy::Server::Configuration::FactoryContext& context);
+
+  AdminHandler(Envoy::Server::Admin& admin,
+               ServiceControlCallRegistrySharedPtr registry,
+               token::TokenSubscriberCacheSharedPtr token_cache);
+  ~AdminHandler() override;
+
+  // Returns the state of the calls and of the token subscribers.
+  std::string dump() const;
+
+ private:
+  Envoy::Http::Code handle(absl::string_view path_and_query,
+                           Envoy::Http::ResponseHeaderMap& response_headers,
+                           Envoy::Buffer::Instance& response,
+                           Envoy::Server::AdminStream& admin_stream);
+
+  Envoy::Server::Admin& admin_;
+  const ServiceControlCallRegistrySharedPtr registry_;
+  const token::TokenSubscriberCacheSharedPtr token_cache_;
+  // Whether the handler was added, it is not if the path is taken.
+  bool added_ = false;
+};
+
+using AdminHandlerSharedPtr = std::shared_ptr<AdminHandler>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
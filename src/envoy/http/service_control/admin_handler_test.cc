@@ -0,0 +1,127 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/admin_handler.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/protobuf/utility.h"
+#include "src/envoy/http/service_control/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::Envoy::ProtobufWkt::Struct;
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::SaveArg;
+
+class AdminHandlerTest : public testing::Test {
+ protected:
+  std::unique_ptr<AdminHandler> createHandler() {
+    EXPECT_CALL(admin_, addHandler(kAdminHandlerPrefix, _, _, true, false))
+        .WillOnce(DoAll(SaveArg<2>(&callback_), Return(true)));
+    return std::make_unique<AdminHandler>(
+        admin_, registry_,
+        std::make_shared<token::TokenSubscriberCache>(scope_));
+  }
+
+  // Serves the admin request, and returns the dump it responded with.
+  Struct serve() {
+    Envoy::Http::TestResponseHeaderMapImpl headers;
+    Envoy::Buffer::OwnedImpl response;
+    EXPECT_EQ(callback_(kAdminHandlerPrefix, headers, response, admin_stream_),
+              Envoy::Http::Code::OK);
+    EXPECT_EQ(headers.getContentTypeValue(), "application/json");
+    Struct dump;
+    Envoy::MessageUtil::loadFromJson(response.toString(), dump);
+    return dump;
+  }
+
+  NiceMock<Envoy::Server::MockAdmin> admin_;
+  NiceMock<Envoy::Server::MockAdminStream> admin_stream_;
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope_;
+  ServiceControlCallRegistrySharedPtr registry_ =
+      std::make_shared<ServiceControlCallRegistry>();
+  Envoy::Server::Admin::HandlerCb callback_;
+};
+
+TEST_F(AdminHandlerTest, RemovedWhenDestroyed) {
+  auto handler = createHandler();
+  EXPECT_CALL(admin_, removeHandler(kAdminHandlerPrefix));
+  handler.reset();
+}
+
+TEST_F(AdminHandlerTest, NotRemovedIfNotAdded) {
+  EXPECT_CALL(admin_, addHandler(kAdminHandlerPrefix, _, _, _, _))
+      .WillOnce(Return(false));
+  EXPECT_CALL(admin_, removeHandler(_)).Times(0);
+  AdminHandler handler(admin_, registry_,
+                       std::make_shared<token::TokenSubscriberCache>(scope_));
+}
+
+TEST_F(AdminHandlerTest, DumpsTheWorkersOfEachCall) {
+  ServiceControlCallStatus status;
+  status.service_name = "echo";
+  status.service_config_id = "2021-07-15r0";
+  ClientCacheStatus worker;
+  worker.check_calls = 4;
+  worker.check_cache_hits = 3;
+  worker.check_calls_in_flight = 1;
+  worker.check_circuit_breaker = "open";
+  status.workers = {worker, ClientCacheStatus()};
+  auto call = std::make_shared<NiceMock<MockServiceControlCall>>();
+  ON_CALL(*call, status()).WillByDefault(Return(status));
+  ServiceControlCallSharedPtr held =
+      registry_->getOrCreate("echo", [&call]() { return call; });
+
+  auto handler = createHandler();
+  const Struct dump = serve();
+
+  const auto& calls = dump.fields().at("service_control_calls").list_value();
+  ASSERT_EQ(calls.values_size(), 1);
+  const auto& fields = calls.values(0).struct_value().fields();
+  EXPECT_EQ(fields.at("service_name").string_value(), "echo");
+  EXPECT_EQ(fields.at("service_config_id").string_value(), "2021-07-15r0");
+
+  const auto& workers = fields.at("workers").list_value();
+  ASSERT_EQ(workers.values_size(), 2);
+  const auto& first = workers.values(0).struct_value().fields();
+  EXPECT_EQ(first.at("check_calls").number_value(), 4);
+  EXPECT_EQ(first.at("check_cache_hit_rate").number_value(), 0.75);
+  EXPECT_EQ(first.at("check_calls_in_flight").number_value(), 1);
+  EXPECT_EQ(first.at("check_circuit_breaker").string_value(), "open");
+  // No hit rate without calls, no state without a circuit breaker.
+  const auto& second = workers.values(1).struct_value().fields();
+  EXPECT_EQ(second.count("check_cache_hit_rate"), 0);
+  EXPECT_EQ(second.count("check_circuit_breaker"), 0);
+
+  EXPECT_EQ(dump.fields().at("token_subscribers").list_value().values_size(),
+            0);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
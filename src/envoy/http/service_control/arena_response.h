@@ -0,0 +1,75 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+
+#include "google/api/servicecontrol/v1/quota_controller.pb.h"
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "google/protobuf/arena.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// Owns a response message of one Service Control call, allocated on an arena
+// whose first block is inlined. The response and all its sub-messages and
+// strings take a single heap allocation unless they outgrow the block, and are
+// freed together with the holder.
+template <typename Response>
+class ArenaResponse {
+ public:
+  ArenaResponse()
+      : arena_(arenaOptions(initial_block_, sizeof(initial_block_))),
+        response_(google::protobuf::Arena::CreateMessage<Response>(&arena_)) {}
+
+  ArenaResponse(const ArenaResponse&) = delete;
+  ArenaResponse& operator=(const ArenaResponse&) = delete;
+
+  Response* get() { return response_; }
+  Response& operator*() { return *response_; }
+  Response* operator->() { return response_; }
+
+ private:
+  // Fits a typical response with a few check errors.
+  static constexpr size_t kInitialBlockBytes = 1024;
+
+  static google::protobuf::ArenaOptions arenaOptions(char* block,
+                                                     size_t size) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = size;
+    return options;
+  }
+
+  // Must be declared before the arena that uses it.
+  alignas(8) char initial_block_[kInitialBlockBytes];
+  google::protobuf::Arena arena_;
+  Response* response_;
+};
+
+using ArenaCheckResponse =
+    ArenaResponse<::google::api::servicecontrol::v1::CheckResponse>;
+using ArenaCheckResponsePtr = std::unique_ptr<ArenaCheckResponse>;
+
+using ArenaQuotaResponse =
+    ArenaResponse<::google::api::servicecontrol::v1::AllocateQuotaResponse>;
+using ArenaQuotaResponsePtr = std::unique_ptr<ArenaQuotaResponse>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,252 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/check_cache_snapshot.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::espv2::api_proxy::service_control::CheckResponseInfo;
+using ::espv2::api_proxy::service_control::ScResponseErrorType;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+namespace api_key = ::espv2::api_proxy::service_control::api_key;
+
+// Starts each snapshot, with the version of its encoding.
+constexpr absl::string_view kSnapshotMagic("ESPV2CC1");
+
+// The integers are little endian, the strings prefixed by their 4 byte size.
+void putInt(uint64_t value, size_t bytes, std::string* out) {
+  for (size_t i = 0; i < bytes; ++i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+void putString(absl::string_view value, std::string* out) {
+  putInt(value.size(), 4, out);
+  out->append(value.data(), value.size());
+}
+
+class Reader {
+ public:
+  explicit Reader(absl::string_view data) : data_(data) {}
+
+  bool empty() const { return data_.empty(); }
+
+  bool readInt(size_t bytes, uint64_t* value) {
+    if (data_.size() < bytes) {
+      return false;
+    }
+    *value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      *value |= static_cast<uint64_t>(static_cast<uint8_t>(data_[i]))
+                << (8 * i);
+    }
+    data_.remove_prefix(bytes);
+    return true;
+  }
+
+  bool readString(std::string* value) {
+    uint64_t size;
+    if (!readInt(4, &size) || data_.size() < size) {
+      return false;
+    }
+    value->assign(data_.data(), size);
+    data_.remove_prefix(size);
+    return true;
+  }
+
+ private:
+  absl::string_view data_;
+};
+
+uint64_t toMillis(Envoy::SystemTime time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+bool readFile(const std::string& path, std::string* content) {
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  *content = buffer.str();
+  return !file.bad();
+}
+
+// Written aside, then renamed over the previous file. The process id keeps
+// apart the files of two proxies of a hot restart. Only readable by the user
+// of the proxy, as the signatures hold the API keys.
+bool writeFile(const std::string& path, const std::string& content) {
+  const std::string tmp_path = absl::StrCat(path, ".tmp", getpid());
+  const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  const bool written =
+      ::write(fd, content.data(), content.size()) ==
+      static_cast<ssize_t>(content.size());
+  if (::close(fd) != 0 || !written ||
+      std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string encodeCheckCacheSnapshot(SharedCheckCache& cache,
+                                     Envoy::SystemTime now) {
+  std::string out(kSnapshotMagic);
+  putInt(toMillis(now), 8, &out);
+  cache.forEach([&out](const std::string& signature,
+                       const CachedCheckResponse& response,
+                       std::chrono::milliseconds time_left) {
+    const CheckResponseInfo& info = response.info;
+    putString(signature, &out);
+    putInt(time_left.count(), 8, &out);
+    putString(info.consumer_project_number, &out);
+    putString(info.consumer_type, &out);
+    putString(info.consumer_number, &out);
+    putString(info.error.name, &out);
+    putInt(info.error.is_network_error, 1, &out);
+    putInt(info.error.type, 1, &out);
+    putInt(info.api_key_state, 1, &out);
+    putInt(static_cast<int>(response.status.code()), 1, &out);
+    putString(absl::string_view(response.status.message().data(),
+                                response.status.message().size()),
+              &out);
+  });
+  return out;
+}
+
+size_t restoreCheckCacheSnapshot(absl::string_view snapshot,
+                                 Envoy::SystemTime now,
+                                 SharedCheckCache& cache) {
+  if (!absl::StartsWith(snapshot, kSnapshotMagic)) {
+    return 0;
+  }
+  Reader reader(snapshot.substr(kSnapshotMagic.size()));
+  uint64_t taken_ms;
+  if (!reader.readInt(8, &taken_ms)) {
+    return 0;
+  }
+  // A snapshot from the future, with a clock gone backwards, is taken as
+  // just written.
+  const uint64_t now_ms = toMillis(now);
+  const uint64_t age_ms = now_ms > taken_ms ? now_ms - taken_ms : 0;
+
+  size_t restored = 0;
+  while (!reader.empty()) {
+    std::string signature;
+    uint64_t time_left_ms;
+    CheckResponseInfo info;
+    uint64_t is_network_error, error_type, api_key_state, code;
+    std::string message;
+    if (!reader.readString(&signature) || !reader.readInt(8, &time_left_ms) ||
+        !reader.readString(&info.consumer_project_number) ||
+        !reader.readString(&info.consumer_type) ||
+        !reader.readString(&info.consumer_number) ||
+        !reader.readString(&info.error.name) ||
+        !reader.readInt(1, &is_network_error) ||
+        !reader.readInt(1, &error_type) ||
+        !reader.readInt(1, &api_key_state) || !reader.readInt(1, &code) ||
+        !reader.readString(&message) ||
+        error_type > ScResponseErrorType::CONSUMER_QUOTA ||
+        api_key_state > api_key::ApiKeyState::VERIFIED ||
+        code > static_cast<int>(StatusCode::kUnauthenticated)) {
+      break;
+    }
+    if (time_left_ms <= age_ms) {
+      continue;
+    }
+    info.error.is_network_error = is_network_error != 0;
+    info.error.type = static_cast<ScResponseErrorType>(error_type);
+    info.api_key_state = static_cast<api_key::ApiKeyState>(api_key_state);
+    if (cache.restore(signature,
+                      std::make_shared<const CachedCheckResponse>(
+                          std::move(info),
+                          Status(static_cast<StatusCode>(code), message)),
+                      std::chrono::milliseconds(time_left_ms - age_ms))) {
+      ++restored;
+    }
+  }
+  return restored;
+}
+
+CheckCacheSnapshotter::CheckCacheSnapshotter(
+    std::vector<Cache> caches, std::chrono::milliseconds interval,
+    Envoy::Event::Dispatcher& dispatcher, Envoy::TimeSource& time_source)
+    : caches_(std::move(caches)),
+      interval_(interval),
+      time_source_(time_source) {
+  restore();
+  timer_ = dispatcher.createTimer([this]() {
+    write();
+    timer_->enableTimer(interval_);
+  });
+  timer_->enableTimer(interval_);
+}
+
+CheckCacheSnapshotter::~CheckCacheSnapshotter() { write(); }
+
+void CheckCacheSnapshotter::restore() {
+  const Envoy::SystemTime now = time_source_.systemTime();
+  for (const Cache& cache : caches_) {
+    std::string snapshot;
+    if (!readFile(cache.path, &snapshot)) {
+      // No snapshot yet on the first start.
+      ENVOY_LOG(debug, "no check cache snapshot read from {}", cache.path);
+      continue;
+    }
+    const size_t restored =
+        restoreCheckCacheSnapshot(snapshot, now, *cache.cache);
+    ENVOY_LOG(info, "restored {} check cache entries from {}", restored,
+              cache.path);
+  }
+}
+
+void CheckCacheSnapshotter::write() {
+  const Envoy::SystemTime now = time_source_.systemTime();
+  for (const Cache& cache : caches_) {
+    if (!writeFile(cache.path, encodeCheckCacheSnapshot(*cache.cache, now))) {
+      ENVOY_LOG(warn, "failed to write the check cache snapshot {}",
+                cache.path);
+    }
+  }
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
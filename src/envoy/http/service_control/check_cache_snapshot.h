@@ -0,0 +1,84 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "envoy/common/time.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "source/common/common/logger.h"
+#include "src/envoy/http/service_control/shared_check_cache.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// Encodes the unexpired entries of the cache, with the time they have left,
+// taken at the wall clock time `now`.
+std::string encodeCheckCacheSnapshot(SharedCheckCache& cache,
+                                     Envoy::SystemTime now);
+
+// Restores the entries of the snapshot into the cache, with the time they
+// had left less the time since the snapshot. Stops at the first malformed
+// entry. Returns the number of entries restored.
+size_t restoreCheckCacheSnapshot(absl::string_view snapshot,
+                                 Envoy::SystemTime now,
+                                 SharedCheckCache& cache);
+
+// Keeps a snapshot file of each of the shared check caches of a service, so
+// the next process, such as the child of a hot restart, starts with the
+// cached Check results of the previous one. The caches are restored from
+// their files when it is created, and written to them every interval and
+// when it is destroyed. The files are replaced whole, so the two processes of
+// a hot restart may share them. Must live on the main thread.
+class CheckCacheSnapshotter
+    : public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
+ public:
+  struct Cache {
+    std::string path;
+    SharedCheckCacheSharedPtr cache;
+  };
+
+  CheckCacheSnapshotter(std::vector<Cache> caches,
+                        std::chrono::milliseconds interval,
+                        Envoy::Event::Dispatcher& dispatcher,
+                        Envoy::TimeSource& time_source);
+  ~CheckCacheSnapshotter();
+
+ private:
+  void restore();
+  void write();
+
+  const std::vector<Cache> caches_;
+  const std::chrono::milliseconds interval_;
+  Envoy::TimeSource& time_source_;
+  Envoy::Event::TimerPtr timer_;
+};
+
+using CheckCacheSnapshotterPtr = std::unique_ptr<CheckCacheSnapshotter>;
+
+// The interval between two snapshots if it is not set.
+constexpr std::chrono::milliseconds kCheckCacheSnapshotInterval(10000);
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
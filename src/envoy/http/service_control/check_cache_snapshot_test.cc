@@ -0,0 +1,182 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/check_cache_snapshot.h"
+
+#include <cstdio>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/environment.h"
+#include "test/test_common/simulated_time_system.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::Envoy::TestEnvironment;
+using ::espv2::api_proxy::service_control::CheckResponseInfo;
+using ::espv2::api_proxy::service_control::ScResponseErrorType;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+using ::testing::NiceMock;
+namespace api_key = ::espv2::api_proxy::service_control::api_key;
+
+class CheckCacheSnapshotTest : public ::testing::Test {
+ protected:
+  CheckCacheSnapshotTest()
+      : stats_(ServiceControlFilterStats::create("test", context_.scope_)) {}
+
+  SharedCheckCacheSharedPtr makeCache() {
+    return std::make_shared<SharedCheckCache>(
+        100, std::chrono::milliseconds(1000), std::chrono::milliseconds(0),
+        time_system_, stats_.shared_check_cache_);
+  }
+
+  CachedCheckResponseConstSharedPtr makeResponse(
+      const std::string& consumer_number) {
+    CheckResponseInfo info;
+    info.consumer_number = consumer_number;
+    info.api_key_state = api_key::ApiKeyState::VERIFIED;
+    return std::make_shared<const CachedCheckResponse>(std::move(info),
+                                                       Status());
+  }
+
+  Envoy::Event::SimulatedTimeSystem time_system_;
+  NiceMock<Envoy::Server::Configuration::MockFactoryContext> context_;
+  ServiceControlFilterStats stats_;
+};
+
+TEST_F(CheckCacheSnapshotTest, RestoredWithTimeLeft) {
+  auto cache = makeCache();
+  cache->insert("allowed", makeResponse("1"));
+  CheckResponseInfo error_info;
+  error_info.error = {"API_KEY_INVALID", false,
+                      ScResponseErrorType::API_KEY_INVALID};
+  error_info.api_key_state = api_key::ApiKeyState::INVALID;
+  cache->insert("denied",
+                std::make_shared<const CachedCheckResponse>(
+                    std::move(error_info),
+                    Status(StatusCode::kInvalidArgument, "invalid key")));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(400));
+  const std::string snapshot =
+      encodeCheckCacheSnapshot(*cache, time_system_.systemTime());
+
+  // Restored 100 ms after the snapshot, by a new cache.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(100));
+  auto restored = makeCache();
+  EXPECT_EQ(restoreCheckCacheSnapshot(snapshot, time_system_.systemTime(),
+                                      *restored),
+            2);
+  EXPECT_EQ(stats_.shared_check_cache_.restored_.value(), 2);
+
+  CachedCheckResponseConstSharedPtr allowed = restored->lookup("allowed");
+  ASSERT_NE(allowed, nullptr);
+  EXPECT_EQ(allowed->info.consumer_number, "1");
+  EXPECT_EQ(allowed->info.api_key_state, api_key::ApiKeyState::VERIFIED);
+  EXPECT_TRUE(allowed->status.ok());
+  CachedCheckResponseConstSharedPtr denied = restored->lookup("denied");
+  ASSERT_NE(denied, nullptr);
+  EXPECT_EQ(denied->info.error.name, "API_KEY_INVALID");
+  EXPECT_EQ(denied->info.error.type, ScResponseErrorType::API_KEY_INVALID);
+  EXPECT_EQ(denied->status,
+            Status(StatusCode::kInvalidArgument, "invalid key"));
+
+  // They expire when they would have in the first cache.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(499));
+  EXPECT_NE(restored->lookup("allowed"), nullptr);
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1));
+  EXPECT_EQ(restored->lookup("allowed"), nullptr);
+}
+
+TEST_F(CheckCacheSnapshotTest, ExpiredAndNewerEntriesNotRestored) {
+  auto cache = makeCache();
+  cache->insert("old", makeResponse("1"));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(600));
+  cache->insert("new", makeResponse("2"));
+  const std::string snapshot =
+      encodeCheckCacheSnapshot(*cache, time_system_.systemTime());
+
+  // The entries already cached are newer than the snapshot.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(500));
+  auto restored = makeCache();
+  restored->insert("new", makeResponse("3"));
+  EXPECT_EQ(restoreCheckCacheSnapshot(snapshot, time_system_.systemTime(),
+                                      *restored),
+            0);
+  EXPECT_EQ(restored->lookup("old"), nullptr);
+  EXPECT_EQ(restored->lookup("new")->info.consumer_number, "3");
+}
+
+TEST_F(CheckCacheSnapshotTest, MalformedSnapshot) {
+  auto cache = makeCache();
+  cache->insert("signature", makeResponse("1"));
+  const std::string snapshot =
+      encodeCheckCacheSnapshot(*cache, time_system_.systemTime());
+
+  auto restored = makeCache();
+  EXPECT_EQ(restoreCheckCacheSnapshot("not a snapshot",
+                                      time_system_.systemTime(), *restored),
+            0);
+  EXPECT_EQ(restoreCheckCacheSnapshot(snapshot.substr(0, snapshot.size() - 1),
+                                      time_system_.systemTime(), *restored),
+            0);
+  EXPECT_EQ(restored->lookup("signature"), nullptr);
+}
+
+TEST_F(CheckCacheSnapshotTest, SnapshotterWritesAndRestores) {
+  const std::string path =
+      TestEnvironment::temporaryPath("check_cache_snapshot");
+  std::remove(path.c_str());
+  NiceMock<Envoy::Event::MockDispatcher> dispatcher;
+  auto cache = makeCache();
+  {
+    auto* timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher);
+    CheckCacheSnapshotter snapshotter({{path, cache}},
+                                      std::chrono::milliseconds(100),
+                                      dispatcher, time_system_);
+    EXPECT_TRUE(timer->enabled());
+    cache->insert("first", makeResponse("1"));
+    timer->invokeCallback();
+    EXPECT_TRUE(timer->enabled());
+
+    // Restored from the periodic snapshot.
+    auto restored = makeCache();
+    new NiceMock<Envoy::Event::MockTimer>(&dispatcher);
+    CheckCacheSnapshotter next({{path, restored}},
+                               std::chrono::milliseconds(100), dispatcher,
+                               time_system_);
+    EXPECT_NE(restored->lookup("first"), nullptr);
+
+    cache->insert("last", makeResponse("2"));
+  }
+
+  // And from the last one, written when the snapshotters are destroyed.
+  auto restored = makeCache();
+  new NiceMock<Envoy::Event::MockTimer>(&dispatcher);
+  CheckCacheSnapshotter snapshotter({{path, restored}},
+                                    std::chrono::milliseconds(100),
+                                    dispatcher, time_system_);
+  EXPECT_NE(restored->lookup("last"), nullptr);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,112 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/circuit_breaker.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+CircuitBreaker::CircuitBreaker(uint32_t failure_threshold,
+                               std::chrono::milliseconds open_duration,
+                               Envoy::TimeSource& time_source,
+                               const CircuitBreakerStats& stats)
+    : failure_threshold_(failure_threshold),
+      open_duration_(open_duration),
+      time_source_(time_source),
+      stats_(stats) {}
+
+CircuitBreaker::~CircuitBreaker() {
+  if (state_ != State::Closed) {
+    stats_.open_.dec();
+  }
+}
+
+bool CircuitBreaker::allowCall() {
+  switch (state_) {
+    case State::Closed:
+      return true;
+    case State::Open:
+    case State::HalfOpen:
+      // Let one probe through per open duration. A probe that never reports
+      // back, e.g. it is cancelled, does not keep the breaker stuck.
+      if (time_source_.monotonicTime() - last_transition_time_ >=
+          open_duration_) {
+        transitTo(State::HalfOpen);
+        return true;
+      }
+      stats_.short_circuited_.inc();
+      return false;
+  }
+  return true;
+}
+
+void CircuitBreaker::onCallDone(const Status& status) {
+  // All 5xx errors and timeouts are already translated to Unavailable.
+  if (status.code() == StatusCode::kUnavailable ||
+      status.code() == StatusCode::kDeadlineExceeded) {
+    consecutive_failures_++;
+    if (state_ == State::HalfOpen ||
+        (state_ == State::Closed &&
+         consecutive_failures_ >= failure_threshold_)) {
+      transitTo(State::Open);
+    }
+    return;
+  }
+  // Internal errors are local, e.g. a missing token or a reset stream, and
+  // tell nothing about Service Control.
+  if (status.code() == StatusCode::kCancelled ||
+      status.code() == StatusCode::kInternal) {
+    return;
+  }
+
+  // Service Control is reachable.
+  consecutive_failures_ = 0;
+  if (state_ != State::Closed) {
+    transitTo(State::Closed);
+  }
+}
+
+void CircuitBreaker::transitTo(State state) {
+  last_transition_time_ = time_source_.monotonicTime();
+  if (state == state_) {
+    return;
+  }
+
+  switch (state) {
+    case State::Closed:
+      stats_.closed_.inc();
+      stats_.open_.dec();
+      break;
+    case State::Open:
+      stats_.opened_.inc();
+      if (state_ == State::Closed) {
+        stats_.open_.inc();
+      }
+      break;
+    case State::HalfOpen:
+      stats_.half_opened_.inc();
+      break;
+  }
+  state_ = state;
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,73 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+#include "envoy/common/time.h"
+#include "google/protobuf/stubs/status.h"
+#include "src/envoy/http/service_control/filter_stats.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// A circuit breaker for the calls to Service Control made by one worker.
+//
+// It opens after a number of consecutive Unavailable or DeadlineExceeded
+// calls. While it is open,
+// calls are short-circuited. After the open duration, a single probe call is
+// let through: the breaker closes if it succeeds and opens again if it fails.
+// Not thread safe.
+class CircuitBreaker {
+ public:
+  enum class State { Closed, Open, HalfOpen };
+
+  CircuitBreaker(uint32_t failure_threshold,
+                 std::chrono::milliseconds open_duration,
+                 Envoy::TimeSource& time_source,
+                 const CircuitBreakerStats& stats);
+  ~CircuitBreaker();
+
+  // Returns false if the call should be short-circuited.
+  bool allowCall();
+
+  // Records the result of a call that was allowed.
+  void onCallDone(const ::google::protobuf::util::Status& status);
+
+  State state() const { return state_; }
+
+ private:
+  void transitTo(State state);
+
+  const uint32_t failure_threshold_;
+  const std::chrono::milliseconds open_duration_;
+  Envoy::TimeSource& time_source_;
+  CircuitBreakerStats stats_;
+
+  State state_ = State::Closed;
+  uint32_t consecutive_failures_ = 0;
+  // When the breaker was opened, or when the last probe was sent.
+  Envoy::MonotonicTime last_transition_time_;
+};
+
+using CircuitBreakerPtr = std::unique_ptr<CircuitBreaker>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
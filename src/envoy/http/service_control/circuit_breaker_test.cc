@@ -0,0 +1,139 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/circuit_breaker.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+const Status kUnavailable(StatusCode::kUnavailable, "unavailable");
+
+class CircuitBreakerTest : public ::testing::Test {
+ protected:
+  CircuitBreakerTest()
+      : stats_(ServiceControlFilterStats::create("test", context_.scope_)),
+        breaker_(std::make_unique<CircuitBreaker>(
+            2, std::chrono::milliseconds(1000), time_system_,
+            stats_.check_circuit_breaker_)) {}
+
+  void openBreaker() {
+    EXPECT_TRUE(breaker_->allowCall());
+    breaker_->onCallDone(kUnavailable);
+    EXPECT_TRUE(breaker_->allowCall());
+    breaker_->onCallDone(kUnavailable);
+    EXPECT_EQ(breaker_->state(), CircuitBreaker::State::Open);
+  }
+
+  Envoy::Event::SimulatedTimeSystem time_system_;
+  testing::NiceMock<Envoy::Server::Configuration::MockFactoryContext> context_;
+  ServiceControlFilterStats stats_;
+  CircuitBreakerPtr breaker_;
+};
+
+TEST_F(CircuitBreakerTest, OpensAfterConsecutiveFailures) {
+  breaker_->onCallDone(kUnavailable);
+  // A success resets the count.
+  breaker_->onCallDone(OkStatus());
+  breaker_->onCallDone(kUnavailable);
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::Closed);
+
+  breaker_->onCallDone(kUnavailable);
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::Open);
+  EXPECT_FALSE(breaker_->allowCall());
+
+  EXPECT_EQ(stats_.check_circuit_breaker_.opened_.value(), 1);
+  EXPECT_EQ(stats_.check_circuit_breaker_.short_circuited_.value(), 1);
+  EXPECT_EQ(stats_.check_circuit_breaker_.open_.value(), 1);
+
+  breaker_.reset();
+  EXPECT_EQ(stats_.check_circuit_breaker_.open_.value(), 0);
+}
+
+TEST_F(CircuitBreakerTest, CancelledAndInternalErrorsIgnored) {
+  breaker_->onCallDone(kUnavailable);
+  breaker_->onCallDone(Status(StatusCode::kCancelled, "cancelled"));
+  breaker_->onCallDone(Status(StatusCode::kInternal, "no token"));
+  breaker_->onCallDone(kUnavailable);
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::Open);
+}
+
+TEST_F(CircuitBreakerTest, ProbeSucceeds) {
+  openBreaker();
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(999));
+  EXPECT_FALSE(breaker_->allowCall());
+
+  // One probe is let through after the open duration.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1));
+  EXPECT_TRUE(breaker_->allowCall());
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::HalfOpen);
+  EXPECT_FALSE(breaker_->allowCall());
+
+  breaker_->onCallDone(OkStatus());
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::Closed);
+  EXPECT_TRUE(breaker_->allowCall());
+
+  EXPECT_EQ(stats_.check_circuit_breaker_.opened_.value(), 1);
+  EXPECT_EQ(stats_.check_circuit_breaker_.half_opened_.value(), 1);
+  EXPECT_EQ(stats_.check_circuit_breaker_.closed_.value(), 1);
+  EXPECT_EQ(stats_.check_circuit_breaker_.short_circuited_.value(), 2);
+  EXPECT_EQ(stats_.check_circuit_breaker_.open_.value(), 0);
+}
+
+TEST_F(CircuitBreakerTest, ProbeFails) {
+  openBreaker();
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  EXPECT_TRUE(breaker_->allowCall());
+  breaker_->onCallDone(kUnavailable);
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::Open);
+
+  // The open duration starts again.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(999));
+  EXPECT_FALSE(breaker_->allowCall());
+
+  EXPECT_EQ(stats_.check_circuit_breaker_.opened_.value(), 2);
+  EXPECT_EQ(stats_.check_circuit_breaker_.open_.value(), 1);
+}
+
+TEST_F(CircuitBreakerTest, LostProbeReplaced) {
+  openBreaker();
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  EXPECT_TRUE(breaker_->allowCall());
+
+  // The probe never reports back, another one is let through later.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  EXPECT_TRUE(breaker_->allowCall());
+  EXPECT_EQ(breaker_->state(), CircuitBreaker::State::HalfOpen);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
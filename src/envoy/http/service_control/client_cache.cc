@@ -14,9 +14,16 @@
 
 #include "src/envoy/http/service_control/client_cache.h"
 
+#include <algorithm>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "source/common/buffer/zero_copy_input_stream_impl.h"
 #include "source/common/tracing/http_tracer_impl.h"
 #include "src/api_proxy/service_control/check_response_convert_utils.h"
 #include "src/api_proxy/service_control/request_builder.h"
+#include "src/api_proxy/utils/memory_bytes.h"
+#include "src/envoy/http/service_control/grpc_call.h"
 #include "src/envoy/http/service_control/http_call.h"
 
 namespace espv2 {
@@ -24,6 +31,7 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
+using ::espv2::api::envoy::v10::http::service_control::AggregationConfig;
 using ::espv2::api::envoy::v10::http::service_control::FilterConfig;
 using ::google::protobuf::util::OkStatus;
 using ::google::protobuf::util::Status;
@@ -33,10 +41,15 @@ using ::espv2::api_proxy::service_control::CheckResponseInfo;
 using ::espv2::api_proxy::service_control::QuotaResponseInfo;
 using ::espv2::api_proxy::service_control::ScResponseErrorType;
 using ::espv2::api_proxy::service_control::api_key::ApiKeyState;
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::SlotBytes;
+using ::espv2::api_proxy::utils::VectorBytes;
 using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
 using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::CheckError;
 using ::google::api::servicecontrol::v1::CheckRequest;
 using ::google::api::servicecontrol::v1::CheckResponse;
+using ::google::api::servicecontrol::v1::QuotaError;
 using ::google::api::servicecontrol::v1::ReportRequest;
 using ::google::api::servicecontrol::v1::ReportResponse;
 
@@ -56,13 +69,36 @@ constexpr uint32_t kCheckAggregationEntries = 10000;
 constexpr uint32_t kCheckAggregationFlushIntervalMs = 60000;
 constexpr uint32_t kCheckAggregationExpirationMs = 300000;
 
+// The shared check cache is disabled by default.
+constexpr uint32_t kSharedCheckCacheEntries = 0;
+// Shared check cache entries are not refreshed ahead by default.
+constexpr uint32_t kCheckRefreshAheadMs = 0;
+// Stale check responses are not served by default.
+constexpr uint32_t kCheckStaleMs = 0;
+// The negative check cache is disabled by default.
+constexpr uint32_t kNegativeCheckCacheEntries = 0;
+constexpr uint32_t kNegativeCheckCacheExpirationMs = 30000;
+// Check call coalescing is disabled by default.
+constexpr bool kCoalesceCheckCalls = false;
+
 // Default config for quota aggregator
 constexpr uint32_t kQuotaAggregationEntries = 10000;
 constexpr uint32_t kQuotaAggregationFlushIntervalMs = 1000;
+// The quota refresh interval does not adapt by default.
+constexpr uint32_t kQuotaMaxRefreshIntervalMs = 0;
+// Exhausted quota keys are only denied by the quota cache by default.
+constexpr bool kQuotaLocalLimit = false;
 
 // Default config for report aggregator
 constexpr uint32_t kReportAggregationEntries = 10000;
 constexpr uint32_t kReportAggregationFlushIntervalMs = 1000;
+// Reports are split to stay under the Service Control payload limit.
+constexpr uint32_t kReportMaxOperations = 0;
+constexpr uint32_t kReportMaxBytes = 1024 * 1024;
+// Reports are not pre-aggregated by default.
+constexpr uint32_t kReportPreaggregationEntries = 0;
+constexpr uint32_t kReportPreaggregationMaxConsumers = 0;
+constexpr bool kBatchReports = false;
 
 // The default connection timeout for check requests.
 constexpr uint32_t kCheckDefaultTimeoutInMs = 1000;
@@ -79,9 +115,81 @@ constexpr uint32_t kAllocateQuotaDefaultNumberOfRetries = 1;
 // The default number of retries for report calls.
 constexpr uint32_t kReportDefaultNumberOfRetries = 5;
 
+// By default, calls are retried immediately and without a retry budget.
+constexpr uint32_t kDefaultRetryBaseIntervalMs = 0;
+constexpr uint32_t kDefaultRetryMaxIntervalFactor = 10;
+constexpr uint32_t kDefaultRetryBudgetPercent = 0;
+
+// The circuit breaker is disabled by default.
+constexpr uint32_t kDefaultCircuitBreakerFailureThreshold = 0;
+constexpr uint32_t kDefaultCircuitBreakerOpenDurationMs = 10000;
+
+// The default adaptive limit of the Check calls in flight, if they are
+// limited.
+constexpr uint32_t kDefaultCheckConcurrencyInitialLimit = 20;
+constexpr uint32_t kDefaultCheckConcurrencyMinLimit = 1;
+constexpr uint32_t kDefaultCheckConcurrencyMaxLimit = 1000;
+
+// The default interval of the connection warm-up, if the connections are
+// warmed up.
+constexpr uint32_t kDefaultWarmUpKeepAliveIntervalMs = 60000;
+
+// The default gzip level of the Report request bodies, if they are compressed.
+constexpr uint32_t kDefaultReportCompressionLevel = 6;
+
+// The default age limit and replay interval of the spooled Report requests, if
+// the spool is enabled.
+constexpr uint32_t kDefaultReportSpoolMaxAgeMs = 600000;
+constexpr uint32_t kDefaultReportSpoolReplayIntervalMs = 100;
+
+// The default latency percentile after which Check calls are hedged, if they
+// are hedged.
+constexpr uint32_t kDefaultCheckHedgingPercentile = 95;
+
+// The default ejection of the endpoints, if the endpoint is selected per
+// request.
+constexpr uint32_t kDefaultEndpointEjectionFailures = 5;
+constexpr uint32_t kDefaultEndpointEjectionDurationMs = 30000;
+
 // The default value for network_fail_open flag.
 constexpr bool kDefaultNetworkFailOpen = true;
 
+// How often the client statistics are added to the cache stats, and the
+// status of the cache is published for the admin handler.
+constexpr std::chrono::seconds kStatsInterval(1);
+
+// The status of the calls short-circuited by an open circuit breaker.
+Status circuitBreakerOpenStatus() {
+  return Status(StatusCode::kUnavailable,
+                "Service Control circuit breaker is open");
+}
+
+// The status of the Check calls rejected by the concurrency limit.
+Status concurrencyLimitStatus() {
+  return Status(StatusCode::kUnavailable,
+                "Service Control Check concurrency limit is reached");
+}
+
+// Adds to `counter` the growth of a client statistic since its last pull.
+void addGrowth(Envoy::Stats::Counter& counter, uint64_t value,
+               uint64_t last_value) {
+  if (value > last_value) {
+    counter.add(value - last_value);
+  }
+}
+
+absl::string_view circuitBreakerStateName(CircuitBreaker::State state) {
+  switch (state) {
+    case CircuitBreaker::State::Closed:
+      return "closed";
+    case CircuitBreaker::State::Open:
+      return "open";
+    case CircuitBreaker::State::HalfOpen:
+      return "half_open";
+  }
+  return "";
+}
+
 // Convert http error status into the ScResponseError.
 api_proxy::service_control::ScResponseError failCallStatusToScResponseError(
     const Status& status) {
@@ -90,23 +198,21 @@ api_proxy::service_control::ScResponseError failCallStatusToScResponseError(
       /*is_network_error=*/true, ScResponseErrorType::ERROR_TYPE_UNSPECIFIED};
 }
 
-// Generates CheckAggregationOptions.
-CheckAggregationOptions getCheckAggregationOptions() {
-  return CheckAggregationOptions(kCheckAggregationEntries,
-                                 kCheckAggregationFlushIntervalMs,
-                                 kCheckAggregationExpirationMs);
-}
-
-// Generates QuotaAggregationOptions.
-QuotaAggregationOptions getQuotaAggregationOptions() {
-  return QuotaAggregationOptions(kQuotaAggregationEntries,
-                                 kQuotaAggregationFlushIntervalMs);
-}
-
-// Generates ReportAggregationOptions.
-ReportAggregationOptions getReportAggregationOptions() {
-  return ReportAggregationOptions(kReportAggregationEntries,
-                                  kReportAggregationFlushIntervalMs);
+// Returns the aggregation option from the service config if it is set, then
+// from the filter config if it is set, otherwise the default value.
+template <class Value, class Wrapper>
+Value getAggregationOption(const AggregationConfig& service_config,
+                           const AggregationConfig& filter_config,
+                           bool (AggregationConfig::*has_option)() const,
+                           const Wrapper& (AggregationConfig::*option)() const,
+                           Value default_value) {
+  if ((service_config.*has_option)()) {
+    return (service_config.*option)().value();
+  }
+  if ((filter_config.*has_option)()) {
+    return (filter_config.*option)().value();
+  }
+  return default_value;
 }
 
 // A timer object to wrap PeriodicTimer
@@ -135,12 +241,70 @@ class EnvoyPeriodicTimer
   Envoy::Event::TimerPtr timer_;
 };
 
+// The state of a Check call made to the aggregation cache. Allocated once
+// per call and freed by the done callback of the aggregation cache. The
+// callbacks of the call only capture a pointer to it, so they fit in the
+// small buffer of std::function and are not allocated.
+struct CheckCallState {
+  // Released to handleCheckResponse once the response is complete.
+  ArenaCheckResponsePtr response = std::make_unique<ArenaCheckResponse>();
+  CheckDoneFunc on_done;
+  std::string signature;
+  std::string consumer_signature;
+  // The response and the done function of the call made on an aggregation
+  // cache miss.
+  CheckResponse* transport_response{};
+  TransportDoneFunc transport_done;
+};
+
+// The transport state of a Check call, on the stack of callCheck().
+struct CheckTransportState {
+  CheckCallState* call;
+  Envoy::Tracing::Span& parent_span;
+  absl::optional<Envoy::MonotonicTime> deadline;
+  CancelFunc cancel_fn;
+  // The transport is only called, within Check(), on an aggregation cache
+  // miss.
+  bool called = false;
+};
+
+// The source of a check request already built.
+class BuiltCheckRequest : public CheckRequestSource {
+ public:
+  explicit BuiltCheckRequest(const CheckRequest& request)
+      : request_(request) {}
+
+  std::string signature() override {
+    return SharedCheckCache::signature(request_);
+  }
+  std::string consumerSignature() override {
+    return SharedCheckCache::consumerSignature(request_);
+  }
+  const CheckRequest& request() override { return request_; }
+
+ private:
+  const CheckRequest& request_;
+};
+
+// A PeriodicTimer run by the flush scheduler of the worker.
+class ScheduledPeriodicTimer
+    : public ::google::service_control_client::PeriodicTimer {
+ public:
+  explicit ScheduledPeriodicTimer(FlushScheduler::HandlePtr handle)
+      : handle_(std::move(handle)) {}
+
+  // Cancels the flush.
+  virtual void Stop() override { handle_.reset(); }
+
+ private:
+  FlushScheduler::HandlePtr handle_;
+};
+
 }  // namespace
 
 template <class Response>
-Status ClientCache::processScCallTransportStatus(const Status& status,
-                                                 Response* resp,
-                                                 const std::string& body) {
+Status ClientCache::processScCallTransportStatus(
+    const Status& status, Response* resp, Envoy::Buffer::Instance& body) {
   std::string callName;
   if (std::is_same<Response, CheckResponse>::value) {
     callName = "check";
@@ -152,11 +316,16 @@ Status ClientCache::processScCallTransportStatus(const Status& status,
 
   if (!status.ok()) {
     ENVOY_LOG(error, "Failed to call {}, error: {}, str body: {}", callName,
-              status.ToString(), body);
+              status.ToString(), body.toString());
   } else {
-    if (!resp->ParseFromString(body)) {
-      ENVOY_LOG(error, "Failed to call {}, error: {}, str body: {}", callName,
-                "invalid response", body);
+    // Parse from the body slices without copying them into a string.
+    const uint64_t body_length = body.length();
+    Envoy::Buffer::ZeroCopyInputStreamImpl stream;
+    stream.move(body);
+    stream.finish();
+    if (!resp->ParseFromZeroCopyStream(&stream)) {
+      ENVOY_LOG(error, "Failed to call {}, error: {}, body length: {}",
+                callName, "invalid response", body_length);
       return Status(StatusCode::kInvalidArgument,
                     std::string("Invalid response"));
     }
@@ -174,6 +343,10 @@ void ClientCache::initHttpRequestSetting(const FilterConfig& filter_config) {
     check_retries_ = kCheckDefaultNumberOfRetries;
     quota_retries_ = kAllocateQuotaDefaultNumberOfRetries;
     report_retries_ = kReportDefaultNumberOfRetries;
+    retry_policy_ = {kDefaultRetryBaseIntervalMs, kDefaultRetryBaseIntervalMs,
+                     kDefaultRetryBudgetPercent};
+    circuit_breaker_failure_threshold_ = kDefaultCircuitBreakerFailureThreshold;
+    circuit_breaker_open_duration_ms_ = kDefaultCircuitBreakerOpenDurationMs;
     return;
   }
   const auto& sc_calling_config = filter_config.sc_calling_config();
@@ -199,6 +372,146 @@ void ClientCache::initHttpRequestSetting(const FilterConfig& filter_config) {
   report_retries_ = sc_calling_config.has_report_retries()
                         ? sc_calling_config.report_retries().value()
                         : kReportDefaultNumberOfRetries;
+
+  retry_policy_.base_interval_ms =
+      sc_calling_config.has_retry_base_interval_ms()
+          ? sc_calling_config.retry_base_interval_ms().value()
+          : kDefaultRetryBaseIntervalMs;
+  retry_policy_.max_interval_ms =
+      sc_calling_config.has_retry_max_interval_ms()
+          ? sc_calling_config.retry_max_interval_ms().value()
+          : retry_policy_.base_interval_ms * kDefaultRetryMaxIntervalFactor;
+  retry_policy_.budget_percent =
+      sc_calling_config.has_retry_budget_percent()
+          ? sc_calling_config.retry_budget_percent().value()
+          : kDefaultRetryBudgetPercent;
+
+  circuit_breaker_failure_threshold_ =
+      sc_calling_config.has_circuit_breaker_failure_threshold()
+          ? sc_calling_config.circuit_breaker_failure_threshold().value()
+          : kDefaultCircuitBreakerFailureThreshold;
+  circuit_breaker_open_duration_ms_ =
+      sc_calling_config.has_circuit_breaker_open_duration_ms()
+          ? sc_calling_config.circuit_breaker_open_duration_ms().value()
+          : kDefaultCircuitBreakerOpenDurationMs;
+}
+
+void ClientCache::initGrpcCallFactories(
+    const FilterConfig& filter_config, Envoy::Stats::Scope& scope,
+    Envoy::Upstream::ClusterManager& cm, Envoy::TimeSource& time_source,
+    Envoy::Event::Dispatcher& dispatcher,
+    std::function<const std::string&()> sc_authorization_fn,
+    std::function<const std::string&()> quota_authorization_fn) {
+  const auto& uri = filter_config.service_control_uri();
+  auto check_call_factory = std::make_unique<GrpcCallFactoryImpl>(
+      createGrpcCallClient(cm, uri, scope), dispatcher,
+      kServiceControllerService, kCheckMethod, sc_authorization_fn,
+      check_timeout_ms_, check_retries_, retry_policy_, time_source);
+  check_call_factory->enableStats(filter_stats_.check_call_);
+  auto quota_call_factory = std::make_unique<GrpcCallFactoryImpl>(
+      createGrpcCallClient(cm, uri, scope), dispatcher,
+      kQuotaControllerService, kAllocateQuotaMethod, quota_authorization_fn,
+      quota_timeout_ms_, quota_retries_, retry_policy_, time_source);
+  quota_call_factory->enableStats(filter_stats_.allocate_quota_call_);
+  auto report_call_factory = std::make_unique<GrpcCallFactoryImpl>(
+      createGrpcCallClient(cm, uri, scope), dispatcher,
+      kServiceControllerService, kReportMethod, sc_authorization_fn,
+      report_timeout_ms_, report_retries_, retry_policy_, time_source);
+  report_call_factory->enableStats(filter_stats_.report_call_);
+  if (filter_config.sc_calling_config().disable_tracing()) {
+    check_call_factory->disableTracing();
+    quota_call_factory->disableTracing();
+    report_call_factory->disableTracing();
+  }
+  check_call_factory_ = std::move(check_call_factory);
+  quota_call_factory_ = std::move(quota_call_factory);
+  report_call_factory_ = std::move(report_call_factory);
+}
+
+AggregationOptions::AggregationOptions(
+    const ::espv2::api::envoy::v10::http::service_control::Service& config,
+    const FilterConfig& filter_config) {
+  const AggregationConfig& service_agg = config.aggregation_config();
+  const AggregationConfig& filter_agg = filter_config.aggregation_config();
+
+  check_cache_entries = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_check_cache_entries,
+      &AggregationConfig::check_cache_entries, kCheckAggregationEntries);
+  check_flush_interval_ms = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_check_flush_interval_ms,
+      &AggregationConfig::check_flush_interval_ms,
+      kCheckAggregationFlushIntervalMs);
+  check_expiration_ms = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_check_expiration_ms,
+      &AggregationConfig::check_expiration_ms, kCheckAggregationExpirationMs);
+
+  quota_cache_entries = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_quota_cache_entries,
+      &AggregationConfig::quota_cache_entries, kQuotaAggregationEntries);
+  quota_refresh_interval_ms = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_quota_refresh_interval_ms,
+      &AggregationConfig::quota_refresh_interval_ms,
+      kQuotaAggregationFlushIntervalMs);
+  quota_max_refresh_interval_ms = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_quota_max_refresh_interval_ms,
+      &AggregationConfig::quota_max_refresh_interval_ms,
+      kQuotaMaxRefreshIntervalMs);
+
+  report_cache_entries = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_report_cache_entries,
+      &AggregationConfig::report_cache_entries, kReportAggregationEntries);
+  report_flush_interval_ms = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_report_flush_interval_ms,
+      &AggregationConfig::report_flush_interval_ms,
+      kReportAggregationFlushIntervalMs);
+  shared_check_cache_entries = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_shared_check_cache_entries,
+      &AggregationConfig::shared_check_cache_entries,
+      kSharedCheckCacheEntries);
+  check_refresh_ahead_ms = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_check_refresh_ahead_ms,
+      &AggregationConfig::check_refresh_ahead_ms, kCheckRefreshAheadMs);
+  check_stale_ms = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_check_stale_ms,
+      &AggregationConfig::check_stale_ms, kCheckStaleMs);
+  negative_check_cache_entries = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_negative_check_cache_entries,
+      &AggregationConfig::negative_check_cache_entries,
+      kNegativeCheckCacheEntries);
+  negative_check_cache_expiration_ms = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_negative_check_cache_expiration_ms,
+      &AggregationConfig::negative_check_cache_expiration_ms,
+      kNegativeCheckCacheExpirationMs);
+  report_max_operations = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_report_max_operations,
+      &AggregationConfig::report_max_operations, kReportMaxOperations);
+  report_max_bytes = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_report_max_bytes,
+      &AggregationConfig::report_max_bytes, kReportMaxBytes);
+  report_preaggregation_entries = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_report_preaggregation_entries,
+      &AggregationConfig::report_preaggregation_entries,
+      kReportPreaggregationEntries);
+  report_preaggregation_max_consumers = getAggregationOption(
+      service_agg, filter_agg,
+      &AggregationConfig::has_report_preaggregation_max_consumers,
+      &AggregationConfig::report_preaggregation_max_consumers,
+      kReportPreaggregationMaxConsumers);
+  batch_reports = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_batch_reports,
+      &AggregationConfig::batch_reports, kBatchReports);
+  coalesce_check_calls = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_coalesce_check_calls,
+      &AggregationConfig::coalesce_check_calls, kCoalesceCheckCalls);
+  quota_local_limit = getAggregationOption(
+      service_agg, filter_agg, &AggregationConfig::has_quota_local_limit,
+      &AggregationConfig::quota_local_limit, kQuotaLocalLimit);
 }
 
 void ClientCache::collectCallStatus(CallStatusStats& call_stats,
@@ -211,31 +524,182 @@ ClientCache::ClientCache(
     const FilterConfig& filter_config, const std::string& stats_prefix,
     Envoy::Stats::Scope& scope, Envoy::Upstream::ClusterManager& cm,
     Envoy::TimeSource& time_source, Envoy::Event::Dispatcher& dispatcher,
-    std::function<const std::string&()> sc_token_fn,
-    std::function<const std::string&()> quota_token_fn)
+    std::function<const std::string&()> sc_authorization_fn,
+    std::function<const std::string&()> quota_authorization_fn,
+    SharedCheckCacheSharedPtr shared_check_cache,
+    SharedCheckCacheSharedPtr stale_check_cache,
+    SharedCheckCacheSharedPtr negative_check_cache,
+    ClientCacheStatusSlotSharedPtr status_slot,
+    FlushSchedulerSharedPtr flush_scheduler)
     : config_(config),
+      aggregation_options_(config, filter_config),
       filter_stats_(ServiceControlFilterStats::create(stats_prefix, scope)),
-      time_source_(time_source) {
-  ServiceControlClientOptions options(getCheckAggregationOptions(),
-                                      getQuotaAggregationOptions(),
-                                      getReportAggregationOptions());
+      memory_stats_(ServiceMemoryStats::create(stats_prefix,
+                                               config.service_name(), scope)),
+      time_source_(time_source),
+      shared_check_cache_(shared_check_cache),
+      stale_check_cache_(stale_check_cache),
+      negative_check_cache_(negative_check_cache),
+      status_slot_(std::move(status_slot)) {
+  ServiceControlClientOptions options(
+      CheckAggregationOptions(aggregation_options_.check_cache_entries,
+                              aggregation_options_.check_flush_interval_ms,
+                              aggregation_options_.check_expiration_ms),
+      QuotaAggregationOptions(aggregation_options_.quota_cache_entries,
+                              aggregation_options_.quota_refresh_interval_ms),
+      ReportAggregationOptions(aggregation_options_.report_cache_entries,
+                               aggregation_options_.report_flush_interval_ms));
+  filter_stats_.check_cache_.capacity_.add(
+      aggregation_options_.check_cache_entries);
+  filter_stats_.quota_cache_.capacity_.add(
+      aggregation_options_.quota_cache_entries);
+  filter_stats_.report_cache_.capacity_.add(
+      aggregation_options_.report_cache_entries);
+  filter_stats_.client_cache_.live_.inc();
 
   initHttpRequestSetting(filter_config);
-  check_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
-      cm, dispatcher, filter_config.service_control_uri(),
-      absl::StrCat("/", config_.service_name(), ":check"), sc_token_fn,
-      check_timeout_ms_, check_retries_, time_source,
-      "Service Control remote call: Check");
-  quota_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
-      cm, dispatcher, filter_config.service_control_uri(),
-      absl::StrCat("/", config_.service_name(), ":allocateQuota"),
-      quota_token_fn, quota_timeout_ms_, quota_retries_, time_source,
-      "Service Control remote call: Allocate Quota");
-  report_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
-      cm, dispatcher, filter_config.service_control_uri(),
-      absl::StrCat("/", config_.service_name(), ":report"), sc_token_fn,
-      report_timeout_ms_, report_retries_, time_source,
-      "Service Control remote call: Report");
+  if (circuit_breaker_failure_threshold_ > 0) {
+    check_circuit_breaker_ = std::make_unique<CircuitBreaker>(
+        circuit_breaker_failure_threshold_,
+        std::chrono::milliseconds(circuit_breaker_open_duration_ms_),
+        time_source, filter_stats_.check_circuit_breaker_);
+    quota_circuit_breaker_ = std::make_unique<CircuitBreaker>(
+        circuit_breaker_failure_threshold_,
+        std::chrono::milliseconds(circuit_breaker_open_duration_ms_),
+        time_source, filter_stats_.quota_circuit_breaker_);
+  }
+  if (filter_config.sc_calling_config().has_check_concurrency_limit()) {
+    const auto& limit =
+        filter_config.sc_calling_config().check_concurrency_limit();
+    check_concurrency_limiter_ = std::make_unique<ConcurrencyLimiter>(
+        limit.initial_limit() > 0 ? limit.initial_limit()
+                                  : kDefaultCheckConcurrencyInitialLimit,
+        limit.min_limit() > 0 ? limit.min_limit()
+                              : kDefaultCheckConcurrencyMinLimit,
+        limit.max_limit() > 0 ? limit.max_limit()
+                              : kDefaultCheckConcurrencyMaxLimit,
+        filter_stats_.check_concurrency_limit_);
+  }
+  if (aggregation_options_.quota_max_refresh_interval_ms >
+      aggregation_options_.quota_refresh_interval_ms) {
+    quota_refresh_scheduler_ = std::make_unique<QuotaRefreshScheduler>(
+        std::chrono::milliseconds(
+            aggregation_options_.quota_refresh_interval_ms),
+        std::chrono::milliseconds(
+            aggregation_options_.quota_max_refresh_interval_ms),
+        aggregation_options_.quota_cache_entries, time_source);
+  }
+  if (aggregation_options_.quota_local_limit) {
+    quota_token_buckets_ = std::make_unique<QuotaTokenBuckets>(
+        std::chrono::milliseconds(
+            aggregation_options_.quota_refresh_interval_ms),
+        aggregation_options_.quota_cache_entries, time_source);
+  }
+  if (filter_config.sc_calling_config().grpc_transport()) {
+    initGrpcCallFactories(filter_config, scope, cm, time_source, dispatcher,
+                          sc_authorization_fn, quota_authorization_fn);
+  } else {
+    auto check_call_factory = std::make_unique<HttpCallFactoryImpl>(
+        cm, dispatcher, filter_config.service_control_uri(),
+        absl::StrCat("/", config_.service_name(), ":check"),
+        sc_authorization_fn, check_timeout_ms_, check_retries_, retry_policy_,
+        time_source, "Service Control remote call: Check");
+    check_call_factory->enableStats(filter_stats_.check_call_);
+    if (filter_config.sc_calling_config().has_check_hedging()) {
+      const auto& hedging = filter_config.sc_calling_config().check_hedging();
+      check_call_factory->enableHedging(
+          {hedging.percentile() > 0 ? hedging.percentile()
+                                    : kDefaultCheckHedgingPercentile,
+           hedging.min_delay_ms(), hedging.max_delay_ms(),
+           filter_stats_.filter_.check_hedged_,
+           filter_stats_.filter_.check_hedge_won_});
+    }
+    auto quota_call_factory = std::make_unique<HttpCallFactoryImpl>(
+        cm, dispatcher, filter_config.service_control_uri(),
+        absl::StrCat("/", config_.service_name(), ":allocateQuota"),
+        quota_authorization_fn, quota_timeout_ms_, quota_retries_,
+        retry_policy_, time_source,
+        "Service Control remote call: Allocate Quota");
+    quota_call_factory->enableStats(filter_stats_.allocate_quota_call_);
+    auto report_call_factory = std::make_unique<HttpCallFactoryImpl>(
+        cm, dispatcher, filter_config.service_control_uri(),
+        absl::StrCat("/", config_.service_name(), ":report"),
+        sc_authorization_fn, report_timeout_ms_, report_retries_,
+        retry_policy_, time_source, "Service Control remote call: Report");
+    report_call_factory->enableStats(filter_stats_.report_call_);
+    if (filter_config.sc_calling_config().has_report_compression()) {
+      const auto& compression =
+          filter_config.sc_calling_config().report_compression();
+      report_call_factory->enableCompression(
+          {compression.level() > 0 ? compression.level()
+                                   : kDefaultReportCompressionLevel,
+           compression.min_body_bytes(), filter_stats_.report_compression_});
+    }
+    if (filter_config.sc_calling_config().disable_tracing()) {
+      check_call_factory->disableTracing();
+      quota_call_factory->disableTracing();
+      report_call_factory->disableTracing();
+    }
+    if (filter_config.sc_calling_config().has_endpoint_selection()) {
+      const auto& selection =
+          filter_config.sc_calling_config().endpoint_selection();
+      const std::vector<::espv2::api::envoy::v10::http::common::HttpUri>
+          additional_uris(selection.additional_uris().begin(),
+                          selection.additional_uris().end());
+      const HttpCallEndpointSelection options{
+          selection.ejection_failures() > 0 ? selection.ejection_failures()
+                                            : kDefaultEndpointEjectionFailures,
+          selection.ejection_duration_ms() > 0
+              ? selection.ejection_duration_ms()
+              : kDefaultEndpointEjectionDurationMs};
+      check_call_factory->enableEndpointSelection(additional_uris, options);
+      quota_call_factory->enableEndpointSelection(additional_uris, options);
+      report_call_factory->enableEndpointSelection(additional_uris, options);
+    }
+    if (filter_config.sc_calling_config().call_pool_size() > 0) {
+      const uint32_t call_pool_size =
+          filter_config.sc_calling_config().call_pool_size();
+      check_call_factory->enableCallPool(call_pool_size);
+      quota_call_factory->enableCallPool(call_pool_size);
+      report_call_factory->enableCallPool(call_pool_size);
+    }
+    // The calls of the three factories share the connections of the
+    // cluster, warmed up once.
+    if (filter_config.sc_calling_config().has_connection_warm_up()) {
+      const auto& warm_up =
+          filter_config.sc_calling_config().connection_warm_up();
+      check_call_factory->enableWarmUp(
+          {warm_up.connections(),
+           std::chrono::milliseconds(warm_up.keep_alive_interval_ms() > 0
+                                         ? warm_up.keep_alive_interval_ms()
+                                         : kDefaultWarmUpKeepAliveIntervalMs)});
+    }
+    check_call_factory_ = std::move(check_call_factory);
+    quota_call_factory_ = std::move(quota_call_factory);
+    report_call_factory_ = std::move(report_call_factory);
+  }
+
+  if (filter_config.sc_calling_config().has_report_spool()) {
+    const auto& spool = filter_config.sc_calling_config().report_spool();
+    report_spool_ = std::make_unique<ReportSpool>(
+        spool.max_bytes(),
+        std::chrono::milliseconds(spool.max_age_ms() > 0
+                                      ? spool.max_age_ms()
+                                      : kDefaultReportSpoolMaxAgeMs),
+        std::chrono::milliseconds(spool.replay_interval_ms() > 0
+                                      ? spool.replay_interval_ms()
+                                      : kDefaultReportSpoolReplayIntervalMs),
+        dispatcher, time_source, filter_stats_.report_spool_,
+        [this](const std::string& body, ReportSpool::DoneFunc on_done) {
+          auto* response = new ReportResponse;
+          sendSerializedReport(std::make_shared<const std::string>(body),
+                               response,
+                               [response, on_done](const Status& status) {
+                                 delete response;
+                                 on_done(status);
+                               });
+        });
+  }
 
   // Note: Check transport is also defined per request.
   // But this must be defined, it will be called on each flush of the cache
@@ -243,15 +707,25 @@ ClientCache::ClientCache(
   options.check_transport = [this](const CheckRequest& request,
                                    CheckResponse* response,
                                    TransportDoneFunc on_done) {
+    filter_stats_.check_cache_.flushed_.inc();
+    if (check_circuit_breaker_ && !check_circuit_breaker_->allowCall()) {
+      on_done(circuitBreakerOpenStatus());
+      return;
+    }
+    // The refreshed responses of the hot keys are the known-good ones.
+    std::string signature;
+    if (stale_check_cache_) {
+      signature = SharedCheckCache::signature(request);
+    }
     // Don't support tracing on this transport
     auto& null_span = Envoy::Tracing::NullSpan::instance();
     auto* call = check_call_factory_->createHttpCall(
         request, null_span,
-        [this, response, on_done](const Status& status,
-                                  const std::string& body) {
+        [this, response, on_done, signature](const Status& status,
+                                             Envoy::Buffer::Instance& body) {
           Status final_status = processScCallTransportStatus<CheckResponse>(
               status, response, body);
-          collectCallStatus(filter_stats_.check_, final_status.code());
+          onCheckCallDone(signature, final_status, *response);
           on_done(final_status);
         });
     call->call();
@@ -260,16 +734,48 @@ ClientCache::ClientCache(
   options.quota_transport = [this](const AllocateQuotaRequest& request,
                                    AllocateQuotaResponse* response,
                                    TransportDoneFunc on_done) {
+    filter_stats_.quota_cache_.flushed_.inc();
+    std::string key;
+    if (quota_refresh_scheduler_ || quota_token_buckets_) {
+      key = QuotaRefreshScheduler::key(request);
+    }
+    if (quota_refresh_scheduler_) {
+      if (!quota_refresh_scheduler_->shouldRefresh(key, response)) {
+        filter_stats_.filter_.quota_refresh_skipped_.inc();
+        on_done(OkStatus());
+        return;
+      }
+    }
+    if (quota_circuit_breaker_ && !quota_circuit_breaker_->allowCall()) {
+      on_done(circuitBreakerOpenStatus());
+      return;
+    }
+    QuotaTokenBuckets::Amounts requested;
+    if (quota_token_buckets_) {
+      requested = QuotaTokenBuckets::amounts(request);
+    }
     // Don't support tracing on this transport
     auto& null_span = Envoy::Tracing::NullSpan::instance();
     auto* call = quota_call_factory_->createHttpCall(
         request, null_span,
-        [this, response, on_done](const Status& status,
-                                  const std::string& body) {
+        [this, response, on_done, key = std::move(key),
+         requested = std::move(requested)](const Status& status,
+                                           Envoy::Buffer::Instance& body) {
           Status final_status =
               processScCallTransportStatus<AllocateQuotaResponse>(
                   status, response, body);
           collectCallStatus(filter_stats_.allocate_quota_, final_status.code());
+          if (quota_circuit_breaker_) {
+            quota_circuit_breaker_->onCallDone(final_status);
+          }
+          if (quota_refresh_scheduler_) {
+            quota_refresh_scheduler_->onRefreshDone(key, final_status,
+                                                    *response);
+          }
+          if (quota_token_buckets_) {
+            quota_token_buckets_->onRefreshDone(key, requested, final_status,
+                                                *response);
+          }
           on_done(final_status);
         });
     call->call();
@@ -278,30 +784,187 @@ ClientCache::ClientCache(
   options.report_transport = [this](const ReportRequest& request,
                                     ReportResponse* response,
                                     TransportDoneFunc on_done) {
-    // Don't support tracing on this transport
-    auto& null_span = Envoy::Tracing::NullSpan::instance();
-    auto* call = report_call_factory_->createHttpCall(
-        request, null_span,
-        [this, response, on_done](const Status& status,
-                                  const std::string& body) {
-          Status final_status = processScCallTransportStatus<ReportResponse>(
-              status, response, body);
-          collectCallStatus(filter_stats_.report_, final_status.code());
+    filter_stats_.report_cache_.flushed_.inc();
+    std::vector<ReportRequest> split_requests = splitReportRequest(
+        request, aggregation_options_.report_max_operations,
+        aggregation_options_.report_max_bytes);
+    if (split_requests.empty()) {
+      callReportTransport(request, response, on_done);
+      return;
+    }
 
-          on_done(final_status);
-        });
-    call->call();
+    ENVOY_LOG(debug, "Split Report with {} operations into {} calls",
+              request.operations_size(), split_requests.size());
+    // Each part is sent and retried by its own call. The first failure, if
+    // any, is reported once all the calls are done.
+    struct SplitState {
+      size_t pending_calls;
+      Status status;
+      std::vector<ReportResponse> responses;
+    };
+    auto state = std::make_shared<SplitState>();
+    state->pending_calls = split_requests.size();
+    state->responses.resize(split_requests.size());
+    for (size_t i = 0; i < split_requests.size(); ++i) {
+      callReportTransport(
+          split_requests[i], &state->responses[i],
+          [state, response, on_done](const Status& status) {
+            if (!status.ok() && state->status.ok()) {
+              state->status = status;
+            }
+            if (--state->pending_calls == 0) {
+              *response = std::move(state->responses.front());
+              on_done(state->status);
+            }
+          });
+    }
   };
 
-  options.periodic_timer = [&dispatcher](int interval_ms,
-                                         std::function<void()> callback)
-      -> std::unique_ptr<::google::service_control_client::PeriodicTimer> {
-    return std::unique_ptr<::google::service_control_client::PeriodicTimer>(
-        new EnvoyPeriodicTimer(dispatcher, interval_ms, callback));
-  };
+  if (flush_scheduler) {
+    options.periodic_timer = [flush_scheduler](int interval_ms,
+                                               std::function<void()> callback)
+        -> std::unique_ptr<::google::service_control_client::PeriodicTimer> {
+      return std::make_unique<ScheduledPeriodicTimer>(
+          flush_scheduler->schedule(std::chrono::milliseconds(interval_ms),
+                                    std::move(callback)));
+    };
+  } else {
+    options.periodic_timer = [&dispatcher](int interval_ms,
+                                           std::function<void()> callback)
+        -> std::unique_ptr<::google::service_control_client::PeriodicTimer> {
+      return std::unique_ptr<::google::service_control_client::PeriodicTimer>(
+          new EnvoyPeriodicTimer(dispatcher, interval_ms, callback));
+    };
+  }
 
   client_ = ::google::service_control_client::CreateServiceControlClient(
       config_.service_name(), config_.service_config_id(), options);
+
+  if (flush_scheduler) {
+    stats_flush_ = flush_scheduler->schedule(kStatsInterval,
+                                             [this]() { onStatsTimer(); });
+  } else {
+    stats_timer_ = dispatcher.createTimer([this]() { onStatsTimer(); });
+  }
+  onStatsTimer();
+}
+
+ClientCacheStatus ClientCache::status() const {
+  ClientCacheStatus status;
+  status.check_calls = check_calls_;
+  status.check_cache_hits = check_cache_hits_;
+  status.quota_calls = quota_calls_;
+  status.report_calls = report_calls_;
+  if (check_call_factory_) {
+    status.check_calls_in_flight = check_call_factory_->activeCalls();
+  }
+  if (quota_call_factory_) {
+    status.quota_calls_in_flight = quota_call_factory_->activeCalls();
+  }
+  if (report_call_factory_) {
+    status.report_calls_in_flight = report_call_factory_->activeCalls();
+  }
+  status.coalesced_checks = inflight_checks_.size();
+  status.revalidating_checks = revalidating_checks_.size();
+  if (check_circuit_breaker_) {
+    status.check_circuit_breaker =
+        circuitBreakerStateName(check_circuit_breaker_->state());
+  }
+  if (quota_circuit_breaker_) {
+    status.quota_circuit_breaker =
+        circuitBreakerStateName(quota_circuit_breaker_->state());
+  }
+  return status;
+}
+
+void ClientCache::pullClientStatistics() {
+  ::google::service_control_client::Statistics statistics;
+  if (!client_->GetStatistics(&statistics).ok()) {
+    return;
+  }
+  addGrowth(filter_stats_.check_cache_.called_, statistics.total_called_checks,
+            client_statistics_.total_called_checks);
+  addGrowth(filter_stats_.check_cache_.missed_,
+            statistics.send_checks_in_flight,
+            client_statistics_.send_checks_in_flight);
+  addGrowth(filter_stats_.quota_cache_.called_, statistics.total_called_quotas,
+            client_statistics_.total_called_quotas);
+  addGrowth(filter_stats_.quota_cache_.missed_,
+            statistics.send_quotas_in_flight,
+            client_statistics_.send_quotas_in_flight);
+  addGrowth(filter_stats_.report_cache_.called_,
+            statistics.total_called_reports,
+            client_statistics_.total_called_reports);
+  addGrowth(filter_stats_.report_cache_.missed_,
+            statistics.send_reports_in_flight,
+            client_statistics_.send_reports_in_flight);
+  client_statistics_ = statistics;
+}
+
+size_t ClientCache::bytes() const {
+  size_t bytes = SlotBytes(revalidating_checks_) + SlotBytes(inflight_checks_);
+  for (const auto& entry : revalidating_checks_) {
+    bytes += HeapBytes(entry.first);
+  }
+  for (const auto& entry : inflight_checks_) {
+    bytes += HeapBytes(entry.first) + VectorBytes(entry.second.callers);
+  }
+  if (quota_refresh_scheduler_) {
+    bytes += quota_refresh_scheduler_->bytes();
+  }
+  if (quota_token_buckets_) {
+    bytes += quota_token_buckets_->bytes();
+  }
+  if (report_spool_) {
+    bytes += report_spool_->bytes();
+  }
+  return bytes;
+}
+
+void ClientCache::updateMemoryStats() {
+  uint64_t bytes = this->bytes();
+  if (owner_bytes_fn_) {
+    bytes += owner_bytes_fn_();
+  }
+  memory_stats_.client_cache_bytes_.add(bytes);
+  memory_stats_.client_cache_bytes_.sub(memory_bytes_);
+  memory_bytes_ = bytes;
+}
+
+void ClientCache::onStatsTimer() {
+  pullClientStatistics();
+  updateMemoryStats();
+  if (status_slot_) {
+    status_slot_->publish(status());
+  }
+  if (stats_timer_) {
+    stats_timer_->enableTimer(kStatsInterval);
+  }
+}
+
+ClientCache::~ClientCache() {
+  // The calls since the last pull still count.
+  pullClientStatistics();
+  filter_stats_.check_cache_.capacity_.sub(
+      aggregation_options_.check_cache_entries);
+  filter_stats_.quota_cache_.capacity_.sub(
+      aggregation_options_.quota_cache_entries);
+  filter_stats_.report_cache_.capacity_.sub(
+      aggregation_options_.report_cache_entries);
+  filter_stats_.client_cache_.live_.dec();
+  memory_stats_.client_cache_bytes_.sub(memory_bytes_);
+}
+
+bool ClientCache::idle() const {
+  for (const auto* factory : {check_call_factory_.get(),
+                              quota_call_factory_.get(),
+                              report_call_factory_.get()}) {
+    if (factory && factory->activeCalls() > 0) {
+      return false;
+    }
+  }
+  return inflight_checks_.empty() &&
+         (!report_spool_ || report_spool_->size() == 0);
 }
 
 void ClientCache::collectScResponseErrorStats(ScResponseErrorType error_type) {
@@ -321,42 +984,388 @@ void ClientCache::collectScResponseErrorStats(ScResponseErrorType error_type) {
   }
 }
 
-CancelFunc ClientCache::callCheck(const CheckRequest& request,
-                                  Envoy::Tracing::Span& parent_span,
-                                  CheckDoneFunc on_done) {
-  CancelFunc cancel_fn;
-  auto check_transport = [this, &parent_span, &cancel_fn](
-                             const CheckRequest& request,
-                             CheckResponse* response,
-                             TransportDoneFunc on_done) {
+CancelFunc ClientCache::callCheck(
+    const CheckRequest& request, Envoy::Tracing::Span& parent_span,
+    CheckDoneFunc on_done, absl::optional<Envoy::MonotonicTime> deadline) {
+  BuiltCheckRequest source(request);
+  return callCheck(source, parent_span, std::move(on_done), deadline);
+}
+
+CancelFunc ClientCache::callCheck(
+    CheckRequestSource& source, Envoy::Tracing::Span& parent_span,
+    CheckDoneFunc on_done, absl::optional<Envoy::MonotonicTime> deadline) {
+  ++check_calls_;
+  // The cache hits use the response converted when it was cached.
+  std::string consumer_signature;
+  if (negative_check_cache_) {
+    consumer_signature = source.consumerSignature();
+    if (CachedCheckResponseConstSharedPtr cached =
+            negative_check_cache_->lookup(consumer_signature)) {
+      parent_span.log(time_source_.systemTime(),
+                      "Service Control negative cache hit: Check");
+      ++check_cache_hits_;
+      handleCachedCheckResponse(*cached, std::move(on_done));
+      return nullptr;
+    }
+  }
+
+  std::string signature;
+  if (shared_check_cache_ || stale_check_cache_ ||
+      aggregation_options_.coalesce_check_calls) {
+    signature = source.signature();
+  }
+  if (shared_check_cache_) {
+    bool refresh = false;
+    if (CachedCheckResponseConstSharedPtr cached =
+            shared_check_cache_->lookup(signature, &refresh)) {
+      parent_span.log(time_source_.systemTime(),
+                      "Service Control shared cache hit: Check");
+      if (refresh) {
+        refreshCheck(signature, source.request(), /*refresh_ahead=*/true);
+      }
+      ++check_cache_hits_;
+      handleCachedCheckResponse(*cached, std::move(on_done));
+      return nullptr;
+    }
+  }
+  if (stale_check_cache_) {
+    if (CachedCheckResponseConstSharedPtr cached =
+            serveRevalidatingCheck(signature, source)) {
+      parent_span.log(time_source_.systemTime(),
+                      "Service Control stale response: Check");
+      ++check_cache_hits_;
+      handleCachedCheckResponse(*cached, std::move(on_done));
+      return nullptr;
+    }
+  }
+
+  // The done callback must be copyable, so it takes the state back with a
+  // raw pointer.
+  auto* state = new CheckCallState();
+  state->on_done = std::move(on_done);
+  state->signature = std::move(signature);
+  state->consumer_signature = std::move(consumer_signature);
+  CheckResponse* response = state->response->get();
+
+  CheckTransportState transport{state, parent_span, deadline};
+  auto check_transport = [this, &transport](const CheckRequest& request,
+                                            CheckResponse* response,
+                                            TransportDoneFunc on_done) {
+    transport.called = true;
+    if (check_circuit_breaker_ && !check_circuit_breaker_->allowCall()) {
+      transport.parent_span.log(time_source_.systemTime(),
+                                "Service Control circuit breaker open: Check");
+      on_done(circuitBreakerOpenStatus());
+      return;
+    }
+    // A coalesced call is shared by requests with different deadlines, it
+    // keeps the configured timeout.
+    if (aggregation_options_.coalesce_check_calls) {
+      transport.cancel_fn =
+          callCoalescedCheck(transport.call->signature, request, response,
+                             transport.parent_span, std::move(on_done));
+      return;
+    }
+
+    if (!acquireCheckCall(transport.parent_span)) {
+      on_done(concurrencyLimitStatus());
+      return;
+    }
+    CheckCallState* state = transport.call;
+    state->transport_response = response;
+    state->transport_done = std::move(on_done);
     auto* call = check_call_factory_->createHttpCall(
-        request, parent_span,
-        [this, response, on_done](const Status& status,
-                                  const std::string& body) {
+        request, transport.parent_span,
+        [this, state, start = time_source_.monotonicTime()](
+            const Status& status, Envoy::Buffer::Instance& body) {
           Status final_status = processScCallTransportStatus<CheckResponse>(
-              status, response, body);
-          collectCallStatus(filter_stats_.check_, final_status.code());
-          on_done(final_status);
+              status, state->transport_response, body);
+          releaseCheckCall(start, final_status);
+          onCheckCallDone(state->signature, final_status,
+                          *state->transport_response);
+          // The done function frees the state.
+          TransportDoneFunc transport_done = std::move(state->transport_done);
+          transport_done(final_status);
         });
+    if (transport.deadline.has_value()) {
+      call->setDeadline(*transport.deadline);
+    }
     call->call();
-    cancel_fn = [call]() { call->cancel(); };
+    transport.cancel_fn = [call]() { call->cancel(); };
   };
 
   parent_span.log(time_source_.systemTime(),
                   "Service Control cache query: Check");
 
-  auto* response = new CheckResponse;
+  // The per-worker aggregator of the service control client keys its cache
+  // with an MD5 signature of the built request, so a miss of the caches
+  // above builds the request even when the aggregator then answers it.
+  const CheckRequest& request = source.request();
   client_->Check(
       request, response,
-      [this, response, on_done](const Status& http_status) {
-        handleCheckResponse(http_status, response, on_done);
+      [this, state](const Status& http_status) {
+        std::unique_ptr<CheckCallState> owned(state);
+        CheckResponse* response = owned->response->get();
+        if (negative_check_cache_ && http_status.ok() &&
+            isNegativeCacheable(*response)) {
+          negative_check_cache_->insert(
+              owned->consumer_signature,
+              std::make_shared<const CachedCheckResponse>(
+                  *response, config_.service_name()));
+        }
+        if (stale_check_cache_) {
+          if (CachedCheckResponseConstSharedPtr stale =
+                  lookupStaleCheck(owned->signature, http_status)) {
+            handleCachedCheckResponse(*stale, std::move(owned->on_done));
+            return;
+          }
+        }
+        handleCheckResponse(http_status, std::move(owned->response),
+                            std::move(owned->on_done));
       },
       check_transport);
+  if (!transport.called) {
+    ++check_cache_hits_;
+  }
+  return std::move(transport.cancel_fn);
+}
+
+bool ClientCache::isNegativeCacheable(const CheckResponse& response) {
+  if (response.check_errors_size() == 0) {
+    return false;
+  }
+  switch (response.check_errors(0).code()) {
+    case CheckError::NOT_FOUND:
+    case CheckError::API_KEY_NOT_FOUND:
+    case CheckError::API_KEY_EXPIRED:
+    case CheckError::API_KEY_INVALID:
+    case CheckError::API_TARGET_BLOCKED:
+    case CheckError::SERVICE_NOT_ACTIVATED:
+    case CheckError::PROJECT_DELETED:
+    case CheckError::PROJECT_INVALID:
+    case CheckError::BILLING_DISABLED:
+    case CheckError::CONSUMER_INVALID:
+      return true;
+    default:
+      // The other errors depend on the caller ip, referer or client app, on
+      // the quota left, or are transient.
+      return false;
+  }
+}
+
+void ClientCache::onCheckCallDone(const std::string& signature,
+                                  const Status& status,
+                                  const CheckResponse& response) {
+  collectCallStatus(filter_stats_.check_, status.code());
+  if (check_circuit_breaker_) {
+    check_circuit_breaker_->onCallDone(status);
+  }
+  if (!status.ok() || signature.empty() ||
+      (!shared_check_cache_ && !stale_check_cache_)) {
+    return;
+  }
+
+  // Converted once for all the hits of both caches.
+  auto cached = std::make_shared<const CachedCheckResponse>(
+      response, config_.service_name());
+  if (shared_check_cache_) {
+    shared_check_cache_->insert(signature, cached);
+  }
+  if (stale_check_cache_) {
+    if (response.check_errors_size() == 0) {
+      stale_check_cache_->insert(signature, cached);
+    } else {
+      stale_check_cache_->remove(signature);
+    }
+  }
+}
+
+bool ClientCache::acquireCheckCall(Envoy::Tracing::Span& parent_span) {
+  if (!check_concurrency_limiter_ || check_concurrency_limiter_->tryAcquire()) {
+    return true;
+  }
+  parent_span.log(time_source_.systemTime(),
+                  "Service Control concurrency limit reached: Check");
+  return false;
+}
+
+void ClientCache::releaseCheckCall(Envoy::MonotonicTime start,
+                                   const Status& status) {
+  if (check_concurrency_limiter_) {
+    check_concurrency_limiter_->onCallDone(
+        status, std::chrono::duration_cast<std::chrono::milliseconds>(
+                    time_source_.monotonicTime() - start));
+  }
+}
+
+bool ClientCache::refreshCheck(const std::string& signature,
+                               const CheckRequest& request,
+                               bool refresh_ahead) {
+  if (check_circuit_breaker_ && !check_circuit_breaker_->allowCall()) {
+    if (refresh_ahead) {
+      shared_check_cache_->cancelRefresh(signature);
+    }
+    return false;
+  }
+  // Don't support tracing on this call, it is not part of the request.
+  auto& null_span = Envoy::Tracing::NullSpan::instance();
+  auto* call = check_call_factory_->createHttpCall(
+      request, null_span,
+      [this, signature, refresh_ahead](const Status& status,
+                                       Envoy::Buffer::Instance& body) {
+        CheckResponse response;
+        Status final_status = processScCallTransportStatus<CheckResponse>(
+            status, &response, body);
+        // On failure, the cached entries expire and the next miss makes the
+        // call. Until then, the next hit in the window tries again.
+        onCheckCallDone(signature, final_status, response);
+        if (refresh_ahead && !final_status.ok()) {
+          shared_check_cache_->cancelRefresh(signature);
+        }
+
+        auto it = revalidating_checks_.find(signature);
+        if (it != revalidating_checks_.end()) {
+          if (final_status.ok()) {
+            revalidating_checks_.erase(it);
+          } else {
+            it->second = false;
+          }
+        }
+      });
+  call->call();
+  return true;
+}
+
+CachedCheckResponseConstSharedPtr ClientCache::lookupStaleCheck(
+    const std::string& signature, const Status& status) {
+  // All 5xx errors are already translated to Unavailable.
+  if (status.code() != StatusCode::kUnavailable &&
+      status.code() != StatusCode::kDeadlineExceeded) {
+    return nullptr;
+  }
+  CachedCheckResponseConstSharedPtr response =
+      stale_check_cache_->lookup(signature);
+  if (response == nullptr) {
+    return nullptr;
+  }
+
+  ENVOY_LOG(debug,
+            "Google Service Control Check failed, serving the last "
+            "known-good response. Original error: {}",
+            status.message());
+  filter_stats_.filter_.allowed_stale_check_.inc();
+  // The next request for the signature starts the revalidation.
+  revalidating_checks_.emplace(signature, false);
+  return response;
+}
+
+CachedCheckResponseConstSharedPtr ClientCache::serveRevalidatingCheck(
+    const std::string& signature, CheckRequestSource& source) {
+  auto it = revalidating_checks_.find(signature);
+  if (it == revalidating_checks_.end()) {
+    return nullptr;
+  }
+  CachedCheckResponseConstSharedPtr response =
+      stale_check_cache_->lookup(signature);
+  if (response == nullptr) {
+    // Too old, wait on the Check call again.
+    revalidating_checks_.erase(it);
+    return nullptr;
+  }
+
+  filter_stats_.filter_.allowed_stale_check_.inc();
+  if (!it->second) {
+    it->second = true;
+    // The call may complete inline, `it` must not be used after this.
+    if (!refreshCheck(signature, source.request(), /*refresh_ahead=*/false)) {
+      revalidating_checks_[signature] = false;
+    }
+  }
+  return response;
+}
+
+CancelFunc ClientCache::callCoalescedCheck(const std::string& signature,
+                                           const CheckRequest& request,
+                                           CheckResponse* response,
+                                           Envoy::Tracing::Span& parent_span,
+                                           TransportDoneFunc on_done) {
+  const uint64_t caller_id = next_check_caller_id_++;
+  CancelFunc cancel_fn = [this, signature, caller_id]() {
+    cancelCoalescedCheck(signature, caller_id);
+  };
+
+  auto it = inflight_checks_.find(signature);
+  if (it != inflight_checks_.end()) {
+    filter_stats_.filter_.check_coalesced_.inc();
+    parent_span.log(time_source_.systemTime(),
+                    "Service Control coalesced call: Check");
+    it->second.callers.push_back({caller_id, response, on_done});
+    return cancel_fn;
+  }
+
+  // Only the new calls are limited, the callers attached to one add no load.
+  if (!acquireCheckCall(parent_span)) {
+    on_done(concurrencyLimitStatus());
+    return nullptr;
+  }
+  InflightCheck& inflight = inflight_checks_[signature];
+  inflight.callers.push_back({caller_id, response, on_done});
+  auto* call = check_call_factory_->createHttpCall(
+      request, parent_span,
+      [this, signature, start = time_source_.monotonicTime()](
+          const Status& status, Envoy::Buffer::Instance& body) {
+        auto it = inflight_checks_.find(signature);
+        if (it == inflight_checks_.end()) {
+          releaseCheckCall(start, status);
+          return;
+        }
+        // Detach the callers before calling them, they may start a new Check
+        // call with the same signature.
+        std::vector<CheckCaller> callers = std::move(it->second.callers);
+        inflight_checks_.erase(it);
+
+        CheckResponse check_response;
+        Status final_status = processScCallTransportStatus<CheckResponse>(
+            status, &check_response, body);
+        releaseCheckCall(start, final_status);
+        onCheckCallDone(signature, final_status, check_response);
+        for (auto& caller : callers) {
+          *caller.response = check_response;
+          caller.on_done(final_status);
+        }
+      });
+  inflight.call = call;
+  // The call may complete inline, `inflight` must not be used after this.
+  call->call();
   return cancel_fn;
 }
 
+void ClientCache::cancelCoalescedCheck(const std::string& signature,
+                                       uint64_t caller_id) {
+  auto it = inflight_checks_.find(signature);
+  if (it == inflight_checks_.end()) {
+    return;
+  }
+  auto& callers = it->second.callers;
+  auto caller = std::find_if(
+      callers.begin(), callers.end(),
+      [caller_id](const CheckCaller& c) { return c.id == caller_id; });
+  if (caller == callers.end()) {
+    return;
+  }
+
+  TransportDoneFunc on_done = std::move(caller->on_done);
+  callers.erase(caller);
+  if (callers.empty()) {
+    // Nobody is waiting for the response. The done callback of the cancelled
+    // call removes the in-flight entry.
+    it->second.call->cancel();
+  }
+  on_done(Status(StatusCode::kCancelled, std::string("Request cancelled")));
+}
+
 void ClientCache::handleCheckResponse(const Status& http_status,
-                                      CheckResponse* response,
+                                      ArenaCheckResponsePtr response,
                                       CheckDoneFunc on_done) {
   CheckResponseInfo response_info;
   Status final_status;
@@ -372,11 +1381,25 @@ void ClientCache::handleCheckResponse(const Status& http_status,
     // Otherwise, http call failed. Use that status to respond.
     final_status = http_status;
   }
+  handleCheckStatus(http_status, final_status, std::move(response_info),
+                    std::move(on_done));
+}
+
+void ClientCache::handleCachedCheckResponse(const CachedCheckResponse& cached,
+                                            CheckDoneFunc on_done) {
+  collectScResponseErrorStats(cached.info.error.type);
+  handleCheckStatus(OkStatus(), cached.status, cached.info,
+                    std::move(on_done));
+}
 
+void ClientCache::handleCheckStatus(const Status& http_status,
+                                    const Status& final_status,
+                                    CheckResponseInfo response_info,
+                                    CheckDoneFunc on_done) {
   if (final_status.ok()) {
     // Everything succeeded, API Key is trusted.
     response_info.api_key_state = ApiKeyState::VERIFIED;
-    on_done(final_status, response_info);
+    on_done(final_status, std::move(response_info));
   } else if (final_status.code() == StatusCode::kUnavailable) {
     // All 5xx errors are already translated to Unavailable.
     // API Key cannot be trusted due to a network error.
@@ -389,7 +1412,7 @@ void ClientCache::handleCheckResponse(const Status& http_status,
                 "request is allowed due to network fail open. Original "
                 "error: {}",
                 final_status.message());
-      on_done(OkStatus(), response_info);
+      on_done(OkStatus(), std::move(response_info));
     } else {
       // Preserve the original 5xx error code in the response back.
       filter_stats_.filter_.denied_control_plane_fault_.inc();
@@ -403,7 +1426,7 @@ void ClientCache::handleCheckResponse(const Status& http_status,
       if (!http_status.ok()) {
         response_info.error = failCallStatusToScResponseError(http_status);
       }
-      on_done(final_status, response_info);
+      on_done(final_status, std::move(response_info));
     }
   } else {
     if (!http_status.ok()) {
@@ -420,7 +1443,7 @@ void ClientCache::handleCheckResponse(const Status& http_status,
       Status scrubbed_status(StatusCode::kInternal, final_status.message());
 
       response_info.error = failCallStatusToScResponseError(http_status);
-      on_done(scrubbed_status, response_info);
+      on_done(scrubbed_status, std::move(response_info));
     } else {
       // HTTP succeeded, but SC Check returned 4xx.
       // Stats already incremented for this case.
@@ -436,16 +1459,35 @@ void ClientCache::handleCheckResponse(const Status& http_status,
         response_info.api_key_state = ApiKeyState::VERIFIED;
       }
 
-      on_done(final_status, response_info);
+      on_done(final_status, std::move(response_info));
     }
   }
-  delete response;
 }
 
 void ClientCache::callQuota(const AllocateQuotaRequest& request,
                             QuotaDoneFunc on_done) {
-  auto* response = new AllocateQuotaResponse;
-  client_->Quota(request, response,
+  ++quota_calls_;
+  std::string key;
+  if (quota_refresh_scheduler_ || quota_token_buckets_) {
+    key = QuotaRefreshScheduler::key(request);
+  }
+  if (quota_token_buckets_ &&
+      !quota_token_buckets_->tryConsume(key, request)) {
+    // Denied like the quota cache would once the refresh is rejected, without
+    // adding to the usage of the refresh.
+    filter_stats_.filter_.quota_locally_limited_.inc();
+    auto response = std::make_unique<ArenaQuotaResponse>();
+    auto* error = (*response)->add_allocate_errors();
+    error->set_code(QuotaError::RESOURCE_EXHAUSTED);
+    error->set_description("Quota exhausted, limited by the proxy.");
+    handleQuotaOnDone(OkStatus(), std::move(response), on_done);
+    return;
+  }
+  if (quota_refresh_scheduler_) {
+    quota_refresh_scheduler_->recordUsage(key);
+  }
+  auto* response = new ArenaQuotaResponse;
+  client_->Quota(request, response->get(),
                  [this, response, on_done](const Status& status) {
                    // Configured to always use the quota cache, so the status
                    // will always be OK. Response message is from the cache. If
@@ -453,12 +1495,13 @@ void ClientCache::callQuota(const AllocateQuotaRequest& request,
                    // during cache refresh, the status will still be OK and the
                    // response message will be empty. This is also treated as a
                    // success.
-                   handleQuotaOnDone(status, response, on_done);
+                   handleQuotaOnDone(status, absl::WrapUnique(response),
+                                     on_done);
                  });
 }
 
 void ClientCache::handleQuotaOnDone(const Status& http_status,
-                                    AllocateQuotaResponse* response,
+                                    ArenaQuotaResponsePtr response,
                                     QuotaDoneFunc on_done) {
   QuotaResponseInfo response_info;
   if (http_status.ok()) {
@@ -467,19 +1510,102 @@ void ClientCache::handleQuotaOnDone(const Status& http_status,
             *response, config_.service_name(), &response_info);
 
     collectScResponseErrorStats(response_info.error.type);
-    on_done(quota_status, response_info);
+    on_done(quota_status, std::move(response_info));
   } else {
     // Most likely an auth error in ESPv2 or API producer deployment.
     filter_stats_.filter_.denied_producer_error_.inc();
 
     response_info.error = failCallStatusToScResponseError(http_status);
-    on_done(http_status, response_info);
+    on_done(http_status, std::move(response_info));
   }
+}
+
+void ClientCache::callReportTransport(const ReportRequest& request,
+                                      ReportResponse* response,
+                                      TransportDoneFunc on_done) {
+  if (!report_spool_) {
+    sendReport(request, response, on_done);
+    return;
+  }
+
+  // The request is not kept by the caller once the call is done. The call
+  // shares its serialization, which is copied only if the call fails.
+  auto body = std::make_shared<const std::string>(request.SerializeAsString());
+  sendSerializedReport(body, response,
+                       [this, body, on_done](const Status& status) {
+                         report_spool_->onReportDone(status, *body);
+                         on_done(status);
+                       });
+}
 
-  delete response;
+void ClientCache::sendReport(const ReportRequest& request,
+                             ReportResponse* response,
+                             TransportDoneFunc on_done) {
+  // Don't support tracing on this transport
+  auto* call = report_call_factory_->createHttpCall(
+      request, Envoy::Tracing::NullSpan::instance(),
+      reportCallDone(response, std::move(on_done)));
+  call->call();
+}
+
+void ClientCache::sendSerializedReport(std::shared_ptr<const std::string> body,
+                                       ReportResponse* response,
+                                       TransportDoneFunc on_done) {
+  auto* call = report_call_factory_->createSerializedHttpCall(
+      std::move(body), Envoy::Tracing::NullSpan::instance(),
+      reportCallDone(response, std::move(on_done)));
+  call->call();
+}
+
+HttpCall::DoneFunc ClientCache::reportCallDone(ReportResponse* response,
+                                               TransportDoneFunc on_done) {
+  return [this, response, on_done = std::move(on_done)](
+             const Status& status, Envoy::Buffer::Instance& body) {
+    Status final_status =
+        processScCallTransportStatus<ReportResponse>(status, response, body);
+    collectCallStatus(filter_stats_.report_, final_status.code());
+
+    on_done(final_status);
+  };
+}
+
+std::vector<ReportRequest> ClientCache::splitReportRequest(
+    const ReportRequest& request, uint32_t max_operations,
+    uint32_t max_bytes) {
+  std::vector<ReportRequest> split_requests;
+  if ((max_operations == 0 ||
+       static_cast<uint32_t>(request.operations_size()) <= max_operations) &&
+      (max_bytes == 0 || request.ByteSizeLong() <= max_bytes)) {
+    return split_requests;
+  }
+
+  ReportRequest empty_request;
+  empty_request.set_service_name(request.service_name());
+  empty_request.set_service_config_id(request.service_config_id());
+  const size_t empty_request_bytes = empty_request.ByteSizeLong();
+
+  size_t current_bytes = 0;
+  for (const auto& operation : request.operations()) {
+    // Roughly the operation size plus its tag and length.
+    const size_t operation_bytes = operation.ByteSizeLong() + 8;
+    const bool full =
+        !split_requests.empty() &&
+        ((max_operations > 0 &&
+          static_cast<uint32_t>(split_requests.back().operations_size()) >=
+              max_operations) ||
+         (max_bytes > 0 && current_bytes + operation_bytes > max_bytes));
+    if (split_requests.empty() || full) {
+      split_requests.push_back(empty_request);
+      current_bytes = empty_request_bytes;
+    }
+    *split_requests.back().add_operations() = operation;
+    current_bytes += operation_bytes;
+  }
+  return split_requests;
 }
 
 void ClientCache::callReport(const ReportRequest& request) {
+  ++report_calls_;
   auto* response = new ReportResponse;
   client_->Report(request, response,
                   [response](const Status&) { delete response; });
@@ -14,6 +14,10 @@
 
 #pragma once
 
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
 #include "api/envoy/v10/http/service_control/config.pb.h"
 #include "envoy/event/dispatcher.h"
 #include "envoy/tracing/http_tracer.h"
@@ -21,9 +25,18 @@
 #include "include/service_control_client.h"
 #include "source/common/common/logger.h"
 #include "src/api_proxy/service_control/request_info.h"
+#include "src/envoy/http/service_control/arena_response.h"
+#include "src/envoy/http/service_control/circuit_breaker.h"
+#include "src/envoy/http/service_control/client_cache_status.h"
+#include "src/envoy/http/service_control/concurrency_limiter.h"
 #include "src/envoy/http/service_control/filter_stats.h"
+#include "src/envoy/http/service_control/flush_scheduler.h"
 #include "src/envoy/http/service_control/http_call.h"
+#include "src/envoy/http/service_control/quota_refresh_scheduler.h"
+#include "src/envoy/http/service_control/quota_token_buckets.h"
+#include "src/envoy/http/service_control/report_spool.h"
 #include "src/envoy/http/service_control/service_control_callback_func.h"
+#include "src/envoy/http/service_control/shared_check_cache.h"
 
 namespace espv2 {
 namespace envoy {
@@ -37,8 +50,54 @@ class ClientCacheCheckResponseErrorTypeTest;
 class ClientCacheQuotaResponseTest;
 class ClientCacheQuotaResponseErrorTypeTest;
 class ClientCacheHttpRequestTest;
+class ClientCacheSplitReportTest;
 }  // namespace test
 
+// The aggregation cache options of a service. Each option is taken from the
+// per-service config if it is set, then from the filter config if it is set,
+// otherwise the default is used.
+struct AggregationOptions {
+  AggregationOptions(
+      const ::espv2::api::envoy::v10::http::service_control::Service& config,
+      const ::espv2::api::envoy::v10::http::service_control::FilterConfig&
+          filter_config);
+
+  uint32_t check_cache_entries;
+  uint32_t check_flush_interval_ms;
+  uint32_t check_expiration_ms;
+  uint32_t quota_cache_entries;
+  uint32_t quota_refresh_interval_ms;
+  uint32_t quota_max_refresh_interval_ms;
+  uint32_t report_cache_entries;
+  uint32_t report_flush_interval_ms;
+  uint32_t report_max_operations;
+  uint32_t report_max_bytes;
+  uint32_t report_preaggregation_entries;
+  uint32_t report_preaggregation_max_consumers;
+  uint32_t shared_check_cache_entries;
+  uint32_t check_refresh_ahead_ms;
+  uint32_t check_stale_ms;
+  uint32_t negative_check_cache_entries;
+  uint32_t negative_check_cache_expiration_ms;
+  bool coalesce_check_calls;
+  bool quota_local_limit;
+  bool batch_reports;
+};
+
+// The check request of a call, with its cache signatures, see
+// SharedCheckCache. Lets the caller key the caches from its own fields, and
+// build the request only when the caches need it.
+class CheckRequestSource {
+ public:
+  virtual ~CheckRequestSource() = default;
+
+  virtual std::string signature() = 0;
+  virtual std::string consumerSignature() = 0;
+
+  // Valid while the source is.
+  virtual const ::google::api::servicecontrol::v1::CheckRequest& request() = 0;
+};
+
 // The class to cache check and batch report.
 class ClientCache : public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
  public:
@@ -49,12 +108,29 @@ class ClientCache : public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
       const std::string& stats_prefix, Envoy::Stats::Scope& scope,
       Envoy::Upstream::ClusterManager& cm, Envoy::TimeSource& time_source,
       Envoy::Event::Dispatcher& dispatcher,
-      std::function<const std::string&()> sc_token_fn,
-      std::function<const std::string&()> quota_token_fn);
+      std::function<const std::string&()> sc_authorization_fn,
+      std::function<const std::string&()> quota_authorization_fn,
+      SharedCheckCacheSharedPtr shared_check_cache,
+      SharedCheckCacheSharedPtr stale_check_cache = nullptr,
+      SharedCheckCacheSharedPtr negative_check_cache = nullptr,
+      ClientCacheStatusSlotSharedPtr status_slot = nullptr,
+      FlushSchedulerSharedPtr flush_scheduler = nullptr);
 
+  ~ClientCache();
+
+  // The Check call made for a cache miss does not outlast the deadline, if
+  // set.
   CancelFunc callCheck(
       const ::google::api::servicecontrol::v1::CheckRequest& request,
-      Envoy::Tracing::Span& parent_span, CheckDoneFunc on_done);
+      Envoy::Tracing::Span& parent_span, CheckDoneFunc on_done,
+      absl::optional<Envoy::MonotonicTime> deadline = absl::nullopt);
+
+  // Same as above, with the request of the source only built if a cache
+  // misses or revalidates it.
+  CancelFunc callCheck(
+      CheckRequestSource& source, Envoy::Tracing::Span& parent_span,
+      CheckDoneFunc on_done,
+      absl::optional<Envoy::MonotonicTime> deadline = absl::nullopt);
 
   void callQuota(
       const ::google::api::servicecontrol::v1::AllocateQuotaRequest& request,
@@ -63,53 +139,195 @@ class ClientCache : public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
   void callReport(
       const ::google::api::servicecontrol::v1::ReportRequest& request);
 
+  // Returns true if no call is in flight nor spooled, so the cache can be
+  // released without losing any.
+  bool idle() const;
+
+  // Sets the memory held by the owner of the cache for it, added to the
+  // memory stats of the service with the bytes of the cache.
+  void set_owner_bytes_fn(std::function<size_t()> owner_bytes_fn) {
+    owner_bytes_fn_ = std::move(owner_bytes_fn);
+  }
+
  private:
   friend class test::ClientCacheCheckResponseTest;
   friend class test::ClientCacheCheckResponseErrorTypeTest;
   friend class test::ClientCacheQuotaResponseTest;
   friend class test::ClientCacheQuotaResponseErrorTypeTest;
   friend class test::ClientCacheHttpRequestTest;
+  friend class test::ClientCacheSplitReportTest;
 
   // Increments the corresponding stat for the given error type.
   void collectScResponseErrorStats(
       ::espv2::api_proxy::service_control::ScResponseErrorType error_type);
 
-  // Ownership of CheckResponse is passed to this function.
+  // The response is freed when the function returns.
   // The function will always call CheckDoneFunc.
-  void handleCheckResponse(
+  void handleCheckResponse(const ::google::protobuf::util::Status& http_status,
+                           ArenaCheckResponsePtr response,
+                           CheckDoneFunc on_done);
+
+  // Like handleCheckResponse for a successful call, with the response
+  // converted when it was cached.
+  void handleCachedCheckResponse(const CachedCheckResponse& cached,
+                                 CheckDoneFunc on_done);
+
+  // Calls CheckDoneFunc for the http status of the call and the status the
+  // response converts to.
+  void handleCheckStatus(
       const ::google::protobuf::util::Status& http_status,
-      ::google::api::servicecontrol::v1::CheckResponse* response,
+      const ::google::protobuf::util::Status& final_status,
+      ::espv2::api_proxy::service_control::CheckResponseInfo response_info,
       CheckDoneFunc on_done);
 
-  // Ownership of AllocateQuotaResponse is passed to this function.
+  // The response is freed when the function returns.
   // The function will always call QuotaDoneFunction.
-  void handleQuotaOnDone(
-      const ::google::protobuf::util::Status& http_status,
-      ::google::api::servicecontrol::v1::AllocateQuotaResponse* response,
-      QuotaDoneFunc on_done);
+  void handleQuotaOnDone(const ::google::protobuf::util::Status& http_status,
+                         ArenaQuotaResponsePtr response, QuotaDoneFunc on_done);
 
   void initHttpRequestSetting(
       const ::espv2::api::envoy::v10::http::service_control::FilterConfig&
           filter_config);
 
+  // Creates the call factories of the Service Control gRPC API.
+  void initGrpcCallFactories(
+      const ::espv2::api::envoy::v10::http::service_control::FilterConfig&
+          filter_config,
+      Envoy::Stats::Scope& scope, Envoy::Upstream::ClusterManager& cm,
+      Envoy::TimeSource& time_source, Envoy::Event::Dispatcher& dispatcher,
+      std::function<const std::string&()> sc_authorization_fn,
+      std::function<const std::string&()> quota_authorization_fn);
+
   void collectCallStatus(CallStatusStats& filter_stats,
                          const ::google::protobuf::util::StatusCode& code);
 
+  // Makes a Check call for a cache miss, or attaches to the in-flight Check
+  // call with the same signature. The response is copied into `response`
+  // before `on_done` is called. Returns the function to cancel this caller.
+  CancelFunc callCoalescedCheck(
+      const std::string& signature,
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      ::google::api::servicecontrol::v1::CheckResponse* response,
+      Envoy::Tracing::Span& parent_span,
+      ::google::service_control_client::TransportDoneFunc on_done);
+
+  // Returns true if the check response rejects the API key for a reason that
+  // does not depend on the rest of the request.
+  static bool isNegativeCacheable(
+      const ::google::api::servicecontrol::v1::CheckResponse& response);
+
+  // Takes a slot of the Check concurrency limit for a call made for a
+  // request. Returns false if the limit is reached, the call is then failed
+  // as unavailable.
+  bool acquireCheckCall(Envoy::Tracing::Span& parent_span);
+  // Gives back the slot of a call taken at `start`, with its result.
+  void releaseCheckCall(Envoy::MonotonicTime start,
+                        const ::google::protobuf::util::Status& status);
+
+  // Records the result of a Check call made to Service Control. The response
+  // is cached under the signature, if it is not empty.
+  void onCheckCallDone(
+      const std::string& signature,
+      const ::google::protobuf::util::Status& status,
+      const ::google::api::servicecontrol::v1::CheckResponse& response);
+
+  // Makes a background Check call to refresh the cached responses of the
+  // signature. Returns false if the call was not made. If `refresh_ahead`,
+  // the shared cache asked for the call, and is told if it fails.
+  bool refreshCheck(
+      const std::string& signature,
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      bool refresh_ahead);
+
+  // Returns the known-good response of the signature if the Check call
+  // failed with a network error and the response is not too old, or
+  // nullptr. The signature is then revalidated by the next requests.
+  CachedCheckResponseConstSharedPtr lookupStaleCheck(
+      const std::string& signature,
+      const ::google::protobuf::util::Status& status);
+
+  // Serves the known-good response of a signature being revalidated, and
+  // makes a revalidation call if none is in flight. Returns nullptr if the
+  // signature is not being revalidated.
+  CachedCheckResponseConstSharedPtr serveRevalidatingCheck(
+      const std::string& signature, CheckRequestSource& source);
+
+  // Detaches the caller from the in-flight Check call and calls its done
+  // function. The call is cancelled when no caller is left.
+  void cancelCoalescedCheck(const std::string& signature, uint64_t caller_id);
+
+  // Sends the report request in one HttpCall, and spools it if the call
+  // fails and the report spool is enabled.
+  void callReportTransport(
+      const ::google::api::servicecontrol::v1::ReportRequest& request,
+      ::google::api::servicecontrol::v1::ReportResponse* response,
+      ::google::service_control_client::TransportDoneFunc on_done);
+
+  // Sends the report request in one HttpCall.
+  void sendReport(
+      const ::google::api::servicecontrol::v1::ReportRequest& request,
+      ::google::api::servicecontrol::v1::ReportResponse* response,
+      ::google::service_control_client::TransportDoneFunc on_done);
+
+  // Sends the serialized report request in one HttpCall.
+  void sendSerializedReport(
+      std::shared_ptr<const std::string> body,
+      ::google::api::servicecontrol::v1::ReportResponse* response,
+      ::google::service_control_client::TransportDoneFunc on_done);
+
+  // Returns the done function of a Report HttpCall.
+  HttpCall::DoneFunc reportCallDone(
+      ::google::api::servicecontrol::v1::ReportResponse* response,
+      ::google::service_control_client::TransportDoneFunc on_done);
+
+  // Splits the report request into requests with at most `max_operations`
+  // operations and roughly `max_bytes` bytes each, 0 meaning no limit.
+  // Returns an empty vector if the request does not need to be split.
+  static std::vector<::google::api::servicecontrol::v1::ReportRequest>
+  splitReportRequest(
+      const ::google::api::servicecontrol::v1::ReportRequest& request,
+      uint32_t max_operations, uint32_t max_bytes);
+
   template <class Response>
   static ::google::protobuf::util::Status processScCallTransportStatus(
       const ::google::protobuf::util::Status& status, Response* resp,
-      const std::string& body);
+      Envoy::Buffer::Instance& body);
 
   const ::espv2::api::envoy::v10::http::service_control::Service& config_;
 
+  // The resolved aggregation cache options.
+  const AggregationOptions aggregation_options_;
+
   // Filter statistics.
   ServiceControlFilterStats filter_stats_;
+  // The memory statistics of the service.
+  ServiceMemoryStats memory_stats_;
+  // Not set if the owner holds no memory for the cache.
+  std::function<size_t()> owner_bytes_fn_;
+  // The bytes last added to the memory stats.
+  uint64_t memory_bytes_ = 0;
 
   // network fail policy
   bool network_fail_open_;
 
   // the configurable timeouts
   uint32_t check_timeout_ms_;
+  // Returns the current state of the cache, as published for the admin
+  // handler.
+  ClientCacheStatus status() const;
+  // Adds the aggregation statistics of the client since the last pull to the
+  // cache stats.
+  void pullClientStatistics();
+  // Pulls the client statistics and publishes the status, then schedules the
+  // next time.
+  void onStatsTimer();
+  // The memory held by the tables of the cache, roughly. The aggregation
+  // caches of the client are not included, they are bounded by their
+  // capacity.
+  size_t bytes() const;
+  // Updates the memory stats with the bytes of the cache and its owner.
+  void updateMemoryStats();
+
   uint32_t report_timeout_ms_;
   uint32_t quota_timeout_ms_;
 
@@ -118,9 +336,80 @@ class ClientCache : public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
   uint32_t report_retries_;
   uint32_t quota_retries_;
 
+  // The backoff and retry budget of the calls.
+  HttpCallRetryPolicy retry_policy_;
+
+  // The circuit breaker setting. Disabled if the threshold is 0.
+  uint32_t circuit_breaker_failure_threshold_;
+  uint32_t circuit_breaker_open_duration_ms_;
+
   // Used to retrieve the current time for tracing.
   Envoy::TimeSource& time_source_;
 
+  // The circuit breakers of the check and quota calls. Null if disabled.
+  CircuitBreakerPtr check_circuit_breaker_;
+  CircuitBreakerPtr quota_circuit_breaker_;
+
+  // The adaptive limit of the Check calls made for requests. Null if it is
+  // disabled.
+  ConcurrencyLimiterPtr check_concurrency_limiter_;
+
+  // Adapts the quota refresh interval of each key. Null if it is disabled.
+  QuotaRefreshSchedulerPtr quota_refresh_scheduler_;
+  QuotaTokenBucketsPtr quota_token_buckets_;
+
+  // The check cache shared by all workers. Null if it is disabled.
+  SharedCheckCacheSharedPtr shared_check_cache_;
+
+  // The known-good check responses shared by all workers, served stale when
+  // Check calls fail. Null if it is disabled.
+  SharedCheckCacheSharedPtr stale_check_cache_;
+
+  // The API key rejections shared by all workers. Null if it is disabled.
+  SharedCheckCacheSharedPtr negative_check_cache_;
+
+  // The signatures served stale on this worker, mapped to whether a
+  // revalidation call is in flight.
+  absl::flat_hash_map<std::string, bool> revalidating_checks_;
+
+  // A caller waiting for an in-flight Check call.
+  struct CheckCaller {
+    uint64_t id;
+    ::google::api::servicecontrol::v1::CheckResponse* response;
+    ::google::service_control_client::TransportDoneFunc on_done;
+  };
+
+  // A Check call shared by the concurrent cache misses with the same
+  // signature.
+  struct InflightCheck {
+    HttpCall* call;
+    std::vector<CheckCaller> callers;
+  };
+
+  // The in-flight Check calls keyed by signature. Only used when
+  // coalesce_check_calls is enabled. Must outlive the call factories, which
+  // cancel the pending calls on destruction.
+  absl::flat_hash_map<std::string, InflightCheck> inflight_checks_;
+  uint64_t next_check_caller_id_ = 0;
+
+  // The calls made to the cache, for the published status.
+  uint64_t check_calls_ = 0;
+  uint64_t check_cache_hits_ = 0;
+  uint64_t quota_calls_ = 0;
+  uint64_t report_calls_ = 0;
+  // Where the status is published to. Null if it is not.
+  const ClientCacheStatusSlotSharedPtr status_slot_;
+  // The client statistics as of the last pull.
+  ::google::service_control_client::Statistics client_statistics_{};
+  // Only one of them is set, the handle if the flushes are scheduled by the
+  // worker flush scheduler.
+  Envoy::Event::TimerPtr stats_timer_;
+  FlushScheduler::HandlePtr stats_flush_;
+
+  // The spool of the failed Report requests. Null if it is disabled. Must
+  // outlive the call factories, which cancel the pending calls on destruction.
+  ReportSpoolPtr report_spool_;
+
   // The http call factories. On destruction, they automatically cancel all
   // pending RPCs. These should always be close to the last member variables in
   // the class to mitigate use-after-free of other class members (destructor
@@ -0,0 +1,103 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// The state of the client cache of a worker, as last published by it.
+struct ClientCacheStatus {
+  uint64_t check_calls = 0;
+  // The checks answered without a call to the server.
+  uint64_t check_cache_hits = 0;
+  uint64_t quota_calls = 0;
+  uint64_t report_calls = 0;
+  // The http calls in flight, per call factory.
+  uint64_t check_calls_in_flight = 0;
+  uint64_t quota_calls_in_flight = 0;
+  uint64_t report_calls_in_flight = 0;
+  // The Check calls shared by concurrent cache misses.
+  uint64_t coalesced_checks = 0;
+  // The signatures served stale on the worker.
+  uint64_t revalidating_checks = 0;
+  // The circuit breaker states, empty if they are disabled.
+  absl::string_view check_circuit_breaker;
+  absl::string_view quota_circuit_breaker;
+};
+
+// Where a worker publishes the status of its client cache, for the admin
+// handler on the main thread. The worker writes a copy now and then, so
+// reading it never waits on, or sends work to, the worker.
+class ClientCacheStatusSlot {
+ public:
+  void publish(const ClientCacheStatus& status) {
+    absl::MutexLock lock(&mutex_);
+    status_ = status;
+  }
+
+  ClientCacheStatus get() const {
+    absl::MutexLock lock(&mutex_);
+    return status_;
+  }
+
+ private:
+  mutable absl::Mutex mutex_;
+  ClientCacheStatus status_ ABSL_GUARDED_BY(mutex_);
+};
+
+using ClientCacheStatusSlotSharedPtr = std::shared_ptr<ClientCacheStatusSlot>;
+
+// The slots of the workers of one service control call. The workers add
+// theirs when their thread local cache is created.
+class ClientCacheStatusSlots {
+ public:
+  ClientCacheStatusSlotSharedPtr add() {
+    auto slot = std::make_shared<ClientCacheStatusSlot>();
+    absl::MutexLock lock(&mutex_);
+    slots_.push_back(slot);
+    return slot;
+  }
+
+  std::vector<ClientCacheStatus> get() const {
+    absl::MutexLock lock(&mutex_);
+    std::vector<ClientCacheStatus> statuses;
+    statuses.reserve(slots_.size());
+    for (const auto& slot : slots_) {
+      statuses.push_back(slot->get());
+    }
+    return statuses;
+  }
+
+ private:
+  mutable absl::Mutex mutex_;
+  std::vector<ClientCacheStatusSlotSharedPtr> slots_ ABSL_GUARDED_BY(mutex_);
+};
+
+using ClientCacheStatusSlotsSharedPtr =
+    std::shared_ptr<ClientCacheStatusSlots>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
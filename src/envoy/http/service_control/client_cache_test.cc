@@ -17,9 +17,11 @@
 #include "absl/functional/bind_front.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/empty_string.h"
 #include "src/envoy/http/service_control/mocks.h"
 #include "src/envoy/http/service_control/service_control_callback_func.h"
+#include "src/envoy/utils/allocation_counter.h"
 #include "test/mocks/common.h"
 #include "test/mocks/event/mocks.h"
 #include "test/mocks/server/mocks.h"
@@ -37,8 +39,8 @@ using ::espv2::api::envoy::v10::http::service_control::FilterConfig;
 using ::espv2::api::envoy::v10::http::service_control::Service;
 using ::espv2::api_proxy::service_control::CheckResponseInfo;
 using ::espv2::api_proxy::service_control::api_key::ApiKeyState;
+using ::espv2::envoy::utils::AllocationCounter;
 using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
-using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
 using ::google::api::servicecontrol::v1::CheckError;
 using ::google::api::servicecontrol::v1::CheckError_Code;
 using ::google::api::servicecontrol::v1::CheckRequest;
@@ -71,7 +73,7 @@ class ClientCacheTestBase : public ::testing::Test {
   void SetUp() override {
     cache_ = std::make_unique<ClientCache>(
         service_config_, filter_config_, "test", context_.scope_, cm_,
-        time_source_, dispatcher_, token_fn_, token_fn_);
+        time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
   }
 
   void checkAndReset(Envoy::Stats::Counter& counter, const int expected_value) {
@@ -111,7 +113,7 @@ class ClientCacheTestBase : public ::testing::Test {
 
 class ClientCacheCheckResponseTest : public ClientCacheTestBase {
  protected:
-  void runTest(StatusCode got_http_code, CheckResponse* got_response,
+  void runTest(StatusCode got_http_code, ArenaCheckResponsePtr got_response,
                StatusCode want_client_code, ApiKeyState want_api_key_state,
                std::string want_error_name) {
     CheckDoneFunc on_done = [&](const Status& status,
@@ -122,51 +124,51 @@ class ClientCacheCheckResponseTest : public ClientCacheTestBase {
     };
 
     const Status http_status(got_http_code, Envoy::EMPTY_STRING);
-    cache_->handleCheckResponse(http_status, got_response, on_done);
+    cache_->handleCheckResponse(http_status, std::move(got_response), on_done);
   }
 };
 
 TEST_F(ClientCacheCheckResponseTest, Http5xxAllowed) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
 
-  runTest(StatusCode::kUnavailable, response, StatusCode::kOk,
+  runTest(StatusCode::kUnavailable, std::move(response), StatusCode::kOk,
           ApiKeyState::NOT_CHECKED, "");
   checkAndReset(stats_.filter_.allowed_control_plane_fault_, 1);
 }
 
 TEST_F(ClientCacheCheckResponseTest, Http4xxTranslatedAndBlocked) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
 
-  runTest(StatusCode::kPermissionDenied, response, StatusCode::kInternal,
-          ApiKeyState::NOT_CHECKED, "PERMISSION_DENIED");
+  runTest(StatusCode::kPermissionDenied, std::move(response),
+          StatusCode::kInternal, ApiKeyState::NOT_CHECKED, "PERMISSION_DENIED");
   checkAndReset(stats_.filter_.denied_producer_error_, 1);
 }
 
 TEST_F(ClientCacheCheckResponseTest, Sc5xxAllowed) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
   CheckError* check_error = response->mutable_check_errors()->Add();
   check_error->set_code(CheckError::NAMESPACE_LOOKUP_UNAVAILABLE);
 
-  runTest(StatusCode::kOk, response, StatusCode::kOk, ApiKeyState::NOT_CHECKED,
-          "NAMESPACE_LOOKUP_UNAVAILABLE");
+  runTest(StatusCode::kOk, std::move(response), StatusCode::kOk,
+          ApiKeyState::NOT_CHECKED, "NAMESPACE_LOOKUP_UNAVAILABLE");
   checkAndReset(stats_.filter_.allowed_control_plane_fault_, 1);
 }
 
 TEST_F(ClientCacheCheckResponseTest, Sc4xxBlocked) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
   CheckError* check_error = response->mutable_check_errors()->Add();
   check_error->set_code(CheckError::CLIENT_APP_BLOCKED);
 
-  runTest(StatusCode::kOk, response, StatusCode::kPermissionDenied,
+  runTest(StatusCode::kOk, std::move(response), StatusCode::kPermissionDenied,
           ApiKeyState::VERIFIED, "CLIENT_APP_BLOCKED");
   checkAndReset(stats_.filter_.denied_consumer_blocked_, 1);
 }
 
 TEST_F(ClientCacheCheckResponseTest, ScOkAllowed) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
 
-  runTest(StatusCode::kOk, response, StatusCode::kOk, ApiKeyState::VERIFIED,
-          "");
+  runTest(StatusCode::kOk, std::move(response), StatusCode::kOk,
+          ApiKeyState::VERIFIED, "");
 }
 
 class ClientCacheCheckResponseNetworkFailClosedTest
@@ -177,24 +179,24 @@ class ClientCacheCheckResponseNetworkFailClosedTest
         ->set_value(false);
     cache_ = std::make_unique<ClientCache>(
         service_config_, filter_config_, "test", context_.scope_, cm_,
-        time_source_, dispatcher_, token_fn_, token_fn_);
+        time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
   }
 };
 
 TEST_F(ClientCacheCheckResponseNetworkFailClosedTest, Http5xxBlocked) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
 
-  runTest(StatusCode::kUnavailable, response, StatusCode::kUnavailable,
-          ApiKeyState::NOT_CHECKED, "UNAVAILABLE");
+  runTest(StatusCode::kUnavailable, std::move(response),
+          StatusCode::kUnavailable, ApiKeyState::NOT_CHECKED, "UNAVAILABLE");
   checkAndReset(stats_.filter_.denied_control_plane_fault_, 1);
 }
 
 TEST_F(ClientCacheCheckResponseNetworkFailClosedTest, Sc5xxBlocked) {
-  CheckResponse* response = new CheckResponse();
+  auto response = std::make_unique<ArenaCheckResponse>();
   CheckError* check_error = response->mutable_check_errors()->Add();
   check_error->set_code(CheckError::NAMESPACE_LOOKUP_UNAVAILABLE);
 
-  runTest(StatusCode::kOk, response, StatusCode::kUnavailable,
+  runTest(StatusCode::kOk, std::move(response), StatusCode::kUnavailable,
           ApiKeyState::NOT_CHECKED, "NAMESPACE_LOOKUP_UNAVAILABLE");
   checkAndReset(stats_.filter_.denied_control_plane_fault_, 1);
 }
@@ -203,7 +205,7 @@ class ClientCacheCheckResponseErrorTypeTest : public ClientCacheTestBase {
  protected:
   void runTest(CheckError_Code got_check_error_code,
                ApiKeyState want_api_key_state, std::string want_error_name) {
-    CheckResponse* response = new CheckResponse();
+    auto response = std::make_unique<ArenaCheckResponse>();
     CheckError* check_error = response->mutable_check_errors()->Add();
     check_error->set_code(got_check_error_code);
 
@@ -212,7 +214,7 @@ class ClientCacheCheckResponseErrorTypeTest : public ClientCacheTestBase {
       EXPECT_EQ(info.error.name, want_error_name);
     };
     const Status http_status(StatusCode::kOk, Envoy::EMPTY_STRING);
-    cache_->handleCheckResponse(http_status, response, on_done);
+    cache_->handleCheckResponse(http_status, std::move(response), on_done);
   }
 };
 
@@ -250,7 +252,7 @@ TEST_F(ClientCacheCheckResponseErrorTypeTest, ServiceNotActivated) {
 
 class ClientCacheQuotaResponseTest : public ClientCacheTestBase {
  protected:
-  void runTest(StatusCode got_http_code, AllocateQuotaResponse* got_response,
+  void runTest(StatusCode got_http_code, ArenaQuotaResponsePtr got_response,
                StatusCode want_client_code, std::string want_error_name) {
     QuotaDoneFunc on_done =
         [&](const Status& status,
@@ -261,37 +263,38 @@ class ClientCacheQuotaResponseTest : public ClientCacheTestBase {
         };
 
     const Status http_status(got_http_code, Envoy::EMPTY_STRING);
-    cache_->handleQuotaOnDone(http_status, got_response, on_done);
+    cache_->handleQuotaOnDone(http_status, std::move(got_response), on_done);
   }
 };
 
 TEST_F(ClientCacheQuotaResponseTest, HttpErrorBlocked) {
-  AllocateQuotaResponse* response = new AllocateQuotaResponse();
+  auto response = std::make_unique<ArenaQuotaResponse>();
 
-  runTest(StatusCode::kInternal, response, StatusCode::kInternal, "INTERNAL");
+  runTest(StatusCode::kInternal, std::move(response), StatusCode::kInternal,
+          "INTERNAL");
   checkAndReset(stats_.filter_.denied_producer_error_, 1);
 }
 
 TEST_F(ClientCacheQuotaResponseTest, ScErrorBlocked) {
-  AllocateQuotaResponse* response = new AllocateQuotaResponse();
+  auto response = std::make_unique<ArenaQuotaResponse>();
   QuotaError* quota_error = response->mutable_allocate_errors()->Add();
   quota_error->set_code(QuotaError::RESOURCE_EXHAUSTED);
 
-  runTest(StatusCode::kOk, response, StatusCode::kResourceExhausted,
+  runTest(StatusCode::kOk, std::move(response), StatusCode::kResourceExhausted,
           "RESOURCE_EXHAUSTED");
   checkAndReset(stats_.filter_.denied_consumer_quota_, 1);
 }
 
 TEST_F(ClientCacheQuotaResponseTest, ScOkAllowed) {
-  AllocateQuotaResponse* response = new AllocateQuotaResponse();
+  auto response = std::make_unique<ArenaQuotaResponse>();
 
-  runTest(StatusCode::kOk, response, StatusCode::kOk, "");
+  runTest(StatusCode::kOk, std::move(response), StatusCode::kOk, "");
 }
 
 class ClientCacheQuotaResponseErrorTypeTest : public ClientCacheTestBase {
  protected:
   void runTest(QuotaError_Code got_quota_error_code) {
-    AllocateQuotaResponse* response = new AllocateQuotaResponse();
+    auto response = std::make_unique<ArenaQuotaResponse>();
     QuotaError* quota_error = response->mutable_allocate_errors()->Add();
     quota_error->set_code(got_quota_error_code);
 
@@ -299,7 +302,7 @@ class ClientCacheQuotaResponseErrorTypeTest : public ClientCacheTestBase {
         [&](const Status&,
             const ::espv2::api_proxy::service_control::QuotaResponseInfo&) {};
     const Status http_status(StatusCode::kOk, Envoy::EMPTY_STRING);
-    cache_->handleQuotaOnDone(http_status, response, on_done);
+    cache_->handleQuotaOnDone(http_status, std::move(response), on_done);
   }
 };
 
@@ -326,7 +329,7 @@ class ClientCacheHttpRequestTest : public ClientCacheTestBase {
 
     cache_ = std::make_unique<ClientCache>(
         service_config_, filter_config_, "test", context_.scope_, cm_,
-        time_source_, dispatcher_, token_fn_, token_fn_);
+        time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
 
     // Setup mock http call.
     http_call_ = std::make_unique<MockHttpCall>();
@@ -343,6 +346,8 @@ class ClientCacheHttpRequestTest : public ClientCacheTestBase {
     cache_->report_call_factory_ = std::move(report_call_factory_);
   }
 
+  ClientCacheStatus cacheStatus() const { return cache_->status(); }
+
   int got_num_callbacks_ = 0;
   NiceMock<Envoy::Tracing::MockSpan> mock_parent_span_;
   std::unique_ptr<MockHttpCall> http_call_;
@@ -381,8 +386,9 @@ class ClientCacheCheckHttpRequestTest : public ClientCacheHttpRequestTest {
             Invoke([this](const Envoy::Protobuf::Message&,
                           Envoy::Tracing::Span&, HttpCall::DoneFunc on_done) {
               // Similar to production behavior of the HttpCallFactory.
+              Envoy::Buffer::OwnedImpl body;
               on_done(Status(StatusCode::kCancelled, "Request cancelled"),
-                      Envoy::EMPTY_STRING);
+                      body);
               return http_call_.get();
             }));
 
@@ -407,6 +413,12 @@ class ClientCacheCheckHttpRequestTest : public ClientCacheHttpRequestTest {
     return response;
   }
 
+  // Completes the pending HttpCall.
+  void httpDone(const Status& status, const std::string& body = "") {
+    Envoy::Buffer::OwnedImpl buffer(body);
+    http_done_(status, buffer);
+  }
+
   HttpCall::DoneFunc http_done_;
 };
 
@@ -427,10 +439,8 @@ TEST_F(ClientCacheCheckHttpRequestTest, OneSuccessfulHttpCall) {
 
   // Stimulate successful http response.
   // Test tear down will check the check callback is invoked.
-  std::string response_body;
   const CheckResponse response = getValidCheckResponse();
-  response.SerializeToString(&response_body);
-  http_done_(OkStatus(), response_body);
+  httpDone(OkStatus(), response.SerializeAsString());
 
   // RPC finished and invoked callback.
   EXPECT_EQ(got_num_callbacks_, 1);
@@ -459,7 +469,7 @@ TEST_F(ClientCacheCheckHttpRequestTest, OneHttpCallWithBadBody) {
   EXPECT_EQ(got_num_callbacks_, 0);
 
   // Stimulate bad http response body.
-  http_done_(OkStatus(), "this http body does not parse into a CheckResponse");
+  httpDone(OkStatus(), "this http body does not parse into a CheckResponse");
 
   // RPC finished and invoked callback.
   EXPECT_EQ(got_num_callbacks_, 1);
@@ -492,8 +502,7 @@ TEST_F(ClientCacheCheckHttpRequestTest, OnePendingHttpCallCancelled) {
 
   // Cancel the pending RPC.
   EXPECT_CALL(*http_call_, cancel()).WillOnce(Invoke([this]() {
-    http_done_(Status(StatusCode::kCancelled, "Request cancelled"),
-               Envoy::EMPTY_STRING);
+    httpDone(Status(StatusCode::kCancelled, "Request cancelled"));
   }));
   cancel_func();
 
@@ -529,10 +538,8 @@ TEST_F(ClientCacheCheckHttpRequestTest, SuccessfulHttpCallWithCache) {
 
   // Stimulate successful http response.
   // Test tear down will check the check callback is invoked.
-  std::string response_body;
   const CheckResponse response = getValidCheckResponse();
-  response.SerializeToString(&response_body);
-  http_done_(OkStatus(), response_body);
+  httpDone(OkStatus(), response.SerializeAsString());
 
   // Check call 2 & 3.
   cache_->callCheck(request, mock_parent_span_, on_check_done);
@@ -547,9 +554,779 @@ TEST_F(ClientCacheCheckHttpRequestTest, SuccessfulHttpCallWithCache) {
   // No more callbacks invoked during destructor.
   EXPECT_EQ(got_num_callbacks_, 3);
 
+  // Stats. The cache counts the calls it got, and the one it missed.
+  checkAndReset(stats_.check_.OK_, 1);
+  checkAndReset(stats_.check_.CANCELLED_, 1);
+  checkAndReset(stats_.check_cache_.flushed_, 1);
+  checkAndReset(stats_.check_cache_.called_, 3);
+  checkAndReset(stats_.check_cache_.missed_, 1);
+}
+
+// The checks answered by the aggregation cache count as hits in the status,
+// which is published once the cache is created.
+TEST_F(ClientCacheCheckHttpRequestTest, StatusCountsCacheHits) {
+  filter_config_.mutable_sc_calling_config()
+      ->mutable_circuit_breaker_failure_threshold()
+      ->set_value(2);
+  auto status_slot = std::make_shared<ClientCacheStatusSlot>();
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr, nullptr,
+      nullptr, status_slot);
+  EXPECT_EQ(status_slot->get().check_calls, 0);
+  EXPECT_EQ(status_slot->get().check_circuit_breaker, "closed");
+
+  EXPECT_CALL(*check_call_factory_, activeCalls()).WillRepeatedly(Return(1));
+  EXPECT_CALL(*quota_call_factory_, activeCalls()).WillRepeatedly(Return(0));
+  EXPECT_CALL(*report_call_factory_, activeCalls()).WillRepeatedly(Return(0));
+  setupHttpMocks(1, 1);
+
+  CheckDoneFunc on_check_done = [this](const Status&,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+  };
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  httpDone(OkStatus(), getValidCheckResponse().SerializeAsString());
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 3);
+
+  const ClientCacheStatus status = cacheStatus();
+  EXPECT_EQ(status.check_calls, 3);
+  EXPECT_EQ(status.check_cache_hits, 2);
+  EXPECT_EQ(status.check_calls_in_flight, 1);
+  EXPECT_EQ(status.check_circuit_breaker, "closed");
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.check_.OK_, 1);
+  checkAndReset(stats_.check_.CANCELLED_, 1);
+  checkAndReset(stats_.check_cache_.flushed_, 1);
+}
+
+// Check call 1: Cache miss occurs, the response is cached.
+// Later check calls: Cache hits, each one makes a bounded number of heap
+// allocations. The bound has headroom, it catches copies added to the hit path
+// rather than pinning its allocations.
+TEST_F(ClientCacheCheckHttpRequestTest, CacheHitAllocationsBounded) {
+  if (!AllocationCounter::enabled()) {
+    GTEST_SKIP() << "allocations are not counted with tcmalloc";
+  }
+  constexpr int kHits = 10;
+  constexpr uint64_t kMaxAllocationsPerHit = 40;
+  setupHttpMocks(1, 1);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  const CheckResponse response = getValidCheckResponse();
+  httpDone(OkStatus(), response.SerializeAsString());
+  // A first hit, so that lazily created state is not counted.
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+
+  AllocationCounter counter;
+  for (int i = 0; i < kHits; ++i) {
+    cache_->callCheck(request, mock_parent_span_, on_check_done);
+  }
+  const uint64_t allocations = counter.allocations();
+  EXPECT_LE(allocations, kHits * kMaxAllocationsPerHit)
+      << allocations / kHits << " allocations per cache hit";
+  EXPECT_EQ(got_num_callbacks_, kHits + 2);
+
+  cache_.reset(nullptr);
+
+  checkAndReset(stats_.check_.OK_, 1);
+  checkAndReset(stats_.check_.CANCELLED_, 1);
+  checkAndReset(stats_.check_cache_.flushed_, 1);
+}
+
+// Check call 1: Shared cache miss occurs, so cache makes HttpCall to SC Check.
+// HttpCall is successful and the response is stored in the shared cache.
+// Check call 2: Shared cache hit, the CheckDoneFunc is called right away.
+TEST_F(ClientCacheCheckHttpRequestTest, SuccessfulHttpCallWithSharedCache) {
+  // Disable the per-worker check cache so only the shared cache is used.
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  auto shared_check_cache = std::make_shared<SharedCheckCache>(
+      100, std::chrono::milliseconds(60000), std::chrono::milliseconds(0),
+      time_source_, stats_.shared_check_cache_);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, shared_check_cache);
+  setupHttpMocks(1, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  // Check call 1.
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 0);
+
+  const CheckResponse response = getValidCheckResponse();
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 1);
+
+  // Check call 2.
+  CancelFunc cancel_fn =
+      cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 2);
+  EXPECT_FALSE(cancel_fn);
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.check_.OK_, 1);
+  checkAndReset(stats_.shared_check_cache_.miss_, 1);
+  checkAndReset(stats_.shared_check_cache_.hit_, 1);
+  EXPECT_EQ(stats_.shared_check_cache_.entries_.value(), 1);
+}
+
+// The check request of a source is only built on the shared cache miss.
+TEST_F(ClientCacheCheckHttpRequestTest, SharedCacheHitWithoutRequest) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  auto shared_check_cache = std::make_shared<SharedCheckCache>(
+      100, std::chrono::milliseconds(60000), std::chrono::milliseconds(0),
+      time_source_, stats_.shared_check_cache_);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, shared_check_cache);
+  setupHttpMocks(1, 0);
+
+  class CountingSource : public CheckRequestSource {
+   public:
+    explicit CountingSource(const CheckRequest& request)
+        : request_(request) {}
+    std::string signature() override {
+      return SharedCheckCache::signature(request_);
+    }
+    std::string consumerSignature() override {
+      return SharedCheckCache::consumerSignature(request_);
+    }
+    const CheckRequest& request() override {
+      ++built_;
+      return request_;
+    }
+
+    const CheckRequest& request_;
+    int built_ = 0;
+  };
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+  const CheckRequest request = getValidCheckRequest();
+  CountingSource source(request);
+  cache_->callCheck(source, mock_parent_span_, on_check_done);
+  httpDone(OkStatus(), getValidCheckResponse().SerializeAsString());
+  EXPECT_EQ(source.built_, 1);
+
+  cache_->callCheck(source, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 2);
+  EXPECT_EQ(source.built_, 1);
+
+  cache_.reset(nullptr);
+  checkAndReset(stats_.shared_check_cache_.hit_, 1);
+}
+
+// Check call 1: Shared cache miss occurs, so cache makes HttpCall to SC Check.
+// Check call 2: Shared cache hit within the refresh-ahead window. The
+// CheckDoneFunc is called right away, and a background HttpCall refreshes the
+// entry.
+TEST_F(ClientCacheCheckHttpRequestTest, SharedCacheRefreshAhead) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  // The window covers the whole entry life, so every hit refreshes.
+  auto shared_check_cache = std::make_shared<SharedCheckCache>(
+      100, std::chrono::milliseconds(60000), std::chrono::milliseconds(60000),
+      time_source_, stats_.shared_check_cache_);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, shared_check_cache);
+  setupHttpMocks(2, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  // Check call 1.
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  const CheckResponse response = getValidCheckResponse();
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 1);
+
+  // Check call 2.
+  CancelFunc cancel_fn =
+      cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 2);
+  EXPECT_FALSE(cancel_fn);
+
+  // The background call completes.
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 2);
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.check_.OK_, 2);
+  checkAndReset(stats_.shared_check_cache_.miss_, 1);
+  checkAndReset(stats_.shared_check_cache_.hit_, 1);
+  checkAndReset(stats_.shared_check_cache_.refreshed_ahead_, 1);
+  EXPECT_EQ(stats_.shared_check_cache_.entries_.value(), 1);
+}
+
+// Check call 1: Shared cache miss occurs, so cache makes HttpCall to SC Check.
+// Check call 2: Shared cache hit within the refresh-ahead window, the
+// background HttpCall fails.
+// Check call 3: Shared cache hit, the entry is refreshed again.
+TEST_F(ClientCacheCheckHttpRequestTest, SharedCacheRefreshAheadAfterFailure) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  auto shared_check_cache = std::make_shared<SharedCheckCache>(
+      100, std::chrono::milliseconds(60000), std::chrono::milliseconds(60000),
+      time_source_, stats_.shared_check_cache_);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, shared_check_cache);
+  setupHttpMocks(3, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  // Check call 1.
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  const CheckResponse response = getValidCheckResponse();
+  httpDone(OkStatus(), response.SerializeAsString());
+
+  // Check call 2.
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  httpDone(Status(StatusCode::kUnavailable, "unavailable"));
+
+  // Check call 3.
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 3);
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.check_.OK_, 2);
+  checkAndReset(stats_.check_.UNAVAILABLE_, 1);
+  checkAndReset(stats_.shared_check_cache_.miss_, 1);
+  checkAndReset(stats_.shared_check_cache_.hit_, 2);
+  checkAndReset(stats_.shared_check_cache_.refreshed_ahead_, 2);
+}
+
+// Check call 1: HttpCall is successful, the response is kept as known-good.
+// Check call 2: HttpCall fails with 503, the known-good response is served.
+// Check call 3: The known-good response is served right away, and a
+// background HttpCall revalidates it.
+TEST_F(ClientCacheCheckHttpRequestTest, StaleResponseServedOnFailure) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  auto stale_check_cache = std::make_shared<SharedCheckCache>(
+      100, std::chrono::milliseconds(60000), std::chrono::milliseconds(0),
+      time_source_, stats_.stale_check_cache_);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr,
+      stale_check_cache);
+  setupHttpMocks(3, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  // Check call 1.
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  const CheckResponse response = getValidCheckResponse();
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 1);
+
+  // Check call 2.
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  httpDone(Status(StatusCode::kUnavailable, "unavailable"));
+  EXPECT_EQ(got_num_callbacks_, 2);
+
+  // Check call 3.
+  CancelFunc cancel_fn =
+      cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 3);
+  EXPECT_FALSE(cancel_fn);
+
+  // The revalidation succeeds.
+  httpDone(OkStatus(), response.SerializeAsString());
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.check_.OK_, 2);
+  checkAndReset(stats_.check_.UNAVAILABLE_, 1);
+  checkAndReset(stats_.filter_.allowed_stale_check_, 2);
+  checkAndReset(stats_.stale_check_cache_.hit_, 2);
+}
+
+// Check call 1: HttpCall is successful, the response rejects the API key and
+// is stored in the negative cache.
+// Check call 2: Negative cache hit, the request is denied without HttpCall.
+TEST_F(ClientCacheCheckHttpRequestTest, InvalidApiKeyNegativeCached) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  auto negative_check_cache = std::make_shared<SharedCheckCache>(
+      100, std::chrono::milliseconds(30000), std::chrono::milliseconds(0),
+      time_source_, stats_.negative_check_cache_);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr, nullptr,
+      negative_check_cache);
+  setupHttpMocks(1, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo& info) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kInvalidArgument);
+    EXPECT_EQ(info.error.name, "API_KEY_INVALID");
+  };
+
+  // Check call 1.
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  CheckResponse response = getValidCheckResponse();
+  response.add_check_errors()->set_code(CheckError::API_KEY_INVALID);
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 1);
+
+  // Check call 2.
+  CancelFunc cancel_fn =
+      cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 2);
+  EXPECT_FALSE(cancel_fn);
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.check_.OK_, 1);
+  checkAndReset(stats_.filter_.denied_consumer_error_, 2);
+  checkAndReset(stats_.negative_check_cache_.miss_, 1);
+  checkAndReset(stats_.negative_check_cache_.hit_, 1);
+  EXPECT_EQ(stats_.negative_check_cache_.entries_.value(), 1);
+}
+
+// Check call 1 & 2: Cache miss occurs for both while the first HttpCall is
+// pending, so they share one HttpCall to SC Check.
+// HttpCall is successful, and both CheckDoneFuncs are called.
+TEST_F(ClientCacheCheckHttpRequestTest, ConcurrentMissesCoalesced) {
+  // Disable the per-worker check cache so every call is a cache miss.
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  filter_config_.mutable_aggregation_config()
+      ->mutable_coalesce_check_calls()
+      ->set_value(true);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+  setupHttpMocks(1, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 0);
+
+  const CheckResponse response = getValidCheckResponse();
+  httpDone(OkStatus(), response.SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 2);
+
+  cache_.reset(nullptr);
+
   // Stats.
   checkAndReset(stats_.check_.OK_, 1);
+  checkAndReset(stats_.filter_.check_coalesced_, 1);
+}
+
+// Check call 1 & 2 share one pending HttpCall. Cancelling call 1 only detaches
+// it, cancelling call 2 cancels the HttpCall.
+TEST_F(ClientCacheCheckHttpRequestTest, CoalescedCallCancelledByLastCaller) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  filter_config_.mutable_aggregation_config()
+      ->mutable_coalesce_check_calls()
+      ->set_value(true);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+  setupHttpMocks(1, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kInternal);
+  };
+
+  const CheckRequest request = getValidCheckRequest();
+  CancelFunc cancel_func_1 =
+      cache_->callCheck(request, mock_parent_span_, on_check_done);
+  CancelFunc cancel_func_2 =
+      cache_->callCheck(request, mock_parent_span_, on_check_done);
+
+  EXPECT_CALL(*http_call_, cancel()).Times(0);
+  cancel_func_1();
+  EXPECT_EQ(got_num_callbacks_, 1);
+  testing::Mock::VerifyAndClearExpectations(http_call_.get());
+
+  EXPECT_CALL(*http_call_, cancel()).WillOnce(Invoke([this]() {
+    httpDone(Status(StatusCode::kCancelled, "Request cancelled"));
+  }));
+  cancel_func_2();
+  EXPECT_EQ(got_num_callbacks_, 2);
+
+  cache_.reset(nullptr);
+
+  // Stats.
   checkAndReset(stats_.check_.CANCELLED_, 1);
+  checkAndReset(stats_.filter_.check_coalesced_, 1);
+  checkAndReset(stats_.filter_.denied_producer_error_, 2);
+}
+
+// Check call 1 & 2: Cache miss occurs, the HttpCalls fail with 5xx and open
+// the circuit breaker.
+// Check call 3: Short-circuited without an HttpCall, and failed open.
+TEST_F(ClientCacheCheckHttpRequestTest, CircuitBreakerOpenFailsFast) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  filter_config_.mutable_sc_calling_config()
+      ->mutable_circuit_breaker_failure_threshold()
+      ->set_value(2);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+  setupHttpMocks(2, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  const CheckRequest request = getValidCheckRequest();
+  for (int i = 0; i < 2; ++i) {
+    cache_->callCheck(request, mock_parent_span_, on_check_done);
+    httpDone(Status(StatusCode::kUnavailable, "Service unavailable"));
+  }
+  EXPECT_EQ(got_num_callbacks_, 2);
+
+  // Check call 3 completes right away.
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 3);
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.filter_.allowed_control_plane_fault_, 3);
+  checkAndReset(stats_.check_circuit_breaker_.opened_, 1);
+  checkAndReset(stats_.check_circuit_breaker_.short_circuited_, 1);
+}
+
+// Check call 1: Cache miss occurs, the HttpCall takes the only slot of the
+// concurrency limit.
+// Check call 2: Rejected without an HttpCall, and failed open.
+TEST_F(ClientCacheCheckHttpRequestTest, ConcurrencyLimitFailsFast) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+  auto* limit = filter_config_.mutable_sc_calling_config()
+                    ->mutable_check_concurrency_limit();
+  limit->set_initial_limit(1);
+  limit->set_max_limit(1);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+  setupHttpMocks(1, 0);
+
+  CheckDoneFunc on_check_done = [this](const Status& got_status,
+                                       const CheckResponseInfo&) {
+    got_num_callbacks_++;
+    EXPECT_EQ(got_status.code(), StatusCode::kOk);
+  };
+
+  const CheckRequest request = getValidCheckRequest();
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(stats_.check_concurrency_limit_.limit_.value(), 1);
+
+  // Check call 2 completes right away.
+  cache_->callCheck(request, mock_parent_span_, on_check_done);
+  EXPECT_EQ(got_num_callbacks_, 1);
+
+  httpDone(OkStatus(), getValidCheckResponse().SerializeAsString());
+  EXPECT_EQ(got_num_callbacks_, 2);
+
+  cache_.reset(nullptr);
+
+  // Stats.
+  checkAndReset(stats_.filter_.allowed_control_plane_fault_, 1);
+  checkAndReset(stats_.check_concurrency_limit_.rejected_, 1);
+  EXPECT_EQ(stats_.check_concurrency_limit_.limit_.value(), 0);
+}
+
+// The cache is idle while none of its calls is in flight, and counted live
+// until destroyed.
+TEST_F(ClientCacheHttpRequestTest, IdleWithoutCallsInFlight) {
+  EXPECT_EQ(stats_.client_cache_.live_.value(), 1);
+  EXPECT_CALL(*check_call_factory_, activeCalls()).WillRepeatedly(Return(0));
+  EXPECT_CALL(*quota_call_factory_, activeCalls()).WillRepeatedly(Return(0));
+  EXPECT_CALL(*report_call_factory_, activeCalls())
+      .WillOnce(Return(1))
+      .WillRepeatedly(Return(0));
+  injectFactoryMocks();
+
+  EXPECT_FALSE(cache_->idle());
+  EXPECT_TRUE(cache_->idle());
+
+  cache_.reset(nullptr);
+  EXPECT_EQ(stats_.client_cache_.live_.value(), 0);
+}
+
+// The memory of the cache and its owner is counted for the service until the
+// cache is destroyed.
+TEST_F(ClientCacheHttpRequestTest, MemoryCounted) {
+  ServiceMemoryStats memory_stats =
+      ServiceMemoryStats::create("test", kServiceName, context_.scope_);
+  const uint64_t cache_bytes = memory_stats.client_cache_bytes_.value();
+
+  cache_->set_owner_bytes_fn([]() { return 1000; });
+  cache_->onStatsTimer();
+  EXPECT_EQ(memory_stats.client_cache_bytes_.value(), cache_bytes + 1000);
+
+  cache_.reset(nullptr);
+  EXPECT_EQ(memory_stats.client_cache_bytes_.value(), 0);
+}
+
+class ClientCacheAggregationConfigTest : public ClientCacheTestBase {
+  void SetUp() override {}
+};
+
+TEST_F(ClientCacheAggregationConfigTest, DefaultCapacity) {
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+
+  EXPECT_EQ(stats_.check_cache_.capacity_.value(), 10000);
+  EXPECT_EQ(stats_.quota_cache_.capacity_.value(), 10000);
+  EXPECT_EQ(stats_.report_cache_.capacity_.value(), 10000);
+
+  // Capacity is released when the cache is destroyed.
+  cache_.reset(nullptr);
+  EXPECT_EQ(stats_.check_cache_.capacity_.value(), 0);
+  EXPECT_EQ(stats_.quota_cache_.capacity_.value(), 0);
+  EXPECT_EQ(stats_.report_cache_.capacity_.value(), 0);
+}
+
+TEST_F(ClientCacheAggregationConfigTest, FilterConfigCapacity) {
+  auto* aggregation_config = filter_config_.mutable_aggregation_config();
+  aggregation_config->mutable_check_cache_entries()->set_value(50000);
+  aggregation_config->mutable_quota_cache_entries()->set_value(200);
+  aggregation_config->mutable_report_cache_entries()->set_value(0);
+
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+
+  EXPECT_EQ(stats_.check_cache_.capacity_.value(), 50000);
+  EXPECT_EQ(stats_.quota_cache_.capacity_.value(), 200);
+  EXPECT_EQ(stats_.report_cache_.capacity_.value(), 0);
+}
+
+TEST_F(ClientCacheAggregationConfigTest, ServiceOverridesFilterConfig) {
+  auto* filter_aggregation_config = filter_config_.mutable_aggregation_config();
+  filter_aggregation_config->mutable_check_cache_entries()->set_value(50000);
+  filter_aggregation_config->mutable_quota_cache_entries()->set_value(200);
+
+  // Only the fields set on the service take precedence, even when set to 0.
+  service_config_.mutable_aggregation_config()
+      ->mutable_check_cache_entries()
+      ->set_value(0);
+
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+
+  EXPECT_EQ(stats_.check_cache_.capacity_.value(), 0);
+  EXPECT_EQ(stats_.quota_cache_.capacity_.value(), 200);
+  EXPECT_EQ(stats_.report_cache_.capacity_.value(), 10000);
+}
+
+class ClientCacheSplitReportTest : public ClientCacheHttpRequestTest {
+ public:
+  static std::vector<ReportRequest> splitReportRequest(
+      const ReportRequest& request, uint32_t max_operations,
+      uint32_t max_bytes) {
+    return ClientCache::splitReportRequest(request, max_operations, max_bytes);
+  }
+
+  ReportRequest getReportRequest(int num_operations) {
+    ReportRequest request;
+    request.set_service_name(kServiceName);
+    request.set_service_config_id(kServiceConfigId);
+    for (int i = 0; i < num_operations; ++i) {
+      request.add_operations()->set_operation_id(
+          absl::StrCat("operation-", i, "-", std::string(100, 'x')));
+    }
+    return request;
+  }
+};
+
+TEST_F(ClientCacheSplitReportTest, NotSplitUnderLimits) {
+  const ReportRequest request = getReportRequest(5);
+  EXPECT_TRUE(splitReportRequest(request, 0, 0).empty());
+  EXPECT_TRUE(splitReportRequest(request, 5, request.ByteSizeLong()).empty());
+}
+
+TEST_F(ClientCacheSplitReportTest, SplitByOperations) {
+  const ReportRequest request = getReportRequest(5);
+  const auto split_requests = splitReportRequest(request, 2, 0);
+
+  ASSERT_EQ(split_requests.size(), 3);
+  EXPECT_EQ(split_requests[0].operations_size(), 2);
+  EXPECT_EQ(split_requests[1].operations_size(), 2);
+  EXPECT_EQ(split_requests[2].operations_size(), 1);
+  for (const auto& split_request : split_requests) {
+    EXPECT_EQ(split_request.service_name(), kServiceName);
+    EXPECT_EQ(split_request.service_config_id(), kServiceConfigId);
+  }
+  EXPECT_EQ(split_requests[2].operations(0).operation_id(),
+            request.operations(4).operation_id());
+}
+
+TEST_F(ClientCacheSplitReportTest, SplitByBytes) {
+  const ReportRequest request = getReportRequest(5);
+  const auto split_requests = splitReportRequest(request, 0, 300);
+
+  ASSERT_GT(split_requests.size(), 1);
+  int num_operations = 0;
+  for (const auto& split_request : split_requests) {
+    EXPECT_LE(split_request.ByteSizeLong(), 300);
+    num_operations += split_request.operations_size();
+  }
+  EXPECT_EQ(num_operations, 5);
+}
+
+TEST_F(ClientCacheSplitReportTest, SplitReportSentInSeparateCalls) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_report_cache_entries()
+      ->set_value(0);
+  filter_config_.mutable_aggregation_config()
+      ->mutable_report_max_operations()
+      ->set_value(2);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+
+  std::vector<HttpCall::DoneFunc> http_dones;
+  EXPECT_CALL(*http_call_, call()).Times(3);
+  EXPECT_CALL(*report_call_factory_, createHttpCall(_, _, _))
+      .Times(3)
+      .WillRepeatedly(
+          Invoke([this, &http_dones](const Envoy::Protobuf::Message& message,
+                                     Envoy::Tracing::Span&,
+                                     HttpCall::DoneFunc on_done) {
+            EXPECT_LE(static_cast<const ReportRequest&>(message)
+                          .operations_size(),
+                      2);
+            http_dones.push_back(on_done);
+            return http_call_.get();
+          }));
+  injectFactoryMocks();
+
+  cache_->callReport(getReportRequest(5));
+
+  ASSERT_EQ(http_dones.size(), 3);
+  for (auto& http_done : http_dones) {
+    Envoy::Buffer::OwnedImpl body;
+    http_done(OkStatus(), body);
+  }
+
+  cache_.reset(nullptr);
+  checkAndReset(stats_.report_.OK_, 3);
+}
+
+TEST_F(ClientCacheHttpRequestTest, FailedReportSpooled) {
+  filter_config_.mutable_aggregation_config()
+      ->mutable_report_cache_entries()
+      ->set_value(0);
+  filter_config_.mutable_sc_calling_config()
+      ->mutable_report_spool()
+      ->set_max_bytes(1024);
+  cache_ = std::make_unique<ClientCache>(
+      service_config_, filter_config_, "test", context_.scope_, cm_,
+      time_source_, dispatcher_, token_fn_, token_fn_, nullptr);
+
+  HttpCall::DoneFunc http_done;
+  std::shared_ptr<const std::string> http_body;
+  EXPECT_CALL(*http_call_, call());
+  EXPECT_CALL(*report_call_factory_, createSerializedHttpCall(_, _, _))
+      .WillOnce(Invoke([this, &http_done, &http_body](
+                           std::shared_ptr<const std::string> body,
+                           Envoy::Tracing::Span&, HttpCall::DoneFunc on_done) {
+        http_body = body;
+        http_done = on_done;
+        return http_call_.get();
+      }));
+  injectFactoryMocks();
+
+  ReportRequest request;
+  request.set_service_name(kServiceName);
+  request.add_operations()->set_operation_id("operation-id");
+  cache_->callReport(request);
+  ASSERT_NE(http_body, nullptr);
+  EXPECT_EQ(*http_body, request.SerializeAsString());
+
+  Envoy::Buffer::OwnedImpl body;
+  http_done(Status(StatusCode::kUnavailable, "unavailable"), body);
+
+  EXPECT_EQ(stats_.report_spool_.spooled_bytes_.value(),
+            request.ByteSizeLong());
+  EXPECT_EQ(stats_.report_spool_.bytes_.value(), request.ByteSizeLong());
+
+  cache_.reset(nullptr);
+  EXPECT_EQ(stats_.report_spool_.bytes_.value(), 0);
+  checkAndReset(stats_.report_.UNAVAILABLE_, 1);
 }
 
 }  // namespace test
@@ -0,0 +1,127 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/concurrency_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+// The number of calls over which the lowest latency is taken.
+constexpr uint32_t kLatencyWindowCalls = 500;
+
+// The lowest gradient of one call, so a slow outlier at most halves the
+// limit.
+constexpr double kMinGradient = 0.5;
+
+// The weight of each call in the limit, so it moves in steps.
+constexpr double kSmoothing = 0.2;
+
+// The cut of the limit on an unavailable or timed out call.
+constexpr double kBackoffRatio = 0.9;
+
+// The latencies are taken as at least this, so the gradient of the calls
+// answered within the same millisecond stays one.
+constexpr double kMinLatencyMs = 1;
+
+}  // namespace
+
+ConcurrencyLimiter::ConcurrencyLimiter(uint32_t initial_limit,
+                                       uint32_t min_limit, uint32_t max_limit,
+                                       const ConcurrencyLimitStats& stats)
+    : min_limit_(std::max<uint32_t>(min_limit, 1)),
+      max_limit_(std::max<double>(max_limit, min_limit_)),
+      stats_(stats),
+      limit_(std::min(std::max<double>(initial_limit, min_limit_),
+                      max_limit_)) {
+  stats_.limit_.add(limit());
+}
+
+ConcurrencyLimiter::~ConcurrencyLimiter() { stats_.limit_.sub(limit()); }
+
+bool ConcurrencyLimiter::tryAcquire() {
+  if (in_flight_ >= limit()) {
+    stats_.rejected_.inc();
+    return false;
+  }
+  ++in_flight_;
+  return true;
+}
+
+void ConcurrencyLimiter::onCallDone(const Status& status,
+                                    std::chrono::milliseconds latency) {
+  // Taken before the release, the calls in flight along with this one.
+  const uint32_t in_flight = in_flight_;
+  if (in_flight_ > 0) {
+    --in_flight_;
+  }
+
+  // All 5xx errors and timeouts are already translated to Unavailable.
+  if (status.code() == StatusCode::kUnavailable ||
+      status.code() == StatusCode::kDeadlineExceeded) {
+    setLimit(limit_ * kBackoffRatio);
+    return;
+  }
+  // The latencies of the cancelled calls and local errors tell nothing
+  // about Service Control.
+  if (status.code() == StatusCode::kCancelled ||
+      status.code() == StatusCode::kInternal) {
+    return;
+  }
+
+  const double latency_ms = std::max<double>(latency.count(), kMinLatencyMs);
+  if (window_calls_ == 0 || latency_ms < window_min_latency_ms_) {
+    window_min_latency_ms_ = latency_ms;
+  }
+  if (min_latency_ms_ == 0 || window_min_latency_ms_ < min_latency_ms_) {
+    min_latency_ms_ = window_min_latency_ms_;
+  }
+  if (++window_calls_ >= kLatencyWindowCalls) {
+    min_latency_ms_ = window_min_latency_ms_;
+    window_calls_ = 0;
+  }
+
+  const double gradient =
+      std::max(kMinGradient, std::min(1.0, min_latency_ms_ / latency_ms));
+  // A worker far below its limit learns nothing about a higher one.
+  if (gradient >= 1.0 && 2 * in_flight < limit_) {
+    return;
+  }
+  setLimit((1 - kSmoothing) * limit_ +
+           kSmoothing * (limit_ * gradient + std::sqrt(limit_)));
+}
+
+void ConcurrencyLimiter::setLimit(double limit) {
+  const uint32_t previous = this->limit();
+  limit_ = std::min(std::max(limit, min_limit_), max_limit_);
+  const uint32_t current = this->limit();
+  if (current > previous) {
+    stats_.limit_.add(current - previous);
+  } else if (current < previous) {
+    stats_.limit_.sub(previous - current);
+  }
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
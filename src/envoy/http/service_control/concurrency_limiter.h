@@ -0,0 +1,75 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "google/protobuf/stubs/status.h"
+#include "src/envoy/http/service_control/filter_stats.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// An adaptive limit of the calls to Service Control one worker has in flight.
+//
+// The limit follows the gradient of the latencies: each call moves it toward
+// the limit scaled by the ratio of the lowest latency of the recent calls to
+// its own, plus room for a queue of the square root of the limit. So it
+// grows while the latencies stay near the lowest one, and shrinks as the
+// server slows down. An unavailable or timed out call cuts it by a tenth.
+// Not thread safe.
+class ConcurrencyLimiter {
+ public:
+  ConcurrencyLimiter(uint32_t initial_limit, uint32_t min_limit,
+                     uint32_t max_limit, const ConcurrencyLimitStats& stats);
+  ~ConcurrencyLimiter();
+
+  // Returns false if the call should be rejected, the limit is reached.
+  // Otherwise the call is in flight until onCallDone().
+  bool tryAcquire();
+
+  // Records the result and latency of a call that was acquired.
+  void onCallDone(const ::google::protobuf::util::Status& status,
+                  std::chrono::milliseconds latency);
+
+  uint32_t limit() const { return static_cast<uint32_t>(limit_); }
+  uint32_t inFlight() const { return in_flight_; }
+
+ private:
+  void setLimit(double limit);
+
+  const double min_limit_;
+  const double max_limit_;
+  ConcurrencyLimitStats stats_;
+
+  double limit_;
+  uint32_t in_flight_ = 0;
+  // The lowest latency of the previous window of calls, and of the current
+  // one, in milliseconds. The baseline follows the server as it changes.
+  double min_latency_ms_ = 0;
+  double window_min_latency_ms_ = 0;
+  uint32_t window_calls_ = 0;
+};
+
+using ConcurrencyLimiterPtr = std::unique_ptr<ConcurrencyLimiter>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,126 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/concurrency_limiter.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/server/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+class ConcurrencyLimiterTest : public ::testing::Test {
+ protected:
+  ConcurrencyLimiterTest()
+      : stats_(ServiceControlFilterStats::create("test", context_.scope_)) {}
+
+  ConcurrencyLimiterPtr makeLimiter(uint32_t initial_limit) {
+    return std::make_unique<ConcurrencyLimiter>(
+        initial_limit, 1, 100, stats_.check_concurrency_limit_);
+  }
+
+  // Makes `calls` concurrent calls, all done after `latency`.
+  void callConcurrently(ConcurrencyLimiter& limiter, uint32_t calls,
+                        std::chrono::milliseconds latency) {
+    for (uint32_t i = 0; i < calls; ++i) {
+      ASSERT_TRUE(limiter.tryAcquire());
+    }
+    for (uint32_t i = 0; i < calls; ++i) {
+      limiter.onCallDone(OkStatus(), latency);
+    }
+  }
+
+  testing::NiceMock<Envoy::Server::Configuration::MockFactoryContext> context_;
+  ServiceControlFilterStats stats_;
+};
+
+TEST_F(ConcurrencyLimiterTest, RejectedAboveLimit) {
+  auto limiter = makeLimiter(2);
+  EXPECT_EQ(stats_.check_concurrency_limit_.limit_.value(), 2);
+  EXPECT_TRUE(limiter->tryAcquire());
+  EXPECT_TRUE(limiter->tryAcquire());
+  EXPECT_FALSE(limiter->tryAcquire());
+  EXPECT_EQ(stats_.check_concurrency_limit_.rejected_.value(), 1);
+
+  limiter->onCallDone(OkStatus(), std::chrono::milliseconds(10));
+  EXPECT_EQ(limiter->inFlight(), 1);
+  EXPECT_TRUE(limiter->tryAcquire());
+
+  limiter.reset();
+  EXPECT_EQ(stats_.check_concurrency_limit_.limit_.value(), 0);
+}
+
+TEST_F(ConcurrencyLimiterTest, GrowsWhileLatenciesStayLow) {
+  auto limiter = makeLimiter(4);
+  for (int i = 0; i < 10; ++i) {
+    callConcurrently(*limiter, limiter->limit(), std::chrono::milliseconds(10));
+  }
+  EXPECT_GT(limiter->limit(), 10);
+  EXPECT_EQ(stats_.check_concurrency_limit_.limit_.value(), limiter->limit());
+
+  // Not while the worker is far below its limit.
+  const uint32_t limit = limiter->limit();
+  callConcurrently(*limiter, 1, std::chrono::milliseconds(10));
+  EXPECT_EQ(limiter->limit(), limit);
+}
+
+TEST_F(ConcurrencyLimiterTest, ShrinksAsLatenciesRise) {
+  auto limiter = makeLimiter(20);
+  callConcurrently(*limiter, 1, std::chrono::milliseconds(10));
+  EXPECT_EQ(limiter->limit(), 20);
+
+  for (int i = 0; i < 20; ++i) {
+    callConcurrently(*limiter, 1, std::chrono::milliseconds(100));
+  }
+  EXPECT_LT(limiter->limit(), 10);
+  EXPECT_GE(limiter->limit(), 1);
+}
+
+TEST_F(ConcurrencyLimiterTest, BacksOffOnUnavailable) {
+  auto limiter = makeLimiter(10);
+  ASSERT_TRUE(limiter->tryAcquire());
+  limiter->onCallDone(Status(StatusCode::kUnavailable, "unavailable"),
+                      std::chrono::milliseconds(1000));
+  EXPECT_EQ(limiter->limit(), 9);
+  EXPECT_EQ(stats_.check_concurrency_limit_.limit_.value(), 9);
+
+  // The cancelled calls are only released.
+  ASSERT_TRUE(limiter->tryAcquire());
+  limiter->onCallDone(Status(StatusCode::kCancelled, "cancelled"),
+                      std::chrono::milliseconds(1));
+  EXPECT_EQ(limiter->limit(), 9);
+  EXPECT_EQ(limiter->inFlight(), 0);
+
+  // Down to the lowest limit.
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_TRUE(limiter->tryAcquire());
+    limiter->onCallDone(Status(StatusCode::kDeadlineExceeded, "timeout"),
+                        std::chrono::milliseconds(1000));
+  }
+  EXPECT_EQ(limiter->limit(), 1);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -14,9 +14,19 @@
 
 #include "src/envoy/http/service_control/config_parser.h"
 
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "source/common/protobuf/utility.h"
+#include "src/api_proxy/utils/memory_bytes.h"
+#include "src/envoy/utils/string_interner.h"
 
+using ::espv2::api::envoy::v10::http::service_control::ApiKeyLocation;
 using ::espv2::api::envoy::v10::http::service_control::FilterConfig;
+using ::espv2::api::envoy::v10::http::service_control::Service;
+using ::espv2::api_proxy::service_control::protocol::Protocol;
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::SlotBytes;
+using ::espv2::api_proxy::utils::VectorBytes;
 
 namespace espv2 {
 namespace envoy {
@@ -26,11 +36,98 @@ namespace {
 
 // The operation name for not matched requests.
 const char kUnrecognizedOperation[] = "<Unknown Operation Name>";
+
+// Delimeter used in jwt payload key path
+constexpr char kJwtPayLoadsDelimeter = '.';
 }  // namespace
 
+Protocol getBackendProtocol(const Service& service) {
+  const std::string& protocol = service.backend_protocol();
+  if (protocol == "http1" || protocol == "http2") {
+    return Protocol::HTTP;
+  }
+  if (protocol == "grpc") {
+    return Protocol::GRPC;
+  }
+  return Protocol::UNKNOWN;
+}
+
+uint32_t internOperationName(absl::string_view operation_name) {
+  static auto* interner = new utils::StringInterner();
+  return interner->intern(operation_name);
+}
+
+LoggedJwtPayload::LoggedJwtPayload(const std::string& metadata_name,
+                                   const std::string& payload_path)
+    : path(payload_path) {
+  steps.push_back(metadata_name);
+  for (absl::string_view step :
+       absl::StrSplit(payload_path, kJwtPayLoadsDelimeter)) {
+    steps.emplace_back(step);
+  }
+}
+
+ApiKeyLocations::ApiKeyLocations(
+    const ::google::protobuf::RepeatedPtrField<ApiKeyLocation>&
+        api_key_locations) {
+  locations.reserve(api_key_locations.size());
+  for (const auto& location : api_key_locations) {
+    switch (location.key_case()) {
+      case ApiKeyLocation::kQuery:
+        locations.push_back({location.key_case(), location.query(),
+                             Envoy::Http::LowerCaseString(""), false});
+        break;
+      case ApiKeyLocation::kHeader: {
+        Envoy::Http::LowerCaseString header(location.header());
+        const bool inline_header = header.get() == kDefaultApiKeyHeader;
+        locations.push_back({location.key_case(), location.header(),
+                             std::move(header), inline_header});
+        break;
+      }
+      case ApiKeyLocation::kCookie:
+        locations.push_back({location.key_case(), location.cookie(),
+                             Envoy::Http::LowerCaseString(""), false});
+        cookie_names.insert(location.cookie());
+        break;
+      case ApiKeyLocation::KEY_NOT_SET:
+        break;
+    }
+  }
+}
+
+ApiKeyFormatMatcher::ApiKeyFormatMatcher(
+    const ::espv2::api::envoy::v10::http::service_control::ApiKeyFormat&
+        config)
+    : min_length_(config.min_length()),
+      max_length_(config.max_length()),
+      check_characters_(!config.allowed_characters().empty()) {
+  if (max_length_ > 0 && max_length_ < min_length_) {
+    throw Envoy::ProtoValidationException(
+        "api_key_format max_length is below min_length", config);
+  }
+  for (const char c : config.allowed_characters()) {
+    allowed_.set(static_cast<unsigned char>(c));
+  }
+}
+
+bool ApiKeyFormatMatcher::matches(absl::string_view api_key) const {
+  if (api_key.size() < min_length_ ||
+      (max_length_ > 0 && api_key.size() > max_length_)) {
+    return false;
+  }
+  if (check_characters_) {
+    for (const char c : api_key) {
+      if (!allowed_.test(static_cast<unsigned char>(c))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 FilterConfigParser::FilterConfigParser(const FilterConfig& config,
                                        ServiceControlCallFactory& factory)
-    : config_(config) {
+    : config_(config), api_key_format_(config.api_key_format()) {
   ServiceContext* first_srv_ctx = nullptr;
   for (const auto& service : config_.services()) {
     ServiceContext* srv_ctx = new ServiceContext(service, factory);
@@ -53,9 +150,20 @@ FilterConfigParser::FilterConfigParser(const FilterConfig& config,
       throw Envoy::ProtoValidationException("Invalid service name",
                                             requirement);
     }
-    requirements_map_.emplace(requirement.operation_name(),
-                              RequirementContextPtr(new RequirementContext(
-                                  requirement, *service_it->second)));
+    auto* require_ctx =
+        new RequirementContext(requirement, *service_it->second);
+    if (!requirements_map_
+             .emplace(requirement.operation_name(),
+                      RequirementContextPtr(require_ctx))
+             .second) {
+      continue;
+    }
+
+    const uint32_t id = internOperationName(requirement.operation_name());
+    if (id >= requirements_by_id_.size()) {
+      requirements_by_id_.resize(id + 1, nullptr);
+    }
+    requirements_by_id_[id] = require_ctx;
   }
 
   if (requirements_map_.size() <
@@ -64,6 +172,25 @@ FilterConfigParser::FilterConfigParser(const FilterConfig& config,
                                           config_);
   }
 
+  // The requirements of a service with the same metrics share the method
+  // name of their AllocateQuota requests, aggregated by the method name and
+  // the metric names.
+  absl::flat_hash_map<std::string, absl::string_view> quota_method_names;
+  for (const auto& requirement : config_.requirements()) {
+    RequirementContext& require_ctx =
+        *requirements_map_[requirement.operation_name()];
+    if (require_ctx.metric_costs().empty()) {
+      continue;
+    }
+    std::string metrics = requirement.service_name();
+    for (const auto& metric_cost : require_ctx.metric_costs()) {
+      absl::StrAppend(&metrics, "\n", metric_cost.first);
+    }
+    require_ctx.set_quota_method_name(
+        quota_method_names.emplace(metrics, requirement.operation_name())
+            .first->second);
+  }
+
   // Construct a requirement for non matched requests
   non_match_rqm_cfg_.set_service_name(first_srv_ctx->config().service_name());
   non_match_rqm_cfg_.set_operation_name(kUnrecognizedOperation);
@@ -71,9 +198,73 @@ FilterConfigParser::FilterConfigParser(const FilterConfig& config,
       new RequirementContext(non_match_rqm_cfg_, *first_srv_ctx));
 
   // The default places to extract api-key
-  default_api_keys_.add_locations()->set_query("key");
-  default_api_keys_.add_locations()->set_query("api_key");
-  default_api_keys_.add_locations()->set_header("x-api-key");
+  ::espv2::api::envoy::v10::http::service_control::ApiKeyRequirement
+      default_api_keys;
+  default_api_keys.add_locations()->set_query("key");
+  default_api_keys.add_locations()->set_query("api_key");
+  default_api_keys.add_locations()->set_header(kDefaultApiKeyHeader);
+  default_api_key_locations_ = ApiKeyLocations(default_api_keys.locations());
+}
+
+size_t ApiKeyLocations::bytes() const {
+  size_t bytes = VectorBytes(locations) + SlotBytes(cookie_names);
+  for (const Location& location : locations) {
+    bytes += HeapBytes(location.name) + HeapBytes(location.header.get());
+  }
+  for (const std::string& name : cookie_names) {
+    bytes += HeapBytes(name);
+  }
+  return bytes;
+}
+
+size_t ServiceContext::bytes() const {
+  size_t bytes = sizeof(*this) + VectorBytes(log_request_headers_) +
+                 VectorBytes(log_response_headers_) +
+                 VectorBytes(log_jwt_payloads_) +
+                 VectorBytes(jwt_issuer_steps_) +
+                 VectorBytes(jwt_audience_steps_);
+  for (const LoggedHeaders* headers :
+       {&log_request_headers_, &log_response_headers_}) {
+    for (const LoggedHeader& header : *headers) {
+      bytes += HeapBytes(header.name) + HeapBytes(header.key.get());
+    }
+  }
+  for (const LoggedJwtPayload& payload : log_jwt_payloads_) {
+    bytes += HeapBytes(payload.path) + VectorBytes(payload.steps);
+    for (const std::string& step : payload.steps) {
+      bytes += HeapBytes(step);
+    }
+  }
+  for (const std::string& step : jwt_issuer_steps_) {
+    bytes += HeapBytes(step);
+  }
+  for (const std::string& step : jwt_audience_steps_) {
+    bytes += HeapBytes(step);
+  }
+  return bytes;
+}
+
+size_t RequirementContext::bytes() const {
+  size_t bytes = sizeof(*this) + api_key_locations_.bytes() +
+                 VectorBytes(metric_costs_);
+  for (const auto& metric_cost : metric_costs_) {
+    bytes += HeapBytes(metric_cost.first);
+  }
+  return bytes;
+}
+
+size_t FilterConfigParser::bytes() const {
+  size_t bytes =
+      SlotBytes(requirements_map_) + VectorBytes(requirements_by_id_) +
+      non_match_rqm_cfg_.SpaceUsedLong() + non_match_rqm_ctx_->bytes() +
+      SlotBytes(service_map_) + default_api_key_locations_.bytes();
+  for (const auto& requirement : requirements_map_) {
+    bytes += HeapBytes(requirement.first) + requirement.second->bytes();
+  }
+  for (const auto& service : service_map_) {
+    bytes += HeapBytes(service.first) + service.second->bytes();
+  }
+  return bytes;
 }
 
 }  // namespace service_control
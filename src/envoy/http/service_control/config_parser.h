@@ -14,10 +14,17 @@
 
 #pragma once
 
+#include <algorithm>
+#include <bitset>
+#include <string>
+#include <vector>
+
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/string_view.h"
 #include "api/envoy/v10/http/service_control/config.pb.h"
 #include "api/envoy/v10/http/service_control/requirement.pb.h"
+#include "envoy/http/header_map.h"
 #include "envoy/router/router.h"
 #include "source/common/protobuf/utility.h"
 #include "src/envoy/http/service_control/service_control_call.h"
@@ -34,18 +41,126 @@ constexpr int64_t kDefaultMinStreamReportIntervalMs = 10000;
 // The lower bound a user can configure the interval too.
 // This represents a realistic round-trip time for SC Report from GCP.
 constexpr int64_t kLowerBoundMinStreamReportIntervalMs = 100;
+
+// The jwt payload paths of the issuer and audience.
+constexpr char kJwtPayloadIssuerPath[] = "iss";
+constexpr char kJwtPayloadAudiencePath[] = "aud";
 }  // namespace
 
 // The filter name.
 constexpr const char kFilterName[] =
     "com.google.espv2.filters.http.service_control";
 
+// Returns the id of the operation name. The ids are dense and never reused,
+// so a per-route config and the filter config agree on the id of an operation
+// while they are built and updated apart. Only called when the configs are
+// built.
+uint32_t internOperationName(absl::string_view operation_name);
+
+// A header to log, with its lookup key built once.
+struct LoggedHeader {
+  explicit LoggedHeader(const std::string& header)
+      : name(header), key(header) {}
+
+  // The name as configured, used in the log.
+  std::string name;
+  Envoy::Http::LowerCaseString key;
+};
+using LoggedHeaders = std::vector<LoggedHeader>;
+
+// A jwt payload to log, with its path in the jwt_authn metadata split once.
+struct LoggedJwtPayload {
+  LoggedJwtPayload(const std::string& metadata_name,
+                   const std::string& payload_path);
+
+  // The path as configured, used in the log.
+  std::string path;
+  // The metadata name, followed by the fields of the path.
+  std::vector<std::string> steps;
+};
+using LoggedJwtPayloads = std::vector<LoggedJwtPayload>;
+
+// Returns the protocol of the backend service or UNKNOWN if not found.
+::espv2::api_proxy::service_control::protocol::Protocol getBackendProtocol(
+    const ::espv2::api::envoy::v10::http::service_control::Service& service);
+
+// The header of the default api key locations. Registered as an inline
+// header, the other header locations are only known once the inline headers
+// are finalized.
+constexpr char kDefaultApiKeyHeader[] = "x-api-key";
+
+// The locations to extract an api key from, compiled once so a request parses
+// its query string and cookies at most once, and looks up the headers with
+// keys built here.
+struct ApiKeyLocations {
+  ApiKeyLocations() = default;
+  explicit ApiKeyLocations(
+      const ::google::protobuf::RepeatedPtrField<
+          ::espv2::api::envoy::v10::http::service_control::ApiKeyLocation>&
+          locations);
+
+  struct Location {
+    ::espv2::api::envoy::v10::http::service_control::ApiKeyLocation::KeyCase
+        type;
+    // The query parameter, header or cookie name.
+    std::string name;
+    // The lookup key of a header location.
+    Envoy::Http::LowerCaseString header;
+    // If set, the header is kDefaultApiKeyHeader, read by its inline handle.
+    bool inline_header;
+  };
+  // The heap bytes of the locations, roughly.
+  size_t bytes() const;
+
+  // In the order they are checked.
+  std::vector<Location> locations;
+  // The names of the cookie locations.
+  absl::flat_hash_set<std::string> cookie_names;
+};
+
+// The format of the api keys to check, compiled once. Admits any key if not
+// configured.
+class ApiKeyFormatMatcher {
+ public:
+  ApiKeyFormatMatcher() = default;
+  explicit ApiKeyFormatMatcher(
+      const ::espv2::api::envoy::v10::http::service_control::ApiKeyFormat&
+          config);
+
+  // Returns false if the api key can not be valid.
+  bool matches(absl::string_view api_key) const;
+
+ private:
+  size_t min_length_ = 0;
+  // 0 if there is no limit.
+  size_t max_length_ = 0;
+  // Indexed by the bytes of the key. Only used if check_characters_.
+  std::bitset<256> allowed_;
+  bool check_characters_ = false;
+};
+
 class ServiceContext {
  public:
   ServiceContext(
       const ::espv2::api::envoy::v10::http::service_control::Service& config,
       ServiceControlCallFactory& factory)
-      : config_(config), service_control_call_(factory.create(config_)) {
+      : config_(config),
+        service_control_call_(factory.create(config_)),
+        log_request_headers_(config_.log_request_headers().begin(),
+                             config_.log_request_headers().end()),
+        log_response_headers_(config_.log_response_headers().begin(),
+                              config_.log_response_headers().end()),
+        jwt_issuer_steps_{config_.jwt_payload_metadata_name(),
+                          kJwtPayloadIssuerPath},
+        jwt_audience_steps_{config_.jwt_payload_metadata_name(),
+                            kJwtPayloadAudiencePath},
+        backend_protocol_(getBackendProtocol(config_)) {
+    log_jwt_payloads_.reserve(config_.log_jwt_payloads().size());
+    for (const std::string& path : config_.log_jwt_payloads()) {
+      log_jwt_payloads_.emplace_back(config_.jwt_payload_metadata_name(),
+                                     path);
+    }
+
     min_stream_report_interval_ms_ = config_.min_stream_report_interval_ms();
     if (!min_stream_report_interval_ms_) {
       min_stream_report_interval_ms_ = kDefaultMinStreamReportIntervalMs;
@@ -69,9 +184,44 @@ class ServiceContext {
 
   ServiceControlCall& call() const { return *service_control_call_; }
 
+  const LoggedHeaders& log_request_headers() const {
+    return log_request_headers_;
+  }
+  const LoggedHeaders& log_response_headers() const {
+    return log_response_headers_;
+  }
+  const LoggedJwtPayloads& log_jwt_payloads() const {
+    return log_jwt_payloads_;
+  }
+
+  // The jwt_authn metadata paths of the issuer and audience of the jwt.
+  const std::vector<std::string>& jwt_issuer_steps() const {
+    return jwt_issuer_steps_;
+  }
+  const std::vector<std::string>& jwt_audience_steps() const {
+    return jwt_audience_steps_;
+  }
+
+  // The protocol of the backend, from the config.
+  ::espv2::api_proxy::service_control::protocol::Protocol backend_protocol()
+      const {
+    return backend_protocol_;
+  }
+
+  // The memory held by the context, roughly, without the config and the
+  // service control call.
+  size_t bytes() const;
+
  private:
   const ::espv2::api::envoy::v10::http::service_control::Service& config_;
-  ServiceControlCallPtr service_control_call_;
+  ServiceControlCallSharedPtr service_control_call_;
+  const LoggedHeaders log_request_headers_;
+  const LoggedHeaders log_response_headers_;
+  LoggedJwtPayloads log_jwt_payloads_;
+  const std::vector<std::string> jwt_issuer_steps_;
+  const std::vector<std::string> jwt_audience_steps_;
+  const ::espv2::api_proxy::service_control::protocol::Protocol
+      backend_protocol_;
   int64_t min_stream_report_interval_ms_;
 };
 using ServiceContextPtr = std::unique_ptr<ServiceContext>;
@@ -81,12 +231,19 @@ class RequirementContext {
   RequirementContext(
       const ::espv2::api::envoy::v10::http::service_control::Requirement& config,
       const ServiceContext& service_ctx)
-      : config_(config), service_ctx_(service_ctx) {
+      : config_(config),
+        service_ctx_(service_ctx),
+        api_key_locations_(config.api_key().locations()),
+        quota_method_name_(config.operation_name()) {
+    // A metric without a positive cost is allocated as one, like the
+    // AllocateQuota request would. Sorted by name, so the requirements of
+    // the same metrics list them alike.
     metric_costs_.reserve(config.metric_costs().size());
     for (const auto& metric_cost : config.metric_costs()) {
-      metric_costs_.push_back(
-          std::make_pair(metric_cost.name(), metric_cost.cost()));
+      metric_costs_.push_back(std::make_pair(
+          metric_cost.name(), std::max<int64_t>(metric_cost.cost(), 1)));
     }
+    std::sort(metric_costs_.begin(), metric_costs_.end());
   }
 
   const ::espv2::api::envoy::v10::http::service_control::Requirement& config()
@@ -96,14 +253,37 @@ class RequirementContext {
 
   const ServiceContext& service_ctx() const { return service_ctx_; }
 
+  // The api key locations of the requirement. Empty if the default ones are
+  // used.
+  const ApiKeyLocations& api_key_locations() const {
+    return api_key_locations_;
+  }
+
   const std::vector<std::pair<std::string, int>>& metric_costs() const {
     return metric_costs_;
   }
 
+  // The method name of the AllocateQuota requests. The operation name of the
+  // first requirement of the service with the same metrics, so that their
+  // quota is aggregated together. It is the method name sent to Service
+  // Control, so it may differ from the operation name, which the Check and
+  // Report requests keep. The zero costs are not pruned to skip the quota:
+  // they are allocated as one.
+  absl::string_view quota_method_name() const { return quota_method_name_; }
+  void set_quota_method_name(absl::string_view name) {
+    quota_method_name_ = name;
+  }
+
+  // The memory held by the context, roughly, without the config.
+  size_t bytes() const;
+
  private:
   const ::espv2::api::envoy::v10::http::service_control::Requirement& config_;
   const ServiceContext& service_ctx_;
+  const ApiKeyLocations api_key_locations_;
   std::vector<std::pair<std::string, int>> metric_costs_;
+  // Refers to the operation name of a requirement config.
+  absl::string_view quota_method_name_;
 };
 using RequirementContextPtr = std::unique_ptr<RequirementContext>;
 
@@ -127,20 +307,39 @@ class FilterConfigParser {
     return requirement_it->second.get();
   }
 
-  const ::espv2::api::envoy::v10::http::service_control::ApiKeyRequirement&
-  default_api_keys() const {
-    return default_api_keys_;
+  // Returns the requirement of the id from internOperationName(), or nullptr
+  // if no requirement has the operation.
+  const RequirementContext* find_requirement_by_id(
+      uint32_t operation_id) const {
+    return operation_id < requirements_by_id_.size()
+               ? requirements_by_id_[operation_id]
+               : nullptr;
+  }
+
+  // The locations to extract an api key from if the requirement has none.
+  const ApiKeyLocations& default_api_key_locations() const {
+    return default_api_key_locations_;
   }
 
   const RequirementContext* non_match_rqm_ctx() const {
     return non_match_rqm_ctx_.get();
   }
 
+  const ApiKeyFormatMatcher& api_key_format() const {
+    return api_key_format_;
+  }
+
+  // The memory held by the requirement and service maps, roughly. The proto
+  // config is not included.
+  size_t bytes() const;
+
  private:
   // The proto config.
   const ::espv2::api::envoy::v10::http::service_control::FilterConfig& config_;
   // Operation name to RequirementContext map.
   absl::flat_hash_map<std::string, RequirementContextPtr> requirements_map_;
+  // The requirements indexed by the id of their operation name.
+  std::vector<const RequirementContext*> requirements_by_id_;
   // The requirement for non matched requests for sending their reports.
   ::espv2::api::envoy::v10::http::service_control::Requirement
       non_match_rqm_cfg_;
@@ -148,20 +347,32 @@ class FilterConfigParser {
   // Service name to ServiceContext map.
   absl::flat_hash_map<std::string, ServiceContextPtr> service_map_;
   // The default locations to extract api-key.
-  ::espv2::api::envoy::v10::http::service_control::ApiKeyRequirement
-      default_api_keys_;
+  ApiKeyLocations default_api_key_locations_;
+  const ApiKeyFormatMatcher api_key_format_;
 };
 
 class PerRouteFilterConfig : public Envoy::Router::RouteSpecificFilterConfig {
  public:
   PerRouteFilterConfig(const ::espv2::api::envoy::v10::http::service_control::
                            PerRouteFilterConfig& per_route)
-      : operation_name_(per_route.operation_name()) {}
+      : operation_name_(per_route.operation_name()),
+        operation_id_(internOperationName(operation_name_)),
+        skip_service_control_(per_route.skip_service_control()) {}
 
   absl::string_view operation_name() const { return operation_name_; }
 
+  // The id of the operation name, to find its requirement without hashing the
+  // name per request.
+  uint32_t operation_id() const { return operation_id_; }
+
+  // If true, the filter passes the requests of the route through without a
+  // handler.
+  bool skip_service_control() const { return skip_service_control_; }
+
  private:
   std::string operation_name_;
+  uint32_t operation_id_;
+  bool skip_service_control_;
 };
 
 using PerRouteFilterConfigSharedPtr = std::shared_ptr<PerRouteFilterConfig>;
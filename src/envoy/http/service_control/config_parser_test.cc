@@ -14,6 +14,7 @@
 
 #include "src/envoy/http/service_control/config_parser.h"
 
+#include "absl/strings/str_cat.h"
 #include "gmock/gmock.h"
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
@@ -75,6 +76,110 @@ requirements {
   EXPECT_FALSE(parser.find_requirement("non-existing-operation"));
 }
 
+TEST(ConfigParserTest, FindRequirementByPerRouteOperationId) {
+  FilterConfig config;
+  const char kFilterConfig[] = R"(
+services {
+  service_name: "echo"
+}
+requirements {
+  service_name: "echo"
+  operation_name: "get_foo"
+})";
+  ASSERT_TRUE(TextFormat::ParseFromString(kFilterConfig, &config));
+  testing::NiceMock<MockServiceControlCallFactory> mock_factory;
+  FilterConfigParser parser(config, mock_factory);
+
+  ::espv2::api::envoy::v10::http::service_control::PerRouteFilterConfig
+      per_route_cfg;
+  per_route_cfg.set_operation_name("get_foo");
+  // Built apart from the filter config, as on a route config update.
+  const PerRouteFilterConfig per_route(per_route_cfg);
+  EXPECT_EQ(parser.find_requirement_by_id(per_route.operation_id()),
+            parser.find_requirement("get_foo"));
+
+  // An operation unknown to the filter config falls back to no requirement.
+  per_route_cfg.set_operation_name("get_bar");
+  const PerRouteFilterConfig other_route(per_route_cfg);
+  EXPECT_NE(other_route.operation_id(), per_route.operation_id());
+  EXPECT_EQ(parser.find_requirement_by_id(other_route.operation_id()),
+            nullptr);
+}
+
+TEST(ConfigParserTest, QuotaMetricsMerged) {
+  FilterConfig config;
+  const char kFilterConfig[] = R"(
+services {
+  service_name: "echo"
+}
+requirements {
+  service_name: "echo"
+  operation_name: "get_foo"
+  metric_costs { name: "read" cost: 1 }
+  metric_costs { name: "all" cost: 2 }
+}
+requirements {
+  service_name: "echo"
+  operation_name: "get_bar"
+  metric_costs { name: "all" cost: 1 }
+  metric_costs { name: "read" cost: 3 }
+}
+requirements {
+  service_name: "echo"
+  operation_name: "post_foo"
+  metric_costs { name: "write" cost: 2 }
+}
+requirements {
+  service_name: "echo"
+  operation_name: "post_bar"
+  metric_costs { name: "write" cost: 0 }
+})";
+  ASSERT_TRUE(TextFormat::ParseFromString(kFilterConfig, &config));
+  testing::NiceMock<MockServiceControlCallFactory> mock_factory;
+  FilterConfigParser parser(config, mock_factory);
+
+  // The costs are sorted by metric names.
+  const std::vector<std::pair<std::string, int>> expected_costs = {
+      {"all", 1}, {"read", 3}};
+  EXPECT_EQ(parser.find_requirement("get_bar")->metric_costs(),
+            expected_costs);
+  // A zero cost is allocated as one.
+  const std::vector<std::pair<std::string, int>> expected_zero_costs = {
+      {"write", 1}};
+  EXPECT_EQ(parser.find_requirement("post_bar")->metric_costs(),
+            expected_zero_costs);
+
+  // The requirements of the same metrics share the quota method name.
+  EXPECT_EQ(parser.find_requirement("get_foo")->quota_method_name(),
+            "get_foo");
+  EXPECT_EQ(parser.find_requirement("get_bar")->quota_method_name(),
+            "get_foo");
+  EXPECT_EQ(parser.find_requirement("post_foo")->quota_method_name(),
+            "post_foo");
+  EXPECT_EQ(parser.find_requirement("post_bar")->quota_method_name(),
+            "post_foo");
+}
+
+TEST(ConfigParserTest, BytesGrowWithRequirements) {
+  FilterConfig config;
+  ASSERT_TRUE(TextFormat::ParseFromString(R"(
+services {
+  service_name: "echo"
+})",
+                                          &config));
+  testing::NiceMock<MockServiceControlCallFactory> mock_factory;
+  const size_t service_bytes = FilterConfigParser(config, mock_factory).bytes();
+  EXPECT_GT(service_bytes, 0);
+
+  for (int i = 0; i < 10; ++i) {
+    auto* requirement = config.add_requirements();
+    requirement->set_service_name("echo");
+    requirement->set_operation_name(absl::StrCat("operation_", i));
+  }
+  EXPECT_GT(FilterConfigParser(config, mock_factory).bytes(),
+            service_bytes + 10 * sizeof(RequirementContext));
+}
+
 TEST(ConfigParserTest, DuplicatedServiceNames) {
   FilterConfig config;
   const char kConfigWithDupliacedService[] = R"(
@@ -131,6 +236,45 @@ requirements {
                           "Invalid service name");
 }
 
+TEST(ConfigParserTest, LoggedFieldsPrebuilt) {
+  FilterConfig config;
+  const char kFilterConfig[] = R"(
+services {
+  service_name: "echo"
+  log_request_headers: "X-Foo"
+  log_jwt_payloads: "sub"
+  log_jwt_payloads: "foo.bar"
+  jwt_payload_metadata_name: "jwt_payloads"
+}
+requirements {
+  service_name: "echo"
+  operation_name: "get_foo"
+})";
+  ASSERT_TRUE(TextFormat::ParseFromString(kFilterConfig, &config));
+  testing::NiceMock<MockServiceControlCallFactory> mock_factory;
+  FilterConfigParser parser(config, mock_factory);
+  const ServiceContext& service_ctx =
+      parser.find_requirement("get_foo")->service_ctx();
+
+  ASSERT_EQ(service_ctx.log_request_headers().size(), 1);
+  EXPECT_EQ(service_ctx.log_request_headers()[0].name, "X-Foo");
+  EXPECT_EQ(service_ctx.log_request_headers()[0].key.get(), "x-foo");
+  EXPECT_TRUE(service_ctx.log_response_headers().empty());
+
+  ASSERT_EQ(service_ctx.log_jwt_payloads().size(), 2);
+  EXPECT_EQ(service_ctx.log_jwt_payloads()[0].path, "sub");
+  EXPECT_THAT(service_ctx.log_jwt_payloads()[0].steps,
+              testing::ElementsAre("jwt_payloads", "sub"));
+  EXPECT_EQ(service_ctx.log_jwt_payloads()[1].path, "foo.bar");
+  EXPECT_THAT(service_ctx.log_jwt_payloads()[1].steps,
+              testing::ElementsAre("jwt_payloads", "foo", "bar"));
+
+  EXPECT_THAT(service_ctx.jwt_issuer_steps(),
+              testing::ElementsAre("jwt_payloads", "iss"));
+  EXPECT_THAT(service_ctx.jwt_audience_steps(),
+              testing::ElementsAre("jwt_payloads", "aud"));
+}
+
 TEST(ConfigParserTest, InvalidMinReportInterval) {
   FilterConfig config;
   const char kFilterInvalidService[] = R"(
@@ -149,6 +293,27 @@ requirements {
                           "min_stream_report_interval_ms");
 }
 
+TEST(ConfigParserTest, ApiKeyFormat) {
+  ::espv2::api::envoy::v10::http::service_control::ApiKeyFormat config;
+  EXPECT_TRUE(ApiKeyFormatMatcher(config).matches("any key"));
+
+  config.set_min_length(3);
+  config.set_max_length(5);
+  config.set_allowed_characters("abc-");
+  const ApiKeyFormatMatcher format(config);
+  EXPECT_TRUE(format.matches("ab-"));
+  EXPECT_TRUE(format.matches("aaaaa"));
+  EXPECT_FALSE(format.matches("ab"));
+  EXPECT_FALSE(format.matches("aaaaaa"));
+  EXPECT_FALSE(format.matches("abd"));
+  EXPECT_FALSE(format.matches(absl::string_view("ab\0", 3)));
+
+  config.set_max_length(2);
+  EXPECT_THROW_WITH_REGEX(ApiKeyFormatMatcher{config},
+                          Envoy::ProtoValidationException,
+                          "max_length is below min_length");
+}
+
 }  // namespace
 }  // namespace service_control
 }  // namespace http_filters
@@ -0,0 +1,64 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/connection_check_memo.h"
+
+#include <algorithm>
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::espv2::api_proxy::service_control::CheckResponseInfo;
+
+const CheckResponseInfo* ConnectionCheckMemo::lookup(
+    absl::string_view signature, Envoy::MonotonicTime now) const {
+  for (const Entry& entry : entries_) {
+    if (entry.signature == signature) {
+      return entry.expire_time > now ? &entry.info : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+void ConnectionCheckMemo::insert(absl::string_view signature,
+                                 const CheckResponseInfo& info,
+                                 Envoy::MonotonicTime now) {
+  Entry* target = nullptr;
+  for (Entry& entry : entries_) {
+    if (entry.signature == signature) {
+      target = &entry;
+      break;
+    }
+  }
+  if (target == nullptr && entries_.size() < kConnectionCheckMemoSize) {
+    target = &entries_.emplace_back();
+  }
+  if (target == nullptr) {
+    // All the entries have the same ttl, the oldest expires first.
+    target = &*std::min_element(entries_.begin(), entries_.end(),
+                                [](const Entry& a, const Entry& b) {
+                                  return a.expire_time < b.expire_time;
+                                });
+  }
+  target->signature.assign(signature.data(), signature.size());
+  target->info = info;
+  target->expire_time = now + ttl_;
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
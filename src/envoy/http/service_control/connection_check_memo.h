@@ -0,0 +1,75 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "envoy/common/time.h"
+#include "envoy/stream_info/filter_state.h"
+#include "src/api_proxy/service_control/request_info.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// The filter state name of the memo, with the connection life span.
+constexpr char kFilterStateConnectionCheckMemo[] =
+    "com.google.espv2.service_control.connection_check_memo";
+
+// Remembers the allowed Check results of the streams of a downstream
+// connection, for a time well below the expiration of the check cache, so
+// the later streams with the same check request skip the client cache. Only
+// used on the worker of the connection.
+class ConnectionCheckMemo : public Envoy::StreamInfo::FilterState::Object {
+ public:
+  explicit ConnectionCheckMemo(std::chrono::milliseconds ttl) : ttl_(ttl) {}
+
+  // Returns the result remembered for the signature, or nullptr if there is
+  // none or it expired. Valid until the next insert.
+  const ::espv2::api_proxy::service_control::CheckResponseInfo* lookup(
+      absl::string_view signature, Envoy::MonotonicTime now) const;
+
+  // Remembers the result for the ttl. Replaces the entry of the same
+  // signature, or the oldest one once the memo is full.
+  void insert(
+      absl::string_view signature,
+      const ::espv2::api_proxy::service_control::CheckResponseInfo& info,
+      Envoy::MonotonicTime now);
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    std::string signature;
+    ::espv2::api_proxy::service_control::CheckResponseInfo info;
+    Envoy::MonotonicTime expire_time;
+  };
+
+  const std::chrono::milliseconds ttl_;
+  // A connection serves few distinct callers, so the entries are scanned.
+  std::vector<Entry> entries_;
+};
+
+// The most entries of a memo.
+constexpr size_t kConnectionCheckMemoSize = 16;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,79 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/connection_check_memo.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::espv2::api_proxy::service_control::CheckResponseInfo;
+
+class ConnectionCheckMemoTest : public ::testing::Test {
+ protected:
+  ConnectionCheckMemoTest() : memo_(std::chrono::milliseconds(1000)) {}
+
+  CheckResponseInfo info(absl::string_view consumer_number) {
+    CheckResponseInfo info;
+    info.consumer_number = std::string(consumer_number);
+    return info;
+  }
+
+  ConnectionCheckMemo memo_;
+  Envoy::MonotonicTime now_;
+};
+
+TEST_F(ConnectionCheckMemoTest, ExpiresAfterTtl) {
+  EXPECT_EQ(memo_.lookup("a", now_), nullptr);
+  memo_.insert("a", info("1"), now_);
+
+  now_ += std::chrono::milliseconds(999);
+  const CheckResponseInfo* found = memo_.lookup("a", now_);
+  ASSERT_NE(found, nullptr);
+  EXPECT_EQ(found->consumer_number, "1");
+  EXPECT_EQ(memo_.lookup("b", now_), nullptr);
+
+  now_ += std::chrono::milliseconds(1);
+  EXPECT_EQ(memo_.lookup("a", now_), nullptr);
+
+  // Inserted again, the entry is refreshed in place.
+  memo_.insert("a", info("2"), now_);
+  EXPECT_EQ(memo_.size(), 1);
+  EXPECT_EQ(memo_.lookup("a", now_)->consumer_number, "2");
+}
+
+TEST_F(ConnectionCheckMemoTest, ReplacesOldestWhenFull) {
+  for (size_t i = 0; i < kConnectionCheckMemoSize; ++i) {
+    memo_.insert(absl::StrCat(i), info(absl::StrCat(i)), now_);
+    now_ += std::chrono::milliseconds(1);
+  }
+  EXPECT_EQ(memo_.size(), kConnectionCheckMemoSize);
+
+  memo_.insert("new", info("new"), now_);
+  EXPECT_EQ(memo_.size(), kConnectionCheckMemoSize);
+  EXPECT_EQ(memo_.lookup("0", now_), nullptr);
+  EXPECT_NE(memo_.lookup("1", now_), nullptr);
+  EXPECT_EQ(memo_.lookup("new", now_)->consumer_number, "new");
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -15,10 +15,13 @@
 #include "src/envoy/http/service_control/filter.h"
 
 #include <chrono>
+#include <utility>
 
 #include "envoy/http/header_map.h"
 #include "source/common/grpc/status.h"
+#include "src/envoy/http/service_control/config_parser.h"
 #include "src/envoy/http/service_control/handler.h"
+#include "src/envoy/utils/filter_state_utils.h"
 #include "src/envoy/utils/http_header_utils.h"
 #include "src/envoy/utils/rc_detail_utils.h"
 
@@ -27,8 +30,30 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
+namespace {
+
+// Returns the per-route config of the route entry, nullptr if it has none.
+const PerRouteFilterConfig* findPerRouteConfig(
+    const Envoy::Router::RouteEntry* route_entry) {
+  if (route_entry == nullptr) {
+    return nullptr;
+  }
+  return route_entry->perFilterConfigTyped<PerRouteFilterConfig>(kFilterName);
+}
+
+}  // namespace
+
+ServiceControlFilter::~ServiceControlFilter() {
+  // The stream is done with the handler, including the report of the access
+  // log which may come after onDestroy().
+  if (handler_) {
+    factory_.releaseHandler(std::move(handler_));
+  }
+}
+
 void ServiceControlFilter::onDestroy() {
   ENVOY_LOG(debug, "Called ServiceControl Filter : {}", __func__);
+  stream_report_timer_.reset();
   if (handler_) {
     handler_->onDestroy();
   }
@@ -36,20 +61,17 @@ void ServiceControlFilter::onDestroy() {
 
 Envoy::Http::FilterHeadersStatus ServiceControlFilter::decodeHeaders(
     Envoy::Http::RequestHeaderMap& headers, bool) {
+  const auto timed = callback_timer_.decode();
   ENVOY_LOG(debug, "Called ServiceControl Filter : {}", __func__);
 
   if (!headers.Method()) {
     rejectRequest(Envoy::Http::Code::BadRequest,
                   "No method in request headers.",
-                  utils::generateRcDetails(utils::kRcDetailFilterServiceControl,
-                                           utils::kRcDetailErrorTypeBadRequest,
-                                           utils::kRcDetailErrorMissingMethod));
+                  utils::kRcDetailsServiceControlMissingMethod);
     return Envoy::Http::FilterHeadersStatus::StopIteration;
   } else if (!headers.Path()) {
     rejectRequest(Envoy::Http::Code::BadRequest, "No path in request headers.",
-                  utils::generateRcDetails(utils::kRcDetailFilterServiceControl,
-                                           utils::kRcDetailErrorTypeBadRequest,
-                                           utils::kRcDetailErrorMissingPath));
+                  utils::kRcDetailsServiceControlMissingPath);
     return Envoy::Http::FilterHeadersStatus::StopIteration;
   }
 
@@ -69,11 +91,30 @@ Envoy::Http::FilterHeadersStatus ServiceControlFilter::decodeHeaders(
     return Envoy::Http::FilterHeadersStatus::Continue;
   }
 
-  handler_ =
-      factory_.createHandler(headers, decoder_callbacks_->streamInfo(), stats_);
+  // Looked up once, for the filter and its handler.
+  const PerRouteFilterConfig* per_route =
+      findPerRouteConfig(route->routeEntry());
+  if (per_route != nullptr && per_route->skip_service_control()) {
+    ENVOY_LOG(debug, "Service control is skipped for operation {}",
+              per_route->operation_name());
+    utils::setStringFilterState(*decoder_callbacks_->streamInfo().filterState(),
+                                utils::kFilterStateApiMethod,
+                                per_route->operation_name());
+    skipped_ = true;
+    state_ = Complete;
+    return Envoy::Http::FilterHeadersStatus::Continue;
+  }
+
+  request_headers_ = &headers;
+  // Read by the handler and the later ESPv2 filters.
+  utils::EspRequestContext::getOrCreate(
+      *decoder_callbacks_->streamInfo().filterState(), headers);
+  handler_ = factory_.createHandler(headers, decoder_callbacks_->streamInfo(),
+                                    per_route, stats_);
   handler_->fillFilterState(*decoder_callbacks_->streamInfo().filterState());
   state_ = Calling;
   stopped_ = false;
+  forwarding_ = handler_->forwardWhileChecking();
 
   Envoy::Tracing::Span& parent_span = decoder_callbacks_->activeSpan();
 
@@ -84,6 +125,13 @@ Envoy::Http::FilterHeadersStatus ServiceControlFilter::decodeHeaders(
     return Envoy::Http::FilterHeadersStatus::Continue;
   }
 
+  // The request goes on to the backend, onCheckDone() resets it if denied.
+  if (state_ == Calling && forwarding_) {
+    ENVOY_LOG(debug, "Called ServiceControl filter : Forward while checking");
+    stats_.filter_.forwarded_while_checking_.inc();
+    return Envoy::Http::FilterHeadersStatus::Continue;
+  }
+
   // Stop for now. If an async request is made, it will continue in onCheckDone.
   ENVOY_LOG(debug, "Called ServiceControl filter : Stop");
   stopped_ = true;
@@ -98,18 +146,43 @@ void ServiceControlFilter::onCheckDone(
     // This cast is safe.
     auto http_code = Envoy::Grpc::Utility::grpcToHttpStatus(
         static_cast<Envoy::Grpc::Status::GrpcStatus>(status.code()));
+    // A forwarded request is reset upstream by the local reply. If the
+    // backend already responded, Envoy resets the downstream stream instead.
     rejectRequest(static_cast<Envoy::Http::Code>(http_code), status.ToString(),
                   rc_detail);
     return;
   }
 
-  stats_.filter_.allowed_.inc();
+  if (local_counters_ != nullptr) {
+    local_counters_->inc(stats_.filter_.allowed_);
+  } else {
+    stats_.filter_.allowed_.inc();
+  }
   state_ = Complete;
+  startStreamReports();
   if (stopped_) {
     decoder_callbacks_->continueDecoding();
   }
 }
 
+void ServiceControlFilter::startStreamReports() {
+  const auto interval = handler_->streamReportInterval();
+  if (!interval.has_value()) {
+    return;
+  }
+  stream_report_interval_ = *interval;
+  stream_report_timer_ = decoder_callbacks_->dispatcher().createTimer(
+      [this]() { onStreamReportTimer(); });
+  stream_report_timer_->enableTimer(stream_report_interval_);
+}
+
+void ServiceControlFilter::onStreamReportTimer() {
+  ENVOY_LOG(debug, "Called ServiceControl Filter : {}", __func__);
+  handler_->callIntermediateReport(request_headers_,
+                                   decoder_callbacks_->activeSpan());
+  stream_report_timer_->enableTimer(stream_report_interval_);
+}
+
 void ServiceControlFilter::rejectRequest(Envoy::Http::Code code,
                                          absl::string_view error_msg,
                                          absl::string_view rc_detail) {
@@ -124,8 +197,9 @@ void ServiceControlFilter::rejectRequest(Envoy::Http::Code code,
 
 Envoy::Http::FilterDataStatus ServiceControlFilter::decodeData(
     Envoy::Buffer::Instance&, bool) {
+  const auto timed = callback_timer_.decode();
   ENVOY_LOG(debug, "Called ServiceControl Filter : {}", __func__);
-  if (state_ == Calling) {
+  if (state_ == Calling && !forwarding_) {
     return Envoy::Http::FilterDataStatus::StopIterationAndWatermark;
   }
   return Envoy::Http::FilterDataStatus::Continue;
@@ -133,8 +207,9 @@ Envoy::Http::FilterDataStatus ServiceControlFilter::decodeData(
 
 Envoy::Http::FilterTrailersStatus ServiceControlFilter::decodeTrailers(
     Envoy::Http::RequestTrailerMap&) {
+  const auto timed = callback_timer_.decode();
   ENVOY_LOG(debug, "Called ServiceControl Filter : {}", __func__);
-  if (state_ == Calling) {
+  if (state_ == Calling && !forwarding_) {
     return Envoy::Http::FilterTrailersStatus::StopIteration;
   }
   return Envoy::Http::FilterTrailersStatus::Continue;
@@ -146,9 +221,16 @@ void ServiceControlFilter::log(
     const Envoy::Http::ResponseTrailerMap* response_trailers,
     const Envoy::StreamInfo::StreamInfo& stream_info) {
   ENVOY_LOG(debug, "Called ServiceControl Filter : {}", __func__);
+  // The final report covers the rest of the stream.
+  stream_report_timer_.reset();
+  if (skipped_) {
+    return;
+  }
   if (!handler_) {
     if (!request_headers) return;
-    handler_ = factory_.createHandler(*request_headers, stream_info, stats_);
+    handler_ = factory_.createHandler(
+        *request_headers, stream_info,
+        findPerRouteConfig(stream_info.routeEntry()), stats_);
   }
 
   Envoy::Tracing::Span& parent_span = decoder_callbacks_->activeSpan();
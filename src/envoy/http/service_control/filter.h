@@ -14,15 +14,19 @@
 
 #pragma once
 
+#include <chrono>
 #include <string>
 
 #include "envoy/access_log/access_log.h"
+#include "envoy/event/timer.h"
 #include "envoy/http/filter.h"
 #include "envoy/http/header_map.h"
 #include "source/common/common/logger.h"
 #include "source/extensions/filters/http/common/pass_through_filter.h"
 #include "src/envoy/http/service_control/filter_stats.h"
 #include "src/envoy/http/service_control/handler.h"
+#include "src/envoy/utils/callback_time.h"
+#include "src/envoy/utils/local_counters.h"
 
 namespace espv2 {
 namespace envoy {
@@ -36,9 +40,18 @@ class ServiceControlFilter
       public ServiceControlHandler::CheckDoneCallback,
       public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
  public:
-  ServiceControlFilter(ServiceControlFilterStats& stats,
-                       const ServiceControlHandlerFactory& factory)
-      : stats_(stats), factory_(factory) {}
+  // The callbacks are not timed if `callback_time_sampler` is nullptr, and
+  // the stats are incremented themselves if `local_counters` is.
+  ServiceControlFilter(
+      ServiceControlFilterStats& stats,
+      const ServiceControlHandlerFactory& factory,
+      const utils::CallbackTimeSampler* callback_time_sampler = nullptr,
+      utils::LocalCounters* local_counters = nullptr)
+      : stats_(stats),
+        local_counters_(local_counters),
+        factory_(factory),
+        callback_timer_(callback_time_sampler) {}
+  ~ServiceControlFilter() override;
 
   void onDestroy() override;
 
@@ -64,17 +77,34 @@ class ServiceControlFilter
   void rejectRequest(Envoy::Http::Code code, absl::string_view error_msg,
                      absl::string_view rc_detail);
 
+  // Starts the intermediate reports of a long-lived stream, if it needs them.
+  void startStreamReports();
+  void onStreamReportTimer();
+
   ServiceControlFilterStats& stats_;
+  utils::LocalCounters* const local_counters_;
   const ServiceControlHandlerFactory& factory_;
+  utils::CallbackTimer callback_timer_;
 
   // The service control request handler
   std::unique_ptr<ServiceControlHandler> handler_;
 
+  // The request headers, valid for the life of the stream.
+  const Envoy::Http::RequestHeaderMap* request_headers_{};
+
+  // Sends the intermediate reports of a long-lived stream.
+  Envoy::Event::TimerPtr stream_report_timer_;
+  std::chrono::milliseconds stream_report_interval_{};
+
   // The state of the request.
   enum State { Init, Calling, Responded, Complete };
   State state_ = Init;
   // Mark if request has been stopped.
   bool stopped_ = false;
+  // Set if the request is forwarded while the Check call is in flight.
+  bool forwarding_ = false;
+  // Set if the route skips service control, the request is not reported.
+  bool skipped_ = false;
 };
 
 }  // namespace service_control
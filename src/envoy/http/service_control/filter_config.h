@@ -18,10 +18,14 @@
 #include "envoy/runtime/runtime.h"
 #include "envoy/server/filter_config.h"
 #include "source/common/common/logger.h"
+#include "src/envoy/http/service_control/admin_handler.h"
 #include "src/envoy/http/service_control/config_parser.h"
 #include "src/envoy/http/service_control/filter_stats.h"
 #include "src/envoy/http/service_control/handler_impl.h"
 #include "src/envoy/http/service_control/service_control_call_impl.h"
+#include "src/envoy/http/service_control/telemetry_shedding.h"
+#include "src/envoy/utils/callback_time.h"
+#include "src/envoy/utils/local_counters.h"
 
 namespace espv2 {
 namespace envoy {
@@ -39,14 +43,48 @@ class ServiceControlFilterConfig
       Envoy::Server::Configuration::FactoryContext& context)
       : filter_stats_(
             ServiceControlFilterStats::create(stats_prefix, context.scope())),
+        local_counters_(proto_config.local_counters(),
+                        {&filter_stats_.filter_.allowed_},
+                        context.threadLocal()),
         proto_config_(
             std::make_shared<
                 ::espv2::api::envoy::v10::http::service_control::FilterConfig>(
                 proto_config)),
         call_factory_(proto_config_, stats_prefix, context),
         config_parser_(*proto_config_, call_factory_),
+        telemetry_shedding_(proto_config.has_telemetry_shedding()
+                                ? std::make_unique<TelemetryShedding>(
+                                      proto_config.telemetry_shedding(),
+                                      context.overloadManager())
+                                : nullptr),
         handler_factory_(context.api().randomGenerator(), config_parser_,
-                         context.timeSource()) {}
+                         context.timeSource(), context.threadLocal(),
+                         proto_config.handler_pool_size(),
+                         proto_config.sequential_operation_ids(),
+                         proto_config.coarse_timestamps(),
+                         telemetry_shedding_.get()),
+        callback_time_sampler_(utils::CallbackTimeSampler::create(
+            proto_config.callback_time(), stats_prefix + "service_control.",
+            context)),
+        admin_handler_(AdminHandler::get(context)) {
+    // The calls have loaded the logs and metrics of the service configs, and
+    // keep copies of their services without them. No worker reads the
+    // services of this filter config until it serves the requests.
+    if (proto_config.trim_service_config()) {
+      for (auto& service : *proto_config_->mutable_services()) {
+        service.clear_service_config();
+      }
+    }
+    retained_config_bytes_ = proto_config_->ByteSizeLong();
+    filter_stats_.config_.retained_bytes_.add(retained_config_bytes_);
+    parser_bytes_ = config_parser_.bytes();
+    filter_stats_.config_.parser_bytes_.add(parser_bytes_);
+  }
+
+  ~ServiceControlFilterConfig() {
+    filter_stats_.config_.retained_bytes_.sub(retained_config_bytes_);
+    filter_stats_.config_.parser_bytes_.sub(parser_bytes_);
+  }
 
   const ServiceControlHandlerFactory& handler_factory() const {
     return handler_factory_;
@@ -54,12 +92,27 @@ class ServiceControlFilterConfig
 
   ServiceControlFilterStats& stats() { return filter_stats_; }
 
+  utils::LocalCounters& local_counters() { return local_counters_; }
+
+  const utils::CallbackTimeSampler* callback_time_sampler() const {
+    return callback_time_sampler_.get();
+  }
+
  private:
   ServiceControlFilterStats filter_stats_;
+  utils::LocalCounters local_counters_;
   FilterConfigProtoSharedPtr proto_config_;
   ServiceControlCallFactoryImpl call_factory_;
   FilterConfigParser config_parser_;
+  const std::unique_ptr<TelemetryShedding> telemetry_shedding_;
   ServiceControlHandlerFactoryImpl handler_factory_;
+  const utils::CallbackTimeSamplerPtr callback_time_sampler_;
+  // Keeps the admin handler added while the filter is configured.
+  const AdminHandlerSharedPtr admin_handler_;
+  // The size of the kept filter config and of the parsed maps, added to the
+  // config stats.
+  uint64_t retained_config_bytes_;
+  uint64_t parser_bytes_;
 };
 
 using FilterConfigSharedPtr = std::shared_ptr<ServiceControlFilterConfig>;
@@ -16,6 +16,7 @@
 #include "test/fuzz/utility.h"
 #include "test/mocks/http/mocks.h"
 #include "test/mocks/server/mocks.h"
+#include "tests/fuzz/fuzz_time_limit.h"
 #include "tests/fuzz/structured_inputs/service_control_filter.pb.validate.h"
 
 namespace espv2 {
@@ -130,6 +131,9 @@ DEFINE_PROTO_FUZZER(
       }));
 
   try {
+    // Times the config parsing and the stream, not the mock setup.
+    espv2::tests::fuzz::FuzzTimeLimit time_limit("ServiceControlFilter");
+
     // Fuzz the stream info.
     std::unique_ptr<TestStreamInfo> stream_info =
         Envoy::Fuzz::fromStreamInfo(input.stream_info());
@@ -35,8 +35,21 @@ namespace service_control {
   COUNTER(denied_control_plane_fault)    \
   COUNTER(denied_consumer_blocked)       \
   COUNTER(denied_consumer_error)         \
+  COUNTER(denied_malformed_api_key)      \
   COUNTER(denied_consumer_quota)         \
   COUNTER(denied_producer_error)         \
+  COUNTER(check_coalesced)               \
+  COUNTER(check_hedged)                  \
+  COUNTER(check_hedge_won)               \
+  COUNTER(allowed_stale_check)           \
+  COUNTER(quota_refresh_skipped)         \
+  COUNTER(handler_pool_hit)              \
+  COUNTER(forwarded_while_checking)      \
+  COUNTER(quota_locally_limited)         \
+  COUNTER(check_connection_memo_hit)     \
+  COUNTER(report_shed_logged_fields)     \
+  COUNTER(report_shed_log_entries)       \
+  COUNTER(report_metrics_only)           \
   HISTOGRAM(request_time, Milliseconds)  \
   HISTOGRAM(backend_time, Milliseconds)  \
   HISTOGRAM(overhead_time, Milliseconds)
@@ -66,6 +79,110 @@ namespace service_control {
   COUNTER(DATA_LOSS)               \
   COUNTER(UNAUTHENTICATED)
 
+/**
+ * Service control aggregation cache stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define CACHE_STATS(COUNTER, GAUGE) \
+  COUNTER(called)                   \
+  COUNTER(missed)                   \
+  COUNTER(flushed)                  \
+  GAUGE(capacity, Accumulate)
+
+/**
+ * Shared check cache stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define SHARED_CHECK_CACHE_STATS(COUNTER, GAUGE) \
+  COUNTER(hit)                                   \
+  COUNTER(miss)                                  \
+  COUNTER(evicted)                               \
+  COUNTER(refreshed_ahead)                       \
+  COUNTER(restored)                              \
+  GAUGE(entries, Accumulate)                     \
+  GAUGE(bytes, Accumulate)
+
+/**
+ * Service control circuit breaker stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define CIRCUIT_BREAKER_STATS(COUNTER, GAUGE) \
+  COUNTER(opened)                             \
+  COUNTER(half_opened)                        \
+  COUNTER(closed)                             \
+  COUNTER(short_circuited)                    \
+  GAUGE(open, Accumulate)
+
+/**
+ * Check concurrency limit stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define CONCURRENCY_LIMIT_STATS(COUNTER, GAUGE) \
+  COUNTER(rejected)                             \
+  GAUGE(limit, Accumulate)
+
+/**
+ * Service control request body compression stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define COMPRESSION_STATS(COUNTER) \
+  COUNTER(compressed)              \
+  COUNTER(uncompressed)            \
+  COUNTER(raw_bytes)               \
+  COUNTER(compressed_bytes)
+
+/**
+ * Report spool stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define REPORT_SPOOL_STATS(COUNTER, GAUGE) \
+  COUNTER(spooled_bytes)                   \
+  COUNTER(replayed_bytes)                  \
+  COUNTER(dropped_bytes)                   \
+  GAUGE(bytes, Accumulate)
+
+/**
+ * Service control call stats, per call type.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define HTTP_CALL_STATS(COUNTER, GAUGE, HISTOGRAM) \
+  COUNTER(call_pool_hit)                           \
+  GAUGE(in_flight, Accumulate)                     \
+  HISTOGRAM(latency, Milliseconds)                 \
+  HISTOGRAM(attempts, Unspecified)
+
+/**
+ * Filter config stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define CONFIG_STATS(GAUGE)         \
+  GAUGE(retained_bytes, Accumulate) \
+  GAUGE(parser_bytes, Accumulate)
+
+/**
+ * Client cache stats.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define CLIENT_CACHE_STATS(GAUGE) GAUGE(live, Accumulate)
+
+/**
+ * Memory stats, per service.
+ * For description of each stat, @see the README.md for this filter.
+ * @see stats_macros.h
+ */
+#define SERVICE_MEMORY_STATS(GAUGE)     \
+  GAUGE(client_cache_bytes, Accumulate) \
+  GAUGE(token_bytes, Accumulate)
+
 /**
  * Wrapper struct for general service control filter stats. @see stats_macros.h
  */
@@ -80,6 +197,89 @@ struct CallStatusStats {
   CALL_STATUS_STATS(GENERATE_COUNTER_STRUCT);
 };
 
+/**
+ * Wrapper struct for service control aggregation cache stats.
+ * @see stats_macros.h
+ */
+struct CacheStats {
+  CACHE_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for shared check cache stats. @see stats_macros.h
+ */
+struct SharedCheckCacheStats {
+  SHARED_CHECK_CACHE_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for service control circuit breaker stats.
+ * @see stats_macros.h
+ */
+struct CircuitBreakerStats {
+  CIRCUIT_BREAKER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for check concurrency limit stats. @see stats_macros.h
+ */
+struct ConcurrencyLimitStats {
+  CONCURRENCY_LIMIT_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for service control request body compression stats.
+ * @see stats_macros.h
+ */
+struct CompressionStats {
+  COMPRESSION_STATS(GENERATE_COUNTER_STRUCT);
+};
+
+/**
+ * Wrapper struct for report spool stats. @see stats_macros.h
+ */
+struct ReportSpoolStats {
+  REPORT_SPOOL_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for service control call stats. @see stats_macros.h
+ */
+struct HttpCallStats {
+  HTTP_CALL_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT,
+                  GENERATE_HISTOGRAM_STRUCT);
+};
+
+/**
+ * Wrapper struct for filter config stats. @see stats_macros.h
+ */
+struct ConfigStats {
+  CONFIG_STATS(GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for client cache stats. @see stats_macros.h
+ */
+struct ClientCacheStats {
+  CLIENT_CACHE_STATS(GENERATE_GAUGE_STRUCT);
+};
+
+/**
+ * Wrapper struct for the memory stats of a service. @see stats_macros.h
+ */
+struct ServiceMemoryStats {
+  SERVICE_MEMORY_STATS(GENERATE_GAUGE_STRUCT);
+
+  // Create a stat struct, named after the service.
+  static ServiceMemoryStats create(const std::string& prefix,
+                                   const std::string& service_name,
+                                   Envoy::Stats::Scope& scope) {
+    const std::string final_prefix =
+        prefix + "service_control.service." + service_name + ".";
+    return {SERVICE_MEMORY_STATS(POOL_GAUGE_PREFIX(scope, final_prefix))};
+  }
+};
+
 /**
  * Wrapper struct for all the stats structs of service control filter .
  */
@@ -92,6 +292,38 @@ struct ServiceControlFilterStats {
   CallStatusStats allocate_quota_;
   // The stats of service control report call status.
   CallStatusStats report_;
+  // The stats of the check aggregation cache.
+  CacheStats check_cache_;
+  // The stats of the quota aggregation cache.
+  CacheStats quota_cache_;
+  // The stats of the report aggregation cache.
+  CacheStats report_cache_;
+  // The stats of the check cache shared by all workers.
+  SharedCheckCacheStats shared_check_cache_;
+  // The stats of the check call circuit breaker.
+  CircuitBreakerStats check_circuit_breaker_;
+  // The stats of the quota call circuit breaker.
+  CircuitBreakerStats quota_circuit_breaker_;
+  // The stats of the report request body compression.
+  CompressionStats report_compression_;
+  // The stats of the failed report spool.
+  ReportSpoolStats report_spool_;
+  // The stats of the known-good check responses shared by all workers.
+  SharedCheckCacheStats stale_check_cache_;
+  // The stats of the API key rejections shared by all workers.
+  SharedCheckCacheStats negative_check_cache_;
+  // The stats of the check calls.
+  HttpCallStats check_call_;
+  // The stats of the allocate quota calls.
+  HttpCallStats allocate_quota_call_;
+  // The stats of the report calls.
+  HttpCallStats report_call_;
+  // The stats of the filter configs.
+  ConfigStats config_;
+  // The stats of the per-worker client caches.
+  ClientCacheStats client_cache_;
+  // The stats of the check call concurrency limit.
+  ConcurrencyLimitStats check_concurrency_limit_;
 
   // Collect service control call status.
   static void collectCallStatus(
@@ -110,7 +342,66 @@ struct ServiceControlFilterStats {
             {CALL_STATUS_STATS(
                 POOL_COUNTER_PREFIX(scope, final_prefix + "allocate_quota."))},
             {CALL_STATUS_STATS(
-                POOL_COUNTER_PREFIX(scope, final_prefix + "report."))}};
+                POOL_COUNTER_PREFIX(scope, final_prefix + "report."))},
+            {CACHE_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "check_cache."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "check_cache."))},
+            {CACHE_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "quota_cache."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "quota_cache."))},
+            {CACHE_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "report_cache."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "report_cache."))},
+            {SHARED_CHECK_CACHE_STATS(
+                POOL_COUNTER_PREFIX(scope,
+                                    final_prefix + "shared_check_cache."),
+                POOL_GAUGE_PREFIX(scope,
+                                  final_prefix + "shared_check_cache."))},
+            {CIRCUIT_BREAKER_STATS(
+                POOL_COUNTER_PREFIX(scope,
+                                    final_prefix + "check_circuit_breaker."),
+                POOL_GAUGE_PREFIX(scope,
+                                  final_prefix + "check_circuit_breaker."))},
+            {CIRCUIT_BREAKER_STATS(
+                POOL_COUNTER_PREFIX(scope,
+                                    final_prefix + "quota_circuit_breaker."),
+                POOL_GAUGE_PREFIX(scope,
+                                  final_prefix + "quota_circuit_breaker."))},
+            {COMPRESSION_STATS(POOL_COUNTER_PREFIX(
+                scope, final_prefix + "report_compression."))},
+            {REPORT_SPOOL_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "report_spool."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "report_spool."))},
+            {SHARED_CHECK_CACHE_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "stale_check_cache."),
+                POOL_GAUGE_PREFIX(scope,
+                                  final_prefix + "stale_check_cache."))},
+            {SHARED_CHECK_CACHE_STATS(
+                POOL_COUNTER_PREFIX(scope,
+                                    final_prefix + "negative_check_cache."),
+                POOL_GAUGE_PREFIX(scope,
+                                  final_prefix + "negative_check_cache."))},
+            {HTTP_CALL_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "check."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "check."),
+                POOL_HISTOGRAM_PREFIX(scope, final_prefix + "check."))},
+            {HTTP_CALL_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "allocate_quota."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "allocate_quota."),
+                POOL_HISTOGRAM_PREFIX(scope,
+                                      final_prefix + "allocate_quota."))},
+            {HTTP_CALL_STATS(
+                POOL_COUNTER_PREFIX(scope, final_prefix + "report."),
+                POOL_GAUGE_PREFIX(scope, final_prefix + "report."),
+                POOL_HISTOGRAM_PREFIX(scope, final_prefix + "report."))},
+            {CONFIG_STATS(POOL_GAUGE_PREFIX(scope, final_prefix + "config."))},
+            {CLIENT_CACHE_STATS(
+                POOL_GAUGE_PREFIX(scope, final_prefix + "client_cache."))},
+            {CONCURRENCY_LIMIT_STATS(
+                POOL_COUNTER_PREFIX(scope,
+                                    final_prefix + "check_concurrency_limit."),
+                POOL_GAUGE_PREFIX(scope,
+                                  final_prefix + "check_concurrency_limit."))}};
   }
 };
 
@@ -22,6 +22,7 @@
 #include "src/envoy/http/service_control/config_parser.h"
 #include "src/envoy/http/service_control/handler.h"
 #include "src/envoy/http/service_control/mocks.h"
+#include "test/mocks/event/mocks.h"
 #include "test/mocks/server/mocks.h"
 #include "test/mocks/stats/mocks.h"
 #include "test/mocks/tracing/mocks.h"
@@ -60,7 +61,7 @@ class ServiceControlFilterTest : public ::testing::Test {
     mock_handler_ = new testing::NiceMock<MockServiceControlHandler>();
     mock_handler_ptr_.reset(mock_handler_);
     mock_route_ = std::make_shared<NiceMock<Envoy::Router::MockRoute>>();
-    ON_CALL(mock_handler_factory_, createHandler(_, _, _))
+    ON_CALL(mock_handler_factory_, createHandler(_, _, _, _))
         .WillByDefault(Return(ByMove(std::move(mock_handler_ptr_))));
 
     mock_span_ = std::make_unique<Envoy::Tracing::MockSpan>();
@@ -129,9 +130,64 @@ TEST_F(ServiceControlFilterTest, DecodeHeadersSyncOKStatus) {
   filter_->onDestroy();
 }
 
+TEST_F(ServiceControlFilterTest, DecodeHeadersPassesPerRouteConfig) {
+  // Test: The per-route config the filter looked up is passed to the handler.
+  ::espv2::api::envoy::v10::http::service_control::PerRouteFilterConfig
+      per_route_cfg;
+  per_route_cfg.set_operation_name("test-operation");
+  PerRouteFilterConfig per_route(per_route_cfg);
+  EXPECT_CALL(mock_decoder_callbacks_.route_->route_entry_,
+              perFilterConfig(kFilterName))
+      .WillRepeatedly(Return(&per_route));
+
+  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, &per_route, _))
+      .WillOnce(Return(ByMove(std::move(mock_handler_ptr_))));
+  EXPECT_CALL(*mock_handler_, callCheck(_, _, _))
+      .WillOnce(Invoke([](Envoy::Http::RequestHeaderMap&, Envoy::Tracing::Span&,
+                          ServiceControlHandler::CheckDoneCallback& callback) {
+        callback.onCheckDone(OkStatus(), "");
+      }));
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(req_headers_, true));
+  filter_->onDestroy();
+}
+
+TEST_F(ServiceControlFilterTest, DecodeHeadersSkipServiceControl) {
+  // Test: A route that skips service control gets no handler and no report.
+  ::espv2::api::envoy::v10::http::service_control::PerRouteFilterConfig
+      per_route_cfg;
+  per_route_cfg.set_operation_name("skipped-operation");
+  per_route_cfg.set_skip_service_control(true);
+  PerRouteFilterConfig per_route(per_route_cfg);
+  EXPECT_CALL(mock_decoder_callbacks_.route_->route_entry_,
+              perFilterConfig(kFilterName))
+      .WillRepeatedly(Return(&per_route));
+
+  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _, _)).Times(0);
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(req_headers_, true));
+  filter_->log(&req_headers_, &resp_headers_, &resp_trailer_,
+               mock_decoder_callbacks_.stream_info_);
+}
+
+TEST_F(ServiceControlFilterTest, DestructorReleasesHandler) {
+  // Test: The handler is given back to the factory when the filter is gone.
+  EXPECT_CALL(*mock_handler_, callCheck(_, _, _));
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(req_headers_, true));
+  filter_->onDestroy();
+
+  ServiceControlHandler* handler = mock_handler_;
+  EXPECT_CALL(mock_handler_factory_, releaseHandler(_))
+      .WillOnce(Invoke([handler](ServiceControlHandlerPtr released) {
+        EXPECT_EQ(released.get(), handler);
+      }));
+  filter_.reset();
+}
+
 TEST_F(ServiceControlFilterTest, OnDestoryWithoutHandler) {
   // Test: calling filter::onDestroy() without handler
-  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _)).Times(0);
+  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _, _)).Times(0);
   filter_->onDestroy();
 }
 
@@ -159,6 +215,36 @@ TEST_F(ServiceControlFilterTest, DecodeHeadersSyncBadStatus) {
             filter_->decodeHeaders(req_headers_, true));
 }
 
+TEST_F(ServiceControlFilterTest, ForwardWhileCheckingDenied) {
+  // Test: A request forwarded while checking is not stopped, and is rejected
+  // when the Check denies it.
+  ServiceControlHandler::CheckDoneCallback* stored_check_done_callback;
+  EXPECT_CALL(*mock_handler_, forwardWhileChecking()).WillOnce(Return(true));
+  EXPECT_CALL(*mock_handler_, callCheck(_, _, _))
+      .WillOnce(Invoke([&stored_check_done_callback](
+                           Envoy::Http::RequestHeaderMap&,
+                           Envoy::Tracing::Span&,
+                           ServiceControlHandler::CheckDoneCallback& callback) {
+        stored_check_done_callback = &callback;
+      }));
+
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(req_headers_, false));
+  EXPECT_EQ(stats_.filter_.forwarded_while_checking_.value(), 1);
+  EXPECT_EQ(Envoy::Http::FilterDataStatus::Continue,
+            filter_->decodeData(mock_buffer_, false));
+  EXPECT_EQ(Envoy::Http::FilterTrailersStatus::Continue,
+            filter_->decodeTrailers(req_trailer_));
+
+  EXPECT_CALL(mock_decoder_callbacks_, continueDecoding()).Times(0);
+  EXPECT_CALL(
+      mock_decoder_callbacks_,
+      sendLocalReply(Envoy::Http::Code::Unauthorized, "UNAUTHENTICATED:test", _,
+                     _, "service_control_check_error{API_KEY_INVALID}"));
+  stored_check_done_callback->onCheckDone(
+      kBadStatus, "service_control_check_error{API_KEY_INVALID}");
+}
+
 TEST_F(ServiceControlFilterTest, DecodeHeadersAsyncGoodStatus) {
   // Test: While Filter is Calling/stopped, onCheckDone calls
   // continueDecoding
@@ -217,7 +303,7 @@ TEST_F(ServiceControlFilterTest, DecodeHeadersAsyncBadStatus) {
 
 TEST_F(ServiceControlFilterTest, LogWithoutHandlerOrHeaders) {
   // Test: If no handler and no headers, a handler is not created
-  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _)).Times(0);
+  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _, _)).Times(0);
 
   // Filter has no handler. If it tries to callReport, it will seg fault
   filter_->log(nullptr, &resp_headers_, &resp_trailer_,
@@ -236,12 +322,51 @@ TEST_F(ServiceControlFilterTest, LogWithHandler) {
   // that one is used for log() and another is not created
   filter_->decodeHeaders(req_headers_, true);
 
-  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _)).Times(0);
+  EXPECT_CALL(mock_handler_factory_, createHandler(_, _, _, _)).Times(0);
+  EXPECT_CALL(*mock_handler_, callReport(_, _, _, _));
+  filter_->log(&req_headers_, &resp_headers_, &resp_trailer_,
+               mock_decoder_callbacks_.stream_info_);
+}
+
+TEST_F(ServiceControlFilterTest, IntermediateReportsForStream) {
+  // Test: A stream is reported on a timer until it ends
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(
+      &mock_decoder_callbacks_.dispatcher_);
+  EXPECT_CALL(*mock_handler_, streamReportInterval())
+      .WillOnce(Return(std::chrono::milliseconds(100)));
+  EXPECT_CALL(*mock_handler_, callCheck(_, _, _))
+      .WillOnce(Invoke([](Envoy::Http::RequestHeaderMap&, Envoy::Tracing::Span&,
+                          ServiceControlHandler::CheckDoneCallback& callback) {
+        callback.onCheckDone(OkStatus(), "");
+      }));
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(100), _))
+      .Times(3);
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(req_headers_, false));
+
+  EXPECT_CALL(*mock_handler_, callIntermediateReport(&req_headers_, _))
+      .Times(2);
+  timer->invokeCallback();
+  timer->invokeCallback();
+
   EXPECT_CALL(*mock_handler_, callReport(_, _, _, _));
   filter_->log(&req_headers_, &resp_headers_, &resp_trailer_,
                mock_decoder_callbacks_.stream_info_);
 }
 
+TEST_F(ServiceControlFilterTest, NoIntermediateReportsForUnaryRequest) {
+  EXPECT_CALL(*mock_handler_, streamReportInterval())
+      .WillOnce(Return(absl::nullopt));
+  EXPECT_CALL(mock_decoder_callbacks_.dispatcher_, createTimer_(_)).Times(0);
+  EXPECT_CALL(*mock_handler_, callCheck(_, _, _))
+      .WillOnce(Invoke([](Envoy::Http::RequestHeaderMap&, Envoy::Tracing::Span&,
+                          ServiceControlHandler::CheckDoneCallback& callback) {
+        callback.onCheckDone(OkStatus(), "");
+      }));
+  EXPECT_EQ(Envoy::Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(req_headers_, true));
+}
+
 TEST_F(ServiceControlFilterTest, DecodeHelpersWhileStopped) {
   // This puts the Filter into a stopped state
   EXPECT_EQ(Envoy::Http::FilterHeadersStatus::StopIteration,
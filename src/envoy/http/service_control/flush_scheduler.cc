@@ -0,0 +1,123 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/flush_scheduler.h"
+
+#include <algorithm>
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+// The number of buckets of the wheel. The longer intervals wait for more
+// than one turn.
+constexpr size_t kWheelBuckets = 64;
+
+}  // namespace
+
+void FlushScheduler::Handle::cancel() {
+  if (entry_ == nullptr) {
+    return;
+  }
+  if (auto scheduler = scheduler_.lock()) {
+    scheduler->remove(entry_);
+  }
+  entry_ = nullptr;
+}
+
+FlushScheduler::FlushScheduler(Envoy::Event::Dispatcher& dispatcher,
+                               std::chrono::milliseconds tick)
+    : tick_(tick),
+      timer_(dispatcher.createTimer([this]() { onTick(); })),
+      buckets_(kWheelBuckets) {}
+
+FlushScheduler::~FlushScheduler() {
+  // The handles left can no longer reach the scheduler.
+  for (Entry* entry : running_) {
+    delete entry;
+  }
+  for (Bucket& bucket : buckets_) {
+    for (Entry* entry : bucket) {
+      delete entry;
+    }
+  }
+}
+
+FlushScheduler::HandlePtr FlushScheduler::schedule(
+    std::chrono::milliseconds interval, std::function<void()> callback) {
+  const uint64_t interval_ticks = std::max<uint64_t>(
+      1, (interval.count() + tick_.count() - 1) / tick_.count());
+  auto* entry = new Entry{std::move(callback), interval_ticks,
+                          current_tick_ + interval_ticks, nullptr, {}};
+  insert(entry);
+  if (size_++ == 0) {
+    timer_->enableTimer(tick_);
+  }
+  return std::make_unique<Handle>(weak_from_this(), entry);
+}
+
+void FlushScheduler::insert(Entry* entry) {
+  entry->bucket = &buckets_[entry->due_tick % buckets_.size()];
+  entry->position = entry->bucket->insert(entry->bucket->end(), entry);
+}
+
+void FlushScheduler::remove(Entry* entry) {
+  entry->bucket->erase(entry->position);
+  delete entry;
+  if (--size_ == 0) {
+    timer_->disableTimer();
+  }
+}
+
+void FlushScheduler::onTick() {
+  ++current_tick_;
+  Bucket& bucket = buckets_[current_tick_ % buckets_.size()];
+  for (auto it = bucket.begin(); it != bucket.end();) {
+    Entry* entry = *it++;
+    if (entry->due_tick == current_tick_) {
+      running_.splice(running_.end(), bucket, entry->position);
+      entry->bucket = &running_;
+    }
+  }
+
+  // Each entry is scheduled again before its callback runs, so the
+  // callbacks may cancel any entry. The callback is copied, as cancelling
+  // its own entry frees it.
+  while (!running_.empty()) {
+    Entry* entry = running_.front();
+    running_.pop_front();
+    entry->due_tick += entry->interval_ticks;
+    insert(entry);
+    const std::function<void()> callback = entry->callback;
+    callback();
+  }
+
+  if (size_ > 0) {
+    timer_->enableTimer(tick_);
+  }
+}
+
+FlushSchedulers::FlushSchedulers(Envoy::ThreadLocal::SlotAllocator& tls)
+    : tls_(tls) {
+  tls_.set([](Envoy::Event::Dispatcher& dispatcher) {
+    return std::make_shared<FlushScheduler>(dispatcher, kFlushSchedulerTick);
+  });
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,126 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/singleton/instance.h"
+#include "envoy/thread_local/thread_local.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// Runs the periodic flushes of the client caches of a worker off one timer,
+// as a timing wheel. The intervals are rounded up to whole ticks, so the
+// flushes due in the same tick run in one wakeup, and their calls are sent
+// in the same event loop iteration. The timer is only enabled while a flush
+// is scheduled. Must only be used on its worker.
+class FlushScheduler : public Envoy::ThreadLocal::ThreadLocalObject,
+                       public std::enable_shared_from_this<FlushScheduler> {
+  struct Entry;
+
+ public:
+  // Cancels the flush when destroyed. May outlive the scheduler.
+  class Handle {
+   public:
+    Handle(std::weak_ptr<FlushScheduler> scheduler, Entry* entry)
+        : scheduler_(std::move(scheduler)), entry_(entry) {}
+    ~Handle() { cancel(); }
+
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+
+    void cancel();
+
+   private:
+    std::weak_ptr<FlushScheduler> scheduler_;
+    // Null once cancelled.
+    Entry* entry_;
+  };
+  using HandlePtr = std::unique_ptr<Handle>;
+
+  FlushScheduler(Envoy::Event::Dispatcher& dispatcher,
+                 std::chrono::milliseconds tick);
+  ~FlushScheduler() override;
+
+  // Runs the callback every interval, from one interval from now, until the
+  // handle is destroyed. Must be called on a scheduler owned by a shared_ptr.
+  HandlePtr schedule(std::chrono::milliseconds interval,
+                     std::function<void()> callback);
+
+  // The number of the flushes scheduled.
+  size_t size() const { return size_; }
+
+ private:
+  using Bucket = std::list<Entry*>;
+
+  struct Entry {
+    std::function<void()> callback;
+    uint64_t interval_ticks;
+    uint64_t due_tick;
+    // The list the entry is in, and its position there.
+    Bucket* bucket;
+    Bucket::iterator position;
+  };
+
+  void onTick();
+  // Puts the entry in the bucket of its due tick.
+  void insert(Entry* entry);
+  void remove(Entry* entry);
+
+  const std::chrono::milliseconds tick_;
+  Envoy::Event::TimerPtr timer_;
+  // Indexed by the due tick modulo their number.
+  std::vector<Bucket> buckets_;
+  // The entries due in the tick being run.
+  Bucket running_;
+  uint64_t current_tick_ = 0;
+  size_t size_ = 0;
+};
+
+using FlushSchedulerSharedPtr = std::shared_ptr<FlushScheduler>;
+
+// The flush schedulers of the workers, shared by the service control calls
+// of a server.
+class FlushSchedulers : public Envoy::Singleton::Instance {
+ public:
+  // Must be created on the main thread.
+  explicit FlushSchedulers(Envoy::ThreadLocal::SlotAllocator& tls);
+
+  // Returns the scheduler of the current worker.
+  FlushSchedulerSharedPtr local() { return tls_->shared_from_this(); }
+
+ private:
+  Envoy::ThreadLocal::TypedSlot<FlushScheduler> tls_;
+};
+
+using FlushSchedulersSharedPtr = std::shared_ptr<FlushSchedulers>;
+
+// The tick of the flush schedulers.
+constexpr std::chrono::milliseconds kFlushSchedulerTick(100);
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
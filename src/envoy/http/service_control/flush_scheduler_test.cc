@@ -0,0 +1,124 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/flush_scheduler.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/event/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::testing::NiceMock;
+
+class FlushSchedulerTest : public ::testing::Test {
+ protected:
+  FlushSchedulerTest()
+      : timer_(new NiceMock<Envoy::Event::MockTimer>(&dispatcher_)),
+        scheduler_(std::make_shared<FlushScheduler>(
+            dispatcher_, std::chrono::milliseconds(100))) {}
+
+  // Runs the ticks, the timer must be enabled for each.
+  void tick(int ticks) {
+    for (int i = 0; i < ticks; ++i) {
+      ASSERT_TRUE(timer_->enabled());
+      timer_->invokeCallback();
+    }
+  }
+
+  NiceMock<Envoy::Event::MockDispatcher> dispatcher_;
+  NiceMock<Envoy::Event::MockTimer>* timer_;
+  FlushSchedulerSharedPtr scheduler_;
+};
+
+TEST_F(FlushSchedulerTest, IntervalsRoundedUpToTicks) {
+  EXPECT_FALSE(timer_->enabled());
+  int fast = 0;
+  int slow = 0;
+  auto fast_handle = scheduler_->schedule(std::chrono::milliseconds(150),
+                                          [&fast]() { ++fast; });
+  auto slow_handle = scheduler_->schedule(std::chrono::milliseconds(1000),
+                                          [&slow]() { ++slow; });
+  EXPECT_EQ(scheduler_->size(), 2);
+
+  // The fast flush runs every 2 ticks, the slow one every 10, in the same
+  // wakeups.
+  tick(10);
+  EXPECT_EQ(fast, 5);
+  EXPECT_EQ(slow, 1);
+}
+
+TEST_F(FlushSchedulerTest, IntervalsLongerThanTheWheel) {
+  int runs = 0;
+  auto handle = scheduler_->schedule(std::chrono::seconds(10),
+                                     [&runs]() { ++runs; });
+  tick(99);
+  EXPECT_EQ(runs, 0);
+  tick(1);
+  EXPECT_EQ(runs, 1);
+  tick(100);
+  EXPECT_EQ(runs, 2);
+}
+
+TEST_F(FlushSchedulerTest, CancelledOnHandleDestruction) {
+  int runs = 0;
+  auto handle = scheduler_->schedule(std::chrono::milliseconds(100),
+                                     [&runs]() { ++runs; });
+  tick(1);
+  handle.reset();
+  EXPECT_EQ(scheduler_->size(), 0);
+
+  // The timer stops with the last flush.
+  EXPECT_FALSE(timer_->enabled());
+  EXPECT_EQ(runs, 1);
+}
+
+TEST_F(FlushSchedulerTest, CallbackCancelsFlushes) {
+  FlushScheduler::HandlePtr first;
+  FlushScheduler::HandlePtr second;
+  int second_runs = 0;
+  first = scheduler_->schedule(std::chrono::milliseconds(100),
+                               [&]() { second.reset(); });
+  second = scheduler_->schedule(std::chrono::milliseconds(100),
+                                [&second_runs]() { ++second_runs; });
+
+  // The second flush is cancelled by the first one of the same tick.
+  tick(1);
+  EXPECT_EQ(second_runs, 0);
+  EXPECT_EQ(scheduler_->size(), 1);
+
+  // A flush cancelling itself.
+  first = scheduler_->schedule(std::chrono::milliseconds(100),
+                               [&]() { first.reset(); });
+  tick(1);
+  EXPECT_EQ(first, nullptr);
+  EXPECT_EQ(scheduler_->size(), 0);
+}
+
+TEST_F(FlushSchedulerTest, HandleOutlivesScheduler) {
+  auto handle =
+      scheduler_->schedule(std::chrono::milliseconds(100), []() {});
+  scheduler_.reset();
+  handle.reset();
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,407 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/grpc_call.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "envoy/config/core/v3/grpc_service.pb.h"
+#include "envoy/event/deferred_deletable.h"
+#include "envoy/event/timer.h"
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/common/backoff_strategy.h"
+#include "source/common/grpc/status.h"
+#include "source/common/http/headers.h"
+#include "source/common/http/utility.h"
+#include "source/common/tracing/http_tracer_impl.h"
+
+using ::espv2::api::envoy::v10::http::common::HttpUri;
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+class GrpcCallImpl : public HttpCall,
+                     public Envoy::Event::DeferredDeletable,
+                     public Envoy::Logger::Loggable<Envoy::Logger::Id::filter>,
+                     public Envoy::Grpc::RawAsyncRequestCallbacks {
+ public:
+  GrpcCallImpl(Envoy::Grpc::RawAsyncClient& client,
+               Envoy::Event::Dispatcher& dispatcher,
+               const std::string& service_full_name,
+               const std::string& method_name,
+               const std::function<const std::string&()>& authorization_fn,
+               std::shared_ptr<const std::string> str_body, uint32_t timeout_ms,
+               uint32_t retries, const HttpCallRetryPolicy& retry_policy,
+               HttpCallRetryBudget& retry_budget,
+               Envoy::Random::RandomGenerator& random,
+               const absl::optional<HttpCallStats>& stats,
+               Envoy::Tracing::Span& parent_span,
+               Envoy::TimeSource& time_source, bool tracing_enabled,
+               ActiveHttpCalls& active_calls)
+      : client_(client),
+        dispatcher_(dispatcher),
+        service_full_name_(service_full_name),
+        method_name_(method_name),
+        str_body_(std::move(str_body)),
+        retries_(retries),
+        timeout_ms_(timeout_ms),
+        retry_budget_(retry_budget),
+        stats_(stats),
+        authorization_fn_(authorization_fn),
+        // The gRPC client spawns the span of each request from this one.
+        parent_span_(tracing_enabled ? parent_span
+                                     : Envoy::Tracing::NullSpan::instance()),
+        time_source_(time_source),
+        active_calls_(active_calls) {
+    if (retry_policy.base_interval_ms > 0) {
+      backoff_ = std::make_unique<Envoy::JitteredExponentialBackOffStrategy>(
+          retry_policy.base_interval_ms,
+          std::max(retry_policy.base_interval_ms, retry_policy.max_interval_ms),
+          random);
+    }
+    retry_budget_.onCallStart();
+    if (stats_.has_value()) {
+      stats_->in_flight_.inc();
+    }
+    ENVOY_LOG(trace, "{}", __func__);
+  }
+
+  void setDoneFunc(HttpCall::DoneFunc on_done) {
+    on_done_ = std::move(on_done);
+  }
+
+  void call() override {
+    call_start_time_ = time_source_.monotonicTime();
+    makeOneCall();
+  }
+
+  void setDeadline(Envoy::MonotonicTime deadline) override {
+    deadline_ = deadline;
+  }
+
+  void cancel() override {
+    if (cancelled_) {
+      return;
+    }
+    cancelled_ = true;
+    ENVOY_LOG(debug, "grpc call [{}/{}]: canceled", service_full_name_,
+              method_name_);
+    if (retry_timer_) {
+      retry_timer_->disableTimer();
+    }
+    if (request_ != nullptr) {
+      request_->cancel();
+      request_ = nullptr;
+    }
+    onDoneWithoutBody(
+        Status(StatusCode::kCancelled, std::string("Request cancelled")));
+    deferredDelete();
+  }
+
+  // gRPC async receive methods
+  void onCreateInitialMetadata(
+      Envoy::Http::RequestHeaderMap& metadata) override {
+    // The authorization is checked not to be empty before each request.
+    metadata.setCopy(Envoy::Http::CustomHeaders::get().Authorization,
+                     authorization_fn_());
+  }
+
+  void onSuccessRaw(Envoy::Buffer::InstancePtr&& response,
+                    Envoy::Tracing::Span&) override {
+    request_ = nullptr;
+    ENVOY_LOG(debug, "grpc call [{}/{}]: success", service_full_name_,
+              method_name_);
+    done(OkStatus(), *response);
+    deferredDelete();
+  }
+
+  void onFailure(Envoy::Grpc::Status::GrpcStatus status,
+                 const std::string& message, Envoy::Tracing::Span&) override {
+    request_ = nullptr;
+    ENVOY_LOG(debug, "grpc call [{}/{}] failed with: {}, message: {}",
+              service_full_name_, method_name_, status, message);
+    if (attemptRetry(status)) {
+      return;
+    }
+
+    std::string error_msg = absl::StrCat(
+        "Calling Google Service Control API failed with: ", status);
+    if (!message.empty()) {
+      absl::StrAppend(&error_msg, " and message: ", message);
+    }
+    onDoneWithoutBody(Status(static_cast<StatusCode>(status), error_msg));
+    deferredDelete();
+  }
+
+ private:
+  bool attemptRetry(Envoy::Grpc::Status::GrpcStatus status) {
+    // Skip the errors of the client side, as the http calls do.
+    const uint64_t status_code =
+        Envoy::Grpc::Utility::grpcToHttpStatus(status);
+    if (status_code >= 400 && status_code < 500) {
+      return false;
+    }
+    if (retries_ <= 0 || cancelled_) {
+      return false;
+    }
+    if (deadlineExceeded(std::chrono::milliseconds(0))) {
+      ENVOY_LOG(debug, "request deadline exceeded, not retrying grpc call");
+      return false;
+    }
+    if (!retrying_) {
+      if (!retry_budget_.tryStartRetry()) {
+        ENVOY_LOG(debug, "retry budget exhausted, not retrying grpc call");
+        return false;
+      }
+      retrying_ = true;
+    }
+    retries_--;
+
+    if (!backoff_) {
+      ENVOY_LOG(debug, "retrying grpc call, with {} remaining chances",
+                retries_);
+      makeOneCall();
+      return true;
+    }
+
+    const uint64_t backoff_ms = backoff_->nextBackOffMs();
+    if (deadlineExceeded(std::chrono::milliseconds(backoff_ms))) {
+      ENVOY_LOG(debug,
+                "request deadline is before the backoff ends, not retrying "
+                "grpc call");
+      return false;
+    }
+    ENVOY_LOG(debug, "retrying grpc call in {} ms, with {} remaining chances",
+              backoff_ms, retries_);
+    if (!retry_timer_) {
+      retry_timer_ = dispatcher_.createTimer([this]() { makeOneCall(); });
+    }
+    retry_timer_->enableTimer(std::chrono::milliseconds(backoff_ms));
+    return true;
+  }
+
+  void makeOneCall() {
+    if (authorization_fn_().empty()) {
+      onDoneWithoutBody(
+          Status(StatusCode::kInternal,
+                 "Missing access token for service control call"));
+      deferredDelete();
+      return;
+    }
+
+    if (deadlineExceeded(std::chrono::milliseconds(0))) {
+      // Fail fast, as if service control did not answer in time.
+      onDoneWithoutBody(
+          Status(StatusCode::kUnavailable,
+                 "Request deadline exceeded before calling service control"));
+      deferredDelete();
+      return;
+    }
+
+    // Reference the serialized body instead of copying it on every attempt.
+    // The fragment keeps the body alive until the request releases it.
+    auto request = std::make_unique<Envoy::Buffer::OwnedImpl>();
+    auto* fragment = new Envoy::Buffer::BufferFragmentImpl(
+        str_body_->data(), str_body_->size(),
+        [str_body = str_body_](const void*, size_t,
+                               const Envoy::Buffer::BufferFragmentImpl* frag) {
+          delete frag;
+        });
+    request->addBufferFragment(*fragment);
+
+    sent_requests_++;
+    ENVOY_LOG(debug, "grpc call [{}/{}]: start", service_full_name_,
+              method_name_);
+    // The client calls onFailure() and returns null if the request can not
+    // start, which may have retried already.
+    Envoy::Grpc::AsyncRequest* sent = client_.sendRaw(
+        service_full_name_, method_name_, std::move(request), *this,
+        parent_span_,
+        Envoy::Http::AsyncClient::RequestOptions().setTimeout(
+            attemptTimeout()));
+    if (sent != nullptr) {
+      request_ = sent;
+    }
+  }
+
+  // Returns true if the deadline passes within `after` from now.
+  bool deadlineExceeded(std::chrono::milliseconds after) const {
+    return deadline_.has_value() &&
+           time_source_.monotonicTime() + after >= *deadline_;
+  }
+
+  // Returns the timeout of an attempt started now, capped to the deadline.
+  std::chrono::milliseconds attemptTimeout() const {
+    const std::chrono::milliseconds timeout(timeout_ms_);
+    if (!deadline_.has_value()) {
+      return timeout;
+    }
+    const auto remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            *deadline_ - time_source_.monotonicTime());
+    return timeout.count() > 0 ? std::min(timeout, remaining) : remaining;
+  }
+
+  void onDoneWithoutBody(const Status& status) {
+    Envoy::Buffer::OwnedImpl body;
+    done(status, body);
+  }
+
+  void done(const Status& status, Envoy::Buffer::Instance& body) {
+    active_calls_.erase(this);
+    on_done_(status, body);
+  }
+
+  void deferredDelete() {
+    if (retrying_) {
+      retry_budget_.onRetryFinish();
+      retrying_ = false;
+    }
+    retry_budget_.onCallFinish();
+    if (stats_.has_value()) {
+      stats_->in_flight_.dec();
+      if (!cancelled_ && sent_requests_ > 0) {
+        stats_->latency_.recordValue(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                time_source_.monotonicTime() - call_start_time_)
+                .count());
+        stats_->attempts_.recordValue(sent_requests_);
+      }
+    }
+    dispatcher_.deferredDelete(std::unique_ptr<GrpcCallImpl>(this));
+  }
+
+  Envoy::Grpc::RawAsyncClient& client_;
+  Envoy::Event::Dispatcher& dispatcher_;
+  const std::string& service_full_name_;
+  const std::string& method_name_;
+
+  // The request in flight, if any.
+  Envoy::Grpc::AsyncRequest* request_{};
+
+  // The callback function when request finished
+  HttpCall::DoneFunc on_done_;
+
+  // The serialized request message, shared by all the attempts
+  std::shared_ptr<const std::string> str_body_;
+
+  // The remaining retry times
+  uint32_t retries_;
+  // The timeout of each attempt
+  uint32_t timeout_ms_;
+  // The deadline of the downstream request, if any.
+  absl::optional<Envoy::MonotonicTime> deadline_;
+  // whether this call has been cancelled
+  bool cancelled_{};
+
+  // The backoff between retries. Null if the retries are immediate.
+  Envoy::BackOffStrategyPtr backoff_;
+  // The timer to make the next retry after the backoff.
+  Envoy::Event::TimerPtr retry_timer_;
+  // The retry budget of the factory.
+  HttpCallRetryBudget& retry_budget_;
+  // Whether this call holds a retry from the budget.
+  bool retrying_{};
+
+  // The stats of the factory. Disabled if not set.
+  const absl::optional<HttpCallStats>& stats_;
+  // The number of requests sent, including the retries.
+  uint32_t sent_requests_{};
+  // The start time of the call.
+  Envoy::MonotonicTime call_start_time_;
+
+  // Returns the Authorization header value, owned by the factory.
+  const std::function<const std::string&()>& authorization_fn_;
+
+  // The parent span of the requests, the null span if tracing is disabled.
+  Envoy::Tracing::Span& parent_span_;
+  Envoy::TimeSource& time_source_;
+
+  // The active calls of the factory.
+  ActiveHttpCalls& active_calls_;
+};
+
+}  // namespace
+
+Envoy::Grpc::RawAsyncClientPtr createGrpcCallClient(
+    Envoy::Upstream::ClusterManager& cm, const HttpUri& uri,
+    Envoy::Stats::Scope& scope) {
+  absl::string_view host, path;
+  Envoy::Http::Utility::extractHostPathFromUri(uri.uri(), host, path);
+
+  envoy::config::core::v3::GrpcService grpc_service;
+  grpc_service.mutable_envoy_grpc()->set_cluster_name(uri.cluster());
+  grpc_service.mutable_envoy_grpc()->set_authority(std::string(host));
+  // The cluster may not be known to the worker yet, the calls fail until it
+  // is.
+  return cm.grpcAsyncClientManager()
+      .factoryForGrpcService(grpc_service, scope,
+                             /*skip_cluster_check=*/true)
+      ->create();
+}
+
+GrpcCallFactoryImpl::GrpcCallFactoryImpl(
+    Envoy::Grpc::RawAsyncClientPtr client, Envoy::Event::Dispatcher& dispatcher,
+    const std::string& service_full_name, const std::string& method_name,
+    std::function<const std::string&()> authorization_fn, uint32_t timeout_ms,
+    uint32_t retries, const HttpCallRetryPolicy& retry_policy,
+    Envoy::TimeSource& time_source)
+    : client_(std::move(client)),
+      dispatcher_(dispatcher),
+      service_full_name_(service_full_name),
+      method_name_(method_name),
+      authorization_fn_(authorization_fn),
+      timeout_ms_(timeout_ms),
+      retries_(retries),
+      retry_policy_(retry_policy),
+      retry_budget_(retry_policy.budget_percent),
+      time_source_(time_source) {}
+
+HttpCall* GrpcCallFactoryImpl::createHttpCall(
+    const Envoy::Protobuf::Message& body, Envoy::Tracing::Span& parent_span,
+    HttpCall::DoneFunc on_done) {
+  auto str_body = std::make_shared<std::string>();
+  body.SerializeToString(str_body.get());
+  return createSerializedHttpCall(std::move(str_body), parent_span,
+                                  std::move(on_done));
+}
+
+HttpCall* GrpcCallFactoryImpl::createSerializedHttpCall(
+    std::shared_ptr<const std::string> body, Envoy::Tracing::Span& parent_span,
+    HttpCall::DoneFunc on_done) {
+  ENVOY_LOG(debug, "grpc call [{}/{}] is created", service_full_name_,
+            method_name_);
+  GrpcCallImpl* grpc_call = new GrpcCallImpl(
+      *client_, dispatcher_, service_full_name_, method_name_,
+      authorization_fn_, std::move(body), timeout_ms_, retries_, retry_policy_,
+      retry_budget_, random_, stats_, parent_span, time_source_,
+      tracing_enabled_, active_calls_);
+  grpc_call->setDoneFunc(std::move(on_done));
+  active_calls_.insert(grpc_call);
+  return grpc_call;
+}
+
+GrpcCallFactoryImpl::~GrpcCallFactoryImpl() { active_calls_.cancelAll(); }
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
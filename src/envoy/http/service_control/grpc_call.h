@@ -0,0 +1,120 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "absl/types/optional.h"
+#include "api/envoy/v10/http/common/base.pb.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/grpc/async_client.h"
+#include "envoy/stats/scope.h"
+#include "envoy/upstream/cluster_manager.h"
+#include "source/common/common/random_generator.h"
+#include "src/envoy/http/service_control/http_call.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// The gRPC service and method names of the Service Control calls.
+constexpr char kServiceControllerService[] =
+    "google.api.servicecontrol.v1.ServiceController";
+constexpr char kQuotaControllerService[] =
+    "google.api.servicecontrol.v1.QuotaController";
+constexpr char kCheckMethod[] = "Check";
+constexpr char kReportMethod[] = "Report";
+constexpr char kAllocateQuotaMethod[] = "AllocateQuota";
+
+// Creates the gRPC client of the calls to the cluster of `uri`, with the host
+// of `uri` as the authority. The calls of the client share the HTTP/2
+// connections of the cluster.
+Envoy::Grpc::RawAsyncClientPtr createGrpcCallClient(
+    Envoy::Upstream::ClusterManager& cm,
+    const ::espv2::api::envoy::v10::http::common::HttpUri& uri,
+    Envoy::Stats::Scope& scope);
+
+// Makes the calls of one method of the Service Control gRPC API, with the
+// same timeout, deadline, retry and stats semantics as HttpCallFactoryImpl.
+// The response body given to the done function is the serialized response
+// message. The calls are not compressed nor hedged.
+class GrpcCallFactoryImpl : public HttpCallFactory {
+ public:
+  GrpcCallFactoryImpl(Envoy::Grpc::RawAsyncClientPtr client,
+                      Envoy::Event::Dispatcher& dispatcher,
+                      const std::string& service_full_name,
+                      const std::string& method_name,
+                      std::function<const std::string&()> authorization_fn,
+                      uint32_t timeout_ms, uint32_t retries,
+                      const HttpCallRetryPolicy& retry_policy,
+                      Envoy::TimeSource& time_source);
+
+  HttpCall* createHttpCall(const Envoy::Protobuf::Message& body,
+                           Envoy::Tracing::Span& parent_span,
+                           HttpCall::DoneFunc on_done) override;
+
+  HttpCall* createSerializedHttpCall(std::shared_ptr<const std::string> body,
+                                     Envoy::Tracing::Span& parent_span,
+                                     HttpCall::DoneFunc on_done) override;
+
+  size_t activeCalls() const override { return active_calls_.size(); }
+
+  ~GrpcCallFactoryImpl();
+
+  // Records the stats of the calls created after this.
+  void enableStats(const HttpCallStats& stats) { stats_.emplace(stats); }
+
+  // Does not trace the calls created after this.
+  void disableTracing() { tracing_enabled_ = false; }
+
+ private:
+  // all active calls generated by this factory
+  ActiveHttpCalls active_calls_;
+
+  // The gRPC client shared by the calls. Must outlive them.
+  Envoy::Grpc::RawAsyncClientPtr client_;
+  Envoy::Event::Dispatcher& dispatcher_;
+
+  const std::string service_full_name_;
+  const std::string method_name_;
+
+  // Returns the Authorization header value of the calls. Empty if there is no
+  // token yet.
+  std::function<const std::string&()> authorization_fn_;
+
+  // call setting
+  uint32_t timeout_ms_;
+  uint32_t retries_;
+  const HttpCallRetryPolicy retry_policy_;
+
+  // The retry budget shared by the calls. Must outlive them.
+  HttpCallRetryBudget retry_budget_;
+
+  // The random generator for the backoff jitter.
+  Envoy::Random::RandomGeneratorImpl random_;
+
+  // The stats of the calls. Disabled if not set.
+  absl::optional<HttpCallStats> stats_;
+
+  Envoy::TimeSource& time_source_;
+  bool tracing_enabled_ = true;
+};
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,285 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/grpc_call.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "gtest/gtest.h"
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/http/header_map_impl.h"
+#include "source/common/http/headers.h"
+#include "test/mocks/common.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/grpc/mocks.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/mocks/tracing/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::MockFunction;
+
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::CheckResponse;
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+class GrpcCallTest : public testing::Test {
+ protected:
+  GrpcCallTest() : fake_token_("Bearer fake-token-value") {
+    fake_request_.set_service_name("test_service");
+    fake_token_fn_ = [this]() -> const std::string& { return fake_token_; };
+    ON_CALL(mock_time_source_, monotonicTime())
+        .WillByDefault(Invoke([this]() { return now_; }));
+  }
+
+  void TearDown() override {
+    grpc_call_factory_.reset();
+    for (auto request : grpc_requests_) {
+      delete request;
+    }
+  }
+
+  void createFactory(uint32_t retries) {
+    auto client = std::make_unique<NiceMock<Envoy::Grpc::MockAsyncClient>>();
+    ON_CALL(*client, sendRaw(_, _, _, _, _, _))
+        .WillByDefault(Invoke(
+            [this](absl::string_view service_full_name,
+                   absl::string_view method_name,
+                   Envoy::Buffer::InstancePtr&& request,
+                   Envoy::Grpc::RawAsyncRequestCallbacks& callbacks,
+                   Envoy::Tracing::Span&,
+                   const Envoy::Http::AsyncClient::RequestOptions& options)
+                -> Envoy::Grpc::AsyncRequest* {
+              EXPECT_EQ(service_full_name, kServiceControllerService);
+              EXPECT_EQ(method_name, kCheckMethod);
+
+              // The token is set in the initial metadata.
+              auto headers = Envoy::Http::RequestHeaderMapImpl::create();
+              callbacks.onCreateInitialMetadata(*headers);
+              auto token_header = headers->get(
+                  Envoy::Http::CustomHeaders::get().Authorization);
+              EXPECT_EQ(token_header[0]->value().getStringView(),
+                        fake_token_);
+
+              request_bodies_.push_back(request->toString());
+              request_timeouts_.push_back(options.timeout);
+              grpc_callbacks_.push_back(&callbacks);
+              auto grpc_request = new NiceMock<Envoy::Grpc::MockAsyncRequest>();
+              grpc_requests_.push_back(grpc_request);
+              return grpc_request;
+            }));
+    grpc_call_factory_ = std::make_unique<GrpcCallFactoryImpl>(
+        std::move(client), dispatcher_, kServiceControllerService,
+        kCheckMethod, fake_token_fn_, /*timeout_ms=*/5000, retries,
+        HttpCallRetryPolicy{0, 0, 0}, mock_time_source_);
+  }
+
+  HttpCall* startCall() {
+    HttpCall* call = grpc_call_factory_->createHttpCall(
+        fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+    call->call();
+    return call;
+  }
+
+  // Callback for HttpCall. Expectations must be set by each test
+  MockFunction<void(const Status& status,
+                    Envoy::Buffer::Instance& response_body)>
+      mock_done_fn_;
+
+  NiceMock<Envoy::Event::MockDispatcher> dispatcher_;
+  NiceMock<Envoy::Tracing::MockSpan> mock_parent_span_;
+  NiceMock<Envoy::MockTimeSystem> mock_time_source_;
+  Envoy::MonotonicTime now_;
+
+  // Keep track of all the gRPC callbacks and requests
+  std::vector<Envoy::Grpc::RawAsyncRequestCallbacks*> grpc_callbacks_;
+  std::vector<Envoy::Grpc::MockAsyncRequest*> grpc_requests_;
+  std::vector<std::string> request_bodies_;
+  std::vector<absl::optional<std::chrono::milliseconds>> request_timeouts_;
+
+  std::string fake_token_;
+  std::function<const std::string&()> fake_token_fn_;
+  CheckRequest fake_request_;
+
+  std::unique_ptr<GrpcCallFactoryImpl> grpc_call_factory_;
+};
+
+TEST_F(GrpcCallTest, TestSingleCallSuccess) {
+  createFactory(/*retries=*/0);
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(0);
+  startCall();
+  ASSERT_EQ(1, grpc_callbacks_.size());
+  EXPECT_EQ(request_bodies_[0], fake_request_.SerializeAsString());
+  EXPECT_EQ(request_timeouts_[0], std::chrono::milliseconds(5000));
+  EXPECT_EQ(grpc_call_factory_->activeCalls(), 1);
+
+  // The response message is given as the body.
+  CheckResponse response;
+  response.set_operation_id("test_operation");
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _))
+      .WillOnce(Invoke([](const Status&, Envoy::Buffer::Instance& body) {
+        CheckResponse parsed;
+        EXPECT_TRUE(parsed.ParseFromString(body.toString()));
+        EXPECT_EQ(parsed.operation_id(), "test_operation");
+      }));
+  grpc_callbacks_[0]->onSuccessRaw(
+      std::make_unique<Envoy::Buffer::OwnedImpl>(response.SerializeAsString()),
+      mock_parent_span_);
+  EXPECT_EQ(grpc_call_factory_->activeCalls(), 0);
+}
+
+TEST_F(GrpcCallTest, TestRetryUnavailable) {
+  createFactory(/*retries=*/2);
+  startCall();
+
+  // The unavailable and timed out attempts are retried with the same body.
+  grpc_callbacks_[0]->onFailure(Envoy::Grpc::Status::Unavailable, "",
+                                mock_parent_span_);
+  grpc_callbacks_[1]->onFailure(Envoy::Grpc::Status::DeadlineExceeded, "",
+                                mock_parent_span_);
+  ASSERT_EQ(3, grpc_callbacks_.size());
+  EXPECT_EQ(request_bodies_[2], request_bodies_[0]);
+
+  EXPECT_CALL(
+      mock_done_fn_,
+      Call(Status(StatusCode::kUnavailable,
+                  "Calling Google Service Control API failed with: 14 and "
+                  "message: upstream connect error"),
+           _))
+      .Times(1);
+  grpc_callbacks_[2]->onFailure(Envoy::Grpc::Status::Unavailable,
+                                "upstream connect error", mock_parent_span_);
+  EXPECT_EQ(3, grpc_callbacks_.size());
+}
+
+TEST_F(GrpcCallTest, TestNoRetryClientError) {
+  createFactory(/*retries=*/2);
+  startCall();
+
+  EXPECT_CALL(mock_done_fn_,
+              Call(Status(StatusCode::kPermissionDenied,
+                          "Calling Google Service Control API failed with: 7"),
+                   _))
+      .Times(1);
+  grpc_callbacks_[0]->onFailure(Envoy::Grpc::Status::PermissionDenied, "",
+                                mock_parent_span_);
+  EXPECT_EQ(1, grpc_callbacks_.size());
+}
+
+TEST_F(GrpcCallTest, TestDeadlineCapsTimeoutAndRetries) {
+  createFactory(/*retries=*/3);
+  HttpCall* call = grpc_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->setDeadline(now_ + std::chrono::milliseconds(100));
+  call->call();
+  ASSERT_EQ(1, request_timeouts_.size());
+  EXPECT_EQ(request_timeouts_[0], std::chrono::milliseconds(100));
+
+  now_ += std::chrono::milliseconds(60);
+  grpc_callbacks_[0]->onFailure(Envoy::Grpc::Status::Unavailable, "",
+                                mock_parent_span_);
+  ASSERT_EQ(2, request_timeouts_.size());
+  EXPECT_EQ(request_timeouts_[1], std::chrono::milliseconds(40));
+
+  // No retry once the deadline passed.
+  now_ += std::chrono::milliseconds(40);
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(1);
+  grpc_callbacks_[1]->onFailure(Envoy::Grpc::Status::Unavailable, "",
+                                mock_parent_span_);
+  EXPECT_EQ(2, request_timeouts_.size());
+}
+
+TEST_F(GrpcCallTest, TestEmptyTokenCallFailure) {
+  createFactory(/*retries=*/0);
+  fake_token_ = "";
+  EXPECT_CALL(mock_done_fn_,
+              Call(Status(StatusCode::kInternal,
+                          "Missing access token for service control call"),
+                   _))
+      .Times(1);
+  startCall();
+  EXPECT_EQ(0, grpc_requests_.size());
+}
+
+TEST_F(GrpcCallTest, TestCallStats) {
+  createFactory(/*retries=*/1);
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> stats_store;
+  ServiceControlFilterStats stats =
+      ServiceControlFilterStats::create("test.", stats_store);
+  grpc_call_factory_->enableStats(stats.check_call_);
+
+  startCall();
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 1);
+  now_ += std::chrono::milliseconds(10);
+  grpc_callbacks_[0]->onFailure(Envoy::Grpc::Status::Unavailable, "",
+                                mock_parent_span_);
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 1);
+
+  now_ += std::chrono::milliseconds(20);
+  EXPECT_CALL(stats_store,
+              deliverHistogramToSinks(
+                  testing::Property(&Envoy::Stats::Metric::name,
+                                    "test.service_control.check.latency"),
+                  30));
+  EXPECT_CALL(stats_store,
+              deliverHistogramToSinks(
+                  testing::Property(&Envoy::Stats::Metric::name,
+                                    "test.service_control.check.attempts"),
+                  2));
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  grpc_callbacks_[1]->onSuccessRaw(std::make_unique<Envoy::Buffer::OwnedImpl>(),
+                                   mock_parent_span_);
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 0);
+}
+
+TEST_F(GrpcCallTest, TestActiveCallCancel) {
+  createFactory(/*retries=*/0);
+  startCall();
+
+  // The call is cancelled with the factory, and still calls back.
+  EXPECT_CALL(mock_done_fn_,
+              Call(Status(StatusCode::kCancelled, "Request cancelled"), _))
+      .Times(1);
+  EXPECT_CALL(*grpc_requests_[0], cancel()).Times(1);
+  grpc_call_factory_.reset();
+}
+
+TEST_F(GrpcCallTest, TestSingleCallCancel) {
+  createFactory(/*retries=*/0);
+  HttpCall* call = startCall();
+
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(1);
+  EXPECT_CALL(*grpc_requests_[0], cancel()).Times(1);
+  call->cancel();
+
+  // The cancelled calls are not cancelled again.
+  EXPECT_CALL(*grpc_requests_[0], cancel()).Times(0);
+  grpc_call_factory_.reset();
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
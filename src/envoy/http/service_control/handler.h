@@ -14,6 +14,9 @@
 
 #pragma once
 
+#include <chrono>
+
+#include "absl/types/optional.h"
 #include "envoy/buffer/buffer.h"
 #include "envoy/common/pure.h"
 #include "envoy/http/header_map.h"
@@ -27,6 +30,8 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
+class PerRouteFilterConfig;
+
 class ServiceControlHandler {
  public:
   virtual ~ServiceControlHandler() = default;
@@ -44,6 +49,10 @@ class ServiceControlHandler {
                          Envoy::Tracing::Span& parent_span,
                          CheckDoneCallback& callback) PURE;
 
+  // Returns whether the request should be forwarded while its Check call is
+  // in flight.
+  virtual bool forwardWhileChecking() const PURE;
+
   // Make a report call.
   virtual void callReport(
       const Envoy::Http::RequestHeaderMap* request_headers,
@@ -51,6 +60,17 @@ class ServiceControlHandler {
       const Envoy::Http::ResponseTrailerMap* response_trailers,
       const Envoy::Tracing::Span& parent_span) PURE;
 
+  // Returns the interval of the intermediate reports of a long-lived stream,
+  // or nullopt if the request is only reported when it ends.
+  virtual absl::optional<std::chrono::milliseconds> streamReportInterval()
+      const PURE;
+
+  // Make an intermediate report call for the stream while it is open. It
+  // reports the bytes since the previous report.
+  virtual void callIntermediateReport(
+      const Envoy::Http::RequestHeaderMap* request_headers,
+      const Envoy::Tracing::Span& parent_span) PURE;
+
   // Fill filter state with request information for access logging.
   virtual void fillFilterState(
       ::Envoy::StreamInfo::FilterState& filter_state) PURE;
@@ -64,10 +84,17 @@ class ServiceControlHandlerFactory {
  public:
   virtual ~ServiceControlHandlerFactory() = default;
 
+  // per_route is the config of the route of the request, nullptr if it has
+  // none. The filter looks it up once per stream.
   virtual ServiceControlHandlerPtr createHandler(
       const Envoy::Http::RequestHeaderMap& headers,
       const Envoy::StreamInfo::StreamInfo& stream_info,
+      const PerRouteFilterConfig* per_route,
       ServiceControlFilterStats& filter_stats) const PURE;
+
+  // Called with the handler of a stream that is destroyed. The factory may
+  // keep it for a later stream.
+  virtual void releaseHandler(ServiceControlHandlerPtr) const {}
 };
 
 }  // namespace service_control
@@ -15,8 +15,10 @@
 #include "src/envoy/http/service_control/handler_impl.h"
 
 #include <chrono>
+#include <utility>
 
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "source/common/common/empty_string.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/utility.h"
@@ -47,44 +49,78 @@ namespace {
 RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
     referer_handle(CustomHeaders::get().Referer);
 
+// CheckRequest headers, read from every checked request.
+RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
+    ios_bundle_id_handle(
+        Envoy::Http::LowerCaseString("x-ios-bundle-identifier"));
+RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
+    android_package_handle(Envoy::Http::LowerCaseString("x-android-package"));
+RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
+    android_cert_handle(Envoy::Http::LowerCaseString("x-android-cert"));
+
 // The HTTP header suffix to send consumer info to backend.
 constexpr char kConsumerTypeHeaderSuffix[] = "api-consumer-type";
 constexpr char kConsumerNumberHeaderSuffix[] = "api-consumer-number";
 
-// CheckRequest headers
-const Envoy::Http::LowerCaseString kIosBundleIdHeader{
-    "x-ios-bundle-identifier"};
-const Envoy::Http::LowerCaseString kAndroidPackageHeader{"x-android-package"};
-const Envoy::Http::LowerCaseString kAndroidCertHeader{"x-android-cert"};
+// Whether the HTTP method is idempotent, per RFC 7231 section 4.2.2.
+bool isIdempotentMethod(absl::string_view method) {
+  const auto& methods = Envoy::Http::Headers::get().MethodValues;
+  return method == methods.Get || method == methods.Head ||
+         method == methods.Options || method == methods.Put ||
+         method == methods.Delete || method == methods.Trace;
+}
 
-constexpr char JwtPayloadIssuerPath[] = "iss";
-constexpr char JwtPayloadAudiencePath[] = "aud";
 }  // namespace
 
 ServiceControlHandlerImpl::ServiceControlHandlerImpl(
     const Envoy::Http::RequestHeaderMap& headers,
-    const Envoy::StreamInfo::StreamInfo& stream_info, const std::string& uuid,
+    const Envoy::StreamInfo::StreamInfo& stream_info,
+    const PerRouteFilterConfig* per_route, absl::string_view uuid,
     const FilterConfigParser& cfg_parser, Envoy::TimeSource& time_source,
     ServiceControlFilterStats& filter_stats)
     : cfg_parser_(cfg_parser),
-      stream_info_(stream_info),
       time_source_(time_source),
-      uuid_(uuid),
-      request_header_size_(headers.byteSize()),
       consumer_type_header_(cfg_parser_.config().generated_header_prefix() +
                             kConsumerTypeHeaderSuffix),
       consumer_number_header_(cfg_parser_.config().generated_header_prefix() +
-                              kConsumerNumberHeaderSuffix),
-      is_grpc_(false),
-      filter_stats_(filter_stats) {
-  is_grpc_ = Envoy::Grpc::Common::hasGrpcContentType(headers);
+                              kConsumerNumberHeaderSuffix) {
+  reset(headers, stream_info, per_route, uuid, filter_stats);
+}
 
-  http_method_ = std::string(utils::readHeaderEntry(headers.Method()));
-  path_ = std::string(utils::readHeaderEntry(headers.Path()));
+void ServiceControlHandlerImpl::reset(
+    const Envoy::Http::RequestHeaderMap& headers,
+    const Envoy::StreamInfo::StreamInfo& stream_info,
+    const PerRouteFilterConfig* per_route, absl::string_view uuid,
+    ServiceControlFilterStats& filter_stats) {
+  stream_info_ = &stream_info;
+  filter_stats_ = &filter_stats;
+  // Assign instead of constructing the strings to keep their capacity.
+  uuid_.assign(uuid);
+  http_method_.assign(utils::readHeaderEntry(headers.Method()));
+  path_.assign(utils::readHeaderEntry(headers.Path()));
+  api_key_.clear();
+  rc_detail_.clear();
+  request_header_size_ = headers.byteSize();
+
+  check_callback_ = nullptr;
+  check_memo_ = nullptr;
+  check_response_info_ = CheckResponseInfo();
+  check_status_ = OkStatus();
+  cancel_fn_ = nullptr;
+  on_check_done_called_ = false;
+  reported_request_bytes_ = 0;
+  reported_response_bytes_ = 0;
+  is_first_report_ = true;
 
-  const auto operation = getOperationFromPerRoute(stream_info_);
-  if (!operation.empty()) {
-    require_ctx_ = cfg_parser_.find_requirement(operation);
+  is_grpc_ = Envoy::Grpc::Common::hasGrpcContentType(headers);
+  is_streaming_ =
+      is_grpc_ || Envoy::Http::Utility::isWebSocketUpgradeRequest(headers);
+
+  require_ctx_ = nullptr;
+  if (per_route != nullptr) {
+    ENVOY_LOG(debug, "get operation_name: {}", per_route->operation_name());
+    require_ctx_ =
+        cfg_parser_.find_requirement_by_id(per_route->operation_id());
     if (!require_ctx_) {
       ENVOY_LOG(debug, "No requirement matched!");
     }
@@ -96,41 +132,44 @@ ServiceControlHandlerImpl::ServiceControlHandlerImpl(
     require_ctx_ = cfg_parser_.non_match_rqm_ctx();
   }
 
-  if (require_ctx_->config().api_key().locations_size() > 0) {
-    extractAPIKey(headers, require_ctx_->config().api_key().locations(),
-                  api_key_);
+  // The filter created the request context, unless the handler is created
+  // without it.
+  const utils::EspRequestContext* request_context =
+      utils::EspRequestContext::find(stream_info.filterState());
+  if (!require_ctx_->api_key_locations().locations.empty()) {
+    extractAPIKey(headers, require_ctx_->api_key_locations(), api_key_,
+                  request_context);
   } else {
-    extractAPIKey(headers, cfg_parser_.default_api_keys().locations(),
-                  api_key_);
+    extractAPIKey(headers, cfg_parser_.default_api_key_locations(), api_key_,
+                  request_context);
   }
 }
 
 ServiceControlHandlerImpl::~ServiceControlHandlerImpl() {}
 
-absl::string_view ServiceControlHandlerImpl::getOperationFromPerRoute(
-    const Envoy::StreamInfo::StreamInfo& stream_info) {
-  if (stream_info_.routeEntry() == nullptr) {
-    ENVOY_LOG(debug, "No route entry");
-    return Envoy::EMPTY_STRING;
-  }
-
-  const auto* per_route =
-      stream_info.routeEntry()->perFilterConfigTyped<PerRouteFilterConfig>(
-          kFilterName);
-  if (per_route == nullptr) {
-    ENVOY_LOG(debug, "no per-route config");
-    return Envoy::EMPTY_STRING;
-  }
-  ENVOY_LOG(debug, "get operation_name: {}", per_route->operation_name());
-  return per_route->operation_name();
-}
-
 void ServiceControlHandlerImpl::fillFilterState(FilterState& filter_state) {
   utils::setStringFilterState(filter_state, utils::kFilterStateApiKey,
                               api_key_);
 
   utils::setStringFilterState(filter_state, utils::kFilterStateApiMethod,
                               require_ctx_->config().operation_name());
+
+  const uint32_t memo_ms = cfg_parser_.config().connection_check_memo_ms();
+  if (memo_ms == 0) {
+    return;
+  }
+  // Set with the connection life span, so it is kept by the stream filter
+  // states of the connection.
+  if (!filter_state.hasData<ConnectionCheckMemo>(
+          kFilterStateConnectionCheckMemo)) {
+    filter_state.setData(
+        kFilterStateConnectionCheckMemo,
+        std::make_shared<ConnectionCheckMemo>(
+            std::chrono::milliseconds(memo_ms)),
+        FilterState::StateType::Mutable, FilterState::LifeSpan::Connection);
+  }
+  check_memo_ = &filter_state.getDataMutable<ConnectionCheckMemo>(
+      kFilterStateConnectionCheckMemo);
 }
 
 void ServiceControlHandlerImpl::onDestroy() {
@@ -146,11 +185,12 @@ void ServiceControlHandlerImpl::fillOperationInfo(
   info.operation_name = require_ctx_->config().operation_name();
   info.producer_project_id =
       require_ctx_->service_ctx().config().producer_project_id();
-  info.current_time = time_source_.systemTime();
+  info.current_time =
+      clock_ != nullptr ? clock_->now() : time_source_.systemTime();
 
-  if (stream_info_.downstreamAddressProvider().remoteAddress()->type() ==
+  if (stream_info_->downstreamAddressProvider().remoteAddress()->type() ==
       Envoy::Network::Address::Type::Ip) {
-    info.client_ip = stream_info_.downstreamAddressProvider()
+    info.client_ip = stream_info_->downstreamAddressProvider()
                          .remoteAddress()
                          ->ip()
                          ->addressAsString();
@@ -168,7 +208,8 @@ void ServiceControlHandlerImpl::prepareReportRequest(
   info.api_method = require_ctx_->config().operation_name();
   info.api_name = require_ctx_->config().api_name();
   info.api_version = require_ctx_->config().api_version();
-  info.log_message = info.api_method + " is called";
+  info.log_message.assign(info.api_method);
+  info.log_message.append(" is called");
 
   info.check_response_info = check_response_info_;
   info.status = check_status_;
@@ -193,17 +234,25 @@ void ServiceControlHandlerImpl::callCheck(
   }
 
   if (!hasApiKey()) {
-    filter_stats_.filter_.denied_consumer_error_.inc();
+    filter_stats_->filter_.denied_consumer_error_.inc();
     check_status_ =
         Status(StatusCode::kUnauthenticated,
                "Method doesn't allow unregistered callers (callers without "
                "established identity). Please use API Key or other form of "
                "API consumer identity to call this API.");
-    callback.onCheckDone(
-        check_status_,
-        utils::generateRcDetails(utils::kRcDetailFilterServiceControl,
-                                 utils::kRcDetailErrorTypeBadRequest,
-                                 utils::kRcDetailErrorMissingApiKey));
+    callback.onCheckDone(check_status_,
+                         utils::kRcDetailsServiceControlMissingApiKey);
+    return;
+  }
+
+  if (!cfg_parser_.api_key_format().matches(api_key_)) {
+    filter_stats_->filter_.denied_consumer_error_.inc();
+    filter_stats_->filter_.denied_malformed_api_key_.inc();
+    // The status Service Control gives the invalid keys.
+    check_status_ = Status(StatusCode::kInvalidArgument,
+                           "API key not valid. Please pass a valid API key.");
+    callback.onCheckDone(check_status_,
+                         utils::kRcDetailsServiceControlMalformedApiKey);
     return;
   }
 
@@ -211,29 +260,84 @@ void ServiceControlHandlerImpl::callCheck(
   ::espv2::api_proxy::service_control::CheckRequestInfo info;
   fillOperationInfo(info);
 
-  info.referer = std::string(
-      utils::readHeaderEntry(headers.getInline(referer_handle.handle())));
-  info.ios_bundle_id =
-      std::string(utils::extractHeader(headers, kIosBundleIdHeader));
-  info.android_package_name =
-      std::string(utils::extractHeader(headers, kAndroidPackageHeader));
-  info.android_cert_fingerprint =
-      std::string(utils::extractHeader(headers, kAndroidCertHeader));
+  // The headers outlive the call, the strings are only copied into the check
+  // request.
+  info.referer =
+      utils::readHeaderEntry(headers.getInline(referer_handle.handle()));
+  info.ios_bundle_id = utils::readHeaderEntry(
+      headers.getInline(ios_bundle_id_handle.handle()));
+  info.android_package_name = utils::readHeaderEntry(
+      headers.getInline(android_package_handle.handle()));
+  info.android_cert_fingerprint = utils::readHeaderEntry(
+      headers.getInline(android_cert_handle.handle()));
+  info.deadline = requestDeadline(headers);
+
+  if (check_memo_ != nullptr) {
+    fillCheckMemoSignature(info);
+    const CheckResponseInfo* memoized = check_memo_->lookup(
+        check_memo_signature_, time_source_.monotonicTime());
+    if (memoized != nullptr) {
+      filter_stats_->filter_.check_connection_memo_hit_.inc();
+      onCheckResponse(headers, OkStatus(), *memoized);
+      return;
+    }
+  }
 
   on_check_done_called_ = false;
   cancel_fn_ = require_ctx_->service_ctx().call().callCheck(
       info, parent_span,
-      [this, &headers](const Status& status,
-                       const CheckResponseInfo& response_info) {
+      [this, &headers](const Status& status, CheckResponseInfo response_info) {
         cancel_fn_ = nullptr;
         on_check_done_called_ = true;
-        onCheckResponse(headers, status, response_info);
+        // The failed open results are not kept, so the later streams check
+        // again.
+        if (check_memo_ != nullptr && status.ok() &&
+            !response_info.error.is_network_error) {
+          check_memo_->insert(check_memo_signature_, response_info,
+                              time_source_.monotonicTime());
+        }
+        onCheckResponse(headers, status, std::move(response_info));
       });
   if (on_check_done_called_) {
     cancel_fn_ = nullptr;
   }
 }
 
+void ServiceControlHandlerImpl::fillCheckMemoSignature(
+    const ::espv2::api_proxy::service_control::CheckRequestInfo& info) {
+  // The signature of the check cache, with the service, as the streams of
+  // a connection may call different services. The delimiter is not valid in
+  // the service names.
+  constexpr absl::string_view kDelimiter("\0", 1);
+  check_memo_signature_ = absl::StrCat(
+      require_ctx_->service_ctx().config().service_name(), kDelimiter,
+      require_ctx_->service_ctx().call().checkSignature(info));
+}
+
+absl::optional<Envoy::MonotonicTime>
+ServiceControlHandlerImpl::requestDeadline(
+    const Envoy::Http::RequestHeaderMap& headers) const {
+  absl::optional<std::chrono::milliseconds> timeout;
+  if (is_grpc_) {
+    timeout = Envoy::Grpc::Common::getGrpcTimeout(headers);
+    // A zero grpc-timeout means no deadline.
+    if (timeout.has_value() && timeout->count() == 0) {
+      timeout = absl::nullopt;
+    }
+  }
+
+  const Envoy::Router::RouteEntry* route_entry = stream_info_->routeEntry();
+  if (route_entry != nullptr && route_entry->timeout().count() > 0 &&
+      (!timeout.has_value() || route_entry->timeout() < *timeout)) {
+    timeout = route_entry->timeout();
+  }
+
+  if (!timeout.has_value()) {
+    return absl::nullopt;
+  }
+  return stream_info_->startTimeMonotonic() + *timeout;
+}
+
 // TODO(taoxuy): add unit test
 void ServiceControlHandlerImpl::callQuota() {
   if (!isQuotaRequired()) {
@@ -243,13 +347,14 @@ void ServiceControlHandlerImpl::callQuota() {
 
   ::espv2::api_proxy::service_control::QuotaRequestInfo info{
       require_ctx_->metric_costs()};
-  info.method_name = require_ctx_->config().operation_name();
+  info.method_name = std::string(require_ctx_->quota_method_name());
   fillOperationInfo(info);
 
   // TODO: if quota cache is disabled, need to use in-flight
   // transport, need to save its cancel function.
   // For now, quota cache is always enabled, in-flight transport
-  // is not called.
+  // is not called. The quota is answered from the cache before the call
+  // returns, so calling it after the Check adds no round trip to the request.
   require_ctx_->service_ctx().call().callQuota(
       info,
       [this](const Status& status, const QuotaResponseInfo& response_info) {
@@ -268,28 +373,29 @@ void ServiceControlHandlerImpl::callQuota() {
 
 void ServiceControlHandlerImpl::onCheckResponse(
     Envoy::Http::RequestHeaderMap& headers, const Status& status,
-    const CheckResponseInfo& response_info) {
-  check_response_info_ = response_info;
+    CheckResponseInfo response_info) {
+  check_response_info_ = std::move(response_info);
 
-  if (!response_info.error.name.empty()) {
+  if (!check_response_info_.error.name.empty()) {
     rc_detail_ =
         utils::generateRcDetails(utils::kRcDetailFilterServiceControl,
-                                 response_info.error.is_network_error
+                                 check_response_info_.error.is_network_error
                                      ? utils::kRcDetailErrorTypeScCheckNetwork
                                      : utils::kRcDetailErrorTypeScCheck,
-                                 response_info.error.name);
+                                 check_response_info_.error.name);
   }
   check_status_ = status;
 
   // Set consumer info to backend. Since consumer_project_id is deprecated and
   // replaced by consumer_number so don't set it here.
-  if (!response_info.consumer_type.empty()) {
-    headers.setReferenceKey(consumer_type_header_, response_info.consumer_type);
+  if (!check_response_info_.consumer_type.empty()) {
+    headers.setReferenceKey(consumer_type_header_,
+                            check_response_info_.consumer_type);
   }
 
-  if (!response_info.consumer_number.empty()) {
+  if (!check_response_info_.consumer_number.empty()) {
     headers.setReferenceKey(consumer_number_header_,
-                            response_info.consumer_number);
+                            check_response_info_.consumer_number);
   }
 
   if (!check_status_.ok()) {
@@ -300,69 +406,221 @@ void ServiceControlHandlerImpl::onCheckResponse(
   callQuota();
 }
 
-void ServiceControlHandlerImpl::callReport(
+void ServiceControlHandlerImpl::fillStreamReport(
     const Envoy::Http::RequestHeaderMap* request_headers,
     const Envoy::Http::ResponseHeaderMap* response_headers,
     const Envoy::Http::ResponseTrailerMap* response_trailers,
-    const Envoy::Tracing::Span& parent_span) {
-  if (!isReportRequired()) {
-    return;
-  }
-
-  ::espv2::api_proxy::service_control::ReportRequestInfo info;
+    const Envoy::Tracing::Span& parent_span,
+    ::espv2::api_proxy::service_control::ReportRequestInfo& info) {
   prepareReportRequest(info);
-  fillLoggedHeader(request_headers,
-                   require_ctx_->service_ctx().config().log_request_headers(),
-                   info.request_headers);
-  fillLoggedHeader(response_headers,
-                   require_ctx_->service_ctx().config().log_response_headers(),
-                   info.response_headers);
-  fillJwtPayloads(
-      stream_info_.dynamicMetadata(),
-      require_ctx_->service_ctx().config().jwt_payload_metadata_name(),
-      require_ctx_->service_ctx().config().log_jwt_payloads(),
-      info.jwt_payloads);
-
-  fillJwtPayload(
-      stream_info_.dynamicMetadata(),
-      require_ctx_->service_ctx().config().jwt_payload_metadata_name(),
-      JwtPayloadIssuerPath, info.auth_issuer);
-
-  fillJwtPayload(
-      stream_info_.dynamicMetadata(),
-      require_ctx_->service_ctx().config().jwt_payload_metadata_name(),
-      JwtPayloadAudiencePath, info.auth_audience);
-
-  info.frontend_protocol = getFrontendProtocol(response_headers, stream_info_);
-  info.backend_protocol =
-      getBackendProtocol(require_ctx_->service_ctx().config());
+
+  fillJwtPayload(stream_info_->dynamicMetadata(),
+                 require_ctx_->service_ctx().jwt_issuer_steps(),
+                 info.auth_issuer);
+
+  fillJwtPayload(stream_info_->dynamicMetadata(),
+                 require_ctx_->service_ctx().jwt_audience_steps(),
+                 info.auth_audience);
+
+  // The response headers of an open stream may not be known yet.
+  info.frontend_protocol =
+      !info.is_final_report && is_grpc_
+          ? ::espv2::api_proxy::service_control::protocol::GRPC
+          : getFrontendProtocol(response_headers, *stream_info_);
+  info.backend_protocol = require_ctx_->service_ctx().backend_protocol();
 
   if (request_headers) {
-    info.referer = std::string(utils::readHeaderEntry(
-        request_headers->getInline(referer_handle.handle())));
+    info.referer = utils::readHeaderEntry(
+        request_headers->getInline(referer_handle.handle()));
   }
 
-  fillLatency(stream_info_, info.latency, filter_stats_);
-  fillStatus(response_headers, response_trailers, stream_info_, info);
+  fillStatus(response_headers, response_trailers, *stream_info_, info);
 
-  info.request_size = stream_info_.bytesReceived() + request_header_size_;
+  const int64_t request_bytes =
+      stream_info_->bytesReceived() + request_header_size_;
+  info.request_size = request_bytes - reported_request_bytes_;
+  reported_request_bytes_ = request_bytes;
 
-  uint64_t response_header_size = 0;
+  int64_t response_bytes = stream_info_->bytesSent();
   if (response_headers) {
-    response_header_size += response_headers->byteSize();
+    response_bytes += response_headers->byteSize();
   }
   if (response_trailers) {
-    response_header_size += response_trailers->byteSize();
+    response_bytes += response_trailers->byteSize();
   }
-  info.response_size = stream_info_.bytesSent() + response_header_size;
+  info.response_size = response_bytes - reported_response_bytes_;
+  reported_response_bytes_ = response_bytes;
 
-  info.response_code_detail = stream_info_.responseCodeDetails().value_or("");
+  info.is_first_report = is_first_report_;
+  is_first_report_ = false;
+
+  info.response_code_detail =
+      stream_info_->responseCodeDetails().value_or("");
 
   info.trace_id = parent_span.getTraceIdAsHex();
+}
+
+void ServiceControlHandlerImpl::callReport(
+    const Envoy::Http::RequestHeaderMap* request_headers,
+    const Envoy::Http::ResponseHeaderMap* response_headers,
+    const Envoy::Http::ResponseTrailerMap* response_trailers,
+    const Envoy::Tracing::Span& parent_span) {
+  if (!isReportRequired()) {
+    return;
+  }
+
+  ::espv2::api_proxy::service_control::ReportRequestInfo& info = report_info_;
+  info.Clear();
+  fillStreamReport(request_headers, response_headers, response_trailers,
+                   parent_span, info);
+  const TelemetryShedLevel shed = telemetry_shedding_ != nullptr
+                                      ? telemetry_shedding_->level()
+                                      : TelemetryShedLevel::None;
+  switch (shed) {
+    case TelemetryShedLevel::None:
+      break;
+    case TelemetryShedLevel::LoggedFields:
+      filter_stats_->filter_.report_shed_logged_fields_.inc();
+      break;
+    case TelemetryShedLevel::LogEntries:
+      filter_stats_->filter_.report_shed_log_entries_.inc();
+      info.skip_log_entries = true;
+      break;
+    case TelemetryShedLevel::MetricsOnly:
+      filter_stats_->filter_.report_metrics_only_.inc();
+      info.skip_log_entries = true;
+      info.metrics_only = true;
+      break;
+  }
+
+  // Only scan for the logged fields if there are logs to put them in.
+  if (shed == TelemetryShedLevel::None &&
+      require_ctx_->service_ctx().call().logsEnabled()) {
+    const ServiceContext& service_ctx = require_ctx_->service_ctx();
+    fillLoggedHeader(request_headers, service_ctx.log_request_headers(),
+                     info.request_headers);
+    fillLoggedHeader(response_headers, service_ctx.log_response_headers(),
+                     info.response_headers);
+    fillJwtPayloads(stream_info_->dynamicMetadata(),
+                    service_ctx.log_jwt_payloads(), info.jwt_payloads);
+  }
+
+  fillLatency(*stream_info_, info.latency, *filter_stats_);
 
   require_ctx_->service_ctx().call().callReport(info);
 }
 
+bool ServiceControlHandlerImpl::forwardWhileChecking() const {
+  return require_ctx_->config().forward_while_checking() &&
+         isIdempotentMethod(http_method_);
+}
+
+absl::optional<std::chrono::milliseconds>
+ServiceControlHandlerImpl::streamReportInterval() const {
+  if (!is_streaming_ || !isReportRequired()) {
+    return absl::nullopt;
+  }
+  return std::chrono::milliseconds(
+      require_ctx_->service_ctx().get_min_stream_report_interval_ms());
+}
+
+void ServiceControlHandlerImpl::callIntermediateReport(
+    const Envoy::Http::RequestHeaderMap* request_headers,
+    const Envoy::Tracing::Span& parent_span) {
+  if (!isReportRequired()) {
+    return;
+  }
+
+  ::espv2::api_proxy::service_control::ReportRequestInfo& info = report_info_;
+  info.Clear();
+  info.is_final_report = false;
+  fillStreamReport(request_headers, nullptr, nullptr, parent_span, info);
+
+  require_ctx_->service_ctx().call().callReport(info);
+}
+
+ServiceControlHandlerFactoryImpl::ServiceControlHandlerFactoryImpl(
+    Envoy::Random::RandomGenerator& random,
+    const FilterConfigParser& cfg_parser, Envoy::TimeSource& time_source,
+    Envoy::ThreadLocal::SlotAllocator& tls, uint32_t pool_size,
+    bool sequential_operation_ids, bool coarse_timestamps,
+    const TelemetryShedding* shedding)
+    : random_(random),
+      cfg_parser_(cfg_parser),
+      time_source_(time_source),
+      telemetry_shedding_(shedding),
+      pool_size_(pool_size) {
+  if (pool_size_ == 0 && !sequential_operation_ids && !coarse_timestamps) {
+    return;
+  }
+  tls_ = Envoy::ThreadLocal::TypedSlot<
+      ServiceControlHandlerThreadLocal>::makeUnique(tls);
+  // The prefix tells apart the ids of other processes, the index the ids of
+  // the other workers.
+  const uint64_t prefix = random_.random();
+  tls_->set([this, prefix, sequential_operation_ids, coarse_timestamps](
+                Envoy::Event::Dispatcher& dispatcher) {
+    auto local = std::make_shared<ServiceControlHandlerThreadLocal>();
+    if (sequential_operation_ids) {
+      local->operation_ids = std::make_unique<SequentialOperationIdGenerator>(
+          prefix, next_generator_index_++);
+    }
+    if (coarse_timestamps) {
+      local->clock =
+          std::make_unique<utils::CoarseSystemClock>(dispatcher, time_source_);
+    }
+    return local;
+  });
+}
+
+ServiceControlHandlerPtr ServiceControlHandlerFactoryImpl::createHandler(
+    const Envoy::Http::RequestHeaderMap& headers,
+    const Envoy::StreamInfo::StreamInfo& stream_info,
+    const PerRouteFilterConfig* per_route,
+    ServiceControlFilterStats& filter_stats) const {
+  ServiceControlHandlerThreadLocal* local =
+      tls_ != nullptr ? &**tls_ : nullptr;
+
+  std::string random_uuid;
+  absl::string_view uuid;
+  if (local != nullptr && local->operation_ids != nullptr) {
+    uuid = local->operation_ids->next();
+  } else {
+    random_uuid = random_.uuid();
+    uuid = random_uuid;
+  }
+
+  if (local != nullptr && !local->handlers.empty()) {
+    std::unique_ptr<ServiceControlHandlerImpl> handler =
+        std::move(local->handlers.back());
+    local->handlers.pop_back();
+    handler->reset(headers, stream_info, per_route, uuid, filter_stats);
+    filter_stats.filter_.handler_pool_hit_.inc();
+    return handler;
+  }
+  auto handler = std::make_unique<ServiceControlHandlerImpl>(
+      headers, stream_info, per_route, uuid, cfg_parser_, time_source_,
+      filter_stats);
+  handler->setTelemetryShedding(telemetry_shedding_);
+  if (local != nullptr) {
+    handler->setClock(local->clock.get());
+  }
+  return handler;
+}
+
+void ServiceControlHandlerFactoryImpl::releaseHandler(
+    ServiceControlHandlerPtr handler) const {
+  if (tls_ == nullptr) {
+    return;
+  }
+  auto& handlers = (*tls_)->handlers;
+  if (handlers.size() < pool_size_) {
+    // Only the handlers created by this factory are released to it.
+    handlers.emplace_back(
+        static_cast<ServiceControlHandlerImpl*>(handler.release()));
+  }
+}
+
 }  // namespace service_control
 }  // namespace http_filters
 }  // namespace envoy
@@ -14,8 +14,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "envoy/buffer/buffer.h"
 #include "envoy/common/random_generator.h"
@@ -23,13 +26,18 @@
 #include "envoy/http/header_map.h"
 #include "envoy/http/query_params.h"
 #include "envoy/runtime/runtime.h"
+#include "envoy/thread_local/thread_local.h"
 #include "source/common/common/logger.h"
 #include "source/common/grpc/codec.h"
 #include "source/common/grpc/common.h"
 #include "src/api_proxy/service_control/request_builder.h"
 #include "src/api_proxy/service_control/request_info.h"
 #include "src/envoy/http/service_control/config_parser.h"
+#include "src/envoy/http/service_control/connection_check_memo.h"
 #include "src/envoy/http/service_control/handler.h"
+#include "src/envoy/http/service_control/operation_id_generator.h"
+#include "src/envoy/http/service_control/telemetry_shedding.h"
+#include "src/envoy/utils/coarse_clock.h"
 #include "src/envoy/utils/http_header_utils.h"
 
 namespace espv2 {
@@ -44,12 +52,31 @@ class ServiceControlHandlerImpl
  public:
   ServiceControlHandlerImpl(const Envoy::Http::RequestHeaderMap& headers,
                             const Envoy::StreamInfo::StreamInfo& stream_info,
-                            const std::string& uuid,
+                            const PerRouteFilterConfig* per_route,
+                            absl::string_view uuid,
                             const FilterConfigParser& cfg_parser,
                             Envoy::TimeSource& timeSource,
                             ServiceControlFilterStats& filter_stats);
   ~ServiceControlHandlerImpl() override;
 
+  // Prepares the handler for a new request, as if it was just constructed.
+  // The strings keep their capacity, so a pooled handler serves the request
+  // without allocating them again.
+  void reset(const Envoy::Http::RequestHeaderMap& headers,
+             const Envoy::StreamInfo::StreamInfo& stream_info,
+             const PerRouteFilterConfig* per_route, absl::string_view uuid,
+             ServiceControlFilterStats& filter_stats);
+
+  // If set, the times of the operations are read from the clock instead of
+  // the time source. It must outlive the handler.
+  void setClock(utils::CoarseSystemClock* clock) { clock_ = clock; }
+
+  // If set, the reports shed their telemetry under overload. It must outlive
+  // the handler.
+  void setTelemetryShedding(const TelemetryShedding* shedding) {
+    telemetry_shedding_ = shedding;
+  }
+
   void callCheck(Envoy::Http::RequestHeaderMap& headers,
                  Envoy::Tracing::Span& parent_span,
                  CheckDoneCallback& callback) override;
@@ -59,28 +86,49 @@ class ServiceControlHandlerImpl
                   const Envoy::Http::ResponseTrailerMap* response_trailers,
                   const Envoy::Tracing::Span& parent_span) override;
 
+  bool forwardWhileChecking() const override;
+
+  absl::optional<std::chrono::milliseconds> streamReportInterval()
+      const override;
+
+  void callIntermediateReport(
+      const Envoy::Http::RequestHeaderMap* request_headers,
+      const Envoy::Tracing::Span& parent_span) override;
+
   void fillFilterState(::Envoy::StreamInfo::FilterState& filter_state) override;
 
   void onDestroy() override;
 
  private:
-  absl::string_view getOperationFromPerRoute(
-      const Envoy::StreamInfo::StreamInfo& stream_info);
-
   void callQuota();
 
+  // Returns the time the request times out, from the smaller of its
+  // grpc-timeout and its route timeout. Not set if it has neither.
+  absl::optional<Envoy::MonotonicTime> requestDeadline(
+      const Envoy::Http::RequestHeaderMap& headers) const;
+
   void fillOperationInfo(
       ::espv2::api_proxy::service_control::OperationInfo& info);
   void prepareReportRequest(
       ::espv2::api_proxy::service_control::ReportRequestInfo& info);
 
+  // Fills the report fields shared by the intermediate and final reports.
+  // The sizes are the bytes since the previous report. is_final_report must
+  // be set on the info before.
+  void fillStreamReport(
+      const Envoy::Http::RequestHeaderMap* request_headers,
+      const Envoy::Http::ResponseHeaderMap* response_headers,
+      const Envoy::Http::ResponseTrailerMap* response_trailers,
+      const Envoy::Tracing::Span& parent_span,
+      ::espv2::api_proxy::service_control::ReportRequestInfo& info);
+
   bool isConfigured() const {
     return require_ctx_ != cfg_parser_.non_match_rqm_ctx();
   }
 
   bool isQuotaRequired() const {
     return !require_ctx_->config().skip_service_control() &&
-           !require_ctx_->config().metric_costs().empty();
+           !require_ctx_->metric_costs().empty();
   }
 
   bool isCheckRequired() const {
@@ -94,21 +142,29 @@ class ServiceControlHandlerImpl
 
   bool hasApiKey() const { return !api_key_.empty(); }
 
+  // Sets the signature of the check request in check_memo_signature_.
+  void fillCheckMemoSignature(
+      const ::espv2::api_proxy::service_control::CheckRequestInfo& info);
+
   void onCheckResponse(
       Envoy::Http::RequestHeaderMap& headers,
       const ::google::protobuf::util::Status& status,
-      const ::espv2::api_proxy::service_control::CheckResponseInfo&
-          response_info);
+      ::espv2::api_proxy::service_control::CheckResponseInfo response_info);
 
   // The filter config parser.
   const FilterConfigParser& cfg_parser_;
 
   // The metadata for the request
-  const Envoy::StreamInfo::StreamInfo& stream_info_;
+  const Envoy::StreamInfo::StreamInfo* stream_info_{};
 
   // timeSource
   Envoy::TimeSource& time_source_;
 
+  // The clock of the worker, if the timestamps are coarse.
+  utils::CoarseSystemClock* clock_{};
+
+  const TelemetryShedding* telemetry_shedding_{};
+
   // The matched requirement
   const RequirementContext* require_ctx_{};
 
@@ -120,7 +176,7 @@ class ServiceControlHandlerImpl
   // Considering the request headers can be modified, the original downstream
   // header should be used as request_header_size. This variable is used to
   // remember the downstream header size when HandlerImpl object is created.
-  int request_header_size_;
+  int request_header_size_ = 0;
 
   // The name of headers to send consumer info
   const Envoy::Http::LowerCaseString consumer_type_header_;
@@ -133,31 +189,68 @@ class ServiceControlHandlerImpl
   // The response code detail.
   std::string rc_detail_;
 
+  // The check results of the connection, if enabled. Owned by the filter
+  // state of the connection.
+  ConnectionCheckMemo* check_memo_{};
+  std::string check_memo_signature_;
+
   CancelFunc cancel_fn_;
-  bool on_check_done_called_;
+  bool on_check_done_called_ = false;
+
+  bool is_grpc_ = false;
+
+  // If true, it is a gRPC or WebSocket stream and needs to send multiple
+  // reports.
+  bool is_streaming_ = false;
 
-  // If true, it is a grpc and need to send multiple reports.
-  bool is_grpc_;
+  // The bytes already sent in intermediate reports.
+  int64_t reported_request_bytes_ = 0;
+  int64_t reported_response_bytes_ = 0;
+  bool is_first_report_ = true;
+
+  // The info of the reports, cleared before each one. Its strings keep their
+  // capacity over the reports of the stream and, as the handler is pooled,
+  // over the requests of the worker.
+  ::espv2::api_proxy::service_control::ReportRequestInfo report_info_;
 
   // Filter statistics.
-  ServiceControlFilterStats& filter_stats_;
+  ServiceControlFilterStats* filter_stats_{};
+};
+
+// The state of a handler factory on one worker.
+struct ServiceControlHandlerThreadLocal
+    : public Envoy::ThreadLocal::ThreadLocalObject {
+  // The free handlers, reused by the later requests of the worker.
+  std::vector<std::unique_ptr<ServiceControlHandlerImpl>> handlers;
+  // Not set if the operation ids are random UUIDs.
+  std::unique_ptr<SequentialOperationIdGenerator> operation_ids;
+  // Not set if the times are read from the time source.
+  std::unique_ptr<utils::CoarseSystemClock> clock;
 };
 
 class ServiceControlHandlerFactoryImpl : public ServiceControlHandlerFactory {
  public:
+  // Up to `pool_size` released handlers are kept per worker. No handler is
+  // reused if it is 0. If `sequential_operation_ids` is set, the operation
+  // ids come from a counter of each worker instead of random UUIDs. If
+  // `coarse_timestamps` is set, the times of the operations come from a
+  // clock of each worker read once per event loop iteration.
   ServiceControlHandlerFactoryImpl(Envoy::Random::RandomGenerator& random,
                                    const FilterConfigParser& cfg_parser,
-                                   Envoy::TimeSource& time_source)
-      : random_(random), cfg_parser_(cfg_parser), time_source_(time_source) {}
+                                   Envoy::TimeSource& time_source,
+                                   Envoy::ThreadLocal::SlotAllocator& tls,
+                                   uint32_t pool_size,
+                                   bool sequential_operation_ids = false,
+                                   bool coarse_timestamps = false,
+                                   const TelemetryShedding* shedding = nullptr);
 
   ServiceControlHandlerPtr createHandler(
       const Envoy::Http::RequestHeaderMap& headers,
       const Envoy::StreamInfo::StreamInfo& stream_info,
-      ServiceControlFilterStats& filter_stats) const override {
-    return std::make_unique<ServiceControlHandlerImpl>(
-        headers, stream_info, random_.uuid(), cfg_parser_, time_source_,
-        filter_stats);
-  }
+      const PerRouteFilterConfig* per_route,
+      ServiceControlFilterStats& filter_stats) const override;
+
+  void releaseHandler(ServiceControlHandlerPtr handler) const override;
 
  private:
   // Random object.
@@ -166,6 +259,15 @@ class ServiceControlHandlerFactoryImpl : public ServiceControlHandlerFactory {
   const FilterConfigParser& cfg_parser_;
   // The timeSource
   Envoy::TimeSource& time_source_;
+  // Not set if the telemetry is not shed.
+  const TelemetryShedding* const telemetry_shedding_;
+  // The maximum number of free handlers per worker.
+  const uint32_t pool_size_;
+  // The index of the next worker's operation id generator.
+  std::atomic<uint16_t> next_generator_index_{0};
+  // Not set if none of the pool, the sequential ids and the coarse
+  // timestamps are enabled.
+  Envoy::ThreadLocal::TypedSlotPtr<ServiceControlHandlerThreadLocal> tls_;
 };
 
 }  // namespace service_control
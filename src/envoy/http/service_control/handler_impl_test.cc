@@ -15,16 +15,21 @@
 
 #include "src/envoy/http/service_control/handler_impl.h"
 
+#include "absl/strings/str_cat.h"
 #include "envoy/http/header_map.h"
 #include "gmock/gmock.h"
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 #include "source/common/common/empty_string.h"
+#include "source/common/network/address_impl.h"
 #include "source/common/tracing/http_tracer_impl.h"
 #include "src/envoy/http/service_control/mocks.h"
+#include "src/envoy/utils/allocation_counter.h"
 #include "src/envoy/utils/filter_state_utils.h"
+#include "test/mocks/common.h"
 #include "test/mocks/router/mocks.h"
 #include "test/mocks/server/mocks.h"
+#include "test/mocks/thread_local/mocks.h"
 #include "test/mocks/tracing/mocks.h"
 #include "test/test_common/test_time.h"
 
@@ -49,6 +54,7 @@ using ::espv2::api_proxy::service_control::ReportRequestInfo;
 using ::espv2::api_proxy::service_control::ScResponseErrorType;
 using ::espv2::api_proxy::service_control::api_key::ApiKeyState;
 using ::espv2::api_proxy::service_control::protocol::Protocol;
+using ::espv2::envoy::utils::AllocationCounter;
 using ::google::protobuf::TextFormat;
 using ::google::protobuf::util::OkStatus;
 using ::google::protobuf::util::Status;
@@ -76,6 +82,13 @@ requirements {
     allow_without_api_key: true
   }
 }
+requirements {
+  service_name: "echo"
+  api_name: "test_api"
+  api_version: "test_version"
+  operation_name: "forward_while_checking"
+  forward_while_checking: true
+}
 requirements {
   service_name: "echo"
   api_name: "test_api"
@@ -145,6 +158,19 @@ requirements {
     cost: 1
   }
 }
+requirements {
+  service_name: "echo"
+  api_name: "test_api"
+  api_version: "test_version"
+  operation_name: "zero_cost_quota"
+  api_key: {
+    allow_without_api_key: true
+  }
+  metric_costs: {
+    name: "metric_name"
+    cost: 0
+  }
+}
 requirements {
   service_name: "echo"
   api_name: "test_api"
@@ -176,10 +202,16 @@ class HandlerTest : public ::testing::Test {
     // mock_call_ expectations on the correct instance.
     cfg_parser_ = nullptr;
     mock_call_ = new testing::NiceMock<MockServiceControlCall>();
+    ON_CALL(*mock_call_, logsEnabled()).WillByDefault(Return(true));
+    ON_CALL(*mock_call_, checkSignature(_))
+        .WillByDefault(Invoke([](const CheckRequestInfo& info) {
+          return absl::StrCat(info.operation_name, "|", info.api_key, "|",
+                              info.client_ip);
+        }));
 
     ASSERT_TRUE(TextFormat::ParseFromString(filter_config, &proto_config_));
     EXPECT_CALL(mock_call_factory_, create(_))
-        .WillOnce(Return(ByMove(ServiceControlCallPtr(mock_call_))));
+        .WillOnce(Return(ByMove(ServiceControlCallSharedPtr(mock_call_))));
     cfg_parser_ =
         std::make_unique<FilterConfigParser>(proto_config_, mock_call_factory_);
   }
@@ -200,15 +232,10 @@ class HandlerTest : public ::testing::Test {
     ::espv2::api::envoy::v10::http::service_control::PerRouteFilterConfig
         per_route_cfg;
     per_route_cfg.set_operation_name(operation);
-    auto per_route = std::make_shared<PerRouteFilterConfig>(per_route_cfg);
+    // The filter looks the per-route config up and passes it to the handler.
+    per_route_ = std::make_unique<PerRouteFilterConfig>(per_route_cfg);
     EXPECT_CALL(mock_stream_info_, routeEntry())
         .WillRepeatedly(Return(&mock_route_entry_));
-    EXPECT_CALL(mock_route_entry_, perFilterConfig(kFilterName))
-        .WillRepeatedly(
-            Invoke([per_route](const std::string&)
-                       -> const Envoy::Router::RouteSpecificFilterConfig* {
-              return per_route.get();
-            }));
   }
 
   testing::NiceMock<Envoy::Stats::MockIsolatedStatsStore> mock_stats_scope_;
@@ -217,6 +244,7 @@ class HandlerTest : public ::testing::Test {
   testing::NiceMock<MockCheckDoneCallback> mock_check_done_callback_;
   testing::NiceMock<MockStreamInfo> mock_stream_info_;
   testing::NiceMock<MockRouteEntry> mock_route_entry_;
+  std::unique_ptr<PerRouteFilterConfig> per_route_;
   testing::NiceMock<MockServiceControlCallFactory> mock_call_factory_;
   Envoy::Event::SimulatedTimeSystem test_time_;
 
@@ -289,7 +317,9 @@ MATCHER_P(MatchesQuotaInfo, expect, Envoy::EMPTY_STRING) {
   MATCH(api_key);
 
   MATCH2(operation_id, "test-uuid");
-  MATCH2(operation_name, expect.method_name);
+  MATCH2(operation_name, (expect.operation_name.empty()
+                              ? expect.method_name
+                              : std::string(expect.operation_name)));
   MATCH2(producer_project_id, "project-id");
   return true;
 }
@@ -354,8 +384,9 @@ TEST_F(HandlerTest, HandlerNoOperationFound) {
   // Note: The operation is set in mock_stream_info_.filter_state_. This test
   // should not set that value.
   TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
   EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
@@ -381,8 +412,8 @@ TEST_F(HandlerTest, HandlerMissingHeaders) {
   // Note: This test builds off of `HandlerNoOperationFound` to keep mocks
   // simple
   ServiceControlHandlerImpl handler(req_headers_, mock_stream_info_,
-                                    "test-uuid", *cfg_parser_, test_time_,
-                                    stats_);
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
   EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
@@ -407,8 +438,9 @@ TEST_F(HandlerTest, HandlerNoRequirementMatched) {
   // passed through without check and report should be called.
   setPerRouteOperation("bad-operation-name");
   TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
   EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
   handler.callCheck(headers, mock_span_, mock_check_done_callback_);
@@ -424,14 +456,40 @@ TEST_F(HandlerTest, HandlerNoRequirementMatched) {
   handler.callReport(&headers, &resp_headers_, &resp_trailer_, mock_span_);
 }
 
+TEST_F(HandlerTest, HandlerForwardWhileChecking) {
+  // Test: Only the idempotent methods of a requirement with
+  // forward_while_checking are forwarded while checking.
+  setPerRouteOperation("forward_while_checking");
+  TestRequestHeaderMapImpl put_headers{{":method", "PUT"}, {":path", "/echo"}};
+  ServiceControlHandlerImpl put_handler(put_headers, mock_stream_info_,
+                                        "test-uuid", *cfg_parser_, test_time_,
+                                        stats_);
+  EXPECT_TRUE(put_handler.forwardWhileChecking());
+
+  TestRequestHeaderMapImpl post_headers{{":method", "POST"},
+                                        {":path", "/echo"}};
+  ServiceControlHandlerImpl post_handler(post_headers, mock_stream_info_,
+                                         "test-uuid", *cfg_parser_,
+                                         test_time_, stats_);
+  EXPECT_FALSE(post_handler.forwardWhileChecking());
+
+  setPerRouteOperation("get_no_key");
+  TestRequestHeaderMapImpl get_headers{{":method", "GET"}, {":path", "/echo"}};
+  ServiceControlHandlerImpl get_handler(get_headers, mock_stream_info_,
+                                        "test-uuid", *cfg_parser_, test_time_,
+                                        stats_);
+  EXPECT_FALSE(get_handler.forwardWhileChecking());
+}
+
 TEST_F(HandlerTest, HandlerCheckNotNeeded) {
   // Test: If the operation does not require check, check should return OK
   setPerRouteOperation("get_no_key");
   TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
   EXPECT_CALL(*mock_call_, callQuota(_, _)).Times(0);
@@ -449,6 +507,228 @@ TEST_F(HandlerTest, HandlerCheckNotNeeded) {
   handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
 }
 
+TEST_F(HandlerTest, HandlerFactoryReusesReleasedHandler) {
+  // Test: A released handler is reset and serves the next request.
+  setPerRouteOperation("get_no_key");
+  testing::NiceMock<Envoy::ThreadLocal::MockInstance> tls;
+  testing::NiceMock<Envoy::Random::MockRandomGenerator> random;
+  EXPECT_CALL(random, uuid())
+      .WillOnce(Return("uuid-1"))
+      .WillOnce(Return("uuid-2"));
+  ServiceControlHandlerFactoryImpl factory(random, *cfg_parser_, test_time_,
+                                           tls, /*pool_size=*/1);
+
+  TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
+  ServiceControlHandlerPtr handler =
+      factory.createHandler(headers, mock_stream_info_, per_route_.get(),
+                            stats_);
+  const ServiceControlHandler* first = handler.get();
+  handler->onDestroy();
+  factory.releaseHandler(std::move(handler));
+
+  TestRequestHeaderMapImpl other_headers{{":method", "POST"},
+                                         {":path", "/echo/other"}};
+  handler = factory.createHandler(
+      other_headers, mock_stream_info_, per_route_.get(), stats_);
+  EXPECT_EQ(handler.get(), first);
+  checkAndReset(stats_.filter_.handler_pool_hit_, 1);
+
+  EXPECT_CALL(*mock_call_, callReport(_))
+      .WillOnce(Invoke([](const ReportRequestInfo& info) {
+        EXPECT_EQ(info.operation_id, "uuid-2");
+        EXPECT_EQ(info.method, "POST");
+        EXPECT_EQ(info.url, "/echo/other");
+      }));
+  handler->callReport(&other_headers, &resp_headers_, &resp_trailer_,
+                      mock_span_);
+}
+
+TEST_F(HandlerTest, HandlerFactorySequentialOperationIds) {
+  // Test: The operation ids come from the worker's counter, not the random
+  // UUIDs.
+  setPerRouteOperation("get_no_key");
+  testing::NiceMock<Envoy::ThreadLocal::MockInstance> tls;
+  testing::NiceMock<Envoy::Random::MockRandomGenerator> random;
+  EXPECT_CALL(random, uuid()).Times(0);
+  ServiceControlHandlerFactoryImpl factory(random, *cfg_parser_, test_time_,
+                                           tls, /*pool_size=*/0,
+                                           /*sequential_operation_ids=*/true);
+
+  std::vector<std::string> operation_ids;
+  EXPECT_CALL(*mock_call_, callReport(_))
+      .Times(2)
+      .WillRepeatedly(Invoke([&operation_ids](const ReportRequestInfo& info) {
+        operation_ids.emplace_back(info.operation_id);
+      }));
+  TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
+  for (int i = 0; i < 2; ++i) {
+    ServiceControlHandlerPtr handler =
+        factory.createHandler(headers, mock_stream_info_, per_route_.get(),
+                              stats_);
+    handler->callReport(&headers, &resp_headers_, &resp_trailer_, mock_span_);
+  }
+
+  ASSERT_EQ(operation_ids.size(), 2);
+  EXPECT_EQ(operation_ids[0].size(),
+            SequentialOperationIdGenerator::kIdLength);
+  EXPECT_NE(operation_ids[0], operation_ids[1]);
+}
+
+TEST_F(HandlerTest, HandlerFactoryCoarseTimestamps) {
+  // Test: The operations of an event loop iteration share the time read at
+  // its first one.
+  setPerRouteOperation("get_no_key");
+  testing::NiceMock<Envoy::ThreadLocal::MockInstance> tls;
+  testing::NiceMock<Envoy::Random::MockRandomGenerator> random;
+  const Envoy::MonotonicTime loop_time = test_time_.monotonicTime();
+  EXPECT_CALL(tls.dispatcher_, approximateMonotonicTime())
+      .WillRepeatedly(Return(loop_time));
+  ServiceControlHandlerFactoryImpl factory(random, *cfg_parser_, test_time_,
+                                           tls, /*pool_size=*/0,
+                                           /*sequential_operation_ids=*/false,
+                                           /*coarse_timestamps=*/true);
+  const Envoy::SystemTime start_time = test_time_.systemTime();
+  test_time_.advanceTimeWait(std::chrono::milliseconds(5));
+
+  std::vector<Envoy::SystemTime> times;
+  EXPECT_CALL(*mock_call_, callReport(_))
+      .Times(2)
+      .WillRepeatedly(Invoke([&times](const ReportRequestInfo& info) {
+        times.push_back(info.current_time);
+      }));
+  TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
+  ServiceControlHandlerPtr handler =
+      factory.createHandler(headers, mock_stream_info_, per_route_.get(),
+                            stats_);
+  handler->callReport(&headers, &resp_headers_, &resp_trailer_, mock_span_);
+
+  // The next iteration reads the time again.
+  EXPECT_CALL(tls.dispatcher_, approximateMonotonicTime())
+      .WillRepeatedly(Return(test_time_.monotonicTime()));
+  handler = factory.createHandler(
+      headers, mock_stream_info_, per_route_.get(), stats_);
+  handler->callReport(&headers, &resp_headers_, &resp_trailer_, mock_span_);
+
+  ASSERT_EQ(times.size(), 2);
+  EXPECT_EQ(times[0], start_time);
+  EXPECT_EQ(times[1], test_time_.systemTime());
+}
+
+TEST_F(HandlerTest, HandlerReportWithoutLogs) {
+  // Test: The logged headers are not collected if the service has no logs.
+  setPerRouteOperation("get_no_key");
+  TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                   {":path", "/echo"},
+                                   {"x-test-log-request-header", "foo"}};
+  TestResponseHeaderMapImpl response_headers{
+      {"x-test-log-response-header", "bar"}};
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+
+  EXPECT_CALL(*mock_call_, logsEnabled()).WillRepeatedly(Return(false));
+  EXPECT_CALL(*mock_call_, callReport(_))
+      .WillOnce(Invoke([](const ReportRequestInfo& info) {
+        EXPECT_TRUE(info.request_headers.empty());
+        EXPECT_TRUE(info.response_headers.empty());
+        EXPECT_TRUE(info.jwt_payloads.empty());
+      }));
+  handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
+}
+
+TEST_F(HandlerTest, HandlerReportShedsTelemetry) {
+  // Test: Under overload, the report sheds its logged fields and logs.
+  setPerRouteOperation("get_no_key");
+  TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                   {":path", "/echo"},
+                                   {"x-test-log-request-header", "foo"}};
+  TestResponseHeaderMapImpl response_headers{
+      {"x-test-log-response-header", "bar"}};
+  ::espv2::api::envoy::v10::http::service_control::TelemetryShedding config;
+  config.set_drop_log_entries_action("shed_logs");
+  testing::NiceMock<Envoy::Server::MockOverloadManager> overload_manager;
+  const Envoy::Server::OverloadActionState saturated =
+      Envoy::Server::OverloadActionState::saturated();
+  ON_CALL(overload_manager.overload_state_, getState("shed_logs"))
+      .WillByDefault(testing::ReturnRef(saturated));
+  const TelemetryShedding shedding(config, overload_manager);
+
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+  handler.setTelemetryShedding(&shedding);
+  EXPECT_CALL(*mock_call_, callReport(_))
+      .WillOnce(Invoke([](const ReportRequestInfo& info) {
+        EXPECT_TRUE(info.request_headers.empty());
+        EXPECT_TRUE(info.response_headers.empty());
+        EXPECT_TRUE(info.skip_log_entries);
+        EXPECT_FALSE(info.metrics_only);
+      }));
+  handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
+  checkAndReset(stats_.filter_.report_shed_log_entries_, 1);
+}
+
+TEST_F(HandlerTest, HandlerIntermediateReportsForGrpcStream) {
+  // Test: A gRPC stream is reported in parts, with the bytes since the
+  // previous report.
+  setPerRouteOperation("get_no_key");
+  TestRequestHeaderMapImpl headers{{":method", "POST"},
+                                   {":path", "/echo"},
+                                   {"content-type", "application/grpc"}};
+  TestResponseHeaderMapImpl response_headers{
+      {"content-type", "application/grpc"}};
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+  EXPECT_EQ(handler.streamReportInterval(), std::chrono::milliseconds(100));
+
+  std::vector<ReportRequestInfo> reports;
+  EXPECT_CALL(*mock_call_, callReport(_))
+      .Times(3)
+      .WillRepeatedly(Invoke([&reports](const ReportRequestInfo& info) {
+        reports.push_back(info);
+      }));
+
+  EXPECT_CALL(mock_stream_info_, bytesReceived()).WillRepeatedly(Return(100));
+  EXPECT_CALL(mock_stream_info_, bytesSent()).WillRepeatedly(Return(1000));
+  handler.callIntermediateReport(&headers, mock_span_);
+
+  EXPECT_CALL(mock_stream_info_, bytesReceived()).WillRepeatedly(Return(150));
+  EXPECT_CALL(mock_stream_info_, bytesSent()).WillRepeatedly(Return(3000));
+  handler.callIntermediateReport(&headers, mock_span_);
+
+  EXPECT_CALL(mock_stream_info_, bytesReceived()).WillRepeatedly(Return(160));
+  EXPECT_CALL(mock_stream_info_, bytesSent()).WillRepeatedly(Return(3500));
+  handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
+
+  ASSERT_EQ(reports.size(), 3);
+  EXPECT_TRUE(reports[0].is_first_report);
+  EXPECT_FALSE(reports[0].is_final_report);
+  EXPECT_EQ(reports[0].request_size, 100 + headers.byteSize());
+  EXPECT_EQ(reports[0].response_size, 1000);
+  EXPECT_EQ(reports[0].frontend_protocol, Protocol::GRPC);
+
+  EXPECT_FALSE(reports[1].is_first_report);
+  EXPECT_FALSE(reports[1].is_final_report);
+  EXPECT_EQ(reports[1].request_size, 50);
+  EXPECT_EQ(reports[1].response_size, 2000);
+
+  EXPECT_FALSE(reports[2].is_first_report);
+  EXPECT_TRUE(reports[2].is_final_report);
+  EXPECT_EQ(reports[2].request_size, 10);
+  EXPECT_EQ(reports[2].response_size,
+            500 + response_headers.byteSize() + resp_trailer_.byteSize());
+}
+
+TEST_F(HandlerTest, HandlerNoIntermediateReportsForUnaryHttp) {
+  setPerRouteOperation("get_no_key");
+  TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/echo"}};
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+  EXPECT_FALSE(handler.streamReportInterval().has_value());
+}
+
 TEST_F(HandlerTest, RequestHeaderSizeWithModificationInUpstream) {
   setPerRouteOperation("get_no_key");
   TestRequestHeaderMapImpl request_headers{{":method", "GET"},
@@ -459,8 +739,8 @@ TEST_F(HandlerTest, RequestHeaderSizeWithModificationInUpstream) {
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
   ServiceControlHandlerImpl handler(request_headers, mock_stream_info_,
-                                    "test-uuid", *cfg_parser_, test_time_,
-                                    stats_);
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
   handler.callCheck(request_headers, mock_span_, mock_check_done_callback_);
 
@@ -485,8 +765,9 @@ TEST_F(HandlerTest, HandlerCheckMissingApiKey) {
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
 
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   Status bad_status =
       Status(StatusCode::kUnauthenticated,
              "Method doesn't allow unregistered callers (callers without "
@@ -512,6 +793,34 @@ TEST_F(HandlerTest, HandlerCheckMissingApiKey) {
   checkAndReset(stats_.filter_.denied_consumer_error_, 1);
 }
 
+TEST_F(HandlerTest, HandlerCheckMalformedApiKey) {
+  // Test: If the api key is not in the configured format, check fails
+  // without a Check call.
+  setUp(absl::StrCat(kFilterConfig, R"(
+api_key_format {
+  min_length: 6
+  allowed_characters: "abcdefghijklmnopqrstuvwxyz"
+})")
+            .c_str());
+  setPerRouteOperation("get_header_key");
+  TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foo'bar"}};
+
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+  EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
+  EXPECT_CALL(mock_check_done_callback_,
+              onCheckDone(Status(StatusCode::kInvalidArgument,
+                                 "API key not valid. Please pass a valid API "
+                                 "key."),
+                          "service_control_bad_request{MALFORMED_API_KEY}"));
+  handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+
+  checkAndReset(stats_.filter_.denied_consumer_error_, 1);
+  checkAndReset(stats_.filter_.denied_malformed_api_key_, 1);
+}
+
 TEST_F(HandlerTest, HandlerSuccessfulCheckSyncWithApiKeyRestrictionFields) {
   // Test: Check is required and succeeds, and api key restriction fields are
   // present on the check request
@@ -525,8 +834,9 @@ TEST_F(HandlerTest, HandlerSuccessfulCheckSyncWithApiKeyRestrictionFields) {
                                    {"x-android-cert", "cert-123"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   CheckResponseInfo response_info;
 
   CheckRequestInfo expected_check_info;
@@ -556,6 +866,41 @@ TEST_F(HandlerTest, HandlerSuccessfulCheckSyncWithApiKeyRestrictionFields) {
   handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
 }
 
+TEST_F(HandlerTest, HandlerCheckDeadlineFromRequestTimeouts) {
+  // Test: The Check call gets the deadline of the request, from the smaller
+  // of its grpc-timeout and its route timeout.
+  setPerRouteOperation("get_header_key");
+  const Envoy::MonotonicTime start_time = test_time_.monotonicTime();
+  ON_CALL(mock_stream_info_, startTimeMonotonic())
+      .WillByDefault(Return(start_time));
+  TestRequestHeaderMapImpl headers{{":method", "POST"},
+                                   {":path", "/echo"},
+                                   {"content-type", "application/grpc"},
+                                   {"grpc-timeout", "100m"},
+                                   {"x-api-key", "foobar"}};
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+
+  absl::optional<Envoy::MonotonicTime> deadline;
+  ON_CALL(*mock_call_, callCheck(_, _, _))
+      .WillByDefault(Invoke([&deadline](const CheckRequestInfo& info,
+                                        Envoy::Tracing::Span&, CheckDoneFunc) {
+        deadline = info.deadline;
+        return nullptr;
+      }));
+
+  ON_CALL(mock_route_entry_, timeout())
+      .WillByDefault(Return(std::chrono::milliseconds(0)));
+  handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+  EXPECT_EQ(deadline, start_time + std::chrono::milliseconds(100));
+
+  ON_CALL(mock_route_entry_, timeout())
+      .WillByDefault(Return(std::chrono::milliseconds(50)));
+  handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+  EXPECT_EQ(deadline, start_time + std::chrono::milliseconds(50));
+}
+
 TEST_F(HandlerTest, HandlerSuccessfulCheckSyncWithoutApiKeyRestrictionFields) {
   // Test: Check is required and succeeds. The api key restriction fields are
   // left blank if not provided.
@@ -564,8 +909,9 @@ TEST_F(HandlerTest, HandlerSuccessfulCheckSyncWithoutApiKeyRestrictionFields) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   CheckResponseInfo response_info;
 
   CheckRequestInfo expected_check_info;
@@ -591,6 +937,88 @@ TEST_F(HandlerTest, HandlerSuccessfulCheckSyncWithoutApiKeyRestrictionFields) {
   handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
 }
 
+TEST_F(HandlerTest, HandlerCheckAndReportAllocationsBounded) {
+  // Test: A request whose check is answered at once, i.e. a cache hit, makes a
+  // bounded number of heap allocations for its check and report. The bound has
+  // headroom, it catches copies added to the request path rather than pinning
+  // its allocations.
+  if (!AllocationCounter::enabled()) {
+    GTEST_SKIP() << "allocations are not counted with tcmalloc";
+  }
+  constexpr int kRequests = 10;
+  constexpr uint64_t kMaxAllocationsPerRequest = 150;
+
+  setPerRouteOperation("get_header_key");
+  TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
+  TestResponseHeaderMapImpl response_headers{
+      {"content-type", "application/grpc"}};
+  CheckResponseInfo response_info;
+  EXPECT_CALL(*mock_call_, callCheck(_, _, _))
+      .WillRepeatedly(Invoke([&response_info](const CheckRequestInfo&,
+                                              Envoy::Tracing::Span&,
+                                              CheckDoneFunc on_done) {
+        on_done(OkStatus(), response_info);
+        return nullptr;
+      }));
+  EXPECT_CALL(*mock_call_, callReport(_)).Times(kRequests + 1);
+  EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""))
+      .Times(kRequests + 1);
+
+  auto run_request = [&]() {
+    ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                      per_route_.get(), "test-uuid",
+                                      *cfg_parser_, test_time_, stats_);
+    handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+    handler.callReport(&headers, &response_headers, &resp_trailer_,
+                       mock_span_);
+  };
+  // A first request, so that lazily created state is not counted.
+  run_request();
+
+  AllocationCounter counter;
+  for (int i = 0; i < kRequests; ++i) {
+    run_request();
+  }
+  const uint64_t allocations = counter.allocations();
+  EXPECT_LE(allocations, kRequests * kMaxAllocationsPerRequest)
+      << allocations / kRequests << " allocations per request";
+}
+
+TEST_F(HandlerTest, HandlerReusedReportInfoAllocations) {
+  // Test: The report of a reset handler reuses the strings of the previous
+  // report, so it allocates less than the first report of a new handler.
+  if (!AllocationCounter::enabled()) {
+    GTEST_SKIP() << "allocations are not counted with tcmalloc";
+  }
+  setPerRouteOperation("get_header_key");
+  TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
+  TestResponseHeaderMapImpl response_headers{
+      {"content-type", "application/grpc"}};
+  EXPECT_CALL(*mock_call_, callReport(_)).Times(3);
+
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+  // A first report, so that lazily created state is not counted.
+  handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
+
+  ServiceControlHandlerImpl new_handler(headers, mock_stream_info_,
+                                        "test-uuid", *cfg_parser_, test_time_,
+                                        stats_);
+  AllocationCounter counter;
+  new_handler.callReport(&headers, &response_headers, &resp_trailer_,
+                         mock_span_);
+  const uint64_t new_allocations = counter.allocations();
+
+  handler.reset(headers, mock_stream_info_, per_route_.get(), "test-uuid",
+                stats_);
+  counter.reset();
+  handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
+  EXPECT_LT(counter.allocations(), new_allocations);
+}
+
 TEST_F(HandlerTest, HandlerSuccessfulQuotaSync) {
   // Test: Quota is required and succeeds.
   setPerRouteOperation("get_header_key_quota");
@@ -598,8 +1026,9 @@ TEST_F(HandlerTest, HandlerSuccessfulQuotaSync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   CheckResponseInfo response_info;
 
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
@@ -636,8 +1065,9 @@ TEST_F(HandlerTest, HandlerCallQuotaWithoutCheck) {
                                    {":path", "/echo?key=foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   // Check is not called.
   EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
 
@@ -662,6 +1092,69 @@ TEST_F(HandlerTest, HandlerCallQuotaWithoutCheck) {
   handler.callReport(&headers, &response_headers, &resp_trailer_, mock_span_);
 }
 
+TEST_F(HandlerTest, HandlerQuotaOfZeroCostsChargedAsOne) {
+  // Test: A zero metric cost is still allocated, as one, with the quota of
+  // the requirement of the same metric
+  setPerRouteOperation("zero_cost_quota");
+  TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                   {":path", "/echo?key=foobar"}};
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
+  EXPECT_CALL(*mock_call_, callCheck(_, _, _)).Times(0);
+
+  const std::vector<std::pair<std::string, int>> expected_costs = {
+      {"metric_name", 1}};
+  QuotaRequestInfo expected_quota_info{expected_costs};
+  expected_quota_info.method_name = "call_quota_without_check";
+  expected_quota_info.operation_name = "zero_cost_quota";
+  expected_quota_info.api_key = "foobar";
+  QuotaResponseInfo quota_response_info;
+  EXPECT_CALL(*mock_call_, callQuota(MatchesQuotaInfo(expected_quota_info), _))
+      .WillOnce(Invoke([&quota_response_info](const QuotaRequestInfo&,
+                                              QuotaDoneFunc on_done) {
+        on_done(OkStatus(), quota_response_info);
+      }));
+
+  EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
+  handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+}
+
+TEST_F(HandlerTest, HandlerSharedQuotaMethodKeepsOperationNames) {
+  // Test: The requirements of the same metrics send the same AllocateQuota
+  // method name, but their quota and report requests keep their own
+  // operation names, so Service Control attributes them per operation.
+  const std::vector<std::string> operations = {"call_quota_without_check",
+                                               "zero_cost_quota"};
+  for (const std::string& operation : operations) {
+    setPerRouteOperation(operation);
+    TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                     {":path", "/echo?key=foobar"}};
+    ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                      per_route_.get(), "test-uuid",
+                                      *cfg_parser_, test_time_, stats_);
+
+    QuotaResponseInfo quota_response_info;
+    EXPECT_CALL(*mock_call_, callQuota(_, _))
+        .WillOnce(Invoke([&operation, &quota_response_info](
+                             const QuotaRequestInfo& info,
+                             QuotaDoneFunc on_done) {
+          EXPECT_EQ(info.method_name, "call_quota_without_check");
+          EXPECT_EQ(info.operation_name, operation);
+          on_done(OkStatus(), quota_response_info);
+        }));
+    EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
+    handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+
+    EXPECT_CALL(*mock_call_, callReport(_))
+        .WillOnce(Invoke([&operation](const ReportRequestInfo& info) {
+          EXPECT_EQ(info.operation_name, operation);
+          EXPECT_EQ(info.api_method, operation);
+        }));
+    handler.callReport(&headers, &resp_headers_, &resp_trailer_, mock_span_);
+  }
+}
+
 TEST_F(HandlerTest, HandlerFailCheckSync) {
   // Test: Check is required and a request is made, but service control
   // returns a bad status.
@@ -670,8 +1163,9 @@ TEST_F(HandlerTest, HandlerFailCheckSync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   Status bad_status = Status(StatusCode::kPermissionDenied,
                              "test bad status returned from service control");
@@ -715,8 +1209,9 @@ TEST_F(HandlerTest, FillFilterState) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   handler.fillFilterState(*mock_stream_info_.filter_state_);
 
@@ -728,6 +1223,89 @@ TEST_F(HandlerTest, FillFilterState) {
             "get_header_key");
 }
 
+TEST_F(HandlerTest, HandlerConnectionCheckMemo) {
+  // Test: the allowed check result of a stream is reused by the next stream
+  // of the connection with the same api key, until it expires.
+  setUp(absl::StrCat(kFilterConfig, "connection_check_memo_ms: 1000").c_str());
+  setPerRouteOperation("get_header_key");
+  TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
+  CheckResponseInfo response_info;
+  response_info.consumer_number = "12345";
+
+  auto check = [&](absl::string_view api_key) {
+    headers.setCopy(Envoy::Http::LowerCaseString("x-api-key"), api_key);
+    ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                      per_route_.get(), "test-uuid",
+                                      *cfg_parser_, test_time_, stats_);
+    handler.fillFilterState(*mock_stream_info_.filter_state_);
+    EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
+    handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+  };
+
+  EXPECT_CALL(*mock_call_, callCheck(_, _, _))
+      .WillOnce(Invoke([&response_info](const CheckRequestInfo&,
+                                        Envoy::Tracing::Span&,
+                                        CheckDoneFunc on_done) {
+        on_done(OkStatus(), response_info);
+        return nullptr;
+      }));
+  check("foobar");
+  headers.remove(Envoy::Http::LowerCaseString("api-consumer-number"));
+  check("foobar");
+  EXPECT_EQ(stats_.filter_.check_connection_memo_hit_.value(), 1);
+  EXPECT_EQ(headers.get_("api-consumer-number"), "12345");
+
+  // Another api key, and the expired result, are checked again.
+  EXPECT_CALL(*mock_call_, callCheck(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&response_info](const CheckRequestInfo&,
+                                              Envoy::Tracing::Span&,
+                                              CheckDoneFunc on_done) {
+        on_done(OkStatus(), response_info);
+        return nullptr;
+      }));
+  check("other");
+  test_time_.advanceTimeWait(std::chrono::milliseconds(1000));
+  check("foobar");
+  EXPECT_EQ(stats_.filter_.check_connection_memo_hit_.value(), 1);
+}
+
+TEST_F(HandlerTest, HandlerConnectionCheckMemoClientIp) {
+  // Test: the streams of a connection with different client ips are checked
+  // each, as the caller ip is a label of the check request.
+  setUp(absl::StrCat(kFilterConfig, "connection_check_memo_ms: 1000").c_str());
+  setPerRouteOperation("get_header_key");
+  TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
+  CheckResponseInfo response_info;
+
+  auto check = [&](const std::string& client_ip) {
+    mock_stream_info_.downstream_address_provider_->setRemoteAddress(
+        std::make_shared<Envoy::Network::Address::Ipv4Instance>(client_ip));
+    ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                      per_route_.get(), "test-uuid",
+                                      *cfg_parser_, test_time_, stats_);
+    EXPECT_CALL(mock_check_done_callback_, onCheckDone(OkStatus(), ""));
+    handler.callCheck(headers, mock_span_, mock_check_done_callback_);
+  };
+
+  std::vector<std::string> client_ips;
+  EXPECT_CALL(*mock_call_, callCheck(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&](const CheckRequestInfo& info,
+                                 Envoy::Tracing::Span&,
+                                 CheckDoneFunc on_done) {
+        client_ips.push_back(info.client_ip);
+        on_done(OkStatus(), response_info);
+        return nullptr;
+      }));
+  check("10.0.0.1");
+  check("10.0.0.2");
+  EXPECT_EQ(stats_.filter_.check_connection_memo_hit_.value(), 0);
+  EXPECT_THAT(client_ips, testing::ElementsAre("10.0.0.1", "10.0.0.2"));
+}
+
 TEST_F(HandlerTest, HandlerFailQuotaSync) {
   // Test: Check is required and a request is made, but service control
   // returns a bad status.
@@ -736,8 +1314,9 @@ TEST_F(HandlerTest, HandlerFailQuotaSync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   CheckResponseInfo response_info;
 
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
@@ -776,8 +1355,9 @@ TEST_F(HandlerTest, HandlerSuccessfulCheckAsync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   CheckResponseInfo response_info;
 
@@ -818,8 +1398,9 @@ TEST_F(HandlerTest, HandlerSuccessfulQuotaAsync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   CheckResponseInfo response_info;
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
@@ -868,8 +1449,9 @@ TEST_F(HandlerTest, HandlerFailCheckAsync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   CheckResponseInfo response_info;
   response_info.error = {"API_KEY_INVALID", false,
@@ -919,8 +1501,9 @@ TEST_F(HandlerTest, HandlerFailQuotaAsync) {
       {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
   TestResponseHeaderMapImpl response_headers{
       {"content-type", "application/grpc"}};
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   CheckResponseInfo response_info;
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
@@ -977,8 +1560,9 @@ TEST_F(HandlerTest, HandlerCancelFuncResetOnDone) {
   MockFunction<void()> mock_cancel;
   CancelFunc cancel_fn = mock_cancel.AsStdFunction();
 
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
       .WillOnce(Invoke([&stored_on_done, cancel_fn](const CheckRequestInfo&,
                                                     Envoy::Tracing::Span&,
@@ -1003,8 +1587,9 @@ TEST_F(HandlerTest, HandlerCancelFuncCalledOnDestroy) {
   MockFunction<void()> mock_cancel;
   CancelFunc cancel_fn = mock_cancel.AsStdFunction();
 
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
       .WillOnce(
           Invoke([cancel_fn](const CheckRequestInfo&, Envoy::Tracing::Span&,
@@ -1024,8 +1609,9 @@ TEST_F(HandlerTest, HandlerCancelFuncNotCalledOnDestroyForSyncOnDone) {
   MockFunction<void()> mock_cancel;
   CancelFunc cancel_fn = mock_cancel.AsStdFunction();
 
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
   EXPECT_CALL(*mock_call_, callCheck(_, _, _))
       .WillOnce(
           Invoke([cancel_fn](const CheckRequestInfo&, Envoy::Tracing::Span&,
@@ -1053,8 +1639,9 @@ TEST_F(HandlerTest, HandlerReportWithoutCheck) {
       {"content-type", "application/grpc"}};
   CheckDoneFunc stored_on_done;
   CheckResponseInfo response_info;
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   ReportRequestInfo expected_report_info;
   initExpectedReportInfo(expected_report_info);
@@ -1077,8 +1664,9 @@ TEST_F(HandlerTest, HandlerReportWithTrace) {
       {"content-type", "application/grpc"}};
   CheckDoneFunc stored_on_done;
   CheckResponseInfo response_info;
-  ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
-                                    *cfg_parser_, test_time_, stats_);
+  ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                    per_route_.get(), "test-uuid", *cfg_parser_,
+                                    test_time_, stats_);
 
   ReportRequestInfo expected_report_info;
   initExpectedReportInfo(expected_report_info);
@@ -1105,7 +1693,8 @@ class HandlerReportStatusTest : public HandlerTest {
         {":method", "GET"}, {":path", "/echo"}, {"x-api-key", "foobar"}};
     CheckDoneFunc stored_on_done;
     CheckResponseInfo response_info;
-    ServiceControlHandlerImpl handler(headers, mock_stream_info_, "test-uuid",
+    ServiceControlHandlerImpl handler(headers, mock_stream_info_,
+                                      per_route_.get(), "test-uuid",
                                       *cfg_parser_, test_time_, stats_);
 
     ReportRequestInfo expected_report_info;
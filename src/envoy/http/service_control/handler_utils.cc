@@ -14,11 +14,11 @@
 
 #include "src/envoy/http/service_control/handler_utils.h"
 
+#include <map>
 #include <sstream>
 #include <vector>
 
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_split.h"
 #include "absl/types/optional.h"
 #include "api/envoy/v10/http/service_control/config.pb.h"
 #include "envoy/grpc/status.h"
@@ -32,7 +32,6 @@
 #include "src/api_proxy/service_control/request_builder.h"
 
 using ::espv2::api::envoy::v10::http::service_control::ApiKeyLocation;
-using ::espv2::api::envoy::v10::http::service_control::Service;
 using ::espv2::api_proxy::service_control::LatencyInfo;
 using ::espv2::api_proxy::service_control::protocol::Protocol;
 using ::google::protobuf::util::StatusCode;
@@ -44,59 +43,17 @@ namespace service_control {
 
 namespace {
 
-// Delimeter used in jwt payload key path
-constexpr char kJwtPayLoadsDelimeter = '.';
-
 constexpr char kContentTypeApplicationGrpcPrefix[] = "application/grpc";
 const Envoy::Http::LowerCaseString kContentTypeHeader{"content-type"};
 
+Envoy::Http::RegisterCustomInlineHeader<
+    Envoy::Http::CustomInlineHeaderRegistry::Type::RequestHeaders>
+    default_api_key_handle{Envoy::Http::LowerCaseString(kDefaultApiKeyHeader)};
+
 inline int64_t convertNsToMs(std::chrono::nanoseconds ns) {
   return std::chrono::duration_cast<std::chrono::milliseconds>(ns).count();
 }
 
-bool extractAPIKeyFromQuery(const Envoy::Http::RequestHeaderMap& headers,
-                            const std::string& query, bool& were_params_parsed,
-                            Envoy::Http::Utility::QueryParams& parsed_params,
-                            std::string& api_key) {
-  if (!were_params_parsed) {
-    if (headers.Path() == nullptr) {
-      return false;
-    }
-    parsed_params = Envoy::Http::Utility::parseQueryString(
-        headers.Path()->value().getStringView());
-    were_params_parsed = true;
-  }
-
-  const auto& it = parsed_params.find(query);
-  if (it != parsed_params.end()) {
-    api_key = it->second;
-    return true;
-  }
-  return false;
-}
-
-bool extractAPIKeyFromHeader(const Envoy::Http::RequestHeaderMap& headers,
-                             const std::string& header, std::string& api_key) {
-  // TODO(qiwzhang): optimize this by using LowerCaseString at init.
-  auto entry = headers.get(Envoy::Http::LowerCaseString(header));
-  if (!entry.empty()) {
-    api_key = std::string(entry[0]->value().getStringView());
-    return true;
-  }
-  return false;
-}
-
-bool extractAPIKeyFromCookie(const Envoy::Http::RequestHeaderMap& headers,
-                             const std::string& cookie, std::string& api_key) {
-  std::string parsed_api_key =
-      Envoy::Http::Utility::parseCookieValue(headers, cookie);
-  if (!parsed_api_key.empty()) {
-    api_key = parsed_api_key;
-    return true;
-  }
-  return false;
-}
-
 void extractJwtPayload(const Envoy::ProtobufWkt::Value& value,
                        const std::string& jwt_payload_path,
                        std::string& info_jwt_payloads) {
@@ -154,18 +111,17 @@ void fillGCPInfo(
   }
 }
 
-void fillLoggedHeader(
-    const Envoy::Http::HeaderMap* headers,
-    const ::google::protobuf::RepeatedPtrField<::std::string>& log_headers,
-    std::string& info_header_field) {
+void fillLoggedHeader(const Envoy::Http::HeaderMap* headers,
+                      const LoggedHeaders& log_headers,
+                      std::string& info_header_field) {
   if (headers == nullptr) {
     return;
   }
-  for (const auto& log_header : log_headers) {
+  for (const LoggedHeader& log_header : log_headers) {
     const auto entry = Envoy::Http::HeaderUtility::getAllOfHeaderAsString(
-        *headers, Envoy::Http::LowerCaseString(log_header));
+        *headers, log_header.key);
     if (entry.result().has_value()) {
-      absl::StrAppend(&info_header_field, log_header, "=",
+      absl::StrAppend(&info_header_field, log_header.name, "=",
                       entry.result().value(), ";");
     }
   }
@@ -240,47 +196,25 @@ Protocol getFrontendProtocol(
   return Protocol::HTTP;
 }
 
-Protocol getBackendProtocol(const Service& service) {
-  std::string protocol = service.backend_protocol();
-
-  if (protocol == "http1" || protocol == "http2") {
-    return Protocol::HTTP;
-  }
-
-  if (protocol == "grpc") {
-    return Protocol::GRPC;
-  }
-
-  return Protocol::UNKNOWN;
-}
-
 // TODO(taoxuy): Add Unit Test
 void fillJwtPayloads(const ::envoy::config::core::v3::Metadata& metadata,
-                     const std::string& jwt_payload_metadata_name,
-                     const ::google::protobuf::RepeatedPtrField<::std::string>&
-                         jwt_payload_paths,
+                     const LoggedJwtPayloads& jwt_payloads,
                      std::string& info_jwt_payloads) {
-  for (const std::string& jwt_payload_path : jwt_payload_paths) {
-    std::vector<std::string> steps =
-        absl::StrSplit(jwt_payload_path, kJwtPayLoadsDelimeter);
-    steps.insert(steps.begin(), jwt_payload_metadata_name);
+  for (const LoggedJwtPayload& jwt_payload : jwt_payloads) {
     const Envoy::ProtobufWkt::Value& value =
         Envoy::Config::Metadata::metadataValue(
             &metadata,
             Envoy::Extensions::HttpFilters::HttpFilterNames::get().JwtAuthn,
-            steps);
+            jwt_payload.steps);
     if (&value != &Envoy::ProtobufWkt::Value::default_instance()) {
-      extractJwtPayload(value, jwt_payload_path, info_jwt_payloads);
+      extractJwtPayload(value, jwt_payload.path, info_jwt_payloads);
     }
   }
 }
 
 void fillJwtPayload(const ::envoy::config::core::v3::Metadata& metadata,
-                    const std::string& jwt_payload_metadata_name,
-                    const std::string& jwt_payload_path,
+                    const std::vector<std::string>& steps,
                     std::string& info_iss_or_aud) {
-  std::vector<std::string> steps = {jwt_payload_metadata_name,
-                                    jwt_payload_path};
   const Envoy::ProtobufWkt::Value& value =
       Envoy::Config::Metadata::metadataValue(
           &metadata,
@@ -291,32 +225,65 @@ void fillJwtPayload(const ::envoy::config::core::v3::Metadata& metadata,
   }
 }
 
-bool extractAPIKey(
-    const Envoy::Http::RequestHeaderMap& headers,
-    const ::google::protobuf::RepeatedPtrField<
-        ::espv2::api::envoy::v10::http::service_control::ApiKeyLocation>&
-        locations,
-    std::string& api_key) {
-  // If checking multiple headers, cache the parameters so they are only parsed
-  // once
-  bool were_params_parsed{false};
-  Envoy::Http::Utility::QueryParams parsed_params;
-
-  for (const auto& location : locations) {
-    switch (location.key_case()) {
-      case ApiKeyLocation::kQuery:
-        if (extractAPIKeyFromQuery(headers, location.query(),
-                                   were_params_parsed, parsed_params, api_key))
+bool extractAPIKey(const Envoy::Http::RequestHeaderMap& headers,
+                   const ApiKeyLocations& locations, std::string& api_key,
+                   const utils::EspRequestContext* request_context) {
+  // The query string and the cookies are only parsed for the first location
+  // that needs them.
+  absl::optional<Envoy::Http::Utility::QueryParams> parsed_params;
+  const Envoy::Http::Utility::QueryParams* params = nullptr;
+  absl::optional<std::map<std::string, std::string>> cookies;
+
+  for (const auto& location : locations.locations) {
+    switch (location.type) {
+      case ApiKeyLocation::kQuery: {
+        if (params == nullptr && request_context != nullptr) {
+          params = &request_context->queryParams();
+        } else if (params == nullptr) {
+          parsed_params = headers.Path() == nullptr
+                              ? Envoy::Http::Utility::QueryParams()
+                              : Envoy::Http::Utility::parseQueryString(
+                                    headers.Path()->value().getStringView());
+          params = &*parsed_params;
+        }
+        const auto it = params->find(location.name);
+        if (it != params->end()) {
+          api_key = it->second;
           return true;
+        }
         break;
-      case ApiKeyLocation::kHeader:
-        if (extractAPIKeyFromHeader(headers, location.header(), api_key))
+      }
+      case ApiKeyLocation::kHeader: {
+        if (location.inline_header) {
+          const Envoy::Http::HeaderEntry* entry =
+              headers.getInline(default_api_key_handle.handle());
+          if (entry != nullptr) {
+            api_key.assign(entry->value().getStringView());
+            return true;
+          }
+          break;
+        }
+        const auto entry = headers.get(location.header);
+        if (!entry.empty()) {
+          api_key = std::string(entry[0]->value().getStringView());
           return true;
+        }
         break;
-      case ApiKeyLocation::kCookie:
-        if (extractAPIKeyFromCookie(headers, location.cookie(), api_key))
+      }
+      case ApiKeyLocation::kCookie: {
+        if (!cookies.has_value()) {
+          cookies = Envoy::Http::Utility::parseCookies(
+              headers, [&locations](absl::string_view name) {
+                return locations.cookie_names.contains(name);
+              });
+        }
+        const auto it = cookies->find(location.name);
+        if (it != cookies->end() && !it->second.empty()) {
+          api_key = it->second;
           return true;
+        }
         break;
+      }
       case ApiKeyLocation::KEY_NOT_SET:
         break;
     }
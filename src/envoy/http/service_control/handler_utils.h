@@ -18,6 +18,7 @@
 #include "source/common/config/metadata.h"
 #include "source/common/http/utility.h"
 #include "src/api_proxy/service_control/request_builder.h"
+#include "src/envoy/http/service_control/config_parser.h"
 #include "src/envoy/http/service_control/filter_stats.h"
 #include "src/envoy/utils/filter_state_utils.h"
 #include "src/envoy/utils/http_header_utils.h"
@@ -30,15 +31,15 @@ namespace service_control {
 // Searches the headers at the given locations and sets the `api_key` if one is
 // found.
 //
-// Returns whether an `api_key` was found.
+// Returns whether an `api_key` was found. The query parameters are read from
+// `request_context` if given, else parsed from the headers.
 bool extractAPIKey(
     const Envoy::Http::RequestHeaderMap& headers,
-    const ::google::protobuf::RepeatedPtrField<
-        ::espv2::api::envoy::v10::http::service_control::ApiKeyLocation>&
-        locations,
-    std::string& api_key);
+    const ApiKeyLocations& locations, std::string& api_key,
+    const utils::EspRequestContext* request_context = nullptr);
 
 // Adds information from the `FilterConfig`'s gcp_attributes to the given info.
+// The info views the strings of the config, they are not copied.
 void fillGCPInfo(
     const ::espv2::api::envoy::v10::http::service_control::FilterConfig&
         filter_config,
@@ -46,10 +47,9 @@ void fillGCPInfo(
 
 // Searches the `headers` for the given `log_headers` and appends all matches
 // to the string provided.
-void fillLoggedHeader(
-    const Envoy::Http::HeaderMap* headers,
-    const ::google::protobuf::RepeatedPtrField<::std::string>& log_headers,
-    std::string& info_header_field);
+void fillLoggedHeader(const Envoy::Http::HeaderMap* headers,
+                      const LoggedHeaders& log_headers,
+                      std::string& info_header_field);
 
 // Fills the `request_time_ms`, `backend_time_ms`, and `overhead_time_ms` of the
 // info provided.
@@ -59,14 +59,12 @@ void fillLatency(const Envoy::StreamInfo::StreamInfo& stream_info,
 
 // Fills the jwt payload of the info provided
 void fillJwtPayloads(const ::envoy::config::core::v3::Metadata& metadata,
-                     const std::string& jwt_payload_metadata_name,
-                     const ::google::protobuf::RepeatedPtrField<::std::string>&
-                         jwt_payload_paths,
+                     const LoggedJwtPayloads& jwt_payloads,
                      std::string& info_jwt_payloads);
 
+// Fills the jwt issuer or audience of the info provided
 void fillJwtPayload(const ::envoy::config::core::v3::Metadata& metadata,
-                    const std::string& jwt_payload_metadata_name,
-                    const std::string& jwt_payload_path,
+                    const std::vector<std::string>& steps,
                     std::string& info_iss_or_aud);
 
 // Returns the protocol of the frontend request or UNKNOWN if not found
@@ -74,10 +72,6 @@ void fillJwtPayload(const ::envoy::config::core::v3::Metadata& metadata,
     const Envoy::Http::ResponseHeaderMap* response_headers,
     const Envoy::StreamInfo::StreamInfo& stream_info);
 
-// Returns the protocol of the backend service or UNKNOWN if not found
-::espv2::api_proxy::service_control::protocol::Protocol getBackendProtocol(
-    const ::espv2::api::envoy::v10::http::service_control::Service& service);
-
 // Fill in the HTTP and gRPC status into the report info.
 void fillStatus(const Envoy::Http::ResponseHeaderMap* response_headers,
                 const Envoy::Http::ResponseTrailerMap* response_trailers,
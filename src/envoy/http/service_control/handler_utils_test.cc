@@ -21,6 +21,7 @@
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 #include "source/common/common/empty_string.h"
+#include "source/common/stream_info/filter_state_impl.h"
 #include "src/api_proxy/service_control/request_builder.h"
 #include "test/mocks/server/mocks.h"
 #include "test/test_common/utility.h"
@@ -84,11 +85,17 @@ TEST(ServiceControlUtils, FillGCPInfo) {
   }
 }
 
+LoggedHeaders toLoggedHeaders(
+    const ::google::protobuf::RepeatedPtrField<std::string>& log_headers) {
+  return LoggedHeaders(log_headers.begin(), log_headers.end());
+}
+
 TEST(ServiceControlUtils, FillLoggedHeader) {
   // First test case: the function can accept null headers
   Service service;
   std::string output;
-  fillLoggedHeader(nullptr, service.log_request_headers(), output);
+  fillLoggedHeader(nullptr, toLoggedHeaders(service.log_request_headers()),
+                   output);
   EXPECT_TRUE(output.empty());
 
   struct TestCase {
@@ -147,7 +154,8 @@ TEST(ServiceControlUtils, FillLoggedHeader) {
 
     std::string output_tc;
 
-    fillLoggedHeader(&test.headers, service_tc.log_request_headers(),
+    fillLoggedHeader(&test.headers,
+                     toLoggedHeaders(service_tc.log_request_headers()),
                      output_tc);
     EXPECT_EQ(test.expected_output, output_tc);
   }
@@ -159,7 +167,8 @@ TEST(ServiceControlUtils, FillLoggedHeader) {
 
   Envoy::Http::TestRequestHeaderMapImpl headers{{"log-this", "foo"},
                                                 {"log-this", "bar"}};
-  fillLoggedHeader(&headers, service.log_request_headers(), output);
+  fillLoggedHeader(&headers, toLoggedHeaders(service.log_request_headers()),
+                   output);
   EXPECT_TRUE(output == "log-this=bar,foo;" || output == "log-this=foo,bar;");
 }
 
@@ -211,6 +220,13 @@ TEST(ServiceControlUtils, ExtractApiKey) {
           "foobar",
       },
 
+      // Test: find apikey in the default header location, read inline
+      {
+          R"(locations: { header: "X-API-Key" } )",
+          {{"x-api-key", "foobar"}},
+          "foobar",
+      },
+
       // Test: find apikey in one of multiple header locations
       {
           R"(
@@ -259,6 +275,15 @@ TEST(ServiceControlUtils, ExtractApiKey) {
           {{"apikey", "foobar"}, {":path", "/echo"}},
           Envoy::EMPTY_STRING},
 
+      // Test: the cookies are parsed once for all the cookie locations
+      {
+          R"(
+            locations: { cookie: "key" }
+            locations: { query: "key" }
+            locations: { cookie: "apikey" } )",
+          {{"cookie", "other=1; apikey=foobar"}, {":path", "/echo?k=v"}},
+          "foobar"},
+
       // Test: apikey is in query but query location is not expected
       {
           R"(
@@ -276,12 +301,32 @@ TEST(ServiceControlUtils, ExtractApiKey) {
     std::string api_key;
 
     EXPECT_EQ(!test.expected_api_key.empty(),
-              extractAPIKey(test.headers, requirement.locations(), api_key));
+              extractAPIKey(test.headers,
+                            ApiKeyLocations(requirement.locations()),
+                            api_key));
 
     EXPECT_EQ(test.expected_api_key, api_key);
   }
 }
 
+TEST(ServiceControlUtils, ExtractAPIKeyFromRequestContext) {
+  ApiKeyRequirement requirement;
+  ASSERT_TRUE(TextFormat::ParseFromString(R"(locations: { query: "key" })",
+                                          &requirement));
+  Envoy::StreamInfo::FilterStateImpl filter_state(
+      Envoy::StreamInfo::FilterState::LifeSpan::FilterChain);
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":path", "/echo?key=foo"}};
+  const utils::EspRequestContext& request_context =
+      utils::EspRequestContext::getOrCreate(filter_state, headers);
+
+  // The query parameters parsed by the context are read.
+  headers.setPath("/echo?key=bar");
+  std::string api_key;
+  EXPECT_TRUE(extractAPIKey(headers, ApiKeyLocations(requirement.locations()),
+                            api_key, &request_context));
+  EXPECT_EQ(api_key, "foo");
+}
+
 TEST(ServiceControlUtils, FillLatency) {
   struct TestCase {
     std::chrono::nanoseconds end_time;
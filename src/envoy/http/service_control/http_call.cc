@@ -14,20 +14,25 @@
 
 #include "src/envoy/http/service_control/http_call.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "envoy/event/deferred_deletable.h"
-#include "source/common/common/empty_string.h"
+#include "envoy/event/timer.h"
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/common/backoff_strategy.h"
 #include "source/common/common/enum_to_int.h"
 #include "source/common/grpc/status.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/message_impl.h"
 #include "source/common/http/utility.h"
 #include "source/common/tracing/http_tracer_impl.h"
+#include "source/extensions/compression/gzip/compressor/zlib_compressor_impl.h"
 
 using Envoy::Http::CustomHeaders;
 using Envoy::Http::CustomInlineHeaderRegistry;
 using Envoy::Http::RegisterCustomInlineHeader;
+using ::Envoy::Extensions::Compression::Gzip::Compressor::ZlibCompressorImpl;
 using ::espv2::api::envoy::v10::http::common::HttpUri;
 using ::google::protobuf::util::OkStatus;
 using ::google::protobuf::util::Status;
@@ -41,8 +46,43 @@ namespace {
 
 constexpr absl::string_view KApplicationProto = "application/x-protobuf";
 
+// The number of calls that can always be retrying at the same time, so the
+// retry budget does not block retries when there is little traffic.
+constexpr uint64_t kMinRetryConcurrency = 3;
+
+// The number of recent latencies the hedging delay is derived from.
+constexpr size_t kMaxLatencySamples = 256;
+// The hedging delay is updated every this many latencies, and is only set
+// once that many are recorded.
+constexpr uint32_t kLatencySamplesPerUpdate = 16;
+
+// The weight of the latest latency in the moving average of an endpoint.
+constexpr double kEndpointLatencyWeight = 0.25;
+// One in this many calls goes to the next endpoint in turn rather than to the
+// fastest one, so the latencies of all the endpoints stay current.
+constexpr uint64_t kEndpointProbeInterval = 64;
+
+// The window bits for gzip encoding.
+constexpr int64_t kGzipWindowBits = 15 | 16;
+constexpr uint64_t kGzipMemoryLevel = 8;
+
 RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
     authorization_handle(CustomHeaders::get().Authorization);
+RegisterCustomInlineHeader<CustomInlineHeaderRegistry::Type::RequestHeaders>
+    content_encoding_handle(CustomHeaders::get().ContentEncoding);
+
+// Returns the gzip encoding of the data.
+std::string gzipCompress(const std::string& data, uint32_t level) {
+  ZlibCompressorImpl compressor;
+  compressor.init(static_cast<ZlibCompressorImpl::CompressionLevel>(level),
+                  ZlibCompressorImpl::CompressionStrategy::Standard,
+                  kGzipWindowBits, kGzipMemoryLevel);
+  Envoy::Buffer::OwnedImpl buffer(data);
+  compressor.compress(buffer, Envoy::Compression::Compressor::State::Finish);
+  return buffer.toString();
+}
+
+}  // namespace
 
 class HttpCallImpl : public HttpCall,
                      public Envoy::Event::DeferredDeletable,
@@ -50,117 +90,339 @@ class HttpCallImpl : public HttpCall,
                      public Envoy::Http::AsyncClient::Callbacks {
  public:
   HttpCallImpl(Envoy::Upstream::ClusterManager& cm,
-               Envoy::Event::Dispatcher& dispatcher, const HttpUri& uri,
-               const std::string& suffix_url,
-               std::function<const std::string&()> token_fn,
-               const Envoy::Protobuf::Message& body, uint32_t timeout_ms,
-               uint32_t retries, Envoy::Tracing::Span& parent_span,
+               Envoy::Event::Dispatcher& dispatcher,
+               const std::vector<HttpCallEndpoint>& endpoints,
+               HttpCallEndpointSelector* endpoint_selector,
+               const std::function<const std::string&()>& authorization_fn,
+               uint32_t timeout_ms, uint32_t retries,
+               const HttpCallRetryPolicy& retry_policy,
+               HttpCallRetryBudget& retry_budget,
+               Envoy::Random::RandomGenerator& random,
+               const absl::optional<HttpCallCompression>& compression,
+               const absl::optional<HttpCallHedging>& hedging,
+               HttpCallLatencyTracker* latency_tracker,
+               const absl::optional<HttpCallStats>& stats,
                Envoy::TimeSource& time_source,
-               const std::string& trace_operation_name)
+               const HttpCallSpanNames& span_names, bool tracing_enabled,
+               ActiveHttpCalls& active_calls, HttpCallFactoryImpl* pool)
       : cm_(cm),
         dispatcher_(dispatcher),
-        http_uri_(uri),
-        retries_(retries),
-        request_count_(0),
+        compression_(compression),
+        endpoints_(endpoints),
+        endpoint_selector_(endpoint_selector),
+        endpoint_(&endpoints.front()),
+        max_retries_(retries),
         timeout_ms_(timeout_ms),
-        cancelled(false),
-        token_fn_(token_fn),
-        parent_span_(parent_span),
+        retry_budget_(retry_budget),
+        hedging_(hedging),
+        latency_tracker_(latency_tracker),
+        stats_(stats),
+        authorization_fn_(authorization_fn),
+        tracing_enabled_(tracing_enabled),
         time_source_(time_source),
-        trace_operation_name_(trace_operation_name) {
-    uri_ = http_uri_.uri() + suffix_url;
+        span_names_(span_names),
+        active_calls_(active_calls),
+        pool_(pool) {
+    if (retry_policy.base_interval_ms > 0) {
+      backoff_ = std::make_unique<Envoy::JitteredExponentialBackOffStrategy>(
+          retry_policy.base_interval_ms,
+          std::max(retry_policy.base_interval_ms, retry_policy.max_interval_ms),
+          random);
+    }
+  }
+
+  // Starts a new call with the call, whether it is new or reused.
+  void start(const Envoy::Protobuf::Message& body,
+             Envoy::Tracing::Span& parent_span) {
+    str_body_ = nullptr;
+    body.SerializeToString(&ownBody());
+    compressed_ = compressBody(*own_body_);
+    str_body_ = own_body_;
+    startCall(parent_span);
+  }
+
+  // Starts a new call with a body already serialized. The body is shared
+  // with the caller, or compressed into a string of the call.
+  void start(std::shared_ptr<const std::string> body,
+             Envoy::Tracing::Span& parent_span) {
+    str_body_ = nullptr;
+    compressed_ = compressBody(*body);
+    if (compressed_) {
+      str_body_ = own_body_;
+    } else {
+      str_body_ = std::move(body);
+    }
+    startCall(parent_span);
+  }
+
+  // Returns the body string of the call. Reuses the one of the previous
+  // call, unless the requests of the previous call still reference it.
+  std::string& ownBody() {
+    if (own_body_ == nullptr || own_body_.use_count() > 1) {
+      own_body_ = std::make_shared<std::string>();
+    }
+    return *own_body_;
+  }
+
+  // Compresses the serialized body into the body string of the call if it is
+  // large enough. Returns whether it is compressed.
+  bool compressBody(const std::string& body) {
+    if (!compression_.has_value()) {
+      return false;
+    }
+    if (body.size() < compression_->min_body_bytes) {
+      compression_->stats.uncompressed_.inc();
+      return false;
+    }
+    compression_->stats.compressed_.inc();
+    compression_->stats.raw_bytes_.add(body.size());
+    std::string compressed = gzipCompress(body, compression_->level);
+    compression_->stats.compressed_bytes_.add(compressed.size());
+    ownBody() = std::move(compressed);
+    return true;
+  }
+
+  void startCall(Envoy::Tracing::Span& parent_span) {
+    endpoint_ = &endpoints_.front();
+    request_endpoint_ = 0;
+    hedge_endpoint_ = 0;
+    retries_ = max_retries_;
+    request_count_ = 0;
+    deadline_.reset();
+    cancelled = false;
+    if (backoff_) {
+      backoff_->reset();
+    }
+    sent_requests_ = 0;
+    parent_span_ = &parent_span;
+    // Requests that are not traced have the null span.
+    traced_ = tracing_enabled_ &&
+              &parent_span != &Envoy::Tracing::NullSpan::instance();
 
-    Envoy::Http::Utility::extractHostPathFromUri(uri_, host_, path_);
-    body.SerializeToString(&str_body_);
+    retry_budget_.onCallStart();
+    if (stats_.has_value()) {
+      stats_->in_flight_.inc();
+    }
 
     ASSERT(!on_done_);
     ENVOY_LOG(trace, "{}", __func__);
   }
 
-  void setDoneFunc(HttpCall::DoneFunc on_done) { on_done_ = on_done; }
+  // Drops the state of the finished call kept for reuse.
+  void recycle() {
+    on_done_ = nullptr;
+    request_span_ = nullptr;
+    hedge_span_ = nullptr;
+    if (retry_timer_) {
+      retry_timer_->disableTimer();
+    }
+    if (hedge_timer_) {
+      hedge_timer_->disableTimer();
+    }
+  }
+
+  void setDoneFunc(HttpCall::DoneFunc on_done) {
+    on_done_ = std::move(on_done);
+  }
+
+  void call() override {
+    call_start_time_ = time_source_.monotonicTime();
+    makeOneCall();
+  }
 
-  void call() override { makeOneCall(); }
+  void setDeadline(Envoy::MonotonicTime deadline) override {
+    deadline_ = deadline;
+  }
 
   // HTTP async receive methods
   void onSuccess(const Envoy::Http::AsyncClient::Request&,
                  Envoy::Http::ResponseMessagePtr&& response) override {
+    request_ = nullptr;
+    onResponse(std::move(response), /*hedge=*/false);
+  }
+
+  void onFailure(const Envoy::Http::AsyncClient::Request&,
+                 Envoy::Http::AsyncClient::FailureReason reason) override {
+    request_ = nullptr;
+    onNetworkFailure(reason, /*hedge=*/false);
+  }
+
+  void onBeforeFinalizeUpstreamSpan(
+      Envoy::Tracing::Span&, const Envoy::Http::ResponseHeaderMap*) override {}
+
+ private:
+  // Forwards the callbacks of the hedge request to the call.
+  class HedgeCallbacks : public Envoy::Http::AsyncClient::Callbacks {
+   public:
+    explicit HedgeCallbacks(HttpCallImpl& call) : call_(call) {}
+
+    void onSuccess(const Envoy::Http::AsyncClient::Request&,
+                   Envoy::Http::ResponseMessagePtr&& response) override {
+      call_.hedge_request_ = nullptr;
+      call_.onResponse(std::move(response), /*hedge=*/true);
+    }
+
+    void onFailure(const Envoy::Http::AsyncClient::Request&,
+                   Envoy::Http::AsyncClient::FailureReason reason) override {
+      call_.hedge_request_ = nullptr;
+      call_.onNetworkFailure(reason, /*hedge=*/true);
+    }
+
+    void onBeforeFinalizeUpstreamSpan(
+        Envoy::Tracing::Span&, const Envoy::Http::ResponseHeaderMap*) override {
+    }
+
+   private:
+    HttpCallImpl& call_;
+  };
+
+  void onResponse(Envoy::Http::ResponseMessagePtr&& response, bool hedge) {
     ENVOY_LOG(trace, "{}", __func__);
+    Envoy::Tracing::SpanPtr& span = hedge ? hedge_span_ : request_span_;
 
-    std::string body;
+    Envoy::Buffer::Instance& body = response->body();
     try {
       const uint64_t status_code =
           Envoy::Http::Utility::getResponseStatus(response->headers());
 
-      request_span_->setTag(Envoy::Tracing::Tags::get().HttpStatusCode,
-                            std::to_string(status_code));
-      request_span_->finishSpan();
-
-      if (response->body().length() > 0) {
-        const auto len = response->body().length();
-        body = std::string(static_cast<char*>(response->body().linearize(len)),
-                           len);
+      if (span) {
+        span->setTag(Envoy::Tracing::Tags::get().HttpStatusCode,
+                     std::to_string(status_code));
+        span->finishSpan();
       }
+
       if (status_code == Envoy::enumToInt(Envoy::Http::Code::OK)) {
-        ENVOY_LOG(debug, "http call [uri = {}]: success with body {}", uri_,
-                  body);
-        on_done_(OkStatus(), body);
+        // The body is only copied into a string if debug logs are enabled.
+        ENVOY_LOG(debug, "http call [uri = {}]: success with body {}",
+                  endpoint_->uri, body.toString());
+        onAttemptSuccess(hedge);
+        done(OkStatus(), body);
       } else {
+        const std::string body_str = body.toString();
         ENVOY_LOG(debug, "http call response status code: {}, body: {}",
-                  status_code, body);
+                  status_code, body_str);
+        if (status_code < 400 || status_code >= 500) {
+          onEndpointFailure(hedge);
+        }
 
-        if (attemptRetry(status_code)) {
+        if (waitForOtherAttempt(span) || attemptRetry(status_code)) {
           return;
         }
 
         std::string error_msg = absl::StrCat(
             "Calling Google Service Control API failed with: ", status_code);
-        if (!body.empty()) {
-          absl::StrAppend(&error_msg, " and body: ", body);
+        if (!body_str.empty()) {
+          absl::StrAppend(&error_msg, " and body: ", body_str);
         }
         auto grpc_code = Envoy::Grpc::Utility::httpToGrpcStatus(status_code);
-        on_done_(Status(static_cast<StatusCode>(grpc_code), error_msg), body);
+        done(Status(static_cast<StatusCode>(grpc_code), error_msg), body);
       }
     } catch (const Envoy::EnvoyException& e) {
       ENVOY_LOG(debug, "http call invalid status");
-      on_done_(Status(StatusCode::kInternal, "Failed to call service control"),
-               body);
+      if (waitForOtherAttempt(span)) {
+        return;
+      }
+      onDoneWithoutBody(
+          Status(StatusCode::kInternal, "Failed to call service control"));
     }
 
     reset();
     deferredDelete();
   }
 
-  void onFailure(const Envoy::Http::AsyncClient::Request&,
-                 Envoy::Http::AsyncClient::FailureReason reason) override {
+  void onNetworkFailure(Envoy::Http::AsyncClient::FailureReason reason,
+                        bool hedge) {
+    Envoy::Tracing::SpanPtr& span = hedge ? hedge_span_ : request_span_;
+
     // The status code in reason is always 0.
     ENVOY_LOG(debug, "http call network error");
+    onEndpointFailure(hedge);
 
-    switch (reason) {
-      case Envoy::Http::AsyncClient::FailureReason::Reset:
-        request_span_->setTag(Envoy::Tracing::Tags::get().Error,
-                              "the stream has been reset");
-        break;
-      default:
-        request_span_->setTag(Envoy::Tracing::Tags::get().Error,
-                              "unknown network error");
-        break;
+    if (span) {
+      switch (reason) {
+        case Envoy::Http::AsyncClient::FailureReason::Reset:
+          span->setTag(Envoy::Tracing::Tags::get().Error,
+                       "the stream has been reset");
+          break;
+        default:
+          span->setTag(Envoy::Tracing::Tags::get().Error,
+                       "unknown network error");
+          break;
+      }
+      span->finishSpan();
     }
-    request_span_->finishSpan();
 
-    if (attemptRetry(0)) {
+    if (waitForOtherAttempt(span) || attemptRetry(0)) {
       return;
     }
 
-    on_done_(Status(StatusCode::kInternal, "Failed to call service control"),
-             std::string());
+    onDoneWithoutBody(
+        Status(StatusCode::kInternal, "Failed to call service control"));
     reset();
     deferredDelete();
   }
 
-  void onBeforeFinalizeUpstreamSpan(
-      Envoy::Tracing::Span&, const Envoy::Http::ResponseHeaderMap*) override {}
+  // Records the latency of the successful attempt, and cancels the other
+  // attempt if the call was hedged.
+  void onAttemptSuccess(bool hedge) {
+    const std::chrono::milliseconds latency =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            time_source_.monotonicTime() -
+            (hedge ? hedge_start_time_ : request_start_time_));
+    if (latency_tracker_ != nullptr) {
+      latency_tracker_->record(latency);
+    }
+    if (endpoint_selector_ != nullptr) {
+      endpoint_selector_->onSuccess(
+          hedge ? hedge_endpoint_ : request_endpoint_, latency);
+    }
+    if (hedge) {
+      hedging_->hedge_won.inc();
+    }
+
+    if (hedge_timer_) {
+      hedge_timer_->disableTimer();
+    }
+    cancelRequest(request_, request_span_);
+    cancelRequest(hedge_request_, hedge_span_);
+  }
+
+  // Counts the failure of the endpoint of the attempt.
+  void onEndpointFailure(bool hedge) {
+    if (endpoint_selector_ != nullptr) {
+      endpoint_selector_->onFailure(hedge ? hedge_endpoint_
+                                          : request_endpoint_);
+    }
+  }
+
+  // Returns true if the other attempt of a hedged call is still in flight,
+  // so the failed attempt waits for it instead of retrying.
+  bool waitForOtherAttempt(Envoy::Tracing::SpanPtr& finished_span) {
+    if (request_ != nullptr || hedge_request_ != nullptr) {
+      finished_span = nullptr;
+      return true;
+    }
+    if (hedge_timer_) {
+      hedge_timer_->disableTimer();
+    }
+    return false;
+  }
+
+  static void cancelRequest(Envoy::Http::AsyncClient::Request*& request,
+                            Envoy::Tracing::SpanPtr& span) {
+    if (request == nullptr) {
+      return;
+    }
+    if (span) {
+      span->setTag(Envoy::Tracing::Tags::get().Error,
+                   Envoy::Tracing::Tags::get().Canceled);
+      span->finishSpan();
+      span = nullptr;
+    }
+    request->cancel();
+    request = nullptr;
+  }
 
- private:
   bool attemptRetry(const uint64_t& status_code) {
     // skip if it is the client side problem.
     if (status_code >= 400 && status_code < 500) {
@@ -169,55 +431,176 @@ class HttpCallImpl : public HttpCall,
     if (retries_ <= 0) {
       return false;
     }
+    if (deadlineExceeded(std::chrono::milliseconds(0))) {
+      ENVOY_LOG(debug,
+                "request deadline exceeded, not retrying http call [uri = {}]",
+                endpoint_->uri);
+      return false;
+    }
+    if (!retrying_) {
+      if (!retry_budget_.tryStartRetry()) {
+        ENVOY_LOG(debug,
+                  "retry budget exhausted, not retrying http call [uri = {}]",
+                  endpoint_->uri);
+        return false;
+      }
+      retrying_ = true;
+    }
     retries_--;
-    ENVOY_LOG(debug,
-              "after {} times failures, retrying http call [uri = {}], with "
-              "{} remaining chances",
-              request_count_, uri_, retries_);
-
     reset();
-    makeOneCall();
+
+    if (!backoff_) {
+      ENVOY_LOG(debug,
+                "after {} times failures, retrying http call [uri = {}], with "
+                "{} remaining chances",
+                request_count_, endpoint_->uri, retries_);
+      makeOneCall();
+      return true;
+    }
+
+    const uint64_t backoff_ms = backoff_->nextBackOffMs();
+    if (deadlineExceeded(std::chrono::milliseconds(backoff_ms))) {
+      ENVOY_LOG(debug,
+                "request deadline is before the backoff ends, not retrying "
+                "http call [uri = {}]",
+                endpoint_->uri);
+      return false;
+    }
+    ENVOY_LOG(debug,
+              "after {} times failures, retrying http call [uri = {}] in {} "
+              "ms, with {} remaining chances",
+              request_count_, endpoint_->uri, backoff_ms, retries_);
+    if (!retry_timer_) {
+      retry_timer_ = dispatcher_.createTimer([this]() { makeOneCall(); });
+    }
+    retry_timer_->enableTimer(std::chrono::milliseconds(backoff_ms));
     return true;
   }
 
   void makeOneCall() {
     request_count_++;
-    std::string token = token_fn_();
-    if (token.empty()) {
-      on_done_(Status(StatusCode::kInternal,
-                      "Missing access token for service control call"),
-               Envoy::EMPTY_STRING);
+    const std::string& authorization = authorization_fn_();
+    if (authorization.empty()) {
+      onDoneWithoutBody(
+          Status(StatusCode::kInternal,
+                 "Missing access token for service control call"));
       deferredDelete();
       return;
     }
 
-    // Trace the request
-    auto span_name = request_count_ == 1
-                         ? trace_operation_name_
-                         : absl::StrCat(trace_operation_name_, " - Retry ",
-                                        request_count_ - 1);
-    request_span_ =
-        parent_span_.spawnChild(Envoy::Tracing::EgressConfig::get(), span_name,
-                                time_source_.systemTime());
-    request_span_->setTag(Envoy::Tracing::Tags::get().Component,
-                          Envoy::Tracing::Tags::get().Proxy);
-    request_span_->setTag(Envoy::Tracing::Tags::get().UpstreamCluster,
-                          http_uri_.cluster());
-    request_span_->setTag(Envoy::Tracing::Tags::get().HttpUrl, uri_);
-    request_span_->setTag(Envoy::Tracing::Tags::get().HttpMethod, "POST");
-
-    Envoy::Http::RequestMessagePtr message = prepareHeaders(token);
-    request_span_->injectContext(message->headers());
-    ENVOY_LOG(debug, "http call from [uri = {}]: start", uri_);
+    if (deadlineExceeded(std::chrono::milliseconds(0))) {
+      // Fail fast, as if service control did not answer in time.
+      onDoneWithoutBody(
+          Status(StatusCode::kUnavailable,
+                 "Request deadline exceeded before calling service control"));
+      deferredDelete();
+      return;
+    }
+
+    const std::chrono::milliseconds timeout = attemptTimeout();
+    request_start_time_ = time_source_.monotonicTime();
+    request_ = send(authorization, span_names_.attempt(request_count_),
+                    request_span_, request_endpoint_, *this, timeout);
+
+    // Only the first attempt is hedged, retries already follow failures.
+    if (request_count_ == 1 && request_ != nullptr) {
+      scheduleHedge(timeout);
+    }
+  }
+
+  // Returns true if the deadline passes within `after` from now.
+  bool deadlineExceeded(std::chrono::milliseconds after) const {
+    return deadline_.has_value() &&
+           time_source_.monotonicTime() + after >= *deadline_;
+  }
+
+  // Returns the timeout of an attempt started now, capped to the deadline.
+  std::chrono::milliseconds attemptTimeout() const {
+    const std::chrono::milliseconds timeout(timeout_ms_);
+    if (!deadline_.has_value()) {
+      return timeout;
+    }
+    const auto remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            *deadline_ - time_source_.monotonicTime());
+    return timeout.count() > 0 ? std::min(timeout, remaining) : remaining;
+  }
+
+  Envoy::Http::AsyncClient::Request* send(
+      const std::string& authorization, const std::string& span_name,
+      Envoy::Tracing::SpanPtr& span, size_t& endpoint_index,
+      Envoy::Http::AsyncClient::Callbacks& callbacks,
+      std::chrono::milliseconds timeout) {
+    // Each attempt picks its endpoint, so a retry avoids a failed one.
+    endpoint_index =
+        endpoint_selector_ != nullptr ? endpoint_selector_->pick() : 0;
+    endpoint_ = &endpoints_[endpoint_index];
+    Envoy::Http::RequestMessagePtr message = prepareHeaders(authorization);
+    // No span, tags or trace context for the requests that are not traced.
+    if (traced_) {
+      span = parent_span_->spawnChild(Envoy::Tracing::EgressConfig::get(),
+                                     span_name, time_source_.systemTime());
+      span->setTag(Envoy::Tracing::Tags::get().Component,
+                   Envoy::Tracing::Tags::get().Proxy);
+      span->setTag(Envoy::Tracing::Tags::get().UpstreamCluster,
+                   endpoint_->cluster);
+      span->setTag(Envoy::Tracing::Tags::get().HttpUrl, endpoint_->uri);
+      span->setTag(Envoy::Tracing::Tags::get().HttpMethod, "POST");
+      span->injectContext(message->headers());
+    }
+    ENVOY_LOG(debug, "http call from [uri = {}]: start", endpoint_->uri);
 
     const auto thread_local_cluster =
-        cm_.getThreadLocalCluster(http_uri_.cluster());
-    if (thread_local_cluster) {
-      request_ = thread_local_cluster->httpAsyncClient().send(
-          std::move(message), *this,
-          Envoy::Http::AsyncClient::RequestOptions().setTimeout(
-              std::chrono::milliseconds(timeout_ms_)));
+        cm_.getThreadLocalCluster(endpoint_->cluster);
+    if (!thread_local_cluster) {
+      return nullptr;
+    }
+    sent_requests_++;
+    return thread_local_cluster->httpAsyncClient().send(
+        std::move(message), callbacks,
+        Envoy::Http::AsyncClient::RequestOptions().setTimeout(timeout));
+  }
+
+  void scheduleHedge(std::chrono::milliseconds timeout) {
+    if (latency_tracker_ == nullptr) {
+      return;
+    }
+    const auto delay = latency_tracker_->hedgeDelay();
+    // Not enough latencies yet, or the call times out before the hedge.
+    if (!delay.has_value() || *delay >= timeout) {
+      return;
+    }
+    if (!hedge_timer_) {
+      hedge_timer_ = dispatcher_.createTimer([this]() { makeHedgeCall(); });
+    }
+    hedge_timer_->enableTimer(*delay);
+  }
+
+  void makeHedgeCall() {
+    if (deadlineExceeded(std::chrono::milliseconds(0))) {
+      return;
     }
+    if (!retrying_) {
+      if (!retry_budget_.tryStartRetry()) {
+        ENVOY_LOG(debug,
+                  "retry budget exhausted, not hedging http call [uri = {}]",
+                  endpoint_->uri);
+        return;
+      }
+      retrying_ = true;
+    }
+    const std::string& authorization = authorization_fn_();
+    if (authorization.empty()) {
+      return;
+    }
+
+    ENVOY_LOG(debug, "no response yet, hedging http call [uri = {}]",
+              endpoint_->uri);
+    hedging_->hedged.inc();
+    hedge_start_time_ = time_source_.monotonicTime();
+    hedge_request_ =
+        send(authorization, span_names_.hedge(), hedge_span_, hedge_endpoint_,
+             hedge_callbacks_, attemptTimeout());
   }
 
   void cancel() override {
@@ -225,7 +608,16 @@ class HttpCallImpl : public HttpCall,
       return;
     }
     cancelled = true;
-    ENVOY_LOG(debug, "Http call [uri = {}]: canceled", uri_);
+    ENVOY_LOG(debug, "Http call [uri = {}]: canceled", endpoint_->uri);
+    if (retry_timer_ && retry_timer_->enabled()) {
+      // Cancelled while waiting to retry, the previous span is finished.
+      retry_timer_->disableTimer();
+      request_span_ = nullptr;
+    }
+    if (hedge_timer_) {
+      hedge_timer_->disableTimer();
+    }
+    cancelRequest(hedge_request_, hedge_span_);
     if (request_span_) {
       request_span_->setTag(Envoy::Tracing::Tags::get().Error,
                             Envoy::Tracing::Tags::get().Canceled);
@@ -234,36 +626,78 @@ class HttpCallImpl : public HttpCall,
 
     if (request_) {
       request_->cancel();
-      ENVOY_LOG(debug, "Http call [uri = {}]: canceled", uri_);
+      ENVOY_LOG(debug, "Http call [uri = {}]: canceled", endpoint_->uri);
       reset();
     }
-    on_done_(Status(StatusCode::kCancelled, std::string("Request cancelled")),
-             Envoy::EMPTY_STRING);
+    onDoneWithoutBody(
+        Status(StatusCode::kCancelled, std::string("Request cancelled")));
     deferredDelete();
   }
 
   void reset() { request_ = nullptr; }
 
-  Envoy::Http::RequestMessagePtr prepareHeaders(const std::string& token) {
+  void onDoneWithoutBody(const Status& status) {
+    Envoy::Buffer::OwnedImpl body;
+    done(status, body);
+  }
+
+  void done(const Status& status, Envoy::Buffer::Instance& body) {
+    active_calls_.erase(this);
+    on_done_(status, body);
+  }
+
+  Envoy::Http::RequestMessagePtr prepareHeaders(
+      const std::string& authorization) {
     Envoy::Http::RequestMessagePtr message(
         new Envoy::Http::RequestMessageImpl());
-    message->headers().setPath(path_);
-    message->headers().setHost(host_);
+    message->headers().setPath(endpoint_->path);
+    message->headers().setHost(endpoint_->host);
 
     message->headers().setReferenceMethod(
         Envoy::Http::Headers::get().MethodValues.Post);
 
-    message->body().add(str_body_.data(), str_body_.size());
+    // Reference the serialized body instead of copying it on every attempt.
+    // The fragment keeps the body alive until the request releases it.
+    auto* fragment = new Envoy::Buffer::BufferFragmentImpl(
+        str_body_->data(), str_body_->size(),
+        [str_body = str_body_](const void*, size_t,
+                               const Envoy::Buffer::BufferFragmentImpl* frag) {
+          delete frag;
+        });
+    message->body().addBufferFragment(*fragment);
     message->headers().setContentLength(message->body().length());
+    if (compressed_) {
+      message->headers().setReferenceInline(
+          content_encoding_handle.handle(),
+          CustomHeaders::get().ContentEncodingValues.Gzip);
+    }
 
-    // assume token is not empty
-    message->headers().setInline(authorization_handle.handle(),
-                                 "Bearer " + token);
+    // assume authorization is not empty
+    message->headers().setInline(authorization_handle.handle(), authorization);
     message->headers().setContentType(KApplicationProto);
     return message;
   }
 
   void deferredDelete() {
+    if (retrying_) {
+      retry_budget_.onRetryFinish();
+      retrying_ = false;
+    }
+    retry_budget_.onCallFinish();
+    if (stats_.has_value()) {
+      stats_->in_flight_.dec();
+      if (!cancelled && sent_requests_ > 0) {
+        stats_->latency_.recordValue(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                time_source_.monotonicTime() - call_start_time_)
+                .count());
+        stats_->attempts_.recordValue(sent_requests_);
+      }
+    }
+    if (pool_ != nullptr) {
+      pool_->releaseCall(this);
+      return;
+    }
     dispatcher_.deferredDelete(std::unique_ptr<HttpCallImpl>(this));
   }
 
@@ -273,88 +707,387 @@ class HttpCallImpl : public HttpCall,
   // The dispatcher for this thread
   Envoy::Event::Dispatcher& dispatcher_;
 
+  // The request body compression of the factory. Disabled if not set.
+  const absl::optional<HttpCallCompression>& compression_;
+
   // The request
   Envoy::Http::AsyncClient::Request* request_{};
 
   // The callback function when request finished
   HttpCall::DoneFunc on_done_;
 
-  // The serialized request body
-  std::string str_body_;
+  // The serialized request body, shared by all the attempts
+  std::shared_ptr<const std::string> str_body_;
+  // The body string of the call when it serializes or compresses the body.
+  std::shared_ptr<std::string> own_body_;
+  // Whether the request body is gzip compressed
+  bool compressed_{};
 
-  // The request uri
-  std::string uri_;
-  // The host of the request uri
-  const HttpUri http_uri_;
-  // The host of the request uri with buffer owned by uri_
-  absl::string_view host_;
-  // The path of the request uri with buffer owned by uri_
-  absl::string_view path_;
+  // The endpoints of the factory.
+  const std::vector<HttpCallEndpoint>& endpoints_;
+  // Picks the endpoint of each request. Null if there is one endpoint.
+  HttpCallEndpointSelector* endpoint_selector_;
+  // The endpoint of the latest request.
+  const HttpCallEndpoint* endpoint_;
+  // The endpoint indexes of the current request and of the hedge.
+  size_t request_endpoint_{};
+  size_t hedge_endpoint_{};
 
+  // The retry times of each call
+  const uint32_t max_retries_;
   // The remaining retry times
-  uint32_t retries_;
+  uint32_t retries_{};
   // The sent request count
-  uint32_t request_count_;
+  uint32_t request_count_{};
   // The timeout
   uint32_t timeout_ms_;
+  // The deadline of the downstream request, if any.
+  absl::optional<Envoy::MonotonicTime> deadline_;
   // whether this call has been cancelled
-  bool cancelled;
+  bool cancelled{};
 
-  // The function for getting token
-  std::function<const std::string&()> token_fn_;
+  // The backoff between retries. Null if the retries are immediate.
+  Envoy::BackOffStrategyPtr backoff_;
+  // The timer to make the next retry after the backoff.
+  Envoy::Event::TimerPtr retry_timer_;
+  // The retry budget of the factory.
+  HttpCallRetryBudget& retry_budget_;
+  // Whether this call holds a retry from the budget.
+  bool retrying_{};
+
+  // The hedging of the factory. Disabled if not set.
+  const absl::optional<HttpCallHedging>& hedging_;
+  // The latencies of the factory. Null if hedging is disabled.
+  HttpCallLatencyTracker* latency_tracker_;
+  // The timer to send the hedge request.
+  Envoy::Event::TimerPtr hedge_timer_;
+  // The hedge request, in flight along with the first request.
+  Envoy::Http::AsyncClient::Request* hedge_request_{};
+  HedgeCallbacks hedge_callbacks_{*this};
+  Envoy::Tracing::SpanPtr hedge_span_;
+  // The stats of the factory. Disabled if not set.
+  const absl::optional<HttpCallStats>& stats_;
+  // The number of requests sent, including the retries and the hedge.
+  uint32_t sent_requests_{};
+  // The start time of the call.
+  Envoy::MonotonicTime call_start_time_;
+  // The start times of the current request and of the hedge.
+  Envoy::MonotonicTime request_start_time_;
+  Envoy::MonotonicTime hedge_start_time_;
+
+  // Returns the Authorization header value, owned by the factory.
+  const std::function<const std::string&()>& authorization_fn_;
 
   // Tracing data
-  Envoy::Tracing::Span& parent_span_;
+  Envoy::Tracing::Span* parent_span_{};
+  // Whether the factory traces the calls.
+  const bool tracing_enabled_;
+  // Whether the requests get spans. The spans are null otherwise.
+  bool traced_{};
   Envoy::TimeSource& time_source_;
   Envoy::Tracing::SpanPtr request_span_;
-  const std::string trace_operation_name_;
+  // The span names of the factory.
+  const HttpCallSpanNames& span_names_;
+
+  // The active calls of the factory.
+  ActiveHttpCalls& active_calls_;
+  // The factory the finished call is released to for reuse. Null if the
+  // call is deleted when it finishes.
+  HttpCallFactoryImpl* pool_;
 };
 
-}  // namespace
+HttpCallEndpoint::HttpCallEndpoint(const HttpUri& http_uri,
+                                   const std::string& suffix_url)
+    : cluster(http_uri.cluster()), uri(http_uri.uri() + suffix_url) {
+  absl::string_view host_view, path_view;
+  Envoy::Http::Utility::extractHostPathFromUri(uri, host_view, path_view);
+  host = std::string(host_view);
+  path = std::string(path_view);
+}
+
+HttpCallEndpointSelector::HttpCallEndpointSelector(
+    size_t endpoints, const HttpCallEndpointSelection& selection,
+    Envoy::TimeSource& time_source)
+    : ejection_failures_(selection.ejection_failures),
+      ejection_duration_(selection.ejection_duration_ms),
+      time_source_(time_source),
+      endpoints_(endpoints) {}
+
+size_t HttpCallEndpointSelector::pick() {
+  const Envoy::MonotonicTime now = time_source_.monotonicTime();
+  if (++picks_ % kEndpointProbeInterval == 0) {
+    const size_t probe = (picks_ / kEndpointProbeInterval) % endpoints_.size();
+    if (endpoints_[probe].ejected_until <= now) {
+      return probe;
+    }
+  }
+
+  absl::optional<size_t> fastest;
+  for (size_t i = 0; i < endpoints_.size(); ++i) {
+    const EndpointState& endpoint = endpoints_[i];
+    if (endpoint.ejected_until > now) {
+      continue;
+    }
+    // The endpoints with no latency yet are tried first.
+    if (!endpoint.latency_ms.has_value()) {
+      return i;
+    }
+    if (!fastest.has_value() ||
+        *endpoint.latency_ms < *endpoints_[*fastest].latency_ms) {
+      fastest = i;
+    }
+  }
+  if (fastest.has_value()) {
+    return *fastest;
+  }
+
+  // All the endpoints are ejected, the first one to return is used.
+  size_t first = 0;
+  for (size_t i = 1; i < endpoints_.size(); ++i) {
+    if (endpoints_[i].ejected_until < endpoints_[first].ejected_until) {
+      first = i;
+    }
+  }
+  return first;
+}
+
+void HttpCallEndpointSelector::onSuccess(size_t endpoint,
+                                         std::chrono::milliseconds latency) {
+  EndpointState& state = endpoints_[endpoint];
+  state.consecutive_failures = 0;
+  const double latency_ms = std::max<int64_t>(0, latency.count());
+  state.latency_ms =
+      state.latency_ms.has_value()
+          ? kEndpointLatencyWeight * latency_ms +
+                (1 - kEndpointLatencyWeight) * *state.latency_ms
+          : latency_ms;
+}
+
+void HttpCallEndpointSelector::onFailure(size_t endpoint) {
+  EndpointState& state = endpoints_[endpoint];
+  if (ejection_failures_ == 0 ||
+      ++state.consecutive_failures < ejection_failures_) {
+    return;
+  }
+  // The latency is measured again once the ejection ends.
+  state.consecutive_failures = 0;
+  state.latency_ms.reset();
+  state.ejected_until = time_source_.monotonicTime() + ejection_duration_;
+}
+
+HttpCallSpanNames::HttpCallSpanNames(const std::string& operation_name,
+                                     uint32_t retries)
+    : hedge_(absl::StrCat(operation_name, " - Hedge")) {
+  attempts_.reserve(retries + 1);
+  attempts_.push_back(operation_name);
+  for (uint32_t retry = 1; retry <= retries; ++retry) {
+    attempts_.push_back(absl::StrCat(operation_name, " - Retry ", retry));
+  }
+}
+
+HttpCallLatencyTracker::HttpCallLatencyTracker(const HttpCallHedging& hedging)
+    : percentile_(hedging.percentile),
+      min_delay_(hedging.min_delay_ms),
+      max_delay_(hedging.max_delay_ms) {
+  latencies_.reserve(kMaxLatencySamples);
+}
+
+void HttpCallLatencyTracker::record(std::chrono::milliseconds latency) {
+  const uint64_t latency_ms = std::max<int64_t>(0, latency.count());
+  if (latencies_.size() < kMaxLatencySamples) {
+    latencies_.push_back(latency_ms);
+  } else {
+    latencies_[next_] = latency_ms;
+  }
+  next_ = (next_ + 1) % kMaxLatencySamples;
+
+  if (++pending_updates_ >= kLatencySamplesPerUpdate) {
+    pending_updates_ = 0;
+    updateHedgeDelay();
+  }
+}
+
+void HttpCallLatencyTracker::updateHedgeDelay() {
+  std::vector<uint64_t> latencies = latencies_;
+  const size_t index =
+      std::min(latencies.size() - 1, latencies.size() * percentile_ / 100);
+  std::nth_element(latencies.begin(), latencies.begin() + index,
+                   latencies.end());
+
+  std::chrono::milliseconds delay =
+      std::max(std::chrono::milliseconds(latencies[index]), min_delay_);
+  if (max_delay_.count() > 0) {
+    delay = std::min(delay, max_delay_);
+  }
+  hedge_delay_ = delay;
+}
+
+bool HttpCallRetryBudget::tryStartRetry() {
+  if (budget_percent_ > 0) {
+    const uint64_t max_retrying_calls = std::max(
+        kMinRetryConcurrency, active_calls_ * budget_percent_ / 100);
+    if (retrying_calls_ >= max_retrying_calls) {
+      return false;
+    }
+  }
+  retrying_calls_++;
+  return true;
+}
 
 HttpCallFactoryImpl::HttpCallFactoryImpl(
     Envoy::Upstream::ClusterManager& cm, Envoy::Event::Dispatcher& dispatcher,
     const ::espv2::api::envoy::v10::http::common::HttpUri& uri,
-    const std::string& suffix_url, std::function<const std::string&()> token_fn,
-    uint32_t timeout_ms, uint32_t retries, Envoy::TimeSource& time_source,
-    const std::string& trace_operation_name)
+    const std::string& suffix_url,
+    std::function<const std::string&()> authorization_fn, uint32_t timeout_ms,
+    uint32_t retries, const HttpCallRetryPolicy& retry_policy,
+    Envoy::TimeSource& time_source, const std::string& trace_operation_name)
     : cm_(cm),
       dispatcher_(dispatcher),
-      uri_(uri),
       suffix_url_(suffix_url),
-      token_fn_(token_fn),
+      authorization_fn_(authorization_fn),
       timeout_ms_(timeout_ms),
       retries_(retries),
-      destruct_mode_(false),
+      retry_policy_(retry_policy),
+      retry_budget_(retry_policy.budget_percent),
       time_source_(time_source),
-      trace_operation_name_(trace_operation_name){};
+      span_names_(trace_operation_name, retries) {
+  endpoints_.emplace_back(uri, suffix_url);
+}
+
+void HttpCallFactoryImpl::enableEndpointSelection(
+    const std::vector<HttpUri>& additional_uris,
+    const HttpCallEndpointSelection& selection) {
+  ASSERT(active_calls_.empty());
+  for (const HttpUri& uri : additional_uris) {
+    endpoints_.emplace_back(uri, suffix_url_);
+  }
+  endpoint_selector_ = std::make_unique<HttpCallEndpointSelector>(
+      endpoints_.size(), selection, time_source_);
+}
 
 HttpCall* HttpCallFactoryImpl::createHttpCall(
     const Envoy::Protobuf::Message& body, Envoy::Tracing::Span& parent_span,
     HttpCall::DoneFunc on_done) {
-  ENVOY_LOG(debug, "{} is created", trace_operation_name_);
-  HttpCallImpl* http_call = new HttpCallImpl(
-      cm_, dispatcher_, uri_, suffix_url_, token_fn_, body, timeout_ms_,
-      retries_, parent_span, time_source_, trace_operation_name_);
-  http_call->setDoneFunc([this, on_done, http_call](const Status& status,
-                                                    const std::string& body) {
-    // When the call is finished, it should be removed from active_calls_ .
-    // However, when the factory object is being destructed, all active_calls_
-    // will be cancelled in one time so no need to remove them from
-    // active_calls_ to avoid removing elements during for-loop iteration.
-    if (!destruct_mode_) {
-      active_calls_.erase(http_call);
-    }
-    on_done(status, body);
-  });
+  HttpCallImpl* http_call = newCall();
+  http_call->start(body, parent_span);
+  return addCall(http_call, std::move(on_done));
+}
+
+HttpCall* HttpCallFactoryImpl::createSerializedHttpCall(
+    std::shared_ptr<const std::string> body, Envoy::Tracing::Span& parent_span,
+    HttpCall::DoneFunc on_done) {
+  HttpCallImpl* http_call = newCall();
+  http_call->start(std::move(body), parent_span);
+  return addCall(http_call, std::move(on_done));
+}
+
+HttpCallImpl* HttpCallFactoryImpl::newCall() {
+  ENVOY_LOG(debug, "{} is created", span_names_.operation());
+  if (free_calls_.empty()) {
+    return new HttpCallImpl(
+        cm_, dispatcher_, endpoints_, endpoint_selector_.get(),
+        authorization_fn_, timeout_ms_, retries_, retry_policy_,
+        retry_budget_, random_, compression_, hedging_, latency_tracker_.get(),
+        stats_, time_source_, span_names_, tracing_enabled_, active_calls_,
+        call_pool_size_ > 0 ? this : nullptr);
+  }
+  HttpCallImpl* http_call = free_calls_.back().release();
+  free_calls_.pop_back();
+  if (stats_.has_value()) {
+    stats_->call_pool_hit_.inc();
+  }
+  return http_call;
+}
+
+HttpCall* HttpCallFactoryImpl::addCall(HttpCallImpl* http_call,
+                                       HttpCall::DoneFunc on_done) {
+  http_call->setDoneFunc(std::move(on_done));
   active_calls_.insert(http_call);
+  called_since_warm_up_ = true;
   return http_call;
 }
 
+void HttpCallFactoryImpl::enableWarmUp(const HttpCallWarmUp& warm_up) {
+  warm_up_.emplace(warm_up);
+  warm_up_timer_ = dispatcher_.createTimer([this]() {
+    if (!called_since_warm_up_) {
+      warmUp();
+    }
+    called_since_warm_up_ = false;
+    warm_up_timer_->enableTimer(warm_up_->keep_alive_interval);
+  });
+  warmUp();
+  warm_up_timer_->enableTimer(warm_up_->keep_alive_interval);
+}
+
+void HttpCallFactoryImpl::warmUp() {
+  // The connections of the requests still in flight are already open.
+  if (!warm_up_requests_.empty()) {
+    return;
+  }
+  for (const HttpCallEndpoint& endpoint : endpoints_) {
+    Envoy::Upstream::ThreadLocalCluster* thread_local_cluster =
+        cm_.getThreadLocalCluster(endpoint.cluster);
+    if (!thread_local_cluster) {
+      continue;
+    }
+    // Sent at the same time, so each request takes a connection of its own
+    // over HTTP/1.1. HTTP/2 multiplexes them on one.
+    for (uint32_t i = 0; i < warm_up_->connections; ++i) {
+      Envoy::Http::RequestMessagePtr message(
+          new Envoy::Http::RequestMessageImpl());
+      message->headers().setPath(endpoint.path);
+      message->headers().setHost(endpoint.host);
+      message->headers().setReferenceMethod(
+          Envoy::Http::Headers::get().MethodValues.Head);
+      Envoy::Http::AsyncClient::Request* request =
+          thread_local_cluster->httpAsyncClient().send(
+              std::move(message), warm_up_callbacks_,
+              Envoy::Http::AsyncClient::RequestOptions().setTimeout(
+                  std::chrono::milliseconds(timeout_ms_)));
+      // Null if it failed right away.
+      if (request != nullptr) {
+        warm_up_requests_.insert(request);
+      }
+    }
+  }
+  ENVOY_LOG(debug, "{}: sent {} warm-up requests", span_names_.operation(),
+            warm_up_requests_.size());
+}
+
+void HttpCallFactoryImpl::enableCallPool(uint32_t call_pool_size) {
+  ASSERT(active_calls_.empty());
+  call_pool_size_ = call_pool_size;
+  recycle_cb_ =
+      dispatcher_.createSchedulableCallback([this]() { recycleCalls(); });
+}
+
+void HttpCallFactoryImpl::releaseCall(HttpCallImpl* call) {
+  // The call may still be on the stack, it is recycled in the next event
+  // loop iteration.
+  released_calls_.emplace_back(call);
+  if (!recycle_cb_->enabled()) {
+    recycle_cb_->scheduleCallbackNextIteration();
+  }
+}
+
+void HttpCallFactoryImpl::recycleCalls() {
+  for (auto& call : released_calls_) {
+    if (free_calls_.size() >= call_pool_size_) {
+      break;
+    }
+    call->recycle();
+    free_calls_.push_back(std::move(call));
+  }
+  // The calls left are deleted.
+  released_calls_.clear();
+}
+
 HttpCallFactoryImpl::~HttpCallFactoryImpl() {
-  destruct_mode_ = true;
-  for (auto* httpCall : active_calls_) {
-    httpCall->cancel();
+  active_calls_.cancelAll();
+  // Cancelled without their callbacks.
+  for (Envoy::Http::AsyncClient::Request* request : warm_up_requests_) {
+    request->cancel();
   }
 }
 
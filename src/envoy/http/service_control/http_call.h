@@ -14,11 +14,26 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/types/optional.h"
 #include "api/envoy/v10/http/common/base.pb.h"
+#include "envoy/buffer/buffer.h"
 #include "envoy/common/pure.h"
+#include "envoy/common/time.h"
+#include "envoy/event/schedulable_cb.h"
+#include "envoy/event/timer.h"
+#include "envoy/stats/stats.h"
 #include "envoy/tracing/http_tracer.h"
 #include "envoy/upstream/cluster_manager.h"
 #include "google/protobuf/stubs/status.h"
+#include "source/common/common/random_generator.h"
+#include "src/envoy/http/service_control/filter_stats.h"
 
 namespace espv2 {
 namespace envoy {
@@ -27,9 +42,11 @@ namespace service_control {
 
 class HttpCall {
  public:
+  // The response body is only valid during the call, and may be drained by
+  // the function.
   using DoneFunc =
       std::function<void(const ::google::protobuf::util::Status& status,
-                         const std::string& response_body)>;
+                         Envoy::Buffer::Instance& response_body)>;
 
   virtual ~HttpCall() {}
   /*
@@ -38,6 +55,212 @@ class HttpCall {
   virtual void cancel() PURE;
 
   virtual void call() PURE;
+
+  /*
+   * Caps the timeout of the attempts, and the retries, to the deadline of
+   * the downstream request. Must be called before call().
+   */
+  virtual void setDeadline(Envoy::MonotonicTime deadline) PURE;
+};
+
+// The calls of a factory not finished yet. A call removes itself before it
+// calls its done function, which is then not wrapped by the factory.
+class ActiveHttpCalls {
+ public:
+  void insert(HttpCall* call) { calls_.insert(call); }
+
+  void erase(HttpCall* call) {
+    // Not removed while they are all being cancelled.
+    if (!cancelling_) {
+      calls_.erase(call);
+    }
+  }
+
+  // Cancels all the calls, when the factory is destructed.
+  void cancelAll() {
+    cancelling_ = true;
+    for (HttpCall* call : calls_) {
+      call->cancel();
+    }
+  }
+
+  size_t size() const { return calls_.size(); }
+  bool empty() const { return calls_.empty(); }
+
+ private:
+  absl::flat_hash_set<HttpCall*> calls_;
+  bool cancelling_ = false;
+};
+
+// The backoff between the retries of a call, and the retry budget shared by
+// all the calls of a HttpCallFactoryImpl.
+struct HttpCallRetryPolicy {
+  // The base interval of the jittered exponential backoff between retries.
+  // The calls are retried immediately if it is 0.
+  uint32_t base_interval_ms;
+  // The maximum interval of the backoff between retries.
+  uint32_t max_interval_ms;
+  // The maximum percentage of the active calls that can be retrying at the
+  // same time. There is no limit if it is 0.
+  uint32_t budget_percent;
+};
+
+// The gzip compression of the request bodies of a HttpCallFactoryImpl.
+struct HttpCallCompression {
+  // The compression level, from 1 (fastest) to 9 (best).
+  uint32_t level;
+  // The bodies smaller than this are sent uncompressed.
+  uint32_t min_body_bytes;
+  // Counts the compressed bodies and their sizes.
+  CompressionStats stats;
+};
+
+// The hedging of the calls of a HttpCallFactoryImpl. A call that gets no
+// response within a percentile of the recent call latencies is sent a second
+// time, and the first success wins.
+struct HttpCallHedging {
+  // The percentile of the recent latencies after which a call is hedged.
+  uint32_t percentile;
+  // The bounds of the delay before a call is hedged. There is no upper bound
+  // if max_delay_ms is 0.
+  uint32_t min_delay_ms;
+  uint32_t max_delay_ms;
+  // Counts the hedged calls, and those answered by the hedge first.
+  Envoy::Stats::Counter& hedged;
+  Envoy::Stats::Counter& hedge_won;
+};
+
+// The warm-up of the connections of a HttpCallFactoryImpl.
+struct HttpCallWarmUp {
+  // The number of concurrent requests sent to each endpoint, opening up to as
+  // many connections.
+  uint32_t connections;
+  // The interval at which the requests are sent again if no call was made
+  // since, so the idle connections are not closed.
+  std::chrono::milliseconds keep_alive_interval;
+};
+
+// Keeps the latencies of the recent successful attempts of a
+// HttpCallFactoryImpl to derive the hedging delay from them.
+class HttpCallLatencyTracker {
+ public:
+  explicit HttpCallLatencyTracker(const HttpCallHedging& hedging);
+
+  void record(std::chrono::milliseconds latency);
+
+  // Returns the delay after which a call is hedged, or nullopt if there are
+  // not enough latencies yet.
+  absl::optional<std::chrono::milliseconds> hedgeDelay() const {
+    return hedge_delay_;
+  }
+
+ private:
+  void updateHedgeDelay();
+
+  const uint32_t percentile_;
+  const std::chrono::milliseconds min_delay_;
+  const std::chrono::milliseconds max_delay_;
+
+  // A ring of the recent latencies in millisecond.
+  std::vector<uint64_t> latencies_;
+  size_t next_{};
+  // The latencies recorded since the delay was last updated.
+  uint32_t pending_updates_{};
+  absl::optional<std::chrono::milliseconds> hedge_delay_;
+};
+
+// Tracks the active and retrying calls of a HttpCallFactoryImpl, so that the
+// retries during an outage stay a fixed fraction of the traffic.
+class HttpCallRetryBudget {
+ public:
+  explicit HttpCallRetryBudget(uint32_t budget_percent)
+      : budget_percent_(budget_percent) {}
+
+  void onCallStart() { active_calls_++; }
+  void onCallFinish() { active_calls_--; }
+
+  // Returns true if one more call can start retrying. The caller must call
+  // onRetryFinish() once it stops retrying.
+  bool tryStartRetry();
+  void onRetryFinish() { retrying_calls_--; }
+
+ private:
+  const uint32_t budget_percent_;
+  uint64_t active_calls_{};
+  uint64_t retrying_calls_{};
+};
+
+// An endpoint the calls of a HttpCallFactoryImpl can be sent to.
+struct HttpCallEndpoint {
+  HttpCallEndpoint(const ::espv2::api::envoy::v10::http::common::HttpUri& uri,
+                   const std::string& suffix_url);
+
+  std::string cluster;
+  // The uri of the calls, and its host and path.
+  std::string uri;
+  std::string host;
+  std::string path;
+};
+
+// The selection of the endpoint of each request of a HttpCallFactoryImpl.
+struct HttpCallEndpointSelection {
+  // The number of consecutive failures after which an endpoint is ejected.
+  // The endpoints are never ejected if it is 0.
+  uint32_t ejection_failures;
+  // The time an ejected endpoint gets no requests, unless all are ejected.
+  uint32_t ejection_duration_ms;
+};
+
+// Picks the endpoint of each request of a HttpCallFactoryImpl: the one with
+// the lowest moving average of its recent latencies, among those that are not
+// ejected for their consecutive failures.
+class HttpCallEndpointSelector {
+ public:
+  HttpCallEndpointSelector(size_t endpoints,
+                           const HttpCallEndpointSelection& selection,
+                           Envoy::TimeSource& time_source);
+
+  // Returns the index of the endpoint of the next request.
+  size_t pick();
+
+  // Records the latency of a successful request to the endpoint.
+  void onSuccess(size_t endpoint, std::chrono::milliseconds latency);
+  // Records a network failure or a server error of a request to the endpoint.
+  void onFailure(size_t endpoint);
+
+ private:
+  struct EndpointState {
+    // The moving average of the latencies. Not set until one is recorded.
+    absl::optional<double> latency_ms;
+    uint32_t consecutive_failures{};
+    Envoy::MonotonicTime ejected_until;
+  };
+
+  const uint32_t ejection_failures_;
+  const std::chrono::milliseconds ejection_duration_;
+  Envoy::TimeSource& time_source_;
+  std::vector<EndpointState> endpoints_;
+  // The number of requests picked, to probe the other endpoints now and then.
+  uint64_t picks_{};
+};
+
+// The span names of the requests of the calls of a HttpCallFactoryImpl, built
+// once rather than for each retry.
+class HttpCallSpanNames {
+ public:
+  HttpCallSpanNames(const std::string& operation_name, uint32_t retries);
+
+  // Returns the span name of the `attempt`th request of a call, from 1.
+  const std::string& attempt(uint32_t attempt) const {
+    return attempts_[std::min<size_t>(attempt, attempts_.size()) - 1];
+  }
+  const std::string& hedge() const { return hedge_; }
+  const std::string& operation() const { return attempts_.front(); }
+
+ private:
+  // The first request, then the retries.
+  std::vector<std::string> attempts_;
+  std::string hedge_;
 };
 
 class HttpCallFactory
@@ -47,17 +270,29 @@ class HttpCallFactory
                                    Envoy::Tracing::Span& parent_span,
                                    HttpCall::DoneFunc on_done) PURE;
 
+  // Creates a call with a body already serialized, shared with the caller
+  // instead of serialized again.
+  virtual HttpCall* createSerializedHttpCall(
+      std::shared_ptr<const std::string> body,
+      Envoy::Tracing::Span& parent_span, HttpCall::DoneFunc on_done) PURE;
+
+  // Returns the number of calls created and not finished yet.
+  virtual size_t activeCalls() const PURE;
+
   virtual ~HttpCallFactory(){};
 };
 
+class HttpCallImpl;
+
 class HttpCallFactoryImpl : public HttpCallFactory {
  public:
   HttpCallFactoryImpl(Envoy::Upstream::ClusterManager& cm,
                       Envoy::Event::Dispatcher& dispatcher,
                       const ::espv2::api::envoy::v10::http::common::HttpUri& uri,
                       const std::string& suffix_url,
-                      std::function<const std::string&()> token_fn,
+                      std::function<const std::string&()> authorization_fn,
                       uint32_t timeout_ms, uint32_t retries,
+                      const HttpCallRetryPolicy& retry_policy,
                       Envoy::TimeSource& time_source,
                       const std::string& trace_operation_name);
 
@@ -65,33 +300,152 @@ class HttpCallFactoryImpl : public HttpCallFactory {
                            Envoy::Tracing::Span& parent_span,
                            HttpCall::DoneFunc on_done);
 
+  HttpCall* createSerializedHttpCall(std::shared_ptr<const std::string> body,
+                                     Envoy::Tracing::Span& parent_span,
+                                     HttpCall::DoneFunc on_done) override;
+
+  size_t activeCalls() const override { return active_calls_.size(); }
+
   ~HttpCallFactoryImpl();
 
+  // Compresses the request bodies of the calls created after this.
+  void enableCompression(const HttpCallCompression& compression) {
+    compression_.emplace(compression);
+  }
+
+  // Records the stats of the calls created after this.
+  void enableStats(const HttpCallStats& stats) { stats_.emplace(stats); }
+
+  // Hedges the calls created after this. A hedge holds a retry from the
+  // retry budget.
+  void enableHedging(const HttpCallHedging& hedging) {
+    hedging_.emplace(hedging);
+    latency_tracker_ = std::make_unique<HttpCallLatencyTracker>(hedging);
+  }
+
+  // Does not trace the calls created after this.
+  void disableTracing() { tracing_enabled_ = false; }
+
+  // Sends each request to the fastest of the uri and the additional uris,
+  // with the same suffix url, instead of the uri. Must be called before any
+  // call is created.
+  void enableEndpointSelection(
+      const std::vector<::espv2::api::envoy::v10::http::common::HttpUri>&
+          additional_uris,
+      const HttpCallEndpointSelection& selection);
+
+  // Opens the connections of each endpoint now, with requests whose
+  // responses are dropped, and again every keep-alive interval without a
+  // call, so the first calls don't wait on the DNS resolution and the TCP and
+  // TLS handshakes. The warm-up is skipped while the cluster is not there
+  // yet.
+  void enableWarmUp(const HttpCallWarmUp& warm_up);
+
+  // Keeps up to `call_pool_size` finished calls to reuse for the new ones,
+  // saving their allocation and that of their body. Must be called before
+  // any call is created.
+  void enableCallPool(uint32_t call_pool_size);
+
  private:
+  friend class HttpCallImpl;
+
+  // Returns a call to start, from the pool or new.
+  HttpCallImpl* newCall();
+  // Records the started call as active.
+  HttpCall* addCall(HttpCallImpl* http_call, HttpCall::DoneFunc on_done);
+
+  // Sends the warm-up requests that are not in flight.
+  void warmUp();
+
+  // Drops the responses of the warm-up requests.
+  class WarmUpCallbacks : public Envoy::Http::AsyncClient::Callbacks {
+   public:
+    explicit WarmUpCallbacks(HttpCallFactoryImpl& factory)
+        : factory_(factory) {}
+
+    void onSuccess(const Envoy::Http::AsyncClient::Request& request,
+                   Envoy::Http::ResponseMessagePtr&&) override {
+      factory_.warm_up_requests_.erase(
+          const_cast<Envoy::Http::AsyncClient::Request*>(&request));
+    }
+    void onFailure(const Envoy::Http::AsyncClient::Request& request,
+                   Envoy::Http::AsyncClient::FailureReason) override {
+      factory_.warm_up_requests_.erase(
+          const_cast<Envoy::Http::AsyncClient::Request*>(&request));
+    }
+    void onBeforeFinalizeUpstreamSpan(
+        Envoy::Tracing::Span&, const Envoy::Http::ResponseHeaderMap*) override {
+    }
+
+   private:
+    HttpCallFactoryImpl& factory_;
+  };
+
+  // Takes back a finished call, to reuse or delete.
+  void releaseCall(HttpCallImpl* call);
+  // Keeps the released calls the pool has room for, and deletes the others.
+  void recycleCalls();
+
   // all active calls generated by this factory
-  absl::flat_hash_set<HttpCall*> active_calls_;
+  ActiveHttpCalls active_calls_;
 
   // envoy upstream
   Envoy::Upstream::ClusterManager& cm_;
   Envoy::Event::Dispatcher& dispatcher_;
 
-  // call uri address
-  const ::espv2::api::envoy::v10::http::common::HttpUri uri_;
+  // The endpoints of the calls, the uri first. Must outlive the calls.
+  std::vector<HttpCallEndpoint> endpoints_;
   const std::string suffix_url_;
+  // Picks the endpoint of each request. Null if there is one endpoint.
+  std::unique_ptr<HttpCallEndpointSelector> endpoint_selector_;
 
-  // token getter
-  std::function<const std::string&()> token_fn_;
+  // Returns the Authorization header value of the calls, built once per
+  // token. Empty if there is no token yet.
+  std::function<const std::string&()> authorization_fn_;
 
   // call setting
   uint32_t timeout_ms_;
   uint32_t retries_;
+  const HttpCallRetryPolicy retry_policy_;
+
+  // The retry budget shared by the calls. Must outlive them.
+  HttpCallRetryBudget retry_budget_;
 
-  // whether the factory is being destructed
-  bool destruct_mode_;
+  // The random generator for the backoff jitter.
+  Envoy::Random::RandomGeneratorImpl random_;
+
+  // The request body compression. Disabled if not set.
+  absl::optional<HttpCallCompression> compression_;
+
+  // The stats of the calls. Disabled if not set.
+  absl::optional<HttpCallStats> stats_;
+
+  // The hedging of the calls, and the latencies it is derived from. Disabled
+  // if not set. Must outlive the calls.
+  absl::optional<HttpCallHedging> hedging_;
+  std::unique_ptr<HttpCallLatencyTracker> latency_tracker_;
 
   // tracing related
   Envoy::TimeSource& time_source_;
-  const std::string trace_operation_name_;
+  const HttpCallSpanNames span_names_;
+  bool tracing_enabled_ = true;
+
+  // The warm-up of the connections. Disabled if not set.
+  absl::optional<HttpCallWarmUp> warm_up_;
+  WarmUpCallbacks warm_up_callbacks_{*this};
+  // The warm-up requests in flight, cancelled with the factory.
+  absl::flat_hash_set<Envoy::Http::AsyncClient::Request*> warm_up_requests_;
+  Envoy::Event::TimerPtr warm_up_timer_;
+  // Whether a call was created since the last warm-up.
+  bool called_since_warm_up_ = false;
+
+  // The finished calls kept for reuse, and those released since the last
+  // event loop iteration. Destroyed first, they reference the members above.
+  // No call is pooled if the pool size is 0.
+  uint32_t call_pool_size_ = 0;
+  Envoy::Event::SchedulableCallbackPtr recycle_cb_;
+  std::vector<std::unique_ptr<HttpCallImpl>> released_calls_;
+  std::vector<std::unique_ptr<HttpCallImpl>> free_calls_;
 };
 
 }  // namespace service_control
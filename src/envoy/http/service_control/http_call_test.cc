@@ -44,6 +44,7 @@ using ::testing::ByMove;
 using ::testing::Invoke;
 using ::testing::MockFunction;
 using ::testing::Return;
+using ::testing::ReturnNew;
 
 using ::Envoy::Http::ResponseMessageImpl;
 using ::espv2::api::envoy::v10::http::common::HttpUri;
@@ -57,11 +58,12 @@ class HttpCallTest : public testing::Test {
  protected:
   HttpCallTest()
       : async_callbacks_(),
-        fake_token_("fake-token-value"),
+        fake_token_("Bearer fake-token-value"),
         fake_trace_operation_name_("fake-trace-operation-name"),
         fake_suffix_url_("fake-suffix-url"),
         timeout_ms_(5000),
-        retries_(0) {}
+        retries_(0),
+        retry_policy_({0, 0, 0}) {}
 
   void SetUp() override {
     http_uri_.set_cluster("test_cluster");
@@ -72,18 +74,28 @@ class HttpCallTest : public testing::Test {
     ON_CALL(thread_local_cluster_, httpAsyncClient())
         .WillByDefault(ReturnRef(http_client_));
     ON_CALL(http_client_, send_(_, _, _))
-        .WillByDefault(
-            Invoke([this](Envoy::Http::RequestMessagePtr& message_ptr,
-                          Envoy::Http::AsyncClient::Callbacks& callbacks,
-                          const Envoy::Http::AsyncClient::RequestOptions)
-                       -> Envoy::Http::AsyncClient::Request* {
+        .WillByDefault(Invoke(
+            [this](Envoy::Http::RequestMessagePtr& message_ptr,
+                   Envoy::Http::AsyncClient::Callbacks& callbacks,
+                   const Envoy::Http::AsyncClient::RequestOptions options)
+                -> Envoy::Http::AsyncClient::Request* {
               // Check token is correctly set
               auto token_header = message_ptr->headers().get(
                   Envoy::Http::CustomHeaders::get().Authorization);
               EXPECT_EQ(token_header[0]->value().getStringView(),
-                        "Bearer " + fake_token_);
+                        fake_token_);
 
               // Make callback and request
+              request_bodies_.push_back(message_ptr->body().toString());
+              request_hosts_.push_back(
+                  std::string(message_ptr->headers().getHostValue()));
+              const auto encoding = message_ptr->headers().get(
+                  Envoy::Http::CustomHeaders::get().ContentEncoding);
+              request_encodings_.push_back(
+                  encoding.empty()
+                      ? ""
+                      : std::string(encoding[0]->value().getStringView()));
+              request_timeouts_.push_back(options.timeout);
               async_callbacks_.push_back(&callbacks);
               auto request = new NiceMock<Envoy::Http::MockAsyncClientRequest>(
                   &http_client_);
@@ -96,7 +108,8 @@ class HttpCallTest : public testing::Test {
     fake_request_ = CheckRequest{};
     http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
         cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
-        timeout_ms_, retries_, mock_time_source_, fake_trace_operation_name_);
+        timeout_ms_, retries_, retry_policy_, mock_time_source_,
+        fake_trace_operation_name_);
   }
 
   void TearDown() override {
@@ -139,7 +152,7 @@ class HttpCallTest : public testing::Test {
 
   // Callback for HttpCall. Expectations must be set by each test
   MockFunction<void(const ::google::protobuf::util::Status& status,
-                    const std::string& response_body)>
+                    Envoy::Buffer::Instance& response_body)>
       mock_done_fn_;
 
   // Underlying http client mocks
@@ -152,6 +165,10 @@ class HttpCallTest : public testing::Test {
   // Keep track of all underlying http client callbacks and http requests
   std::vector<Envoy::Http::AsyncClient::Callbacks*> async_callbacks_;
   std::vector<Envoy::Http::MockAsyncClientRequest*> http_requests_;
+  std::vector<std::string> request_bodies_;
+  std::vector<std::string> request_hosts_;
+  std::vector<std::string> request_encodings_;
+  std::vector<absl::optional<std::chrono::milliseconds>> request_timeouts_;
 
   // Token
   std::string fake_token_;
@@ -167,6 +184,7 @@ class HttpCallTest : public testing::Test {
   std::string fake_suffix_url_;
   uint32_t timeout_ms_;
   uint32_t retries_;
+  HttpCallRetryPolicy retry_policy_;
 
   std::unique_ptr<HttpCallFactoryImpl> http_call_factory_;
 };
@@ -190,6 +208,136 @@ TEST_F(HttpCallTest, TestSingleCallSuccessHttpOk) {
                                  makeResponseWithStatus(200));
 }
 
+TEST_F(HttpCallTest, TestUntracedRequestNoSpan) {
+  // The requests that are not traced have the null span.
+  EXPECT_CALL(mock_parent_span_, spawnChild_(_, _, _)).Times(0);
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, Envoy::Tracing::NullSpan::instance(),
+      mock_done_fn_.AsStdFunction());
+  call->call();
+  EXPECT_EQ(1, http_requests_.size());
+
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+}
+
+TEST_F(HttpCallTest, TestTracingDisabledNoSpan) {
+  http_call_factory_->disableTracing();
+  EXPECT_CALL(mock_parent_span_, spawnChild_(_, _, _)).Times(0);
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->call();
+
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+}
+
+TEST(HttpCallSpanNamesTest, NamesOfAttempts) {
+  HttpCallSpanNames names("op", 2);
+  EXPECT_EQ(names.operation(), "op");
+  EXPECT_EQ(names.attempt(1), "op");
+  EXPECT_EQ(names.attempt(2), "op - Retry 1");
+  EXPECT_EQ(names.attempt(3), "op - Retry 2");
+  EXPECT_EQ(names.hedge(), "op - Hedge");
+}
+
+TEST(HttpCallEndpointSelectorTest, PicksFastestEndpoint) {
+  NiceMock<Envoy::MockTimeSystem> time_source;
+  HttpCallEndpointSelector selector(3, {0, 0}, time_source);
+
+  // The endpoints with no latency are tried first.
+  EXPECT_EQ(selector.pick(), 0);
+  selector.onSuccess(0, std::chrono::milliseconds(100));
+  EXPECT_EQ(selector.pick(), 1);
+  selector.onSuccess(1, std::chrono::milliseconds(20));
+  EXPECT_EQ(selector.pick(), 2);
+  selector.onSuccess(2, std::chrono::milliseconds(50));
+  EXPECT_EQ(selector.pick(), 1);
+
+  // The average follows the recent latencies.
+  for (int i = 0; i < 10; ++i) {
+    selector.onSuccess(1, std::chrono::milliseconds(200));
+  }
+  EXPECT_EQ(selector.pick(), 2);
+}
+
+TEST(HttpCallEndpointSelectorTest, EjectsFailingEndpoint) {
+  NiceMock<Envoy::MockTimeSystem> time_source;
+  Envoy::MonotonicTime now;
+  ON_CALL(time_source, monotonicTime())
+      .WillByDefault(Invoke([&now]() { return now; }));
+  HttpCallEndpointSelector selector(2, {2, 1000}, time_source);
+  selector.onSuccess(0, std::chrono::milliseconds(10));
+  selector.onSuccess(1, std::chrono::milliseconds(50));
+
+  // A success resets the consecutive failures.
+  selector.onFailure(0);
+  selector.onSuccess(0, std::chrono::milliseconds(10));
+  selector.onFailure(0);
+  EXPECT_EQ(selector.pick(), 0);
+
+  selector.onFailure(0);
+  EXPECT_EQ(selector.pick(), 1);
+
+  // Once ejected all, the first endpoint to return is used.
+  now += std::chrono::milliseconds(100);
+  selector.onFailure(1);
+  selector.onFailure(1);
+  EXPECT_EQ(selector.pick(), 0);
+
+  // The returned endpoint is tried again first.
+  now += std::chrono::milliseconds(1000);
+  EXPECT_EQ(selector.pick(), 0);
+}
+
+TEST_F(HttpCallTest, TestRetryGoesToOtherEndpoint) {
+  retries_ = 1;
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+  HttpUri other_uri;
+  other_uri.set_cluster("other_cluster");
+  other_uri.set_uri("http://other_host/test_path");
+  http_call_factory_->enableEndpointSelection({other_uri}, {1, 1000});
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->call();
+
+  // The failed endpoint is ejected, the retry goes to the other one.
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(503));
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  async_callbacks_[1]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+  EXPECT_EQ(request_hosts_,
+            std::vector<std::string>({"test_host", "other_host"}));
+}
+
+TEST_F(HttpCallTest, TestSingleCallSuccessWithBody) {
+  // Phase 1: Create HttpCall and send the request
+  auto mock_child_span = makeMockChildSpan();
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->call();
+
+  // Phase 2: Emulate successful http response, the body is passed through
+  EXPECT_CALL(*mock_child_span, finishSpan()).Times(1);
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _))
+      .WillOnce(Invoke([](const Status&, Envoy::Buffer::Instance& body) {
+        EXPECT_EQ(body.toString(), "response-body");
+      }));
+
+  auto response = makeResponseWithStatus(200);
+  response->body().add("response-body");
+  async_callbacks_[0]->onSuccess(lastHttpRequest(), std::move(response));
+}
+
 TEST_F(HttpCallTest, TestSingleCallSuccessHttpNotFound) {
   // Phase 1: Create HttpCall and send the request
   auto mock_child_span = makeMockChildSpan();
@@ -234,8 +382,8 @@ TEST_F(HttpCallTest, TestSingleCallFailure) {
       Call(Status(StatusCode::kInternal, "Failed to call service control"), _))
       .Times(1);
 
-  async_callbacks_[0]->onFailure(
-      lastHttpRequest(), Envoy::Http::AsyncClient::FailureReason::Reset);
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
 }
 
 TEST_F(HttpCallTest, TestEmptyTokenCallFailure) {
@@ -259,7 +407,8 @@ TEST_F(HttpCallTest, TestRetryCallSuccess) {
   retries_ = 2;
   http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
       cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
-      timeout_ms_, retries_, mock_time_source_, fake_trace_operation_name_);
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
   // Phase 1: Create HttpCall and send the request
   auto mock_child_span_1 = makeMockChildSpan();
   EXPECT_CALL(mock_done_fn_, Call(_, _))
@@ -293,12 +442,42 @@ TEST_F(HttpCallTest, TestRetryCallSuccess) {
                                  makeResponseWithStatus(200));
 }
 
+TEST_F(HttpCallTest, TestRetrySendsSameBody) {
+  retries_ = 1;
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+  fake_request_.set_service_name("test-service");
+
+  auto mock_child_span_1 = makeMockChildSpan();
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->call();
+
+  EXPECT_CALL(*mock_child_span_1, finishSpan()).Times(1);
+  auto mock_child_span_2 = makeMockChildSpan();
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(503));
+
+  // Both attempts send the serialized request.
+  ASSERT_EQ(2, request_bodies_.size());
+  EXPECT_EQ(request_bodies_[0], fake_request_.SerializeAsString());
+  EXPECT_EQ(request_bodies_[1], fake_request_.SerializeAsString());
+
+  EXPECT_CALL(*mock_child_span_2, finishSpan()).Times(1);
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  async_callbacks_[1]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+}
+
 TEST_F(HttpCallTest, TestThreeRetriesWithLastSuccess) {
   // Set request to retry 2 more times
   retries_ = 2;
   http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
       cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
-      timeout_ms_, retries_, mock_time_source_, fake_trace_operation_name_);
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
 
   // Phase 1: Create HttpCall and send the request
   auto mock_child_span_1 = makeMockChildSpan();
@@ -339,7 +518,8 @@ TEST_F(HttpCallTest, TestThreeRetriesWithLastFailure) {
   retries_ = 2;
   http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
       cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
-      timeout_ms_, retries_, mock_time_source_, fake_trace_operation_name_);
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
 
   // Phase 1: Create HttpCall and send the request
   auto mock_child_span_1 = makeMockChildSpan();
@@ -378,6 +558,460 @@ TEST_F(HttpCallTest, TestThreeRetriesWithLastFailure) {
                                  makeResponseWithStatus(504));
 }
 
+TEST_F(HttpCallTest, TestRetryWithBackoff) {
+  // Set request to retry once after a backoff
+  retries_ = 1;
+  retry_policy_ = {100, 1000, 0};
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+
+  // Phase 1: Create HttpCall and send the request
+  auto mock_child_span_1 = makeMockChildSpan();
+  EXPECT_CALL(mock_done_fn_, Call(_, _))
+      .Times(0);  // Callback does not occur until response
+
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->call();
+  EXPECT_EQ(1, async_callbacks_.size());
+
+  // Phase 2: Emulate a bad status code, the retry waits for the backoff
+  auto* retry_timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  EXPECT_CALL(*retry_timer, enableTimer(_, _)).Times(1);
+  EXPECT_CALL(*mock_child_span_1, finishSpan()).Times(1);
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(503));
+  EXPECT_EQ(1, async_callbacks_.size());
+
+  // Phase 3: Retry when the backoff timer fires
+  auto mock_child_span_2 = makeMockChildSpan();
+  retry_timer->invokeCallback();
+  EXPECT_EQ(2, async_callbacks_.size());
+
+  // Phase 4: Emulate successful http response on the retry
+  EXPECT_CALL(*mock_child_span_2, finishSpan()).Times(1);
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  async_callbacks_[1]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+}
+
+TEST_F(HttpCallTest, TestCancelDuringBackoff) {
+  retries_ = 1;
+  retry_policy_ = {100, 1000, 0};
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+
+  auto mock_child_span_1 = makeMockChildSpan();
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->call();
+
+  auto* retry_timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  EXPECT_CALL(*mock_child_span_1, finishSpan()).Times(1);
+  async_callbacks_[0]->onFailure(
+      lastHttpRequest(), Envoy::Http::AsyncClient::FailureReason::Reset);
+
+  // The pending retry is dropped and the callback is called once.
+  EXPECT_CALL(*retry_timer, disableTimer()).Times(1);
+  EXPECT_CALL(mock_done_fn_, Call(Status(StatusCode::kCancelled,
+                                         "Request cancelled"),
+                                  _))
+      .Times(1);
+  call->cancel();
+  EXPECT_EQ(1, async_callbacks_.size());
+}
+
+TEST_F(HttpCallTest, TestRetryBudgetExhausted) {
+  // Allow 10% of the active calls to retry, but at least 3.
+  retries_ = 1;
+  retry_policy_ = {0, 0, 10};
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(0);
+
+  // Phase 1: Send 4 requests
+  for (int i = 0; i < 4; ++i) {
+    http_call_factory_
+        ->createHttpCall(fake_request_, mock_parent_span_,
+                         mock_done_fn_.AsStdFunction())
+        ->call();
+  }
+  EXPECT_EQ(4, async_callbacks_.size());
+
+  // Phase 2: The first 3 failed requests are retried
+  for (int i = 0; i < 3; ++i) {
+    async_callbacks_[i]->onSuccess(*http_requests_[i],
+                                   makeResponseWithStatus(503));
+  }
+  EXPECT_EQ(7, async_callbacks_.size());
+
+  // Phase 3: The budget is exhausted, the 4th failed request is not retried
+  EXPECT_CALL(
+      mock_done_fn_,
+      Call(Status(StatusCode::kUnavailable,
+                  "Calling Google Service Control API failed with: 503"),
+           _))
+      .Times(1);
+  async_callbacks_[3]->onSuccess(*http_requests_[3],
+                                 makeResponseWithStatus(503));
+  EXPECT_EQ(7, async_callbacks_.size());
+
+  // Phase 4: The pending retries are cancelled with the factory
+  EXPECT_CALL(mock_done_fn_,
+              Call(Status(StatusCode::kCancelled, "Request cancelled"), _))
+      .Times(3);
+  http_call_factory_.reset();
+}
+
+TEST_F(HttpCallTest, TestDeadlineCapsTimeoutAndRetries) {
+  retries_ = 3;
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+  Envoy::MonotonicTime now;
+  ON_CALL(mock_time_source_, monotonicTime())
+      .WillByDefault(Invoke([&now]() { return now; }));
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+
+  // Phase 1: The timeout is capped to the time left before the deadline
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->setDeadline(now + std::chrono::milliseconds(100));
+  call->call();
+  ASSERT_EQ(1, request_timeouts_.size());
+  EXPECT_EQ(request_timeouts_[0], std::chrono::milliseconds(100));
+
+  // Phase 2: The retry gets the time left
+  now += std::chrono::milliseconds(60);
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(503));
+  ASSERT_EQ(2, request_timeouts_.size());
+  EXPECT_EQ(request_timeouts_[1], std::chrono::milliseconds(40));
+
+  // Phase 3: No retry once the deadline passed
+  now += std::chrono::milliseconds(40);
+  EXPECT_CALL(
+      mock_done_fn_,
+      Call(Status(StatusCode::kUnavailable,
+                  "Calling Google Service Control API failed with: 503"),
+           _))
+      .Times(1);
+  async_callbacks_[1]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(503));
+  EXPECT_EQ(2, request_timeouts_.size());
+}
+
+TEST_F(HttpCallTest, TestDeadlineExceededBeforeCall) {
+  Envoy::MonotonicTime now;
+  ON_CALL(mock_time_source_, monotonicTime()).WillByDefault(Return(now));
+
+  EXPECT_CALL(mock_done_fn_,
+              Call(Status(StatusCode::kUnavailable,
+                          "Request deadline exceeded before calling service "
+                          "control"),
+                   _))
+      .Times(1);
+  HttpCall* call = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  call->setDeadline(now);
+  call->call();
+  EXPECT_EQ(0, http_requests_.size());
+}
+
+TEST_F(HttpCallTest, TestCallStats) {
+  retries_ = 1;
+  http_call_factory_ = std::make_unique<HttpCallFactoryImpl>(
+      cm_, dispatcher_, http_uri_, fake_suffix_url_, fake_token_fn_,
+      timeout_ms_, retries_, retry_policy_, mock_time_source_,
+      fake_trace_operation_name_);
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> stats_store;
+  ServiceControlFilterStats stats =
+      ServiceControlFilterStats::create("test.", stats_store);
+  http_call_factory_->enableStats(stats.check_call_);
+  Envoy::MonotonicTime now;
+  ON_CALL(mock_time_source_, monotonicTime())
+      .WillByDefault(Invoke([&now]() { return now; }));
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+
+  // Phase 1: The call is in flight until its retry succeeds
+  http_call_factory_
+      ->createHttpCall(fake_request_, mock_parent_span_,
+                       mock_done_fn_.AsStdFunction())
+      ->call();
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 1);
+  now += std::chrono::milliseconds(10);
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(503));
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 1);
+
+  // Phase 2: The latency and the attempts of the whole call are recorded
+  now += std::chrono::milliseconds(20);
+  EXPECT_CALL(stats_store,
+              deliverHistogramToSinks(
+                  testing::Property(&Envoy::Stats::Metric::name,
+                                    "test.service_control.check.latency"),
+                  30));
+  EXPECT_CALL(stats_store,
+              deliverHistogramToSinks(
+                  testing::Property(&Envoy::Stats::Metric::name,
+                                    "test.service_control.check.attempts"),
+                  2));
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  async_callbacks_[1]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 0);
+}
+
+TEST_F(HttpCallTest, TestFinishedCallReused) {
+  auto* recycle_cb =
+      new NiceMock<Envoy::Event::MockSchedulableCallback>(&dispatcher_);
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> stats_store;
+  ServiceControlFilterStats stats =
+      ServiceControlFilterStats::create("test.", stats_store);
+  http_call_factory_->enableStats(stats.check_call_);
+  http_call_factory_->enableCallPool(/*call_pool_size=*/1);
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(2);
+
+  // Phase 1: The finished call is recycled in the next event loop iteration
+  HttpCall* first = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  first->call();
+  async_callbacks_[0]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+  EXPECT_TRUE(recycle_cb->enabled());
+  recycle_cb->invokeCallback();
+
+  // Phase 2: The next call reuses it, with its own body
+  fake_request_.set_service_name("other_service");
+  HttpCall* second = http_call_factory_->createHttpCall(
+      fake_request_, mock_parent_span_, mock_done_fn_.AsStdFunction());
+  EXPECT_EQ(second, first);
+  EXPECT_EQ(stats.check_call_.call_pool_hit_.value(), 1);
+  second->call();
+  EXPECT_EQ(request_bodies_[1], fake_request_.SerializeAsString());
+  async_callbacks_[1]->onSuccess(lastHttpRequest(),
+                                 makeResponseWithStatus(200));
+  EXPECT_EQ(stats.check_call_.in_flight_.value(), 0);
+}
+
+TEST_F(HttpCallTest, TestWarmUp) {
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  EXPECT_CALL(http_client_, send_(_, _, _))
+      .Times(4)
+      .WillRepeatedly(Invoke(
+          [this](Envoy::Http::RequestMessagePtr& message_ptr,
+                 Envoy::Http::AsyncClient::Callbacks& callbacks,
+                 const Envoy::Http::AsyncClient::RequestOptions&)
+              -> Envoy::Http::AsyncClient::Request* {
+            // No body, nor token.
+            EXPECT_EQ(message_ptr->headers().getMethodValue(), "HEAD");
+            EXPECT_EQ(message_ptr->headers().getHostValue(), "test_host");
+            EXPECT_EQ(message_ptr->body().length(), 0);
+            async_callbacks_.push_back(&callbacks);
+            http_requests_.push_back(
+                new NiceMock<Envoy::Http::MockAsyncClientRequest>(
+                    &http_client_));
+            return http_requests_.back();
+          }));
+
+  // Phase 1: The connections are opened right away
+  http_call_factory_->enableWarmUp({2, std::chrono::milliseconds(1000)});
+  EXPECT_EQ(async_callbacks_.size(), 2);
+  EXPECT_TRUE(timer->enabled());
+
+  // Phase 2: Not sent again while they are in flight
+  timer->invokeCallback();
+  EXPECT_EQ(async_callbacks_.size(), 2);
+  async_callbacks_[0]->onSuccess(*http_requests_[0],
+                                 makeResponseWithStatus(404));
+  async_callbacks_[1]->onFailure(
+      *http_requests_[1], Envoy::Http::AsyncClient::FailureReason::Reset);
+
+  // Phase 3: Sent again after an interval without a call, and cancelled with
+  // the factory
+  timer->invokeCallback();
+  EXPECT_EQ(async_callbacks_.size(), 4);
+  EXPECT_CALL(*http_requests_[2], cancel());
+  EXPECT_CALL(*http_requests_[3], cancel());
+  http_call_factory_.reset();
+}
+
+TEST_F(HttpCallTest, TestCompressedBody) {
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> stats_store;
+  ServiceControlFilterStats stats =
+      ServiceControlFilterStats::create("test", stats_store);
+  http_call_factory_->enableCompression({6, 10, stats.report_compression_});
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+
+  // Small requests are not compressed.
+  http_call_factory_
+      ->createHttpCall(fake_request_, mock_parent_span_,
+                       mock_done_fn_.AsStdFunction())
+      ->call();
+  EXPECT_EQ(request_encodings_[0], "");
+  EXPECT_EQ(request_bodies_[0], fake_request_.SerializeAsString());
+
+  fake_request_.set_service_name(std::string(100, 'a'));
+  http_call_factory_
+      ->createHttpCall(fake_request_, mock_parent_span_,
+                       mock_done_fn_.AsStdFunction())
+      ->call();
+  EXPECT_EQ(request_encodings_[1], "gzip");
+  // The gzip magic number.
+  EXPECT_EQ(request_bodies_[1].substr(0, 2), "\x1f\x8b");
+  EXPECT_LT(request_bodies_[1].size(), fake_request_.ByteSizeLong());
+
+  EXPECT_EQ(stats.report_compression_.uncompressed_.value(), 1);
+  EXPECT_EQ(stats.report_compression_.compressed_.value(), 1);
+  EXPECT_EQ(stats.report_compression_.raw_bytes_.value(),
+            fake_request_.ByteSizeLong());
+  EXPECT_EQ(stats.report_compression_.compressed_bytes_.value(),
+            request_bodies_[1].size());
+
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(2);
+  http_call_factory_.reset();
+}
+
+TEST_F(HttpCallTest, TestSerializedBody) {
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> stats_store;
+  ServiceControlFilterStats stats =
+      ServiceControlFilterStats::create("test", stats_store);
+  http_call_factory_->enableCompression({6, 10, stats.report_compression_});
+  ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+      .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+
+  // The body is sent as it is, and still shared by the caller.
+  auto small_body =
+      std::make_shared<const std::string>(fake_request_.SerializeAsString());
+  http_call_factory_
+      ->createSerializedHttpCall(small_body, mock_parent_span_,
+                                 mock_done_fn_.AsStdFunction())
+      ->call();
+  EXPECT_EQ(request_encodings_[0], "");
+  EXPECT_EQ(request_bodies_[0], *small_body);
+
+  // The compressed body does not change the shared one.
+  fake_request_.set_service_name(std::string(100, 'a'));
+  auto large_body =
+      std::make_shared<const std::string>(fake_request_.SerializeAsString());
+  http_call_factory_
+      ->createSerializedHttpCall(large_body, mock_parent_span_,
+                                 mock_done_fn_.AsStdFunction())
+      ->call();
+  EXPECT_EQ(request_encodings_[1], "gzip");
+  EXPECT_EQ(request_bodies_[1].substr(0, 2), "\x1f\x8b");
+  EXPECT_EQ(*large_body, fake_request_.SerializeAsString());
+  EXPECT_EQ(stats.report_compression_.raw_bytes_.value(), large_body->size());
+
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(2);
+  http_call_factory_.reset();
+}
+
+class HttpCallHedgingTest : public HttpCallTest {
+ protected:
+  void SetUp() override {
+    HttpCallTest::SetUp();
+    // The latencies are all 0, so calls are hedged after the minimum delay.
+    ON_CALL(mock_time_source_, monotonicTime())
+        .WillByDefault(Return(Envoy::MonotonicTime()));
+    ON_CALL(mock_parent_span_, spawnChild_(_, _, _))
+        .WillByDefault(ReturnNew<NiceMock<Envoy::Tracing::MockSpan>>());
+    http_call_factory_->enableHedging(
+        {50, 20, 0, stats_.filter_.check_hedged_,
+         stats_.filter_.check_hedge_won_});
+
+    // Record enough latencies to derive the hedging delay.
+    EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(16);
+    for (int i = 0; i < 16; ++i) {
+      http_call_factory_
+          ->createHttpCall(fake_request_, mock_parent_span_,
+                           mock_done_fn_.AsStdFunction())
+          ->call();
+      async_callbacks_.back()->onSuccess(lastHttpRequest(),
+                                         makeResponseWithStatus(200));
+    }
+    testing::Mock::VerifyAndClearExpectations(&mock_done_fn_);
+  }
+
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> stats_store_;
+  ServiceControlFilterStats stats_{
+      ServiceControlFilterStats::create("test", stats_store_)};
+};
+
+TEST_F(HttpCallHedgingTest, TestHedgeWins) {
+  auto* hedge_timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  EXPECT_CALL(*hedge_timer, enableTimer(std::chrono::milliseconds(20), _))
+      .Times(1);
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(0);
+  http_call_factory_
+      ->createHttpCall(fake_request_, mock_parent_span_,
+                       mock_done_fn_.AsStdFunction())
+      ->call();
+  EXPECT_EQ(17, http_requests_.size());
+
+  // No response within the delay, the same request is sent again.
+  hedge_timer->invokeCallback();
+  EXPECT_EQ(18, http_requests_.size());
+  EXPECT_EQ(request_bodies_[16], request_bodies_[17]);
+  EXPECT_EQ(stats_.filter_.check_hedged_.value(), 1);
+
+  // The hedge answers first, the first request is cancelled.
+  EXPECT_CALL(*http_requests_[16], cancel()).Times(1);
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  async_callbacks_[17]->onSuccess(*http_requests_[17],
+                                  makeResponseWithStatus(200));
+  EXPECT_EQ(stats_.filter_.check_hedge_won_.value(), 1);
+}
+
+TEST_F(HttpCallHedgingTest, TestFailedHedgeWaitsForFirstRequest) {
+  auto* hedge_timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  EXPECT_CALL(mock_done_fn_, Call(_, _)).Times(0);
+  http_call_factory_
+      ->createHttpCall(fake_request_, mock_parent_span_,
+                       mock_done_fn_.AsStdFunction())
+      ->call();
+  hedge_timer->invokeCallback();
+  EXPECT_EQ(18, http_requests_.size());
+
+  // The failed hedge is neither retried nor reported.
+  async_callbacks_[17]->onSuccess(*http_requests_[17],
+                                  makeResponseWithStatus(503));
+  EXPECT_EQ(18, http_requests_.size());
+
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  async_callbacks_[16]->onSuccess(*http_requests_[16],
+                                  makeResponseWithStatus(200));
+  EXPECT_EQ(stats_.filter_.check_hedge_won_.value(), 0);
+}
+
+TEST_F(HttpCallHedgingTest, TestNoHedgeAfterResponse) {
+  auto* hedge_timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  EXPECT_CALL(*hedge_timer, disableTimer()).Times(AtLeast(1));
+  EXPECT_CALL(mock_done_fn_, Call(OkStatus(), _)).Times(1);
+  http_call_factory_
+      ->createHttpCall(fake_request_, mock_parent_span_,
+                       mock_done_fn_.AsStdFunction())
+      ->call();
+  async_callbacks_[16]->onSuccess(*http_requests_[16],
+                                  makeResponseWithStatus(200));
+  EXPECT_EQ(17, http_requests_.size());
+  EXPECT_EQ(stats_.filter_.check_hedged_.value(), 0);
+}
+
 TEST_F(HttpCallTest, TestActiveCallCancel) {
   // Phase 1: Create HttpCall and send the request
   auto mock_child_span = makeMockChildSpan();
@@ -0,0 +1,55 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/logs_metrics_cache.h"
+
+#include "absl/strings/str_cat.h"
+#include "src/api_proxy/service_control/logs_metrics_loader.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::espv2::api_proxy::service_control::LogsMetricsLoader;
+
+LogsMetricsCache::EntrySharedPtr LogsMetricsCache::get(
+    const std::string& service_name, const std::string& service_config_id,
+    const ::google::api::Service& service_config) {
+  // The config id only names a config within its service.
+  const std::string key = absl::StrCat(service_name, "/", service_config_id);
+  if (EntrySharedPtr entry = entries_[key].lock()) {
+    return entry;
+  }
+
+  // Drop the entries of the services no longer configured.
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.expired()) {
+      entries_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  auto entry = std::make_shared<Entry>();
+  (void)LogsMetricsLoader::Load(service_config, &entry->logs, &entry->metrics,
+                                &entry->labels);
+  entries_[key] = entry;
+  return entry;
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,59 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <set>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "envoy/singleton/instance.h"
+#include "google/api/service.pb.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// The logs, metrics and labels loaded from the service configs, shared by the
+// filter configs of a server. A config push builds new filter configs while
+// the old ones are still alive, so the services whose config id did not
+// change are not loaded again.
+// Must only be used on the main thread.
+class LogsMetricsCache : public Envoy::Singleton::Instance {
+ public:
+  struct Entry {
+    std::set<std::string> logs;
+    std::set<std::string> metrics;
+    std::set<std::string> labels;
+  };
+  using EntrySharedPtr = std::shared_ptr<const Entry>;
+
+  // Returns the entry of the service config, loading it if no one holds it.
+  // The entry is freed once its last holder is gone.
+  EntrySharedPtr get(const std::string& service_name,
+                     const std::string& service_config_id,
+                     const ::google::api::Service& service_config);
+
+ private:
+  absl::flat_hash_map<std::string, std::weak_ptr<const Entry>> entries_;
+};
+
+using LogsMetricsCacheSharedPtr = std::shared_ptr<LogsMetricsCache>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,69 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/logs_metrics_cache.h"
+
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::api::Service;
+using ::google::protobuf::TextFormat;
+using ::testing::ElementsAre;
+
+constexpr char kServiceConfig[] = R"(
+logs {
+  name: "endpoints_log"
+}
+monitored_resources {
+  type: "api"
+}
+logging {
+  producer_destinations {
+    monitored_resource: "api"
+    logs: "endpoints_log"
+  }
+})";
+
+TEST(LogsMetricsCacheTest, SharedWhileHeld) {
+  Service service_config;
+  ASSERT_TRUE(TextFormat::ParseFromString(kServiceConfig, &service_config));
+  LogsMetricsCache cache;
+
+  auto entry = cache.get("echo", "config-1", service_config);
+  EXPECT_THAT(entry->logs, ElementsAre("endpoints_log"));
+
+  // A config id already loaded is not loaded again.
+  EXPECT_EQ(cache.get("echo", "config-1", Service()), entry);
+
+  // Other config ids and services have their own entries.
+  EXPECT_NE(cache.get("echo", "config-2", service_config), entry);
+  EXPECT_NE(cache.get("echo111", "config-1", service_config), entry);
+
+  // The entry is loaded again once no one holds it.
+  entry.reset();
+  EXPECT_TRUE(cache.get("echo", "config-1", Service())->logs.empty());
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
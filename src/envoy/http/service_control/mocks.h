@@ -39,6 +39,16 @@ class MockServiceControlHandler : public ServiceControlHandler {
                const Envoy::Tracing::Span& parent_span),
               (override));
 
+  MOCK_METHOD(bool, forwardWhileChecking, (), (const, override));
+
+  MOCK_METHOD(absl::optional<std::chrono::milliseconds>, streamReportInterval,
+              (), (const, override));
+
+  MOCK_METHOD(void, callIntermediateReport,
+              (const Envoy::Http::RequestHeaderMap* request_headers,
+               const Envoy::Tracing::Span& parent_span),
+              (override));
+
   MOCK_METHOD(void, onDestroy, (), (override));
 
   MOCK_METHOD(void, fillFilterState,
@@ -50,8 +60,12 @@ class MockServiceControlHandlerFactory : public ServiceControlHandlerFactory {
   MOCK_METHOD(ServiceControlHandlerPtr, createHandler,
               (const Envoy::Http::RequestHeaderMap& headers,
                const Envoy::StreamInfo::StreamInfo& stream_info,
+               const PerRouteFilterConfig* per_route,
                ServiceControlFilterStats& filter_stats),
               (const, override));
+
+  MOCK_METHOD(void, releaseHandler, (ServiceControlHandlerPtr handler),
+              (const, override));
 };
 
 class MockServiceControlCall : public ServiceControlCall {
@@ -62,6 +76,11 @@ class MockServiceControlCall : public ServiceControlCall {
        Envoy::Tracing::Span& parent_span, CheckDoneFunc on_done),
       (override));
 
+  MOCK_METHOD(
+      std::string, checkSignature,
+      (const ::espv2::api_proxy::service_control::CheckRequestInfo& request),
+      (const, override));
+
   MOCK_METHOD(
       void, callQuota,
       (const ::espv2::api_proxy::service_control::QuotaRequestInfo& info,
@@ -72,12 +91,16 @@ class MockServiceControlCall : public ServiceControlCall {
       void, callReport,
       (const ::espv2::api_proxy::service_control::ReportRequestInfo& request),
       (override));
+
+  MOCK_METHOD(bool, logsEnabled, (), (const, override));
+
+  MOCK_METHOD(ServiceControlCallStatus, status, (), (const, override));
 };
 
 class MockServiceControlCallFactory : public ServiceControlCallFactory {
  public:
   MOCK_METHOD(
-      ServiceControlCallPtr, create,
+      ServiceControlCallSharedPtr, create,
       (const ::espv2::api::envoy::v10::http::service_control::Service& config),
       (override));
 };
@@ -99,6 +122,7 @@ class MockHttpCall : public HttpCall {
 
   MOCK_METHOD(void, cancel, (), (override));
   MOCK_METHOD(void, call, (), (override));
+  MOCK_METHOD(void, setDeadline, (Envoy::MonotonicTime deadline), (override));
 };
 
 class MockHttpCallFactory : public HttpCallFactory {
@@ -109,6 +133,10 @@ class MockHttpCallFactory : public HttpCallFactory {
   MOCK_METHOD(HttpCall*, createHttpCall,
               (const Envoy::Protobuf::Message& body,
                Envoy::Tracing::Span& parent_span, HttpCall::DoneFunc on_done));
+  MOCK_METHOD(HttpCall*, createSerializedHttpCall,
+              (std::shared_ptr<const std::string> body,
+               Envoy::Tracing::Span& parent_span, HttpCall::DoneFunc on_done));
+  MOCK_METHOD(size_t, activeCalls, (), (const));
 };
 
 }  // namespace service_control
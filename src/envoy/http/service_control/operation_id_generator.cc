@@ -0,0 +1,62 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/operation_id_generator.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+// The counter takes the last 12 hex digits.
+constexpr size_t kCounterDigits = 12;
+constexpr uint64_t kCounterMask = (uint64_t{1} << (4 * kCounterDigits)) - 1;
+
+// Writes the lowest `digits` hex digits of the value.
+void writeHex(uint64_t value, size_t digits, char* out) {
+  for (size_t i = digits; i > 0; --i) {
+    out[i - 1] = kHexDigits[value & 0xf];
+    value >>= 4;
+  }
+}
+
+}  // namespace
+
+SequentialOperationIdGenerator::SequentialOperationIdGenerator(uint64_t prefix,
+                                                               uint16_t index) {
+  // xxxxxxxx-xxxx-xxxx-iiii-cccccccccccc
+  writeHex(prefix >> 32, 8, id_);
+  id_[8] = '-';
+  writeHex(prefix >> 16, 4, id_ + 9);
+  id_[13] = '-';
+  writeHex(prefix, 4, id_ + 14);
+  id_[18] = '-';
+  writeHex(index, 4, id_ + 19);
+  id_[23] = '-';
+}
+
+absl::string_view SequentialOperationIdGenerator::next() {
+  writeHex(counter_++ & kCounterMask, kCounterDigits,
+           id_ + kIdLength - kCounterDigits);
+  return absl::string_view(id_, kIdLength);
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
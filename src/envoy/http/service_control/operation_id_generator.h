@@ -0,0 +1,55 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/strings/string_view.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// Generates unique operation ids without the cost of random UUIDs.
+//
+// An id is laid out like a UUID: 64 random bits shared by the generators of a
+// process, the 16 bit index of the generator and a 48 bit counter, all in
+// hex. The ids are formatted in place, only the counter digits are rewritten
+// for each id. Not thread safe, each worker has its own generator.
+class SequentialOperationIdGenerator {
+ public:
+  static constexpr size_t kIdLength = 36;
+
+  SequentialOperationIdGenerator(uint64_t prefix, uint16_t index);
+
+  SequentialOperationIdGenerator(const SequentialOperationIdGenerator&) =
+      delete;
+  SequentialOperationIdGenerator& operator=(
+      const SequentialOperationIdGenerator&) = delete;
+
+  // Returns the next id. It is valid until the next call.
+  absl::string_view next();
+
+ private:
+  char id_[kIdLength];
+  uint64_t counter_ = 0;
+};
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
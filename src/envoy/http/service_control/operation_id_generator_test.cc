@@ -0,0 +1,48 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/operation_id_generator.h"
+
+#include <string>
+
+#include "absl/container/flat_hash_set.h"
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+TEST(SequentialOperationIdGeneratorTest, UuidLayout) {
+  SequentialOperationIdGenerator generator(0x0123456789abcdef, 0x2a);
+  EXPECT_EQ(generator.next(), "01234567-89ab-cdef-002a-000000000000");
+  EXPECT_EQ(generator.next(), "01234567-89ab-cdef-002a-000000000001");
+}
+
+TEST(SequentialOperationIdGeneratorTest, UniqueIds) {
+  SequentialOperationIdGenerator generator(1, 0);
+  SequentialOperationIdGenerator other(1, 1);
+  absl::flat_hash_set<std::string> ids;
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(ids.emplace(generator.next()).second);
+    EXPECT_TRUE(ids.emplace(other.next()).second);
+  }
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
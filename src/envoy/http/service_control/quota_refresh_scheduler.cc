@@ -0,0 +1,152 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/quota_refresh_scheduler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "src/api_proxy/utils/memory_bytes.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::SlotBytes;
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
+using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::protobuf::util::Status;
+
+namespace {
+
+// Separates the fields of a key. It can not appear in the fields.
+constexpr absl::string_view kKeyDelimiter("\0", 1);
+
+}  // namespace
+
+QuotaRefreshScheduler::QuotaRefreshScheduler(
+    std::chrono::milliseconds min_interval,
+    std::chrono::milliseconds max_interval, uint32_t max_keys,
+    Envoy::TimeSource& time_source)
+    : min_interval_(min_interval),
+      max_interval_(max_interval),
+      max_keys_(max_keys),
+      time_source_(time_source) {}
+
+std::string QuotaRefreshScheduler::key(const AllocateQuotaRequest& request) {
+  const auto& operation = request.allocate_operation();
+
+  std::vector<absl::string_view> metric_names;
+  metric_names.reserve(operation.quota_metrics_size());
+  for (const auto& metric : operation.quota_metrics()) {
+    metric_names.push_back(metric.metric_name());
+  }
+  std::sort(metric_names.begin(), metric_names.end());
+
+  std::string key = absl::StrCat(operation.method_name(), kKeyDelimiter,
+                                 operation.consumer_id());
+  for (const auto& metric_name : metric_names) {
+    absl::StrAppend(&key, kKeyDelimiter, metric_name);
+  }
+  return key;
+}
+
+void QuotaRefreshScheduler::recordUsage(const std::string& key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    if (entries_.size() >= max_keys_) {
+      evict(time_source_.monotonicTime());
+      if (entries_.size() >= max_keys_) {
+        // Not tracked, the key is refreshed at the minimum interval.
+        return;
+      }
+    }
+    it = entries_.emplace(key, Entry()).first;
+    it->second.interval = min_interval_;
+    it->second.last_refresh_time = time_source_.monotonicTime();
+  }
+  it->second.usage++;
+}
+
+bool QuotaRefreshScheduler::shouldRefresh(const std::string& key,
+                                          AllocateQuotaResponse* response) {
+  const auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return true;
+  }
+
+  Entry& entry = it->second;
+  if (entry.usage == 0 && entry.has_response &&
+      time_source_.monotonicTime() - entry.last_refresh_time <
+          entry.interval) {
+    *response = entry.response;
+    return false;
+  }
+
+  entry.idle_refresh = entry.usage == 0;
+  entry.usage = 0;
+  return true;
+}
+
+void QuotaRefreshScheduler::onRefreshDone(
+    const std::string& key, const Status& status,
+    const AllocateQuotaResponse& response) {
+  const auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return;
+  }
+
+  Entry& entry = it->second;
+  if (!status.ok() || response.allocate_errors_size() > 0) {
+    // Keep checking at the minimum interval until the quota is available.
+    entry.interval = min_interval_;
+    entry.has_response = false;
+    return;
+  }
+
+  entry.interval = entry.idle_refresh
+                       ? std::min(entry.interval * 2, max_interval_)
+                       : min_interval_;
+  entry.has_response = true;
+  entry.response = response;
+  entry.last_refresh_time = time_source_.monotonicTime();
+}
+
+size_t QuotaRefreshScheduler::bytes() const {
+  size_t bytes = SlotBytes(entries_);
+  for (const auto& entry : entries_) {
+    // The response is counted in the slot.
+    bytes += HeapBytes(entry.first) + entry.second.response.SpaceUsedLong() -
+             sizeof(entry.second.response);
+  }
+  return bytes;
+}
+
+void QuotaRefreshScheduler::evict(Envoy::MonotonicTime now) {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (now - it->second.last_refresh_time >= max_interval_) {
+      entries_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
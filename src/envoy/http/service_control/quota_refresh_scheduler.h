@@ -0,0 +1,97 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "envoy/common/time.h"
+#include "google/api/servicecontrol/v1/quota_controller.pb.h"
+#include "google/protobuf/stubs/status.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// Adapts the quota refresh interval of each quota key of one worker.
+//
+// The quota cache refreshes every key at a fixed interval, the minimum one
+// here. A key with no usage since its last refresh is idle: its interval is
+// doubled after each refresh, up to the maximum, and the refreshes in between
+// are answered with the last response instead of a call. Any usage or quota
+// error brings the key back to the minimum interval, so the keys in use are
+// enforced as tightly as before. Not thread safe.
+class QuotaRefreshScheduler {
+ public:
+  QuotaRefreshScheduler(std::chrono::milliseconds min_interval,
+                        std::chrono::milliseconds max_interval,
+                        uint32_t max_keys, Envoy::TimeSource& time_source);
+
+  // Returns the quota key of the request, the same for all the requests
+  // aggregated in one quota cache entry.
+  static std::string key(
+      const ::google::api::servicecontrol::v1::AllocateQuotaRequest& request);
+
+  // Records a request using the quota of the key.
+  void recordUsage(const std::string& key);
+
+  // Returns false if the refresh of the key can be skipped; the last response
+  // is then copied into `response`.
+  bool shouldRefresh(
+      const std::string& key,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* response);
+
+  // Records the result of a refresh that was not skipped.
+  void onRefreshDone(
+      const std::string& key, const ::google::protobuf::util::Status& status,
+      const ::google::api::servicecontrol::v1::AllocateQuotaResponse&
+          response);
+
+  size_t size() const { return entries_.size(); }
+
+  // The memory held by the keys, roughly.
+  size_t bytes() const;
+
+ private:
+  struct Entry {
+    std::chrono::milliseconds interval;
+    uint64_t usage = 0;
+    // Whether the refresh in flight, if any, was made while idle.
+    bool idle_refresh = false;
+    bool has_response = false;
+    ::google::api::servicecontrol::v1::AllocateQuotaResponse response;
+    // When the key was last refreshed, or first used.
+    Envoy::MonotonicTime last_refresh_time;
+  };
+
+  // Removes the entries not refreshed for the maximum interval to make room.
+  void evict(Envoy::MonotonicTime now);
+
+  const std::chrono::milliseconds min_interval_;
+  const std::chrono::milliseconds max_interval_;
+  const size_t max_keys_;
+  Envoy::TimeSource& time_source_;
+  absl::flat_hash_map<std::string, Entry> entries_;
+};
+
+using QuotaRefreshSchedulerPtr = std::unique_ptr<QuotaRefreshScheduler>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,161 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/quota_refresh_scheduler.h"
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
+using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::QuotaError;
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+constexpr char kKey[] = "key";
+
+class QuotaRefreshSchedulerTest : public ::testing::Test {
+ protected:
+  QuotaRefreshSchedulerTest()
+      : scheduler_(std::chrono::milliseconds(1000),
+                   std::chrono::milliseconds(4000), 10, time_system_) {}
+
+  AllocateQuotaResponse makeResponse(const std::string& operation_id) {
+    AllocateQuotaResponse response;
+    response.set_operation_id(operation_id);
+    return response;
+  }
+
+  // Advances the time by the minimum interval and returns whether the key is
+  // refreshed. A refresh succeeds with the given response.
+  bool tick(const AllocateQuotaResponse& refreshed) {
+    time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+    AllocateQuotaResponse response;
+    if (!scheduler_.shouldRefresh(kKey, &response)) {
+      EXPECT_EQ(response.operation_id(), "op-1");
+      return false;
+    }
+    scheduler_.onRefreshDone(kKey, OkStatus(), refreshed);
+    return true;
+  }
+
+  Envoy::Event::SimulatedTimeSystem time_system_;
+  QuotaRefreshScheduler scheduler_;
+};
+
+TEST_F(QuotaRefreshSchedulerTest, UntrackedKeyAlwaysRefreshed) {
+  AllocateQuotaResponse response;
+  EXPECT_TRUE(scheduler_.shouldRefresh(kKey, &response));
+  scheduler_.onRefreshDone(kKey, OkStatus(), makeResponse("op-1"));
+  EXPECT_TRUE(scheduler_.shouldRefresh(kKey, &response));
+  EXPECT_EQ(scheduler_.size(), 0);
+}
+
+TEST_F(QuotaRefreshSchedulerTest, IdleKeyBacksOff) {
+  scheduler_.recordUsage(kKey);
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+
+  // Idle: the interval doubles after each refresh, up to the maximum.
+  std::vector<bool> refreshed;
+  for (int i = 0; i < 14; ++i) {
+    refreshed.push_back(tick(makeResponse("op-1")));
+  }
+  EXPECT_THAT(refreshed,
+              testing::ElementsAre(true, false, true, false, false, false,
+                                   true, false, false, false, true, false,
+                                   false, false));
+}
+
+TEST_F(QuotaRefreshSchedulerTest, UsageResetsInterval) {
+  scheduler_.recordUsage(kKey);
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+  EXPECT_FALSE(tick(makeResponse("op-1")));
+
+  scheduler_.recordUsage(kKey);
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+  // Refreshed with usage, back to the minimum interval.
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+}
+
+TEST_F(QuotaRefreshSchedulerTest, ErrorsResetInterval) {
+  scheduler_.recordUsage(kKey);
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+
+  AllocateQuotaResponse exhausted = makeResponse("op-1");
+  exhausted.add_allocate_errors()->set_code(QuotaError::RESOURCE_EXHAUSTED);
+  EXPECT_TRUE(tick(exhausted));
+  // No response to reuse after an error.
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+  EXPECT_FALSE(tick(makeResponse("op-1")));
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  AllocateQuotaResponse response;
+  EXPECT_TRUE(scheduler_.shouldRefresh(kKey, &response));
+  scheduler_.onRefreshDone(kKey, Status(StatusCode::kUnavailable, ""),
+                           response);
+  EXPECT_TRUE(tick(makeResponse("op-1")));
+}
+
+TEST_F(QuotaRefreshSchedulerTest, StaleKeysEvictedWhenFull) {
+  for (int i = 0; i < 10; ++i) {
+    scheduler_.recordUsage(absl::StrCat("key-", i));
+  }
+  scheduler_.recordUsage("new-key");
+  EXPECT_EQ(scheduler_.size(), 10);
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(4000));
+  scheduler_.recordUsage("new-key");
+  EXPECT_EQ(scheduler_.size(), 1);
+}
+
+TEST(QuotaRefreshSchedulerKeyTest, StableMetricOrder) {
+  AllocateQuotaRequest request1;
+  auto* operation1 = request1.mutable_allocate_operation();
+  operation1->set_method_name("method");
+  operation1->set_consumer_id("api_key:key");
+  operation1->add_quota_metrics()->set_metric_name("metric-a");
+  operation1->add_quota_metrics()->set_metric_name("metric-b");
+
+  AllocateQuotaRequest request2;
+  auto* operation2 = request2.mutable_allocate_operation();
+  operation2->set_method_name("method");
+  operation2->set_consumer_id("api_key:key");
+  operation2->add_quota_metrics()->set_metric_name("metric-b");
+  operation2->add_quota_metrics()->set_metric_name("metric-a");
+  operation2->set_operation_id("id");
+
+  EXPECT_EQ(QuotaRefreshScheduler::key(request1),
+            QuotaRefreshScheduler::key(request2));
+
+  operation2->set_consumer_id("api_key:other");
+  EXPECT_NE(QuotaRefreshScheduler::key(request1),
+            QuotaRefreshScheduler::key(request2));
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
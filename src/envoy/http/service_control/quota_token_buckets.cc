@@ -0,0 +1,239 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/quota_token_buckets.h"
+
+#include <algorithm>
+
+#include "src/api_proxy/utils/memory_bytes.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::SlotBytes;
+using ::espv2::api_proxy::utils::VectorBytes;
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
+using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::QuotaError;
+using ::google::protobuf::util::Status;
+
+namespace {
+
+bool isExhausted(const AllocateQuotaResponse& response) {
+  for (const auto& error : response.allocate_errors()) {
+    if (error.code() == QuotaError::RESOURCE_EXHAUSTED) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+QuotaTokenBuckets::QuotaTokenBuckets(std::chrono::milliseconds refresh_interval,
+                                     uint32_t max_keys,
+                                     Envoy::TimeSource& time_source)
+    : refresh_interval_(refresh_interval),
+      max_keys_(max_keys),
+      time_source_(time_source) {}
+
+QuotaTokenBuckets::Amounts QuotaTokenBuckets::amounts(
+    const AllocateQuotaRequest& request) {
+  Amounts amounts;
+  for (const auto& metric : request.allocate_operation().quota_metrics()) {
+    int64_t amount = 0;
+    for (const auto& value : metric.metric_values()) {
+      amount += value.int64_value();
+    }
+
+    auto it = std::find_if(amounts.begin(), amounts.end(),
+                           [&metric](const auto& entry) {
+                             return entry.first == metric.metric_name();
+                           });
+    if (it == amounts.end()) {
+      amounts.emplace_back(metric.metric_name(), amount);
+    } else {
+      it->second += amount;
+    }
+  }
+  return amounts;
+}
+
+bool QuotaTokenBuckets::tryConsume(const std::string& key,
+                                   const AllocateQuotaRequest& request) {
+  const auto it = entries_.find(key);
+  if (it == entries_.end() || it->second.buckets.empty()) {
+    return true;
+  }
+
+  Entry& entry = it->second;
+  refill(entry, time_source_.monotonicTime());
+
+  // A request has a handful of metrics, look them up without building the
+  // amounts.
+  const auto& metrics = request.allocate_operation().quota_metrics();
+  for (const Bucket& bucket : entry.buckets) {
+    int64_t amount = 0;
+    for (const auto& metric : metrics) {
+      if (metric.metric_name() == bucket.metric_name) {
+        for (const auto& value : metric.metric_values()) {
+          amount += value.int64_value();
+        }
+      }
+    }
+    if (bucket.tokens < amount) {
+      return false;
+    }
+  }
+
+  for (Bucket& bucket : entry.buckets) {
+    for (const auto& metric : metrics) {
+      if (metric.metric_name() == bucket.metric_name) {
+        for (const auto& value : metric.metric_values()) {
+          bucket.tokens -= value.int64_value();
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void QuotaTokenBuckets::onRefreshDone(const std::string& key,
+                                      const Amounts& requested,
+                                      const Status& status,
+                                      const AllocateQuotaResponse& response) {
+  if (!status.ok()) {
+    // The outcome is unknown, keep the key as it is.
+    return;
+  }
+
+  const Envoy::MonotonicTime now = time_source_.monotonicTime();
+  auto it = entries_.find(key);
+  if (isExhausted(response)) {
+    if (it == entries_.end() || it->second.granted.empty()) {
+      // Nothing known to fit the quota, the quota cache denies the key until
+      // a refresh succeeds.
+      return;
+    }
+
+    Entry& entry = it->second;
+    refill(entry, now);
+    if (entry.buckets.empty()) {
+      for (const auto& granted : entry.granted) {
+        entry.buckets.push_back(
+            {granted.first, std::max<double>(1, granted.second), 0});
+      }
+    } else {
+      for (Bucket& bucket : entry.buckets) {
+        bucket.limit = std::max<double>(1, bucket.limit / 2);
+        bucket.tokens = std::min(bucket.tokens, bucket.limit);
+      }
+    }
+    entry.last_refresh_time = now;
+    return;
+  }
+
+  if (response.allocate_errors_size() > 0) {
+    return;
+  }
+
+  if (it == entries_.end()) {
+    if (requested.empty()) {
+      return;
+    }
+    if (entries_.size() >= max_keys_) {
+      evict(now);
+      if (entries_.size() >= max_keys_) {
+        // Not tracked, the key is never limited.
+        return;
+      }
+    }
+    it = entries_.emplace(key, Entry()).first;
+    it->second.last_refill_time = now;
+  }
+
+  Entry& entry = it->second;
+  if (!entry.buckets.empty()) {
+    bool used_up = false;
+    for (const auto& amount : requested) {
+      for (const Bucket& bucket : entry.buckets) {
+        if (bucket.metric_name == amount.first &&
+            amount.second >= bucket.limit) {
+          used_up = true;
+        }
+      }
+    }
+
+    if (used_up) {
+      // The consumer may have more quota than the buckets allow.
+      refill(entry, now);
+      for (Bucket& bucket : entry.buckets) {
+        bucket.limit *= 2;
+      }
+    } else {
+      entry.buckets.clear();
+    }
+  }
+  entry.granted = requested;
+  entry.last_refresh_time = now;
+}
+
+size_t QuotaTokenBuckets::bytes() const {
+  size_t bytes = SlotBytes(entries_);
+  for (const auto& entry : entries_) {
+    bytes += HeapBytes(entry.first) + VectorBytes(entry.second.granted) +
+             VectorBytes(entry.second.buckets);
+    for (const auto& amount : entry.second.granted) {
+      bytes += HeapBytes(amount.first);
+    }
+    for (const Bucket& bucket : entry.second.buckets) {
+      bytes += HeapBytes(bucket.metric_name);
+    }
+  }
+  return bytes;
+}
+
+bool QuotaTokenBuckets::limited(const std::string& key) const {
+  const auto it = entries_.find(key);
+  return it != entries_.end() && !it->second.buckets.empty();
+}
+
+void QuotaTokenBuckets::refill(Entry& entry, Envoy::MonotonicTime now) {
+  const double intervals =
+      std::chrono::duration<double>(now - entry.last_refill_time) /
+      std::chrono::duration<double>(refresh_interval_);
+  for (Bucket& bucket : entry.buckets) {
+    bucket.tokens =
+        std::min(bucket.limit, bucket.tokens + bucket.limit * intervals);
+  }
+  entry.last_refill_time = now;
+}
+
+void QuotaTokenBuckets::evict(Envoy::MonotonicTime now) {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (now - it->second.last_refresh_time >= 2 * refresh_interval_) {
+      entries_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
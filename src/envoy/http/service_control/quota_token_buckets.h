@@ -0,0 +1,110 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "envoy/common/time.h"
+#include "google/api/servicecontrol/v1/quota_controller.pb.h"
+#include "google/protobuf/stubs/status.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// Limits the quota usage of the exhausted quota keys of one worker.
+//
+// The quota cache only learns that a key is out of quota on a refresh, so a
+// consumer bursting over its limit is let through until the next refresh, and
+// is denied altogether from then until a refresh succeeds again. Once a
+// refresh of a key is rejected, its requests go through a token bucket per
+// metric instead, holding the amounts of the last successful refresh per
+// refresh interval. A successful refresh that used up a bucket doubles it,
+// and one that did not removes the buckets of the key; a rejected one halves
+// them. Not thread safe.
+class QuotaTokenBuckets {
+ public:
+  // The amount of each metric of a request, summed by metric name.
+  using Amounts = std::vector<std::pair<std::string, int64_t>>;
+
+  QuotaTokenBuckets(std::chrono::milliseconds refresh_interval,
+                    uint32_t max_keys, Envoy::TimeSource& time_source);
+
+  static Amounts amounts(
+      const ::google::api::servicecontrol::v1::AllocateQuotaRequest& request);
+
+  // Takes the amounts of the request from the buckets of the key. Returns
+  // false, taking nothing, if a bucket does not hold enough tokens. Keys with
+  // no buckets always succeed.
+  bool tryConsume(
+      const std::string& key,
+      const ::google::api::servicecontrol::v1::AllocateQuotaRequest& request);
+
+  // Records the result of a refresh of the key asking for `requested`.
+  void onRefreshDone(
+      const std::string& key, const Amounts& requested,
+      const ::google::protobuf::util::Status& status,
+      const ::google::api::servicecontrol::v1::AllocateQuotaResponse&
+          response);
+
+  size_t size() const { return entries_.size(); }
+
+  // The memory held by the keys, roughly.
+  size_t bytes() const;
+
+  // Returns whether the requests of the key go through its buckets.
+  bool limited(const std::string& key) const;
+
+ private:
+  struct Bucket {
+    std::string metric_name;
+    // The tokens added per refresh interval, also the bucket size.
+    double limit;
+    double tokens;
+  };
+
+  struct Entry {
+    // The amounts granted by the last successful refresh.
+    Amounts granted;
+    // Empty if the key is not limited.
+    std::vector<Bucket> buckets;
+    Envoy::MonotonicTime last_refill_time;
+    Envoy::MonotonicTime last_refresh_time;
+  };
+
+  // Adds the tokens for the time since the last refill.
+  void refill(Entry& entry, Envoy::MonotonicTime now);
+
+  // Removes the entries not refreshed for two intervals to make room.
+  void evict(Envoy::MonotonicTime now);
+
+  const std::chrono::milliseconds refresh_interval_;
+  const size_t max_keys_;
+  Envoy::TimeSource& time_source_;
+  absl::flat_hash_map<std::string, Entry> entries_;
+};
+
+using QuotaTokenBucketsPtr = std::unique_ptr<QuotaTokenBuckets>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,174 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/quota_token_buckets.h"
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
+using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::QuotaError;
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+constexpr char kKey[] = "key";
+constexpr char kMetric[] = "metric";
+
+AllocateQuotaRequest makeRequest(int64_t amount) {
+  AllocateQuotaRequest request;
+  auto* metric = request.mutable_allocate_operation()->add_quota_metrics();
+  metric->set_metric_name(kMetric);
+  metric->add_metric_values()->set_int64_value(amount);
+  return request;
+}
+
+AllocateQuotaResponse makeExhausted() {
+  AllocateQuotaResponse response;
+  response.add_allocate_errors()->set_code(QuotaError::RESOURCE_EXHAUSTED);
+  return response;
+}
+
+class QuotaTokenBucketsTest : public ::testing::Test {
+ protected:
+  QuotaTokenBucketsTest()
+      : buckets_(std::chrono::milliseconds(1000), 10, time_system_) {}
+
+  void refreshed(int64_t amount, const AllocateQuotaResponse& response) {
+    buckets_.onRefreshDone(kKey, {{kMetric, amount}}, OkStatus(), response);
+  }
+
+  // Returns the number of requests of the amount let through.
+  int consume(int requests, int64_t amount) {
+    int allowed = 0;
+    for (int i = 0; i < requests; ++i) {
+      allowed += buckets_.tryConsume(kKey, makeRequest(amount));
+    }
+    return allowed;
+  }
+
+  Envoy::Event::SimulatedTimeSystem time_system_;
+  QuotaTokenBuckets buckets_;
+};
+
+TEST_F(QuotaTokenBucketsTest, AmountsSummedByMetric) {
+  AllocateQuotaRequest request = makeRequest(2);
+  auto* metric = request.mutable_allocate_operation()->add_quota_metrics();
+  metric->set_metric_name(kMetric);
+  metric->add_metric_values()->set_int64_value(3);
+  request.mutable_allocate_operation()->add_quota_metrics()->set_metric_name(
+      "other");
+
+  const QuotaTokenBuckets::Amounts expected = {{kMetric, 5}, {"other", 0}};
+  EXPECT_EQ(QuotaTokenBuckets::amounts(request), expected);
+}
+
+TEST_F(QuotaTokenBucketsTest, NotLimitedUntilExhausted) {
+  EXPECT_EQ(consume(100, 1), 100);
+  refreshed(100, AllocateQuotaResponse());
+  EXPECT_FALSE(buckets_.limited(kKey));
+  EXPECT_EQ(consume(100, 1), 100);
+
+  // A rejection with nothing granted before is left to the quota cache.
+  buckets_.onRefreshDone("new", {{kMetric, 5}}, OkStatus(), makeExhausted());
+  EXPECT_FALSE(buckets_.limited("new"));
+}
+
+TEST_F(QuotaTokenBucketsTest, ExhaustedKeyLimitedToLastGrant) {
+  refreshed(10, AllocateQuotaResponse());
+  refreshed(50, makeExhausted());
+  EXPECT_TRUE(buckets_.limited(kKey));
+
+  // The bucket starts empty and fills with the last grant per interval.
+  EXPECT_EQ(consume(20, 1), 0);
+  time_system_.advanceTimeWait(std::chrono::milliseconds(500));
+  EXPECT_EQ(consume(20, 1), 5);
+  time_system_.advanceTimeWait(std::chrono::milliseconds(5000));
+  EXPECT_EQ(consume(20, 1), 10);
+
+  // A request larger than the bucket is never let through.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  EXPECT_EQ(consume(1, 11), 0);
+  EXPECT_EQ(consume(1, 10), 1);
+}
+
+TEST_F(QuotaTokenBucketsTest, UsedUpBucketDoubles) {
+  refreshed(10, AllocateQuotaResponse());
+  refreshed(50, makeExhausted());
+
+  refreshed(10, AllocateQuotaResponse());
+  EXPECT_TRUE(buckets_.limited(kKey));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  EXPECT_EQ(consume(30, 1), 20);
+}
+
+TEST_F(QuotaTokenBucketsTest, UnusedBucketRemoved) {
+  refreshed(10, AllocateQuotaResponse());
+  refreshed(50, makeExhausted());
+
+  refreshed(5, AllocateQuotaResponse());
+  EXPECT_FALSE(buckets_.limited(kKey));
+  EXPECT_EQ(consume(30, 1), 30);
+}
+
+TEST_F(QuotaTokenBucketsTest, ExhaustedAgainHalves) {
+  refreshed(10, AllocateQuotaResponse());
+  refreshed(50, makeExhausted());
+
+  refreshed(10, makeExhausted());
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  EXPECT_EQ(consume(30, 1), 5);
+}
+
+TEST_F(QuotaTokenBucketsTest, FailedRefreshIgnored) {
+  refreshed(10, AllocateQuotaResponse());
+  buckets_.onRefreshDone(kKey, {{kMetric, 10}},
+                         Status(StatusCode::kUnavailable, ""), makeExhausted());
+  EXPECT_FALSE(buckets_.limited(kKey));
+
+  refreshed(50, makeExhausted());
+  buckets_.onRefreshDone(kKey, {{kMetric, 0}},
+                         Status(StatusCode::kUnavailable, ""),
+                         AllocateQuotaResponse());
+  EXPECT_TRUE(buckets_.limited(kKey));
+}
+
+TEST_F(QuotaTokenBucketsTest, MaxKeys) {
+  for (int i = 0; i < 20; ++i) {
+    buckets_.onRefreshDone(absl::StrCat("key-", i), {{kMetric, 1}},
+                           OkStatus(), AllocateQuotaResponse());
+  }
+  EXPECT_EQ(buckets_.size(), 10);
+
+  // The keys not refreshed for two intervals make room for new ones.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(2000));
+  refreshed(1, AllocateQuotaResponse());
+  EXPECT_EQ(buckets_.size(), 1);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,95 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/report_builder_pool.h"
+
+#include <utility>
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::espv2::api_proxy::service_control::ReportRequestInfo;
+
+OwnedReportRequestInfo::OwnedReportRequestInfo(const ReportRequestInfo& info)
+    : operation_id_(info.operation_id),
+      operation_name_(info.operation_name),
+      producer_project_id_(info.producer_project_id),
+      api_key_(info.api_key),
+      referer_(info.referer),
+      location_(info.location),
+      compute_platform_(info.compute_platform),
+      project_id_(info.project_id),
+      info_(info) {
+  info_.operation_id = operation_id_;
+  info_.operation_name = operation_name_;
+  info_.producer_project_id = producer_project_id_;
+  info_.api_key = api_key_;
+  info_.referer = referer_;
+  info_.location = location_;
+  info_.compute_platform = compute_platform_;
+  info_.project_id = project_id_;
+}
+
+ReportBuilderPool::ReportBuilderPool(
+    Envoy::Thread::ThreadFactory& thread_factory, uint32_t threads,
+    size_t max_queued_jobs)
+    : max_queued_jobs_(max_queued_jobs) {
+  threads_.reserve(threads);
+  for (uint32_t i = 0; i < threads; ++i) {
+    threads_.push_back(thread_factory.createThread([this]() { run(); }));
+  }
+}
+
+ReportBuilderPool::~ReportBuilderPool() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+    jobs_.clear();
+  }
+  for (auto& thread : threads_) {
+    thread->join();
+  }
+}
+
+bool ReportBuilderPool::submit(Job job) {
+  absl::MutexLock lock(&mutex_);
+  if (stopping_ || jobs_.size() >= max_queued_jobs_) {
+    return false;
+  }
+  jobs_.push_back(std::move(job));
+  return true;
+}
+
+void ReportBuilderPool::run() {
+  while (true) {
+    Job job;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(this, &ReportBuilderPool::hasWork));
+      if (stopping_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,91 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "envoy/thread/thread.h"
+#include "src/api_proxy/service_control/request_info.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// A copy of a ReportRequestInfo whose views point to its own strings, so it
+// can outlive the request and the filter config it was filled from. Neither
+// copied nor moved, which would leave the views dangling.
+class OwnedReportRequestInfo {
+ public:
+  explicit OwnedReportRequestInfo(
+      const ::espv2::api_proxy::service_control::ReportRequestInfo& info);
+
+  OwnedReportRequestInfo(const OwnedReportRequestInfo&) = delete;
+  OwnedReportRequestInfo& operator=(const OwnedReportRequestInfo&) = delete;
+
+  const ::espv2::api_proxy::service_control::ReportRequestInfo& info() const {
+    return info_;
+  }
+
+ private:
+  std::string operation_id_;
+  std::string operation_name_;
+  std::string producer_project_id_;
+  std::string api_key_;
+  std::string referer_;
+  std::string location_;
+  std::string compute_platform_;
+  std::string project_id_;
+  ::espv2::api_proxy::service_control::ReportRequestInfo info_;
+};
+
+// A few threads that build the reports off the workers. The jobs wait in a
+// bounded queue shared by all the workers; a job that finds it full is not
+// queued, and the worker does the work itself. The jobs still queued when the
+// pool is destroyed are dropped.
+class ReportBuilderPool {
+ public:
+  using Job = std::function<void()>;
+
+  ReportBuilderPool(Envoy::Thread::ThreadFactory& thread_factory,
+                    uint32_t threads, size_t max_queued_jobs);
+  ~ReportBuilderPool();
+
+  // Returns false if the queue is full, then the job is not run.
+  bool submit(Job job);
+
+ private:
+  // The loop of each thread.
+  void run();
+  bool hasWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return stopping_ || !jobs_.empty();
+  }
+
+  const size_t max_queued_jobs_;
+  absl::Mutex mutex_;
+  std::deque<Job> jobs_ ABSL_GUARDED_BY(mutex_);
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+  std::vector<Envoy::Thread::ThreadPtr> threads_;
+};
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
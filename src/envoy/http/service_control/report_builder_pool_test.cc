@@ -0,0 +1,90 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/report_builder_pool.h"
+
+#include <atomic>
+#include <string>
+
+#include "absl/synchronization/notification.h"
+#include "gtest/gtest.h"
+#include "test/test_common/thread_factory_for_test.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::espv2::api_proxy::service_control::ReportRequestInfo;
+
+TEST(OwnedReportRequestInfoTest, OwnsViewedStrings) {
+  std::string operation_id = "operation-id-longer-than-a-short-string";
+  std::string location = "us-central1";
+  ReportRequestInfo info;
+  info.operation_id = operation_id;
+  info.location = location;
+  info.api_method = "api-method";
+  info.http_response_code = 200;
+
+  OwnedReportRequestInfo owned(info);
+  operation_id.assign(operation_id.size(), 'x');
+  location.clear();
+
+  EXPECT_EQ(owned.info().operation_id,
+            "operation-id-longer-than-a-short-string");
+  EXPECT_EQ(owned.info().location, "us-central1");
+  EXPECT_EQ(owned.info().api_method, "api-method");
+  EXPECT_EQ(owned.info().http_response_code, 200);
+}
+
+TEST(ReportBuilderPoolTest, RunsSubmittedJobs) {
+  std::atomic<int> done{0};
+  absl::Notification all_done;
+  {
+    ReportBuilderPool pool(Envoy::Thread::threadFactoryForTest(), 2, 100);
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(pool.submit([&done, &all_done]() {
+        if (++done == 100) {
+          all_done.Notify();
+        }
+      }));
+    }
+    all_done.WaitForNotification();
+  }
+  EXPECT_EQ(done, 100);
+}
+
+TEST(ReportBuilderPoolTest, FullQueueRejectsJobs) {
+  absl::Notification started;
+  absl::Notification release;
+  ReportBuilderPool pool(Envoy::Thread::threadFactoryForTest(), 1, 1);
+
+  // The only thread is held by the first job, the second one fills the
+  // queue.
+  ASSERT_TRUE(pool.submit([&started, &release]() {
+    started.Notify();
+    release.WaitForNotification();
+  }));
+  started.WaitForNotification();
+  ASSERT_TRUE(pool.submit([]() {}));
+  EXPECT_FALSE(pool.submit([]() {}));
+  release.Notify();
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
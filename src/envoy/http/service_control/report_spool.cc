@@ -0,0 +1,147 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/report_spool.h"
+
+#include <utility>
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+namespace {
+
+// All 5xx errors and timeouts are already translated to Unavailable. Other
+// errors would fail again when replayed.
+bool isTransientError(const Status& status) {
+  return status.code() == StatusCode::kUnavailable ||
+         status.code() == StatusCode::kDeadlineExceeded;
+}
+
+}  // namespace
+
+ReportSpool::ReportSpool(uint64_t max_bytes, std::chrono::milliseconds max_age,
+                         std::chrono::milliseconds replay_interval,
+                         Envoy::Event::Dispatcher& dispatcher,
+                         Envoy::TimeSource& time_source,
+                         const ReportSpoolStats& stats, ReplayFunc replay_fn)
+    : max_bytes_(max_bytes),
+      max_age_(max_age),
+      replay_interval_(replay_interval),
+      time_source_(time_source),
+      stats_(stats),
+      replay_fn_(std::move(replay_fn)),
+      replay_timer_(dispatcher.createTimer([this]() { replayNext(); })) {}
+
+ReportSpool::~ReportSpool() { stats_.bytes_.sub(bytes_); }
+
+void ReportSpool::onReportDone(const Status& status, const std::string& body) {
+  if (isTransientError(status)) {
+    push({body, time_source_.monotonicTime()}, /*front=*/false);
+    return;
+  }
+
+  if (status.ok() && !replaying_ && !entries_.empty()) {
+    replaying_ = true;
+    replay_timer_->enableTimer(replay_interval_);
+  }
+}
+
+void ReportSpool::push(Entry entry, bool front) {
+  const uint64_t size = entry.body.size();
+  if (size > max_bytes_) {
+    stats_.dropped_bytes_.add(size);
+    return;
+  }
+
+  dropExpired(time_source_.monotonicTime());
+  // A failed replay is older than all the entries, it is the one to drop.
+  if (front && bytes_ + size > max_bytes_) {
+    stats_.dropped_bytes_.add(size);
+    return;
+  }
+  while (bytes_ + size > max_bytes_) {
+    dropFront();
+  }
+
+  bytes_ += size;
+  stats_.bytes_.add(size);
+  if (front) {
+    entries_.push_front(std::move(entry));
+  } else {
+    entries_.push_back(std::move(entry));
+    stats_.spooled_bytes_.add(size);
+  }
+}
+
+ReportSpool::Entry ReportSpool::popFront() {
+  Entry entry = std::move(entries_.front());
+  entries_.pop_front();
+  bytes_ -= entry.body.size();
+  stats_.bytes_.sub(entry.body.size());
+  return entry;
+}
+
+void ReportSpool::dropFront() {
+  stats_.dropped_bytes_.add(popFront().body.size());
+}
+
+void ReportSpool::dropExpired(Envoy::MonotonicTime now) {
+  while (!entries_.empty() && entries_.front().spool_time + max_age_ <= now) {
+    dropFront();
+  }
+}
+
+void ReportSpool::replayNext() {
+  dropExpired(time_source_.monotonicTime());
+  if (entries_.empty()) {
+    replaying_ = false;
+    return;
+  }
+
+  auto entry = std::make_shared<Entry>(popFront());
+  replay_fn_(entry->body, [this, entry](const Status& status) {
+    onReplayDone(status, entry);
+  });
+}
+
+void ReportSpool::onReplayDone(const Status& status,
+                               std::shared_ptr<Entry> entry) {
+  if (isTransientError(status)) {
+    // Wait for the next success before replaying again.
+    replaying_ = false;
+    if (entry->spool_time + max_age_ > time_source_.monotonicTime()) {
+      push(std::move(*entry), /*front=*/true);
+    } else {
+      stats_.dropped_bytes_.add(entry->body.size());
+    }
+    return;
+  }
+
+  if (status.ok()) {
+    stats_.replayed_bytes_.add(entry->body.size());
+  } else {
+    stats_.dropped_bytes_.add(entry->body.size());
+  }
+  replay_timer_->enableTimer(replay_interval_);
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
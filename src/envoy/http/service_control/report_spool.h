@@ -0,0 +1,102 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "envoy/common/time.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "google/protobuf/stubs/status.h"
+#include "src/envoy/http/service_control/filter_stats.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// A bounded in-memory spool of the Report requests that failed with a
+// transient error after all retries, kept by one worker.
+//
+// The serialized requests are kept in arrival order. The oldest ones are
+// dropped when the spool is full or when they get older than the max age.
+// Once a Report call succeeds again, the spooled requests are replayed one at
+// a time, at most one per replay interval. A replay that fails with a
+// transient error puts the request back and pauses the replay until the next
+// success. Not thread safe.
+class ReportSpool {
+ public:
+  using DoneFunc = std::function<void(const ::google::protobuf::util::Status&)>;
+  // Sends one spooled request. Must always call the done function.
+  using ReplayFunc =
+      std::function<void(const std::string& body, DoneFunc on_done)>;
+
+  ReportSpool(uint64_t max_bytes, std::chrono::milliseconds max_age,
+              std::chrono::milliseconds replay_interval,
+              Envoy::Event::Dispatcher& dispatcher,
+              Envoy::TimeSource& time_source, const ReportSpoolStats& stats,
+              ReplayFunc replay_fn);
+  ~ReportSpool();
+
+  // Records the result of a Report call with the serialized request `body`.
+  // The request is copied into the spool if the call failed with a transient
+  // error.
+  void onReportDone(const ::google::protobuf::util::Status& status,
+                    const std::string& body);
+
+  size_t size() const { return entries_.size(); }
+  uint64_t bytes() const { return bytes_; }
+
+ private:
+  struct Entry {
+    std::string body;
+    Envoy::MonotonicTime spool_time;
+  };
+
+  // Adds the entry at the back, or at the front for a failed replay, dropping
+  // old entries to make room.
+  void push(Entry entry, bool front);
+  Entry popFront();
+  void dropFront();
+  void dropExpired(Envoy::MonotonicTime now);
+
+  void replayNext();
+  void onReplayDone(const ::google::protobuf::util::Status& status,
+                    std::shared_ptr<Entry> entry);
+
+  const uint64_t max_bytes_;
+  const std::chrono::milliseconds max_age_;
+  const std::chrono::milliseconds replay_interval_;
+  Envoy::TimeSource& time_source_;
+  ReportSpoolStats stats_;
+  ReplayFunc replay_fn_;
+  Envoy::Event::TimerPtr replay_timer_;
+
+  std::deque<Entry> entries_;
+  uint64_t bytes_ = 0;
+  // Whether a replay is scheduled or in flight.
+  bool replaying_ = false;
+};
+
+using ReportSpoolPtr = std::unique_ptr<ReportSpool>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
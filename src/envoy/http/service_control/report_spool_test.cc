@@ -0,0 +1,177 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/report_spool.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+using ::testing::_;
+using ::testing::NiceMock;
+
+const Status kUnavailable(StatusCode::kUnavailable, "unavailable");
+
+class ReportSpoolTest : public ::testing::Test {
+ protected:
+  ReportSpoolTest()
+      : stats_(ServiceControlFilterStats::create("test", context_.scope_)),
+        timer_(new NiceMock<Envoy::Event::MockTimer>(&dispatcher_)) {}
+
+  void makeSpool(uint64_t max_bytes) {
+    spool_ = std::make_unique<ReportSpool>(
+        max_bytes, std::chrono::milliseconds(1000),
+        std::chrono::milliseconds(10), dispatcher_, time_system_,
+        stats_.report_spool_,
+        [this](const std::string& body, ReportSpool::DoneFunc on_done) {
+          replayed_bodies_.push_back(body);
+          replay_dones_.push_back(on_done);
+        });
+  }
+
+  Envoy::Event::SimulatedTimeSystem time_system_;
+  testing::NiceMock<Envoy::Server::Configuration::MockFactoryContext> context_;
+  NiceMock<Envoy::Event::MockDispatcher> dispatcher_;
+  ServiceControlFilterStats stats_;
+  // Owned by the spool.
+  NiceMock<Envoy::Event::MockTimer>* timer_;
+  std::unique_ptr<ReportSpool> spool_;
+
+  std::vector<std::string> replayed_bodies_;
+  std::vector<ReportSpool::DoneFunc> replay_dones_;
+};
+
+TEST_F(ReportSpoolTest, OnlyTransientErrorsSpooled) {
+  makeSpool(100);
+  spool_->onReportDone(OkStatus(), "ok");
+  spool_->onReportDone(Status(StatusCode::kInvalidArgument, "bad"), "bad");
+  spool_->onReportDone(kUnavailable, "12345");
+  spool_->onReportDone(Status(StatusCode::kDeadlineExceeded, "timeout"),
+                       "123");
+
+  EXPECT_EQ(spool_->size(), 2);
+  EXPECT_EQ(spool_->bytes(), 8);
+  EXPECT_EQ(stats_.report_spool_.spooled_bytes_.value(), 8);
+  EXPECT_EQ(stats_.report_spool_.bytes_.value(), 8);
+  EXPECT_FALSE(timer_->enabled());
+
+  spool_.reset();
+  EXPECT_EQ(stats_.report_spool_.bytes_.value(), 0);
+}
+
+TEST_F(ReportSpoolTest, OldestDroppedWhenFull) {
+  makeSpool(10);
+  spool_->onReportDone(kUnavailable, "1234");
+  spool_->onReportDone(kUnavailable, "5678");
+  spool_->onReportDone(kUnavailable, "9012");
+  // Larger than the spool.
+  spool_->onReportDone(kUnavailable, "12345678901");
+
+  EXPECT_EQ(spool_->size(), 2);
+  EXPECT_EQ(spool_->bytes(), 8);
+  EXPECT_EQ(stats_.report_spool_.dropped_bytes_.value(), 15);
+
+  spool_->onReportDone(OkStatus(), "");
+  timer_->invokeCallback();
+  ASSERT_EQ(replayed_bodies_.size(), 1);
+  EXPECT_EQ(replayed_bodies_[0], "5678");
+}
+
+TEST_F(ReportSpoolTest, ExpiredDropped) {
+  makeSpool(100);
+  spool_->onReportDone(kUnavailable, "old");
+  time_system_.advanceTimeWait(std::chrono::milliseconds(600));
+  spool_->onReportDone(kUnavailable, "new");
+  time_system_.advanceTimeWait(std::chrono::milliseconds(400));
+
+  spool_->onReportDone(OkStatus(), "");
+  timer_->invokeCallback();
+  ASSERT_EQ(replayed_bodies_.size(), 1);
+  EXPECT_EQ(replayed_bodies_[0], "new");
+  EXPECT_EQ(stats_.report_spool_.dropped_bytes_.value(), 3);
+}
+
+TEST_F(ReportSpoolTest, ReplayedOneAtATimeAfterSuccess) {
+  makeSpool(100);
+  spool_->onReportDone(kUnavailable, "first");
+  spool_->onReportDone(kUnavailable, "second");
+  EXPECT_FALSE(timer_->enabled());
+
+  EXPECT_CALL(*timer_, enableTimer(std::chrono::milliseconds(10), _)).Times(3);
+  spool_->onReportDone(OkStatus(), "");
+  // Already replaying.
+  spool_->onReportDone(OkStatus(), "");
+
+  timer_->invokeCallback();
+  ASSERT_EQ(replay_dones_.size(), 1);
+  EXPECT_EQ(replayed_bodies_[0], "first");
+  replay_dones_[0](OkStatus());
+
+  timer_->invokeCallback();
+  ASSERT_EQ(replay_dones_.size(), 2);
+  EXPECT_EQ(replayed_bodies_[1], "second");
+  replay_dones_[1](OkStatus());
+
+  // Nothing left, the replay stops.
+  timer_->invokeCallback();
+  EXPECT_EQ(replay_dones_.size(), 2);
+  EXPECT_EQ(spool_->size(), 0);
+  EXPECT_EQ(stats_.report_spool_.replayed_bytes_.value(), 11);
+  EXPECT_EQ(stats_.report_spool_.bytes_.value(), 0);
+}
+
+TEST_F(ReportSpoolTest, FailedReplayPutBack) {
+  makeSpool(100);
+  spool_->onReportDone(kUnavailable, "first");
+  spool_->onReportDone(kUnavailable, "second");
+
+  spool_->onReportDone(OkStatus(), "");
+  timer_->invokeCallback();
+  ASSERT_EQ(replay_dones_.size(), 1);
+  replay_dones_[0](kUnavailable);
+
+  // The failed replay stays first and is not counted as spooled again.
+  EXPECT_EQ(spool_->size(), 2);
+  EXPECT_EQ(stats_.report_spool_.spooled_bytes_.value(), 11);
+  EXPECT_EQ(stats_.report_spool_.replayed_bytes_.value(), 0);
+
+  // The replay resumes on the next success.
+  spool_->onReportDone(OkStatus(), "");
+  timer_->invokeCallback();
+  ASSERT_EQ(replayed_bodies_.size(), 2);
+  EXPECT_EQ(replayed_bodies_[1], "first");
+
+  // A non transient error drops the request.
+  replay_dones_[1](Status(StatusCode::kInvalidArgument, "bad"));
+  EXPECT_EQ(spool_->size(), 1);
+  EXPECT_EQ(stats_.report_spool_.dropped_bytes_.value(), 5);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
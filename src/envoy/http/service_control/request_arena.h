@@ -0,0 +1,83 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "google/protobuf/arena.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// An arena to build the Service Control requests of one worker on.
+//
+// The requests are handed to the client cache, which copies or serializes
+// them before returning, so the arena is reset as soon as no request built on
+// it is in use. Its first block is kept across resets, so a worker builds its
+// requests without heap allocations once the block fits them.
+// Not thread safe.
+class RequestArena {
+ public:
+  // Fits a report with the default logs, metrics and labels.
+  static constexpr size_t kInitialBlockBytes = 16 * 1024;
+
+  // Keeps the arena from being reset while in scope. Scopes nest: a done
+  // callback may build another request while the outer one is still in use.
+  class Scope {
+   public:
+    explicit Scope(RequestArena& arena) : arena_(arena) { ++arena_.depth_; }
+    ~Scope() {
+      if (--arena_.depth_ == 0) {
+        arena_.arena_.Reset();
+      }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    template <typename Message>
+    Message* create() {
+      return google::protobuf::Arena::CreateMessage<Message>(&arena_.arena_);
+    }
+
+   private:
+    RequestArena& arena_;
+  };
+
+  RequestArena()
+      : initial_block_(new char[kInitialBlockBytes]),
+        arena_(arenaOptions(initial_block_.get())) {}
+
+ private:
+  static google::protobuf::ArenaOptions arenaOptions(char* block) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = kInitialBlockBytes;
+    return options;
+  }
+
+  // Must be declared before the arena that uses it.
+  std::unique_ptr<char[]> initial_block_;
+  google::protobuf::Arena arena_;
+  uint32_t depth_ = 0;
+};
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
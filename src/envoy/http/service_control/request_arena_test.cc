@@ -0,0 +1,75 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/request_arena.h"
+
+#include <string>
+
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::ReportRequest;
+
+TEST(RequestArenaTest, MessagesOnArena) {
+  RequestArena arena;
+  RequestArena::Scope scope(arena);
+  auto* request = scope.create<CheckRequest>();
+  request->mutable_operation()->set_operation_name("op-name");
+
+  EXPECT_NE(request->GetArena(), nullptr);
+  EXPECT_EQ(request->operation().GetArena(), request->GetArena());
+  EXPECT_EQ(request->operation().operation_name(), "op-name");
+}
+
+TEST(RequestArenaTest, NestedScopeKeepsOuterMessages) {
+  RequestArena arena;
+  RequestArena::Scope outer(arena);
+  auto* check = outer.create<CheckRequest>();
+  check->mutable_operation()->set_operation_name("op-name");
+
+  {
+    RequestArena::Scope inner(arena);
+    auto* report = inner.create<ReportRequest>();
+    report->add_operations()->set_operation_name(std::string(1024, 'x'));
+  }
+
+  // The inner scope did not reset the arena the outer request lives on.
+  EXPECT_EQ(check->operation().operation_name(), "op-name");
+}
+
+TEST(RequestArenaTest, ReusedAfterReset) {
+  RequestArena arena;
+  for (int i = 0; i < 3; ++i) {
+    RequestArena::Scope scope(arena);
+    auto* report = scope.create<ReportRequest>();
+    for (int j = 0; j < 100; ++j) {
+      // Outgrows the initial block.
+      report->add_operations()->set_operation_name(std::string(1024, 'x'));
+    }
+    EXPECT_EQ(report->operations_size(), 100);
+  }
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -14,9 +14,13 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "api/envoy/v10/http/service_control/config.pb.h"
 #include "envoy/common/pure.h"
 #include "envoy/tracing/http_tracer.h"
+#include "src/envoy/http/service_control/client_cache_status.h"
 #include "src/envoy/http/service_control/service_control_callback_func.h"
 
 namespace espv2 {
@@ -24,6 +28,14 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
+// The state of a service control call, for the admin interface.
+struct ServiceControlCallStatus {
+  std::string service_name;
+  std::string service_config_id;
+  // The status last published by each worker.
+  std::vector<ClientCacheStatus> workers;
+};
+
 class ServiceControlCall {
  public:
   virtual ~ServiceControlCall() = default;
@@ -32,6 +44,13 @@ class ServiceControlCall {
       const ::espv2::api_proxy::service_control::CheckRequestInfo& request_info,
       Envoy::Tracing::Span& parent_span, CheckDoneFunc on_done) PURE;
 
+  // Returns the signature of the check request of the info: its operation,
+  // consumer and labels. The requests of equal signatures get the same
+  // check response.
+  virtual std::string checkSignature(
+      const ::espv2::api_proxy::service_control::CheckRequestInfo&
+          request_info) const PURE;
+
   virtual void callQuota(
       const ::espv2::api_proxy::service_control::QuotaRequestInfo& request_info,
       QuotaDoneFunc on_done) PURE;
@@ -39,15 +58,23 @@ class ServiceControlCall {
   virtual void callReport(
       const ::espv2::api_proxy::service_control::ReportRequestInfo&
           request_info) PURE;
+
+  // Whether reports carry log entries. The logged headers and jwt payloads
+  // are only collected for the reports if they do.
+  virtual bool logsEnabled() const PURE;
+
+  // Returns the state of the call. Does not wait for the workers.
+  virtual ServiceControlCallStatus status() const PURE;
 };
 
-using ServiceControlCallPtr = std::unique_ptr<ServiceControlCall>;
+using ServiceControlCallSharedPtr = std::shared_ptr<ServiceControlCall>;
 
 class ServiceControlCallFactory {
  public:
   virtual ~ServiceControlCallFactory() = default;
 
-  virtual ServiceControlCallPtr create(
+  // The call may be shared with other filter configs of the same service.
+  virtual ServiceControlCallSharedPtr create(
       const ::espv2::api::envoy::v10::http::service_control::Service& config)
       PURE;
 };
@@ -14,9 +14,16 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "absl/strings/str_cat.h"
+#include "envoy/singleton/manager.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "google/protobuf/util/field_mask_util.h"
 #include "google/protobuf/util/time_util.h"
 #include "source/common/common/assert.h"
-#include "src/api_proxy/service_control/logs_metrics_loader.h"
+#include "source/common/common/hash.h"
+#include "source/common/protobuf/utility.h"
+#include "src/api_proxy/utils/memory_bytes.h"
 #include "src/envoy/http/service_control/service_control_call_impl.h"
 
 namespace espv2 {
@@ -24,16 +31,224 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
+SINGLETON_MANAGER_REGISTRATION(logs_metrics_cache);
+SINGLETON_MANAGER_REGISTRATION(service_control_call_registry);
+SINGLETON_MANAGER_REGISTRATION(flush_schedulers);
+
 using ::espv2::api::envoy::v10::http::common::AccessToken;
 using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
 using ::espv2::api::envoy::v10::http::service_control::FilterConfig;
 using ::espv2::api::envoy::v10::http::service_control::Service;
-using ::espv2::api_proxy::service_control::LogsMetricsLoader;
+using ::espv2::api_proxy::service_control::LogSampler;
+using ::espv2::api_proxy::service_control::CheckRequestInfo;
 using ::espv2::api_proxy::service_control::RequestBuilder;
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::ReportRequest;
 using ::google::protobuf::util::TimeUtil;
+using token::TokenConstSharedPtr;
 using token::TokenSubscriber;
 using token::TokenType;
 
+namespace {
+
+// The default maximum number of reports waiting for the build threads.
+constexpr size_t kDefaultReportBuildQueueSize = 10000;
+
+// Returns a copy of the service without its service config.
+Service withoutServiceConfig(const Service& config) {
+  Service copy(config);
+  copy.clear_service_config();
+  return copy;
+}
+
+// Keys the check caches from the fields of the check request info, and
+// builds the request on the arena of the scope only if they need it.
+class InfoCheckRequest
+    : public CheckRequestSource,
+      public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
+ public:
+  InfoCheckRequest(const RequestBuilder& builder, const CheckRequestInfo& info,
+                   RequestArena::Scope& arena_scope)
+      : builder_(builder), info_(info), arena_scope_(arena_scope) {}
+
+  std::string signature() override {
+    RequestBuilder::CheckLabels labels;
+    builder_.GetCheckLabels(info_, &labels);
+    return SharedCheckCache::signature(info_.operation_name, consumerId(),
+                                       absl::MakeSpan(labels));
+  }
+
+  std::string consumerSignature() override {
+    return SharedCheckCache::consumerSignature(info_.operation_name,
+                                               consumerId());
+  }
+
+  const CheckRequest& request() override {
+    if (request_ == nullptr) {
+      request_ = arena_scope_.create<CheckRequest>();
+      (void)builder_.FillCheckRequest(info_, request_);
+      ENVOY_LOG(debug, "Sending check : {}", request_->DebugString());
+    }
+    return *request_;
+  }
+
+ private:
+  // Built once for both signatures.
+  const std::string& consumerId() {
+    if (!consumer_id_.has_value()) {
+      consumer_id_ = RequestBuilder::CheckConsumerId(info_);
+    }
+    return *consumer_id_;
+  }
+
+  const RequestBuilder& builder_;
+  const CheckRequestInfo& info_;
+  RequestArena::Scope& arena_scope_;
+  absl::optional<std::string> consumer_id_;
+  CheckRequest* request_{};
+};
+
+}  // namespace
+
+ThreadLocalCache::~ThreadLocalCache() {
+  if (report_preaggregator_) {
+    flushPreaggregatedReports();
+  }
+  if (report_batch_) {
+    flushReportBatch();
+  }
+}
+
+bool ThreadLocalCache::preaggregateReport(
+    const RequestBuilder& builder,
+    const ::espv2::api_proxy::service_control::ReportRequestInfo& info) {
+  if (!report_preaggregator_ || !report_preaggregator_->Add(builder, info)) {
+    return false;
+  }
+  if (!report_flush_timer_->enabled()) {
+    report_flush_timer_->enableTimer(report_flush_interval_);
+  }
+  return true;
+}
+
+size_t ThreadLocalCache::bytes() const {
+  size_t bytes = RequestArena::kInitialBlockBytes;
+  if (report_preaggregator_) {
+    bytes += report_preaggregator_->bytes();
+  }
+  if (report_batch_) {
+    bytes += report_batch_->SpaceUsedLong();
+  }
+  return bytes;
+}
+
+bool ThreadLocalCache::idle() const {
+  return client_cache_.idle() && !report_batch_posted_ &&
+         (!report_preaggregator_ || report_preaggregator_->size() == 0);
+}
+
+void ThreadLocalCache::flushPreaggregatedReports() {
+  // Not on the arena, so the operations are moved into it, not copied.
+  ReportRequest request;
+  if (report_preaggregator_->Flush(&request)) {
+    client_cache_.callReport(request);
+  }
+}
+
+ReportRequest* ThreadLocalCache::reportBatch() {
+  if (!report_batch_) {
+    return nullptr;
+  }
+  if (!report_batch_posted_) {
+    report_batch_posted_ = true;
+    // The batch goes away with the cache, which may be before the end of the
+    // iteration on shutdown.
+    dispatcher_.post(
+        [this, batch = std::weak_ptr<ReportRequest>(report_batch_)]() {
+          if (batch.lock()) {
+            flushReportBatch();
+          }
+        });
+  }
+  return report_batch_.get();
+}
+
+void ThreadLocalCache::flushReportBatch() {
+  report_batch_posted_ = false;
+  if (report_batch_->operations_size() > 0) {
+    client_cache_.callReport(*report_batch_);
+  }
+  report_batch_->Clear();
+}
+
+ThreadLocalCacheHolder::ThreadLocalCacheHolder(
+    CreateFunc create_fn, ClientCacheStatusSlotSharedPtr status_slot,
+    Envoy::Event::Dispatcher& dispatcher, bool lazy,
+    std::chrono::milliseconds idle_release)
+    : create_fn_(std::move(create_fn)),
+      status_slot_(std::move(status_slot)),
+      idle_release_(idle_release) {
+  if (lazy && idle_release_.count() > 0) {
+    idle_timer_ = dispatcher.createTimer([this]() { onIdleTimer(); });
+  }
+  if (!lazy) {
+    cache_ = create_fn_(status_slot_);
+  }
+}
+
+ThreadLocalCache& ThreadLocalCacheHolder::get() {
+  if (!cache_) {
+    cache_ = create_fn_(status_slot_);
+    cache_->set_sc_authorization(authorization_);
+    cache_->set_quota_authorization(authorization_);
+    if (idle_timer_) {
+      idle_timer_->enableTimer(idle_release_);
+    }
+  }
+  used_ = true;
+  return *cache_;
+}
+
+void ThreadLocalCacheHolder::set_authorization(TokenSharedPtr authorization) {
+  authorization_ = std::move(authorization);
+  if (cache_) {
+    cache_->set_sc_authorization(authorization_);
+    cache_->set_quota_authorization(authorization_);
+  }
+}
+
+void ThreadLocalCacheHolder::onIdleTimer() {
+  if (used_ || !cache_->idle()) {
+    used_ = false;
+    idle_timer_->enableTimer(idle_release_);
+    return;
+  }
+  // The report build jobs still holding the cache drop their reports, see
+  // submitReport(). None is expected after a whole idle interval.
+  cache_.reset();
+  status_slot_->publish(ClientCacheStatus());
+}
+
+void ServiceControlCallImpl::updateToken(const std::string& token) {
+  // Built once here, the calls of all the workers reference it.
+  TokenSharedPtr authorization =
+      std::make_shared<const std::string>(absl::StrCat("Bearer ", token));
+  updateTokenBytes(*authorization, authorization_bytes_);
+  tls_.runOnAllThreads(
+      [authorization](Envoy::OptRef<ThreadLocalCacheHolder> object) {
+        object->set_authorization(authorization);
+      });
+}
+
+void ServiceControlCallImpl::updateTokenBytes(const std::string& token,
+                                              uint64_t& counted_bytes) {
+  const uint64_t bytes = sizeof(token) + HeapBytes(token);
+  memory_stats_.token_bytes_.add(bytes);
+  memory_stats_.token_bytes_.sub(counted_bytes);
+  counted_bytes = bytes;
+}
+
 void ServiceControlCallImpl::createImdsTokenSub() {
   const std::string& token_cluster = filter_config_.imds_token().cluster();
   const std::string& token_uri = filter_config_.imds_token().uri();
@@ -43,13 +258,8 @@ void ServiceControlCallImpl::createImdsTokenSub() {
       filter_config_.dep_error_behavior();
   imds_token_sub_ = token_subscriber_factory_.createImdsTokenSubscriber(
       TokenType::AccessToken, token_cluster, token_uri, fetch_timeout,
-      error_behavior, [this](absl::string_view token) {
-        TokenSharedPtr new_token = std::make_shared<std::string>(token);
-        tls_.runOnAllThreads(
-            [new_token](Envoy::OptRef<ThreadLocalCache> object) {
-              object->set_sc_token(new_token);
-              object->set_quota_token(new_token);
-            });
+      error_behavior, [this](const TokenConstSharedPtr& token) {
+        updateToken(*token);
       });
 }
 
@@ -66,8 +276,9 @@ void ServiceControlCallImpl::createIamTokenSub() {
           filter_config_.dep_error_behavior();
       access_token_sub_ = token_subscriber_factory_.createImdsTokenSubscriber(
           TokenType::AccessToken, cluster, uri, fetch_timeout, error_behavior,
-          [this](absl::string_view access_token) {
-            access_token_for_iam_ = std::string(access_token);
+          [this](const TokenConstSharedPtr& access_token) {
+            access_token_for_iam_ = access_token;
+            updateTokenBytes(*access_token, access_token_for_iam_bytes_);
           });
       break;
     }
@@ -89,34 +300,130 @@ void ServiceControlCallImpl::createIamTokenSub() {
   iam_token_sub_ = token_subscriber_factory_.createIamTokenSubscriber(
       TokenType::AccessToken, token_cluster, token_uri, fetch_timeout,
       error_behavior,
-      [this](absl::string_view token) {
-        TokenSharedPtr new_token = std::make_shared<std::string>(token);
-        tls_.runOnAllThreads(
-            [new_token](Envoy::OptRef<ThreadLocalCache> object) {
-              object->set_sc_token(new_token);
-              object->set_quota_token(new_token);
-            });
-      },
+      [this](const TokenConstSharedPtr& token) { updateToken(*token); },
       filter_config_.iam_token().delegates(), scopes,
-      [this]() { return access_token_for_iam_; });
+      filter_config_.iam_token().access_token(), [this]() {
+        return access_token_for_iam_ == nullptr ? std::string()
+                                                : *access_token_for_iam_;
+      });
+}
+
+void ServiceControlCallImpl::createCheckCacheSnapshotter(
+    Envoy::Server::Configuration::FactoryContext& context) {
+  const auto& snapshot_config = filter_config_.check_cache_snapshot();
+  // Named as their stats.
+  const std::pair<const char*, SharedCheckCacheSharedPtr> named_caches[] = {
+      {"shared_check_cache", shared_check_cache_},
+      {"stale_check_cache", stale_check_cache_},
+      {"negative_check_cache", negative_check_cache_},
+  };
+  std::vector<CheckCacheSnapshotter::Cache> caches;
+  for (const auto& cache : named_caches) {
+    if (cache.second) {
+      caches.push_back({absl::StrCat(snapshot_config.directory(), "/",
+                                     config_.service_name(), ".",
+                                     cache.first),
+                        cache.second});
+    }
+  }
+  if (caches.empty()) {
+    return;
+  }
+  check_cache_snapshotter_ = std::make_unique<CheckCacheSnapshotter>(
+      std::move(caches),
+      snapshot_config.interval_ms() > 0
+          ? std::chrono::milliseconds(snapshot_config.interval_ms())
+          : kCheckCacheSnapshotInterval,
+      context.dispatcher(), context.timeSource());
 }
 
 ServiceControlCallImpl::ServiceControlCallImpl(
     FilterConfigProtoSharedPtr proto_config, const Service& config,
     const std::string& stats_prefix,
     Envoy::Server::Configuration::FactoryContext& context)
-    : filter_config_(*proto_config),
-      token_subscriber_factory_(context),
+    : proto_config_(proto_config),
+      filter_config_(*proto_config_),
+      config_(withoutServiceConfig(config)),
+      // No request is served without the service control tokens.
+      token_subscriber_factory_(context, filter_config_.token_refresh_config(),
+                                /*on_demand=*/false,
+                                token::TokenFetchPriority::High),
+      memory_stats_(ServiceMemoryStats::create(
+          stats_prefix, config.service_name(),
+          context.getServerFactoryContext().scope())),
+      status_slots_(std::make_shared<ClientCacheStatusSlots>()),
       tls_(context.threadLocal()) {
+  // The listener scope goes away with the listener.
+  Envoy::Stats::Scope& scope = context.getServerFactoryContext().scope();
+  const AggregationOptions aggregation_options(config, filter_config_);
+  validateIdleRelease(aggregation_options, filter_config_);
+  if (aggregation_options.shared_check_cache_entries > 0) {
+    shared_check_cache_ = std::make_shared<SharedCheckCache>(
+        aggregation_options.shared_check_cache_entries,
+        std::chrono::milliseconds(aggregation_options.check_flush_interval_ms),
+        std::chrono::milliseconds(aggregation_options.check_refresh_ahead_ms),
+        context.timeSource(),
+        ServiceControlFilterStats::create(stats_prefix, scope)
+            .shared_check_cache_);
+  }
+  if (aggregation_options.check_stale_ms > 0) {
+    // Sized like the check caches it stands in for.
+    stale_check_cache_ = std::make_shared<SharedCheckCache>(
+        std::max(aggregation_options.check_cache_entries,
+                 aggregation_options.shared_check_cache_entries),
+        std::chrono::milliseconds(aggregation_options.check_stale_ms),
+        std::chrono::milliseconds(0), context.timeSource(),
+        ServiceControlFilterStats::create(stats_prefix, scope)
+            .stale_check_cache_);
+  }
+  if (aggregation_options.negative_check_cache_entries > 0) {
+    negative_check_cache_ = std::make_shared<SharedCheckCache>(
+        aggregation_options.negative_check_cache_entries,
+        std::chrono::milliseconds(
+            aggregation_options.negative_check_cache_expiration_ms),
+        std::chrono::milliseconds(0), context.timeSource(),
+        ServiceControlFilterStats::create(stats_prefix, scope)
+            .negative_check_cache_);
+  }
+  if (filter_config_.has_check_cache_snapshot()) {
+    createCheckCacheSnapshotter(context);
+  }
+
+  if (filter_config_.coalesce_flush_timers()) {
+    flush_schedulers_ = context.singletonManager().getTyped<FlushSchedulers>(
+        SINGLETON_MANAGER_REGISTERED_NAME(flush_schedulers),
+        [&context] {
+          return std::make_shared<FlushSchedulers>(context.threadLocal());
+        });
+  }
+
   // Pass shared_ptr of proto_config to the function capture so that
   // it will not be released when the function is called.
-  tls_.set([proto_config, &config, stats_prefix, &scope = context.scope(),
+  tls_.set([proto_config, &config = config_, stats_prefix, &scope,
             &cm = context.clusterManager(),
-            &time_source =
-                context.timeSource()](Envoy::Event::Dispatcher& dispatcher) {
-    return std::make_shared<ThreadLocalCache>(config, *proto_config,
-                                              stats_prefix, scope, cm,
-                                              time_source, dispatcher);
+            &time_source = context.timeSource(),
+            shared_check_cache = shared_check_cache_,
+            stale_check_cache = stale_check_cache_,
+            negative_check_cache = negative_check_cache_,
+            status_slots = status_slots_,
+            flush_schedulers =
+                flush_schedulers_](Envoy::Event::Dispatcher& dispatcher) {
+    auto create_fn = [proto_config, &config, stats_prefix, &scope, &cm,
+                      &time_source, &dispatcher, shared_check_cache,
+                      stale_check_cache, negative_check_cache,
+                      flush_schedulers](
+                         ClientCacheStatusSlotSharedPtr status_slot) {
+      return std::make_shared<ThreadLocalCache>(
+          config, *proto_config, stats_prefix, scope, cm, time_source,
+          dispatcher, shared_check_cache, stale_check_cache,
+          negative_check_cache, std::move(status_slot),
+          flush_schedulers ? flush_schedulers->local() : nullptr);
+    };
+    return std::make_shared<ThreadLocalCacheHolder>(
+        std::move(create_fn), status_slots->add(), dispatcher,
+        proto_config->lazy_client_caches(),
+        std::chrono::milliseconds(
+            proto_config->client_cache_idle_release_ms()));
   });
 
   switch (filter_config_.access_token_case()) {
@@ -131,43 +438,229 @@ ServiceControlCallImpl::ServiceControlCallImpl(
   }
 
   if (config.has_service_config()) {
-    std::set<std::string> logs, metrics, labels;
-    (void)LogsMetricsLoader::Load(config.service_config(), &logs, &metrics,
-                                  &labels);
-    request_builder_.reset(new RequestBuilder(logs, metrics, labels,
-                                              config.service_name(),
-                                              config.service_config_id()));
+    logs_metrics_cache_ =
+        context.singletonManager().getTyped<LogsMetricsCache>(
+            SINGLETON_MANAGER_REGISTERED_NAME(logs_metrics_cache),
+            [] { return std::make_shared<LogsMetricsCache>(); });
+    logs_metrics_ = logs_metrics_cache_->get(config.service_name(),
+                                             config.service_config_id(),
+                                             config.service_config());
+    request_builder_.reset(new RequestBuilder(
+        logs_metrics_->logs, logs_metrics_->metrics, logs_metrics_->labels,
+        config.service_name(), config.service_config_id()));
   } else {
     request_builder_.reset(new RequestBuilder(
         {"endpoints_log"}, config.service_name(), config.service_config_id()));
   }
+  if (config.has_log_sampling()) {
+    request_builder_->set_log_sampler(std::make_unique<LogSampler>(
+        config.log_sampling().success_percentage(),
+        config.log_sampling().max_success_logs_per_consumer_per_second()));
+  }
+
+  if (filter_config_.report_build_threads() > 0) {
+    report_builder_pool_ = std::make_unique<ReportBuilderPool>(
+        context.api().threadFactory(), filter_config_.report_build_threads(),
+        filter_config_.report_build_queue_size() > 0
+            ? filter_config_.report_build_queue_size()
+            : kDefaultReportBuildQueueSize);
+  }
 }  // namespace ServiceControl
 
 CancelFunc ServiceControlCallImpl::callCheck(
     const ::espv2::api_proxy::service_control::CheckRequestInfo& request_info,
     Envoy::Tracing::Span& parent_span, CheckDoneFunc on_done) {
-  ::google::api::servicecontrol::v1::CheckRequest request;
-  (void)request_builder_->FillCheckRequest(request_info, &request);
-  ENVOY_LOG(debug, "Sending check : {}", request.DebugString());
-  return getTLCache().client_cache().callCheck(request, parent_span, on_done);
+  RequestArena::Scope arena_scope(getTLCache().request_arena());
+  // On a cache hit, the check request is not built.
+  InfoCheckRequest request(*request_builder_, request_info, arena_scope);
+  return getTLCache().client_cache().callCheck(
+      request, parent_span, std::move(on_done), request_info.deadline);
+}
+
+std::string ServiceControlCallImpl::checkSignature(
+    const ::espv2::api_proxy::service_control::CheckRequestInfo& request_info)
+    const {
+  RequestBuilder::CheckLabels labels;
+  request_builder_->GetCheckLabels(request_info, &labels);
+  return SharedCheckCache::signature(
+      request_info.operation_name,
+      RequestBuilder::CheckConsumerId(request_info), absl::MakeSpan(labels));
 }
 
 void ServiceControlCallImpl::callQuota(
     const ::espv2::api_proxy::service_control::QuotaRequestInfo& request_info,
     QuotaDoneFunc on_done) {
-  ::google::api::servicecontrol::v1::AllocateQuotaRequest request;
-  (void)request_builder_->FillAllocateQuotaRequest(request_info, &request);
-  ENVOY_LOG(debug, "Sending allocateQuota : {}", request.DebugString());
-  getTLCache().client_cache().callQuota(request, on_done);
+  RequestArena::Scope arena_scope(getTLCache().request_arena());
+  auto* request = arena_scope
+                      .create<::google::api::servicecontrol::v1::
+                                  AllocateQuotaRequest>();
+  (void)request_builder_->FillAllocateQuotaRequest(request_info, request);
+  ENVOY_LOG(debug, "Sending allocateQuota : {}", request->DebugString());
+  getTLCache().client_cache().callQuota(*request, on_done);
 }
 
 void ServiceControlCallImpl::callReport(
     const ::espv2::api_proxy::service_control::ReportRequestInfo&
         request_info) {
-  ::google::api::servicecontrol::v1::ReportRequest request;
-  (void)request_builder_->FillReportRequest(request_info, &request);
-  ENVOY_LOG(debug, "Sending report : {}", request.DebugString());
-  getTLCache().client_cache().callReport(request);
+  if (getTLCache().preaggregateReport(*request_builder_, request_info)) {
+    return;
+  }
+  if (report_builder_pool_ && submitReport(request_info)) {
+    return;
+  }
+  if (auto* batch = getTLCache().reportBatch()) {
+    (void)request_builder_->FillReportRequest(request_info, batch);
+    return;
+  }
+  RequestArena::Scope arena_scope(getTLCache().request_arena());
+  auto* request =
+      arena_scope.create<::google::api::servicecontrol::v1::ReportRequest>();
+  (void)request_builder_->FillReportRequest(request_info, request);
+  ENVOY_LOG(debug, "Sending report : {}", request->DebugString());
+  getTLCache().client_cache().callReport(*request);
+}
+
+bool ServiceControlCallImpl::submitReport(
+    const ::espv2::api_proxy::service_control::ReportRequestInfo&
+        request_info) {
+  auto info = std::make_shared<const OwnedReportRequestInfo>(request_info);
+  ThreadLocalCache& cache = getTLCache();
+  return report_builder_pool_->submit(
+      [builder = request_builder_, info, &dispatcher = cache.dispatcher(),
+       weak_cache = cache.weak_from_this()]() {
+        // The worker is shutting down.
+        if (weak_cache.expired()) {
+          return;
+        }
+        auto request = std::make_shared<ReportRequest>();
+        (void)builder->FillReportRequest(info->info(), request.get());
+        dispatcher.post([weak_cache, request]() {
+          if (auto cache = weak_cache.lock()) {
+            cache->client_cache().callReport(*request);
+          }
+        });
+      });
+}
+
+ServiceControlCallImpl::~ServiceControlCallImpl() {
+  memory_stats_.token_bytes_.sub(authorization_bytes_ +
+                                 access_token_for_iam_bytes_);
+}
+
+ServiceControlCallStatus ServiceControlCallImpl::status() const {
+  return {config_.service_name(), config_.service_config_id(),
+          status_slots_->get()};
+}
+
+std::shared_ptr<ServiceControlCallRegistry> ServiceControlCallRegistry::get(
+    Envoy::Singleton::Manager& singleton_manager) {
+  return singleton_manager.getTyped<ServiceControlCallRegistry>(
+      SINGLETON_MANAGER_REGISTERED_NAME(service_control_call_registry),
+      [] { return std::make_shared<ServiceControlCallRegistry>(); });
+}
+
+ServiceControlCallSharedPtr ServiceControlCallRegistry::getOrCreate(
+    const std::string& key,
+    const std::function<ServiceControlCallSharedPtr()>& create) {
+  if (ServiceControlCallSharedPtr call = calls_[key].lock()) {
+    return call;
+  }
+
+  // Drop the calls of the services no longer configured.
+  for (auto it = calls_.begin(); it != calls_.end();) {
+    if (it->second.expired()) {
+      calls_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  ServiceControlCallSharedPtr call = create();
+  calls_[key] = call;
+  return call;
+}
+
+std::vector<ServiceControlCallStatus> ServiceControlCallRegistry::statuses()
+    const {
+  std::vector<ServiceControlCallStatus> statuses;
+  for (const auto& entry : calls_) {
+    if (ServiceControlCallSharedPtr call = entry.second.lock()) {
+      statuses.push_back(call->status());
+    }
+  }
+  return statuses;
+}
+
+size_t configHash(const Envoy::Protobuf::Message& message) {
+  std::string bytes;
+  {
+    ::google::protobuf::io::StringOutputStream stream(&bytes);
+    ::google::protobuf::io::CodedOutputStream output(&stream);
+    output.SetSerializationDeterministic(true);
+    message.SerializeToCodedStream(&output);
+  }
+  return Envoy::HashUtil::xxHash64(bytes);
+}
+
+void validateIdleRelease(const AggregationOptions& options,
+                         const FilterConfig& filter_config) {
+  const uint32_t idle_release_ms = filter_config.client_cache_idle_release_ms();
+  if (!filter_config.lazy_client_caches() || idle_release_ms == 0) {
+    return;
+  }
+  // The pre-aggregated reports wait for a flush interval, then for another
+  // one in the report cache of the client.
+  uint32_t held_ms = 0;
+  if (options.report_preaggregation_entries > 0) {
+    held_ms += options.report_flush_interval_ms;
+  }
+  if (options.report_cache_entries > 0) {
+    held_ms += options.report_flush_interval_ms;
+  }
+  if (idle_release_ms <= held_ms) {
+    throw Envoy::EnvoyException(absl::StrCat(
+        "client_cache_idle_release_ms (", idle_release_ms,
+        ") must be greater than the ", held_ms,
+        " ms the reports are aggregated for"));
+  }
+}
+
+ServiceControlCallFactoryImpl::ServiceControlCallFactoryImpl(
+    FilterConfigProtoSharedPtr proto_config, const std::string& stats_prefix,
+    Envoy::Server::Configuration::FactoryContext& context)
+    : proto_config_(proto_config),
+      stats_prefix_(stats_prefix),
+      context_(context),
+      registry_(ServiceControlCallRegistry::get(context.singletonManager())) {
+  // Only the filter level fields are copied, not the requirements of every
+  // operation.
+  ::google::protobuf::FieldMask filter_level_fields;
+  const auto* descriptor = FilterConfig::descriptor();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const auto* field = descriptor->field(i);
+    if (field->number() != FilterConfig::kServicesFieldNumber &&
+        field->number() != FilterConfig::kRequirementsFieldNumber) {
+      filter_level_fields.add_paths(field->name());
+    }
+  }
+  FilterConfig filter_level_config;
+  ::google::protobuf::util::FieldMaskUtil::MergeMessageTo(
+      *proto_config_, filter_level_fields,
+      ::google::protobuf::util::FieldMaskUtil::MergeOptions(),
+      &filter_level_config);
+  filter_config_hash_ = configHash(filter_level_config);
+}
+
+ServiceControlCallSharedPtr ServiceControlCallFactoryImpl::create(
+    const Service& config) {
+  const std::string key = absl::StrCat(
+      stats_prefix_, "/", config.service_name(), "/",
+      config.service_config_id(), "/", configHash(config), "/",
+      filter_config_hash_);
+  return registry_->getOrCreate(key, [this, &config]() {
+    return std::make_shared<ServiceControlCallImpl>(proto_config_, config,
+                                                    stats_prefix_, context_);
+  });
 }
 
 }  // namespace service_control
@@ -14,15 +14,24 @@
 
 #pragma once
 
+#include "absl/container/flat_hash_map.h"
 #include "api/envoy/v10/http/service_control/config.pb.h"
 #include "envoy/server/filter_config.h"
+#include "envoy/singleton/instance.h"
+#include "envoy/singleton/manager.h"
 #include "envoy/thread_local/thread_local.h"
 #include "envoy/upstream/cluster_manager.h"
 #include "google/api/service.pb.h"
 #include "source/common/common/empty_string.h"
 #include "source/common/common/logger.h"
+#include "src/api_proxy/service_control/report_preaggregator.h"
 #include "src/api_proxy/service_control/request_builder.h"
+#include "src/envoy/http/service_control/check_cache_snapshot.h"
 #include "src/envoy/http/service_control/client_cache.h"
+#include "src/envoy/http/service_control/flush_scheduler.h"
+#include "src/envoy/http/service_control/logs_metrics_cache.h"
+#include "src/envoy/http/service_control/report_builder_pool.h"
+#include "src/envoy/http/service_control/request_arena.h"
 #include "src/envoy/http/service_control/service_control_call.h"
 #include "src/envoy/token/token_subscriber_factory_impl.h"
 
@@ -31,14 +40,17 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
-// Use shared_ptr to do atomic token update.
-using TokenSharedPtr = std::shared_ptr<std::string>;
+// Use shared_ptr to do atomic token update. Holds the Authorization header
+// value of the token, built once per token and shared by all the workers.
+using TokenSharedPtr = std::shared_ptr<const std::string>;
 
 // The scope for Service Control API
 constexpr char kServiceControlScope[] =
     "https://www.googleapis.com/auth/servicecontrol";
 
-class ThreadLocalCache : public Envoy::ThreadLocal::ThreadLocalObject {
+class ThreadLocalCache
+    : public Envoy::ThreadLocal::ThreadLocalObject,
+      public std::enable_shared_from_this<ThreadLocalCache> {
  public:
   ThreadLocalCache(
       const ::espv2::api::envoy::v10::http::service_control::Service& config,
@@ -46,35 +58,152 @@ class ThreadLocalCache : public Envoy::ThreadLocal::ThreadLocalObject {
           filter_config,
       const std::string& stats_prefix, Envoy::Stats::Scope& scope,
       Envoy::Upstream::ClusterManager& cm, Envoy::TimeSource& time_source,
-      Envoy::Event::Dispatcher& dispatcher)
+      Envoy::Event::Dispatcher& dispatcher,
+      SharedCheckCacheSharedPtr shared_check_cache,
+      SharedCheckCacheSharedPtr stale_check_cache,
+      SharedCheckCacheSharedPtr negative_check_cache,
+      ClientCacheStatusSlotSharedPtr status_slot,
+      FlushSchedulerSharedPtr flush_scheduler)
       : client_cache_(
             config, filter_config, stats_prefix, scope, cm, time_source,
-            dispatcher, [this]() -> const std::string& { return sc_token(); },
-            [this]() -> const std::string& { return quota_token(); }) {}
+            dispatcher,
+            [this]() -> const std::string& { return sc_authorization(); },
+            [this]() -> const std::string& { return quota_authorization(); },
+            shared_check_cache, stale_check_cache, negative_check_cache,
+            std::move(status_slot), std::move(flush_scheduler)),
+        dispatcher_(dispatcher) {
+    const AggregationOptions options(config, filter_config);
+    if (options.report_preaggregation_entries > 0) {
+      report_preaggregator_ = std::make_unique<
+          ::espv2::api_proxy::service_control::ReportPreaggregator>(
+          options.report_preaggregation_entries,
+          options.report_preaggregation_max_consumers);
+      report_flush_interval_ =
+          std::chrono::milliseconds(options.report_flush_interval_ms);
+      report_flush_timer_ =
+          dispatcher.createTimer([this]() { flushPreaggregatedReports(); });
+    }
+    if (options.batch_reports) {
+      report_batch_ = std::make_shared<
+          ::google::api::servicecontrol::v1::ReportRequest>();
+    }
+    client_cache_.set_owner_bytes_fn([this]() { return bytes(); });
+  }
+  ~ThreadLocalCache() override;
+
+  // Returns false if the report is not pre-aggregated, then it is to be sent
+  // as it is.
+  bool preaggregateReport(
+      const ::espv2::api_proxy::service_control::RequestBuilder& builder,
+      const ::espv2::api_proxy::service_control::ReportRequestInfo& info);
+
+  // Returns the request to add the operations of a report to, passed on to
+  // the client cache at the end of the event loop iteration. Returns nullptr
+  // if the reports are not batched.
+  ::google::api::servicecontrol::v1::ReportRequest* reportBatch();
 
-  void set_sc_token(TokenSharedPtr sc_token) { sc_token_ = sc_token; }
-  const std::string& sc_token() const {
-    return (sc_token_) ? *sc_token_ : Envoy::EMPTY_STRING;
+  void set_sc_authorization(TokenSharedPtr sc_authorization) {
+    sc_authorization_ = std::move(sc_authorization);
+  }
+  const std::string& sc_authorization() const {
+    return (sc_authorization_) ? *sc_authorization_ : Envoy::EMPTY_STRING;
   }
 
-  void set_quota_token(TokenSharedPtr quota_token) {
-    quota_token_ = quota_token;
+  void set_quota_authorization(TokenSharedPtr quota_authorization) {
+    quota_authorization_ = std::move(quota_authorization);
   }
-  const std::string& quota_token() const {
-    return (quota_token_) ? *quota_token_ : Envoy::EMPTY_STRING;
+  const std::string& quota_authorization() const {
+    return (quota_authorization_) ? *quota_authorization_
+                                  : Envoy::EMPTY_STRING;
   }
 
   ClientCache& client_cache() { return client_cache_; }
 
+  // Returns true if the client cache is idle and no report is held here, so
+  // the cache can be released without losing any.
+  bool idle() const;
+
+  RequestArena& request_arena() { return request_arena_; }
+
+  Envoy::Event::Dispatcher& dispatcher() { return dispatcher_; }
+
  private:
-  TokenSharedPtr sc_token_;
-  TokenSharedPtr quota_token_;
+  TokenSharedPtr sc_authorization_;
+  TokenSharedPtr quota_authorization_;
   ClientCache client_cache_;
+  RequestArena request_arena_;
+
+  // The memory held for the client cache, roughly: the request arena, the
+  // pre-aggregated and the batched reports.
+  size_t bytes() const;
+
+  // Passes the pre-aggregated reports on to the client cache.
+  void flushPreaggregatedReports();
+
+  // Not set if the reports are not pre-aggregated.
+  std::unique_ptr<::espv2::api_proxy::service_control::ReportPreaggregator>
+      report_preaggregator_;
+  std::chrono::milliseconds report_flush_interval_{};
+  // Only enabled while there are pre-aggregated reports.
+  Envoy::Event::TimerPtr report_flush_timer_;
+
+  // Passes the batched reports on to the client cache.
+  void flushReportBatch();
+
+  Envoy::Event::Dispatcher& dispatcher_;
+  // Not set if the reports are not batched. Kept between the batches, so
+  // the operations of the next one reuse its allocations.
+  std::shared_ptr<::google::api::servicecontrol::v1::ReportRequest>
+      report_batch_;
+  // Whether the flush of the batch is posted.
+  bool report_batch_posted_ = false;
+};
+
+// Holds the thread local cache of a worker. With lazy creation, the cache is
+// created on the first use, and released once it is idle for the release
+// interval.
+class ThreadLocalCacheHolder : public Envoy::ThreadLocal::ThreadLocalObject {
+ public:
+  using CreateFunc = std::function<std::shared_ptr<ThreadLocalCache>(
+      ClientCacheStatusSlotSharedPtr status_slot)>;
+
+  // The cache is created here if not `lazy`. If `idle_release` is 0, the
+  // cache is never released.
+  ThreadLocalCacheHolder(CreateFunc create_fn,
+                         ClientCacheStatusSlotSharedPtr status_slot,
+                         Envoy::Event::Dispatcher& dispatcher, bool lazy,
+                         std::chrono::milliseconds idle_release);
+
+  // Creates the cache if there is none.
+  ThreadLocalCache& get();
+
+  // Sets the token of the cache, and of the ones created after this.
+  void set_authorization(TokenSharedPtr authorization);
+
+ private:
+  // Releases the cache if it was not used since the last time.
+  void onIdleTimer();
+
+  const CreateFunc create_fn_;
+  // Reused by the caches created again.
+  const ClientCacheStatusSlotSharedPtr status_slot_;
+  const std::chrono::milliseconds idle_release_;
+  // Not set if the cache is never released.
+  Envoy::Event::TimerPtr idle_timer_;
+
+  TokenSharedPtr authorization_;
+  // Null until the first use, and once released.
+  std::shared_ptr<ThreadLocalCache> cache_;
+  // Whether the cache was used since the last idle timer.
+  bool used_ = false;
 };
 
 using FilterConfigProtoSharedPtr = std::shared_ptr<
     ::espv2::api::envoy::v10::http::service_control::FilterConfig>;
 
+// May outlive the filter config and listener that created it, see
+// ServiceControlCallRegistry. Only the server wide parts of the context are
+// kept past the constructor.
 class ServiceControlCallImpl
     : public ServiceControlCall,
       public Envoy::Logger::Loggable<Envoy::Logger::Id::filter> {
@@ -84,11 +213,16 @@ class ServiceControlCallImpl
       const ::espv2::api::envoy::v10::http::service_control::Service& config,
       const std::string& stats_prefix,
       Envoy::Server::Configuration::FactoryContext& context);
+  ~ServiceControlCallImpl() override;
 
   CancelFunc callCheck(
       const ::espv2::api_proxy::service_control::CheckRequestInfo& request_info,
       Envoy::Tracing::Span& parent_span, CheckDoneFunc on_done) override;
 
+  std::string checkSignature(
+      const ::espv2::api_proxy::service_control::CheckRequestInfo&
+          request_info) const override;
+
   void callQuota(
       const ::espv2::api_proxy::service_control::QuotaRequestInfo& request_info,
       QuotaDoneFunc on_done) override;
@@ -96,53 +230,146 @@ class ServiceControlCallImpl
   void callReport(const ::espv2::api_proxy::service_control::ReportRequestInfo&
                       request_info) override;
 
+  bool logsEnabled() const override { return request_builder_->has_logs(); }
+
+  ServiceControlCallStatus status() const override;
+
  private:
   // Get thread local cache object.
-  ThreadLocalCache& getTLCache() { return *tls_; }
+  ThreadLocalCache& getTLCache() { return tls_->get(); }
 
+  // Queues the report to be built by the report build threads. Returns false
+  // if the queue is full.
+  bool submitReport(
+      const ::espv2::api_proxy::service_control::ReportRequestInfo&
+          request_info);
+
+  // Publishes the token to the workers.
+  void updateToken(const std::string& token);
+  // Replaces the bytes of a token in the memory stats.
+  void updateTokenBytes(const std::string& token, uint64_t& counted_bytes);
   void createImdsTokenSub();
   void createIamTokenSub();
+  void createCheckCacheSnapshotter(
+      Envoy::Server::Configuration::FactoryContext& context);
 
+  // Owns the filter config this call was built from.
+  const FilterConfigProtoSharedPtr proto_config_;
   const ::espv2::api::envoy::v10::http::service_control::FilterConfig&
       filter_config_;
-  std::unique_ptr<::espv2::api_proxy::service_control::RequestBuilder>
+  // A copy of the service without its service config, which is only read
+  // while the call is created. The filter config may drop the service
+  // configs of its own services while the workers read this one.
+  const ::espv2::api::envoy::v10::http::service_control::Service config_;
+  // Keep the loaded service config alive in the cache for the next config
+  // push.
+  LogsMetricsCacheSharedPtr logs_metrics_cache_;
+  LogsMetricsCache::EntrySharedPtr logs_metrics_;
+  // Shared with the report build jobs.
+  std::shared_ptr<::espv2::api_proxy::service_control::RequestBuilder>
       request_builder_;
 
+  // Only used by the constructor.
   const token::TokenSubscriberFactoryImpl token_subscriber_factory_;
 
   // Token subscriber used to fetch access token from imds for service control
   token::TokenSubscriberPtr imds_token_sub_;
 
-  // Access Token for iam server
-  std::string access_token_for_iam_;
+  // Access Token for iam server, null until the first one.
+  token::TokenConstSharedPtr access_token_for_iam_;
   // Token subscriber used to fetch access token from imds for accessing iam
   token::TokenSubscriberPtr access_token_sub_;
   // Token subscriber used to fetch access token from iam for service control
   token::TokenSubscriberPtr iam_token_sub_;
 
-  Envoy::ThreadLocal::TypedSlot<ThreadLocalCache> tls_;
+  // The memory stats of the service, and the bytes of the tokens counted in
+  // them.
+  ServiceMemoryStats memory_stats_;
+  uint64_t authorization_bytes_ = 0;
+  uint64_t access_token_for_iam_bytes_ = 0;
+
+  // The check cache shared by the thread local caches. Null if disabled.
+  SharedCheckCacheSharedPtr shared_check_cache_;
+  // The known-good check responses shared by the thread local caches. Null if
+  // disabled.
+  SharedCheckCacheSharedPtr stale_check_cache_;
+  // The API key rejections shared by the thread local caches. Null if
+  // disabled.
+  SharedCheckCacheSharedPtr negative_check_cache_;
+  // Snapshots the shared check caches, null if disabled.
+  CheckCacheSnapshotterPtr check_cache_snapshotter_;
+
+  // Where the workers publish the status of their caches.
+  const ClientCacheStatusSlotsSharedPtr status_slots_;
+
+  // The flush schedulers of the workers, null if the caches flush on their
+  // own timers. Outlives the thread local caches.
+  FlushSchedulersSharedPtr flush_schedulers_;
+
+  Envoy::ThreadLocal::TypedSlot<ThreadLocalCacheHolder> tls_;
+
+  // Not set if the workers build the reports. Destroyed first, as its
+  // threads use the builder.
+  std::unique_ptr<ReportBuilderPool> report_builder_pool_;
 };  // namespace ServiceControl
 
+// The service control calls of a server. Filter configs with the same service
+// and the same filter level settings share one call, so a config push keeps
+// the token subscribers and the warm caches of the unchanged services.
+// Must only be used on the main thread.
+class ServiceControlCallRegistry : public Envoy::Singleton::Instance {
+ public:
+  // Returns the registry of the server.
+  static std::shared_ptr<ServiceControlCallRegistry> get(
+      Envoy::Singleton::Manager& singleton_manager);
+
+  // Returns the call of the key, creating it if no one holds it. The call is
+  // freed once its last holder is gone.
+  ServiceControlCallSharedPtr getOrCreate(
+      const std::string& key,
+      const std::function<ServiceControlCallSharedPtr()>& create);
+
+  // Returns the status of each call held.
+  std::vector<ServiceControlCallStatus> statuses() const;
+
+ private:
+  absl::flat_hash_map<std::string, std::weak_ptr<ServiceControlCall>> calls_;
+};
+
+using ServiceControlCallRegistrySharedPtr =
+    std::shared_ptr<ServiceControlCallRegistry>;
+
+// Returns a hash of the message from its deterministic binary encoding, to
+// key the registry. Several times faster than Envoy::MessageUtil::hash, which
+// prints the text format, on the service configs of many methods. Only
+// stable within a build.
+size_t configHash(const Envoy::Protobuf::Message& message);
+
+// Throws an EnvoyException if the client caches of a service with the
+// options may be released while they still aggregate reports: the release
+// interval must be longer than the reports are held.
+void validateIdleRelease(
+    const AggregationOptions& options,
+    const ::espv2::api::envoy::v10::http::service_control::FilterConfig&
+        filter_config);
+
 class ServiceControlCallFactoryImpl : public ServiceControlCallFactory {
  public:
   explicit ServiceControlCallFactoryImpl(
       FilterConfigProtoSharedPtr proto_config, const std::string& stats_prefix,
-      Envoy::Server::Configuration::FactoryContext& context)
-      : proto_config_(proto_config),
-        stats_prefix_(stats_prefix),
-        context_(context) {}
+      Envoy::Server::Configuration::FactoryContext& context);
 
-  ServiceControlCallPtr create(
+  ServiceControlCallSharedPtr create(
       const ::espv2::api::envoy::v10::http::service_control::Service& config)
-      override {
-    return std::make_unique<ServiceControlCallImpl>(proto_config_, config,
-                                                    stats_prefix_, context_);
-  }
+      override;
 
  private:
   FilterConfigProtoSharedPtr proto_config_;
   std::string stats_prefix_;
   Envoy::Server::Configuration::FactoryContext& context_;
+  ServiceControlCallRegistrySharedPtr registry_;
+  // The hash of the filter config, without its services and requirements.
+  size_t filter_config_hash_;
 };
 
 }  // namespace service_control
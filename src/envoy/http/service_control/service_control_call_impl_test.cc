@@ -0,0 +1,123 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/service_control_call_impl.h"
+
+#include "envoy/common/exception.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "src/envoy/http/service_control/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+TEST(ServiceControlCallRegistryTest, SharedWhileHeld) {
+  ServiceControlCallRegistry registry;
+  int created = 0;
+  auto create = [&created]() -> ServiceControlCallSharedPtr {
+    ++created;
+    return std::make_shared<testing::NiceMock<MockServiceControlCall>>();
+  };
+
+  ServiceControlCallSharedPtr call = registry.getOrCreate("echo/1", create);
+  EXPECT_EQ(registry.getOrCreate("echo/1", create), call);
+  EXPECT_EQ(created, 1);
+
+  // Other keys get their own call.
+  ServiceControlCallSharedPtr other = registry.getOrCreate("echo/2", create);
+  EXPECT_NE(other, call);
+  EXPECT_EQ(created, 2);
+
+  // The call is created again once no one holds it.
+  call.reset();
+  registry.getOrCreate("echo/1", create);
+  EXPECT_EQ(created, 3);
+}
+
+TEST(ServiceControlCallRegistryTest, StatusesOfHeldCalls) {
+  ServiceControlCallRegistry registry;
+  auto create = []() -> ServiceControlCallSharedPtr {
+    auto call = std::make_shared<testing::NiceMock<MockServiceControlCall>>();
+    ServiceControlCallStatus status;
+    status.service_name = "echo";
+    status.workers.resize(2);
+    ON_CALL(*call, status()).WillByDefault(testing::Return(status));
+    return call;
+  };
+
+  ServiceControlCallSharedPtr call = registry.getOrCreate("echo/1", create);
+  registry.getOrCreate("echo/2", create);
+  const std::vector<ServiceControlCallStatus> statuses = registry.statuses();
+  ASSERT_EQ(statuses.size(), 1);
+  EXPECT_EQ(statuses[0].service_name, "echo");
+  EXPECT_EQ(statuses[0].workers.size(), 2);
+}
+
+TEST(ServiceControlCallFactoryTest, ConfigHashOfContent) {
+  ::espv2::api::envoy::v10::http::service_control::Service config;
+  config.set_service_name("echo");
+  config.set_service_config_id("1");
+  config.mutable_service_config()->add_metrics()->set_name("request_count");
+  const size_t hash = configHash(config);
+
+  auto copy = config;
+  EXPECT_EQ(configHash(copy), hash);
+
+  copy.mutable_service_config()->mutable_metrics(0)->set_name("latencies");
+  EXPECT_NE(configHash(copy), hash);
+}
+
+TEST(ServiceControlCallFactoryTest, IdleReleaseLongerThanAggregation) {
+  ::espv2::api::envoy::v10::http::service_control::FilterConfig filter_config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"(
+        lazy_client_caches: true
+        client_cache_idle_release_ms: 1500
+        aggregation_config { report_flush_interval_ms { value: 1000 } }
+      )",
+      &filter_config));
+  const ::espv2::api::envoy::v10::http::service_control::Service config;
+  EXPECT_NO_THROW(
+      validateIdleRelease(AggregationOptions(config, filter_config),
+                          filter_config));
+
+  // The pre-aggregated reports are held for two intervals.
+  filter_config.mutable_aggregation_config()
+      ->mutable_report_preaggregation_entries()
+      ->set_value(100);
+  EXPECT_THROW(validateIdleRelease(AggregationOptions(config, filter_config),
+                                   filter_config),
+               Envoy::EnvoyException);
+
+  filter_config.set_client_cache_idle_release_ms(2001);
+  EXPECT_NO_THROW(
+      validateIdleRelease(AggregationOptions(config, filter_config),
+                          filter_config));
+
+  // The caches that are never released hold their reports.
+  filter_config.set_client_cache_idle_release_ms(0);
+  EXPECT_NO_THROW(
+      validateIdleRelease(AggregationOptions(config, filter_config),
+                          filter_config));
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
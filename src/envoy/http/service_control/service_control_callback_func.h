@@ -22,15 +22,16 @@ namespace envoy {
 namespace http_filters {
 namespace service_control {
 
-// The function to be called when check call is completed.
+// The function to be called when check call is completed. The response info
+// is passed by value so the callee can move it.
 using CheckDoneFunc = std::function<void(
     const ::google::protobuf::util::Status& status,
-    const ::espv2::api_proxy::service_control::CheckResponseInfo&)>;
+    ::espv2::api_proxy::service_control::CheckResponseInfo)>;
 
 // The function to be called when allocateQuota call is completed.
 using QuotaDoneFunc = std::function<void(
     const ::google::protobuf::util::Status& status,
-    const ::espv2::api_proxy::service_control::QuotaResponseInfo&)>;
+    ::espv2::api_proxy::service_control::QuotaResponseInfo)>;
 
 // The function to cancel a on-going request.
 using CancelFunc = std::function<void()>;
@@ -0,0 +1,288 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/shared_check_cache.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/str_cat.h"
+#include "src/api_proxy/service_control/check_response_convert_utils.h"
+#include "src/api_proxy/utils/memory_bytes.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::CheckResponse;
+
+namespace {
+
+// Separates the fields of a signature. It can not appear in the fields.
+constexpr absl::string_view kSignatureDelimiter("\0", 1);
+
+}  // namespace
+
+CachedCheckResponse::CachedCheckResponse(const CheckResponse& response,
+                                         const std::string& service_name)
+    : status(api_proxy::service_control::ConvertCheckResponse(
+          response, service_name, &info)) {}
+
+size_t CachedCheckResponse::bytes() const {
+  return sizeof(*this) + HeapBytes(info.consumer_project_number) +
+         HeapBytes(info.consumer_type) + HeapBytes(info.consumer_number) +
+         HeapBytes(info.error.name) + status.message().size();
+}
+
+SharedCheckCache::SharedCheckCache(uint32_t max_entries,
+                                   std::chrono::milliseconds expiration,
+                                   std::chrono::milliseconds refresh_ahead,
+                                   Envoy::TimeSource& time_source,
+                                   const SharedCheckCacheStats& stats)
+    : max_entries_per_shard_(std::max<size_t>(
+          1, (max_entries + kNumShards - 1) / kNumShards)),
+      expiration_(expiration),
+      refresh_ahead_(refresh_ahead),
+      time_source_(time_source),
+      stats_(stats) {}
+
+SharedCheckCache::~SharedCheckCache() {
+  for (auto& shard : shards_) {
+    absl::MutexLock lock(&shard.mutex);
+    stats_.entries_.sub(shard.entries.size());
+    for (const auto& entry : shard.entries) {
+      stats_.bytes_.sub(entry.second.bytes);
+    }
+  }
+}
+
+std::string SharedCheckCache::signature(const CheckRequest& request) {
+  const auto& operation = request.operation();
+  std::vector<std::pair<absl::string_view, absl::string_view>> labels;
+  labels.reserve(operation.labels().size());
+  for (const auto& label : operation.labels()) {
+    labels.emplace_back(label.first, label.second);
+  }
+  return signature(operation.operation_name(), operation.consumer_id(),
+                   absl::MakeSpan(labels));
+}
+
+std::string SharedCheckCache::consumerSignature(const CheckRequest& request) {
+  return consumerSignature(request.operation().operation_name(),
+                           request.operation().consumer_id());
+}
+
+std::string SharedCheckCache::signature(
+    absl::string_view operation_name, absl::string_view consumer_id,
+    absl::Span<std::pair<absl::string_view, absl::string_view>> labels) {
+  // Map iteration order is not defined, sort the labels to get a stable
+  // signature.
+  std::sort(labels.begin(), labels.end());
+
+  std::string signature = consumerSignature(operation_name, consumer_id);
+  for (const auto& label : labels) {
+    absl::StrAppend(&signature, kSignatureDelimiter, label.first, "=",
+                    label.second);
+  }
+  return signature;
+}
+
+std::string SharedCheckCache::consumerSignature(
+    absl::string_view operation_name, absl::string_view consumer_id) {
+  return absl::StrCat(operation_name, kSignatureDelimiter, consumer_id);
+}
+
+SharedCheckCache::Shard& SharedCheckCache::shardFor(
+    absl::string_view signature) {
+  return shards_[absl::Hash<absl::string_view>{}(signature) &
+                 (kNumShards - 1)];
+}
+
+CachedCheckResponseConstSharedPtr SharedCheckCache::lookup(
+    absl::string_view signature, bool* refresh) {
+  Shard& shard = shardFor(signature);
+  const Envoy::MonotonicTime now = time_source_.monotonicTime();
+
+  CachedCheckResponseConstSharedPtr response;
+  bool in_refresh_window;
+  {
+    absl::ReaderMutexLock lock(&shard.mutex);
+    const auto it = shard.entries.find(signature);
+    if (it == shard.entries.end() || it->second.expire_time <= now) {
+      stats_.miss_.inc();
+      return nullptr;
+    }
+
+    response = it->second.response;
+    it->second.referenced.store(true, std::memory_order_relaxed);
+    in_refresh_window = refresh_ahead_.count() > 0 &&
+                        !it->second.refreshing &&
+                        it->second.expire_time - now <= refresh_ahead_;
+  }
+  stats_.hit_.inc();
+
+  if (refresh != nullptr) {
+    // Only take the writer lock for the rare hits in the window.
+    *refresh = in_refresh_window && startRefresh(shard, signature);
+  }
+  return response;
+}
+
+bool SharedCheckCache::startRefresh(Shard& shard,
+                                    absl::string_view signature) {
+  absl::MutexLock lock(&shard.mutex);
+  const auto it = shard.entries.find(signature);
+  if (it == shard.entries.end() || it->second.refreshing) {
+    return false;
+  }
+  it->second.refreshing = true;
+  stats_.refreshed_ahead_.inc();
+  return true;
+}
+
+void SharedCheckCache::cancelRefresh(absl::string_view signature) {
+  Shard& shard = shardFor(signature);
+
+  absl::MutexLock lock(&shard.mutex);
+  const auto it = shard.entries.find(signature);
+  if (it != shard.entries.end()) {
+    it->second.refreshing = false;
+  }
+}
+
+void SharedCheckCache::insert(const std::string& signature,
+                              CachedCheckResponseConstSharedPtr response) {
+  Shard& shard = shardFor(signature);
+  const Envoy::MonotonicTime now = time_source_.monotonicTime();
+
+  absl::MutexLock lock(&shard.mutex);
+  setResponse(*findOrInsert(shard, signature, now), std::move(response),
+              now + expiration_);
+}
+
+bool SharedCheckCache::restore(const std::string& signature,
+                               CachedCheckResponseConstSharedPtr response,
+                               std::chrono::milliseconds time_left) {
+  Shard& shard = shardFor(signature);
+  const Envoy::MonotonicTime now = time_source_.monotonicTime();
+
+  absl::MutexLock lock(&shard.mutex);
+  const auto existing = shard.entries.find(signature);
+  if (existing != shard.entries.end() && existing->second.expire_time > now) {
+    return false;
+  }
+  setResponse(*findOrInsert(shard, signature, now), std::move(response),
+              now + std::min(time_left, expiration_));
+  stats_.restored_.inc();
+  return true;
+}
+
+SharedCheckCache::EntryMap::iterator SharedCheckCache::findOrInsert(
+    Shard& shard, const std::string& signature, Envoy::MonotonicTime now) {
+  auto it = shard.entries.find(signature);
+  if (it == shard.entries.end()) {
+    if (shard.entries.size() >= max_entries_per_shard_) {
+      evict(shard, now);
+    }
+    it = shard.entries.try_emplace(signature).first;
+    it->second.clock_index = shard.clock.size();
+    shard.clock.push_back(&*it);
+    stats_.entries_.inc();
+  }
+  return it;
+}
+
+void SharedCheckCache::setResponse(
+    EntryMap::value_type& entry,
+    CachedCheckResponseConstSharedPtr response,
+    Envoy::MonotonicTime expire_time) {
+  const size_t bytes =
+      sizeof(entry) + HeapBytes(entry.first) + response->bytes();
+  stats_.bytes_.add(bytes);
+  stats_.bytes_.sub(entry.second.bytes);
+  entry.second.bytes = bytes;
+  entry.second.response = std::move(response);
+  entry.second.expire_time = expire_time;
+  entry.second.refreshing = false;
+}
+
+void SharedCheckCache::forEach(const ForEachFunc& fn) {
+  const Envoy::MonotonicTime now = time_source_.monotonicTime();
+  for (auto& shard : shards_) {
+    absl::ReaderMutexLock lock(&shard.mutex);
+    for (const auto& entry : shard.entries) {
+      if (entry.second.expire_time > now) {
+        fn(entry.first, *entry.second.response,
+           std::chrono::duration_cast<std::chrono::milliseconds>(
+               entry.second.expire_time - now));
+      }
+    }
+  }
+}
+
+void SharedCheckCache::remove(absl::string_view signature) {
+  Shard& shard = shardFor(signature);
+
+  absl::MutexLock lock(&shard.mutex);
+  const auto it = shard.entries.find(signature);
+  if (it != shard.entries.end()) {
+    erase(shard, it);
+  }
+}
+
+void SharedCheckCache::erase(Shard& shard, EntryMap::iterator it) {
+  // The last entry of the clock takes the place of the erased one.
+  const size_t index = it->second.clock_index;
+  shard.clock[index] = shard.clock.back();
+  shard.clock[index]->second.clock_index = index;
+  shard.clock.pop_back();
+
+  stats_.bytes_.sub(it->second.bytes);
+  stats_.entries_.dec();
+  shard.entries.erase(it);
+}
+
+void SharedCheckCache::evict(Shard& shard, Envoy::MonotonicTime now) {
+  if (shard.clock.empty()) {
+    return;
+  }
+
+  for (size_t scanned = 0; scanned < kMaxEvictionScan; ++scanned) {
+    if (shard.hand >= shard.clock.size()) {
+      shard.hand = 0;
+    }
+    Entry& entry = shard.clock[shard.hand]->second;
+    if (entry.expire_time <= now ||
+        !entry.referenced.exchange(false, std::memory_order_relaxed)) {
+      break;
+    }
+    ++shard.hand;
+  }
+
+  if (shard.hand >= shard.clock.size()) {
+    shard.hand = 0;
+  }
+  erase(shard, shard.entries.find(shard.clock[shard.hand]->first));
+  stats_.evicted_.inc();
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
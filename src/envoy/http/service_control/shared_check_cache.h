@@ -0,0 +1,203 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/node_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "envoy/common/time.h"
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "google/protobuf/stubs/status.h"
+#include "src/api_proxy/service_control/request_info.h"
+#include "src/envoy/http/service_control/filter_stats.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// A cached check response, converted once when it is cached rather than on
+// every hit. Only the info and status the hits are answered with are kept,
+// not the response. It is immutable and shared by the hits.
+struct CachedCheckResponse {
+  CachedCheckResponse(
+      const ::google::api::servicecontrol::v1::CheckResponse& response,
+      const std::string& service_name);
+  // An already converted response, e.g. restored from a snapshot.
+  CachedCheckResponse(
+      ::espv2::api_proxy::service_control::CheckResponseInfo info,
+      ::google::protobuf::util::Status status)
+      : info(std::move(info)), status(std::move(status)) {}
+
+  // The bytes the response retains, including its heap strings.
+  size_t bytes() const;
+
+  // The info and status the response converts to. The info is declared
+  // first, it is filled in by the conversion.
+  ::espv2::api_proxy::service_control::CheckResponseInfo info;
+  ::google::protobuf::util::Status status;
+};
+
+using CachedCheckResponseConstSharedPtr =
+    std::shared_ptr<const CachedCheckResponse>;
+
+// A check response cache shared by the workers of one service.
+//
+// Entries are spread over lock-striped shards by signature, so workers looking
+// up different requests rarely contend. Each entry expires a fixed time after
+// it was inserted; the next miss then refreshes it with a new Check call. If
+// a refresh-ahead window is set, the first hit within the window before the
+// expiry asks its caller to refresh the entry in the background instead.
+//
+// A full shard evicts with a clock: its hand passes over a few entries, and
+// evicts the first one expired or not hit since the hand last passed it.
+class SharedCheckCache {
+ public:
+  SharedCheckCache(uint32_t max_entries, std::chrono::milliseconds expiration,
+                   std::chrono::milliseconds refresh_ahead,
+                   Envoy::TimeSource& time_source,
+                   const SharedCheckCacheStats& stats);
+  ~SharedCheckCache();
+
+  // Returns the signature of the check request. Requests with the same
+  // signature yield the same check response.
+  static std::string signature(
+      const ::google::api::servicecontrol::v1::CheckRequest& request);
+
+  // Returns the signature of the operation and consumer of the check
+  // request, ignoring the labels.
+  static std::string consumerSignature(
+      const ::google::api::servicecontrol::v1::CheckRequest& request);
+
+  // Same as above, from the fields set in the check request, so the callers
+  // may key the cache before building it. The labels are sorted in place.
+  static std::string signature(
+      absl::string_view operation_name, absl::string_view consumer_id,
+      absl::Span<std::pair<absl::string_view, absl::string_view>> labels);
+  static std::string consumerSignature(absl::string_view operation_name,
+                                       absl::string_view consumer_id);
+
+  // Returns the cached response for the signature, or nullptr if there is no
+  // unexpired entry. On a hit, `refresh` is set to true if the caller should
+  // refresh the entry; it is set for a single caller per entry.
+  CachedCheckResponseConstSharedPtr lookup(absl::string_view signature,
+                                           bool* refresh = nullptr);
+
+  // Caches the response for the signature, replacing any existing entry.
+  void insert(const std::string& signature,
+              CachedCheckResponseConstSharedPtr response);
+
+  // Removes the entry of the signature, if any.
+  void remove(absl::string_view signature);
+
+  // Called by the caller asked to refresh the entry of the signature if the
+  // refresh failed, so the next hit in the window is asked to refresh it.
+  void cancelRefresh(absl::string_view signature);
+
+  // Calls the function with each unexpired entry and the time it has left,
+  // under the lock of its shard.
+  using ForEachFunc =
+      std::function<void(const std::string& signature,
+                         const CachedCheckResponse& response,
+                         std::chrono::milliseconds time_left)>;
+  void forEach(const ForEachFunc& fn);
+
+  // Caches the response for the signature for the time it has left, at most
+  // the expiration, e.g. from a snapshot of the previous process. The
+  // unexpired entries are kept, then false is returned.
+  bool restore(const std::string& signature,
+               CachedCheckResponseConstSharedPtr response,
+               std::chrono::milliseconds time_left);
+
+ private:
+  struct Entry {
+    CachedCheckResponseConstSharedPtr response;
+    Envoy::MonotonicTime expire_time;
+    // Whether a caller was asked to refresh the entry.
+    bool refreshing = false;
+    // The bytes counted in the bytes gauge for the entry and its signature.
+    size_t bytes = 0;
+    // Set by the hits, under the reader lock, and cleared by the clock hand.
+    std::atomic<bool> referenced{false};
+    // The position of the entry in the clock of its shard.
+    size_t clock_index = 0;
+  };
+
+  using EntryMap = absl::node_hash_map<std::string, Entry>;
+
+  struct Shard {
+    absl::Mutex mutex;
+    // A node map, so the clock can point to its entries.
+    EntryMap entries ABSL_GUARDED_BY(mutex);
+    // The entries, in no particular order, and the next one to look at.
+    std::vector<EntryMap::value_type*> clock ABSL_GUARDED_BY(mutex);
+    size_t hand ABSL_GUARDED_BY(mutex) = 0;
+  };
+
+  // Must be a power of 2.
+  static constexpr size_t kNumShards = 16;
+  // The most entries the clock hand looks at to evict one.
+  static constexpr size_t kMaxEvictionScan = 8;
+
+  Shard& shardFor(absl::string_view signature);
+
+  // Returns the entry of the signature, inserted if needed, evicting others
+  // to make room for it.
+  EntryMap::iterator findOrInsert(
+      Shard& shard, const std::string& signature, Envoy::MonotonicTime now)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.mutex);
+
+  // Updates the response of the entry, and the bytes gauge. The lock of
+  // its shard must be held.
+  void setResponse(EntryMap::value_type& entry,
+                   CachedCheckResponseConstSharedPtr response,
+                   Envoy::MonotonicTime expire_time);
+
+  // Erases the entry, which must be in the shard, and updates the gauges.
+  void erase(Shard& shard, EntryMap::iterator it)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.mutex);
+
+  // Marks the entry as being refreshed. Returns false if it is gone or
+  // another caller already refreshes it.
+  bool startRefresh(Shard& shard, absl::string_view signature);
+
+  // Evicts one entry of the shard: the first one from the clock hand that is
+  // expired or not referenced, or the next one if the scanned ones all are.
+  void evict(Shard& shard, Envoy::MonotonicTime now)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.mutex);
+
+  const size_t max_entries_per_shard_;
+  const std::chrono::milliseconds expiration_;
+  const std::chrono::milliseconds refresh_ahead_;
+  Envoy::TimeSource& time_source_;
+  SharedCheckCacheStats stats_;
+  std::array<Shard, kNumShards> shards_;
+};
+
+using SharedCheckCacheSharedPtr = std::shared_ptr<SharedCheckCache>;
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,284 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/shared_check_cache.h"
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "src/api_proxy/service_control/request_builder.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::espv2::api_proxy::service_control::CheckRequestInfo;
+using ::espv2::api_proxy::service_control::RequestBuilder;
+using ::espv2::api_proxy::service_control::ScResponseErrorType;
+using ::google::api::servicecontrol::v1::CheckError;
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::CheckResponse;
+using ::google::protobuf::util::StatusCode;
+
+class SharedCheckCacheTest : public ::testing::Test {
+ protected:
+  SharedCheckCacheTest()
+      : stats_(ServiceControlFilterStats::create("test", context_.scope_)) {}
+
+  std::unique_ptr<SharedCheckCache> makeCache(uint32_t max_entries,
+                                              uint32_t refresh_ahead_ms = 0) {
+    return std::make_unique<SharedCheckCache>(
+        max_entries, std::chrono::milliseconds(1000),
+        std::chrono::milliseconds(refresh_ahead_ms), time_system_,
+        stats_.shared_check_cache_);
+  }
+
+  // The consumer number tells the responses apart.
+  CachedCheckResponseConstSharedPtr makeResponse(int64_t consumer_number) {
+    CheckResponse response;
+    response.mutable_check_info()->mutable_consumer_info()->set_consumer_number(
+        consumer_number);
+    return std::make_shared<const CachedCheckResponse>(response, "service");
+  }
+
+  Envoy::Event::SimulatedTimeSystem time_system_;
+  testing::NiceMock<Envoy::Server::Configuration::MockFactoryContext> context_;
+  ServiceControlFilterStats stats_;
+};
+
+TEST_F(SharedCheckCacheTest, HitAndMiss) {
+  auto cache = makeCache(100);
+
+  EXPECT_EQ(cache->lookup("signature"), nullptr);
+  cache->insert("signature", makeResponse(1));
+  CachedCheckResponseConstSharedPtr got = cache->lookup("signature");
+  ASSERT_NE(got, nullptr);
+  EXPECT_EQ(got->info.consumer_number, "1");
+  EXPECT_EQ(cache->lookup("other-signature"), nullptr);
+
+  EXPECT_EQ(stats_.shared_check_cache_.hit_.value(), 1);
+  EXPECT_EQ(stats_.shared_check_cache_.miss_.value(), 2);
+  EXPECT_EQ(stats_.shared_check_cache_.entries_.value(), 1);
+
+  cache.reset();
+  EXPECT_EQ(stats_.shared_check_cache_.entries_.value(), 0);
+}
+
+TEST_F(SharedCheckCacheTest, BytesGauge) {
+  auto cache = makeCache(100);
+  const CachedCheckResponseConstSharedPtr response = makeResponse(1);
+  EXPECT_GE(response->bytes(), sizeof(CachedCheckResponse));
+
+  // The long signature is on the heap, and counted with the entry.
+  const std::string signature(100, 's');
+  cache->insert(signature, response);
+  const uint64_t bytes = stats_.shared_check_cache_.bytes_.value();
+  EXPECT_GT(bytes, response->bytes() + signature.size());
+
+  // Replacing the entry does not count it twice.
+  cache->insert(signature, response);
+  EXPECT_EQ(stats_.shared_check_cache_.bytes_.value(), bytes);
+
+  cache->insert("other-signature", response);
+  cache->remove(signature);
+  EXPECT_LT(stats_.shared_check_cache_.bytes_.value(), bytes);
+  cache.reset();
+  EXPECT_EQ(stats_.shared_check_cache_.bytes_.value(), 0);
+}
+
+TEST_F(SharedCheckCacheTest, EntryExpires) {
+  auto cache = makeCache(100);
+
+  cache->insert("signature", makeResponse(1));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(999));
+  EXPECT_NE(cache->lookup("signature"), nullptr);
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1));
+  EXPECT_EQ(cache->lookup("signature"), nullptr);
+
+  // Inserting again refreshes the entry.
+  cache->insert("signature", makeResponse(2));
+  CachedCheckResponseConstSharedPtr got = cache->lookup("signature");
+  ASSERT_NE(got, nullptr);
+  EXPECT_EQ(got->info.consumer_number, "2");
+  EXPECT_EQ(stats_.shared_check_cache_.entries_.value(), 1);
+}
+
+TEST_F(SharedCheckCacheTest, RefreshAhead) {
+  auto cache = makeCache(100, 200);
+  bool refresh = true;
+
+  cache->insert("signature", makeResponse(1));
+  EXPECT_NE(cache->lookup("signature", &refresh), nullptr);
+  EXPECT_FALSE(refresh);
+
+  // Within the window, only the first hit refreshes.
+  time_system_.advanceTimeWait(std::chrono::milliseconds(800));
+  EXPECT_NE(cache->lookup("signature", &refresh), nullptr);
+  EXPECT_TRUE(refresh);
+  EXPECT_NE(cache->lookup("signature", &refresh), nullptr);
+  EXPECT_FALSE(refresh);
+  EXPECT_EQ(stats_.shared_check_cache_.refreshed_ahead_.value(), 1);
+
+  // The refreshed entry can be refreshed again before its new expiry.
+  cache->insert("signature", makeResponse(2));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(800));
+  CachedCheckResponseConstSharedPtr got = cache->lookup("signature", &refresh);
+  ASSERT_NE(got, nullptr);
+  EXPECT_TRUE(refresh);
+  EXPECT_EQ(got->info.consumer_number, "2");
+}
+
+TEST_F(SharedCheckCacheTest, RefreshAheadAgainAfterCancel) {
+  auto cache = makeCache(100, 200);
+  bool refresh = false;
+
+  cache->insert("signature", makeResponse(1));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(800));
+  EXPECT_NE(cache->lookup("signature", &refresh), nullptr);
+  EXPECT_TRUE(refresh);
+
+  // The refresh failed, the next hit refreshes.
+  cache->cancelRefresh("signature");
+  EXPECT_NE(cache->lookup("signature", &refresh), nullptr);
+  EXPECT_TRUE(refresh);
+  EXPECT_EQ(stats_.shared_check_cache_.refreshed_ahead_.value(), 2);
+
+  // Unknown signatures are ignored.
+  cache->cancelRefresh("other");
+}
+
+TEST_F(SharedCheckCacheTest, NoRefreshAheadByDefault) {
+  auto cache = makeCache(100);
+  bool refresh = true;
+
+  cache->insert("signature", makeResponse(1));
+  time_system_.advanceTimeWait(std::chrono::milliseconds(999));
+  EXPECT_NE(cache->lookup("signature", &refresh), nullptr);
+  EXPECT_FALSE(refresh);
+}
+
+TEST_F(SharedCheckCacheTest, EvictWhenFull) {
+  // Rounded up to one entry per shard.
+  auto cache = makeCache(1);
+  int found = 0;
+  for (int i = 0; i < 64; ++i) {
+    cache->insert(absl::StrCat("signature-", i), makeResponse(1));
+  }
+  for (int i = 0; i < 64; ++i) {
+    if (cache->lookup(absl::StrCat("signature-", i)) != nullptr) {
+      ++found;
+    }
+  }
+
+  // At most one entry per shard is kept.
+  EXPECT_LE(found, 16);
+  EXPECT_EQ(stats_.shared_check_cache_.entries_.value(), found);
+  EXPECT_EQ(stats_.shared_check_cache_.evicted_.value(), 64 - found);
+}
+
+TEST_F(SharedCheckCacheTest, EvictKeepsRecentlyHitEntry) {
+  // Two entries per shard.
+  auto cache = makeCache(32);
+  cache->insert("hot", makeResponse(1));
+  for (int i = 0; i < 64; ++i) {
+    cache->insert(absl::StrCat("signature-", i), makeResponse(2));
+    EXPECT_NE(cache->lookup("hot"), nullptr) << "after insert " << i;
+  }
+
+  EXPECT_GT(stats_.shared_check_cache_.evicted_.value(), 0);
+  EXPECT_LE(stats_.shared_check_cache_.entries_.value(), 32);
+}
+
+TEST_F(SharedCheckCacheTest, HitsShareConvertedResponse) {
+  auto cache = makeCache(100);
+  CheckResponse response;
+  response.add_check_errors()->set_code(CheckError::API_KEY_INVALID);
+  auto cached =
+      std::make_shared<const CachedCheckResponse>(response, "service");
+  EXPECT_EQ(cached->status.code(), StatusCode::kInvalidArgument);
+  EXPECT_EQ(cached->info.error.type, ScResponseErrorType::API_KEY_INVALID);
+
+  // The hits get the converted response, not copies of it.
+  cache->insert("signature", cached);
+  EXPECT_EQ(cache->lookup("signature"), cached);
+  EXPECT_EQ(cache->lookup("signature"), cached);
+}
+
+TEST(SharedCheckCacheSignatureTest, StableLabelOrder) {
+  CheckRequest request1;
+  request1.mutable_operation()->set_operation_name("op-name");
+  request1.mutable_operation()->set_consumer_id("api_key:key");
+  (*request1.mutable_operation()->mutable_labels())["a"] = "1";
+  (*request1.mutable_operation()->mutable_labels())["b"] = "2";
+
+  CheckRequest request2;
+  request2.mutable_operation()->set_operation_name("op-name");
+  request2.mutable_operation()->set_consumer_id("api_key:key");
+  (*request2.mutable_operation()->mutable_labels())["b"] = "2";
+  (*request2.mutable_operation()->mutable_labels())["a"] = "1";
+
+  EXPECT_EQ(SharedCheckCache::signature(request1),
+            SharedCheckCache::signature(request2));
+
+  // Operation id and time do not affect the response.
+  request2.mutable_operation()->set_operation_id("id");
+  EXPECT_EQ(SharedCheckCache::signature(request1),
+            SharedCheckCache::signature(request2));
+
+  request2.mutable_operation()->set_consumer_id("api_key:other");
+  EXPECT_NE(SharedCheckCache::signature(request1),
+            SharedCheckCache::signature(request2));
+}
+
+TEST(SharedCheckCacheSignatureTest, FromCheckRequestInfo) {
+  RequestBuilder builder({}, "test-service", "test-config-id");
+  CheckRequestInfo info;
+  info.operation_id = "id";
+  info.operation_name = "op-name";
+  info.api_key = "key";
+  info.client_ip = "1.2.3.4";
+  info.referer = "referer";
+  info.ios_bundle_id = "bundle";
+
+  for (bool with_api_key : {true, false}) {
+    if (!with_api_key) {
+      info.api_key = "";
+    }
+    CheckRequest request;
+    ASSERT_TRUE(builder.FillCheckRequest(info, &request).ok());
+
+    // The signatures from the info are the ones of its request.
+    RequestBuilder::CheckLabels labels;
+    builder.GetCheckLabels(info, &labels);
+    EXPECT_EQ(SharedCheckCache::signature(info.operation_name,
+                                          RequestBuilder::CheckConsumerId(info),
+                                          absl::MakeSpan(labels)),
+              SharedCheckCache::signature(request));
+    EXPECT_EQ(SharedCheckCache::consumerSignature(
+                  info.operation_name, RequestBuilder::CheckConsumerId(info)),
+              SharedCheckCache::consumerSignature(request));
+  }
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,46 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/telemetry_shedding.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+TelemetryShedding::TelemetryShedding(
+    const ::espv2::api::envoy::v10::http::service_control::TelemetryShedding&
+        config,
+    Envoy::Server::OverloadManager& overload_manager)
+    : overload_manager_(overload_manager),
+      actions_{config.drop_logged_fields_action(),
+               config.drop_log_entries_action(),
+               config.metrics_only_action()} {}
+
+TelemetryShedLevel TelemetryShedding::level() const {
+  Envoy::Server::ThreadLocalOverloadState& state =
+      overload_manager_.getThreadLocalOverloadState();
+  for (size_t i = actions_.size(); i > 0; --i) {
+    const std::string& action = actions_[i - 1];
+    if (!action.empty() && state.getState(action).isSaturated()) {
+      return static_cast<TelemetryShedLevel>(i);
+    }
+  }
+  return TelemetryShedLevel::None;
+}
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,60 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <string>
+
+#include "api/envoy/v10/http/service_control/config.pb.h"
+#include "envoy/server/overload/overload_manager.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+
+// The telemetry the reports shed, each level also shedding the ones before.
+enum class TelemetryShedLevel {
+  None = 0,
+  // The logged headers and jwt payloads.
+  LoggedFields = 1,
+  // The log entries.
+  LogEntries = 2,
+  // The reports are pre-aggregated into metrics only.
+  MetricsOnly = 3,
+};
+
+// Reads the telemetry to shed from the overload actions of the server's
+// overload manager, as they are on the calling worker.
+class TelemetryShedding {
+ public:
+  TelemetryShedding(
+      const ::espv2::api::envoy::v10::http::service_control::TelemetryShedding&
+          config,
+      Envoy::Server::OverloadManager& overload_manager);
+
+  // The level of the most shedding action saturated on the worker.
+  TelemetryShedLevel level() const;
+
+ private:
+  Envoy::Server::OverloadManager& overload_manager_;
+  // The action names by level, from LoggedFields. Empty if not configured.
+  std::array<std::string, 3> actions_;
+};
+
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,57 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/http/service_control/telemetry_shedding.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/server/overload_manager.h"
+
+namespace espv2 {
+namespace envoy {
+namespace http_filters {
+namespace service_control {
+namespace {
+
+using ::Envoy::Server::OverloadActionState;
+using ::testing::NiceMock;
+using ::testing::ReturnRef;
+
+TEST(TelemetrySheddingTest, MostSheddingSaturatedAction) {
+  ::espv2::api::envoy::v10::http::service_control::TelemetryShedding config;
+  config.set_drop_logged_fields_action("shed_fields");
+  config.set_metrics_only_action("metrics_only");
+  NiceMock<Envoy::Server::MockOverloadManager> overload_manager;
+  const TelemetryShedding shedding(config, overload_manager);
+
+  const OverloadActionState inactive = OverloadActionState::inactive();
+  const OverloadActionState saturated = OverloadActionState::saturated();
+  auto& state = overload_manager.overload_state_;
+  ON_CALL(state, getState("shed_fields")).WillByDefault(ReturnRef(inactive));
+  ON_CALL(state, getState("metrics_only")).WillByDefault(ReturnRef(inactive));
+  EXPECT_EQ(shedding.level(), TelemetryShedLevel::None);
+
+  ON_CALL(state, getState("shed_fields")).WillByDefault(ReturnRef(saturated));
+  EXPECT_EQ(shedding.level(), TelemetryShedLevel::LoggedFields);
+
+  ON_CALL(state, getState("metrics_only"))
+      .WillByDefault(ReturnRef(saturated));
+  EXPECT_EQ(shedding.level(), TelemetryShedLevel::MetricsOnly);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace http_filters
+}  // namespace envoy
+}  // namespace espv2
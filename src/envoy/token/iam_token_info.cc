@@ -15,16 +15,19 @@
 #include "src/envoy/token/iam_token_info.h"
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "google/protobuf/util/time_util.h"
 #include "source/common/common/empty_string.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/message_impl.h"
-#include "src/envoy/utils/json_struct.h"
+#include "source/common/protobuf/utility.h"
+#include "src/envoy/utils/json_field_reader.h"
 
 namespace espv2 {
 namespace envoy {
 namespace token {
 
-using utils::JsonStruct;
+using utils::JsonFieldReader;
 
 // Body field for the sequence of service accounts in a delegation chain.
 constexpr char kDelegatesField[]("delegates");
@@ -113,40 +116,36 @@ Envoy::Http::RequestMessagePtr IamTokenInfo::prepareRequest(
 // }
 bool IamTokenInfo::parseAccessToken(absl::string_view response,
                                     TokenResult* ret) const {
-  // Parse the JSON into a proto.
-  ::google::protobuf::Struct response_pb;
-  ::google::protobuf::util::Status parse_status =
-      ::google::protobuf::util::JsonStringToMessage(std::string(response),
-                                                    &response_pb);
+  // Read the fields straight from the JSON.
+  JsonFieldReader json_reader;
+  ::google::protobuf::util::Status parse_status = json_reader.parse(response);
   if (!parse_status.ok()) {
     ENVOY_LOG(error, "Parsing response failed: {}", parse_status.ToString());
     return false;
   }
-  JsonStruct json_struct(response_pb);
 
   // Parse the token.
-  std::string token;
-  parse_status = json_struct.getString("accessToken", &token);
-  if (!parse_status.ok()) {
+  const absl::optional<absl::string_view> token =
+      json_reader.findString("accessToken");
+  if (!token.has_value()) {
     ENVOY_LOG(error, "Parsing response failed for field `accessToken`: {}",
-              parse_status.ToString());
+              "missing or not a string");
     return false;
   }
 
   // Parse the expiry timestamp.
-  ::google::protobuf::Timestamp expireTime;
-  parse_status = json_struct.getTimestamp("expireTime", &expireTime);
-
-  if (!parse_status.ok()) {
+  const absl::optional<::google::protobuf::Timestamp> expireTime =
+      json_reader.findTimestamp("expireTime");
+  if (!expireTime.has_value()) {
     ENVOY_LOG(error, "Parsing response failed for field `expireTime`: {}",
-              parse_status.ToString());
+              "missing or not a Timestamp");
     return false;
   }
 
   const std::chrono::seconds expires_in = std::chrono::seconds(
-      (expireTime - ::google::protobuf::util::TimeUtil::GetCurrentTime())
+      (*expireTime - ::google::protobuf::util::TimeUtil::GetCurrentTime())
           .seconds());
-  ret->token = token;
+  ret->token = std::string(*token);
   ret->expiry_duration = expires_in;
   return true;
 }
@@ -157,31 +156,33 @@ bool IamTokenInfo::parseAccessToken(absl::string_view response,
 // }
 bool IamTokenInfo::parseIdentityToken(absl::string_view response,
                                       TokenResult* ret) const {
-  // Parse the JSON into a proto.
-  ::google::protobuf::Struct response_pb;
-  ::google::protobuf::util::Status parse_status =
-      ::google::protobuf::util::JsonStringToMessage(std::string(response),
-                                                    &response_pb);
+  // Read the fields straight from the JSON.
+  JsonFieldReader json_reader;
+  ::google::protobuf::util::Status parse_status = json_reader.parse(response);
   if (!parse_status.ok()) {
     ENVOY_LOG(error, "Parsing response failed: {}", parse_status.ToString());
     return false;
   }
-  JsonStruct json_struct(response_pb);
 
   // Parse the token.
-  std::string token;
-  parse_status = json_struct.getString("token", &token);
-  if (!parse_status.ok()) {
+  const absl::optional<absl::string_view> token =
+      json_reader.findString("token");
+  if (!token.has_value()) {
     ENVOY_LOG(error, "Parsing response failed for field `token`: {}",
-              parse_status.ToString());
+              "missing or not a string");
     return false;
   }
 
-  ret->token = token;
+  ret->token = std::string(*token);
   ret->expiry_duration = kDefaultTokenExpiry;
   return true;
 }
 
+std::string IamTokenInfo::requestKey() const {
+  return absl::StrCat(absl::StrJoin(delegates_, ","), "\n",
+                      absl::StrJoin(scopes_, ","), "\n", include_email_);
+}
+
 void IamTokenInfo::insertStrListToProto(
     Envoy::ProtobufWkt::Value& body, const std::string& key,
     const ::google::protobuf::RepeatedPtrField<std::string>& val_list,
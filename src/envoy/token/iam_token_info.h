@@ -39,6 +39,7 @@ class IamTokenInfo : public TokenInfo {
                         TokenResult* ret) const override;
   bool parseIdentityToken(absl::string_view response,
                           TokenResult* ret) const override;
+  std::string requestKey() const override;
 
  private:
   void insertStrListToProto(
@@ -46,7 +47,7 @@ class IamTokenInfo : public TokenInfo {
       const ::google::protobuf::RepeatedPtrField<std::string>& val_list,
       const absl::string_view& val_prefix) const;
 
-  const ::google::protobuf::RepeatedPtrField<std::string>& delegates_;
+  const ::google::protobuf::RepeatedPtrField<std::string> delegates_;
   const ::google::protobuf::RepeatedPtrField<std::string> scopes_;
   const bool include_email_;
   const GetTokenFunc access_token_fn_;
@@ -18,13 +18,13 @@
 #include "source/common/http/headers.h"
 #include "source/common/http/message_impl.h"
 #include "source/common/http/utility.h"
-#include "src/envoy/utils/json_struct.h"
+#include "src/envoy/utils/json_field_reader.h"
 
 namespace espv2 {
 namespace envoy {
 namespace token {
 
-using utils::JsonStruct;
+using utils::JsonFieldReader;
 
 // Required header when fetching from IMDS.
 const Envoy::Http::LowerCaseString kMetadataFlavorKey("Metadata-Flavor");
@@ -60,38 +60,34 @@ Envoy::Http::RequestMessagePtr ImdsTokenInfo::prepareRequest(
 // }
 bool ImdsTokenInfo::parseAccessToken(absl::string_view response,
                                      TokenResult* ret) const {
-  // Parse the JSON into a proto.
-  ::google::protobuf::Struct response_pb;
-  ::google::protobuf::util::Status parse_status =
-      ::google::protobuf::util::JsonStringToMessage(std::string(response),
-                                                    &response_pb);
+  // Read the fields straight from the JSON.
+  JsonFieldReader json_reader;
+  ::google::protobuf::util::Status parse_status = json_reader.parse(response);
   if (!parse_status.ok()) {
     ENVOY_LOG(error, "Parsing response failed: {}", parse_status.ToString());
     return false;
   }
-  JsonStruct json_struct(response_pb);
 
   // Parse the token.
-  std::string token;
-  parse_status = json_struct.getString("access_token", &token);
-  if (!parse_status.ok()) {
+  const absl::optional<absl::string_view> token =
+      json_reader.findString("access_token");
+  if (!token.has_value()) {
     ENVOY_LOG(error, "Parsing response failed for field `access_token`: {}",
-              parse_status.ToString());
+              "missing or not a string");
     return false;
   }
 
   // Parse the expiry duration.
-  int expires_seconds;
-  parse_status = json_struct.getInteger("expires_in", &expires_seconds);
-  if (!parse_status.ok()) {
+  const absl::optional<int64_t> expires_seconds =
+      json_reader.findInteger("expires_in");
+  if (!expires_seconds.has_value()) {
     ENVOY_LOG(error, "Parsing response failed for field `expires_in`: {}",
-              parse_status.ToString());
+              "missing or not an integer");
     return false;
   }
 
-  const std::chrono::seconds expires_in = std::chrono::seconds(expires_seconds);
-  ret->token = token;
-  ret->expiry_duration = expires_in;
+  ret->token = std::string(*token);
+  ret->expiry_duration = std::chrono::seconds(*expires_seconds);
   return true;
 }
 
@@ -103,6 +99,9 @@ bool ImdsTokenInfo::parseIdentityToken(absl::string_view response,
   return true;
 }
 
+// The token url is all of the request.
+std::string ImdsTokenInfo::requestKey() const { return ""; }
+
 }  // namespace token
 }  // namespace envoy
 }  // namespace espv2
@@ -32,6 +32,7 @@ class ImdsTokenInfo : public TokenInfo {
                         TokenResult* ret) const override;
   bool parseIdentityToken(absl::string_view response,
                           TokenResult* ret) const override;
+  std::string requestKey() const override;
 };
 
 }  // namespace token
@@ -15,6 +15,7 @@
 #include "src/envoy/token/imds_token_info.h"
 #include "test/fuzz/fuzz_runner.h"
 #include "test/fuzz/utility.h"
+#include "tests/fuzz/fuzz_time_limit.h"
 #include "tests/fuzz/structured_inputs/imds_token_info.pb.validate.h"
 
 namespace espv2 {
@@ -31,6 +32,7 @@ DEFINE_PROTO_FUZZER(
 
   try {
     Envoy::TestUtility::validate(input);
+    espv2::tests::fuzz::FuzzTimeLimit time_limit("ImdsTokenInfo");
 
     ImdsTokenInfo token_info;
 
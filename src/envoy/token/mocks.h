@@ -44,6 +44,7 @@ class MockTokenSubscriberFactory : public TokenSubscriberFactory {
        UpdateTokenCallback callback,
        const ::google::protobuf::RepeatedPtrField<std::string>& delegates,
        const ::google::protobuf::RepeatedPtrField<std::string>& scopes,
+       const ::espv2::api::envoy::v10::http::common::AccessToken& access_token,
        GetTokenFunc access_token_fn),
       (const));
 };
@@ -58,6 +59,8 @@ class MockTokenInfo : public TokenInfo {
 
   MOCK_METHOD(bool, parseIdentityToken,
               (absl::string_view response, TokenResult* ret), (const));
+
+  MOCK_METHOD(std::string, requestKey, (), (const));
 };
 
 using MockTokenInfoPtr = std::unique_ptr<NiceMock<MockTokenInfo>>;
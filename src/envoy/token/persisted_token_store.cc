@@ -0,0 +1,194 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/persisted_token_store.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "envoy/common/exception.h"
+#include "openssl/evp.h"
+#include "openssl/rand.h"
+#include "openssl/sha.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+namespace {
+
+constexpr size_t kKeySize = 32;
+constexpr size_t kNonceSize = 12;
+constexpr size_t kTagSize = 16;
+
+// Returns the whole file, or false if it can not be read.
+bool readFile(const std::string& path, std::string* content) {
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  *content = buffer.str();
+  return !file.bad();
+}
+
+// Encrypts `plaintext`, authenticated with `aad`, into nonce | ciphertext |
+// tag.
+bool encrypt(const std::string& key, absl::string_view aad,
+             absl::string_view plaintext, std::string* out) {
+  out->resize(kNonceSize + plaintext.size() + kTagSize);
+  uint8_t* nonce = reinterpret_cast<uint8_t*>(&(*out)[0]);
+  uint8_t* ciphertext = nonce + kNonceSize;
+  if (RAND_bytes(nonce, kNonceSize) != 1) {
+    return false;
+  }
+  bssl::UniquePtr<EVP_CIPHER_CTX> ctx(EVP_CIPHER_CTX_new());
+  int len = 0;
+  return ctx != nullptr &&
+         EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr,
+                            reinterpret_cast<const uint8_t*>(key.data()),
+                            nonce) == 1 &&
+         EVP_EncryptUpdate(ctx.get(), nullptr, &len,
+                           reinterpret_cast<const uint8_t*>(aad.data()),
+                           aad.size()) == 1 &&
+         EVP_EncryptUpdate(ctx.get(), ciphertext, &len,
+                           reinterpret_cast<const uint8_t*>(plaintext.data()),
+                           plaintext.size()) == 1 &&
+         EVP_EncryptFinal_ex(ctx.get(), ciphertext + len, &len) == 1 &&
+         EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, kTagSize,
+                             ciphertext + plaintext.size()) == 1;
+}
+
+// Decrypts what encrypt() wrote. Returns false if it was not written with
+// the same key and aad.
+bool decrypt(const std::string& key, absl::string_view aad,
+             absl::string_view in, std::string* plaintext) {
+  if (in.size() < kNonceSize + kTagSize) {
+    return false;
+  }
+  const uint8_t* nonce = reinterpret_cast<const uint8_t*>(in.data());
+  const uint8_t* ciphertext = nonce + kNonceSize;
+  const size_t ciphertext_size = in.size() - kNonceSize - kTagSize;
+  plaintext->resize(ciphertext_size);
+  // The tag is not modified, only OpenSSL takes it as non const.
+  uint8_t tag[kTagSize];
+  std::copy(ciphertext + ciphertext_size,
+            ciphertext + ciphertext_size + kTagSize, tag);
+  bssl::UniquePtr<EVP_CIPHER_CTX> ctx(EVP_CIPHER_CTX_new());
+  int len = 0;
+  return ctx != nullptr &&
+         EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr,
+                            reinterpret_cast<const uint8_t*>(key.data()),
+                            nonce) == 1 &&
+         EVP_DecryptUpdate(ctx.get(), nullptr, &len,
+                           reinterpret_cast<const uint8_t*>(aad.data()),
+                           aad.size()) == 1 &&
+         EVP_DecryptUpdate(ctx.get(),
+                           reinterpret_cast<uint8_t*>(&(*plaintext)[0]), &len,
+                           ciphertext, ciphertext_size) == 1 &&
+         EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, kTagSize, tag) ==
+             1 &&
+         EVP_DecryptFinal_ex(ctx.get(),
+                             reinterpret_cast<uint8_t*>(&(*plaintext)[0]) + len,
+                             &len) == 1;
+}
+
+}  // namespace
+
+PersistedTokenStore::PersistedTokenStore(const std::string& dir,
+                                         const std::string& key_file)
+    : dir_(dir) {
+  if (!readFile(key_file, &encryption_key_)) {
+    throw Envoy::EnvoyException(
+        absl::StrCat("Failed to read the token cache key file ", key_file));
+  }
+  if (encryption_key_.size() != kKeySize) {
+    throw Envoy::EnvoyException(
+        absl::StrCat("The token cache key file ", key_file, " must hold ",
+                     kKeySize, " bytes, not ", encryption_key_.size()));
+  }
+}
+
+std::string PersistedTokenStore::path(absl::string_view key) const {
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(key.data()), key.size(), digest);
+  return absl::StrCat(
+      dir_, "/",
+      absl::BytesToHexString(absl::string_view(
+          reinterpret_cast<const char*>(digest), sizeof(digest))));
+}
+
+std::string PersistedTokenStore::load(absl::string_view key,
+                                      Envoy::SystemTime* expiry) const {
+  std::string content;
+  std::string plaintext;
+  if (!readFile(path(key), &content) ||
+      !decrypt(encryption_key_, key, content, &plaintext)) {
+    return "";
+  }
+  // The expiry in seconds since the epoch, then the token.
+  const size_t separator = plaintext.find('\n');
+  int64_t expiry_seconds;
+  if (separator == std::string::npos ||
+      !absl::SimpleAtoi(absl::string_view(plaintext).substr(0, separator),
+                        &expiry_seconds)) {
+    return "";
+  }
+  *expiry = Envoy::SystemTime(std::chrono::seconds(expiry_seconds));
+  return plaintext.substr(separator + 1);
+}
+
+bool PersistedTokenStore::store(absl::string_view key, absl::string_view token,
+                                Envoy::SystemTime expiry) const {
+  const int64_t expiry_seconds =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          expiry.time_since_epoch())
+          .count();
+  std::string content;
+  if (!encrypt(encryption_key_, key, absl::StrCat(expiry_seconds, "\n", token),
+               &content)) {
+    return false;
+  }
+
+  // Written aside, then renamed over the previous file. The process id keeps
+  // apart the files of two proxies of a hot restart.
+  const std::string path = this->path(key);
+  const std::string tmp_path = absl::StrCat(path, ".tmp", getpid());
+  const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  const bool written =
+      ::write(fd, content.data(), content.size()) ==
+      static_cast<ssize_t>(content.size());
+  if (::close(fd) != 0 || !written ||
+      std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
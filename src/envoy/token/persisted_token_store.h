@@ -0,0 +1,61 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "envoy/common/time.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+// Persists tokens to files, so they survive restarts of the proxy. Each token
+// is stored with its expiry under a key naming its fetch: the file name is the
+// hex SHA-256 of the key, the key also authenticates the content.
+//
+// The tokens are encrypted with AES-256-GCM. A file written with another key,
+// for another fetch, or damaged is ignored. Files are replaced atomically, so
+// a proxy reading while another writes, as in a hot restart, reads either
+// token whole.
+class PersistedTokenStore {
+ public:
+  // Throws EnvoyException if the key file can not be read, or does not hold
+  // exactly 32 bytes.
+  PersistedTokenStore(const std::string& dir, const std::string& key_file);
+
+  // Returns the token stored for `key` and sets its expiry, or an empty
+  // string if none was stored or it can not be read.
+  std::string load(absl::string_view key, Envoy::SystemTime* expiry) const;
+
+  // Stores the token for `key`, in place of the previous one. Returns false
+  // if it could not be written.
+  bool store(absl::string_view key, absl::string_view token,
+             Envoy::SystemTime expiry) const;
+
+ private:
+  std::string path(absl::string_view key) const;
+
+  const std::string dir_;
+  std::string encryption_key_;
+};
+
+using PersistedTokenStorePtr = std::unique_ptr<PersistedTokenStore>;
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
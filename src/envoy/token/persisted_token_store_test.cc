@@ -0,0 +1,106 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/persisted_token_store.h"
+
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "envoy/common/exception.h"
+#include "gtest/gtest.h"
+#include "test/test_common/environment.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+namespace test {
+
+using ::Envoy::TestEnvironment;
+
+class PersistedTokenStoreTest : public testing::Test {
+ protected:
+  PersistedTokenStoreTest()
+      : dir_(TestEnvironment::temporaryPath("persisted_token_store")) {
+    TestEnvironment::createPath(dir_);
+  }
+
+  // Returns a store encrypting with a key of 32 times `key_char`.
+  PersistedTokenStore createStore(char key_char) {
+    return PersistedTokenStore(
+        dir_, TestEnvironment::writeStringToFileForTest(
+                  "persisted_token_store_key", std::string(32, key_char)));
+  }
+
+  const std::string dir_;
+  const Envoy::SystemTime expiry_{std::chrono::seconds(1626307200)};
+};
+
+TEST_F(PersistedTokenStoreTest, StoresAndLoads) {
+  const PersistedTokenStore store = createStore('a');
+  Envoy::SystemTime expiry;
+  EXPECT_EQ(store.load("foo", &expiry), "");
+
+  ASSERT_TRUE(store.store("foo", "token-foo", expiry_));
+  ASSERT_TRUE(store.store("bar", "token-bar", expiry_ + std::chrono::hours(1)));
+  EXPECT_EQ(store.load("foo", &expiry), "token-foo");
+  EXPECT_EQ(expiry, expiry_);
+  EXPECT_EQ(store.load("bar", &expiry), "token-bar");
+  EXPECT_EQ(expiry, expiry_ + std::chrono::hours(1));
+
+  // Replaced by the next token.
+  ASSERT_TRUE(store.store("foo", "token-foo-2", expiry_));
+  EXPECT_EQ(store.load("foo", &expiry), "token-foo-2");
+
+  // Read by the store of a restarted proxy.
+  EXPECT_EQ(createStore('a').load("foo", &expiry), "token-foo-2");
+}
+
+TEST_F(PersistedTokenStoreTest, OtherKeyIgnored) {
+  ASSERT_TRUE(createStore('a').store("foo", "token-foo", expiry_));
+
+  Envoy::SystemTime expiry;
+  EXPECT_EQ(createStore('b').load("foo", &expiry), "");
+}
+
+TEST_F(PersistedTokenStoreTest, DamagedFileIgnored) {
+  const PersistedTokenStore store = createStore('a');
+  ASSERT_TRUE(store.store("foo", "token-foo", expiry_));
+
+  // The only file of the directory is the one of "foo".
+  const std::string path =
+      absl::StrCat(dir_, "/2c26b46b68ffc68ff99b453c1d304134",
+                   "13422d706483bfa0f98a5e886266e7ae");
+  std::string content = TestEnvironment::readFileToStringForTest(path);
+  content.back() ^= 1;
+  TestEnvironment::writeStringToFileForTest(path, content,
+                                            /*fully_qualified_path=*/true);
+
+  Envoy::SystemTime expiry;
+  EXPECT_EQ(store.load("foo", &expiry), "");
+}
+
+TEST_F(PersistedTokenStoreTest, InvalidKeyFile) {
+  EXPECT_THROW(PersistedTokenStore(dir_, dir_ + "/non-existent"),
+               Envoy::EnvoyException);
+  EXPECT_THROW(PersistedTokenStore(
+                   dir_, TestEnvironment::writeStringToFileForTest(
+                             "persisted_token_store_short_key",
+                             std::string(31, 'a'))),
+               Envoy::EnvoyException);
+}
+
+}  // namespace test
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,116 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_fetch_scheduler.h"
+
+#include <utility>
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+SINGLETON_MANAGER_REGISTRATION(token_fetch_scheduler);
+
+class TokenFetchScheduler::Fetch : public TokenFetch {
+ public:
+  Fetch(TokenFetchScheduler& scheduler, ClusterFetches& cluster,
+        std::function<void()> start)
+      : scheduler_(scheduler), cluster_(cluster), start_(std::move(start)) {}
+
+  ~Fetch() override { scheduler_.release(cluster_, *this); }
+
+  bool inFlight() const override { return in_flight_; }
+
+  TokenFetchScheduler& scheduler_;
+  ClusterFetches& cluster_;
+  const std::function<void()> start_;
+  bool in_flight_ = false;
+  // Valid while queued.
+  bool queued_ = false;
+  Queue::iterator queue_it_;
+};
+
+std::shared_ptr<TokenFetchScheduler> TokenFetchScheduler::get(
+    Envoy::Singleton::Manager& singleton_manager,
+    Envoy::Stats::Scope& scope) {
+  return singleton_manager.getTyped<TokenFetchScheduler>(
+      SINGLETON_MANAGER_REGISTERED_NAME(token_fetch_scheduler),
+      [&scope] { return std::make_shared<TokenFetchScheduler>(scope); });
+}
+
+TokenFetchScheduler::TokenFetchScheduler(Envoy::Stats::Scope& scope)
+    : stats_{TOKEN_FETCH_SCHEDULER_STATS(
+          POOL_GAUGE_PREFIX(scope, "token_fetch_scheduler."))} {}
+
+TokenFetchPtr TokenFetchScheduler::schedule(const std::string& cluster,
+                                            uint32_t max_in_flight,
+                                            TokenFetchPriority priority,
+                                            Envoy::MonotonicTime expiry,
+                                            std::function<void()> start) {
+  std::unique_ptr<ClusterFetches>& entry = clusters_[cluster];
+  if (entry == nullptr) {
+    entry = std::make_unique<ClusterFetches>();
+    entry->max_in_flight = max_in_flight;
+  } else if (max_in_flight < entry->max_in_flight) {
+    entry->max_in_flight = max_in_flight;
+  }
+
+  auto fetch = std::make_unique<Fetch>(*this, *entry, std::move(start));
+  if (entry->queue.empty() && entry->in_flight < entry->max_in_flight) {
+    fetch->in_flight_ = true;
+    ++entry->in_flight;
+    stats_.in_flight_.inc();
+    return fetch;
+  }
+
+  fetch->queued_ = true;
+  fetch->queue_it_ =
+      entry->queue.emplace(QueueKey(priority, expiry, next_seq_++), fetch.get())
+          .first;
+  stats_.queued_.inc();
+  return fetch;
+}
+
+void TokenFetchScheduler::startQueued(ClusterFetches& cluster) {
+  // A started fetch may end at once, and start others itself.
+  while (!cluster.queue.empty() && cluster.in_flight < cluster.max_in_flight) {
+    Fetch* fetch = cluster.queue.begin()->second;
+    cluster.queue.erase(cluster.queue.begin());
+    stats_.queued_.dec();
+    fetch->queued_ = false;
+    fetch->in_flight_ = true;
+    ++cluster.in_flight;
+    stats_.in_flight_.inc();
+    // The fetch may be destroyed by its start.
+    const std::function<void()> start = fetch->start_;
+    start();
+  }
+}
+
+void TokenFetchScheduler::release(ClusterFetches& cluster, Fetch& fetch) {
+  if (fetch.queued_) {
+    cluster.queue.erase(fetch.queue_it_);
+    stats_.queued_.dec();
+    return;
+  }
+  if (fetch.in_flight_) {
+    --cluster.in_flight;
+    stats_.in_flight_.dec();
+    startQueued(cluster);
+  }
+}
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,118 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "absl/container/flat_hash_map.h"
+#include "envoy/common/pure.h"
+#include "envoy/common/time.h"
+#include "envoy/singleton/instance.h"
+#include "envoy/singleton/manager.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+/**
+ * All stats for the token fetch scheduler. @see stats_macros.h
+ */
+#define TOKEN_FETCH_SCHEDULER_STATS(GAUGE) \
+  GAUGE(in_flight, Accumulate)             \
+  GAUGE(queued, Accumulate)
+
+struct TokenFetchSchedulerStats {
+  TOKEN_FETCH_SCHEDULER_STATS(GENERATE_GAUGE_STRUCT)
+};
+
+// The fetches of a higher priority are started first.
+enum class TokenFetchPriority {
+  // The tokens no request can be served without, like the service control
+  // access tokens.
+  High = 0,
+  Normal = 1,
+};
+
+// A fetch scheduled with the TokenFetchScheduler. It is queued or in flight
+// until destroyed.
+class TokenFetch {
+ public:
+  virtual ~TokenFetch() = default;
+
+  virtual bool inFlight() const PURE;
+};
+
+using TokenFetchPtr = std::unique_ptr<TokenFetch>;
+
+// Limits the token fetches in flight per cluster, for all the subscribers of
+// the process, so they do not all hit the token server at once after it was
+// down. The fetches over the limit are queued: the ones of a higher priority
+// first, then the ones whose token expires first. Main thread only.
+class TokenFetchScheduler : public Envoy::Singleton::Instance {
+ public:
+  // Returns the process wide scheduler. Its stats are created in `scope`,
+  // which must be server wide, by the first call.
+  static std::shared_ptr<TokenFetchScheduler> get(
+      Envoy::Singleton::Manager& singleton_manager,
+      Envoy::Stats::Scope& scope);
+
+  explicit TokenFetchScheduler(Envoy::Stats::Scope& scope);
+
+  // Returns a fetch of `cluster` in flight if fewer than `max_in_flight` are,
+  // then the caller starts it. Otherwise the fetch is queued, and `start` is
+  // called once it gets in flight. It is in flight until the returned handle
+  // is destroyed; destroying it before only dequeues it. A cluster has the
+  // lowest limit scheduled with. The scheduler must outlive its fetches.
+  TokenFetchPtr schedule(const std::string& cluster, uint32_t max_in_flight,
+                         TokenFetchPriority priority,
+                         Envoy::MonotonicTime expiry,
+                         std::function<void()> start);
+
+ private:
+  class Fetch;
+  // Ordered by priority, then expiry, then schedule order.
+  using QueueKey =
+      std::tuple<TokenFetchPriority, Envoy::MonotonicTime, uint64_t>;
+  using Queue = std::map<QueueKey, Fetch*>;
+
+  struct ClusterFetches {
+    uint32_t max_in_flight;
+    uint32_t in_flight = 0;
+    Queue queue;
+  };
+
+  // Starts the queued fetches of the cluster that fit in its limit.
+  void startQueued(ClusterFetches& cluster);
+  // Called by a fetch when it is destroyed.
+  void release(ClusterFetches& cluster, Fetch& fetch);
+
+  TokenFetchSchedulerStats stats_;
+  uint64_t next_seq_ = 0;
+  // Never erased, there is one per token cluster.
+  absl::flat_hash_map<std::string, std::unique_ptr<ClusterFetches>> clusters_;
+};
+
+using TokenFetchSchedulerSharedPtr = std::shared_ptr<TokenFetchScheduler>;
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,120 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_fetch_scheduler.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+namespace test {
+
+class TokenFetchSchedulerTest : public testing::Test {
+ protected:
+  // Schedules a fetch of the cluster that records its start.
+  TokenFetchPtr schedule(const std::string& name, TokenFetchPriority priority,
+                         std::chrono::seconds expires_in,
+                         const std::string& cluster = "imds") {
+    return scheduler_.schedule(cluster, 2, priority, now_ + expires_in,
+                               [this, name]() { started_.push_back(name); });
+  }
+
+  uint64_t gauge(const std::string& name) {
+    return Envoy::TestUtility::findGauge(scope_,
+                                         "token_fetch_scheduler." + name)
+        ->value();
+  }
+
+  testing::NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope_;
+  TokenFetchScheduler scheduler_{scope_};
+  const Envoy::MonotonicTime now_{};
+  std::vector<std::string> started_;
+};
+
+TEST_F(TokenFetchSchedulerTest, LimitsFetchesInFlightPerCluster) {
+  TokenFetchPtr foo =
+      schedule("foo", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr bar =
+      schedule("bar", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr baz =
+      schedule("baz", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr other = schedule("other", TokenFetchPriority::Normal,
+                                 std::chrono::seconds(0), "iam");
+  EXPECT_TRUE(foo->inFlight());
+  EXPECT_TRUE(bar->inFlight());
+  EXPECT_FALSE(baz->inFlight());
+  EXPECT_TRUE(other->inFlight());
+  EXPECT_EQ(gauge("in_flight"), 3);
+  EXPECT_EQ(gauge("queued"), 1);
+
+  // The fetches in flight at once are started by their caller.
+  EXPECT_TRUE(started_.empty());
+  foo.reset();
+  EXPECT_EQ(started_, std::vector<std::string>({"baz"}));
+  EXPECT_TRUE(baz->inFlight());
+  EXPECT_EQ(gauge("in_flight"), 3);
+  EXPECT_EQ(gauge("queued"), 0);
+}
+
+TEST_F(TokenFetchSchedulerTest, StartsUrgentFetchesFirst) {
+  TokenFetchPtr foo =
+      schedule("foo", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr bar =
+      schedule("bar", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr late =
+      schedule("late", TokenFetchPriority::Normal, std::chrono::seconds(600));
+  TokenFetchPtr soon =
+      schedule("soon", TokenFetchPriority::Normal, std::chrono::seconds(60));
+  TokenFetchPtr high =
+      schedule("high", TokenFetchPriority::High, std::chrono::seconds(3600));
+  TokenFetchPtr dequeued =
+      schedule("dequeued", TokenFetchPriority::High, std::chrono::seconds(0));
+  dequeued.reset();
+
+  foo.reset();
+  high.reset();
+  bar.reset();
+  EXPECT_EQ(started_, std::vector<std::string>({"high", "soon", "late"}));
+  EXPECT_EQ(gauge("in_flight"), 2);
+  EXPECT_EQ(gauge("queued"), 0);
+}
+
+TEST_F(TokenFetchSchedulerTest, StartedFetchMayEndAtOnce) {
+  TokenFetchPtr foo =
+      schedule("foo", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr bar =
+      schedule("bar", TokenFetchPriority::Normal, std::chrono::seconds(0));
+  TokenFetchPtr failed;
+  failed = scheduler_.schedule("imds", 2, TokenFetchPriority::Normal, now_,
+                               [&failed]() { failed.reset(); });
+  TokenFetchPtr baz =
+      schedule("baz", TokenFetchPriority::Normal, std::chrono::seconds(0));
+
+  foo.reset();
+  EXPECT_EQ(failed, nullptr);
+  EXPECT_EQ(started_, std::vector<std::string>({"baz"}));
+  EXPECT_EQ(gauge("in_flight"), 2);
+}
+
+}  // namespace test
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
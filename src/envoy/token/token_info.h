@@ -39,6 +39,10 @@ class TokenInfo : public Envoy::Logger::Loggable<Envoy::Logger::Id::init> {
                                 TokenResult* ret) const PURE;
   virtual bool parseIdentityToken(absl::string_view response,
                                   TokenResult* ret) const PURE;
+
+  // Returns what makes the tokens of the adapter differ, but the token url.
+  // Part of the names of the persisted tokens.
+  virtual std::string requestKey() const PURE;
 };
 
 using TokenInfoPtr = std::unique_ptr<TokenInfo>;
@@ -0,0 +1,157 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_registry.h"
+
+#include "src/api_proxy/utils/memory_bytes.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+using ::espv2::api_proxy::utils::HeapBytes;
+using ::espv2::api_proxy::utils::VectorBytes;
+
+TokenRegistry::TokenRegistry(Envoy::ThreadLocal::SlotAllocator& tls,
+                             Envoy::Event::Dispatcher& dispatcher,
+                             std::chrono::milliseconds batch_window,
+                             Envoy::Stats::Gauge* bytes_gauge)
+    : tls_(tls),
+      batch_window_(batch_window),
+      publish_timer_(dispatcher.createTimer([this]() { publish(); })),
+      tokens_(std::make_shared<const Tokens>()),
+      bytes_gauge_(bytes_gauge) {
+  tls_.set([tokens = tokens_](Envoy::Event::Dispatcher&) {
+    return std::make_shared<ThreadLocalTokens>(tokens);
+  });
+}
+
+TokenRegistry::~TokenRegistry() {
+  if (bytes_gauge_ != nullptr) {
+    bytes_gauge_->sub(bytes_);
+  }
+}
+
+size_t TokenRegistry::add() {
+  auto tokens = std::make_shared<Tokens>(*tokens_);
+  tokens->emplace_back();
+  tokens_ = std::move(tokens);
+  // Workers read past the end of their snapshot as no token, so the new
+  // entry need not be published.
+  return tokens_->size() - 1;
+}
+
+void TokenRegistry::update(size_t id, std::string token) {
+  pending_.emplace_back(id,
+                        std::make_shared<const std::string>(std::move(token)));
+  if ((*tokens_)[id] == nullptr) {
+    publish_timer_->disableTimer();
+    publish();
+    return;
+  }
+  if (!publish_timer_->enabled()) {
+    publish_timer_->enableTimer(batch_window_);
+  }
+}
+
+void TokenRegistry::clear(size_t id) {
+  pending_.emplace_back(id, nullptr);
+  if (!publish_timer_->enabled()) {
+    publish_timer_->enableTimer(batch_window_);
+  }
+}
+
+// Removes its waiter from the worker when destroyed, unless it was called.
+class TokenRegistry::Wait : public TokenWait {
+ public:
+  Wait(std::list<Waiter>& waiters, size_t id, std::function<void()> ready)
+      : waiters_(waiters),
+        waiter_it_(waiters_.insert(waiters_.end(),
+                                   Waiter{id, std::move(ready), this})) {}
+
+  ~Wait() override {
+    if (waiting_) {
+      waiters_.erase(waiter_it_);
+    }
+  }
+
+  // Called by the worker before it calls the waiter.
+  void done() { waiting_ = false; }
+
+ private:
+  std::list<Waiter>& waiters_;
+  const std::list<Waiter>::iterator waiter_it_;
+  bool waiting_ = true;
+};
+
+TokenWaitPtr TokenRegistry::waitForToken(size_t id,
+                                         std::function<void()> ready) const {
+  return std::make_unique<Wait>(tls_->waiters_, id, std::move(ready));
+}
+
+void TokenRegistry::ThreadLocalTokens::notifyWaiters() {
+  auto it = waiters_.begin();
+  while (it != waiters_.end()) {
+    if (it->id >= tokens_->size() || (*tokens_)[it->id] == nullptr) {
+      ++it;
+      continue;
+    }
+    std::function<void()> ready = std::move(it->ready);
+    it->wait->done();
+    waiters_.erase(it);
+    ready();
+    // The callback may have ended other waits.
+    it = waiters_.begin();
+  }
+}
+
+void TokenRegistry::publish() {
+  if (pending_.empty()) {
+    return;
+  }
+
+  auto tokens = std::make_shared<Tokens>(*tokens_);
+  for (auto& update : pending_) {
+    (*tokens)[update.first] = std::move(update.second);
+  }
+  pending_.clear();
+  tokens_ = std::move(tokens);
+  updateBytes();
+
+  tls_.runOnAllThreads(
+      [tokens = tokens_](Envoy::OptRef<ThreadLocalTokens> object) {
+        object->tokens_ = tokens;
+        object->notifyWaiters();
+      });
+}
+
+void TokenRegistry::updateBytes() {
+  if (bytes_gauge_ == nullptr) {
+    return;
+  }
+  // The previous snapshot is only held until the workers swap it.
+  uint64_t bytes = VectorBytes(*tokens_);
+  for (const TokenSharedPtr& token : *tokens_) {
+    if (token != nullptr) {
+      bytes += sizeof(*token) + HeapBytes(*token);
+    }
+  }
+  bytes_gauge_->add(bytes);
+  bytes_gauge_->sub(bytes_);
+  bytes_ = bytes;
+}
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,129 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/stats/stats.h"
+#include "envoy/thread_local/thread_local.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+// A wait of a worker for the token of a registry entry. Destroying it ends
+// the wait.
+class TokenWait {
+ public:
+  virtual ~TokenWait() = default;
+};
+
+using TokenWaitPtr = std::unique_ptr<TokenWait>;
+
+// Publishes the tokens of many subscribers to the workers in batches.
+//
+// The workers read an immutable snapshot of all the tokens, swapped as a
+// whole on each publish. The first token of each entry is published at once,
+// as no request can use the entry before. Later updates replace tokens that
+// are still valid, so they are held for the batch window and published
+// together, with a single callback per worker.
+class TokenRegistry {
+ public:
+  using TokenSharedPtr = std::shared_ptr<const std::string>;
+
+  // The window should be well under the time a token is refreshed before it
+  // expires. The memory held by the published tokens is counted in
+  // `bytes_gauge`, if set.
+  TokenRegistry(Envoy::ThreadLocal::SlotAllocator& tls,
+                Envoy::Event::Dispatcher& dispatcher,
+                std::chrono::milliseconds batch_window,
+                Envoy::Stats::Gauge* bytes_gauge = nullptr);
+  ~TokenRegistry();
+
+  // Adds an entry with no token and returns its id. Main thread only.
+  size_t add();
+
+  // Sets the token of the entry. Main thread only.
+  void update(size_t id, std::string token);
+
+  // Removes the token of the entry, published with the next batch. Main
+  // thread only.
+  void clear(size_t id);
+
+  // Calls `ready` on the calling worker once the entry has a token published
+  // there, unless the wait is ended before. The entry must have no token on
+  // the worker yet.
+  TokenWaitPtr waitForToken(size_t id, std::function<void()> ready) const;
+
+  // Returns the token of the entry published to the calling thread, or
+  // nullptr if there is none yet.
+  TokenSharedPtr get(size_t id) const {
+    const Tokens& tokens = *tls_->tokens_;
+    return id < tokens.size() ? tokens[id] : nullptr;
+  }
+
+ private:
+  using Tokens = std::vector<TokenSharedPtr>;
+  using TokensConstSharedPtr = std::shared_ptr<const Tokens>;
+
+  class Wait;
+  struct Waiter {
+    size_t id;
+    std::function<void()> ready;
+    Wait* wait;
+  };
+
+  struct ThreadLocalTokens : public Envoy::ThreadLocal::ThreadLocalObject {
+    explicit ThreadLocalTokens(TokensConstSharedPtr tokens)
+        : tokens_(std::move(tokens)) {}
+
+    // Calls the waiters whose entry has a token now.
+    void notifyWaiters();
+
+    TokensConstSharedPtr tokens_;
+    // The waits of the worker.
+    mutable std::list<Waiter> waiters_;
+  };
+
+  // Publishes the pending updates in a new snapshot.
+  void publish();
+  // Updates the bytes gauge with the tokens published.
+  void updateBytes();
+
+  Envoy::ThreadLocal::TypedSlot<ThreadLocalTokens> tls_;
+  const std::chrono::milliseconds batch_window_;
+  Envoy::Event::TimerPtr publish_timer_;
+  // The tokens published last, shared with the workers.
+  TokensConstSharedPtr tokens_;
+  std::vector<std::pair<size_t, TokenSharedPtr>> pending_;
+  Envoy::Stats::Gauge* const bytes_gauge_;
+  // The bytes last added to the gauge.
+  uint64_t bytes_ = 0;
+};
+
+using TokenRegistryPtr = std::unique_ptr<TokenRegistry>;
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,159 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_registry.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/mocks/thread_local/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+namespace test {
+
+using ::testing::NiceMock;
+
+class TokenRegistryTest : public testing::Test {
+ protected:
+  TokenRegistryTest()
+      : timer_(new NiceMock<Envoy::Event::MockTimer>(&dispatcher_)),
+        registry_(tls_, dispatcher_, std::chrono::milliseconds(1000)) {}
+
+  NiceMock<Envoy::ThreadLocal::MockInstance> tls_;
+  NiceMock<Envoy::Event::MockDispatcher> dispatcher_;
+  // Owned by the registry.
+  NiceMock<Envoy::Event::MockTimer>* timer_;
+  TokenRegistry registry_;
+};
+
+TEST_F(TokenRegistryTest, FirstTokenPublishedAtOnce) {
+  const size_t foo = registry_.add();
+  const size_t bar = registry_.add();
+  EXPECT_EQ(registry_.get(foo), nullptr);
+
+  registry_.update(foo, "token-foo");
+  EXPECT_EQ(*registry_.get(foo), "token-foo");
+  EXPECT_EQ(registry_.get(bar), nullptr);
+  EXPECT_FALSE(timer_->enabled());
+}
+
+TEST_F(TokenRegistryTest, RefreshesPublishedTogether) {
+  const size_t foo = registry_.add();
+  const size_t bar = registry_.add();
+  registry_.update(foo, "token-foo");
+  registry_.update(bar, "token-bar");
+
+  registry_.update(foo, "token-foo-2");
+  EXPECT_TRUE(timer_->enabled());
+  registry_.update(bar, "token-bar-2");
+  EXPECT_EQ(*registry_.get(foo), "token-foo");
+  EXPECT_EQ(*registry_.get(bar), "token-bar");
+
+  timer_->invokeCallback();
+  EXPECT_EQ(*registry_.get(foo), "token-foo-2");
+  EXPECT_EQ(*registry_.get(bar), "token-bar-2");
+}
+
+TEST_F(TokenRegistryTest, FirstTokenPublishesPendingRefreshes) {
+  const size_t foo = registry_.add();
+  const size_t bar = registry_.add();
+  registry_.update(foo, "token-foo");
+  registry_.update(foo, "token-foo-2");
+
+  registry_.update(bar, "token-bar");
+  EXPECT_FALSE(timer_->enabled());
+  EXPECT_EQ(*registry_.get(foo), "token-foo-2");
+  EXPECT_EQ(*registry_.get(bar), "token-bar");
+}
+
+TEST_F(TokenRegistryTest, ClearedTokenPublishedWithBatch) {
+  const size_t foo = registry_.add();
+  registry_.update(foo, "token-foo");
+
+  registry_.clear(foo);
+  EXPECT_TRUE(timer_->enabled());
+  EXPECT_EQ(*registry_.get(foo), "token-foo");
+
+  timer_->invokeCallback();
+  EXPECT_EQ(registry_.get(foo), nullptr);
+
+  // The next token is a first one again.
+  registry_.update(foo, "token-foo-2");
+  EXPECT_EQ(*registry_.get(foo), "token-foo-2");
+}
+
+TEST_F(TokenRegistryTest, WaitersCalledOnceTokenPublished) {
+  const size_t foo = registry_.add();
+  const size_t bar = registry_.add();
+  int foo_ready = 0;
+  int bar_ready = 0;
+  TokenWaitPtr foo_wait =
+      registry_.waitForToken(foo, [&foo_ready] { ++foo_ready; });
+  TokenWaitPtr bar_wait =
+      registry_.waitForToken(bar, [&bar_ready] { ++bar_ready; });
+  TokenWaitPtr ended_wait =
+      registry_.waitForToken(foo, [] { FAIL() << "ended wait called"; });
+  ended_wait.reset();
+
+  registry_.update(foo, "token-foo");
+  EXPECT_EQ(foo_ready, 1);
+  EXPECT_EQ(bar_ready, 0);
+
+  // Called once only, and a called wait can still be destroyed.
+  registry_.update(bar, "token-bar");
+  EXPECT_EQ(foo_ready, 1);
+  EXPECT_EQ(bar_ready, 1);
+  foo_wait.reset();
+  bar_wait.reset();
+}
+
+TEST_F(TokenRegistryTest, WaiterMayEndOtherWaits) {
+  const size_t foo = registry_.add();
+  TokenWaitPtr second_wait;
+  TokenWaitPtr first_wait =
+      registry_.waitForToken(foo, [&second_wait] { second_wait.reset(); });
+  second_wait =
+      registry_.waitForToken(foo, [] { FAIL() << "ended wait called"; });
+
+  registry_.update(foo, "token-foo");
+  EXPECT_EQ(second_wait, nullptr);
+}
+
+TEST_F(TokenRegistryTest, PublishedTokensCounted) {
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> store;
+  Envoy::Stats::Gauge& bytes = store.gaugeFromString(
+      "bytes", Envoy::Stats::Gauge::ImportMode::Accumulate);
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(&dispatcher_);
+  {
+    TokenRegistry registry(tls_, dispatcher_, std::chrono::milliseconds(1000),
+                           &bytes);
+    const size_t foo = registry.add();
+    registry.update(foo, std::string(100, 'a'));
+    const uint64_t token_bytes = bytes.value();
+    EXPECT_GT(token_bytes, 100);
+
+    registry.clear(foo);
+    timer->invokeCallback();
+    EXPECT_LT(bytes.value(), token_bytes);
+  }
+  EXPECT_EQ(bytes.value(), 0);
+}
+
+}  // namespace test
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
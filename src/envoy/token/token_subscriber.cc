@@ -19,6 +19,7 @@
 #include "envoy/http/async_client.h"
 #include "envoy/http/header_map.h"
 #include "source/common/common/assert.h"
+#include "source/common/common/backoff_strategy.h"
 #include "source/common/common/enum_to_int.h"
 #include "source/common/http/message_impl.h"
 #include "source/common/http/utility.h"
@@ -28,10 +29,14 @@ namespace envoy {
 namespace token {
 
 using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
+using ::espv2::api::envoy::v10::http::common::TokenRefreshConfig;
 
-// Delay after a failed fetch.
+// Delay after a failed fetch, if there is no backoff.
 constexpr std::chrono::seconds kFailedRequestRetryTime(2);
 
+// The default maximum backoff is this factor times the base interval.
+constexpr uint64_t kDefaultRetryMaxIntervalFactor = 10;
+
 // Update the token `n` seconds before the expiration.
 constexpr std::chrono::seconds kRefreshBuffer(5);
 
@@ -40,8 +45,12 @@ TokenSubscriber::TokenSubscriber(
     const TokenType& token_type, const std::string& token_cluster,
     const std::string& token_url, std::chrono::seconds fetch_timeout,
     DependencyErrorBehavior error_behavior, UpdateTokenCallback callback,
-    TokenInfoPtr token_info)
-    : context_(context),
+    TokenInfoPtr token_info, const TokenRefreshConfig& refresh_config,
+    TokenFetchPriority fetch_priority)
+    : cluster_manager_(context.clusterManager()),
+      dispatcher_(context.dispatcher()),
+      random_(context.api().randomGenerator()),
+      init_manager_(context.initManager()),
       token_type_(token_type),
       token_cluster_(token_cluster),
       token_url_(token_url),
@@ -49,18 +58,118 @@ TokenSubscriber::TokenSubscriber(
       error_behavior_(error_behavior),
       callback_(callback),
       token_info_(std::move(token_info)),
-      active_request_(nullptr),
-      init_target_(nullptr) {
+      refresh_jitter_percent_(refresh_config.refresh_jitter_percent()),
+      init_fetch_timeout_(refresh_config.init_fetch_timeout_ms()),
+      fetch_scheduler_(refresh_config.max_concurrent_fetches() > 0
+                           ? TokenFetchScheduler::get(
+                                 context.singletonManager(),
+                                 context.getServerFactoryContext().scope())
+                           : nullptr),
+      max_concurrent_fetches_(refresh_config.max_concurrent_fetches()),
+      fetch_priority_(fetch_priority),
+      token_store_(refresh_config.has_token_cache()
+                       ? std::make_unique<PersistedTokenStore>(
+                             refresh_config.token_cache().dir(),
+                             refresh_config.token_cache().key_file())
+                       : nullptr),
+      active_request_(nullptr) {
   debug_name_ = absl::StrCat("TokenSubscriber(", token_url_, ")");
+  if (token_store_ != nullptr) {
+    store_key_ = absl::StrCat(token_type_, "\n", token_cluster_, "\n",
+                              token_url_, "\n", token_info_->requestKey());
+  }
+  const uint64_t base_interval_ms = refresh_config.retry_base_interval_ms();
+  if (base_interval_ms > 0) {
+    const uint64_t max_interval_ms =
+        refresh_config.retry_max_interval_ms() > 0
+            ? refresh_config.retry_max_interval_ms()
+            : base_interval_ms * kDefaultRetryMaxIntervalFactor;
+    backoff_ = std::make_unique<Envoy::JitteredExponentialBackOffStrategy>(
+        base_interval_ms, std::max(base_interval_ms, max_interval_ms),
+        random_);
+  }
 }
 
 void TokenSubscriber::init() {
-  init_target_ = std::make_unique<Envoy::Init::TargetImpl>(
-      debug_name_, [this] { refresh(); });
   refresh_timer_ =
-      context_.dispatcher().createTimer([this]() -> void { refresh(); });
+      dispatcher_.createTimer([this]() -> void { refresh(); });
 
-  context_.initManager().add(*init_target_);
+  // With a persisted token, no init manager waits.
+  loadPersistedToken();
+  addInitManager(init_manager_);
+}
+
+void TokenSubscriber::start() {
+  refresh_timer_ =
+      dispatcher_.createTimer([this]() -> void { refresh(); });
+
+  if (!loadPersistedToken()) {
+    refresh();
+  }
+}
+
+bool TokenSubscriber::loadPersistedToken() {
+  if (token_store_ == nullptr) {
+    return false;
+  }
+  Envoy::SystemTime expiry;
+  std::string token = token_store_->load(store_key_, &expiry);
+  const std::chrono::seconds expires_in =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          expiry - dispatcher_.timeSource().systemTime());
+  if (token.empty() || expires_in <= kRefreshBuffer) {
+    return false;
+  }
+
+  ENVOY_LOG(debug, "{}: Got persisted token, expires in {} seconds",
+            debug_name_, expires_in.count());
+  token_expiry_ = dispatcher_.timeSource().monotonicTime() + expires_in;
+  callback_(std::make_shared<const std::string>(std::move(token)));
+  signalReady();
+  scheduleRefresh(refreshDelay(expires_in));
+  return true;
+}
+
+void TokenSubscriber::addInitManager(Envoy::Init::Manager& init_manager) {
+  if (ready_) {
+    return;
+  }
+  // The first manager to initialize its target starts the fetches.
+  init_targets_.push_back(
+      std::make_unique<Envoy::Init::TargetImpl>(debug_name_, [this] {
+        if (!fetch_started_) {
+          startInitFetchTimer();
+          refresh();
+        }
+      }));
+  init_manager.add(*init_targets_.back());
+}
+
+void TokenSubscriber::startInitFetchTimer() {
+  if (init_fetch_timeout_.count() == 0 ||
+      error_behavior_ != DependencyErrorBehavior::ALWAYS_INIT) {
+    return;
+  }
+  init_fetch_timer_ = dispatcher_.createTimer([this]() -> void {
+    ENVOY_LOG(warn,
+              "{}: no token after the init fetch timeout, signalling ready "
+              "due to DependencyErrorBehavior config.",
+              debug_name_);
+    signalReady();
+  });
+  init_fetch_timer_->enableTimer(init_fetch_timeout_);
+}
+
+void TokenSubscriber::signalReady() {
+  ready_ = true;
+  if (init_fetch_timer_) {
+    init_fetch_timer_->disableTimer();
+  }
+  const auto init_targets = std::move(init_targets_);
+  init_targets_.clear();
+  for (const auto& init_target : init_targets) {
+    init_target->ready();
+  }
 }
 
 TokenSubscriber::~TokenSubscriber() {
@@ -69,45 +178,125 @@ TokenSubscriber::~TokenSubscriber() {
   }
 }
 
-void TokenSubscriber::handleFailResponse() {
+TokenSubscriberStatus TokenSubscriber::status() const {
+  const Envoy::MonotonicTime now = dispatcher_.timeSource().monotonicTime();
+  TokenSubscriberStatus status;
+  status.name = debug_name_;
+  status.has_token = token_expiry_ != Envoy::MonotonicTime();
+  if (status.has_token) {
+    status.expires_in =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            token_expiry_ - now);
+  }
+  if (refresh_timer_ && refresh_timer_->enabled()) {
+    status.refresh_in = std::max(
+        std::chrono::milliseconds(0),
+        std::chrono::duration_cast<std::chrono::milliseconds>(next_refresh_ -
+                                                              now));
+  }
+  status.fetching = active_request_ != nullptr || fetch_ != nullptr;
+  status.last_error = last_error_;
+  return status;
+}
+
+void TokenSubscriber::scheduleRefresh(std::chrono::milliseconds delay) {
+  next_refresh_ = dispatcher_.timeSource().monotonicTime() + delay;
+  refresh_timer_->enableTimer(delay);
+}
+
+void TokenSubscriber::handleFailResponse(absl::string_view error) {
   active_request_ = nullptr;
-  refresh_timer_->enableTimer(kFailedRequestRetryTime);
+  fetch_.reset();
+  last_error_ = std::string(error);
+  if (backoff_) {
+    scheduleRefresh(std::chrono::milliseconds(backoff_->nextBackOffMs()));
+  } else {
+    scheduleRefresh(kFailedRequestRetryTime);
+  }
 
   switch (error_behavior_) {
     case DependencyErrorBehavior::ALWAYS_INIT:
+      if (init_fetch_timer_ && !ready_) {
+        // Still waiting for the first token.
+        break;
+      }
       ENVOY_LOG(debug,
                 "{}: Response failed, but signalling ready due to "
                 "DependencyErrorBehavior config.");
-      init_target_->ready();
+      signalReady();
       break;
     default:
       break;
   }
 }
 
-void TokenSubscriber::handleSuccessResponse(absl::string_view token,
+void TokenSubscriber::handleSuccessResponse(TokenConstSharedPtr token,
                                             std::chrono::seconds expires_in) {
   active_request_ = nullptr;
+  fetch_.reset();
+  last_error_.clear();
+  token_expiry_ = dispatcher_.timeSource().monotonicTime() + expires_in;
 
   // Signal that we are ready for initialization.
   ENVOY_LOG(debug, "{}: Got token and expiry duration: {} , {} seconds",
-            debug_name_, token, expires_in.count());
+            debug_name_, *token, expires_in.count());
+  if (token_store_ != nullptr &&
+      !token_store_->store(
+          store_key_, *token,
+          dispatcher_.timeSource().systemTime() + expires_in)) {
+    ENVOY_LOG(warn, "{}: failed to persist the token", debug_name_);
+  }
   callback_(token);
-  init_target_->ready();
+  signalReady();
+  if (backoff_) {
+    backoff_->reset();
+  }
 
   if (expires_in <= kRefreshBuffer) {
     // Handle low expiry time by retrying immediately.
     refresh();
   } else {
-    refresh_timer_->enableTimer(expires_in - kRefreshBuffer);
+    scheduleRefresh(refreshDelay(expires_in));
+  }
+}
+
+std::chrono::milliseconds TokenSubscriber::refreshDelay(
+    std::chrono::seconds expires_in) {
+  const std::chrono::milliseconds delay = expires_in - kRefreshBuffer;
+  if (refresh_jitter_percent_ == 0) {
+    return delay;
   }
+  // Only moved ahead, the token is still refreshed before it expires.
+  const uint64_t max_jitter_ms = delay.count() * refresh_jitter_percent_ / 100;
+  return delay -
+         std::chrono::milliseconds(random_.random() % (max_jitter_ms + 1));
 }
 
 void TokenSubscriber::refresh() {
+  fetch_started_ = true;
   if (active_request_) {
     active_request_->cancel();
+    active_request_ = nullptr;
+  }
+  if (fetch_scheduler_ == nullptr) {
+    fetch();
+    return;
+  }
+  if (fetch_ != nullptr && !fetch_->inFlight()) {
+    // Keeps its place in the queue.
+    return;
   }
 
+  fetch_.reset();
+  fetch_ = fetch_scheduler_->schedule(token_cluster_, max_concurrent_fetches_,
+                                      fetch_priority_, token_expiry_,
+                                      [this]() { fetch(); });
+  if (fetch_->inFlight()) {
+    fetch();
+  }
+}
+
+void TokenSubscriber::fetch() {
   ENVOY_LOG(debug, "{}: Sending TokenSubscriber request", debug_name_);
 
   Envoy::Http::RequestMessagePtr message =
@@ -115,7 +304,7 @@ void TokenSubscriber::refresh() {
   if (message == nullptr) {
     // Preconditions in TokenInfo are not met, not an error.
     ENVOY_LOG(warn, "{}: preconditions not met, retrying later", debug_name_);
-    handleFailResponse();
+    handleFailResponse("preconditions not met");
     return;
   }
 
@@ -128,10 +317,13 @@ void TokenSubscriber::refresh() {
           .setSendXff(false);
 
   const auto thread_local_cluster =
-      context_.clusterManager().getThreadLocalCluster(token_cluster_);
+      cluster_manager_.getThreadLocalCluster(token_cluster_);
   if (thread_local_cluster) {
     active_request_ = thread_local_cluster->httpAsyncClient().send(
         std::move(message), *this, options);
+  } else {
+    // Nothing is in flight.
+    fetch_.reset();
   }
 }
 
@@ -143,14 +335,14 @@ void TokenSubscriber::processResponse(
 
     if (status_code != Envoy::enumToInt(Envoy::Http::Code::OK)) {
       ENVOY_LOG(error, "{}: failed: {}", debug_name_, status_code);
-      handleFailResponse();
+      handleFailResponse(absl::StrCat("response status ", status_code));
       return;
     }
   } catch (const Envoy::EnvoyException& e) {
     // This occurs if the status header is missing.
     // Catch the exception to prevent unwinding and skipping cleanup.
     ENVOY_LOG(error, "{}: failed: {}", debug_name_, e.what());
-    handleFailResponse();
+    handleFailResponse(e.what());
     return;
   }
 
@@ -172,7 +364,7 @@ void TokenSubscriber::processResponse(
 
   // Determine status.
   if (!success) {
-    handleFailResponse();
+    handleFailResponse("invalid token response");
     return;
   }
 
@@ -183,7 +375,7 @@ void TokenSubscriber::processResponse(
     ENVOY_LOG(error,
               "{}: failed because invalid characters were detected in token {}",
               debug_name_, result.token);
-    handleFailResponse();
+    handleFailResponse("invalid characters in token");
     return;
   }
 
@@ -193,11 +385,14 @@ void TokenSubscriber::processResponse(
               "{}: failed because token has already expired, it expired {} "
               "seconds ago",
               debug_name_, result.expiry_duration.count());
-    handleFailResponse();
+    handleFailResponse("token already expired");
     return;
   }
 
-  handleSuccessResponse(result.token, result.expiry_duration);
+  // The only copy of the token, all the holders share it.
+  handleSuccessResponse(
+      std::make_shared<const std::string>(std::move(result.token)),
+      result.expiry_duration);
 }
 
 void TokenSubscriber::onSuccess(const Envoy::Http::AsyncClient::Request&,
@@ -214,15 +409,14 @@ void TokenSubscriber::onFailure(
     case Envoy::Http::AsyncClient::FailureReason::Reset:
       ENVOY_LOG(error, "{}: failed with error: the stream has been reset",
                 debug_name_);
-
+      handleFailResponse("stream reset");
       break;
     default:
       ENVOY_LOG(error, "{}: failed with an unknown network failure",
                 debug_name_);
+      handleFailResponse("network failure");
       break;
   }
-
-  handleFailResponse();
 }
 
 }  // namespace token
@@ -14,7 +14,15 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "api/envoy/v10/http/common/base.pb.h"
+#include "envoy/common/backoff_strategy.h"
+#include "envoy/common/random_generator.h"
 #include "envoy/common/time.h"
 #include "envoy/event/dispatcher.h"
 #include "envoy/http/message.h"
@@ -22,6 +30,8 @@
 #include "envoy/upstream/cluster_manager.h"
 #include "source/common/common/logger.h"
 #include "source/common/init/target_impl.h"
+#include "src/envoy/token/persisted_token_store.h"
+#include "src/envoy/token/token_fetch_scheduler.h"
 #include "src/envoy/token/token_info.h"
 
 namespace espv2 {
@@ -30,7 +40,35 @@ namespace token {
 
 enum TokenType { AccessToken, IdentityToken };
 
-using UpdateTokenCallback = std::function<void(absl::string_view)>;
+// A token, shared by its subscriber with all of its holders.
+using TokenConstSharedPtr = std::shared_ptr<const std::string>;
+
+// Called with each new token. Holders keep the pointer rather than copying
+// the token.
+using UpdateTokenCallback = std::function<void(const TokenConstSharedPtr&)>;
+
+// The subscription of a holder to a token. The holder's callback is no longer
+// called once it is destroyed.
+class TokenSubscription {
+ public:
+  virtual ~TokenSubscription() = default;
+};
+
+using TokenSubscriberPtr = std::unique_ptr<TokenSubscription>;
+
+// The state of a subscriber, for the admin interface.
+struct TokenSubscriberStatus {
+  std::string name;
+  bool has_token = false;
+  // Unset if there is no token.
+  absl::optional<std::chrono::milliseconds> expires_in;
+  // Unset if no refresh is scheduled.
+  absl::optional<std::chrono::milliseconds> refresh_in;
+  // Whether a fetch is queued or in flight.
+  bool fetching = false;
+  // Why the last fetch failed, empty if it succeeded.
+  std::string last_error;
+};
 
 // `TokenSubscriber` class contains platform logic to initiate token refreshes
 // and callback to the clients.
@@ -38,7 +76,8 @@ using UpdateTokenCallback = std::function<void(absl::string_view)>;
 // It must be provided a `TokenInfo` adapter that knows how to parse the
 // token response.
 class TokenSubscriber
-    : public Envoy::Http::AsyncClient::Callbacks,
+    : public TokenSubscription,
+      public Envoy::Http::AsyncClient::Callbacks,
       public Envoy::Logger::Loggable<Envoy::Logger::Id::init> {
  public:
   TokenSubscriber(Envoy::Server::Configuration::FactoryContext& context,
@@ -47,20 +86,48 @@ class TokenSubscriber
                   std::chrono::seconds fetch_timeout,
                   ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior
                       error_behavior,
-                  UpdateTokenCallback callback, TokenInfoPtr token_info);
+                  UpdateTokenCallback callback, TokenInfoPtr token_info,
+                  const ::espv2::api::envoy::v10::http::common::
+                      TokenRefreshConfig& refresh_config,
+                  TokenFetchPriority fetch_priority =
+                      TokenFetchPriority::Normal);
   void init();
 
+  // Starts fetching at once, with no init manager waiting for the first
+  // token, for a subscriber created after its listener was initialized.
+  void start();
+
+  // Makes `init_manager` also wait for the first token, unless it is already
+  // there. For the subscribers shared by the filters of several listeners.
+  void addInitManager(Envoy::Init::Manager& init_manager);
+
   ~TokenSubscriber();
 
+  TokenSubscriberStatus status() const;
+
   void onBeforeFinalizeUpstreamSpan(
       Envoy::Tracing::Span&, const Envoy::Http::ResponseHeaderMap*) override {}
 
  private:
-  void handleFailResponse();
-  void handleSuccessResponse(absl::string_view token,
+  // Hands out the persisted token and schedules its refresh, if there is one
+  // still valid. Returns whether there was.
+  bool loadPersistedToken();
+  void handleFailResponse(absl::string_view error);
+  // Schedules the next refresh in `delay`.
+  void scheduleRefresh(std::chrono::milliseconds delay);
+  // Signals all the init managers waiting for the first token.
+  void signalReady();
+  // Starts the init fetch timeout, if there is one.
+  void startInitFetchTimer();
+  // Returns the delay before the refresh of a token that expires in
+  // `expires_in`.
+  std::chrono::milliseconds refreshDelay(std::chrono::seconds expires_in);
+  void handleSuccessResponse(TokenConstSharedPtr token,
                              std::chrono::seconds expires_in);
   void processResponse(Envoy::Http::ResponseMessagePtr&& response);
+  // Fetches the token, once the fetch scheduler lets it.
   void refresh();
+  void fetch();
 
   // Envoy::Http::AsyncClient::Callbacks implemented by this class.
   void onSuccess(const Envoy::Http::AsyncClient::Request& request,
@@ -68,7 +135,12 @@ class TokenSubscriber
   void onFailure(const Envoy::Http::AsyncClient::Request& request,
                  Envoy::Http::AsyncClient::FailureReason reason) override;
 
-  Envoy::Server::Configuration::FactoryContext& context_;
+  // The init manager belongs to the listener and is only used by init(). The
+  // others are server wide, so a subscriber may outlive its listener.
+  Envoy::Upstream::ClusterManager& cluster_manager_;
+  Envoy::Event::Dispatcher& dispatcher_;
+  Envoy::Random::RandomGenerator& random_;
+  Envoy::Init::Manager& init_manager_;
   const TokenType token_type_;
   const std::string token_cluster_;
   const std::string token_url_;
@@ -76,6 +148,30 @@ class TokenSubscriber
   const api::envoy::v10::http::common::DependencyErrorBehavior error_behavior_;
   const UpdateTokenCallback callback_;
   TokenInfoPtr token_info_;
+  // The percentage of the token lifetime its refresh is moved ahead by at
+  // most.
+  const uint32_t refresh_jitter_percent_;
+  // The backoff between failed fetches. Null if they are retried after a fixed
+  // delay.
+  Envoy::BackOffStrategyPtr backoff_;
+  // Limits the fetches in flight. Null if they are not limited.
+  const TokenFetchSchedulerSharedPtr fetch_scheduler_;
+  const uint32_t max_concurrent_fetches_;
+  const TokenFetchPriority fetch_priority_;
+  // Queued or in flight, until the fetch ends.
+  TokenFetchPtr fetch_;
+  // When the current token expires, the epoch if there is none.
+  Envoy::MonotonicTime token_expiry_{};
+  // When the scheduled refresh is due.
+  Envoy::MonotonicTime next_refresh_{};
+  // Why the last fetch failed, empty if it succeeded.
+  std::string last_error_;
+  // Persists the tokens. Null if they are not.
+  const PersistedTokenStorePtr token_store_;
+  // Names the tokens of the subscriber in the store.
+  std::string store_key_;
+  // How long failed fetches may delay the init managers, with ALWAYS_INIT.
+  const std::chrono::milliseconds init_fetch_timeout_;
 
   Envoy::Http::AsyncClient::Request* active_request_{};
 
@@ -90,14 +186,20 @@ class TokenSubscriber
   //   Each target starts to make its remote call and signals `ready` to manager
   //   when it is initialized.
   Envoy::Event::TimerPtr refresh_timer_;
-  std::unique_ptr<Envoy::Init::TargetImpl> init_target_;
+  // Signals the init managers once the init fetch timeout is over. Null if
+  // they are signalled on the first failed fetch.
+  Envoy::Event::TimerPtr init_fetch_timer_;
+  // The targets of the init managers waiting, dropped once they are ready.
+  std::vector<std::unique_ptr<Envoy::Init::TargetImpl>> init_targets_;
+  // Whether the init managers were signalled.
+  bool ready_ = false;
+  // Whether the first fetch was started, by the first target initialized.
+  bool fetch_started_ = false;
 
   // Used in logs.
   std::string debug_name_;
 };
 
-using TokenSubscriberPtr = std::unique_ptr<TokenSubscriber>;
-
 }  // namespace token
 }  // namespace envoy
 }  // namespace espv2
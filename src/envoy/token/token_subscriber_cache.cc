@@ -0,0 +1,123 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_subscriber_cache.h"
+
+#include <utility>
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+SINGLETON_MANAGER_REGISTRATION(token_subscriber_cache);
+
+// Removes its callback, and its access token function, from the shared
+// subscriber when destroyed.
+class TokenSubscriberCache::Subscription : public TokenSubscription {
+ public:
+  Subscription(std::shared_ptr<SharedSubscriber> shared,
+               UpdateTokenCallback callback, GetTokenFunc access_token_fn)
+      : shared_(std::move(shared)),
+        callback_it_(shared_->callbacks.insert(shared_->callbacks.end(),
+                                               std::move(callback))),
+        access_token_fn_it_(shared_->access_token_fns.end()) {
+    if (access_token_fn != nullptr) {
+      access_token_fn_it_ = shared_->access_token_fns.insert(
+          shared_->access_token_fns.end(), std::move(access_token_fn));
+    }
+  }
+
+  ~Subscription() override {
+    shared_->callbacks.erase(callback_it_);
+    if (access_token_fn_it_ != shared_->access_token_fns.end()) {
+      shared_->access_token_fns.erase(access_token_fn_it_);
+    }
+  }
+
+ private:
+  const std::shared_ptr<SharedSubscriber> shared_;
+  const std::list<UpdateTokenCallback>::iterator callback_it_;
+  std::list<GetTokenFunc>::iterator access_token_fn_it_;
+};
+
+std::shared_ptr<TokenSubscriberCache> TokenSubscriberCache::get(
+    Envoy::Singleton::Manager& singleton_manager,
+    Envoy::Stats::Scope& scope) {
+  return singleton_manager.getTyped<TokenSubscriberCache>(
+      SINGLETON_MANAGER_REGISTERED_NAME(token_subscriber_cache),
+      [&scope] { return std::make_shared<TokenSubscriberCache>(scope); });
+}
+
+TokenSubscriberCache::TokenSubscriberCache(Envoy::Stats::Scope& scope)
+    : stats_{TOKEN_SUBSCRIBER_CACHE_STATS(
+          POOL_COUNTER_PREFIX(scope, "token_subscriber_cache."))} {}
+
+TokenSubscriberPtr TokenSubscriberCache::subscribe(
+    const std::string& key, Envoy::Init::Manager* init_manager,
+    UpdateTokenCallback callback, const CreateSubscriberFunc& create,
+    GetTokenFunc access_token_fn) {
+  std::weak_ptr<SharedSubscriber>& entry = entries_[key];
+  std::shared_ptr<SharedSubscriber> shared = entry.lock();
+  if (shared != nullptr) {
+    stats_.shared_subscriptions_.inc();
+    if (shared->token != nullptr) {
+      callback(shared->token);
+    }
+    if (init_manager != nullptr) {
+      shared->subscriber->addInitManager(*init_manager);
+    }
+    return std::make_unique<Subscription>(
+        std::move(shared), std::move(callback), std::move(access_token_fn));
+  }
+
+  shared = std::make_shared<SharedSubscriber>();
+  // The subscriber does not outlive the shared entry that owns it.
+  SharedSubscriber* raw = shared.get();
+  entry = shared;
+  // Subscribed before the subscriber is created, as it may fetch at once.
+  auto subscription = std::make_unique<Subscription>(
+      std::move(shared), std::move(callback), std::move(access_token_fn));
+  raw->subscriber = create(
+      [raw](const TokenConstSharedPtr& token) {
+        raw->token = token;
+        for (const UpdateTokenCallback& callback : raw->callbacks) {
+          callback(token);
+        }
+      },
+      [raw]() {
+        for (const GetTokenFunc& access_token_fn : raw->access_token_fns) {
+          std::string access_token = access_token_fn();
+          if (!access_token.empty()) {
+            return access_token;
+          }
+        }
+        return std::string();
+      });
+  return subscription;
+}
+
+std::vector<TokenSubscriberStatus> TokenSubscriberCache::statuses() const {
+  std::vector<TokenSubscriberStatus> statuses;
+  for (const auto& entry : entries_) {
+    std::shared_ptr<SharedSubscriber> shared = entry.second.lock();
+    if (shared != nullptr && shared->subscriber != nullptr) {
+      statuses.push_back(shared->subscriber->status());
+    }
+  }
+  return statuses;
+}
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
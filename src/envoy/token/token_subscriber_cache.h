@@ -0,0 +1,103 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "envoy/init/manager.h"
+#include "envoy/singleton/instance.h"
+#include "envoy/singleton/manager.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
+#include "src/envoy/token/iam_token_info.h"
+#include "src/envoy/token/token_subscriber.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+
+/**
+ * All stats for the token subscriber cache. @see stats_macros.h
+ */
+#define TOKEN_SUBSCRIBER_CACHE_STATS(COUNTER) COUNTER(shared_subscriptions)
+
+struct TokenSubscriberCacheStats {
+  TOKEN_SUBSCRIBER_CACHE_STATS(GENERATE_COUNTER_STRUCT)
+};
+
+// Shares the subscribers of identical token fetches between the filter
+// configs of all the listeners, so each token is fetched once. Main thread
+// only.
+//
+// Each subscription to an existing subscriber counts in
+// `shared_subscriptions`: it saves a fetch per token refresh.
+class TokenSubscriberCache : public Envoy::Singleton::Instance {
+ public:
+  // Creates a subscriber that calls the given callback with its tokens, and
+  // that fetches IAM tokens with the access tokens of the given function.
+  using CreateSubscriberFunc = std::function<std::unique_ptr<TokenSubscriber>(
+      UpdateTokenCallback, GetTokenFunc)>;
+
+  // Returns the process wide cache. Its stats are created in `scope`, which
+  // must be server wide, by the first call.
+  static std::shared_ptr<TokenSubscriberCache> get(
+      Envoy::Singleton::Manager& singleton_manager,
+      Envoy::Stats::Scope& scope);
+
+  explicit TokenSubscriberCache(Envoy::Stats::Scope& scope);
+
+  // Returns a subscription to the token fetched as `key` describes. If no one
+  // holds it, its subscriber is created by `create`; it is destroyed with the
+  // last subscription. `callback` is called with the current token at once,
+  // if there is one, and with each later one. `init_manager`, if not null,
+  // waits for the first token.
+  //
+  // `access_token_fn`, if set, returns the access token the holder would
+  // fetch IAM tokens with. The subscriber uses the first access token any of
+  // its subscriptions has, so one holder still waiting for its access token
+  // does not hold back the others.
+  TokenSubscriberPtr subscribe(const std::string& key,
+                               Envoy::Init::Manager* init_manager,
+                               UpdateTokenCallback callback,
+                               const CreateSubscriberFunc& create,
+                               GetTokenFunc access_token_fn = nullptr);
+
+  // Returns the status of each subscriber held.
+  std::vector<TokenSubscriberStatus> statuses() const;
+
+ private:
+  struct SharedSubscriber {
+    std::unique_ptr<TokenSubscriber> subscriber;
+    // Null until the first token.
+    TokenConstSharedPtr token;
+    std::list<UpdateTokenCallback> callbacks;
+    std::list<GetTokenFunc> access_token_fns;
+  };
+  class Subscription;
+
+  TokenSubscriberCacheStats stats_;
+  absl::flat_hash_map<std::string, std::weak_ptr<SharedSubscriber>> entries_;
+};
+
+using TokenSubscriberCacheSharedPtr = std::shared_ptr<TokenSubscriberCache>;
+
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,181 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_subscriber_cache.h"
+
+#include "api/envoy/v10/http/common/base.pb.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "src/envoy/token/mocks.h"
+#include "test/mocks/init/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+namespace test {
+namespace {
+
+using ::Envoy::Server::Configuration::MockFactoryContext;
+using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
+using ::espv2::api::envoy::v10::http::common::TokenRefreshConfig;
+using ::testing::MockFunction;
+
+class TokenSubscriberCacheTest : public testing::Test {
+ protected:
+  // Subscribes to `key`. A subscriber created for it is not started, its
+  // tokens are given by the callback kept in `update_token_`, and its access
+  // token function is kept in `access_token_fn_`.
+  TokenSubscriberPtr subscribe(
+      const std::string& key,
+      MockFunction<void(const TokenConstSharedPtr&)>& callback,
+      GetTokenFunc access_token_fn = nullptr) {
+    return cache_.subscribe(
+        key, &init_manager_, callback.AsStdFunction(),
+        [this](UpdateTokenCallback update_token,
+               GetTokenFunc access_token_fn) {
+          ++create_count_;
+          update_token_ = update_token;
+          access_token_fn_ = access_token_fn;
+          return std::make_unique<TokenSubscriber>(
+              context_, TokenType::AccessToken, "token_cluster",
+              "http://token/uri", std::chrono::seconds(5),
+              DependencyErrorBehavior::UNSPECIFIED, update_token,
+              std::make_unique<NiceMock<MockTokenInfo>>(),
+              TokenRefreshConfig());
+        },
+        std::move(access_token_fn));
+  }
+
+  uint64_t sharedSubscriptions() {
+    return Envoy::TestUtility::findCounter(
+               scope_, "token_subscriber_cache.shared_subscriptions")
+        ->value();
+  }
+
+  NiceMock<MockFactoryContext> context_;
+  NiceMock<Envoy::Init::MockManager> init_manager_;
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope_;
+  TokenSubscriberCache cache_{scope_};
+  UpdateTokenCallback update_token_;
+  GetTokenFunc access_token_fn_;
+  int create_count_ = 0;
+};
+
+TEST_F(TokenSubscriberCacheTest, SameKeyShared) {
+  MockFunction<void(const TokenConstSharedPtr&)> callback1;
+  MockFunction<void(const TokenConstSharedPtr&)> callback2;
+  MockFunction<void(const TokenConstSharedPtr&)> callback3;
+
+  TokenSubscriberPtr sub1 = subscribe("key", callback1);
+  TokenSubscriberPtr sub2 = subscribe("key", callback2);
+  EXPECT_EQ(create_count_, 1);
+  EXPECT_EQ(sharedSubscriptions(), 1);
+
+  // All the subscriptions share the token, not copies of it.
+  const TokenConstSharedPtr token1 = std::make_shared<const std::string>("1");
+  EXPECT_CALL(callback1, Call(token1));
+  EXPECT_CALL(callback2, Call(token1));
+  update_token_(token1);
+
+  // A later subscription gets the current token at once.
+  EXPECT_CALL(callback3, Call(token1));
+  TokenSubscriberPtr sub3 = subscribe("key", callback3);
+  EXPECT_EQ(create_count_, 1);
+
+  // A released subscription gets no more tokens.
+  sub1.reset();
+  const TokenConstSharedPtr token2 = std::make_shared<const std::string>("2");
+  EXPECT_CALL(callback2, Call(token2));
+  EXPECT_CALL(callback3, Call(token2));
+  update_token_(token2);
+}
+
+TEST_F(TokenSubscriberCacheTest, DifferentKeysNotShared) {
+  MockFunction<void(const TokenConstSharedPtr&)> callback1;
+  MockFunction<void(const TokenConstSharedPtr&)> callback2;
+
+  TokenSubscriberPtr sub1 = subscribe("key1", callback1);
+  TokenSubscriberPtr sub2 = subscribe("key2", callback2);
+  EXPECT_EQ(create_count_, 2);
+  EXPECT_EQ(sharedSubscriptions(), 0);
+
+  EXPECT_CALL(callback1, Call).Times(0);
+  const TokenConstSharedPtr token = std::make_shared<const std::string>("1");
+  EXPECT_CALL(callback2, Call(token));
+  update_token_(token);
+}
+
+TEST_F(TokenSubscriberCacheTest, SubscriberReleasedWithLastSubscription) {
+  MockFunction<void(const TokenConstSharedPtr&)> callback;
+
+  TokenSubscriberPtr sub1 = subscribe("key", callback);
+  TokenSubscriberPtr sub2 = subscribe("key", callback);
+  sub1.reset();
+  sub2.reset();
+
+  // A new subscriber is created, with no token yet.
+  EXPECT_CALL(callback, Call).Times(0);
+  TokenSubscriberPtr sub3 = subscribe("key", callback);
+  EXPECT_EQ(create_count_, 2);
+}
+
+TEST_F(TokenSubscriberCacheTest, AccessTokenLookupsShared) {
+  MockFunction<void(const TokenConstSharedPtr&)> callback;
+  std::string access_token1;
+  std::string access_token2 = "access-token-2";
+
+  TokenSubscriberPtr sub1 =
+      subscribe("key", callback, [&access_token1] { return access_token1; });
+  TokenSubscriberPtr sub2 =
+      subscribe("key", callback, [&access_token2] { return access_token2; });
+  TokenSubscriberPtr sub3 = subscribe("key", callback);
+  EXPECT_EQ(create_count_, 1);
+
+  // The first access token a subscription has is used.
+  EXPECT_EQ(access_token_fn_(), "access-token-2");
+  access_token1 = "access-token-1";
+  EXPECT_EQ(access_token_fn_(), "access-token-1");
+
+  // The ones of released subscriptions are not.
+  sub1.reset();
+  EXPECT_EQ(access_token_fn_(), "access-token-2");
+  sub2.reset();
+  EXPECT_EQ(access_token_fn_(), "");
+}
+
+TEST_F(TokenSubscriberCacheTest, StatusesOfHeldSubscribers) {
+  MockFunction<void(const TokenConstSharedPtr&)> callback;
+
+  TokenSubscriberPtr sub1 = subscribe("key1", callback);
+  TokenSubscriberPtr sub2 = subscribe("key1", callback);
+  TokenSubscriberPtr sub3 = subscribe("key2", callback);
+  std::vector<TokenSubscriberStatus> statuses = cache_.statuses();
+  ASSERT_EQ(statuses.size(), 2);
+  EXPECT_EQ(statuses[0].name, "TokenSubscriber(http://token/uri)");
+  EXPECT_FALSE(statuses[0].has_token);
+  EXPECT_FALSE(statuses[0].refresh_in.has_value());
+
+  // Released subscribers are left out.
+  sub3.reset();
+  EXPECT_EQ(cache_.statuses().size(), 1);
+}
+
+}  // namespace
+}  // namespace test
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
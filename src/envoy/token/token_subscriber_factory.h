@@ -34,6 +34,8 @@ class TokenSubscriberFactory {
           error_behavior,
       UpdateTokenCallback callback) const PURE;
 
+  // `access_token_fn` returns the access tokens to fetch the IAM tokens
+  // with, which are fetched as `access_token` describes.
   virtual TokenSubscriberPtr createIamTokenSubscriber(
       const TokenType& token_type, const std::string& token_cluster,
       const std::string& token_url, std::chrono::seconds fetch_timeout,
@@ -42,6 +44,7 @@ class TokenSubscriberFactory {
       UpdateTokenCallback callback,
       const ::google::protobuf::RepeatedPtrField<std::string>& delegates,
       const ::google::protobuf::RepeatedPtrField<std::string>& scopes,
+      const ::espv2::api::envoy::v10::http::common::AccessToken& access_token,
       GetTokenFunc access_token_fn) const PURE;
 };
 
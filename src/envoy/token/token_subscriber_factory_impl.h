@@ -14,21 +14,42 @@
 
 #pragma once
 
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "api/envoy/v10/http/common/base.pb.h"
 #include "src/envoy/token/iam_token_info.h"
 #include "src/envoy/token/imds_token_info.h"
 #include "src/envoy/token/token_subscriber.h"
+#include "src/envoy/token/token_subscriber_cache.h"
 #include "src/envoy/token/token_subscriber_factory.h"
 
 namespace espv2 {
 namespace envoy {
 namespace token {
 
+// The subscribers are shared by all the factories through the
+// TokenSubscriberCache. The holders of an IAM subscriber share their access
+// token lookups too: the subscriber authenticates with the access token of
+// any of them. They all fetch it from the same access token server, as the
+// server is part of the key.
+//
+// The subscribers of an `on_demand` factory are created after the listener
+// was initialized: they fetch at once and no init manager waits for them.
 class TokenSubscriberFactoryImpl : public TokenSubscriberFactory {
  public:
   TokenSubscriberFactoryImpl(
-      Envoy::Server::Configuration::FactoryContext& context)
-      : context_(context) {}
+      Envoy::Server::Configuration::FactoryContext& context,
+      const ::espv2::api::envoy::v10::http::common::TokenRefreshConfig&
+          refresh_config,
+      bool on_demand = false,
+      TokenFetchPriority fetch_priority = TokenFetchPriority::Normal)
+      : context_(context),
+        refresh_config_(refresh_config),
+        on_demand_(on_demand),
+        fetch_priority_(fetch_priority),
+        cache_(TokenSubscriberCache::get(
+            context.singletonManager(),
+            context.getServerFactoryContext().scope())) {}
 
   TokenSubscriberPtr createImdsTokenSubscriber(
       const TokenType& token_type, const std::string& token_cluster,
@@ -36,12 +57,19 @@ class TokenSubscriberFactoryImpl : public TokenSubscriberFactory {
       ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior
           error_behavior,
       UpdateTokenCallback callback) const override {
-    TokenInfoPtr info = std::make_unique<ImdsTokenInfo>();
-    TokenSubscriberPtr subscriber = std::make_unique<TokenSubscriber>(
-        context_, token_type, token_cluster, token_url, fetch_timeout,
-        error_behavior, callback, std::move(info));
-    subscriber->init();
-    return subscriber;
+    return cache_->subscribe(
+        key("imds", token_type, token_cluster, token_url, fetch_timeout,
+            error_behavior),
+        on_demand_ ? nullptr : &context_.initManager(), std::move(callback),
+        [&](UpdateTokenCallback shared_callback, GetTokenFunc) {
+          TokenInfoPtr info = std::make_unique<ImdsTokenInfo>();
+          auto subscriber = std::make_unique<TokenSubscriber>(
+              context_, token_type, token_cluster, token_url, fetch_timeout,
+              error_behavior, std::move(shared_callback), std::move(info),
+              refresh_config_, fetch_priority_);
+          start(*subscriber);
+          return subscriber;
+        });
   }
 
   TokenSubscriberPtr createIamTokenSubscriber(
@@ -52,18 +80,62 @@ class TokenSubscriberFactoryImpl : public TokenSubscriberFactory {
       UpdateTokenCallback callback,
       const ::google::protobuf::RepeatedPtrField<std::string>& delegates,
       const ::google::protobuf::RepeatedPtrField<std::string>& scopes,
+      const ::espv2::api::envoy::v10::http::common::AccessToken& access_token,
       GetTokenFunc access_token_fn) const override {
-    TokenInfoPtr info = std::make_unique<IamTokenInfo>(
-        delegates, scopes, token_type == IdentityToken, access_token_fn);
-    TokenSubscriberPtr subscriber = std::make_unique<TokenSubscriber>(
-        context_, token_type, token_cluster, token_url, fetch_timeout,
-        error_behavior, callback, std::move(info));
-    subscriber->init();
-    return subscriber;
+    // Many audiences usually share the delegates chain: the ones of each
+    // audience are fetched once, whatever the number of holders.
+    const std::string iam_key = absl::StrCat(
+        key("iam", token_type, token_cluster, token_url, fetch_timeout,
+            error_behavior),
+        "\n", absl::StrJoin(delegates, ","), "\n", absl::StrJoin(scopes, ","),
+        "\n", access_token.ShortDebugString());
+    return cache_->subscribe(
+        iam_key, on_demand_ ? nullptr : &context_.initManager(),
+        std::move(callback),
+        [&](UpdateTokenCallback shared_callback,
+            GetTokenFunc shared_access_token_fn) {
+          TokenInfoPtr info = std::make_unique<IamTokenInfo>(
+              delegates, scopes, token_type == IdentityToken,
+              std::move(shared_access_token_fn));
+          auto subscriber = std::make_unique<TokenSubscriber>(
+              context_, token_type, token_cluster, token_url, fetch_timeout,
+              error_behavior, std::move(shared_callback), std::move(info),
+              refresh_config_, fetch_priority_);
+          start(*subscriber);
+          return subscriber;
+        },
+        std::move(access_token_fn));
   }
 
  private:
+  // All that makes two fetches of a kind differ, but the IAM request fields.
+  std::string key(
+      absl::string_view kind, const TokenType& token_type,
+      const std::string& token_cluster, const std::string& token_url,
+      std::chrono::seconds fetch_timeout,
+      ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior
+          error_behavior) const {
+    return absl::StrCat(kind, "\n", token_type, "\n", token_cluster, "\n",
+                        token_url, "\n", fetch_timeout.count(), "\n",
+                        error_behavior, "\n",
+                        refresh_config_.ShortDebugString(), "\n",
+                        static_cast<int>(fetch_priority_));
+  }
+
+  void start(TokenSubscriber& subscriber) const {
+    if (on_demand_) {
+      subscriber.start();
+    } else {
+      subscriber.init();
+    }
+  }
+
   Envoy::Server::Configuration::FactoryContext& context_;
+  const ::espv2::api::envoy::v10::http::common::TokenRefreshConfig
+      refresh_config_;
+  const bool on_demand_;
+  const TokenFetchPriority fetch_priority_;
+  const TokenSubscriberCacheSharedPtr cache_;
 };
 
 }  // namespace token
@@ -0,0 +1,100 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/token/token_subscriber_factory_impl.h"
+
+#include "api/envoy/v10/http/common/base.pb.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "test/mocks/server/mocks.h"
+#include "test/test_common/utility.h"
+
+namespace espv2 {
+namespace envoy {
+namespace token {
+namespace test {
+namespace {
+
+using ::Envoy::Server::Configuration::MockFactoryContext;
+using ::espv2::api::envoy::v10::http::common::AccessToken;
+using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
+using ::espv2::api::envoy::v10::http::common::TokenRefreshConfig;
+using ::testing::NiceMock;
+
+class TokenSubscriberFactoryImplTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+        R"(
+          remote_token {
+            cluster: "access_token_cluster"
+            uri: "http://metadata/token"
+            timeout { seconds: 5 }
+          }
+        )",
+        &access_token_));
+  }
+
+  TokenSubscriberPtr subscribeIam(const AccessToken& access_token) {
+    return factory_.createIamTokenSubscriber(
+        TokenType::IdentityToken, "iam_cluster",
+        "http://iam/uri?audience=audience", std::chrono::seconds(5),
+        DependencyErrorBehavior::UNSPECIFIED,
+        [](const TokenConstSharedPtr&) {}, delegates_, scopes_, access_token,
+        [] { return std::string("access_token"); });
+  }
+
+  uint64_t sharedSubscriptions() {
+    return Envoy::TestUtility::findCounter(
+               context_.server_factory_context_.scope_,
+               "token_subscriber_cache.shared_subscriptions")
+        ->value();
+  }
+
+  NiceMock<MockFactoryContext> context_;
+  TokenSubscriberFactoryImpl factory_{context_, TokenRefreshConfig()};
+  ::google::protobuf::RepeatedPtrField<std::string> delegates_;
+  ::google::protobuf::RepeatedPtrField<std::string> scopes_;
+  AccessToken access_token_;
+};
+
+TEST_F(TokenSubscriberFactoryImplTest, IamSubscriberSharedForSameAccessToken) {
+  TokenSubscriberPtr sub1 = subscribeIam(access_token_);
+  TokenSubscriberPtr sub2 = subscribeIam(access_token_);
+  EXPECT_EQ(sharedSubscriptions(), 1);
+}
+
+TEST_F(TokenSubscriberFactoryImplTest,
+       IamSubscriberNotSharedForOtherAccessToken) {
+  // Test: the configs differ only in the server of the access tokens.
+  AccessToken other_uri = access_token_;
+  other_uri.mutable_remote_token()->set_uri("http://other/token");
+  AccessToken other_cluster = access_token_;
+  other_cluster.mutable_remote_token()->set_cluster("other_cluster");
+  AccessToken other_timeout = access_token_;
+  other_timeout.mutable_remote_token()->mutable_timeout()->set_seconds(10);
+
+  TokenSubscriberPtr sub1 = subscribeIam(access_token_);
+  TokenSubscriberPtr sub2 = subscribeIam(other_uri);
+  TokenSubscriberPtr sub3 = subscribeIam(other_cluster);
+  TokenSubscriberPtr sub4 = subscribeIam(other_timeout);
+  EXPECT_EQ(sharedSubscriptions(), 0);
+}
+
+}  // namespace
+}  // namespace test
+}  // namespace token
+}  // namespace envoy
+}  // namespace espv2
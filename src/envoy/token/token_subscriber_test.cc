@@ -22,6 +22,7 @@
 #include "src/envoy/token/mocks.h"
 #include "test/mocks/init/mocks.h"
 #include "test/mocks/server/mocks.h"
+#include "test/test_common/environment.h"
 #include "test/test_common/utility.h"
 
 namespace espv2 {
@@ -32,11 +33,14 @@ namespace test {
 using ::Envoy::Server::Configuration::MockFactoryContext;
 using ::Envoy::Upstream::MockThreadLocalCluster;
 using ::espv2::api::envoy::v10::http::common::DependencyErrorBehavior;
+using ::espv2::api::envoy::v10::http::common::TokenRefreshConfig;
 
 using ::testing::_;
 using ::testing::ByMove;
 using ::testing::Invoke;
+using ::testing::Lt;
 using ::testing::MockFunction;
+using ::testing::Pointee;
 using ::testing::Return;
 using ::testing::ReturnRef;
 
@@ -82,7 +86,7 @@ class TokenSubscriberTest : public testing::Test {
     token_sub_ = std::make_unique<TokenSubscriber>(
         context_, token_type, "token_cluster", token_url_,
         std::chrono::seconds(5), error_behavior,
-        token_callback_.AsStdFunction(), std::move(info_));
+        token_callback_.AsStdFunction(), std::move(info_), refresh_config_);
     token_sub_->init();
 
     // TokenSubscriber must call `ready` to signal Init::Manager once it
@@ -103,7 +107,8 @@ class TokenSubscriberTest : public testing::Test {
 
   // Params to class under test.
   std::string token_url_ = "http://iam/uri_suffix";
-  MockFunction<int(absl::string_view)> token_callback_;
+  TokenRefreshConfig refresh_config_;
+  MockFunction<void(const TokenConstSharedPtr&)> token_callback_;
 
   // Mocks for remote request.
   Envoy::Http::AsyncClient::Callbacks* client_callback_;
@@ -119,7 +124,7 @@ class TokenSubscriberTest : public testing::Test {
 
   // Our classes.
   MockTokenInfoPtr info_;
-  TokenSubscriberPtr token_sub_;
+  std::unique_ptr<TokenSubscriber> token_sub_;
 };
 
 TEST_F(TokenSubscriberTest, HandleMissingPreconditions) {
@@ -229,6 +234,47 @@ TEST_F(TokenSubscriberTest, ProcessNon200ResponseButInitAllowed) {
   ASSERT_TRUE(init_ready_);
 }
 
+TEST_F(TokenSubscriberTest, ProcessNon200ResponseInitAllowedAfterTimeout) {
+  refresh_config_.set_init_fetch_timeout_ms(10000);
+  auto* init_fetch_timer =
+      new NiceMock<Envoy::Event::MockTimer>(&context_.dispatcher_);
+  EXPECT_CALL(*init_fetch_timer,
+              enableTimer(std::chrono::milliseconds(10000), nullptr));
+
+  // Setup fake remote request.
+  Envoy::Http::RequestHeaderMapPtr req_headers(
+      new Envoy::Http::TestRequestHeaderMapImpl());
+  EXPECT_CALL(*info_, prepareRequest(token_url_))
+      .Times(1)
+      .WillRepeatedly(
+          Return(ByMove(std::make_unique<Envoy::Http::RequestMessageImpl>(
+              std::move(req_headers)))));
+
+  // Expect subscriber does not succeed.
+  EXPECT_CALL(*mock_timer_, enableTimer(kFailedExpect, nullptr)).Times(1);
+  EXPECT_CALL(token_callback_, Call(_)).Times(0);
+
+  // Start class under test.
+  setUp(TokenType::IdentityToken, DependencyErrorBehavior::ALWAYS_INIT);
+
+  // Setup fake response.
+  Envoy::Http::ResponseHeaderMapPtr resp_headers(
+      new Envoy::Http::TestResponseHeaderMapImpl({
+          {":status", "504"},
+      }));
+  Envoy::Http::ResponseMessagePtr response(
+      new Envoy::Http::ResponseMessageImpl(std::move(resp_headers)));
+
+  // Start the response.
+  client_callback_->onSuccess(client_request_, std::move(response));
+
+  // Init waits for the first token until the timeout.
+  ASSERT_EQ(call_count_, 1);
+  ASSERT_FALSE(init_ready_);
+  init_fetch_timer->invokeCallback();
+  ASSERT_TRUE(init_ready_);
+}
+
 TEST_F(TokenSubscriberTest, ProcessMissingStatusResponse) {
   // Setup fake remote request.
   Envoy::Http::RequestHeaderMapPtr req_headers(
@@ -419,6 +465,35 @@ TEST_F(TokenSubscriberTest, TokenPastExpiryCheckFails) {
   ASSERT_FALSE(init_ready_);
 }
 
+TEST_F(TokenSubscriberTest, FetchWaitsForSchedulerSlot) {
+  refresh_config_.set_max_concurrent_fetches(1);
+  // Another fetch of the cluster holds the only slot.
+  const TokenFetchSchedulerSharedPtr scheduler = TokenFetchScheduler::get(
+      context_.singletonManager(), context_.getServerFactoryContext().scope());
+  TokenFetchPtr other_fetch =
+      scheduler->schedule("token_cluster", 1, TokenFetchPriority::Normal,
+                          Envoy::MonotonicTime(), [] {});
+  ASSERT_TRUE(other_fetch->inFlight());
+
+  // Setup fake remote request.
+  Envoy::Http::RequestHeaderMapPtr req_headers(
+      new Envoy::Http::TestRequestHeaderMapImpl());
+  EXPECT_CALL(*info_, prepareRequest(token_url_))
+      .Times(1)
+      .WillRepeatedly(
+          Return(ByMove(std::make_unique<Envoy::Http::RequestMessageImpl>(
+              std::move(req_headers)))));
+
+  // Start class under test.
+  setUp(TokenType::AccessToken,
+        DependencyErrorBehavior::BLOCK_INIT_ON_ANY_ERROR);
+  ASSERT_EQ(call_count_, 0);
+
+  // The queued fetch starts once the slot is free.
+  other_fetch.reset();
+  ASSERT_EQ(call_count_, 1);
+}
+
 TEST_F(TokenSubscriberTest, Success) {
   // Setup fake remote request.
   Envoy::Http::RequestHeaderMapPtr req_headers(
@@ -441,7 +516,8 @@ TEST_F(TokenSubscriberTest, Success) {
   EXPECT_CALL(*mock_timer_,
               enableTimer(std::chrono::milliseconds(25 * 1000), nullptr))
       .Times(1);
-  EXPECT_CALL(token_callback_, Call("fake-token")).Times(1);
+  EXPECT_CALL(token_callback_, Call(Pointee(std::string("fake-token"))))
+      .Times(1);
 
   // Start class under test.
   setUp(TokenType::AccessToken,
@@ -463,6 +539,56 @@ TEST_F(TokenSubscriberTest, Success) {
   ASSERT_TRUE(init_ready_);
 }
 
+TEST_F(TokenSubscriberTest, PersistedTokenUsedAfterRestart) {
+  const std::string dir =
+      Envoy::TestEnvironment::temporaryPath("token_subscriber_test");
+  Envoy::TestEnvironment::createPath(dir);
+  refresh_config_.mutable_token_cache()->set_dir(dir);
+  refresh_config_.mutable_token_cache()->set_key_file(
+      Envoy::TestEnvironment::writeStringToFileForTest("token_cache_key",
+                                                       std::string(32, 'k')));
+
+  // The first subscriber fetches the token, and persists it.
+  Envoy::Http::RequestHeaderMapPtr req_headers(
+      new Envoy::Http::TestRequestHeaderMapImpl());
+  EXPECT_CALL(*info_, prepareRequest(token_url_))
+      .WillOnce(
+          Return(ByMove(std::make_unique<Envoy::Http::RequestMessageImpl>(
+              std::move(req_headers)))));
+  EXPECT_CALL(*info_, parseAccessToken(_, _))
+      .WillOnce(Invoke([](absl::string_view, TokenResult* ret) {
+        ret->token = "fake-token";
+        ret->expiry_duration = std::chrono::seconds(3600);
+        return true;
+      }));
+  EXPECT_CALL(token_callback_, Call(Pointee(std::string("fake-token"))))
+      .Times(2);
+  setUp(TokenType::AccessToken,
+        DependencyErrorBehavior::BLOCK_INIT_ON_ANY_ERROR);
+  Envoy::Http::ResponseHeaderMapPtr resp_headers(
+      new Envoy::Http::TestResponseHeaderMapImpl({
+          {":status", "200"},
+      }));
+  Envoy::Http::ResponseMessagePtr response(
+      new Envoy::Http::ResponseMessageImpl(std::move(resp_headers)));
+  client_callback_->onSuccess(client_request_, std::move(response));
+  ASSERT_EQ(call_count_, 1);
+
+  // The one of a restarted proxy has it at once. No init manager waits, and
+  // it is refreshed before it expires.
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(&context_.dispatcher_);
+  EXPECT_CALL(*timer,
+              enableTimer(Lt(std::chrono::milliseconds(3600 * 1000)), _));
+  EXPECT_CALL(context_.init_manager_, add(_)).Times(0);
+  TokenSubscriber restarted(
+      context_, TokenType::AccessToken, "token_cluster", token_url_,
+      std::chrono::seconds(5), DependencyErrorBehavior::BLOCK_INIT_ON_ANY_ERROR,
+      token_callback_.AsStdFunction(),
+      std::make_unique<NiceMock<MockTokenInfo>>(), refresh_config_);
+  restarted.init();
+  EXPECT_EQ(call_count_, 1);
+}
+
 TEST_F(TokenSubscriberTest, RetryMissingPreconditionThenSuccess) {
   // Part 1: Failed due to missing precondition
 
@@ -488,7 +614,8 @@ TEST_F(TokenSubscriberTest, RetryMissingPreconditionThenSuccess) {
   EXPECT_CALL(*mock_timer_,
               enableTimer(std::chrono::milliseconds(25 * 1000), nullptr))
       .Times(1);
-  EXPECT_CALL(token_callback_, Call("fake-token")).Times(1);
+  EXPECT_CALL(token_callback_, Call(Pointee(std::string("fake-token"))))
+      .Times(1);
 
   // Start class under test.
   setUp(TokenType::AccessToken,
@@ -517,6 +644,57 @@ TEST_F(TokenSubscriberTest, RetryMissingPreconditionThenSuccess) {
   ASSERT_TRUE(init_ready_);
 }
 
+TEST_F(TokenSubscriberTest, StatusHasLastErrorAndNextRefresh) {
+  Envoy::Http::RequestHeaderMapPtr req_headers(
+      new Envoy::Http::TestRequestHeaderMapImpl());
+  EXPECT_CALL(*info_, prepareRequest(_))
+      .WillOnce(Return(ByMove(nullptr)))
+      .WillRepeatedly(
+          Return(ByMove(std::make_unique<Envoy::Http::RequestMessageImpl>(
+              std::move(req_headers)))));
+  EXPECT_CALL(*info_, parseAccessToken(_, _))
+      .WillOnce(Invoke([](absl::string_view, TokenResult* ret) {
+        ret->token = "fake-token";
+        ret->expiry_duration = std::chrono::seconds(30);
+        return true;
+      }));
+  EXPECT_CALL(*mock_timer_, enableTimer(kFailedExpect, nullptr));
+  EXPECT_CALL(*mock_timer_,
+              enableTimer(std::chrono::milliseconds(25 * 1000), nullptr));
+  EXPECT_CALL(*mock_timer_, enabled()).WillRepeatedly(Return(true));
+
+  setUp(TokenType::AccessToken,
+        DependencyErrorBehavior::BLOCK_INIT_ON_ANY_ERROR);
+
+  // The failed fetch is retried later.
+  TokenSubscriberStatus status = token_sub_->status();
+  EXPECT_EQ(status.name, "TokenSubscriber(http://iam/uri_suffix)");
+  EXPECT_FALSE(status.has_token);
+  EXPECT_FALSE(status.expires_in.has_value());
+  ASSERT_TRUE(status.refresh_in.has_value());
+  EXPECT_LE(*status.refresh_in, kFailedExpect);
+  EXPECT_EQ(status.last_error, "preconditions not met");
+
+  // The retry gets a token, and clears the error.
+  timer_cb_();
+  Envoy::Http::ResponseMessagePtr response(
+      new Envoy::Http::ResponseMessageImpl(
+          Envoy::Http::ResponseHeaderMapPtr(
+              new Envoy::Http::TestResponseHeaderMapImpl({
+                  {":status", "200"},
+              }))));
+  client_callback_->onSuccess(client_request_, std::move(response));
+
+  status = token_sub_->status();
+  EXPECT_TRUE(status.has_token);
+  ASSERT_TRUE(status.expires_in.has_value());
+  EXPECT_LE(*status.expires_in, std::chrono::seconds(30));
+  ASSERT_TRUE(status.refresh_in.has_value());
+  EXPECT_LE(*status.refresh_in, std::chrono::seconds(25));
+  EXPECT_FALSE(status.fetching);
+  EXPECT_EQ(status.last_error, "");
+}
+
 TEST_F(TokenSubscriberTest, RetryMissingPreconditionThenSuccessWithAlwaysInit) {
   // Part 1: Failed due to missing precondition
 
@@ -542,7 +720,8 @@ TEST_F(TokenSubscriberTest, RetryMissingPreconditionThenSuccessWithAlwaysInit) {
   EXPECT_CALL(*mock_timer_,
               enableTimer(std::chrono::milliseconds(25 * 1000), nullptr))
       .Times(1);
-  EXPECT_CALL(token_callback_, Call("fake-token")).Times(1);
+  EXPECT_CALL(token_callback_, Call(Pointee(std::string("fake-token"))))
+      .Times(1);
 
   // Start class under test.
   setUp(TokenType::AccessToken, DependencyErrorBehavior::ALWAYS_INIT);
@@ -592,7 +771,8 @@ TEST_F(TokenSubscriberTest, RetryShortExpiryTime) {
 
   // Expect subscriber does succeed, but time was not set.
   EXPECT_CALL(*mock_timer_, enableTimer(_, _)).Times(0);
-  EXPECT_CALL(token_callback_, Call("fake-token")).Times(1);
+  EXPECT_CALL(token_callback_, Call(Pointee(std::string("fake-token"))))
+      .Times(1);
 
   // Start class under test.
   setUp(TokenType::AccessToken,
@@ -614,6 +794,93 @@ TEST_F(TokenSubscriberTest, RetryShortExpiryTime) {
   ASSERT_TRUE(init_ready_);
 }
 
+TEST_F(TokenSubscriberTest, SuccessWithRefreshJitter) {
+  refresh_config_.set_refresh_jitter_percent(20);
+  EXPECT_CALL(context_.api_.random_, random()).WillOnce(Return(3001));
+
+  // Setup fake remote request.
+  Envoy::Http::RequestHeaderMapPtr req_headers(
+      new Envoy::Http::TestRequestHeaderMapImpl());
+  EXPECT_CALL(*info_, prepareRequest(token_url_))
+      .Times(1)
+      .WillRepeatedly(
+          Return(ByMove(std::make_unique<Envoy::Http::RequestMessageImpl>(
+              std::move(req_headers)))));
+
+  // Setup fake parse status.
+  EXPECT_CALL(*info_, parseAccessToken(_, _))
+      .WillOnce(Invoke([](absl::string_view, TokenResult* ret) {
+        ret->token = "fake-token";
+        ret->expiry_duration = std::chrono::seconds(30);
+        return true;
+      }));
+
+  // The refresh 25s after is moved ahead by at most 20% of it, 5s.
+  EXPECT_CALL(*mock_timer_,
+              enableTimer(std::chrono::milliseconds(25 * 1000 - 3001), nullptr))
+      .Times(1);
+  EXPECT_CALL(token_callback_, Call(Pointee(std::string("fake-token"))))
+      .Times(1);
+
+  // Start class under test.
+  setUp(TokenType::AccessToken,
+        DependencyErrorBehavior::BLOCK_INIT_ON_ANY_ERROR);
+
+  // Setup fake response.
+  Envoy::Http::ResponseHeaderMapPtr resp_headers(
+      new Envoy::Http::TestResponseHeaderMapImpl({
+          {":status", "200"},
+      }));
+  Envoy::Http::ResponseMessagePtr response(
+      new Envoy::Http::ResponseMessageImpl(std::move(resp_headers)));
+
+  // Start the response.
+  client_callback_->onSuccess(client_request_, std::move(response));
+
+  // Assert subscriber did succeed.
+  ASSERT_EQ(call_count_, 1);
+  ASSERT_TRUE(init_ready_);
+}
+
+TEST_F(TokenSubscriberTest, FailedFetchBacksOff) {
+  refresh_config_.set_retry_base_interval_ms(1000);
+  EXPECT_CALL(context_.api_.random_, random()).WillRepeatedly(Return(1500));
+
+  // Setup fake remote request.
+  Envoy::Http::RequestHeaderMapPtr req_headers(
+      new Envoy::Http::TestRequestHeaderMapImpl());
+  EXPECT_CALL(*info_, prepareRequest(token_url_))
+      .Times(1)
+      .WillRepeatedly(
+          Return(ByMove(std::make_unique<Envoy::Http::RequestMessageImpl>(
+              std::move(req_headers)))));
+
+  // The first retry is within the base interval, not after the fixed delay.
+  EXPECT_CALL(*mock_timer_,
+              enableTimer(Lt(std::chrono::milliseconds(1000)), nullptr))
+      .Times(1);
+  EXPECT_CALL(token_callback_, Call(_)).Times(0);
+
+  // Start class under test.
+  setUp(TokenType::IdentityToken,
+        DependencyErrorBehavior::BLOCK_INIT_ON_ANY_ERROR);
+
+  // Setup fake response.
+  Envoy::Http::ResponseHeaderMapPtr resp_headers(
+      new Envoy::Http::TestResponseHeaderMapImpl({
+          {":status", "504"},
+      }));
+  Envoy::Http::ResponseMessagePtr response(
+      new Envoy::Http::ResponseMessageImpl(std::move(resp_headers)));
+
+  // Start the response.
+  client_callback_->onSuccess(client_request_, std::move(response));
+
+  // Assert subscriber did not succeed.
+  ASSERT_EQ(call_count_, 1);
+  ASSERT_FALSE(init_ready_);
+}
+
 }  // namespace test
 }  // namespace token
 }  // namespace envoy
@@ -0,0 +1,82 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// tcmalloc provides operator new itself, it can't be replaced then.
+#if !defined(TCMALLOC) && !defined(GPERFTOOLS_TCMALLOC)
+#define ESPV2_COUNT_ALLOCATIONS
+#endif
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+std::atomic<uint64_t> allocations_{0};
+
+}  // namespace
+
+AllocationCounter::AllocationCounter() { reset(); }
+
+bool AllocationCounter::enabled() {
+#ifdef ESPV2_COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint64_t AllocationCounter::allocations() const {
+  return allocations_.load(std::memory_order_relaxed) - start_;
+}
+
+void AllocationCounter::reset() {
+  start_ = allocations_.load(std::memory_order_relaxed);
+}
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
+
+#ifdef ESPV2_COUNT_ALLOCATIONS
+
+namespace {
+
+void* countedAlloc(size_t size) {
+  espv2::envoy::utils::allocations_.fetch_add(1, std::memory_order_relaxed);
+  // malloc(0) may return nullptr, operator new must not.
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+}  // namespace
+
+// The nothrow and aligned forms are left to the standard library: the nothrow
+// ones call these, the aligned ones have their own allocator.
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+#endif
@@ -0,0 +1,51 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+// Counts the heap allocations made with operator new while it is alive, for
+// tests that bound the allocations of a request path. Allocations of all the
+// threads are counted, so tests should keep other threads idle.
+//
+// The count is only kept in builds without tcmalloc (e.g. --config=asan), as
+// tcmalloc provides operator new itself. Tests should skip otherwise:
+//
+//   if (!AllocationCounter::enabled()) {
+//     GTEST_SKIP() << "allocations are not counted with tcmalloc";
+//   }
+class AllocationCounter {
+ public:
+  AllocationCounter();
+
+  // Whether allocations are counted in this build.
+  static bool enabled();
+
+  // The number of allocations made since construction or the last reset().
+  uint64_t allocations() const;
+
+  void reset();
+
+ private:
+  uint64_t start_;
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
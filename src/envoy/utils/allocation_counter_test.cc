@@ -0,0 +1,56 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/allocation_counter.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+TEST(AllocationCounterTest, CountsAllocations) {
+  if (!AllocationCounter::enabled()) {
+    GTEST_SKIP() << "allocations are not counted with tcmalloc";
+  }
+
+  AllocationCounter counter;
+  EXPECT_EQ(counter.allocations(), 0);
+
+  auto value = std::make_unique<int>(1);
+  EXPECT_EQ(counter.allocations(), 1);
+
+  std::vector<int> values;
+  values.reserve(16);
+  EXPECT_EQ(counter.allocations(), 2);
+
+  // Freeing memory is not counted.
+  value.reset();
+  EXPECT_EQ(counter.allocations(), 2);
+
+  counter.reset();
+  EXPECT_EQ(counter.allocations(), 0);
+  std::string text(100, 'a');
+  EXPECT_EQ(counter.allocations(), 1);
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
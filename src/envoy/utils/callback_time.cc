@@ -0,0 +1,76 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/callback_time.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+CallbackTimeSampler::CallbackTimeSampler(uint32_t sample_rate,
+                                         const std::string& prefix,
+                                         Envoy::Stats::Scope& scope,
+                                         Envoy::TimeSource& time_source,
+                                         Envoy::Random::RandomGenerator& random)
+    : sample_rate_(sample_rate),
+      stats_{CALLBACK_TIME_STATS(POOL_HISTOGRAM_PREFIX(scope, prefix))},
+      time_source_(time_source),
+      random_(random) {}
+
+CallbackTimeSamplerPtr CallbackTimeSampler::create(
+    const ::espv2::api::envoy::v10::http::common::CallbackTimeConfig& config,
+    const std::string& prefix,
+    Envoy::Server::Configuration::FactoryContext& context) {
+  if (config.sample_rate() == 0) {
+    return nullptr;
+  }
+  return std::make_unique<CallbackTimeSampler>(
+      config.sample_rate(), prefix, context.scope(), context.timeSource(),
+      context.api().randomGenerator());
+}
+
+CallbackTimer::Scope::Scope(const CallbackTimeSampler* sampler,
+                            std::chrono::nanoseconds& total)
+    : sampler_(sampler), total_(total) {
+  if (sampler_ != nullptr) {
+    start_ = sampler_->now();
+  }
+}
+
+CallbackTimer::Scope::~Scope() {
+  if (sampler_ != nullptr) {
+    total_ += sampler_->now() - start_;
+  }
+}
+
+CallbackTimer::~CallbackTimer() {
+  if (sampler_ == nullptr) {
+    return;
+  }
+  // A filter with callbacks of one kind only doesn't record the other one.
+  if (decode_time_.count() > 0) {
+    sampler_->stats().decode_callback_time_.recordValue(
+        std::chrono::duration_cast<std::chrono::microseconds>(decode_time_)
+            .count());
+  }
+  if (encode_time_.count() > 0) {
+    sampler_->stats().encode_callback_time_.recordValue(
+        std::chrono::duration_cast<std::chrono::microseconds>(encode_time_)
+            .count());
+  }
+}
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
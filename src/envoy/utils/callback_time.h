@@ -0,0 +1,124 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "api/envoy/v10/http/common/base.pb.h"
+#include "envoy/common/random_generator.h"
+#include "envoy/common/time.h"
+#include "envoy/server/filter_config.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+/**
+ * The callback time stats of a filter. @see stats_macros.h
+ */
+#define CALLBACK_TIME_STATS(HISTOGRAM)          \
+  HISTOGRAM(decode_callback_time, Microseconds) \
+  HISTOGRAM(encode_callback_time, Microseconds)
+
+/**
+ * Wrapper struct for the callback time stats. @see stats_macros.h
+ */
+struct CallbackTimeStats {
+  CALLBACK_TIME_STATS(GENERATE_HISTOGRAM_STRUCT)
+};
+
+class CallbackTimeSampler;
+using CallbackTimeSamplerPtr = std::unique_ptr<CallbackTimeSampler>;
+
+// Picks the requests whose filter callbacks are timed, one in every
+// `sample_rate` ones. Owned by the filter config, shared by the workers.
+class CallbackTimeSampler {
+ public:
+  CallbackTimeSampler(uint32_t sample_rate, const std::string& prefix,
+                      Envoy::Stats::Scope& scope,
+                      Envoy::TimeSource& time_source,
+                      Envoy::Random::RandomGenerator& random);
+
+  // Returns nullptr if the config times no request. `prefix` is the one of
+  // the filter stats, e.g. "http.ingress.path_rewrite.".
+  static CallbackTimeSamplerPtr create(
+      const ::espv2::api::envoy::v10::http::common::CallbackTimeConfig& config,
+      const std::string& prefix,
+      Envoy::Server::Configuration::FactoryContext& context);
+
+  // Returns whether a new request is timed.
+  bool sample() const { return random_.random() % sample_rate_ == 0; }
+
+  Envoy::MonotonicTime now() const { return time_source_.monotonicTime(); }
+
+  CallbackTimeStats& stats() const { return stats_; }
+
+ private:
+  const uint32_t sample_rate_;
+  mutable CallbackTimeStats stats_;
+  Envoy::TimeSource& time_source_;
+  Envoy::Random::RandomGenerator& random_;
+};
+
+// Times the decode and encode callbacks of a request in a filter, if the
+// request is sampled. The total time of each kind is recorded when the timer
+// is destroyed with the filter. Requests that are not sampled don't read the
+// clock.
+//
+//   Envoy::Http::FilterHeadersStatus Filter::decodeHeaders(...) {
+//     const auto timed = callback_timer_.decode();
+//     ...
+//   }
+class CallbackTimer {
+ public:
+  // Times a callback until it goes out of scope.
+  class Scope {
+   public:
+    Scope(const CallbackTimeSampler* sampler,
+          std::chrono::nanoseconds& total);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    const CallbackTimeSampler* const sampler_;
+    std::chrono::nanoseconds& total_;
+    Envoy::MonotonicTime start_;
+  };
+
+  // The sampler may be nullptr, then no request is timed.
+  explicit CallbackTimer(const CallbackTimeSampler* sampler)
+      : sampler_(sampler != nullptr && sampler->sample() ? sampler
+                                                         : nullptr) {}
+  ~CallbackTimer();
+
+  Scope decode() { return Scope(sampler_, decode_time_); }
+  Scope encode() { return Scope(sampler_, encode_time_); }
+
+ private:
+  // Only set if the request is sampled.
+  const CallbackTimeSampler* const sampler_;
+  std::chrono::nanoseconds decode_time_{};
+  std::chrono::nanoseconds encode_time_{};
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,123 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/callback_time.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/common.h"
+#include "test/mocks/server/mocks.h"
+#include "test/mocks/stats/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+using ::espv2::api::envoy::v10::http::common::CallbackTimeConfig;
+using ::testing::_;
+using ::testing::NiceMock;
+using ::testing::Property;
+using ::testing::Return;
+
+class CallbackTimeTest : public ::testing::Test {
+ protected:
+  // Makes the clock move by `elapsed` between each read.
+  void tick(std::chrono::microseconds elapsed) {
+    now_ += elapsed;
+    EXPECT_CALL(time_source_, monotonicTime())
+        .WillOnce(Return(now_ - elapsed))
+        .WillOnce(Return(now_))
+        .RetiresOnSaturation();
+  }
+
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> scope_;
+  NiceMock<Envoy::MockTimeSystem> time_source_;
+  NiceMock<Envoy::Random::MockRandomGenerator> random_;
+  CallbackTimeSampler sampler_{4, "filter.", scope_, time_source_, random_};
+  Envoy::MonotonicTime now_;
+};
+
+TEST_F(CallbackTimeTest, SampledRequestRecorded) {
+  EXPECT_CALL(random_, random()).WillOnce(Return(8));
+  EXPECT_CALL(scope_,
+              deliverHistogramToSinks(
+                  Property(&Envoy::Stats::Metric::name,
+                           "filter.decode_callback_time"),
+                  5));
+  EXPECT_CALL(scope_,
+              deliverHistogramToSinks(
+                  Property(&Envoy::Stats::Metric::name,
+                           "filter.encode_callback_time"),
+                  7));
+
+  CallbackTimer timer(&sampler_);
+  // The times of the callbacks of a kind add up.
+  tick(std::chrono::microseconds(7));
+  { const auto timed = timer.encode(); }
+  tick(std::chrono::microseconds(2));
+  { const auto timed = timer.decode(); }
+  tick(std::chrono::microseconds(3));
+  { const auto timed = timer.decode(); }
+}
+
+TEST_F(CallbackTimeTest, DecodeOnlyRequestRecordsDecodeTime) {
+  EXPECT_CALL(random_, random()).WillOnce(Return(0));
+  EXPECT_CALL(scope_,
+              deliverHistogramToSinks(
+                  Property(&Envoy::Stats::Metric::name,
+                           "filter.decode_callback_time"),
+                  2));
+  EXPECT_CALL(scope_,
+              deliverHistogramToSinks(
+                  Property(&Envoy::Stats::Metric::name,
+                           "filter.encode_callback_time"),
+                  _))
+      .Times(0);
+
+  CallbackTimer timer(&sampler_);
+  tick(std::chrono::microseconds(2));
+  const auto timed = timer.decode();
+}
+
+TEST_F(CallbackTimeTest, RequestNotSampled) {
+  EXPECT_CALL(random_, random()).WillOnce(Return(5));
+  EXPECT_CALL(time_source_, monotonicTime()).Times(0);
+  EXPECT_CALL(scope_, deliverHistogramToSinks(_, _)).Times(0);
+
+  CallbackTimer timer(&sampler_);
+  const auto timed = timer.decode();
+}
+
+TEST_F(CallbackTimeTest, NoSampler) {
+  EXPECT_CALL(random_, random()).Times(0);
+  EXPECT_CALL(scope_, deliverHistogramToSinks(_, _)).Times(0);
+
+  CallbackTimer timer(nullptr);
+  const auto timed = timer.encode();
+}
+
+TEST(CallbackTimeSamplerTest, Create) {
+  NiceMock<Envoy::Server::Configuration::MockFactoryContext> context;
+  CallbackTimeConfig config;
+  EXPECT_EQ(CallbackTimeSampler::create(config, "filter.", context), nullptr);
+
+  config.set_sample_rate(1);
+  EXPECT_NE(CallbackTimeSampler::create(config, "filter.", context), nullptr);
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
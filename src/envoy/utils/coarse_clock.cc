@@ -0,0 +1,39 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/coarse_clock.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+CoarseSystemClock::CoarseSystemClock(
+    const Envoy::Event::Dispatcher& dispatcher, Envoy::TimeSource& time_source)
+    : dispatcher_(dispatcher),
+      time_source_(time_source),
+      loop_time_(dispatcher.approximateMonotonicTime()),
+      now_(time_source.systemTime()) {}
+
+Envoy::SystemTime CoarseSystemClock::now() {
+  const Envoy::MonotonicTime loop_time = dispatcher_.approximateMonotonicTime();
+  if (loop_time != loop_time_) {
+    loop_time_ = loop_time;
+    now_ = time_source_.systemTime();
+  }
+  return now_;
+}
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,46 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "envoy/common/time.h"
+#include "envoy/event/dispatcher.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+// The wall clock of a worker, read at most once per iteration of its event
+// loop: the time is cached until the approximate monotonic time of the
+// dispatcher, updated by each iteration, moves. It lags the real time by at
+// most an iteration, which is fine for timestamps that only need
+// millisecond accuracy. Only used on the thread of the dispatcher.
+class CoarseSystemClock {
+ public:
+  CoarseSystemClock(const Envoy::Event::Dispatcher& dispatcher,
+                    Envoy::TimeSource& time_source);
+
+  Envoy::SystemTime now();
+
+ private:
+  const Envoy::Event::Dispatcher& dispatcher_;
+  Envoy::TimeSource& time_source_;
+  // The loop time the cached time was read at.
+  Envoy::MonotonicTime loop_time_;
+  Envoy::SystemTime now_;
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
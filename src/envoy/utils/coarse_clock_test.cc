@@ -0,0 +1,56 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/coarse_clock.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/common.h"
+#include "test/mocks/event/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+using ::testing::NiceMock;
+using ::testing::Return;
+
+TEST(CoarseSystemClockTest, ReadOncePerLoopIteration) {
+  NiceMock<Envoy::Event::MockDispatcher> dispatcher;
+  NiceMock<Envoy::MockTimeSystem> time_source;
+  const Envoy::MonotonicTime loop_time(std::chrono::seconds(1));
+  const Envoy::SystemTime time1(std::chrono::seconds(100));
+  const Envoy::SystemTime time2(std::chrono::seconds(101));
+  EXPECT_CALL(dispatcher, approximateMonotonicTime())
+      .WillRepeatedly(Return(loop_time));
+  EXPECT_CALL(time_source, systemTime()).WillOnce(Return(time1));
+  CoarseSystemClock clock(dispatcher, time_source);
+
+  // The same iteration reuses the time.
+  EXPECT_EQ(clock.now(), time1);
+  EXPECT_EQ(clock.now(), time1);
+
+  // The next one reads the clock again, once.
+  EXPECT_CALL(dispatcher, approximateMonotonicTime())
+      .WillRepeatedly(Return(loop_time + std::chrono::milliseconds(2)));
+  EXPECT_CALL(time_source, systemTime()).WillOnce(Return(time2));
+  EXPECT_EQ(clock.now(), time2);
+  EXPECT_EQ(clock.now(), time2);
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
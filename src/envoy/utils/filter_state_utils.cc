@@ -44,6 +44,59 @@ absl::string_view getStringFilterState(
   return filter_state.getDataReadOnly<StringAccessor>(data_name).asString();
 }
 
+const EspRequestContext& EspRequestContext::getOrCreate(
+    FilterState& filter_state, const Envoy::Http::RequestHeaderMap& headers) {
+  const absl::string_view path =
+      headers.Path() == nullptr ? absl::string_view()
+                                : headers.Path()->value().getStringView();
+  if (!filter_state.hasData<EspRequestContext>(kFilterStateRequestContext)) {
+    auto context = std::make_unique<EspRequestContext>();
+    context->setPath(path);
+    filter_state.setData(kFilterStateRequestContext, std::move(context),
+                         FilterState::StateType::Mutable);
+  }
+
+  auto& context = filter_state.getDataMutable<EspRequestContext>(
+      kFilterStateRequestContext);
+  if (!context.valid_ || context.request_path_.path.data() != path.data() ||
+      context.request_path_.path.size() != path.size()) {
+    context.setPath(path);
+  }
+  return context;
+}
+
+void EspRequestContext::invalidate(FilterState& filter_state) {
+  if (filter_state.hasData<EspRequestContext>(kFilterStateRequestContext)) {
+    filter_state
+        .getDataMutable<EspRequestContext>(kFilterStateRequestContext)
+        .valid_ = false;
+  }
+}
+
+const EspRequestContext* EspRequestContext::find(
+    const FilterState& filter_state) {
+  if (!filter_state.hasData<EspRequestContext>(kFilterStateRequestContext)) {
+    return nullptr;
+  }
+  return &filter_state.getDataReadOnly<EspRequestContext>(
+      kFilterStateRequestContext);
+}
+
+const Envoy::Http::Utility::QueryParams& EspRequestContext::queryParams()
+    const {
+  if (!query_params_.has_value()) {
+    query_params_ =
+        Envoy::Http::Utility::parseQueryString(request_path_.path);
+  }
+  return *query_params_;
+}
+
+void EspRequestContext::setPath(absl::string_view path) {
+  request_path_ = RequestPath::scan(path);
+  valid_ = true;
+  query_params_.reset();
+}
+
 }  // namespace utils
 }  // namespace envoy
 }  // namespace espv2
@@ -15,7 +15,11 @@
 #pragma once
 #include <string>
 
+#include "absl/types/optional.h"
+#include "envoy/http/header_map.h"
 #include "envoy/stream_info/filter_state.h"
+#include "source/common/http/utility.h"
+#include "src/envoy/utils/request_path.h"
 
 namespace espv2 {
 namespace envoy {
@@ -37,6 +41,45 @@ absl::string_view getStringFilterState(
     const Envoy::StreamInfo::FilterState& filter_state,
     absl::string_view data_name);
 
+// Data name in `FilterState` of the EspRequestContext.
+constexpr char kFilterStateRequestContext[] =
+    "com.google.espv2.filters.http.request_context";
+
+// The request attributes more than one ESPv2 filter reads, derived once per
+// request by the first filter that needs them and kept in the filter state.
+class EspRequestContext : public Envoy::StreamInfo::FilterState::Object {
+ public:
+  // Returns the context of the stream for `headers`, created or, if the path
+  // has changed since, updated. A path set in a new header value, such as by
+  // a filter between the ESPv2 ones, is noticed from its address and size.
+  static const EspRequestContext& getOrCreate(
+      Envoy::StreamInfo::FilterState& filter_state,
+      const Envoy::Http::RequestHeaderMap& headers);
+
+  // Returns the context created by an earlier filter, or nullptr.
+  static const EspRequestContext* find(
+      const Envoy::StreamInfo::FilterState& filter_state);
+
+  // Called by the ESPv2 filters that change the path, as the header value
+  // may be reused for the new path. The next getOrCreate() scans it again.
+  static void invalidate(Envoy::StreamInfo::FilterState& filter_state);
+
+  // The :path, scanned. It views the header, and is only valid until the
+  // path is changed.
+  const RequestPath& path() const { return request_path_; }
+
+  // The query parameters of the path, parsed on first use.
+  const Envoy::Http::Utility::QueryParams& queryParams() const;
+
+ private:
+  void setPath(absl::string_view path);
+
+  RequestPath request_path_;
+  // Whether request_path_ views the current path.
+  bool valid_ = false;
+  mutable absl::optional<Envoy::Http::Utility::QueryParams> query_params_;
+};
+
 }  // namespace utils
 }  // namespace envoy
 }  // namespace espv2
@@ -43,6 +43,35 @@ TEST(FilterStateUtilsTest, ReturnEmptyStringViewForNonExistingDataName) {
             Envoy::EMPTY_STRING);
 }
 
+TEST(FilterStateUtilsTest, RequestContextSharedUntilPathChanges) {
+  Envoy::StreamInfo::FilterStateImpl filter_state(
+      Envoy::StreamInfo::FilterState::LifeSpan::FilterChain);
+  Envoy::Http::TestRequestHeaderMapImpl headers{{":path", "/a?key=1#b"}};
+  EXPECT_EQ(EspRequestContext::find(filter_state), nullptr);
+
+  const EspRequestContext& context =
+      EspRequestContext::getOrCreate(filter_state, headers);
+  EXPECT_EQ(context.path().pathWithoutQuery(), "/a");
+  EXPECT_TRUE(context.path().has_fragment);
+  EXPECT_EQ(context.queryParams().at("key"), "1");
+  EXPECT_EQ(&EspRequestContext::getOrCreate(filter_state, headers), &context);
+  EXPECT_EQ(EspRequestContext::find(filter_state), &context);
+
+  // A path of another size is scanned again.
+  headers.setPath("/c?key=2");
+  EspRequestContext::getOrCreate(filter_state, headers);
+  EXPECT_EQ(context.path().path, "/c?key=2");
+  EXPECT_FALSE(context.path().has_fragment);
+  EXPECT_EQ(context.queryParams().at("key"), "2");
+
+  // So is one of the same size once invalidated, whatever its address.
+  headers.setPath("/d?key=3");
+  EspRequestContext::invalidate(filter_state);
+  EspRequestContext::getOrCreate(filter_state, headers);
+  EXPECT_EQ(context.path().path, "/d?key=3");
+  EXPECT_EQ(context.queryParams().at("key"), "3");
+}
+
 }  // namespace
 }  // namespace utils
 }  // namespace envoy
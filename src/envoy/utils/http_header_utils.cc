@@ -26,8 +26,11 @@ namespace utils {
 namespace Logger = Envoy::Logger;
 
 namespace {
-const Envoy::Http::LowerCaseString kHttpMethodOverrideHeader{
-    "x-http-method-override"};
+// Looked up in every request.
+Envoy::Http::RegisterCustomInlineHeader<
+    Envoy::Http::CustomInlineHeaderRegistry::Type::RequestHeaders>
+    method_override_handle(
+        Envoy::Http::LowerCaseString("x-http-method-override"));
 }  // namespace
 
 absl::string_view readHeaderEntry(const Envoy::Http::HeaderEntry* entry) {
@@ -39,29 +42,30 @@ absl::string_view readHeaderEntry(const Envoy::Http::HeaderEntry* entry) {
 
 absl::string_view extractHeader(const Envoy::Http::HeaderMap& headers,
                                 const Envoy::Http::LowerCaseString& header) {
-  const auto result =
-      Envoy::Http::HeaderUtility::getAllOfHeaderAsString(headers, header);
-  if (!result.result().has_value()) {
+  // Joining the values would need storage the returned view can not point to.
+  const auto entries = headers.get(header);
+  if (entries.empty()) {
     return Envoy::EMPTY_STRING;
   }
-  return result.result().value();
+  return entries[0]->value().getStringView();
 }
 
 bool handleHttpMethodOverride(Envoy::Http::RequestHeaderMap& headers) {
-  const auto entry = headers.get(kHttpMethodOverrideHeader);
-  if (entry.empty()) {
+  const Envoy::Http::HeaderEntry* entry =
+      headers.getInline(method_override_handle.handle());
+  if (entry == nullptr) {
     return false;
   }
 
   // Override can be confusing while debugging, log it.
   absl::string_view method_original = headers.Method()->value().getStringView();
-  absl::string_view method_override = entry[0]->value().getStringView();
+  absl::string_view method_override = entry->value().getStringView();
   ENVOY_LOG_MISC(debug, "Original :method = {}, x-http-method-override = {}",
                  method_original, method_override);
 
   // Move the header.
   headers.setMethod(method_override);
-  headers.remove(kHttpMethodOverrideHeader);
+  headers.removeInline(method_override_handle.handle());
   return true;
 }
 
@@ -27,6 +27,8 @@ namespace utils {
 absl::string_view readHeaderEntry(const Envoy::Http::HeaderEntry* entry);
 
 // Returns HTTP header value if the header is found, otherwise empty string.
+// If the header is set more than once, returns its first value. The value
+// points into the header map.
 // If the header is one of inline headers, please use inline getter instead for
 // better performance.
 // For details, see
@@ -51,6 +51,20 @@ TEST(HttpHeaderUtilsTest, NoHttpMethodOverride) {
   EXPECT_EQ(headers.Method()->value().getStringView(), "POST");
 }
 
+TEST(HttpHeaderUtilsTest, ExtractHeader) {
+  const Envoy::Http::LowerCaseString header{"x-android-package"};
+  Envoy::Http::TestRequestHeaderMapImpl headers;
+  EXPECT_TRUE(extractHeader(headers, header).empty());
+
+  headers.addCopy(header, "foo");
+  headers.addCopy(header, "bar");
+  const absl::string_view value = extractHeader(headers, header);
+  EXPECT_EQ(value, "foo");
+  // The value is not copied.
+  EXPECT_EQ(value.data(),
+            headers.get(header)[0]->value().getStringView().data());
+}
+
 }  // namespace
 }  // namespace utils
 }  // namespace envoy
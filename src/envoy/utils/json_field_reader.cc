@@ -0,0 +1,495 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/json_field_reader.h"
+
+#include <climits>
+#include <cmath>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "google/protobuf/util/time_util.h"
+
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+// Like the default recursion limit of the protobuf JSON parser.
+constexpr int kMaxDepth = 100;
+
+// Appends the code point as UTF-8.
+void appendUtf8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+// Reads the 4 hex digits of a \u escape at `pos`.
+bool readHex4(absl::string_view text, size_t pos, uint32_t* value) {
+  if (pos + 4 > text.size()) {
+    return false;
+  }
+  *value = 0;
+  for (size_t i = pos; i < pos + 4; ++i) {
+    const char c = text[i];
+    if (!absl::ascii_isxdigit(c)) {
+      return false;
+    }
+    *value = *value * 16 + (absl::ascii_isdigit(c)
+                                ? c - '0'
+                                : absl::ascii_tolower(c) - 'a' + 10);
+  }
+  return true;
+}
+
+// Unescapes the text of a string, checked by the scanner, into `out`.
+bool unescape(absl::string_view text, std::string* out) {
+  out->clear();
+  out->reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '\\') {
+      out->push_back(text[i]);
+      continue;
+    }
+    ++i;
+    switch (text[i]) {
+      case '"':
+      case '\\':
+      case '/':
+        out->push_back(text[i]);
+        break;
+      case 'b':
+        out->push_back('\b');
+        break;
+      case 'f':
+        out->push_back('\f');
+        break;
+      case 'n':
+        out->push_back('\n');
+        break;
+      case 'r':
+        out->push_back('\r');
+        break;
+      case 't':
+        out->push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code_point;
+        if (!readHex4(text, i + 1, &code_point)) {
+          return false;
+        }
+        i += 4;
+        if (code_point >= 0xD800 && code_point < 0xDC00) {
+          // A high surrogate, the low one must follow.
+          uint32_t low;
+          if (i + 2 >= text.size() || text[i + 1] != '\\' ||
+              text[i + 2] != 'u' || !readHex4(text, i + 3, &low) ||
+              low < 0xDC00 || low >= 0xE000) {
+            return false;
+          }
+          i += 6;
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        } else if (code_point >= 0xDC00 && code_point < 0xE000) {
+          return false;
+        }
+        appendUtf8(code_point, out);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+// Checks the JSON grammar in one pass, and records the top level fields.
+class Scanner {
+ public:
+  using Field = JsonFieldReader::Field;
+  using Kind = JsonFieldReader::Kind;
+
+  explicit Scanner(absl::string_view json) : json_(json) {}
+
+  bool scanDocument(std::vector<std::pair<std::string, Field>>* fields) {
+    skipWhitespace();
+    if (!scanObject(0, fields)) {
+      return false;
+    }
+    skipWhitespace();
+    return pos_ == json_.size();
+  }
+
+ private:
+  void skipWhitespace() {
+    while (pos_ < json_.size() &&
+           (json_[pos_] == ' ' || json_[pos_] == '\t' || json_[pos_] == '\n' ||
+            json_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  bool consume(char c) {
+    if (pos_ < json_.size() && json_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  // Sets `field` if not null.
+  bool scanValue(int depth, Field* field) {
+    if (pos_ >= json_.size()) {
+      return false;
+    }
+    Field value{Kind::Other, {}, false};
+    switch (json_[pos_]) {
+      case '{':
+        if (!scanObject(depth + 1, nullptr)) {
+          return false;
+        }
+        break;
+      case '[':
+        if (!scanArray(depth + 1)) {
+          return false;
+        }
+        break;
+      case '"':
+        value.kind = Kind::String;
+        if (!scanString(&value.text, &value.escaped)) {
+          return false;
+        }
+        break;
+      case 't':
+        if (!scanLiteral("true")) {
+          return false;
+        }
+        break;
+      case 'f':
+        if (!scanLiteral("false")) {
+          return false;
+        }
+        break;
+      case 'n':
+        if (!scanLiteral("null")) {
+          return false;
+        }
+        break;
+      default:
+        value.kind = Kind::Number;
+        if (!scanNumber(&value.text)) {
+          return false;
+        }
+        break;
+    }
+    if (field != nullptr) {
+      *field = value;
+    }
+    return true;
+  }
+
+  // Records the fields if `fields` is not null.
+  bool scanObject(int depth,
+                  std::vector<std::pair<std::string, Field>>* fields) {
+    if (depth > kMaxDepth || !consume('{')) {
+      return false;
+    }
+    skipWhitespace();
+    if (consume('}')) {
+      return true;
+    }
+    while (true) {
+      skipWhitespace();
+      absl::string_view key;
+      bool key_escaped;
+      if (!scanString(&key, &key_escaped)) {
+        return false;
+      }
+      skipWhitespace();
+      if (!consume(':')) {
+        return false;
+      }
+      skipWhitespace();
+      Field field;
+      if (!scanValue(depth, fields != nullptr ? &field : nullptr)) {
+        return false;
+      }
+      if (fields != nullptr) {
+        std::string unescaped_key;
+        if (!key_escaped) {
+          unescaped_key = std::string(key);
+        } else if (!unescape(key, &unescaped_key)) {
+          return false;
+        }
+        fields->emplace_back(std::move(unescaped_key), field);
+      }
+      skipWhitespace();
+      if (consume('}')) {
+        return true;
+      }
+      if (!consume(',')) {
+        return false;
+      }
+    }
+  }
+
+  bool scanArray(int depth) {
+    if (depth > kMaxDepth || !consume('[')) {
+      return false;
+    }
+    skipWhitespace();
+    if (consume(']')) {
+      return true;
+    }
+    while (true) {
+      skipWhitespace();
+      if (!scanValue(depth, nullptr)) {
+        return false;
+      }
+      skipWhitespace();
+      if (consume(']')) {
+        return true;
+      }
+      if (!consume(',')) {
+        return false;
+      }
+    }
+  }
+
+  // Sets `text` to the string between its quotes.
+  bool scanString(absl::string_view* text, bool* escaped) {
+    if (!consume('"')) {
+      return false;
+    }
+    const size_t begin = pos_;
+    *escaped = false;
+    while (pos_ < json_.size()) {
+      const char c = json_[pos_];
+      if (c == '"') {
+        *text = json_.substr(begin, pos_ - begin);
+        ++pos_;
+        return true;
+      }
+      if (static_cast<unsigned char>(c) < 0x20) {
+        return false;
+      }
+      if (c == '\\') {
+        *escaped = true;
+        ++pos_;
+        if (pos_ >= json_.size()) {
+          return false;
+        }
+        uint32_t code_unit;
+        if (json_[pos_] == 'u') {
+          if (!readHex4(json_, pos_ + 1, &code_unit)) {
+            return false;
+          }
+          pos_ += 4;
+        } else if (absl::string_view("\"\\/bfnrt").find(json_[pos_]) ==
+                   absl::string_view::npos) {
+          return false;
+        }
+      }
+      ++pos_;
+    }
+    return false;
+  }
+
+  bool scanLiteral(absl::string_view literal) {
+    if (json_.substr(pos_, literal.size()) != literal) {
+      return false;
+    }
+    pos_ += literal.size();
+    return true;
+  }
+
+  // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+  bool scanNumber(absl::string_view* text) {
+    const size_t begin = pos_;
+    consume('-');
+    if (consume('0')) {
+      // No leading zeros.
+    } else if (!scanDigits()) {
+      return false;
+    }
+    if (consume('.') && !scanDigits()) {
+      return false;
+    }
+    if (consume('e') || consume('E')) {
+      if (!consume('+')) {
+        consume('-');
+      }
+      if (!scanDigits()) {
+        return false;
+      }
+    }
+    *text = json_.substr(begin, pos_ - begin);
+    return true;
+  }
+
+  // Scans one digit or more.
+  bool scanDigits() {
+    const size_t begin = pos_;
+    while (pos_ < json_.size() && absl::ascii_isdigit(json_[pos_])) {
+      ++pos_;
+    }
+    return pos_ > begin;
+  }
+
+  const absl::string_view json_;
+  size_t pos_ = 0;
+};
+
+}  // namespace
+
+Status JsonFieldReader::parse(absl::string_view json) {
+  fields_.clear();
+  unescaped_.clear();
+  Scanner scanner(json);
+  if (!scanner.scanDocument(&fields_)) {
+    fields_.clear();
+    return Status(StatusCode::kInvalidArgument, "Invalid JSON object");
+  }
+  return OkStatus();
+}
+
+const JsonFieldReader::Field* JsonFieldReader::find(
+    absl::string_view key) const {
+  // The last one wins, like in a Struct.
+  for (auto it = fields_.rbegin(); it != fields_.rend(); ++it) {
+    if (it->first == key) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+Status JsonFieldReader::getString(absl::string_view key,
+                                  std::string* value) const {
+  const Field* field = find(key);
+  if (field == nullptr) {
+    return Status(StatusCode::kNotFound, "Field not found");
+  }
+  if (field->kind != Kind::String) {
+    return Status(StatusCode::kInvalidArgument, "Field is not a string");
+  }
+
+  if (!field->escaped) {
+    value->assign(field->text.data(), field->text.size());
+  } else if (!unescape(field->text, value)) {
+    return Status(StatusCode::kInvalidArgument, "Field is not a valid string");
+  }
+  return OkStatus();
+}
+
+Status JsonFieldReader::getInteger(absl::string_view key, int* value) const {
+  const Field* field = find(key);
+  if (field == nullptr) {
+    return Status(StatusCode::kNotFound, "Field not found");
+  }
+  if (field->kind != Kind::Number) {
+    return Status(StatusCode::kInvalidArgument, "Field is not a number");
+  }
+
+  // Handle overflows, like JsonStruct does with the Struct double.
+  double number_value;
+  if (!absl::SimpleAtod(field->text, &number_value) ||
+      number_value < INT_MIN || number_value > INT_MAX ||
+      std::isnan(number_value)) {
+    return Status(StatusCode::kInvalidArgument, "Field overflows an integer");
+  }
+
+  // Warning: Truncates value!
+  *value = static_cast<int>(number_value);
+  return OkStatus();
+}
+
+Status JsonFieldReader::getTimestamp(
+    absl::string_view key, ::google::protobuf::Timestamp* value) const {
+  std::string str_value;
+  Status parse_status = getString(key, &str_value);
+  if (!parse_status.ok()) {
+    return parse_status;
+  }
+  return ::google::protobuf::util::TimeUtil::FromString(str_value, value)
+             ? OkStatus()
+             : Status(StatusCode::kInvalidArgument,
+                      "Field is not a Timestamp");
+}
+
+absl::optional<absl::string_view> JsonFieldReader::findString(
+    absl::string_view key) const {
+  const Field* field = find(key);
+  if (field == nullptr || field->kind != Kind::String) {
+    return absl::nullopt;
+  }
+  if (!field->escaped) {
+    return field->text;
+  }
+
+  std::string value;
+  if (!unescape(field->text, &value)) {
+    return absl::nullopt;
+  }
+  unescaped_.push_back(std::move(value));
+  return absl::string_view(unescaped_.back());
+}
+
+absl::optional<int64_t> JsonFieldReader::findInteger(
+    absl::string_view key) const {
+  const Field* field = find(key);
+  if (field == nullptr || field->kind != Kind::Number) {
+    return absl::nullopt;
+  }
+
+  // 2^63 is exact as a double, INT64_MAX is not.
+  double number_value;
+  if (!absl::SimpleAtod(field->text, &number_value) ||
+      !(number_value >= -0x1p63 && number_value < 0x1p63)) {
+    return absl::nullopt;
+  }
+  return static_cast<int64_t>(number_value);
+}
+
+absl::optional<::google::protobuf::Timestamp> JsonFieldReader::findTimestamp(
+    absl::string_view key) const {
+  const absl::optional<absl::string_view> str_value = findString(key);
+  ::google::protobuf::Timestamp value;
+  if (!str_value.has_value() ||
+      !::google::protobuf::util::TimeUtil::FromString(std::string(*str_value),
+                                                      &value)) {
+    return absl::nullopt;
+  }
+  return value;
+}
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,83 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/timestamp.pb.h"
+#include "google/protobuf/util/json_util.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+// Reads the top level fields of a small JSON object straight from its text,
+// like JsonStruct does from the Struct it was parsed to, in a single pass and
+// with no Struct. The whole text is checked to be valid JSON, as RFC 8259
+// defines it: stricter than the protobuf parser, that takes trailing commas or
+// unquoted keys. Meant for the token responses, with a few fields.
+class JsonFieldReader {
+ public:
+  // Reads `json`, which the reader views: it must outlive the reader.
+  // Returns kInvalidArgument if `json` is not a JSON object.
+  ::google::protobuf::util::Status parse(absl::string_view json);
+
+  ::google::protobuf::util::Status getString(absl::string_view key,
+                                             std::string* value) const;
+
+  ::google::protobuf::util::Status getInteger(absl::string_view key,
+                                              int* value) const;
+
+  ::google::protobuf::util::Status getTimestamp(
+      absl::string_view key, ::google::protobuf::Timestamp* value) const;
+
+  // Like the getters, for callers that only need to know whether the field
+  // could be read: nothing is allocated for a missing or mistyped field, and
+  // a string with no escapes is returned as a view of the JSON text. An
+  // escaped one is unescaped into the reader. The views are valid until the
+  // next parse().
+  absl::optional<absl::string_view> findString(absl::string_view key) const;
+  // Truncates like getInteger(), with no overflow below the int64_t range.
+  absl::optional<int64_t> findInteger(absl::string_view key) const;
+  absl::optional<::google::protobuf::Timestamp> findTimestamp(
+      absl::string_view key) const;
+
+  enum class Kind { String, Number, Other };
+  struct Field {
+    Kind kind;
+    // A string between its quotes, still escaped, or a number.
+    absl::string_view text;
+    bool escaped;
+  };
+
+ private:
+  // Returns the last field of the key, or nullptr.
+  const Field* find(absl::string_view key) const;
+
+  // The unescaped keys, in order.
+  std::vector<std::pair<std::string, Field>> fields_;
+  // The strings findString() unescaped. A deque does not move them.
+  mutable std::deque<std::string> unescaped_;
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,205 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/json_field_reader.h"
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/struct.pb.h"
+#include "gtest/gtest.h"
+
+using ::google::protobuf::util::StatusCode;
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+TEST(JsonFieldReaderTest, GetString) {
+  JsonFieldReader reader;
+  ASSERT_TRUE(reader
+                  .parse(R"(
+  {
+    "good_string": "good",
+    "empty_string": "",
+    "escaped_string": "a\"b\\c\/\né😀",
+    "bad_string": 28657
+  }
+  )")
+                  .ok());
+
+  std::string value;
+  EXPECT_TRUE(reader.getString("good_string", &value).ok());
+  EXPECT_EQ(value, "good");
+  EXPECT_TRUE(reader.getString("empty_string", &value).ok());
+  EXPECT_TRUE(value.empty());
+  EXPECT_TRUE(reader.getString("escaped_string", &value).ok());
+  EXPECT_EQ(value, "a\"b\\c/\n\xc3\xa9\xf0\x9f\x98\x80");
+
+  EXPECT_EQ(reader.getString("bad_string", &value).code(),
+            StatusCode::kInvalidArgument);
+  EXPECT_EQ(reader.getString("missing_string", &value).code(),
+            StatusCode::kNotFound);
+}
+
+TEST(JsonFieldReaderTest, GetInteger) {
+  JsonFieldReader reader;
+  ASSERT_TRUE(reader
+                  .parse(R"({
+    "good_int": 3600,
+    "negative_int": -12,
+    "float": 2.5e1,
+    "overflow": 1e20,
+    "bad_int": "3600",
+    "nested": {"good_int": 1}
+  })")
+                  .ok());
+
+  int value;
+  EXPECT_TRUE(reader.getInteger("good_int", &value).ok());
+  EXPECT_EQ(value, 3600);
+  EXPECT_TRUE(reader.getInteger("negative_int", &value).ok());
+  EXPECT_EQ(value, -12);
+  EXPECT_TRUE(reader.getInteger("float", &value).ok());
+  EXPECT_EQ(value, 25);
+
+  EXPECT_EQ(reader.getInteger("overflow", &value).code(),
+            StatusCode::kInvalidArgument);
+  EXPECT_EQ(reader.getInteger("bad_int", &value).code(),
+            StatusCode::kInvalidArgument);
+  EXPECT_EQ(reader.getInteger("nested", &value).code(),
+            StatusCode::kInvalidArgument);
+  EXPECT_EQ(reader.getInteger("missing_int", &value).code(),
+            StatusCode::kNotFound);
+}
+
+TEST(JsonFieldReaderTest, GetTimestamp) {
+  JsonFieldReader reader;
+  ASSERT_TRUE(reader
+                  .parse(R"({
+    "good": "2111-02-20T23:15:34-08:00",
+    "bad": "1999-34-08:00"
+  })")
+                  .ok());
+
+  ::google::protobuf::Timestamp value;
+  EXPECT_TRUE(reader.getTimestamp("good", &value).ok());
+  EXPECT_EQ(reader.getTimestamp("bad", &value).code(),
+            StatusCode::kInvalidArgument);
+}
+
+TEST(JsonFieldReaderTest, FindFields) {
+  const std::string json = R"({
+    "string": "good",
+    "escaped": "a\/b",
+    "int": 3600,
+    "float": -2.5e1,
+    "overflow": 1e19,
+    "time": "2111-02-20T23:15:34-08:00"
+  })";
+  JsonFieldReader reader;
+  ASSERT_TRUE(reader.parse(json).ok());
+
+  // An unescaped string views the JSON text.
+  const absl::optional<absl::string_view> value = reader.findString("string");
+  ASSERT_TRUE(value.has_value());
+  EXPECT_EQ(*value, "good");
+  EXPECT_GE(value->data(), json.data());
+  EXPECT_LT(value->data(), json.data() + json.size());
+  EXPECT_EQ(reader.findString("escaped"), "a/b");
+  EXPECT_EQ(reader.findString("int"), absl::nullopt);
+  EXPECT_EQ(reader.findString("missing"), absl::nullopt);
+
+  EXPECT_EQ(reader.findInteger("int"), 3600);
+  EXPECT_EQ(reader.findInteger("float"), -25);
+  EXPECT_EQ(reader.findInteger("overflow"), absl::nullopt);
+  EXPECT_EQ(reader.findInteger("string"), absl::nullopt);
+
+  EXPECT_TRUE(reader.findTimestamp("time").has_value());
+  EXPECT_FALSE(reader.findTimestamp("string").has_value());
+}
+
+TEST(JsonFieldReaderTest, LastDuplicateWins) {
+  JsonFieldReader reader;
+  ASSERT_TRUE(reader.parse(R"({"token": "old", "token": "new"})").ok());
+
+  std::string value;
+  EXPECT_TRUE(reader.getString("token", &value).ok());
+  EXPECT_EQ(value, "new");
+}
+
+TEST(JsonFieldReaderTest, ValidJson) {
+  const std::vector<std::string> documents = {
+      R"({})",
+      R"( { "a" : [1, -0.5e+3, true, false, null, {"b": []}] } )",
+      R"({"a": "\u00e9\ud83d\ude00"})",
+      "{\"a\":\t1\r\n}",
+  };
+
+  for (const std::string& document : documents) {
+    JsonFieldReader reader;
+    EXPECT_TRUE(reader.parse(document).ok()) << document;
+    ::google::protobuf::Struct struct_pb;
+    EXPECT_TRUE(
+        ::google::protobuf::util::JsonStringToMessage(document, &struct_pb)
+            .ok())
+        << document;
+  }
+}
+
+// Stricter than the protobuf parser, which takes some of these.
+TEST(JsonFieldReaderTest, InvalidJson) {
+  const std::vector<std::string> documents = {
+      "",
+      "[]",
+      "\"a\"",
+      R"({"a": 1,})",
+      R"({"a" 1})",
+      R"({"a": 01})",
+      R"({"a": 1.})",
+      R"({"a": .5})",
+      R"({"a": +1})",
+      R"({"a": tru})",
+      R"({"a": "\x"})",
+      R"({"a": "\u00g0"})",
+      "{\"a\": \"\n\"}",
+      R"({"a": 1} {})",
+      R"({"a": [1 2]})",
+      R"({"a": "b)",
+      R"({a: 1})",
+  };
+
+  for (const std::string& document : documents) {
+    JsonFieldReader reader;
+    EXPECT_EQ(reader.parse(document).code(), StatusCode::kInvalidArgument)
+        << document;
+  }
+}
+
+TEST(JsonFieldReaderTest, NestingLimited) {
+  JsonFieldReader reader;
+  EXPECT_TRUE(reader
+                  .parse(absl::StrCat("{\"a\":", std::string(50, '['),
+                                      std::string(50, ']'), "}"))
+                  .ok());
+  EXPECT_FALSE(reader
+                   .parse(absl::StrCat("{\"a\":", std::string(1000, '['),
+                                       std::string(1000, ']'), "}"))
+                   .ok());
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -68,6 +68,31 @@ Status JsonStruct::getInteger(const std::string& key, int* value) {
   return OkStatus();
 }
 
+absl::optional<absl::string_view> JsonStruct::findString(
+    const std::string& key) const {
+  const auto& fields = struct_.fields();
+  const auto it = fields.find(key);
+  if (it == fields.end() || it->second.kind_case() != Value::kStringValue) {
+    return absl::nullopt;
+  }
+  return absl::string_view(it->second.string_value());
+}
+
+absl::optional<int64_t> JsonStruct::findInteger(const std::string& key) const {
+  const auto& fields = struct_.fields();
+  const auto it = fields.find(key);
+  if (it == fields.end() || it->second.kind_case() != Value::kNumberValue) {
+    return absl::nullopt;
+  }
+
+  // 2^63 is exact as a double, INT64_MAX is not.
+  const double number_value = it->second.number_value();
+  if (!(number_value >= -0x1p63 && number_value < 0x1p63)) {
+    return absl::nullopt;
+  }
+  return static_cast<int64_t>(number_value);
+}
+
 Status JsonStruct::getTimestamp(const std::string& key,
                                 ::google::protobuf::Timestamp* value) {
   std::string strValue;
@@ -14,6 +14,10 @@
 
 #pragma once
 
+#include <cstdint>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "google/protobuf/struct.pb.h"
 #include "google/protobuf/timestamp.pb.h"
 #include "google/protobuf/util/json_util.h"
@@ -40,6 +44,12 @@ class JsonStruct {
   ::google::protobuf::util::Status getTimestamp(
       const std::string& key, ::google::protobuf::Timestamp* value);
 
+  // Non-allocating lookups: absl::nullopt if the field is missing or is not
+  // of the type. The string view is of the Struct.
+  absl::optional<absl::string_view> findString(const std::string& key) const;
+  // Truncates like getInteger(), with no overflow below the int64_t range.
+  absl::optional<int64_t> findInteger(const std::string& key) const;
+
  private:
   const ::google::protobuf::Struct& struct_;
 };
@@ -15,6 +15,7 @@
 #include "json_struct.h"
 #include "test/fuzz/fuzz_runner.h"
 #include "test/fuzz/utility.h"
+#include "tests/fuzz/fuzz_time_limit.h"
 #include "tests/fuzz/structured_inputs/json_struct.pb.validate.h"
 
 namespace espv2 {
@@ -30,6 +31,7 @@ DEFINE_PROTO_FUZZER(const espv2::tests::fuzz::protos::JsonStructInput& input) {
 
   try {
     Envoy::TestUtility::validate(input);
+    espv2::tests::fuzz::FuzzTimeLimit time_limit("JsonStruct");
 
     JsonStruct json_struct(input.pb_struct());
 
@@ -100,6 +100,34 @@ TEST(JsonStructTest, GetInt) {
             StatusCode::kNotFound);
 }
 
+TEST(JsonStructTest, FindStringAndInteger) {
+  ::google::protobuf::util::JsonParseOptions options;
+  ::google::protobuf::Struct struct_pb;
+
+  const std::string struct_json = R"(
+  {
+    "string": "good",
+    "int": 377,
+    "float_number": -1.57,
+    "overflow": 1e19
+  }
+  )";
+  ASSERT_TRUE(::google::protobuf::util::JsonStringToMessage(struct_json,
+                                                            &struct_pb, options)
+                  .ok());
+  const JsonStruct json_struct(struct_pb);
+
+  EXPECT_EQ(json_struct.findString("string"), "good");
+  EXPECT_EQ(json_struct.findString("int"), absl::nullopt);
+  EXPECT_EQ(json_struct.findString("missing"), absl::nullopt);
+
+  EXPECT_EQ(json_struct.findInteger("int"), 377);
+  EXPECT_EQ(json_struct.findInteger("float_number"), -1);
+  EXPECT_EQ(json_struct.findInteger("string"), absl::nullopt);
+  EXPECT_EQ(json_struct.findInteger("overflow"), absl::nullopt);
+  EXPECT_EQ(json_struct.findInteger("missing"), absl::nullopt);
+}
+
 }  // namespace
 }  // namespace utils
 }  // namespace envoy
@@ -0,0 +1,67 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/local_counters.h"
+
+#include <utility>
+
+#include "source/common/common/assert.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+LocalCounters::LocalCounters(
+    const ::espv2::api::envoy::v10::http::common::LocalCountersConfig& config,
+    const std::vector<Envoy::Stats::Counter*>& stats,
+    Envoy::ThreadLocal::SlotAllocator& tls) {
+  if (config.flush_interval_ms() == 0) {
+    return;
+  }
+  ASSERT(stats.size() <= kMaxCounters);
+  auto shared_stats =
+      std::make_shared<std::vector<Envoy::Stats::CounterSharedPtr>>();
+  for (Envoy::Stats::Counter* stat : stats) {
+    stats_[size_++] = stat;
+    shared_stats->emplace_back(stat);
+  }
+
+  const std::chrono::milliseconds flush_interval(config.flush_interval_ms());
+  tls_ = std::make_unique<Envoy::ThreadLocal::TypedSlot<Slots>>(tls);
+  tls_->set([stats = StatsSharedPtr(std::move(shared_stats)),
+             flush_interval](Envoy::Event::Dispatcher& dispatcher) {
+    return std::make_shared<Slots>(stats, flush_interval, dispatcher);
+  });
+}
+
+LocalCounters::Slots::Slots(StatsSharedPtr shared_stats,
+                            std::chrono::milliseconds interval,
+                            Envoy::Event::Dispatcher& dispatcher)
+    : stats(std::move(shared_stats)),
+      flush_interval(interval),
+      timer(dispatcher.createTimer([this]() { flush(); })) {}
+
+void LocalCounters::Slots::flush() {
+  for (size_t i = 0; i < stats->size(); ++i) {
+    if (counts[i] > 0) {
+      (*stats)[i]->add(counts[i]);
+      counts[i] = 0;
+    }
+  }
+  pending = false;
+}
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,104 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "api/envoy/v10/http/common/base.pb.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/stats/stats.h"
+#include "envoy/thread_local/thread_local.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+// The counters of a filter that most requests increment, counted by each
+// worker in slots of its own, so the workers don't contend on the cache
+// lines of the shared stats. A worker adds its counts to the stats once per
+// flush interval, when it counted any, and when the counters are destroyed.
+// Owned by the filter config, created on the main thread.
+class LocalCounters {
+ public:
+  // The most counters of a filter.
+  static constexpr size_t kMaxCounters = 4;
+
+  // Increments the stats themselves.
+  LocalCounters() = default;
+
+  // Counts the stats on the workers if the config sets a flush interval.
+  LocalCounters(
+      const ::espv2::api::envoy::v10::http::common::LocalCountersConfig&
+          config,
+      const std::vector<Envoy::Stats::Counter*>& stats,
+      Envoy::ThreadLocal::SlotAllocator& tls);
+
+  // Increments the stat, in the slot of the worker if it is one of the local
+  // counters. Only called on the workers.
+  void inc(Envoy::Stats::Counter& stat) {
+    if (tls_ != nullptr) {
+      for (size_t i = 0; i < size_; ++i) {
+        if (stats_[i] == &stat) {
+          (*tls_)->inc(i);
+          return;
+        }
+      }
+    }
+    stat.inc();
+  }
+
+ private:
+  using StatsSharedPtr =
+      std::shared_ptr<const std::vector<Envoy::Stats::CounterSharedPtr>>;
+
+  // The counts of a worker, padded to their own cache lines.
+  struct alignas(64) Slots : public Envoy::ThreadLocal::ThreadLocalObject {
+    Slots(StatsSharedPtr shared_stats, std::chrono::milliseconds interval,
+          Envoy::Event::Dispatcher& dispatcher);
+    ~Slots() override { flush(); }
+
+    void inc(size_t index) {
+      ++counts[index];
+      if (!pending) {
+        pending = true;
+        timer->enableTimer(flush_interval);
+      }
+    }
+    void flush();
+
+    std::array<uint64_t, kMaxCounters> counts{};
+    // Whether a flush is scheduled.
+    bool pending = false;
+    // Kept by the workers, which may release their slots after the filter
+    // config.
+    const StatsSharedPtr stats;
+    const std::chrono::milliseconds flush_interval;
+    Envoy::Event::TimerPtr timer;
+  };
+
+  std::array<Envoy::Stats::Counter*, kMaxCounters> stats_{};
+  size_t size_ = 0;
+  // Not set if the stats are incremented themselves.
+  std::unique_ptr<Envoy::ThreadLocal::TypedSlot<Slots>> tls_;
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,76 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/local_counters.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/stats/mocks.h"
+#include "test/mocks/thread_local/mocks.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+using ::espv2::api::envoy::v10::http::common::LocalCountersConfig;
+using ::testing::NiceMock;
+
+class LocalCountersTest : public ::testing::Test {
+ protected:
+  NiceMock<Envoy::ThreadLocal::MockInstance> tls_;
+  NiceMock<Envoy::Stats::MockIsolatedStatsStore> store_;
+  Envoy::Stats::Counter& hot_ = store_.counterFromString("hot");
+  Envoy::Stats::Counter& other_ = store_.counterFromString("other");
+};
+
+TEST_F(LocalCountersTest, StatsIncrementedIfDisabled) {
+  LocalCounters counters(LocalCountersConfig(), {&hot_}, tls_);
+  counters.inc(hot_);
+  EXPECT_EQ(hot_.value(), 1);
+
+  LocalCounters defaults;
+  defaults.inc(hot_);
+  EXPECT_EQ(hot_.value(), 2);
+}
+
+TEST_F(LocalCountersTest, FlushedEveryInterval) {
+  auto* timer = new NiceMock<Envoy::Event::MockTimer>(&tls_.dispatcher_);
+  LocalCountersConfig config;
+  config.set_flush_interval_ms(1000);
+  LocalCounters counters(config, {&hot_}, tls_);
+
+  // The timer is only enabled once counted.
+  EXPECT_FALSE(timer->enabled());
+  counters.inc(hot_);
+  counters.inc(hot_);
+  EXPECT_EQ(hot_.value(), 0);
+  EXPECT_TRUE(timer->enabled());
+
+  // The other stats are incremented themselves.
+  counters.inc(other_);
+  EXPECT_EQ(other_.value(), 1);
+
+  timer->invokeCallback();
+  EXPECT_EQ(hot_.value(), 2);
+  EXPECT_FALSE(timer->enabled());
+  counters.inc(hot_);
+  EXPECT_TRUE(timer->enabled());
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -20,10 +20,10 @@ namespace espv2 {
 namespace envoy {
 namespace utils {
 
-std::string generateRcDetails(const std::string& filter_name,
-                              const std::string& error_type,
-                              const std::string& error_detail) {
-  if (error_detail.length() > 0) {
+std::string generateRcDetails(absl::string_view filter_name,
+                              absl::string_view error_type,
+                              absl::string_view error_detail) {
+  if (!error_detail.empty()) {
     return absl::StrCat(filter_name, "_", error_type, "{", error_detail, "}");
   }
   return absl::StrCat(filter_name, "_", error_type);
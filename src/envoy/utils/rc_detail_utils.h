@@ -16,6 +16,7 @@
 #include <string>
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 
 namespace espv2 {
 namespace envoy {
@@ -43,16 +44,38 @@ const char kRcDetailErrorTypeWrongRouteConfig[] = "wrong_route_config";
 
 // The detailed errors.
 const char kRcDetailErrorMissingApiKey[] = "MISSING_API_KEY";
+const char kRcDetailErrorMalformedApiKey[] = "MALFORMED_API_KEY";
 const char kRcDetailErrorMissingMethod[] = "MISSING_METHOD";
 const char kRcDetailErrorMissingPath[] = "MISSING_PATH";
 const char kRcDetailErrorOversizePath[] = "OVERSIZE_PATH";
 const char kRcDetailErrorFragmentIdentifier[] = "PATH_WITH_FRAGMENT_IDENTIFIER";
 
+// The response code details with no dynamic part, spelled out so that
+// rejections don't build them. rc_detail_utils_test checks each equals the
+// generateRcDetails() of its parts.
+constexpr absl::string_view kRcDetailsServiceControlMissingApiKey =
+    "service_control_bad_request{MISSING_API_KEY}";
+constexpr absl::string_view kRcDetailsServiceControlMalformedApiKey =
+    "service_control_bad_request{MALFORMED_API_KEY}";
+constexpr absl::string_view kRcDetailsServiceControlMissingMethod =
+    "service_control_bad_request{MISSING_METHOD}";
+constexpr absl::string_view kRcDetailsServiceControlMissingPath =
+    "service_control_bad_request{MISSING_PATH}";
+constexpr absl::string_view kRcDetailsBackendAuthMissingBackendToken =
+    "backend_auth_missing_backend_token";
+constexpr absl::string_view kRcDetailsPathRewriteMissingPath =
+    "path_rewrite_bad_request{MISSING_PATH}";
+constexpr absl::string_view kRcDetailsPathRewriteOversizePath =
+    "path_rewrite_bad_request{OVERSIZE_PATH}";
+constexpr absl::string_view kRcDetailsPathRewriteFragmentIdentifier =
+    "path_rewrite_bad_request{PATH_WITH_FRAGMENT_IDENTIFIER}";
+
 // Generate a string for response code details in format of
-// `filter_name`_`error_type`_{`error_detail`}.
-std::string generateRcDetails(const std::string& filter_name,
-                              const std::string& error_type,
-                              const std::string& error_detail = "");
+// `filter_name`_`error_type`_{`error_detail`}. Only needed for the ones with
+// a dynamic part, such as an error name or a path.
+std::string generateRcDetails(absl::string_view filter_name,
+                              absl::string_view error_type,
+                              absl::string_view error_detail = "");
 
 }  // namespace utils
 }  // namespace envoy
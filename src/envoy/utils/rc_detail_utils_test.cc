@@ -18,6 +18,40 @@ TEST(GenerateRcDetailTest, WithoutDetail) {
             "filter_name_error_type");
 }
 
+TEST(GenerateRcDetailTest, StaticRcDetails) {
+  EXPECT_EQ(kRcDetailsServiceControlMissingApiKey,
+            generateRcDetails(kRcDetailFilterServiceControl,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorMissingApiKey));
+  EXPECT_EQ(kRcDetailsServiceControlMalformedApiKey,
+            generateRcDetails(kRcDetailFilterServiceControl,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorMalformedApiKey));
+  EXPECT_EQ(kRcDetailsServiceControlMissingMethod,
+            generateRcDetails(kRcDetailFilterServiceControl,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorMissingMethod));
+  EXPECT_EQ(kRcDetailsServiceControlMissingPath,
+            generateRcDetails(kRcDetailFilterServiceControl,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorMissingPath));
+  EXPECT_EQ(kRcDetailsBackendAuthMissingBackendToken,
+            generateRcDetails(kRcDetailFilterBackendAuth,
+                              kRcDetailErrorTypeMissingBackendToken));
+  EXPECT_EQ(kRcDetailsPathRewriteMissingPath,
+            generateRcDetails(kRcDetailFilterPathRewrite,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorMissingPath));
+  EXPECT_EQ(kRcDetailsPathRewriteOversizePath,
+            generateRcDetails(kRcDetailFilterPathRewrite,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorOversizePath));
+  EXPECT_EQ(kRcDetailsPathRewriteFragmentIdentifier,
+            generateRcDetails(kRcDetailFilterPathRewrite,
+                              kRcDetailErrorTypeBadRequest,
+                              kRcDetailErrorFragmentIdentifier));
+}
+
 }  // namespace
 }  // namespace utils
 }  // namespace envoy
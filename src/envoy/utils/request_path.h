@@ -0,0 +1,63 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+
+#include "absl/strings/string_view.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+// A request path with the positions the filter and the rewrite need, found in
+// a single scan of the path.
+struct RequestPath {
+  // Scans the path for its query string and any fragment identifier.
+  static RequestPath scan(absl::string_view path) {
+    RequestPath request_path;
+    request_path.path = path;
+    const size_t pos = path.find_first_of("?#");
+    if (pos != absl::string_view::npos && path[pos] == '?') {
+      request_path.query_pos = pos;
+      request_path.has_fragment =
+          path.find('#', pos + 1) != absl::string_view::npos;
+    } else {
+      request_path.has_fragment = pos != absl::string_view::npos;
+    }
+    return request_path;
+  }
+
+  // The path without its query string.
+  absl::string_view pathWithoutQuery() const {
+    return path.substr(0, query_pos);
+  }
+  // The query string with its leading '?', or empty.
+  absl::string_view query() const {
+    return query_pos == absl::string_view::npos ? absl::string_view()
+                                                : path.substr(query_pos);
+  }
+
+  // The whole path, query string included.
+  absl::string_view path;
+  // The position of the '?' of the query string, npos if there is none.
+  size_t query_pos = absl::string_view::npos;
+  // Whether the path has a '#' anywhere.
+  bool has_fragment = false;
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
@@ -0,0 +1,34 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/string_interner.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+uint32_t StringInterner::intern(absl::string_view value) {
+  absl::MutexLock lock(&mutex_);
+  const auto it = ids_.find(value);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  const uint32_t id = ids_.size();
+  ids_.emplace(std::string(value), id);
+  return id;
+}
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
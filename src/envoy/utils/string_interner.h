@@ -0,0 +1,43 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+
+// Gives each distinct string a dense id, never reused, so configs built and
+// updated apart agree on the id of a string. Thread safe; only meant to be
+// used when configs are built, the strings are kept for the process.
+class StringInterner {
+ public:
+  // Returns the id of the string, the next unused one for a new string.
+  uint32_t intern(absl::string_view value);
+
+ private:
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, uint32_t> ids_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
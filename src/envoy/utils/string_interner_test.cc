@@ -0,0 +1,44 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/envoy/utils/string_interner.h"
+
+#include "gtest/gtest.h"
+
+namespace espv2 {
+namespace envoy {
+namespace utils {
+namespace {
+
+TEST(StringInternerTest, DenseIdsPerString) {
+  StringInterner interner;
+  EXPECT_EQ(interner.intern("a"), 0);
+  EXPECT_EQ(interner.intern("b"), 1);
+  EXPECT_EQ(interner.intern("a"), 0);
+  EXPECT_EQ(interner.intern(""), 2);
+  EXPECT_EQ(interner.intern("b"), 1);
+}
+
+TEST(StringInternerTest, InternersApart) {
+  StringInterner first;
+  StringInterner second;
+  EXPECT_EQ(first.intern("a"), 0);
+  EXPECT_EQ(second.intern("b"), 0);
+  EXPECT_EQ(second.intern("a"), 1);
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace envoy
+}  // namespace espv2
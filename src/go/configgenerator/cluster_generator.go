@@ -26,6 +26,7 @@ import (
 	sc "github.com/GoogleCloudPlatform/esp-v2/src/go/configinfo"
 	clusterpb "github.com/envoyproxy/go-control-plane/envoy/config/cluster/v3"
 	corepb "github.com/envoyproxy/go-control-plane/envoy/config/core/v3"
+	wrapperspb "github.com/golang/protobuf/ptypes/wrappers"
 )
 
 // MakeClusters provides dynamic cluster settings for Envoy
@@ -310,7 +311,13 @@ func makeServiceControlCluster(serviceInfo *sc.ServiceInfo) (*clusterpb.Cluster,
 		return nil, fmt.Errorf("error parsing service control URI: should not have path part: %s, %s", uri, path)
 	}
 
-	connectTimeoutProto := ptypes.DurationProto(5 * time.Second)
+	opts := &serviceInfo.Options
+	if !opts.ScEnableHttp2 && (opts.ScMaxConcurrentStreams > 0 || opts.ScKeepaliveInterval > 0) {
+		return nil, fmt.Errorf("service_control_max_concurrent_streams and service_control_keepalive_interval_ms require service_control_enable_http2")
+	}
+
+	connectTimeout := 5 * time.Second
+	connectTimeoutProto := ptypes.DurationProto(connectTimeout)
 	serviceInfo.ServiceControlURI = scheme + "://" + hostname + "/v1/services"
 	c := &clusterpb.Cluster{
 		Name:                 util.ServiceControlClusterName,
@@ -322,7 +329,11 @@ func makeServiceControlCluster(serviceInfo *sc.ServiceInfo) (*clusterpb.Cluster,
 	}
 
 	if scheme == "https" {
-		transportSocket, err := util.CreateUpstreamTransportSocket(hostname, serviceInfo.Options.SslSidestreamClientRootCertsPath, "", nil, "")
+		var alpnProtocols []string
+		if opts.ScEnableHttp2 {
+			alpnProtocols = []string{"h2"}
+		}
+		transportSocket, err := util.CreateUpstreamTransportSocket(hostname, serviceInfo.Options.SslSidestreamClientRootCertsPath, "", alpnProtocols, "")
 		if err != nil {
 			return nil, fmt.Errorf("error marshaling tls context to transport_socket config for cluster %s, err=%v",
 				c.Name, err)
@@ -330,6 +341,21 @@ func makeServiceControlCluster(serviceInfo *sc.ServiceInfo) (*clusterpb.Cluster,
 		c.TransportSocket = transportSocket
 	}
 
+	if opts.ScEnableHttp2 {
+		c.Http2ProtocolOptions = &corepb.Http2ProtocolOptions{}
+		if opts.ScMaxConcurrentStreams > 0 {
+			c.Http2ProtocolOptions.MaxConcurrentStreams = &wrapperspb.UInt32Value{Value: uint32(opts.ScMaxConcurrentStreams)}
+		}
+		if opts.ScKeepaliveInterval > 0 {
+			// A connection with an unanswered PING is closed after the same time
+			// it may take to open a new one.
+			c.Http2ProtocolOptions.ConnectionKeepalive = &corepb.KeepaliveSettings{
+				Interval: ptypes.DurationProto(opts.ScKeepaliveInterval),
+				Timeout:  ptypes.DurationProto(connectTimeout),
+			}
+		}
+	}
+
 	return c, nil
 }
 
@@ -29,6 +29,7 @@ import (
 
 	clusterpb "github.com/envoyproxy/go-control-plane/envoy/config/cluster/v3"
 	corepb "github.com/envoyproxy/go-control-plane/envoy/config/core/v3"
+	wrapperspb "github.com/golang/protobuf/ptypes/wrappers"
 	annotationspb "google.golang.org/genproto/googleapis/api/annotations"
 	confpb "google.golang.org/genproto/googleapis/api/serviceconfig"
 	apipb "google.golang.org/genproto/protobuf/api"
@@ -57,6 +58,10 @@ func TestMakeServiceControlCluster(t *testing.T) {
 		fakeServiceConfig *confpb.Service
 		wantedCluster     clusterpb.Cluster
 		BackendAddress    string
+		enableHttp2       bool
+		maxStreams        uint
+		keepalive         time.Duration
+		wantedError       string
 	}{
 		{
 			desc: "Success for gRPC backend",
@@ -118,18 +123,77 @@ func TestMakeServiceControlCluster(t *testing.T) {
 				LoadAssignment:       util.CreateLoadAssignment("127.0.0.1", 8000),
 			},
 		},
+		{
+			desc: "Success for HTTP/2 with keepalive",
+			fakeServiceConfig: &confpb.Service{
+				Name: testProjectName,
+				Apis: []*apipb.Api{
+					{
+						Name: testApiName,
+					},
+				},
+				Control: &confpb.Control{
+					Environment: testServiceControlEnv,
+				},
+			},
+			BackendAddress: "grpc://127.0.0.1:80",
+			enableHttp2:    true,
+			maxStreams:     100,
+			keepalive:      30 * time.Second,
+			wantedCluster: clusterpb.Cluster{
+				Name:                 "service-control-cluster",
+				ConnectTimeout:       ptypes.DurationProto(5 * time.Second),
+				ClusterDiscoveryType: &clusterpb.Cluster_Type{Type: clusterpb.Cluster_LOGICAL_DNS},
+				DnsLookupFamily:      clusterpb.Cluster_V4_ONLY,
+				LoadAssignment:       util.CreateLoadAssignment(testServiceControlEnv, 443),
+				TransportSocket:      createH2TransportSocket("servicecontrol.googleapis.com"),
+				Http2ProtocolOptions: &corepb.Http2ProtocolOptions{
+					MaxConcurrentStreams: &wrapperspb.UInt32Value{Value: 100},
+					ConnectionKeepalive: &corepb.KeepaliveSettings{
+						Interval: ptypes.DurationProto(30 * time.Second),
+						Timeout:  ptypes.DurationProto(5 * time.Second),
+					},
+				},
+			},
+		},
+		{
+			desc: "Fail for keepalive without HTTP/2",
+			fakeServiceConfig: &confpb.Service{
+				Name: testProjectName,
+				Apis: []*apipb.Api{
+					{
+						Name: testApiName,
+					},
+				},
+				Control: &confpb.Control{
+					Environment: testServiceControlEnv,
+				},
+			},
+			BackendAddress: "grpc://127.0.0.1:80",
+			keepalive:      30 * time.Second,
+			wantedError:    "service_control_max_concurrent_streams and service_control_keepalive_interval_ms require service_control_enable_http2",
+		},
 	}
 
 	for i, tc := range testData {
 		t.Run(tc.desc, func(t *testing.T) {
 			opts := options.DefaultConfigGeneratorOptions()
 			opts.BackendAddress = tc.BackendAddress
+			opts.ScEnableHttp2 = tc.enableHttp2
+			opts.ScMaxConcurrentStreams = tc.maxStreams
+			opts.ScKeepaliveInterval = tc.keepalive
 			fakeServiceInfo, err := configinfo.NewServiceInfoFromServiceConfig(tc.fakeServiceConfig, testConfigID, opts)
 			if err != nil {
 				t.Fatal(err)
 			}
 
 			cluster, err := makeServiceControlCluster(fakeServiceInfo)
+			if tc.wantedError != "" {
+				if err == nil || err.Error() != tc.wantedError {
+					t.Errorf("Test Desc(%d): %s, makeServiceControlCluster got error: %v, want: %v", i, tc.desc, err, tc.wantedError)
+				}
+				return
+			}
 			if err != nil {
 				t.Fatal(err)
 			}
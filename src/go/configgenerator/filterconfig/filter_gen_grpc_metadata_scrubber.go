@@ -0,0 +1,65 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package filterconfig
+
+import (
+	"fmt"
+
+	ci "github.com/GoogleCloudPlatform/esp-v2/src/go/configinfo"
+	gmspb "github.com/GoogleCloudPlatform/esp-v2/src/go/proto/api/envoy/v10/http/grpc_metadata_scrubber"
+	"github.com/GoogleCloudPlatform/esp-v2/src/go/util"
+	"github.com/GoogleCloudPlatform/esp-v2/src/go/util/httppattern"
+	hcmpb "github.com/envoyproxy/go-control-plane/envoy/extensions/filters/network/http_connection_manager/v3"
+	"github.com/golang/protobuf/ptypes"
+	anypb "github.com/golang/protobuf/ptypes/any"
+)
+
+// Only the methods of httpOnlyMethods get this per route config.
+var gmsPerRouteFilterConfigGen = func(method *ci.MethodInfo, httpRule *httppattern.Pattern) (*anypb.Any, error) {
+	gmsPerRoute := &gmspb.PerRouteFilterConfig{
+		HttpOnly: true,
+	}
+	gmspr, err := ptypes.MarshalAny(gmsPerRoute)
+	if err != nil {
+		return nil, fmt.Errorf("error marshaling grpc_metadata_scrubber per-route config to Any: %v", err)
+	}
+	return gmspr, nil
+}
+
+var gmsFilterGenFunc = func(serviceInfo *ci.ServiceInfo) (*hcmpb.HttpFilter, []*ci.MethodInfo, error) {
+	return &hcmpb.HttpFilter{
+		Name: util.GrpcMetadataScrubber,
+	}, httpOnlyMethods(serviceInfo), nil
+}
+
+// httpOnlyMethods returns the methods whose backend speaks HTTP/1.1. gRPC
+// needs HTTP/2, so the responses of these methods are never gRPC ones.
+func httpOnlyMethods(serviceInfo *ci.ServiceInfo) []*ci.MethodInfo {
+	clusterProtocols := make(map[string]util.BackendProtocol)
+	if serviceInfo.LocalBackendCluster != nil {
+		clusterProtocols[serviceInfo.LocalBackendCluster.ClusterName] = serviceInfo.LocalBackendCluster.Protocol
+	}
+	for _, cluster := range serviceInfo.RemoteBackendClusters {
+		clusterProtocols[cluster.ClusterName] = cluster.Protocol
+	}
+
+	var methods []*ci.MethodInfo
+	for _, method := range serviceInfo.Methods {
+		if method.BackendInfo != nil && clusterProtocols[method.BackendInfo.ClusterName] == util.HTTP1 {
+			methods = append(methods, method)
+		}
+	}
+	return methods
+}
@@ -0,0 +1,137 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package filterconfig
+
+import (
+	"reflect"
+	"sort"
+	"testing"
+
+	"github.com/GoogleCloudPlatform/esp-v2/src/go/configinfo"
+	"github.com/GoogleCloudPlatform/esp-v2/src/go/options"
+	"github.com/GoogleCloudPlatform/esp-v2/src/go/util"
+	"github.com/golang/protobuf/jsonpb"
+
+	confpb "google.golang.org/genproto/googleapis/api/serviceconfig"
+	apipb "google.golang.org/genproto/protobuf/api"
+)
+
+func TestGrpcMetadataScrubberFilter(t *testing.T) {
+	fakeServiceConfig := &confpb.Service{
+		Name: testProjectName,
+		Apis: []*apipb.Api{
+			{
+				Name: "testapipb",
+				Methods: []*apipb.Method{
+					{
+						Name: "local",
+					},
+					{
+						Name: "http1",
+					},
+					{
+						Name: "http2",
+					},
+					{
+						Name: "grpc",
+					},
+				},
+			},
+		},
+		Backend: &confpb.Backend{
+			Rules: []*confpb.BackendRule{
+				{
+					Selector: "testapipb.http1",
+					Address:  "https://http1.testapipb.com",
+				},
+				{
+					Selector: "testapipb.http2",
+					Address:  "https://http2.testapipb.com",
+					Protocol: "h2",
+				},
+				{
+					Selector: "testapipb.grpc",
+					Address:  "grpcs://grpc.testapipb.com",
+				},
+			},
+		},
+	}
+
+	testdata := []struct {
+		desc                string
+		backendAddress      string
+		wantHttpOnlyMethods []string
+	}{
+		{
+			desc:                "Local gRPC backend, only the method of the HTTP/1.1 remote backend is http only",
+			backendAddress:      "grpc://127.0.0.1:80",
+			wantHttpOnlyMethods: []string{"testapipb.http1"},
+		},
+		{
+			desc:                "Local HTTP/1.1 backend, the methods of the HTTP/1.1 backends are http only",
+			backendAddress:      "http://127.0.0.1:80",
+			wantHttpOnlyMethods: []string{"testapipb.http1", "testapipb.local"},
+		},
+	}
+
+	for _, tc := range testdata {
+		t.Run(tc.desc, func(t *testing.T) {
+			opts := options.DefaultConfigGeneratorOptions()
+			opts.BackendAddress = tc.backendAddress
+			fakeServiceInfo, err := configinfo.NewServiceInfoFromServiceConfig(fakeServiceConfig, testConfigID, opts)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			filter, methods, err := gmsFilterGenFunc(fakeServiceInfo)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if filter.GetName() != util.GrpcMetadataScrubber {
+				t.Errorf("got filter %q, want %q", filter.GetName(), util.GrpcMetadataScrubber)
+			}
+
+			var gotHttpOnlyMethods []string
+			for _, method := range methods {
+				gotHttpOnlyMethods = append(gotHttpOnlyMethods, method.Operation())
+			}
+			sort.Strings(gotHttpOnlyMethods)
+			if !reflect.DeepEqual(gotHttpOnlyMethods, tc.wantHttpOnlyMethods) {
+				t.Errorf("got http only methods %v, want %v", gotHttpOnlyMethods, tc.wantHttpOnlyMethods)
+			}
+		})
+	}
+}
+
+func TestGrpcMetadataScrubberPerRouteFilterConfig(t *testing.T) {
+	perRoute, err := gmsPerRouteFilterConfigGen(&configinfo.MethodInfo{}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	marshaler := &jsonpb.Marshaler{}
+	gotPerRoute, err := marshaler.MarshalToString(perRoute)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	wantPerRoute := `{
+  "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+  "httpOnly": true
+}`
+	if err := util.JsonEqual(wantPerRoute, gotPerRoute); err != nil {
+		t.Errorf("gmsPerRouteFilterConfigGen failed,\n%v", err)
+	}
+}
@@ -33,7 +33,8 @@ import (
 
 var scPerRouteFilterConfigGen = func(method *ci.MethodInfo, httpRule *httppattern.Pattern) (*anypb.Any, error) {
 	scPerRoute := &scpb.PerRouteFilterConfig{
-		OperationName: method.Operation(),
+		OperationName:      method.Operation(),
+		SkipServiceControl: method.SkipServiceControl,
 	}
 	scpr, err := ptypes.MarshalAny(scPerRoute)
 	if err != nil {
@@ -143,12 +143,9 @@ func MakeFilterGenerators(serviceInfo *ci.ServiceInfo) ([]*FilterGenerator, erro
 		// Add GrpcMetadataScrubber filter to retain gRPC trailers
 
 		filterGenerators = append(filterGenerators, &FilterGenerator{
-			FilterName: util.GrpcMetadataScrubber,
-			FilterGenFunc: func(sc *ci.ServiceInfo) (*hcmpb.HttpFilter, []*ci.MethodInfo, error) {
-				return &hcmpb.HttpFilter{
-					Name: util.GrpcMetadataScrubber,
-				}, nil, nil
-			},
+			FilterName:            util.GrpcMetadataScrubber,
+			FilterGenFunc:         gmsFilterGenFunc,
+			PerRouteConfigGenFunc: gmsPerRouteFilterConfigGen,
 		})
 	}
 
@@ -144,6 +144,10 @@ var (
 	ScQuotaRetries  = flag.Int("service_control_quota_retries", -1, `Set the retry times for service control Quota request. Must be >= 0 and the default is 1 if not set.`)
 	ScReportRetries = flag.Int("service_control_report_retries", -1, `Set the retry times for service control Report request. Must be >= 0 and the default is 5 if not set.`)
 
+	ScEnableHttp2          = flag.Bool("service_control_enable_http2", false, `Use HTTP/2 to call service control, so the Check, Quota and Report calls of a worker are multiplexed on a few long-lived connections.`)
+	ScMaxConcurrentStreams = flag.Uint("service_control_max_concurrent_streams", 0, `The maximum number of concurrent calls on one HTTP/2 connection to service control. A new connection is opened when it is reached. If 0, Envoy's default is used. Requires service_control_enable_http2.`)
+	ScKeepaliveIntervalMs  = flag.Int("service_control_keepalive_interval_ms", 0, `The interval in millisecond at which HTTP/2 PING frames are sent on idle connections to service control, so they are kept open and detected when broken. If 0, no PING frame is sent. Requires service_control_enable_http2.`)
+
 	ComputePlatformOverride = flag.String("compute_platform_override", "", "the overridden platform where the proxy is running at")
 
 	// Flags for testing purpose. They are not exposed to the user via start_proxy.py
@@ -259,6 +263,9 @@ func EnvoyConfigOptionsFromFlags() options.ConfigGeneratorOptions {
 		ScCheckRetries:                          *ScCheckRetries,
 		ScQuotaRetries:                          *ScQuotaRetries,
 		ScReportRetries:                         *ScReportRetries,
+		ScEnableHttp2:                           *ScEnableHttp2,
+		ScMaxConcurrentStreams:                  *ScMaxConcurrentStreams,
+		ScKeepaliveInterval:                     time.Duration(*ScKeepaliveIntervalMs) * time.Millisecond,
 		TranscodingAlwaysPrintPrimitiveFields:   *TranscodingAlwaysPrintPrimitiveFields,
 		TranscodingAlwaysPrintEnumsAsInts:       *TranscodingAlwaysPrintEnumsAsInts,
 		TranscodingPreserveProtoFieldNames:      *TranscodingPreserveProtoFieldNames,
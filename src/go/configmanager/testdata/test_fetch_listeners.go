@@ -2171,6 +2171,10 @@ var (
                         "timeout": "15s"
                       },
                       "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "envoy.filters.http.jwt_authn": {
                           "@type": "type.googleapis.com/envoy.extensions.filters.http.jwt_authn.v3.PerRouteConfig",
                           "requirementName": "1.echo_api_endpoints_cloudesf_testing_cloud_goog.Echo_Auth_Jwt"
@@ -2201,6 +2205,10 @@ var (
                         "timeout": "15s"
                       },
                       "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "envoy.filters.http.jwt_authn": {
                           "@type": "type.googleapis.com/envoy.extensions.filters.http.jwt_authn.v3.PerRouteConfig",
                           "requirementName": "1.echo_api_endpoints_cloudesf_testing_cloud_goog.Echo_Auth_Jwt"
@@ -2229,6 +2237,12 @@ var (
                           "retryOn": "reset,connect-failure,refused-stream"
                         },
                         "timeout": "15s"
+                      },
+                      "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        }
                       }
                     },
                     {
@@ -2253,6 +2267,12 @@ var (
                           "retryOn": "reset,connect-failure,refused-stream"
                         },
                         "timeout": "15s"
+                      },
+                      "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        }
                       }
                     },
                     {
@@ -2497,6 +2517,10 @@ var (
                         "timeout": "15s"
                       },
                       "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.service_control": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.service_control.PerRouteFilterConfig",
                           "operationName": "1.echo_api_endpoints_cloudesf_testing_cloud_goog.Simplegetcors"
@@ -2527,6 +2551,10 @@ var (
                         "timeout": "15s"
                       },
                       "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.service_control": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.service_control.PerRouteFilterConfig",
                           "operationName": "1.echo_api_endpoints_cloudesf_testing_cloud_goog.Simplegetcors"
@@ -2557,6 +2585,10 @@ var (
                         "timeout": "15s"
                       },
                       "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.service_control": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.service_control.PerRouteFilterConfig",
                           "operationName": "1.echo_api_endpoints_cloudesf_testing_cloud_goog.ESPv2_Autogenerated_CORS_simplegetcors"
@@ -2587,6 +2619,10 @@ var (
                         "timeout": "15s"
                       },
                       "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.service_control": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.service_control.PerRouteFilterConfig",
                           "operationName": "1.echo_api_endpoints_cloudesf_testing_cloud_goog.ESPv2_Autogenerated_CORS_simplegetcors"
@@ -321,6 +321,12 @@ var (
                           "retryOn": "reset,connect-failure,refused-stream"
                         },
                         "timeout": "15s"
+                      },
+                      "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        }
                       }
                     },
                     {
@@ -345,6 +351,12 @@ var (
                           "retryOn": "reset,connect-failure,refused-stream"
                         },
                         "timeout": "15s"
+                      },
+                      "typedPerFilterConfig": {
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        }
                       }
                     },
                     {
@@ -376,6 +388,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "https://us-central1-cloud-esf.cloudfunctions.net/hello"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/hello"
@@ -411,6 +427,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "https://us-central1-cloud-esf.cloudfunctions.net/hello"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/hello"
@@ -446,6 +466,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "1083071298623-e...t.apps.googleusercontent.com"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/api"
@@ -481,6 +505,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "1083071298623-e...t.apps.googleusercontent.com"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/api"
@@ -519,6 +547,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "1083071298623-e...t.apps.googleusercontent.com"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/api"
@@ -554,6 +586,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "1083071298623-e...t.apps.googleusercontent.com"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/api"
@@ -589,6 +625,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "1083071298623-e...t.apps.googleusercontent.com"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "pathPrefix": "/api"
@@ -624,6 +664,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "https://us-west2-cloud-esf.cloudfunctions.net/search"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "constantPath": {
@@ -661,6 +705,10 @@ var (
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.PerRouteFilterConfig",
                           "jwtAudience": "https://us-west2-cloud-esf.cloudfunctions.net/search"
                         },
+                        "com.google.espv2.filters.http.grpc_metadata_scrubber": {
+                          "@type": "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig",
+                          "httpOnly": true
+                        },
                         "com.google.espv2.filters.http.path_rewrite": {
                           "@type": "type.googleapis.com/espv2.api.envoy.v10.http.path_rewrite.PerRouteFilterConfig",
                           "constantPath": {
@@ -126,6 +126,11 @@ type ConfigGeneratorOptions struct {
 	ScQuotaRetries            int
 	ScReportRetries           int
 
+	// Service control cluster connection settings.
+	ScEnableHttp2          bool
+	ScMaxConcurrentStreams uint
+	ScKeepaliveInterval    time.Duration
+
 	ComputePlatformOverride string
 
 	TranscodingAlwaysPrintPrimitiveFields   bool
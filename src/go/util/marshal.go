@@ -22,6 +22,7 @@ import (
 	"github.com/golang/protobuf/proto"
 
 	bapb "github.com/GoogleCloudPlatform/esp-v2/src/go/proto/api/envoy/v10/http/backend_auth"
+	gmspb "github.com/GoogleCloudPlatform/esp-v2/src/go/proto/api/envoy/v10/http/grpc_metadata_scrubber"
 	prpb "github.com/GoogleCloudPlatform/esp-v2/src/go/proto/api/envoy/v10/http/path_rewrite"
 	scpb "github.com/GoogleCloudPlatform/esp-v2/src/go/proto/api/envoy/v10/http/service_control"
 
@@ -97,6 +98,8 @@ var Resolver = FuncResolver(func(url string) (proto.Message, error) {
 		return new(bapb.PerRouteFilterConfig), nil
 	case "type.googleapis.com/espv2.api.envoy.v10.http.backend_auth.FilterConfig":
 		return new(bapb.FilterConfig), nil
+	case "type.googleapis.com/espv2.api.envoy.v10.http.grpc_metadata_scrubber.PerRouteFilterConfig":
+		return new(gmspb.PerRouteFilterConfig), nil
 	case "type.googleapis.com/envoy.extensions.filters.http.router.v3.Router":
 		return new(routerpb.Router), nil
 	case "type.googleapis.com/envoy.extensions.transport_sockets.tls.v3.UpstreamTlsContext":
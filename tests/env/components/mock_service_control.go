@@ -51,6 +51,12 @@ type MockServiceCtrl struct {
 	quotaHandler       http.Handler
 	reportHandler      http.Handler
 	getRequestsTimeout time.Duration
+
+	// The load settings, read by the handlers while serving.
+	skipRecording   int32
+	responseLatency int64
+	failEvery       int32
+	failStatus      int32
 }
 
 type serviceHandler struct {
@@ -64,9 +70,19 @@ func (h *serviceHandler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 		ReqType:   h.resp.reqType,
 		ReqHeader: r.Header,
 	}
-	atomic.AddInt32(h.m.count, 1)
+	count := atomic.AddInt32(h.m.count, 1)
 	req.ReqBody, _ = ioutil.ReadAll(r.Body)
-	h.m.ch <- req
+	if atomic.LoadInt32(&h.m.skipRecording) == 0 {
+		h.m.ch <- req
+	}
+
+	if latency := atomic.LoadInt64(&h.m.responseLatency); latency > 0 {
+		time.Sleep(time.Duration(latency))
+	}
+	if failEvery := atomic.LoadInt32(&h.m.failEvery); failEvery > 0 && count%failEvery == 0 {
+		w.WriteHeader(int(atomic.LoadInt32(&h.m.failStatus)))
+		return
+	}
 
 	if h.resp.respStatusCode != 0 {
 		w.WriteHeader(h.resp.respStatusCode)
@@ -213,6 +229,28 @@ func (m *MockServiceCtrl) SetGetRequestsTimeout(timeout time.Duration) {
 	m.getRequestsTimeout = timeout
 }
 
+// SetLoadMode stops keeping the requests for GetRequests, so the server can
+// take more than it buffers, as under load.
+func (m *MockServiceCtrl) SetLoadMode(enabled bool) {
+	var skipRecording int32
+	if enabled {
+		skipRecording = 1
+	}
+	atomic.StoreInt32(&m.skipRecording, skipRecording)
+}
+
+// SetResponseLatency delays each response of the service control by latency.
+func (m *MockServiceCtrl) SetResponseLatency(latency time.Duration) {
+	atomic.StoreInt64(&m.responseLatency, int64(latency))
+}
+
+// SetFailEvery fails every n-th request of the service control with status,
+// none if n is 0. The requests are counted by GetRequestCount.
+func (m *MockServiceCtrl) SetFailEvery(n int, status int) {
+	atomic.StoreInt32(&m.failStatus, int32(status))
+	atomic.StoreInt32(&m.failEvery, int32(n))
+}
+
 // SetCheckResponse sets the response for the check of the service control.
 func (m *MockServiceCtrl) SetCheckResponse(checkResponse *scpb.CheckResponse) {
 	req_b, _ := proto.Marshal(checkResponse)
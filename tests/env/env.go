@@ -188,6 +188,11 @@ func (e *TestEnv) Ports() *platform.Ports {
 	return e.ports
 }
 
+// EnvoyPid returns the process id of the Envoy started by Setup.
+func (e *TestEnv) EnvoyPid() int {
+	return e.envoy.Process.Pid
+}
+
 // OverrideAuthentication overrides Service.Authentication.
 func (e *TestEnv) OverrideAuthentication(authentication *confpb.Authentication) {
 	e.fakeServiceConfig.Authentication = authentication
@@ -546,7 +551,7 @@ func (e *TestEnv) StopBackendServer() error {
 }
 
 // TearDown shutdown the servers.
-func (e *TestEnv) TearDown(t *testing.T) {
+func (e *TestEnv) TearDown(t testing.TB) {
 	glog.Infof("start tearing down...")
 
 	// Run all health checks. If they fail, our test causes a server to crash.
@@ -62,6 +62,7 @@ const (
 	TestDynamicRoutingEscapeSlashes
 	TestDynamicRoutingPathPreprocessing
 	TestDynamicRoutingWithAllowCors
+	TestFilterChainBenchmark
 	TestFrontendAndBackendAuthHeaders
 	TestGeneratedHeaders
 	TestGRPC
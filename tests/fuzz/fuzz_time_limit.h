@@ -0,0 +1,79 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "source/common/common/assert.h"
+#include "source/common/common/logger.h"
+
+namespace espv2 {
+namespace tests {
+namespace fuzz {
+
+// The environment variable with the time limit of each call, in
+// milliseconds. A fuzz test that is not given one is not timed.
+constexpr char kFuzzTimeLimitEnv[] = "ESPV2_FUZZ_TIME_LIMIT_MS";
+
+// Times one call of the code under test, for the whole scope it lives in,
+// and crashes the fuzz test if the call took longer than the limit. Replaying
+// a corpus with a limit flags the inputs with a pathological run time, such
+// as the ones that hit a super-linear path, along with the crashing ones.
+class FuzzTimeLimit {
+ public:
+  // `call` names the call in the crash message, with its input.
+  explicit FuzzTimeLimit(absl::string_view call)
+      : call_(call), start_(std::chrono::steady_clock::now()) {}
+
+  ~FuzzTimeLimit() {
+    const std::chrono::milliseconds limit = timeLimit();
+    if (limit.count() == 0) {
+      return;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_);
+    ENVOY_LOG_MISC(debug, "{} took {}ms", call_, elapsed.count());
+    RELEASE_ASSERT(elapsed <= limit,
+                   absl::StrCat(call_, " took ", elapsed.count(),
+                                "ms, over the limit of ", limit.count(),
+                                "ms"));
+  }
+
+  // Returns the limit, or zero if none is set.
+  static std::chrono::milliseconds timeLimit() {
+    static const std::chrono::milliseconds limit = [] {
+      const char* value = std::getenv(kFuzzTimeLimitEnv);
+      uint64_t limit_ms = 0;
+      if (value != nullptr && !absl::SimpleAtoi(value, &limit_ms)) {
+        limit_ms = 0;
+      }
+      return std::chrono::milliseconds(limit_ms);
+    }();
+    return limit;
+  }
+
+ private:
+  const std::string call_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace fuzz
+}  // namespace tests
+}  // namespace espv2
@@ -0,0 +1,317 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Package filter_chain_benchmark_test measures the throughput and latency of
+// Envoy with the ESPv2 filters in front of the bookstore backend, with the
+// mock service control answering with configurable latency and errors.
+//
+// The benchmarks are not run by the integration tests. Run them with
+//
+//	go test ./tests/integration_test/filter_chain_benchmark_test/ \
+//	    -run xxx -bench . --benchmark_results=results.json
+//
+// Each scenario reports req/s, the p50, p99 and p99.9 latencies and the CPU
+// time of Envoy per request, in microseconds. The results of the last run of
+// each scenario are also written to --benchmark_results, one JSON object per
+// line, for trend tracking.
+package filter_chain_benchmark_test
+
+import (
+	"context"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/GoogleCloudPlatform/esp-v2/tests/env"
+	"github.com/GoogleCloudPlatform/esp-v2/tests/env/platform"
+	"google.golang.org/grpc"
+	"google.golang.org/grpc/metadata"
+
+	bsgrpcv1 "github.com/GoogleCloudPlatform/esp-v2/tests/endpoints/bookstore_grpc/proto/v1"
+	confpb "google.golang.org/genproto/googleapis/api/serviceconfig"
+)
+
+var (
+	resultsPath  = flag.String("benchmark_results", "", "file to write the results to, one JSON object per scenario")
+	concurrency  = flag.Int("benchmark_concurrency", 16, "the number of requests in flight")
+	checkLatency = flag.Duration("benchmark_check_latency", 5*time.Millisecond, "the latency of the service control in the latency scenario")
+)
+
+// The clock ticks of /proc/<pid>/stat, USER_HZ on Linux.
+const clockTicksPerSecond = 100
+
+type scenario struct {
+	name string
+	// The bookstore method: a path for HTTP, a gRPC method name for gRPC.
+	method string
+	grpc   bool
+	// The API key of the i-th request.
+	apiKey func(i int64) string
+	// The latency and the errors of the service control.
+	latency   time.Duration
+	failEvery int
+}
+
+func sameAPIKey(int64) string { return "api-key" }
+
+func uniqueAPIKey(i int64) string { return "api-key-" + strconv.FormatInt(i, 10) }
+
+func scenarios() []scenario {
+	return []scenario{
+		// The check is answered from the cache.
+		{name: "cache_hit", method: "/v1/shelves", apiKey: sameAPIKey},
+		// Every request needs a check.
+		{name: "cache_miss", method: "/v1/shelves", apiKey: uniqueAPIKey},
+		// GetShelf has a quota metric rule, so requests also allocate quota.
+		{name: "quota", method: "/v1/shelves/100", apiKey: sameAPIKey},
+		{name: "cache_miss_slow_check", method: "/v1/shelves", apiKey: uniqueAPIKey, latency: *checkLatency},
+		// One service control call in 10 fails with a 503.
+		{name: "cache_miss_check_errors", method: "/v1/shelves", apiKey: uniqueAPIKey, failEvery: 10},
+		// The service control filter handles gRPC calls as streams, with
+		// intermediate reports.
+		{name: "grpc_stream", method: "ListShelves", grpc: true, apiKey: sameAPIKey},
+	}
+}
+
+type result struct {
+	Scenario              string  `json:"scenario"`
+	Requests              int     `json:"requests"`
+	Errors                int64   `json:"errors"`
+	RequestsPerSecond     float64 `json:"requests_per_second"`
+	P50Micros             float64 `json:"p50_us"`
+	P99Micros             float64 `json:"p99_us"`
+	P999Micros            float64 `json:"p99_9_us"`
+	EnvoyCPUMicrosPerCall float64 `json:"envoy_cpu_us_per_request"`
+}
+
+var (
+	resultsMu sync.Mutex
+	// The last run of each scenario, by name.
+	results = map[string]result{}
+)
+
+func TestMain(m *testing.M) {
+	flag.Parse()
+	code := m.Run()
+	if err := writeResults(); err != nil {
+		fmt.Fprintf(os.Stderr, "fail to write the benchmark results: %v\n", err)
+		code = 1
+	}
+	os.Exit(code)
+}
+
+func writeResults() error {
+	if *resultsPath == "" || len(results) == 0 {
+		return nil
+	}
+	names := make([]string, 0, len(results))
+	for name := range results {
+		names = append(names, name)
+	}
+	sort.Strings(names)
+
+	var lines []string
+	for _, name := range names {
+		line, err := json.Marshal(results[name])
+		if err != nil {
+			return err
+		}
+		lines = append(lines, string(line))
+	}
+	return ioutil.WriteFile(*resultsPath, []byte(strings.Join(lines, "\n")+"\n"), 0644)
+}
+
+func BenchmarkFilterChain(b *testing.B) {
+	args := []string{"--service_config_id=test-config-id",
+		"--rollout_strategy=fixed", "--suppress_envoy_headers"}
+
+	s := env.NewTestEnv(platform.TestFilterChainBenchmark, platform.GrpcBookstoreSidecar)
+	s.OverrideQuota(&confpb.Quota{
+		MetricRules: []*confpb.MetricRule{
+			{
+				Selector: "endpoints.examples.bookstore.Bookstore.GetShelf",
+				MetricCosts: map[string]int64{
+					"metrics_first": 1,
+				},
+			},
+		},
+	})
+	defer s.TearDown(b)
+	if err := s.Setup(args); err != nil {
+		b.Fatalf("fail to setup test env, %v", err)
+	}
+	s.ServiceControlServer.SetLoadMode(true)
+
+	addr := fmt.Sprintf("%v:%v", platform.GetLoopbackAddress(), s.Ports().ListenerPort)
+	httpClient := &http.Client{
+		Transport: &http.Transport{
+			MaxIdleConnsPerHost: *concurrency,
+		},
+	}
+	conn, err := grpc.Dial(addr, grpc.WithInsecure())
+	if err != nil {
+		b.Fatalf("fail to connect to Envoy, %v", err)
+	}
+	defer conn.Close()
+	grpcClient := bsgrpcv1.NewBookstoreClient(conn)
+
+	for _, sc := range scenarios() {
+		sc := sc
+		b.Run(sc.name, func(b *testing.B) {
+			s.ServiceControlServer.SetResponseLatency(sc.latency)
+			s.ServiceControlServer.SetFailEvery(sc.failEvery, http.StatusServiceUnavailable)
+			defer s.ServiceControlServer.SetResponseLatency(0)
+			defer s.ServiceControlServer.SetFailEvery(0, 0)
+
+			call := func(i int64) error {
+				if sc.grpc {
+					ctx := metadata.AppendToOutgoingContext(context.Background(), "x-api-key", sc.apiKey(i))
+					_, err := grpcClient.ListShelves(ctx, &bsgrpcv1.Empty{})
+					return err
+				}
+				return doHTTP(httpClient, fmt.Sprintf("http://%s%s?key=%s", addr, sc.method, sc.apiKey(i)))
+			}
+			run(b, sc.name, s.EnvoyPid(), call)
+		})
+	}
+}
+
+func doHTTP(client *http.Client, url string) error {
+	resp, err := client.Get(url)
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+	// Read the whole body, so the connection is reused.
+	if _, err := io.Copy(ioutil.Discard, resp.Body); err != nil {
+		return err
+	}
+	if resp.StatusCode != http.StatusOK {
+		return fmt.Errorf("http response status is not 200 OK: %s", resp.Status)
+	}
+	return nil
+}
+
+// run makes b.N calls, *concurrency at a time, and reports their results.
+func run(b *testing.B, name string, envoyPid int, call func(i int64) error) {
+	latencies := make([]time.Duration, b.N)
+	var next, errors int64
+
+	cpuBefore, err := processCPUTime(envoyPid)
+	if err != nil {
+		b.Fatalf("fail to read the CPU time of Envoy, %v", err)
+	}
+	b.ResetTimer()
+	start := time.Now()
+
+	var wg sync.WaitGroup
+	for w := 0; w < *concurrency; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for {
+				i := atomic.AddInt64(&next, 1) - 1
+				if i >= int64(b.N) {
+					return
+				}
+				callStart := time.Now()
+				if err := call(i); err != nil {
+					atomic.AddInt64(&errors, 1)
+				}
+				latencies[i] = time.Since(callStart)
+			}
+		}()
+	}
+	wg.Wait()
+
+	elapsed := time.Since(start)
+	b.StopTimer()
+	cpuAfter, err := processCPUTime(envoyPid)
+	if err != nil {
+		b.Fatalf("fail to read the CPU time of Envoy, %v", err)
+	}
+
+	sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+	r := result{
+		Scenario:              name,
+		Requests:              b.N,
+		Errors:                errors,
+		RequestsPerSecond:     float64(b.N) / elapsed.Seconds(),
+		P50Micros:             percentileMicros(latencies, 0.5),
+		P99Micros:             percentileMicros(latencies, 0.99),
+		P999Micros:            percentileMicros(latencies, 0.999),
+		EnvoyCPUMicrosPerCall: float64((cpuAfter - cpuBefore).Microseconds()) / float64(b.N),
+	}
+	b.ReportMetric(r.RequestsPerSecond, "req/s")
+	b.ReportMetric(r.P50Micros, "p50-us")
+	b.ReportMetric(r.P99Micros, "p99-us")
+	b.ReportMetric(r.P999Micros, "p99.9-us")
+	b.ReportMetric(r.EnvoyCPUMicrosPerCall, "envoy-cpu-us/req")
+	b.ReportMetric(float64(errors)/float64(b.N), "errors/req")
+
+	resultsMu.Lock()
+	results[name] = r
+	resultsMu.Unlock()
+}
+
+// percentileMicros returns the p quantile of the sorted latencies.
+func percentileMicros(sorted []time.Duration, p float64) float64 {
+	if len(sorted) == 0 {
+		return 0
+	}
+	i := int(p * float64(len(sorted)))
+	if i >= len(sorted) {
+		i = len(sorted) - 1
+	}
+	return float64(sorted[i].Nanoseconds()) / 1e3
+}
+
+// processCPUTime returns the user and system CPU time of the process, from
+// /proc/<pid>/stat.
+func processCPUTime(pid int) (time.Duration, error) {
+	stat, err := ioutil.ReadFile(fmt.Sprintf("/proc/%d/stat", pid))
+	if err != nil {
+		return 0, err
+	}
+	// The fields after the command name, which is in parentheses, start with
+	// the state, the third field. utime and stime are the 14th and 15th.
+	end := strings.LastIndexByte(string(stat), ')')
+	if end < 0 {
+		return 0, fmt.Errorf("invalid stat: %s", stat)
+	}
+	fields := strings.Fields(string(stat[end+1:]))
+	if len(fields) < 13 {
+		return 0, fmt.Errorf("invalid stat: %s", stat)
+	}
+	var ticks int64
+	for _, field := range fields[11:13] {
+		n, err := strconv.ParseInt(field, 10, 64)
+		if err != nil {
+			return 0, err
+		}
+		ticks += n
+	}
+	return time.Duration(ticks) * time.Second / clockTicksPerSecond, nil
+}
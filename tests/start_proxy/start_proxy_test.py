@@ -102,6 +102,20 @@ class TestStartProxy(unittest.TestCase):
               '--check_metadata', '--underscores_in_headers',
               '--disable_tracing'
               ]),
+            # service control HTTP/2
+            (['-R=managed', '--http_port=8079',
+              '--service_control_enable_http2',
+              '--service_control_max_concurrent_streams=100',
+              '--service_control_keepalive_interval_ms=30000',
+              '--disable_tracing'],
+             ['bin/configmanager', '--logtostderr', '--rollout_strategy', 'managed',
+              '--backend_address', 'http://127.0.0.1:8082', '--v', '0',
+              '--listener_port', '8079',
+              '--service_control_enable_http2',
+              '--service_control_max_concurrent_streams', '100',
+              '--service_control_keepalive_interval_ms', '30000',
+              '--disable_tracing'
+              ]),
             # enable_jwks_async_fetch
             (['-R=managed','--disable_jwks_async_fetch',
               '--http_port=8079', '--service_control_quota_retries=3',